@@ -0,0 +1,76 @@
+/**
+ * @file rules.c
+ * @brief An example of embedding slo in a C program as a rules engine.
+ *
+ * The rules are compiled once and their function is called for each event.
+ * Build it with `make embed` and run build/rules.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "core/embed.h"
+
+static const char* rules =
+    "final var RISKY = {\"XX\": true, \"YY\": true};\n"
+    "\n"
+    "func score(amount, country) {\n"
+    "    var score = amount / 100;\n"
+    "    if (RISKY.get(country, false)) {\n"
+    "        score *= 3;\n"
+    "    }\n"
+    "    return score;\n"
+    "}\n";
+
+/**
+ * @struct Event
+ */
+typedef struct Event {
+    double amount;
+    const char* country;
+} Event;
+
+int main(void) {
+    static VM sloVM;
+    initVM(&sloVM);
+
+    Value script;
+    Value score;
+    if (!sloCompile(rules, "rules.slo", &script) || sloRun(script) != INTERPRET_OK
+            || !sloFunction("score", &score)) {
+        return 1;
+    }
+
+    Event events[] = {{250, "GB"}, {80, "XX"}, {1200, "FR"}, {40, "YY"}};
+    int eventCount = sizeof(events) / sizeof(events[0]);
+    for (int i = 0; i < eventCount; i++) {
+        Value result;
+        double value;
+        sloPushNumber(events[i].amount);
+        sloPushString(events[i].country);
+        if (!sloCall(score, 2, &result) || !sloToNumber(result, &value)) {
+            return 1;
+        }
+        printf("%s %g -> %g\n", events[i].country, events[i].amount, value);
+    }
+
+    int calls = 1000000;
+    double total = 0;
+    clock_t start = clock();
+    for (int i = 0; i < calls; i++) {
+        Value result;
+        double value;
+        sloPushNumber(i % 500);
+        sloPush(OBJ_VAL(copyString("GB", 2)));
+        if (sloCall(score, 2, &result) && sloToNumber(result, &value)) {
+            total += value;
+        }
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("%d calls, total %g, %.0f calls a second\n", calls, total, calls / seconds);
+
+    sloRelease(score);
+    sloRelease(script);
+    freeVM();
+    return 0;
+}
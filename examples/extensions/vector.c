@@ -0,0 +1,86 @@
+/**
+ * @file vector.c
+ * @brief An example native extension adding vector functions to slo.
+ *
+ * Build it with `make extensions` and import it with SLO_PATH pointing at
+ * build/extensions:
+ *
+ *     import vector;
+ *     print(vector.dot([1, 2, 3], [4, 5, 6]));  # 32
+ *     print(vector.scale([1, 2, 3], 2));        # [2, 4, 6]
+ */
+
+#include "core/extension.h"
+#include "core/vm.h"
+
+static Value dotNative(int argCount, Value* args, ParamInfo* params);
+static Value scaleNative(int argCount, Value* args, ParamInfo* params);
+
+static NativeDef vectorNatives[] = {
+    {"dot", dotNative, 2, 2, {{"a", true}, {"b", true}}},
+    {"scale", scaleNative, 2, 2, {{"values", true}, {"factor", true}}},
+    {NULL}
+};
+
+SloExtension* sloExtensionInit(void) {
+    static SloExtension extension = SLO_EXTENSION(vectorNatives);
+    return &extension;
+}
+
+/**
+ * Method for checking a value is a list of numbers.
+ */
+static bool isNumberList(Value value) {
+    if (!IS_LIST(value)) {
+        return false;
+    }
+    ObjList* list = AS_LIST(value);
+    for (int i = 0; i < list->values.count; i++) {
+        if (!IS_NUMBER(list->values.values[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * dot native function.
+ * Returns the dot product of two lists of numbers of the same length.
+ */
+static Value dotNative(int argCount, Value* args, ParamInfo* params) {
+    if (!isNumberList(args[0]) || !isNumberList(args[1])) {
+        return ERROR_VAL_PTR("dot() expects two lists of numbers.");
+    }
+    ValueArray* a = &AS_LIST(args[0])->values;
+    ValueArray* b = &AS_LIST(args[1])->values;
+    if (a->count != b->count) {
+        return ERROR_VAL_PTR("dot() expects lists of the same length.");
+    }
+    double total = 0;
+    for (int i = 0; i < a->count; i++) {
+        total += AS_NUMBER(a->values[i]) * AS_NUMBER(b->values[i]);
+    }
+    return NUMBER_VAL(total);
+}
+
+/**
+ * scale native function.
+ * Returns a new list with every number multiplied by the factor.
+ */
+static Value scaleNative(int argCount, Value* args, ParamInfo* params) {
+    if (!isNumberList(args[0]) || !IS_NUMBER(args[1])) {
+        return ERROR_VAL_PTR("scale() expects a list of numbers and a number.");
+    }
+    ValueArray* values = &AS_LIST(args[0])->values;
+    double factor = AS_NUMBER(args[1]);
+
+    ObjList* result = newList();
+    // rooted while it grows, as growing it can collect
+    push(OBJ_VAL(result));
+    for (int i = 0; i < values->count; i++) {
+        writeValueArray(&result->values, NUMBER_VAL(AS_NUMBER(values->values[i]) * factor));
+    }
+    result->count = result->values.count;
+    pop();
+    return OBJ_VAL(result);
+}
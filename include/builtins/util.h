@@ -17,6 +17,13 @@
  */
 void defineBuiltIn(Table* tbl, const char* name, NativeFn function, int arityMin, int arityMax, ParamInfo* params);
 
+/**
+ * Method for looking up a method of a class or module with lazily created natives.
+ *
+ * Checks methods first and, failing that, creates the native from its
+ * NativeDef and adds it to methods so it's only created once.
+ */
+bool lookupNative(Obj* owner, Table* methods, NativeDef* natives, ObjString* name, Value* value);
 
 /**
  *
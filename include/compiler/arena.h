@@ -0,0 +1,78 @@
+/**
+ * @file arena.h
+ *
+ * A bump allocator for the compiler's bookkeeping: locals, upvalues and
+ * the jumps waiting to be patched. Nothing's freed on its own and arrays
+ * that grow just leave their old space behind, unless they're the last
+ * thing allocated and can grow where they are. Instead everything since a
+ * mark can be given back at once, as a function's compiler is when it's
+ * finished, and the rest's freed when the compile is.
+ *
+ * It's plain malloc'd memory, outside of what the collector counts.
+ */
+
+#ifndef cslo_arena_h
+#define cslo_arena_h
+
+#include <stddef.h>
+
+#include "core/common.h"
+
+// how much each block holds, unless something bigger needs a block to itself
+#define ARENA_BLOCK_SIZE (16 * 1024)
+
+typedef struct ArenaBlock ArenaBlock;
+
+/**
+ * @struct Arena
+ */
+typedef struct Arena {
+    // the block being allocated from, with the full ones after it
+    ArenaBlock* blocks;
+    // blocks given back by a reset, to be used again before allocating more
+    ArenaBlock* spare;
+} Arena;
+
+/**
+ * @struct ArenaMark
+ *
+ * How far into an arena it's been allocated, to be reset back to.
+ */
+typedef struct ArenaMark {
+    ArenaBlock* block;
+    size_t used;
+} ArenaMark;
+
+/**
+ * Method for initialising an arena, which allocates nothing until it's used.
+ */
+void initArena(Arena* arena);
+
+/**
+ * Method for allocating from an arena.
+ */
+void* arenaAllocate(Arena* arena, size_t size);
+
+/**
+ * Method for growing an array allocated from an arena, returning where it now is.
+ *
+ * The capacity's grown as GROW_CAPACITY would and written back.
+ */
+void* arenaGrowArray(Arena* arena, void* array, int* capacity, size_t itemSize);
+
+/**
+ * Method for marking how far into an arena it's been allocated.
+ */
+ArenaMark arenaMark(Arena* arena);
+
+/**
+ * Method for giving back everything allocated from an arena since a mark.
+ */
+void arenaReset(Arena* arena, ArenaMark mark);
+
+/**
+ * Method for freeing everything allocated from an arena.
+ */
+void freeArena(Arena* arena);
+
+#endif  // cslo_arena_h
@@ -12,7 +12,16 @@
 #include "core/chunk.h"
 #include "core/value.h"
 
-#endif
+/**
+ * @struct CodeMark
+ *
+ * A position in the current chunk's code and constants that can be rewound to.
+ */
+typedef struct CodeMark {
+    int offset;
+    int constantCount;
+    int handlerCount;
+} CodeMark;
 
 /**
  * @file codegen.c
@@ -37,6 +46,16 @@ void emitByte(uint8_t byte, int line);
  */
 void emitBytes(uint8_t byte1, uint8_t byte2);
 
+/**
+ * Method for emitting an instruction with a two byte operand.
+ */
+void emitShortOp(uint8_t op, uint16_t operand);
+
+/**
+ * Method for emitting the operand for a new inline cache.
+ */
+void emitInlineCache();
+
 /**
  * Method for emitting a loop instruction.
  */
@@ -53,9 +72,11 @@ int emitJump(uint8_t instruction);
 void emitReturn();
 
 /**
- * makeConstant
+ * Method for adding a constant to the chunk, returning its index.
+ *
+ * A constant that's already in the chunk is reused rather than added again.
  */
-uint8_t makeConstant(Value value);
+uint16_t makeConstant(Value value);
 
 /**
  * Method for writing a constant to the chunk.
@@ -66,3 +87,25 @@ void emitConstant(Value value);
  * Method for returning the current compiling chunk.
  */
 Chunk* currentChunk();
+
+/**
+ * Method for writing a literal value to the chunk.
+ */
+void emitLiteral(Value value);
+
+/**
+ * Method for getting the current position in the chunk.
+ */
+CodeMark markCode();
+
+/**
+ * Method for checking whether the code since the given mark is a single literal.
+ */
+bool constantExpression(CodeMark mark, Value* value);
+
+/**
+ * Method for discarding everything emitted since the given mark.
+ */
+void rewindCode(CodeMark mark);
+
+#endif
@@ -5,6 +5,7 @@
 #ifndef cslo_compiler_h
 #define cslo_compiler_h
 
+#include "compiler/arena.h"
 #include "parser/parser.h"
 #include "core/object.h"
 #include "scanner.h"
@@ -18,8 +19,22 @@ typedef struct Local {
     int depth;
     bool isCaptured;
     bool isFinal;
+    // where the list or dict literal it was declared with was emitted, while nothing
+    // it's been used for lets that escape the frame, otherwise -1
+    int literal;
 } Local;
 
+/**
+ * @struct LocalPop
+ *
+ * A pop a break or continue emitted for a local that's still holding a literal
+ * that may turn out never to escape, to become an OP_POP_LOCAL if it doesn't.
+ */
+typedef struct LocalPop {
+    int offset;
+    int local;
+} LocalPop;
+
 /**
  * @struct Upvalue
  */
@@ -29,6 +44,40 @@ typedef struct Upvalue {
     bool isFinal;
 } Upvalue;
 
+#define MAX_FINALLY_EXITS 56
+
+/**
+ * @struct TryStatement
+ *
+ * A try statement whose block or except clauses are being compiled.
+ * A break, continue or return jumping out of it runs its finally clause
+ * first, compiled again from the source where the jump is. The code that
+ * does so is outside the try statement, so it's cut out of the ranges its
+ * handlers are added for, and jumps as the clause would after it.
+ */
+typedef struct TryStatement {
+    struct TryStatement* enclosing;
+    // the locals and scope depth it starts with
+    int depth;
+    int scopeDepth;
+    bool hasFinally;
+    // whether compiling a copy of its finally clause reported an error
+    bool failed;
+    // the '{' its finally clause starts with
+    Token finally;
+    // the [start, end) of the code run for the finally clauses of those it's in
+    int exits[MAX_FINALLY_EXITS][2];
+    int exitCount;
+    // the loop it's in, which a break or continue in a copy of its finally clause
+    // jumps in, and those jumps, for the loop to patch once it's the innermost again
+    int loopStart;
+    int loopScopeDepth;
+    int breakJumps[MAX_FINALLY_EXITS];
+    int breakCount;
+    int continueJumps[MAX_FINALLY_EXITS];
+    int continueCount;
+} TryStatement;
+
 /**
  * @enum FunctionType
  */
@@ -41,22 +90,56 @@ typedef enum FunctionType {
 
 /**
  * @struct Compiler
+ *
+ * Its arrays are allocated from the compile's arena, growing as they're
+ * needed, so a compiler takes up little of the C stack however deeply
+ * functions are nested, and given back when its function's finished. Locals and upvalues are still limited to
+ * UINT8_COUNT, as their slots are emitted as a byte.
  */
 typedef struct Compiler {
     struct Compiler* enclosing;
     ObjFunction* function;
     FunctionType type;
+    // how far into the arena it was when the compiler started
+    ArenaMark mark;
+    // whether an enclosing compiler's array was grown into its part of the arena, so it can't be given back
+    bool keepArena;
 
-    Local locals[UINT8_COUNT];
+    Local* locals;
     int localCount;
-    Upvalue upvalues[UINT8_COUNT];
+    int localCapacity;
+    Upvalue* upvalues;
+    int upvalueCapacity;
     int scopeDepth;
     int innermostLoopStart;
     int innermostLoopScopeDepth;
-    int continueJumps[256];
+    // the breaks and continues waiting to be patched, those of the innermost loop last
+    int* continueJumps;
     int continueCount;
-    int breakJumps[256];
+    int continueCapacity;
+    int* breakJumps;
     int breakCount;
+    int breakCapacity;
+    // where the last OP_CALL was emitted, so a return of it can become a tail call
+    int lastCall;
+    // where the last OP_GET_PROPERTY was emitted, so calling what it gets can become an invoke
+    int lastGetProperty;
+    // the last offset a forward jump was patched to land on
+    int lastJumpTarget;
+    // the try statement the code's in, where calls can't become tail calls, or NULL
+    TryStatement* innermostTry;
+    // where the last list or dict literal was emitted and where it starts in the source
+    int lastLiteral;
+    const char* lastLiteralStart;
+    LocalPop* localPops;
+    int localPopCount;
+    int localPopCapacity;
+    // whether any literal was made local to the frame, so its returns need to free them
+    bool hasLocalObjects;
+    // an open addressed hash index into the chunk's constants, so equal ones are only added once
+    int* constantIndex;
+    int constantIndexCapacity;
+    int constantIndexCount;
 } Compiler;
 
 /**
@@ -67,15 +150,23 @@ typedef struct ClassCompiler {
     bool hasSuperClass;
 } ClassCompiler;
 
-extern Compiler* current;
-extern ClassCompiler* currentClass;
-extern Token lastVariableToken;
+extern THREAD_LOCAL Compiler* current;
+extern THREAD_LOCAL ClassCompiler* currentClass;
+extern THREAD_LOCAL Token lastVariableToken;
 
 /**
  * Method for compiling slo code into bytecode.
  */
 ObjFunction* compile(const char* source, const char* file);
 
+/**
+ * Method for compiling a module's slo code into bytecode.
+ *
+ * The module's globals are named after it ("module.name") so they don't
+ * clash with those of the scripts that import it.
+ */
+ObjFunction* compileModule(const char* source, const char* file, ObjString* module);
+
 Token syntheticToken(const char* text);
 void namedVariable(Token name, bool canAssign);
 
@@ -108,7 +199,7 @@ uint8_t argumentList();
 /**
  * Method for parsing a variable.
  */
-uint8_t parseVariable(bool isFinal, const char* errorMessage);
+uint16_t parseVariable(bool isFinal, const char* errorMessage);
 
 /**
  * Method for marking a local variable initialised.
@@ -118,7 +209,7 @@ void markInitialized();
 /**
  * Method for defining a variale.
  */
-void defineVariable(uint8_t global, bool isFinal);
+void defineVariable(uint16_t global, bool isFinal);
 
 /**
  * Method for resolving an upvalue variable.
@@ -130,6 +221,21 @@ int resolveUpvalue(Compiler* compiler, Token* name);
  */
 void addLocal(Token name, bool isFinal);
 
+/**
+ * Method for adding a break's jump, to be patched at the end of its loop.
+ */
+void addBreakJump(int jump);
+
+/**
+ * Method for adding a continue's jump, to be patched at the end of its loop's body.
+ */
+void addContinueJump(int jump);
+
+/**
+ * Method for adding a pop a break or continue emitted for a local holding a literal.
+ */
+void addLocalPop(int offset, int local);
+
 /**
  * Method for declaring a variable.
  */
@@ -138,7 +244,17 @@ void declareVariable(bool isFinal);
 /**
  * Method for identifying a constant.
  */
-uint8_t identifierConstant(Token* name);
+uint16_t identifierConstant(Token* name);
+
+/**
+ * Method for resolving a global variable to its slot in the VM.
+ */
+uint16_t resolveGlobal(Token* name);
+
+/**
+ * Method for emitting a get/set for a local, upvalue or global variable.
+ */
+void emitVariableOp(uint8_t op, int arg);
 
 /**
  * Method for comparing two identifiers.
@@ -155,6 +271,11 @@ int resolveLocal(Compiler* compiler, Token* name);
  */
 int addUpvalue(Compiler* compiler, uint8_t index, bool isLocal, bool isFinal);
 
+/**
+ * Method for noting a list or dict literal that opened at start was just emitted.
+ */
+void markLiteral(const char* start);
+
 /**
  * Method for beginning a block's scope.
  */
@@ -170,6 +291,11 @@ void endScope();
  */
 void varDeclaration(bool isFinal);
 
+/**
+ * Method for compiling a list or dict comprehension, after its opening bracket.
+ */
+void comprehension(bool isDict);
+
 /**
  * Method for compiling classes.
  */
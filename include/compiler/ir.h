@@ -0,0 +1,123 @@
+/**
+ * @file ir.h
+ *
+ * The form a finished chunk's code is lifted into for the optimiser's passes.
+ */
+
+#ifndef cslo_ir_h
+#define cslo_ir_h
+
+#include <stdint.h>
+
+#include "core/chunk.h"
+
+/**
+ * @struct IrInstruction
+ *
+ * One instruction of the code.
+ *
+ * A jump holds the index of the instruction it lands on rather than an
+ * offset, so instructions can be rewritten or removed without fixing up
+ * the jumps around them; offsets are only worked out again when the code
+ * is lowered back into the chunk. A jump's offset isn't one of its operands.
+ */
+typedef struct IrInstruction {
+    uint8_t opcode;
+    // where the operands start in the IR's operand bytes
+    int operands;
+    int operandCount;
+    int line;
+    // the instruction's offset in the original code
+    int original;
+    // the instruction a jump lands on, or -1 if it isn't one
+    int target;
+    // whether a jump or the edge of a try block lands here
+    bool isTarget;
+    bool removed;
+} IrInstruction;
+
+/**
+ * @struct IrHandler
+ *
+ * A try block's entry in the handler table, as instruction indices.
+ */
+typedef struct IrHandler {
+    int start;
+    int end;
+    int handler;
+} IrHandler;
+
+/**
+ * @struct Ir
+ *
+ * A chunk's code as a list of instructions.
+ *
+ * Removed instructions are left in place and skipped, so indices stay
+ * stable while passes run. An index of count means the end of the code.
+ */
+typedef struct Ir {
+    Chunk* chunk;
+    IrInstruction* instructions;
+    int count;
+    uint8_t* bytes;
+    int byteCount;
+    int byteCapacity;
+    IrHandler* handlers;
+} Ir;
+
+/**
+ * Method for checking whether the given opcode is a jump.
+ */
+bool isJumpInstruction(uint8_t instruction);
+
+/**
+ * Method for lifting a chunk's code into the IR.
+ *
+ * Returns false, leaving nothing to free, if there wasn't the memory for it.
+ */
+bool liftChunk(Ir* ir, Chunk* chunk);
+
+/**
+ * Method for writing the IR back into its chunk.
+ *
+ * Lays the live instructions out again and rebuilds the jump offsets,
+ * line table and handler table to match. An edge of a try block that was
+ * on a removed instruction moves to the next one still there.
+ */
+void lowerChunk(Ir* ir);
+
+/**
+ * Method for freeing the IR, leaving its chunk as it is.
+ */
+void freeIr(Ir* ir);
+
+/**
+ * Method for working out which instructions are jump targets from the live jumps and the handler table.
+ */
+void markTargets(Ir* ir);
+
+/**
+ * Method for getting the first live instruction at or after the given index.
+ */
+int liveInstruction(Ir* ir, int index);
+
+/**
+ * Method for getting the live instruction following the one at the given index.
+ */
+int nextInstruction(Ir* ir, int index);
+
+/**
+ * Method for adding operand bytes to the IR, returning where they start.
+ *
+ * Returns -1 if there wasn't the memory for them.
+ */
+int addOperands(Ir* ir, const uint8_t* bytes, int count);
+
+/**
+ * Method for getting an instruction's operands.
+ */
+static inline uint8_t* irOperands(Ir* ir, IrInstruction* instruction) {
+    return ir->bytes + instruction->operands;
+}
+
+#endif
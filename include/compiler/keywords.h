@@ -36,9 +36,11 @@ static const Keyword keywords[] = {
     {"else",    TOKEN_ELSE},
     {"elif",    TOKEN_ELIF},
     {"enum",    TOKEN_ENUM},
+    {"except",  TOKEN_EXCEPT},
     {"extends", TOKEN_EXTENDS},
     {"false",   TOKEN_FALSE},
     {"final",   TOKEN_FINAL},
+    {"finally", TOKEN_FINALLY},
     {"for",     TOKEN_FOR},
     {"func",    TOKEN_FUN},
     {"has",     TOKEN_HAS},
@@ -47,14 +49,30 @@ static const Keyword keywords[] = {
     {"in",      TOKEN_IN},
     {"nil",     TOKEN_NIL},
     {"or",      TOKEN_OR},
+    {"raise",   TOKEN_RAISE},
     {"return",  TOKEN_RETURN},
     {"self",    TOKEN_SELF},
     {"super",   TOKEN_SUPER},
     {"true",    TOKEN_TRUE},
+    {"try",     TOKEN_TRY},
     {"var",     TOKEN_VAR},
     {"while",   TOKEN_WHILE},
 };
 
 #define KEYWORD_COUNT (sizeof(keywords)/sizeof(keywords[0]))
 
+/**
+ * The number of slots in the scanner's keyword hash table, a power of two.
+ */
+#define KEYWORD_SLOTS 64
+
+/**
+ * Hashes an identifier by its first and last characters and its length.
+ *
+ * Every keyword above gets its own slot, so a lookup is a single compare.
+ * A keyword added that collides still works, it's just found by probing.
+ */
+#define KEYWORD_HASH(first, last, length) \
+    (((unsigned)(first) * 10 + (unsigned)(last) * 4 + (unsigned)(length) * 3) & (KEYWORD_SLOTS - 1))
+
 #endif
@@ -0,0 +1,21 @@
+/**
+ * @file optimizer.h
+ *
+ * Optimisation of compiled chunks.
+ */
+
+#ifndef cslo_optimizer_h
+#define cslo_optimizer_h
+
+#include "core/chunk.h"
+
+/**
+ * Method for running the optimiser over a finished chunk.
+ *
+ * Threads jumps, removes unreachable code and fuses common instruction
+ * sequences into superinstructions, fixing up jump offsets, the line
+ * table and the handler table to match.
+ */
+void optimizeChunk(Chunk* chunk);
+
+#endif
@@ -6,6 +6,7 @@
 #define cslo_scanner_h
 
 #include "compiler/tokens.h"
+#include "core/common.h"
 
 /**
  * Method for initialising our scanner for the given source string.
@@ -23,6 +24,6 @@ typedef struct Scanner {
   int line;
 } Scanner;
 
-extern Scanner scanner;
+extern THREAD_LOCAL Scanner scanner;
 
 #endif
@@ -46,6 +46,7 @@ typedef enum TokenType {
     TOKEN_HAS, TOKEN_HAS_NOT, TOKEN_IN,
     TOKEN_ENUM, TOKEN_AS, TOKEN_BREAK, TOKEN_CONTINUE,
     TOKEN_FINAL, TOKEN_ASSERT,
+    TOKEN_TRY, TOKEN_EXCEPT, TOKEN_FINALLY, TOKEN_RAISE,
 
     TOKEN_IMPORT,
 
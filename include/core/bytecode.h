@@ -0,0 +1,102 @@
+/**
+ * @file bytecode.h
+ * @brief Serialising compiled functions to and from .sloc files and .slob bundles.
+ */
+
+#ifndef cslo_bytecode_h
+#define cslo_bytecode_h
+
+#include "core/common.h"
+#include "core/object.h"
+
+/**
+ * The magic bytes at the start of every .sloc file.
+ */
+#define SLOC_MAGIC "SLOC"
+
+/**
+ * The magic bytes at the start of every .slob bundle.
+ */
+#define SLOB_MAGIC "SLOB"
+
+/**
+ * The version of the .sloc format.
+ *
+ * This must be bumped whenever the opcodes or their operands change
+ * so that stale caches are recompiled rather than run. Bundles share it.
+ */
+#define SLOC_FORMAT_VERSION 18
+
+/**
+ * Method for getting the path of the bytecode cache for a given source file.
+ *
+ * The caller is responsible for freeing the returned path.
+ */
+char* bytecodePath(const char* path);
+
+/**
+ * Method for loading a cached compiled script for the given source file.
+ *
+ * The cache is valid if the source's mtime and size match the ones it was
+ * written with; failing that, if the source's hash still matches.
+ * module is the name of the module being loaded, or NULL for a script,
+ * and a cache compiled as the other is ignored.
+ * Returns NULL if there's no valid cache.
+ */
+ObjFunction* readBytecode(const char* path, const char* source, ObjString* module);
+
+/**
+ * Method for writing a compiled script next to its source file.
+ *
+ * Returns false if the cache couldn't be written.
+ */
+bool writeBytecode(ObjFunction* function, const char* path, const char* source);
+
+/**
+ * Method for serialising a single function, with the names of the globals
+ * it uses, so it can be loaded into another VM.
+ *
+ * Returns a malloc'd buffer the caller frees, or NULL if the function holds
+ * a constant that can't be serialised.
+ */
+uint8_t* packFunction(ObjFunction* function, size_t* size);
+
+/**
+ * Method for loading a function serialised by packFunction into this VM.
+ *
+ * The globals it uses are resolved by name, so they're given slots here
+ * if they don't have one yet. Returns NULL if the buffer is invalid.
+ */
+ObjFunction* unpackFunction(const uint8_t* bytes, size_t size);
+
+/**
+ * Method for writing a bundle of a compiled script and the modules it imports.
+ *
+ * names[i] is the name modules[i] was compiled as. Every string is written
+ * once, to a pool at the start of the bundle. Returns false if the bundle
+ * couldn't be written.
+ */
+bool writeBundle(const char* path, ObjFunction* script, ObjString** names, ObjFunction** modules, int moduleCount);
+
+/**
+ * Method for mapping a bundle into memory, for readBundledFunction to load from.
+ *
+ * The bundle is shared by every VM in the process. Returns false if it
+ * can't be read or wasn't written by this version of slo.
+ */
+bool openBundle(const char* path);
+
+/**
+ * Method for checking whether the open bundle has the given module.
+ */
+bool isBundled(ObjString* module);
+
+/**
+ * Method for loading a module's function from the open bundle, or the script's if module is NULL.
+ *
+ * The bundle's strings are interned into this VM the first time it loads
+ * from it. Returns NULL if it isn't in the bundle or is invalid.
+ */
+ObjFunction* readBundledFunction(ObjString* module);
+
+#endif
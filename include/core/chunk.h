@@ -11,12 +11,121 @@
 
 /**
 * @struct LineStart
+*
+* Where a run of instructions from the same line starts.
 */
 typedef struct LineStart {
   int offset;
   int line;
 } LineStart;
 
+/**
+ * How many runs apart the line table's checkpoints are.
+ *
+ * A finished chunk's lines are compacted into a line table: a varint count
+ * of checkpoints, the checkpoints, then every run as the varint difference
+ * from the offset before and the zigzag varint difference from the line
+ * before. After every LINE_CHECKPOINT_INTERVAL runs there's a checkpoint of
+ * three little-endian 32-bit ints: where in the runs the next one starts,
+ * and the offset and line it got to. Looking up an instruction is a binary
+ * search of the checkpoints and decoding at most that many runs, and a
+ * function short enough not to need any is only a few bytes.
+ */
+#define LINE_CHECKPOINT_INTERVAL 16
+
+/**
+ * The number of receiver shapes an inline cache remembers
+ * before it starts replacing entries.
+ */
+#define INLINE_CACHE_WAYS 4
+
+/**
+ * @struct InlineCacheEntry
+ *
+ * One receiver shape seen at a property access or invoke site.
+ * fieldIndex is the index of the field in instances with that shape,
+ * or -1 if the name resolved to a method on the shape's class.
+ * For OP_SET_PROPERTY sites that add a field, transition is the shape
+ * the instance moves to.
+ * OP_INVOKE sites on the built in types leave shape NULL and cache the
+ * native method found on builtIn, their receiver's class, instead.
+ */
+typedef struct InlineCacheEntry {
+    struct Shape* shape;
+    struct ObjClass* builtIn;
+    struct Shape* transition;
+    int fieldIndex;
+    Value method;
+} InlineCacheEntry;
+
+/**
+ * @struct InlineCache
+ *
+ * Per call-site cache for OP_GET_PROPERTY, OP_SET_PROPERTY and OP_INVOKE.
+ */
+typedef struct InlineCache {
+    InlineCacheEntry entries[INLINE_CACHE_WAYS];
+    int next;
+} InlineCache;
+
+/**
+ * @struct ExceptionHandler
+ *
+ * A try block's entry in its chunk's handler table.
+ * Nothing runs on entering the block, the table's only looked at when
+ * something's raised: an instruction in [start, end) that raises jumps
+ * to handler, with the stack cut back to depth slots and the exception
+ * pushed on top. Inner blocks come before the blocks around them.
+ */
+typedef struct ExceptionHandler {
+    int start;
+    int end;
+    int handler;
+    int depth;
+} ExceptionHandler;
+
+/**
+ * The bytes OP_FORMAT has for each part after its count:
+ * flags, the width and then the precision.
+ * The low bits of the flags are the conversion, a FormatType,
+ * and the rest are the FORMAT_* flags below.
+ */
+#define FORMAT_SPEC_BYTES 3
+
+/**
+ * @enum FormatType
+ *
+ * The conversion a format spec asks for, FORMAT_NONE for however
+ * the value would normally be converted to a string.
+ */
+typedef enum FormatType {
+    FORMAT_NONE,
+    FORMAT_FIXED,
+    FORMAT_EXPONENT,
+    FORMAT_GENERAL,
+    FORMAT_INTEGER,
+    FORMAT_HEX,
+} FormatType;
+
+#define FORMAT_TYPE_MASK 0x0f
+#define FORMAT_ALIGN_LEFT 0x10
+#define FORMAT_ALIGN_RIGHT 0x20
+#define FORMAT_ALIGN_CENTER 0x30
+#define FORMAT_ALIGN_MASK 0x30
+#define FORMAT_ZERO_PAD 0x40
+#define FORMAT_PRECISION 0x80
+
+/**
+ * The flags OP_CLOSURE has for each captured variable, before its index.
+ *
+ * CAPTURE_LOCAL captures one of the enclosing function's locals rather than
+ * one of its upvalues. CAPTURE_FLAT copies a final variable's value straight
+ * into the closure, where OP_GET_CAPTURED reads it, instead of sharing it
+ * through an upvalue.
+ */
+#define CAPTURE_LOCAL 0x01
+#define CAPTURE_FLAT 0x02
+
 /** @struct Chunk
 *  This defines a chunk of code.
 *
@@ -30,9 +139,24 @@ typedef struct Chunk {
     int capacity;
     uint8_t* code;
     ValueArray constants;
+    // the line runs as they're written, until the chunk's finished and they're compacted
     int lineCount;
     int lineCapacity;
     LineStart* lines;
+    // the compacted line table, which may be borrowed from a mapped bundle
+    const uint8_t* lineTable;
+    int lineTableSize;
+    bool ownsLineTable;
+    int cacheCount;
+    int cacheCapacity;
+    InlineCache* caches;
+    // the loops that have run here, counted for and compiled by the JIT
+    int loopCount;
+    int loopCapacity;
+    struct JitLoop* loops;
+    int handlerCount;
+    int handlerCapacity;
+    ExceptionHandler* handlers;
 } Chunk;
 
 
@@ -56,6 +180,49 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line);
 */
 int addConstant(Chunk* chunk, Value value);
 
+/**
+ * Method for adding a new, empty inline cache to a given chunk.
+ */
+int addInlineCache(Chunk* chunk);
+
+/**
+ * Method for adding an exception handler to the end of a given chunk's handler table.
+ */
+void addExceptionHandler(Chunk* chunk, int start, int end, int handler, int depth);
+
+/**
+ * Method for finding the innermost exception handler covering the given offset.
+ *
+ * Returns NULL if the instruction there isn't in a try block.
+ */
+ExceptionHandler* findExceptionHandler(Chunk* chunk, int offset);
+
+/**
+ * Method for getting the size in bytes of the instruction
+ * at the given offset, including its operands.
+ */
+int instructionLength(Chunk* chunk, int offset);
+
+/**
+ * Method for getting the generic instruction a quickened one was rewritten from.
+ *
+ * Anything that isn't quickened is returned as is.
+ */
+uint8_t genericInstruction(uint8_t instruction);
+
+/**
+ * Method for compacting a finished chunk's line runs into its line table.
+ */
+void compactLines(Chunk* chunk);
+
+/**
+ * Method for giving a chunk the line table it was stored with.
+ *
+ * A borrowed table isn't copied, so must outlive the chunk. Returns false,
+ * leaving the chunk without one, if it's too malformed to look anything up in.
+ */
+bool setLineTable(Chunk* chunk, const uint8_t* table, int size, bool borrow);
+
 /**
  * Method for getting the line of a given instruction.
  */
@@ -63,6 +230,9 @@ int getLine(Chunk chunk, size_t instruction);
 
 /**
  * Method for getting the column of a given instruction.
+ *
+ * This is how far into the code of its run of the line it is, as the
+ * compiler doesn't keep the columns of what it emits.
  */
 int getColumn(Chunk chunk, size_t instruction);
 
@@ -16,6 +16,49 @@
 #define DEBUG_LOG_GC 0
 #endif
 
+// Use computed-goto ("labels as values") dispatch in the VM where the compiler
+// supports it. Build with -DSLO_SWITCH_DISPATCH to force the portable switch.
+#if defined(__GNUC__) && !defined(SLO_SWITCH_DISPATCH)
+#define COMPUTED_GOTO 1
+#endif
+
+// Each thread has its own running VM and compiler state, so several
+// interpreters can run side by side in one process.
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
+// Hints for branches that are almost never taken, so the common path stays
+// small enough to be inlined.
+#if defined(__GNUC__)
+#define UNLIKELY(condition) __builtin_expect(!!(condition), 0)
+#define COLD __attribute__((noinline, cold))
+#else
+#define UNLIKELY(condition) (condition)
+#define COLD
+#endif
+
+// Marks a case that carries on into the next one where a "fall through"
+// comment isn't seen, like before a case label that comes from a macro.
+#if defined(__has_attribute)
+#if __has_attribute(fallthrough)
+#define FALLTHROUGH __attribute__((fallthrough))
+#endif
+#endif
+#ifndef FALLTHROUGH
+#define FALLTHROUGH ((void)0)
+#endif
+
+// Hot loops are compiled to machine code (see jit.h) on x86-64, unless run with
+// --no-jit. Build with -DSLO_NO_JIT to leave the compiler out.
+#if defined(__x86_64__) && defined(__unix__) && !defined(SLO_NO_JIT)
+#define SLO_JIT 1
+#endif
+
 #define UINT8_COUNT (UINT8_MAX + 1)
 
 #define MAX_IF_BRANCHES 56
@@ -17,4 +17,9 @@ void disassembleChunk(Chunk* chunk, const char* name);
  */
 int disassembleInstruction(Chunk* chunk, int offset);
 
+/**
+ * Method for getting an opcode's name, or NULL if it isn't one.
+ */
+const char* opcodeName(uint8_t instruction);
+
 #endif
@@ -0,0 +1,124 @@
+/**
+ * @file embed.h
+ * @brief The interface for running slo from inside a C program.
+ *
+ * A script is compiled once, run to define its functions, and then any
+ * of them can be called as often as needed without compiling again:
+ *
+ *     static VM sloVM;
+ *     initVM(&sloVM);
+ *
+ *     Value script, rule, result;
+ *     if (!sloCompile(source, "rules.slo", &script) || sloRun(script) != INTERPRET_OK
+ *             || !sloFunction("score", &rule)) {
+ *         ...
+ *     }
+ *     for (each event) {
+ *         sloPushNumber(event->amount);
+ *         sloPushString(event->country);
+ *         if (sloCall(rule, 2, &result)) {
+ *             double score;
+ *             sloToNumber(result, &score);
+ *         }
+ *     }
+ *     sloRelease(rule);
+ *     sloRelease(script);
+ *     freeVM();
+ *
+ * Arguments are pushed onto the VM's stack, where the collector can see
+ * them, and a call pops them. The script and functions handed back are
+ * held until they're released, but a call's result is only safe until
+ * the next call or allocation unless it's held with sloHold. Errors are
+ * reported to stderr, as they are when running a file, and leave the VM
+ * ready for the next call.
+ */
+
+#ifndef cslo_embed_h
+#define cslo_embed_h
+
+#include "core/object.h"
+#include "core/value.h"
+#include "core/vm.h"
+
+/**
+ * Method for compiling a script without running it.
+ *
+ * The script is written to script and held until it's released.
+ * Returns false if it didn't compile, the errors having been reported.
+ */
+bool sloCompile(const char* source, const char* file, Value* script);
+
+/**
+ * Method for running a compiled script's top level, defining its globals.
+ */
+InterpretResult sloRun(Value script);
+
+/**
+ * Method for looking up a global function, method or class by name.
+ *
+ * The function is written to function and held until it's released.
+ * Returns false if there's no such global or it can't be called.
+ */
+bool sloFunction(const char* name, Value* function);
+
+/**
+ * Method for calling a function with the argCount values last pushed as its arguments.
+ *
+ * The arguments are popped and the return value written to result.
+ * Returns false if the call raised an error.
+ */
+bool sloCall(Value function, int argCount, Value* result);
+
+/**
+ * Method for keeping a value alive while it's only referenced from C.
+ */
+void sloHold(Value value);
+
+/**
+ * Method for releasing a value that was held, or handed back held.
+ */
+void sloRelease(Value value);
+
+/**
+ * Method for pushing an argument.
+ */
+void sloPush(Value value);
+
+/**
+ * Method for pushing a number argument.
+ */
+void sloPushNumber(double number);
+
+/**
+ * Method for pushing a bool argument.
+ */
+void sloPushBool(bool boolean);
+
+/**
+ * Method for pushing a nil argument.
+ */
+void sloPushNil();
+
+/**
+ * Method for pushing a string argument, copied from a NUL terminated string.
+ */
+void sloPushString(const char* chars);
+
+/**
+ * Method for reading a number, returning false if the value isn't one.
+ */
+bool sloToNumber(Value value, double* number);
+
+/**
+ * Method for reading a bool, returning false if the value isn't one.
+ */
+bool sloToBool(Value value, bool* boolean);
+
+/**
+ * Method for reading a string, returning NULL if the value isn't one.
+ *
+ * The characters belong to the string, so are only safe as long as it is.
+ */
+const char* sloToString(Value value);
+
+#endif  // cslo_embed_h
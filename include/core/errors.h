@@ -37,4 +37,16 @@ typedef struct {
 
 void reportError(Exception* exc);
 
+/**
+ * Method for getting the name of an error type, like "TypeException".
+ */
+const char* errorTypeToString(enum ErrorType type);
+
+/**
+ * Method for getting the error type with the given name.
+ *
+ * Returns -1 if no error type has that name.
+ */
+int errorTypeFromName(const char* name, int length);
+
 #endif // cslo_errors_h
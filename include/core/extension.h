@@ -0,0 +1,77 @@
+/**
+ * @file extension.h
+ * @brief The interface for native extensions written in C.
+ *
+ * An extension is a shared library, '<name>.so', that `import <name>;` finds
+ * in the same places as a '<name>.slo' module. It's compiled against these
+ * headers and defines its functions the same way the standard library does:
+ *
+ *     static Value dotNative(int argCount, Value* args, ParamInfo* params) { ... }
+ *
+ *     static NativeDef vectorNatives[] = {
+ *         {"dot", dotNative, 2, 2, {{"a", true}, {"b", true}}},
+ *         {NULL}
+ *     };
+ *
+ *     SloExtension* sloExtensionInit(void) {
+ *         static SloExtension extension = SLO_EXTENSION(vectorNatives);
+ *         return &extension;
+ *     }
+ *
+ * Natives follow the same rules as the built in ones: errors are returned
+ * with nativeError() for fixed messages, ERROR_VAL_PTR() for ones built in a
+ * buffer, and anything allocated must be pushed onto the VM
+ * stack while allocating something else. Values kept in C between calls
+ * must be pinned or the collector will free them.
+ */
+
+#ifndef cslo_extension_h
+#define cslo_extension_h
+
+#include "core/object.h"
+#include "core/value.h"
+
+/**
+ * Bumped whenever a change to the VM would break extensions built before it.
+ */
+#define SLO_EXTENSION_ABI 2
+
+/**
+ * The name of the function every extension defines.
+ */
+#define SLO_EXTENSION_INIT "sloExtensionInit"
+
+/**
+ * @struct SloExtension
+ *
+ * What an extension hands to the loader. The ABI version and the size of a
+ * Value are checked so an extension built for another version, or for a
+ * NaN-boxed build when this one isn't, is refused rather than crashing.
+ */
+typedef struct SloExtension {
+    int abiVersion;
+    int valueSize;
+    NativeDef* natives;
+} SloExtension;
+
+/**
+ * Macro for initialising an extension's SloExtension from its natives.
+ */
+#define SLO_EXTENSION(natives) {SLO_EXTENSION_ABI, (int)sizeof(Value), (natives)}
+
+typedef SloExtension* (*SloExtensionInitFn)(void);
+
+/**
+ * Method for keeping a value alive while it's only referenced from C.
+ *
+ * A value can be pinned more than once and stays alive until it's unpinned
+ * as many times.
+ */
+void pinValue(Value value);
+
+/**
+ * Method for releasing a value pinned with pinValue.
+ */
+void unpinValue(Value value);
+
+#endif  // cslo_extension_h
@@ -0,0 +1,46 @@
+/**
+ * @file flusher.h
+ * @brief Writing a file's output on a thread of its own.
+ */
+
+#ifndef cslo_flusher_h
+#define cslo_flusher_h
+
+#include <stddef.h>
+
+#include "core/common.h"
+
+typedef struct Flusher Flusher;
+
+/**
+ * Method for starting a thread that writes to the given descriptor.
+ *
+ * Writes are copied into a buffer of capacity bytes, and each one that
+ * fills up is handed to the thread while the next is filled. Returns NULL
+ * if the thread couldn't be started.
+ */
+Flusher* startFlusher(int fd, size_t capacity);
+
+/**
+ * Method for writing through a flusher.
+ *
+ * Returns false if it's had to wait on a write by the thread that failed,
+ * which is otherwise reported by the next sync.
+ */
+bool flusherWrite(Flusher* flusher, const char* chars, size_t length);
+
+/**
+ * Method for waiting until everything written through a flusher is in the file.
+ *
+ * Returns false if any of it couldn't be written.
+ */
+bool syncFlusher(Flusher* flusher);
+
+/**
+ * Method for syncing a flusher, then stopping its thread and freeing it.
+ *
+ * The descriptor's left open. Returns false if anything couldn't be written.
+ */
+bool stopFlusher(Flusher* flusher);
+
+#endif  // cslo_flusher_h
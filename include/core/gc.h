@@ -2,9 +2,176 @@
  * @file gc.h
  */
 
+#ifndef cslo_gc_h
+#define cslo_gc_h
+
+#include <stdio.h>
+
+#include "core/object.h"
 #include "table.h"
 #include "core/value.h"
 
+/**
+ * @enum GCMode
+ *
+ * GC_FULL is the original stop-the-world collector that marks and sweeps
+ * the whole heap each time.
+ * GC_GENERATIONAL allocates into a nursery that's collected on its own
+ * (a minor collection) and promotes survivors to the old generation, which
+ * is only collected when it has grown enough (a major collection).
+ */
+typedef enum GCMode {
+    GC_FULL,
+    GC_GENERATIONAL
+} GCMode;
+
+/**
+ * @struct GCStats
+ *
+ * Counters for reporting collector pauses.
+ */
+typedef struct GCStats {
+    int minorCollections;
+    int majorCollections;
+    double minorPauseTotal;
+    double majorPauseTotal;
+    double maxPause;
+    size_t bytesFreed;
+    size_t objectsFreed;
+    // what the last collection freed, a background sweep's once it's finished
+    size_t lastBytesFreed;
+    size_t lastObjectsFreed;
+    // when the VM started, to work out how fast it's allocating
+    double startTime;
+} GCStats;
+
+/**
+ * How many times the heap that survives a collection it grows to before the next, by default.
+ */
+#define GC_HEAP_GROW_FACTOR 2
+
+/**
+ * The heap size the first collection happens at, and the least collections wait for.
+ */
+#define GC_MIN_HEAP (1024 * 1024)
+
+/**
+ * The default size of the nursery in generational mode.
+ */
+#define GC_DEFAULT_NURSERY_SIZE (1024 * 1024)
+
+/**
+ * The heap size major collections start using more than one thread at, by default.
+ */
+#define GC_DEFAULT_PARALLEL_HEAP (64 * 1024 * 1024)
+
+struct Sweeper;
+
+/**
+ * Method for choosing the collector. Must be called before running any code.
+ */
+void setGCMode(GCMode mode, size_t nurserySize);
+
+/**
+ * Method for choosing how many threads major collections use once the heap is minHeap bytes.
+ *
+ * They mark on all of them, and in GC_FULL mode sweep on one in the background
+ * while the program carries on. A single thread collects the way it always has.
+ */
+void setGCThreads(int threads, size_t minHeap);
+
+/**
+ * Method for setting how many times the surviving heap can grow to before the next collection.
+ */
+void setHeapGrowFactor(double factor);
+
+/**
+ * Method for turning collections on or off.
+ *
+ * While they're off the heap grows without limit, for sections of a program
+ * that can't have pauses. Turning them back on collects at the next allocation
+ * if the heap grew past where it would have while they were off.
+ */
+void setGCEnabled(bool enabled);
+
+/**
+ * Method for starting a region.
+ *
+ * Everything allocated until it ends is kept apart from the rest of the
+ * heap, so that what's left of it can be freed at the end without tracing
+ * anything older. Regions can be nested, only the outermost one frees anything.
+ */
+void beginRegion();
+
+/**
+ * Method for ending a region.
+ *
+ * Whatever it allocated that escaped, into the stack, globals or an older
+ * object, is kept and the rest freed, which is counted as a minor
+ * collection. While collections are turned off it's all kept.
+ */
+void endRegion();
+
+/**
+ * Method for a full collection now, even while collections are turned off.
+ * Returns the number of bytes it freed.
+ */
+size_t collectNow();
+
+// how many ObjTypes there are, for countObjects
+#define OBJ_TYPE_COUNT (OBJ_ERROR + 1)
+
+/**
+ * Method for counting the objects that are live, by ObjType.
+ *
+ * Counts has to have room for every type. Anything unreachable since the
+ * last collection is counted until the next one frees it.
+ */
+void countObjects(size_t* counts, int typeCount);
+
+/**
+ * Method for getting the name of an object type.
+ */
+const char* objTypeName(ObjType type);
+
+/**
+ * Method for getting a monotonic timestamp in seconds, for timing pauses.
+ */
+double gcClock();
+
+/**
+ * Method for getting how fast the program's allocating, in bytes per second since it started.
+ */
+double allocationRate();
+
+/**
+ * Method for waiting on a background sweep, if there is one, and reclaiming what it freed.
+ */
+void finishSweep();
+
+/**
+ * Method for printing the collector's pause statistics.
+ */
+void printGCStats(FILE* out);
+
+/**
+ * Method for adding an old object to the remembered set.
+ */
+void rememberObject(Obj* object);
+
+/**
+ * Write barrier for the generational collector.
+ *
+ * Must be called after storing a value into a heap object, so that an old
+ * object pointing at a young one gets scanned by the next minor collection.
+ * It's a no-op unless the collector is generational or a region's running.
+ */
+static inline void writeBarrier(Obj* container, Value value) {
+    if (container->old && !container->remembered && IS_OBJ(value) && !AS_OBJ(value)->old) {
+        rememberObject(container);
+    }
+}
+
 /**
  * Method for gc processing.
  */
@@ -60,3 +227,5 @@ void sweep();
  * Method for removing white objects from the table.
  */
 void tableRemoveWhite(Table* table);
+
+#endif
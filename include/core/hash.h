@@ -0,0 +1,71 @@
+/**
+ * @file hash.h
+ *
+ * Hashing for table keys. Strings are hashed a word at a time in the style
+ * of wyhash, and numbers and pointers are put through a multiply and fold
+ * mixer, so sequential ints and addresses a few bytes apart still spread
+ * out over the low bits the tables index with.
+ *
+ * Every hash is keyed with a seed picked once per process, so which keys
+ * collide can't be worked out ahead of time. SLO_HASH_SEED set to a number
+ * fixes the seed, for reproducing a run. Hashes mustn't be written
+ * anywhere that outlives the process.
+ */
+
+#ifndef cslo_hash_h
+#define cslo_hash_h
+
+#include <stdint.h>
+
+// the environment variable that fixes the seed
+#define HASH_SEED_ENV "SLO_HASH_SEED"
+
+#define HASH_P0 0xa0761d6478bd642full
+#define HASH_P1 0xe7037ed1a0b428dbull
+
+extern uint64_t hashSeed;
+
+/**
+ * Method for picking the process's seed, the first time a VM is made.
+ */
+void initHashSeed();
+
+/**
+ * Method for hashing a run of bytes.
+ */
+uint32_t hashBytes(const char* bytes, int length);
+
+/**
+ * Method for multiplying two 64-bit numbers and folding the 128-bit product into 64 bits.
+ */
+static inline uint64_t hashMix(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+    uint64_t high = ha * hb, middle0 = ha * lb, middle1 = la * hb, low = la * lb;
+    uint64_t t = low + (middle0 << 32);
+    uint64_t carry = t < low;
+    uint64_t lo = t + (middle1 << 32);
+    carry += lo < t;
+    uint64_t hi = high + (middle0 >> 32) + (middle1 >> 32) + carry;
+    return lo ^ hi;
+#endif
+}
+
+/**
+ * Method for hashing a 64-bit integer.
+ */
+static inline uint32_t hashInteger(uint64_t value) {
+    return (uint32_t)hashMix(value ^ hashSeed ^ HASH_P0, HASH_P1);
+}
+
+/**
+ * Method for hashing an address, for objects that are keyed by identity.
+ */
+static inline uint32_t hashAddress(const void* address) {
+    return hashInteger((uint64_t)(uintptr_t)address);
+}
+
+#endif  // cslo_hash_h
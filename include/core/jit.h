@@ -0,0 +1,58 @@
+/**
+ * @file jit.h
+ *
+ * A baseline compiler from bytecode to machine code for hot loops.
+ *
+ * Each loop's back edge is counted, and once a loop has gone round
+ * JIT_THRESHOLD times its body is compiled, as long as every instruction in
+ * it is one the compiler knows. The machine code works on the VM's own stack
+ * and slots, so whenever it meets something it doesn't handle (a value of the
+ * wrong type, a jump out of the loop) it hands back the offset of the
+ * instruction to carry on from and run() takes over from there.
+ */
+
+#ifndef cslo_jit_h
+#define cslo_jit_h
+
+#include "core/chunk.h"
+
+// how many times a loop goes round in the interpreter before it's compiled
+#define JIT_THRESHOLD 64
+
+/**
+ * Compiled code for a loop, called with the frame's slots and where the stack
+ * top is kept. It returns the offset run() should continue at.
+ */
+typedef int (*JitCode)(Value* slots, Value** stackTop);
+
+/**
+ * @struct JitLoop
+ *
+ * A loop in a chunk, from the first instruction its OP_LOOP jumps back to
+ * until just after that OP_LOOP.
+ */
+typedef struct JitLoop {
+    int start;
+    int end;
+    int count;
+    // the most values the loop's code can push above where the stack was on entering it
+    int pushes;
+    bool failed;
+    JitCode code;
+    size_t size;
+} JitLoop;
+
+/**
+ * Method for taking a loop's back edge, running its compiled code if it has any.
+ *
+ * The loop runs from start up to end. Returns the instruction run() carries on from,
+ * which is start unless compiled code ran.
+ */
+uint8_t* enterLoop(Chunk* chunk, uint8_t* start, uint8_t* end, Value* slots);
+
+/**
+ * Method for freeing the loops a chunk has counted and compiled.
+ */
+void freeJitLoops(Chunk* chunk);
+
+#endif
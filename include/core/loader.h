@@ -8,6 +8,51 @@
 
 #include <stdbool.h>
 
-bool loadModule(const char* moduleName, const char* nickName);
+#include "core/object.h"
+
+/**
+ * Method for loading a module by its name.
+ *
+ * Native modules are checked first, then a '<name>.slo' file next to the
+ * importing file, in the current directory or in SLO_PATH, then a native
+ * extension, '<name>.so', in the same places. When a bundle is being run,
+ * the modules in it are loaded from there before looking for files. Each module is loaded once;
+ * importing it again returns the same module.
+ * Returns NULL if the module couldn't be found or failed to load.
+ */
+ObjModule* loadModule(ObjString* name, ObjString* importer);
+
+/**
+ * Method for registering a .slo module without running it.
+ *
+ * Used when a thread is started with a copy of another VM's globals, which
+ * already include everything the module defined.
+ */
+ObjModule* adoptFileModule(ObjString* name);
+
+/**
+ * Method for starting to compile the .slo modules a script imports, and the ones they import, ahead.
+ *
+ * They're compiled on vm->importThreads threads, each with a VM of its own,
+ * and handed back when they're imported. They still run in the order
+ * they're imported, on this thread. A module that failed to compile ahead
+ * or was found somewhere else is compiled again when it's imported, so
+ * errors are reported the same as without.
+ */
+void startPrecompiling(ObjFunction* script);
+
+/**
+ * Method for stopping the threads compiling ahead and dropping anything they compiled that wasn't imported.
+ */
+void stopPrecompiling();
+
+/**
+ * Method for compiling a script and every .slo module it imports into a bundle at output.
+ *
+ * Modules are found the same way importing them would. Native extensions
+ * are left out and still loaded from their files when they're imported.
+ * Errors are reported to stderr and false is returned.
+ */
+bool compileBundle(const char* path, const char* output);
 
 #endif  // cslo_loader_h
@@ -0,0 +1,39 @@
+/**
+ * @file memo.h
+ *
+ * The table a memoised function keeps its results in, by the args they're for.
+ */
+
+#ifndef cslo_memo_h
+#define cslo_memo_h
+
+#include "core/common.h"
+#include "core/object.h"
+#include "core/value.h"
+
+/**
+ * Method for hashing the args of a call, each the way it would be as a dict key.
+ */
+uint32_t hashArguments(Value* args, int argCount);
+
+/**
+ * Method for getting the result remembered for the given args.
+ *
+ * Counts a hit or a miss, and a hit makes the entry the most recently used.
+ */
+bool memoGet(ObjMemo* memo, Value* args, int argCount, uint32_t hash, Value* result);
+
+/**
+ * Method for remembering the result for the given args.
+ *
+ * The args are a copy made with ALLOCATE that the memo takes over. When
+ * the memo is full the least recently used entry is dropped to make room.
+ */
+void memoSet(ObjMemo* memo, Value* args, int argCount, uint32_t hash, Value result);
+
+/**
+ * Method for forgetting every result a memo has, leaving its stats as they are.
+ */
+void clearMemo(ObjMemo* memo);
+
+#endif
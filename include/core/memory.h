@@ -19,6 +19,75 @@
  */
 #define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
 
+/**
+ * Macro for freeing an object allocated with allocateObjectMemory.
+ */
+#define FREE_OBJ(type, pointer) freeObjectMemory(pointer, sizeof(type))
+
+/**
+ * The granularity of the object pool's size classes.
+ */
+#define POOL_GRANULE 16
+
+/**
+ * The largest object handled by the pools. Anything bigger uses reallocate.
+ */
+#define POOL_MAX_SIZE 256
+
+/**
+ * The size of each slab the pools carve objects out of.
+ */
+#define POOL_SLAB_SIZE (64 * 1024)
+
+/**
+ * @struct PoolSlab
+ *
+ * A block of memory objects of a single size class are carved from.
+ */
+typedef struct PoolSlab {
+    struct PoolSlab* next;
+    size_t used;
+} PoolSlab;
+
+/**
+ * @struct FreeObject
+ *
+ * A freed object slot in a pool's free list.
+ */
+typedef struct FreeObject {
+    struct FreeObject* next;
+} FreeObject;
+
+/**
+ * @struct ObjectPool
+ *
+ * Pool for one size class: the free list and the slab currently being
+ * carved up, plus every slab so we can release them on shutdown.
+ */
+typedef struct ObjectPool {
+    FreeObject* freeList;
+    PoolSlab* slabs;
+} ObjectPool;
+
+#define POOL_CLASSES (POOL_MAX_SIZE / POOL_GRANULE)
+
+/**
+ * @struct FreedMemory
+ *
+ * Memory freed by a background sweep, kept apart from the VM's pools and
+ * counters (which its thread is still using) until it's reclaimed.
+ */
+typedef struct FreedMemory {
+    size_t bytes;
+    FreeObject* freeLists[POOL_CLASSES];
+    FreeObject* freeTails[POOL_CLASSES];
+} FreedMemory;
+
+/**
+ * Where memory freed on this thread is recorded instead of the VM, if set.
+ */
+extern THREAD_LOCAL FreedMemory* freedMemory;
+
 /**
  * Macro for growing the capacity.
  * If less than 8 - return 8, otherwise double it.
@@ -52,6 +121,29 @@
  */
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
 
+/**
+ * Method for allocating the memory for an Obj.
+ *
+ * Objects are carved out of slabs with one free list per size class,
+ * so allocating and freeing small objects is usually a free list pop/push.
+ */
+void* allocateObjectMemory(size_t size);
+
+/**
+ * Method for returning an Obj's memory to its pool.
+ */
+void freeObjectMemory(void* pointer, size_t size);
+
+/**
+ * Method for releasing all of the pools' slabs on shutdown.
+ */
+void freeObjectPools();
+
+/**
+ * Method for handing memory freed by a background sweep back to the VM.
+ */
+void reclaimFreedMemory(FreedMemory* freed);
+
 /**
  * Method for freeing an object.
  *
@@ -64,4 +156,10 @@ void freeObject(Obj* object);
  */
 void freeObjects();
 
+/**
+ * Method for freeing a list or dict made by newLocalList or newLocalDict
+ * once the frame that made it is finished with it. Anything else is left alone.
+ */
+void freeLocalObject(Obj* object);
+
 #endif
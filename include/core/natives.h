@@ -35,6 +35,12 @@ Value printLNNative(int argCount, Value* args, ParamInfo* params);
  */
 Value sleepNative(int argCount, Value* args, ParamInfo* params);
 
+/**
+ * Yield native function.
+ * Suspends the running fiber, passing the value out to whatever resumed it.
+ */
+Value yieldNative(int argCount, Value* args, ParamInfo* params);
+
 /**
  * Time native function.
  * Returns the number of seconds since epoch.
@@ -52,6 +58,11 @@ Value exitNative(int argCount, Value* args, ParamInfo* params);
  */
 Value lenNative(int argCount, Value* args, ParamInfo* params);
 
+/**
+ * range native function.
+ */
+Value rangeNative(int argCount, Value* args, ParamInfo* params);
+
 // MATH NATIVES
 
 /**
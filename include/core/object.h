@@ -9,6 +9,8 @@
 
 #include "chunk.h"
 #include "core/common.h"
+#include "core/errors.h"
+#include "core/shape.h"
 #include "table.h"
 #include "core/value.h"
 
@@ -63,6 +65,42 @@
 /** Macro for checking the given object is an ObjFile. */
 #define IS_FILE(value)        isObjType(value, OBJ_FILE)
 
+/** Macro for checking the given object is an ObjStringBuilder. */
+#define IS_STRING_BUILDER(value) isObjType(value, OBJ_STRING_BUILDER)
+
+/** Macro for checking the given object is an ObjArray. */
+#define IS_ARRAY(value)       isObjType(value, OBJ_ARRAY)
+
+/** Macro for checking the given object is an ObjSet. */
+#define IS_SET(value)         isObjType(value, OBJ_SET)
+
+/** Macro for checking the given object is an ObjBytes. */
+#define IS_BYTES(value)       isObjType(value, OBJ_BYTES)
+
+/** Macro for checking the given object is an ObjFiber. */
+#define IS_FIBER(value)       isObjType(value, OBJ_FIBER)
+
+/** Macro for checking the given object is an ObjSocket. */
+#define IS_SOCKET(value)      isObjType(value, OBJ_SOCKET)
+
+/** Macro for checking the given object is an ObjThread. */
+#define IS_THREAD(value)      isObjType(value, OBJ_THREAD)
+
+/** Macro for checking the given object is an ObjChannel. */
+#define IS_CHANNEL(value)     isObjType(value, OBJ_CHANNEL)
+
+/** Macro for checking the given object is an ObjRange. */
+#define IS_RANGE(value)       isObjType(value, OBJ_RANGE)
+
+/** Macro for checking the given object is an ObjRandom. */
+#define IS_RANDOM(value)      isObjType(value, OBJ_RANDOM)
+
+/** Macro for checking the given object is an ObjDictView. */
+#define IS_DICT_VIEW(value)   isObjType(value, OBJ_DICT_VIEW)
+
+/** Macro for checking the given object is an ObjMemo. */
+#define IS_MEMO(value)        isObjType(value, OBJ_MEMO)
+
 /**
  * Macros for converting values to objects.
  */
@@ -91,8 +129,8 @@
 /** Macro for converting a Value to an ObjString. */
 #define AS_STRING(value)       ((ObjString*)AS_OBJ(value))
 
-/** Macro for returning the ObjString character array for the given Value. */
-#define AS_CSTRING(value)      (((ObjString*)AS_OBJ(value))->chars)
+/** Macro for returning the ObjString's null terminated character array for the given Value. */
+#define AS_CSTRING(value)      stringChars(AS_STRING(value))
 
 /** Macro for converting a Value to an ObjList. */
 #define AS_LIST(value)        ((ObjList*)AS_OBJ(value))
@@ -109,6 +147,45 @@
 /** Macro for converting a Value to an ObjFile. */
 #define AS_FILE(value)        ((ObjFile*)AS_OBJ(value))
 
+/** Macro for converting a Value to an ObjStringBuilder. */
+#define AS_STRING_BUILDER(value) ((ObjStringBuilder*)AS_OBJ(value))
+
+/** Macro for converting a Value to an ObjArray. */
+#define AS_ARRAY(value)       ((ObjArray*)AS_OBJ(value))
+
+/** Macro for converting a Value to an ObjSet. */
+#define AS_SET(value)         ((ObjSet*)AS_OBJ(value))
+
+/** Macro for converting a Value to an ObjBytes. */
+#define AS_BYTES(value)       ((ObjBytes*)AS_OBJ(value))
+
+/** Macro for converting a Value to an ObjFiber. */
+#define AS_FIBER(value)       ((ObjFiber*)AS_OBJ(value))
+
+/** Macro for converting a Value to an ObjSocket. */
+#define AS_SOCKET(value)      ((ObjSocket*)AS_OBJ(value))
+
+/** Macro for converting a Value to an ObjThread. */
+#define AS_THREAD(value)      ((ObjThread*)AS_OBJ(value))
+
+/** Macro for converting a Value to an ObjChannel. */
+#define AS_CHANNEL(value)     ((ObjChannel*)AS_OBJ(value))
+
+/** Macro for converting a Value to an ObjRange. */
+#define AS_RANGE(value)       ((ObjRange*)AS_OBJ(value))
+
+/** Macro for converting a Value to an ObjRandom. */
+#define AS_RANDOM(value)      ((ObjRandom*)AS_OBJ(value))
+
+/** Macro for converting a Value to an ObjDictView. */
+#define AS_DICT_VIEW(value)   ((ObjDictView*)AS_OBJ(value))
+
+/** Macro for converting a Value to an ObjMemo. */
+#define AS_MEMO(value)        ((ObjMemo*)AS_OBJ(value))
+
+/** Macro for checking the given object is an exception, an ObjError that was raised. */
+#define IS_EXCEPTION(value)   isObjType(value, OBJ_ERROR)
+
 /** Macro for convering a Value to an ObjError. */
 #define AS_ERROR(value)       ((ObjError*)AS_OBJ(value))
 
@@ -130,6 +207,18 @@ typedef enum ObjType {
     OBJ_MODULE,
     OBJ_ENUM,
     OBJ_FILE,
+    OBJ_STRING_BUILDER,
+    OBJ_ARRAY,
+    OBJ_SET,
+    OBJ_BYTES,
+    OBJ_FIBER,
+    OBJ_SOCKET,
+    OBJ_THREAD,
+    OBJ_CHANNEL,
+    OBJ_RANGE,
+    OBJ_RANDOM,
+    OBJ_DICT_VIEW,
+    OBJ_MEMO,
     OBJ_ERROR,
 } ObjType;
 
@@ -150,12 +239,19 @@ typedef enum FileMode {
  *
  * Struct for defining an Obj.
  * Stores the type enum a reference to the next object.
+ * old and remembered are used by the generational collector: old once
+ * the object has been promoted out of the nursery and remembered while
+ * it's in the remembered set.
  *
  * All Objs will 'inherit' from this struct.
  */
 struct Obj {
     ObjType type;
     bool mark;
+    bool old;
+    bool remembered;
+    // owned by the frame that made it rather than the collector, see newLocalList
+    bool local;
     struct Obj* next;
 };
 
@@ -166,7 +262,7 @@ struct Obj {
  * Contains the name of the parameter and whether it is required.
  */
 typedef struct ParamInfo {
-    ObjString* name;
+    const char* name;
     bool required;
 } ParamInfo;
 
@@ -197,6 +293,26 @@ typedef struct ObjNative {
     ParamInfo* params;
 } ObjNative;
 
+/**
+ * Natives are described by at most this many parameters.
+ */
+#define NATIVE_MAX_PARAMS 4
+
+/**
+ * @struct NativeDef
+ *
+ * A native function that hasn't been created yet. Classes and modules keep
+ * a static array of these, ended by one with a NULL name, and only create
+ * the ObjNative the first time it's looked up.
+ */
+typedef struct NativeDef {
+    const char* name;
+    NativeFn function;
+    int arityMin;
+    int arityMax;
+    ParamInfo params[NATIVE_MAX_PARAMS];
+} NativeDef;
+
 /**
  * @struct ObjNativeProperty defintion
  */
@@ -210,12 +326,24 @@ typedef struct ObjNativeProperty {
  *
  * As well as the base Obj, contains the length of the string
  * and a pointer to the actual string.
+ *
+ * Strings from the compiler are interned and hashed up front; strings
+ * made while running aren't interned and only get hashed when first needed.
+ *
+ * A string with a parent is a view onto part of the parent's characters,
+ * which it keeps alive; its chars aren't null terminated until materialised.
+ * A mapped string's chars are a read-only mapping of a file, which is only
+ * ever seen through views.
  */
 typedef struct ObjString {
     Obj obj;
     int length;
-    char* chars;
+    bool interned;
+    bool hashed;
+    bool mapped;
     uint32_t hash;
+    char* chars;
+    struct ObjString* parent;
 } ObjString;
 
 /**
@@ -237,6 +365,9 @@ typedef struct ObjClosure {
     Obj obj;
     ObjFunction* function;
     ObjUpvalue** upvalues;
+    // the values of the final variables it captured, indexed like upvalues,
+    // or NULL if it didn't capture any. Their upvalues are left NULL
+    Value* captured;
     int upvalueCount;
 } ObjClosure;
 
@@ -251,15 +382,24 @@ typedef struct ObjClass{
     struct ObjClass* superclass;
     Table methods;
     Table nativeProperties;
+    NativeDef* natives;
+    Shape* rootShape;
+    int instanceSize;
 } ObjClass;
 
 /**
  * @struct ObjInstance
+ *
+ * Fields are stored in a flat array laid out by the instance's shape.
  */
 typedef struct ObjInstance {
     Obj obj;
     ObjClass* sClass;
-    Table fields;
+    Shape* shape;
+    Value* fields;
+    int fieldCapacity;
+    // the last of its methods that was bound, reused while the same method is
+    struct ObjBoundMethod* bound;
 } ObjInstance;
 
 /**
@@ -271,15 +411,24 @@ typedef struct ObjBoundMethod {
     ObjClosure* method;
 } ObjBoundMethod;
 
+// slices and clones shorter than this are copied straight away rather than shared
+#define LIST_SHARE_MIN 16
+
 /**
  * @struct ObjList
+ *
+ * A slice or clone shares its values with the list it came from until either is
+ * written to. The values then live in a hidden storage list that nothing writes to,
+ * and the lists sharing them point into its buffer, copying their own part out
+ * before their first write (see unshareList).
  */
-typedef struct {
+typedef struct ObjList {
     Obj obj;
     int count;
     int capacity;
     ObjClass* sClass;
     ValueArray values;
+    struct ObjList* storage;
 } ObjList;
 
 /**
@@ -291,12 +440,122 @@ typedef struct {
     Table data;
 } ObjDict;
 
+/**
+ * @struct ObjSet
+ *
+ * An unordered collection of unique values.
+ * The values are the keys of the table, which all map to true.
+ */
+typedef struct {
+    Obj obj;
+    Table data;
+} ObjSet;
+
+/**
+ * @struct ObjBytes
+ *
+ * A growable buffer of raw bytes, for binary data that isn't text.
+ */
+typedef struct {
+    Obj obj;
+    int count;
+    int capacity;
+    uint8_t* data;
+} ObjBytes;
+
+/**
+ * @enum FiberState
+ */
+typedef enum FiberState {
+    FIBER_NEW,
+    FIBER_SUSPENDED,
+    FIBER_RUNNING,
+    FIBER_DONE
+} FiberState;
+
+/**
+ * @struct FiberFrame
+ *
+ * A call frame of a suspended fiber, with its slots as an offset into the fiber's stack.
+ */
+typedef struct FiberFrame {
+    ObjClosure* closure;
+    uint8_t* ip;
+    int slots;
+} FiberFrame;
+
+/**
+ * @struct ObjFiber
+ *
+ * A coroutine with its own call frames and values. It runs on top of the
+ * VM's stack while it's running; when it yields its frames and values are
+ * moved out into frames and stack, along with any open upvalues that point
+ * at them, and moved back when it's resumed.
+ */
+typedef struct ObjFiber {
+    Obj obj;
+    FiberState state;
+    ObjClosure* closure;
+    FiberFrame* frames;
+    int frameCount;
+    int frameCapacity;
+    Value* stack;
+    int stackCount;
+    int stackCapacity;
+    ObjUpvalue* openUpvalues;
+    // the value passed out by the last yield
+    Value transfer;
+    // how deep natives had called back into slo when it was resumed
+    int callDepth;
+} ObjFiber;
+
+/**
+ * @struct ObjSocket
+ *
+ * A non-blocking TCP socket, either a connection or one listening for them.
+ */
+typedef struct {
+    Obj obj;
+    int fd;
+    bool listening;
+    bool closed;
+} ObjSocket;
+
+/**
+ * @struct ObjThread
+ *
+ * A function running on its own OS thread, in its own VM.
+ * The handle is shared with the thread, see std/thread.h.
+ */
+typedef struct {
+    Obj obj;
+    struct ThreadHandle* handle;
+} ObjThread;
+
+/**
+ * @struct ObjChannel
+ *
+ * One VM's reference to a channel that's shared between threads.
+ * Each VM the channel is passed to gets its own ObjChannel for it.
+ */
+typedef struct {
+    Obj obj;
+    struct Channel* channel;
+} ObjChannel;
+
 /**
  * @struct ObjModule
+ *
+ * Native modules hold their functions in methods, created from natives as
+ * they're looked up. Modules loaded from a .slo file instead map each name
+ * they define to its global slot, so reading one gives its current value.
  */
 typedef struct {
     Obj obj;
     Table methods;
+    NativeDef* natives;
+    ObjString* name;
+    bool fromFile;
 } ObjModule;
 
 /**
@@ -308,8 +567,26 @@ typedef struct {
     Table values;
 } ObjEnum;
 
+/**
+ * The size of the stdio buffer files are opened with unless they're given
+ * one, so reading line by line or writing a line at a time makes few,
+ * large reads and writes.
+ */
+#define FILE_BUFFER_SIZE (1 << 16)
+
+/**
+ * The biggest buffer a file can be opened with.
+ */
+#define FILE_MAX_BUFFER_SIZE (1 << 30)
+
+struct Flusher;
+
 /**
  * @struct ObjFile
+ *
+ * The line buffer is reused by every line read from the file. A file
+ * written in the background has a flusher, which everything written to
+ * it goes through rather than the FILE*.
  */
 typedef struct {
     Obj obj;
@@ -317,13 +594,160 @@ typedef struct {
     bool closed;
     FileMode mode;
     ObjString* name;
+    char* buffer;
+    char* line;
+    size_t lineCapacity;
+    struct Flusher* flusher;
 } ObjFile;
 
+/**
+ * @struct ObjStringBuilder
+ *
+ * A growable buffer for building up a string without
+ * creating (and interning) every intermediate string.
+ */
+typedef struct {
+    Obj obj;
+    char* chars;
+    int length;
+    int capacity;
+} ObjStringBuilder;
+
+/**
+ * @enum ArrayType
+ *
+ * The element types a typed array can hold.
+ */
+typedef enum ArrayType {
+    ARRAY_F64,
+    ARRAY_I64
+} ArrayType;
+
+/**
+ * @struct ObjArray
+ *
+ * A fixed length array of numbers stored unboxed in one contiguous buffer,
+ * either as doubles or as 64 bit integers.
+ */
+typedef struct {
+    Obj obj;
+    ArrayType type;
+    int count;
+    union {
+        double* f64;
+        int64_t* i64;
+    } as;
+} ObjArray;
+
+/**
+ * @struct ObjRange
+ *
+ * A lazy arithmetic sequence from start up to, but not including, stop.
+ * The values are worked out as they're iterated over rather than stored.
+ */
+typedef struct {
+    Obj obj;
+    double start;
+    double stop;
+    double step;
+} ObjRange;
+
+/**
+ * @enum DictViewKind
+ *
+ * What a dict view produces for each of its dict's entries.
+ */
+typedef enum {
+    VIEW_KEYS,
+    VIEW_VALUES,
+    VIEW_ITEMS,
+} DictViewKind;
+
+/**
+ * @struct ObjDictView
+ *
+ * A live view over a dict's keys, values or [key, value] pairs, as returned
+ * by keys(), values() and items(). Iterating one walks the dict's table
+ * directly, so nothing is copied unless it's turned into a list.
+ */
+typedef struct {
+    Obj obj;
+    ObjDict* dict;
+    DictViewKind kind;
+} ObjDictView;
+
+/**
+ * @struct MemoEntry
+ *
+ * The result of one call to a memoised function, under the args it was called with.
+ */
+typedef struct {
+    Value* args;
+    int argCount;
+    uint32_t hash;
+    Value result;
+    // the next entry in the same bucket, or -1
+    int chain;
+    // the entries used just after and before this one, or -1
+    int newer;
+    int older;
+} MemoEntry;
+
+/**
+ * @struct ObjMemo
+ *
+ * A function wrapped so its results are remembered by the args it's called
+ * with, as made by the cache module. Calling one looks the args up before
+ * the function's called at all. The entries are kept in the order they were
+ * last used, so once there are maxSize of them the least recently used one
+ * makes way for the next; a maxSize of 0 means there's no limit.
+ */
+typedef struct {
+    Obj obj;
+    Value function;
+    int maxSize;
+    int count;
+    int capacity;
+    MemoEntry* entries;
+    // the first entry in each bucket, or -1
+    int* buckets;
+    int bucketCount;
+    int newest;
+    int oldest;
+    uint64_t hits;
+    uint64_t misses;
+} ObjMemo;
+
+/**
+ * @struct RandomState
+ *
+ * The state of a xoshiro256** generator. Each VM has one behind the random
+ * module's functions, and each random.Random has its own.
+ */
+typedef struct {
+    uint64_t s[4];
+} RandomState;
+
+/**
+ * @struct ObjRandom
+ *
+ * A random number generator independent of the VM's, from random.Random.
+ */
+typedef struct {
+    Obj obj;
+    RandomState state;
+} ObjRandom;
+
 /**
  * @struct ObjError
+ *
+ * An error a native returned, or an exception raised in slo.
+ * Only the type and message are kept: the stack trace is only
+ * put together if the exception's never caught and is reported.
  */
 typedef struct {
     Obj obj;
+    enum ErrorType type;
     ObjString* message;
 } ObjError;
 
@@ -342,6 +766,23 @@ ObjClass* newClass(ObjString* name, ObjClass* superClass);
  */
 ObjClosure* newClosure(ObjFunction* function);
 
+/**
+ * Method for getting a field from an instance.
+ */
+bool instanceGetField(ObjInstance* instance, ObjString* name, Value* value);
+
+/**
+ * Method for adding a field to an instance by moving it to the given shape.
+ * The shape must be a transition from the instance's current shape.
+ */
+void instanceAddField(ObjInstance* instance, Shape* next, Value value);
+
+/**
+ * Method for setting a field on an instance, adding it if it's new.
+ * Returns true if the field was added.
+ */
+bool instanceSetField(ObjInstance* instance, ObjString* name, Value value);
+
 /**
  * Method for creating a new ObjInstance.
  */
@@ -377,6 +818,50 @@ ObjString* takeString(char* chars, int length);
  */
 ObjString* copyString(const char* chars, int length);
 
+/**
+ * Method for interning a copy of the given string when its hash is already known,
+ * like the strings in a bundle's pool.
+ */
+ObjString* copyStringHashed(const char* chars, int length, uint32_t hash);
+
+/**
+ * Method for creating an uninterned ObjString and taking ownership of the given string.
+ *
+ * For string data made while running, which would only fill up the intern table.
+ */
+ObjString* takeRuntimeString(char* chars, int length);
+
+/**
+ * Method for creating an uninterned ObjString and copying the given string onto the heap.
+ */
+ObjString* copyRuntimeString(const char* chars, int length);
+
+/**
+ * Method for getting a string's hash, working it out on first use.
+ */
+uint32_t stringHash(ObjString* string);
+
+/**
+ * Method for creating a string that views part of another string without copying it.
+ *
+ * The parent has to be rooted by the caller.
+ */
+ObjString* newStringView(ObjString* parent, int start, int length);
+
+/**
+ * Method for creating a view of the whole of a memory mapped file.
+ *
+ * The string that owns the mapping unmaps it once no views are left.
+ */
+ObjString* newMappedString(char* chars, int length);
+
+/**
+ * Method for getting a string's null terminated characters.
+ *
+ * A view is materialised into its own copy of the characters first.
+ */
+char* stringChars(ObjString* string);
+
 /**
  * Method for creating a new upvalue.
  */
@@ -387,11 +872,44 @@ ObjUpvalue* newUpvalue(Value* slot);
  */
 ObjList* newList();
 
+/**
+ * Method for creating a new, empty ObjList with room for capacity values.
+ */
+ObjList* newListWithCapacity(int capacity);
+
+/**
+ * Method for creating a list the compiler has proven never leaves the frame
+ * making it, with room for capacity values. It's kept off the collector's
+ * lists and freed by the frame, see freeLocalObject.
+ */
+ObjList* newLocalList(int capacity);
+
+/**
+ * Method for creating a list of count of the given list's values from start,
+ * sharing them with it rather than copying them.
+ */
+ObjList* shareList(ObjList* list, int start, int count);
+
+/**
+ * Method for giving a list its own copy of the values it shares with others.
+ */
+void copySharedValues(ObjList* list);
+
 /**
  * Method for creating a new ObjDict.
  */
 ObjDict* newDict();
 
+/**
+ * Method for creating a new, empty ObjDict with room for count entries.
+ */
+ObjDict* newDictWithCapacity(int count);
+
+/**
+ * Method for creating a dict that never leaves the frame making it, see newLocalList.
+ */
+ObjDict* newLocalDict(int count);
+
 /**
  * Method for creating a new ObjModule.
  */
@@ -403,15 +921,147 @@ ObjModule* newModule();
 ObjEnum* newEnum(ObjString* name);
 
 /**
- * Method for creating a new ObjFile.
+ * Method for creating a new ObjFile, with a stdio buffer of bufferSize bytes.
+ *
+ * A bufferSize of 0 leaves the FILE* with the one it has.
+ */
+ObjFile* newFile(FILE* file, FileMode mode, ObjString* name, size_t bufferSize);
+
+/**
+ * Method for creating a new ObjStringBuilder.
+ */
+ObjStringBuilder* newStringBuilder();
+
+/**
+ * Method for appending a value's string form to a string builder.
+ *
+ * Returns false if the value couldn't be converted to a string.
+ */
+bool stringBuilderAppend(ObjStringBuilder* builder, Value value);
+
+/**
+ * Method for creating a new zeroed ObjArray of the given type and length.
+ */
+ObjArray* newArray(ArrayType type, int count);
+
+/**
+ * Method for creating a new, empty ObjSet.
  */
-ObjFile* newFile(FILE* file, FileMode mode, ObjString* name);
+ObjSet* newSet();
+
+/**
+ * Method for creating a new zeroed ObjBytes of the given length.
+ */
+ObjBytes* newBytes(int count);
+
+/**
+ * Method for creating a new ObjRange. The step must not be zero.
+ */
+ObjRange* newRange(double start, double stop, double step);
+
+/**
+ * Method for creating a new ObjRandom, which has to be seeded before it's used.
+ */
+ObjRandom* newRandom();
+
+/**
+ * Method for getting the number of values a range produces.
+ */
+int rangeLength(ObjRange* range);
+
+/**
+ * Method for creating a new ObjDictView over the given dict.
+ */
+ObjDictView* newDictView(ObjDict* dict, DictViewKind kind);
+
+/**
+ * Method for getting the nth entry a dict view produces, or NULL if there isn't one.
+ */
+Entry* dictViewEntry(ObjDictView* view, int index);
+
+/**
+ * Method for getting what a dict view produces for one of its dict's entries.
+ *
+ * Only an items view allocates, for the pair.
+ */
+Value dictViewValue(ObjDictView* view, Entry* entry);
+
+/**
+ * Method for checking whether a dict view would produce the given value.
+ */
+bool dictViewHas(ObjDictView* view, Value value);
+
+/**
+ * Method for copying what a dict view produces into a new list.
+ */
+ObjList* dictViewToList(ObjDictView* view);
+
+/**
+ * Method for creating a new ObjMemo remembering the results of the given function.
+ */
+ObjMemo* newMemo(Value function, int maxSize);
+
+/**
+ * Method for creating a new ObjFiber that runs the given closure.
+ */
+ObjFiber* newFiber(ObjClosure* closure);
+
+/**
+ * Method for creating a new ObjSocket that owns the given file descriptor.
+ */
+ObjSocket* newSocket(int fd, bool listening);
+
+/**
+ * Method for closing an ObjSocket's file descriptor.
+ */
+void closeSocket(ObjSocket* socket);
+
+/**
+ * Method for creating a new ObjThread for a started thread.
+ */
+ObjThread* newThread(struct ThreadHandle* handle);
+
+/**
+ * Method for creating a new ObjChannel, taking a reference to the channel.
+ */
+ObjChannel* newChannel(struct Channel* channel);
+
+/**
+ * Method for closing an ObjFile and freeing its buffers.
+ *
+ * Returns false if anything written to it couldn't be.
+ */
+bool closeFile(ObjFile* file);
+
+/**
+ * Method for waiting until everything written to a file in the background is in it,
+ * before the FILE* is used directly. Returns false if any of it couldn't be written.
+ */
+bool syncFile(ObjFile* file);
 
 /**
  * Method for creating a new ObjError.
  */
 ObjError* newError(const char* message);
 
+/**
+ * Method for creating a new ObjError of the given type to raise as an exception.
+ */
+ObjError* newException(enum ErrorType type, const char* message);
+
+/**
+ * Method for returning an error from a native without allocating.
+ *
+ * The message isn't copied so it must outlive the call, like a string literal.
+ * Use ERROR_VAL_PTR() for messages built in a buffer.
+ */
+Value nativeError(const char* message);
+
+/**
+ * Method for getting the message of an error a native returned.
+ */
+const char* errorMessage(Value error);
+
 /**
  * Method for printing an object.
  */
@@ -424,6 +1074,36 @@ static inline bool isObjType(Value value, ObjType type) {
   return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
+/**
+ * Method for making sure a list owns its values before anything writes to them
+ * or grows them.
+ */
+static inline void unshareList(ObjList* list) {
+    if (list->storage != NULL) {
+        copySharedValues(list);
+    }
+}
+
+/**
+ * Method for reading an element of a typed array as a number.
+ */
+static inline double arrayGet(ObjArray* array, int index) {
+    return array->type == ARRAY_F64 ? array->as.f64[index] : (double)array->as.i64[index];
+}
+
+/**
+ * Method for writing a number to an element of a typed array.
+ *
+ * Integer arrays truncate the number towards zero.
+ */
+static inline void arraySet(ObjArray* array, int index, double value) {
+    if (array->type == ARRAY_F64) {
+        array->as.f64[index] = value;
+    } else {
+        array->as.i64[index] = (int64_t)value;
+    }
+}
+
 // helper macro for defining inline params
 #define PARAMS(...)  createParamInfoArray(((ParamInfo[]){__VA_ARGS__}), sizeof((ParamInfo[]){__VA_ARGS__})/sizeof(ParamInfo))
 
@@ -0,0 +1,88 @@
+/**
+ * @file opcode_stats.h
+ *
+ * Counts of how often run() executes each opcode, and each opcode straight
+ * after another, for finding out which superinstructions and quickenings real
+ * programs would gain from. Only in builds with SLO_OPCODE_STATS defined
+ * (make cslo-opstats), with SLO_OPCODE_CYCLES as well it also adds up the
+ * cycles from dispatching each opcode to dispatching the next.
+ *
+ * Each VM counts its own, which are added together as VMs are freed and
+ * written out at exit. Loops running as machine code (see jit.h) aren't
+ * dispatched so aren't counted, run with --no-jit to count them.
+ */
+
+#ifndef cslo_opcode_stats_h
+#define cslo_opcode_stats_h
+
+#include "core/common.h"
+
+#ifdef SLO_OPCODE_STATS
+
+#include <stdio.h>
+
+// cycles are read from the time stamp counter, so are only counted on x86
+#if defined(SLO_OPCODE_CYCLES) && !(defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)))
+#undef SLO_OPCODE_CYCLES
+#endif
+
+// the file the counts are written to as JSON, instead of a table on stderr, if it's set
+#define OPCODE_STATS_ENV "SLO_OPCODE_STATS"
+
+// how many of the most run opcode pairs the table lists
+#define OPCODE_STATS_PAIRS 40
+
+/**
+ * @struct OpcodeStats
+ *
+ * A VM's counts, pairs[a][b] being how often b ran straight after a.
+ */
+typedef struct OpcodeStats {
+    // UINT8_MAX before anything has run
+    uint8_t last;
+    uint64_t counts[UINT8_COUNT];
+    uint64_t pairs[UINT8_COUNT][UINT8_COUNT];
+#ifdef SLO_OPCODE_CYCLES
+    uint64_t lastCycles;
+    uint64_t cycles[UINT8_COUNT];
+#endif
+} OpcodeStats;
+
+/**
+ * Method for making a VM's counts, all zero.
+ */
+OpcodeStats* newOpcodeStats();
+
+/**
+ * Method for adding a VM's counts to the totals, and freeing them.
+ */
+void mergeOpcodeStats(OpcodeStats* stats);
+
+/**
+ * Method for writing the totals, after adding in the running VM's.
+ *
+ * They go to the file named by OPCODE_STATS_ENV as JSON if it's set, or out as a table.
+ */
+void writeOpcodeStats(FILE* out);
+
+/**
+ * Method for counting an instruction that's about to run.
+ */
+static inline void countOpcode(OpcodeStats* stats, uint8_t instruction) {
+    stats->counts[instruction]++;
+    if (stats->last != UINT8_MAX) {
+        stats->pairs[stats->last][instruction]++;
+    }
+#ifdef SLO_OPCODE_CYCLES
+    uint64_t now = __builtin_ia32_rdtsc();
+    if (stats->last != UINT8_MAX) {
+        stats->cycles[stats->last] += now - stats->lastCycles;
+    }
+    stats->lastCycles = now;
+#endif
+    stats->last = instruction;
+}
+
+#endif
+
+#endif
@@ -44,6 +44,7 @@ typedef enum OpCode {
     OP_JUMP_IF_TRUE,
     OP_LOOP,
     OP_CALL,
+    OP_TAIL_CALL,
     OP_INVOKE,
     OP_SUPER_INVOKE,
     OP_CLOSURE,
@@ -66,9 +67,42 @@ typedef enum OpCode {
     OP_DICT,
     OP_ENUM,
     OP_IMPORT,
-    OP_IMPORT_AS,
     OP_INTERPOLATE,
     OP_ASSERT,
+    OP_ITER_NEXT,
+    OP_NEW_LIST,
+    OP_NEW_DICT,
+    OP_LIST_APPEND,
+    OP_DICT_INSERT,
+    OP_THROW,
+    OP_EXCEPT_JUMP,
+    OP_FORMAT,
+    OP_GET_CAPTURED,
+    // OP_CONSTANT with a two byte index, for chunks with more than 256 constants
+    OP_CONSTANT_LONG,
+    // lists and dicts the compiler has proven never leave their frame, see newLocalList
+    OP_LIST_LOCAL,
+    OP_DICT_LOCAL,
+    OP_POP_LOCAL,
+    OP_RETURN_LOCALS,
+    // superinstructions only emitted by the optimiser
+    OP_INC_LOCAL,
+    OP_GET_LOCAL_GET_LOCAL,
+    OP_LESS_JUMP,
+    OP_POP_N,
+    // three address arithmetic on frame slots, also only from the optimiser
+    OP_LOCALS_ARITH,
+    OP_LOCAL_CONSTANT_ARITH,
+    OP_LOCALS_ARITH_SET,
+    OP_LOCAL_CONSTANT_ARITH_SET,
+    // quickened forms the VM rewrites the generic instruction into after seeing its operands' types,
+    // never compiled or written to a cache, see genericInstruction
+    OP_GET_INDEX_LIST,
+    OP_GET_INDEX_DICT,
+    OP_SET_INDEX_LIST,
+    OP_SET_INDEX_DICT,
+    OP_HAS_DICT,
+    OP_HAS_SET,
 } OpCode;
 
 #endif
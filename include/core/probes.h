@@ -0,0 +1,101 @@
+/**
+ * @file probes.h
+ *
+ * Static tracepoints for bpftrace, perf and SystemTap to attach to, in
+ * builds with SLO_PROBES defined (make cslo-probes) where sys/sdt.h is
+ * there. Each is a nop in the code until something attaches to it, and
+ * the arguments are only worked out while something has, so a probes
+ * build runs as fast as any other when it isn't being traced.
+ *
+ * The probes, under the provider "slo":
+ *
+ *     function__entry(name, file, line)        a slo function is called
+ *     function__return(name, file, line)       and returns
+ *     gc__start(bytes, major)                  a collection starts
+ *     gc__done(before, after, major)           and finishes
+ *     module__load__start(name, importer)      an import isn't loaded yet
+ *     module__load__done(name, found)          and has been found or not
+ *     error(type, message, file, line)         a runtime error is raised
+ *
+ * Strings are NUL terminated, line is where the function starts on entry
+ * and where it returned from on return, and bytes are the heap's size:
+ *
+ *     bpftrace -e 'usdt:./build/cslo-probes:slo:function__entry
+ *         { @[str(arg0)] = count(); }' -c './build/cslo-probes app.slo'
+ *
+ * Without SLO_PROBES, or without the header, they're all left out.
+ */
+
+#ifndef cslo_probes_h
+#define cslo_probes_h
+
+#include "core/common.h"
+
+#if defined(SLO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define SLO_HAS_PROBES
+#endif
+#endif
+
+#ifdef SLO_HAS_PROBES
+
+#include "core/object.h"
+
+// each probe gets a semaphore that tracers bump while they're attached
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define PROBE_SEMAPHORE(name) slo_##name##_semaphore
+#define PROBE_ENABLED(name) UNLIKELY(PROBE_SEMAPHORE(name) != 0)
+
+extern unsigned short PROBE_SEMAPHORE(function__entry);
+extern unsigned short PROBE_SEMAPHORE(function__return);
+extern unsigned short PROBE_SEMAPHORE(gc__start);
+extern unsigned short PROBE_SEMAPHORE(gc__done);
+extern unsigned short PROBE_SEMAPHORE(module__load__start);
+extern unsigned short PROBE_SEMAPHORE(module__load__done);
+extern unsigned short PROBE_SEMAPHORE(error);
+
+/**
+ * Method for firing function__entry for a function that's just been called.
+ */
+void probeFunctionEntry(ObjFunction* function);
+
+/**
+ * Method for firing function__return for a function returning from the given offset.
+ */
+void probeFunctionReturn(ObjFunction* function, int offset);
+
+/**
+ * Method for firing error, for one raised where the running frame is.
+ */
+void probeError(const char* type, const char* message);
+
+#define PROBE_FUNCTION_ENTRY(function) \
+    do { if (PROBE_ENABLED(function__entry)) probeFunctionEntry(function); } while (false)
+#define PROBE_FUNCTION_RETURN(function, offset) \
+    do { if (PROBE_ENABLED(function__return)) probeFunctionReturn(function, offset); } while (false)
+#define PROBE_GC_START(bytes, major) \
+    do { if (PROBE_ENABLED(gc__start)) STAP_PROBE2(slo, gc__start, bytes, major); } while (false)
+#define PROBE_GC_DONE(before, after, major) \
+    do { if (PROBE_ENABLED(gc__done)) STAP_PROBE3(slo, gc__done, before, after, major); } while (false)
+#define PROBE_MODULE_LOAD_START(name, importer) \
+    do { if (PROBE_ENABLED(module__load__start)) STAP_PROBE2(slo, module__load__start, name, importer); } while (false)
+#define PROBE_MODULE_LOAD_DONE(name, found) \
+    do { if (PROBE_ENABLED(module__load__done)) STAP_PROBE2(slo, module__load__done, name, found); } while (false)
+#define PROBE_ERROR(type, message) \
+    do { if (PROBE_ENABLED(error)) probeError(type, message); } while (false)
+
+#else
+
+#define PROBE_FUNCTION_ENTRY(function) do {} while (false)
+#define PROBE_FUNCTION_RETURN(function, offset) do {} while (false)
+#define PROBE_GC_START(bytes, major) do {} while (false)
+#define PROBE_GC_DONE(before, after, major) do {} while (false)
+#define PROBE_MODULE_LOAD_START(name, importer) do {} while (false)
+#define PROBE_MODULE_LOAD_DONE(name, found) do {} while (false)
+#define PROBE_ERROR(type, message) do {} while (false)
+
+#endif
+
+#endif  // cslo_probes_h
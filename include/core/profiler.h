@@ -0,0 +1,61 @@
+/**
+ * @file profiler.h
+ *
+ * Profiling of where a slo program spends its time, turned on with --profile.
+ *
+ * PROFILE_CALLS counts each function's calls and times them as they're made
+ * and returned from, both inclusive (with the functions they call) and
+ * exclusive (without). PROFILE_SAMPLES instead has a CPU timer interrupt the
+ * program every millisecond, and the next call, return or loop back edge
+ * records the stack of frames it's running, by function and file:line, in
+ * the collapsed format flame graph tools read.
+ *
+ * Only the main VM is profiled, time spent in other threads is sampled
+ * wherever the main one is.
+ */
+
+#ifndef cslo_profiler_h
+#define cslo_profiler_h
+
+#include <stdio.h>
+
+#include "core/common.h"
+
+// what vm->profile is set to, and either or both can be
+#define PROFILE_CALLS 0x1
+#define PROFILE_SAMPLES 0x2
+
+// how often a sample's taken, in microseconds of CPU time
+#define PROFILE_INTERVAL 1000
+
+/**
+ * Method for starting to profile the running VM. Must be called before running any code.
+ */
+void startProfiler(int mode);
+
+/**
+ * Method for recording that a frame has been entered, by its index in vm->frames.
+ */
+void profileCall(int frame);
+
+/**
+ * Method for recording that a frame is about to return, by its index in vm->frames.
+ *
+ * The frame's ip has to be up to date, as a sample may be taken first.
+ */
+void profileReturn(int frame);
+
+/**
+ * Method for taking any samples the timer's asked for since the last one,
+ * at a back edge. The running frame's ip has to be up to date.
+ */
+void profileSample();
+
+/**
+ * Method for stopping the profiler and writing what it recorded.
+ *
+ * The table of calls goes to out, and the collapsed stacks to the file at samplesPath.
+ */
+void writeProfile(FILE* out, const char* samplesPath);
+
+#endif
@@ -0,0 +1,62 @@
+/**
+ * @file shape.h
+ * @brief Hidden classes describing the field layout of instances.
+ */
+
+#ifndef cslo_shape_h
+#define cslo_shape_h
+
+#include "core/common.h"
+#include "core/table.h"
+#include "core/value.h"
+
+/**
+ * @struct Shape
+ *
+ * A shape maps field names to indexes in an instance's field array.
+ * Instances of a class that had the same fields added in the same order
+ * share a shape. Each class has a root shape with no fields and adding a
+ * field moves an instance along a transition to a child shape.
+ *
+ * Shapes never change once created so a shape pointer is enough for an
+ * inline cache to know where a field lives.
+ */
+typedef struct Shape {
+    struct ObjClass* owner;
+    struct Shape* parent;
+    ObjString* name;
+    int fieldCount;
+    Table slots;
+    int transitionCount;
+    int transitionCapacity;
+    struct Shape** transitions;
+} Shape;
+
+/**
+ * Method for creating the root shape for a class.
+ */
+Shape* newShape(struct ObjClass* owner);
+
+/**
+ * Method for getting the index of a field in a shape.
+ * Returns -1 if the shape doesn't have the field.
+ */
+int shapeSlot(Shape* shape, ObjString* name);
+
+/**
+ * Method for getting the shape after adding a field to the given shape.
+ * Reuses an existing transition when there is one.
+ */
+Shape* shapeTransition(Shape* shape, ObjString* name);
+
+/**
+ * Method for marking the strings held by a shape and its transitions.
+ */
+void markShape(Shape* shape);
+
+/**
+ * Method for freeing a shape and its transitions.
+ */
+void freeShape(Shape* shape);
+
+#endif
@@ -0,0 +1,40 @@
+/**
+ * @file snapshot.h
+ * @brief Saving the globals a script leaves behind, to start from them again.
+ */
+
+#ifndef cslo_snapshot_h
+#define cslo_snapshot_h
+
+#include <stdbool.h>
+
+#include "core/vm.h"
+
+/**
+ * The magic bytes at the start of every snapshot.
+ */
+#define SNAPSHOT_MAGIC "SLOI"
+
+/**
+ * The global a snapshot starts running from.
+ */
+#define SNAPSHOT_ENTRY "main"
+
+/**
+ * Method for writing every global, and everything they reach, to a snapshot.
+ *
+ * Globals are packed the same way as they're copied into a new thread,
+ * so modules are imported again by name and natives looked up again by
+ * name when it's loaded. Globals that can't be saved, such as open files,
+ * are left out with a warning. Returns false if it couldn't be written.
+ */
+bool writeSnapshot(const char* path);
+
+/**
+ * Method for loading a snapshot's globals and calling its main().
+ *
+ * Nothing's compiled and the script's top level isn't run again.
+ */
+InterpretResult interpretSnapshot(const char* path);
+
+#endif  // cslo_snapshot_h
@@ -0,0 +1,28 @@
+/**
+ * @file sort.h
+ * @brief Stable sorting of values.
+ */
+
+#ifndef cslo_sort_h
+#define cslo_sort_h
+
+#include "core/common.h"
+#include "core/value.h"
+
+/**
+ * Method for sorting values in place.
+ *
+ * The sort is a stable, adaptive merge sort: already sorted runs are found and
+ * merged rather than sorted again. Lists of only numbers or only strings
+ * are sorted on their raw doubles / strings without re-checking types.
+ */
+void sortValues(Value* values, int count);
+
+/**
+ * Method for sorting values in place by a key per value.
+ *
+ * keys[i] is the key for values[i] and is moved along with it.
+ */
+void sortValuesByKey(Value* values, Value* keys, int count);
+
+#endif
@@ -10,18 +10,29 @@
 
 /**
  * @struct Entry
+ *
+ * A key/value pair and the key's hash. Deleted entries have an empty key.
  */
 typedef struct Entry {
     Value key;
     Value value;
+    uint32_t hash;
 } Entry;
 
 /**
  * @struct Table
+ *
+ * A compact, insertion ordered hash table.
+ *
+ * The entries are stored densely in the order they were added, and the
+ * open addressed hash index only holds positions into that array. Iterating
+ * a table is a walk over entries[0..entryCount), skipping deleted entries.
  */
 typedef struct Table {
     int count;
+    int entryCount;
     int capacity;
+    int32_t* index;
     Entry* entries;
 } Table;
 
@@ -65,4 +76,9 @@ ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t
  */
 bool tableGet(Table* table, Value key, Value* value);
 
+/**
+ * Method for growing a table so it can hold count entries without growing again.
+ */
+void tableReserve(Table* table, int count);
+
 #endif
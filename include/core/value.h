@@ -5,6 +5,9 @@
 #ifndef cslo_value_h
 #define cslo_value_h
 
+#include <math.h>
+#include <string.h>
+
 #include "core/common.h"
 
 /**
@@ -24,11 +27,148 @@ typedef enum ValueType {
     VAL_BOOL,
     VAL_NIL,
     VAL_NUMBER,
+    VAL_INT, // a number that's a small integer
     VAL_OBJ,
     VAL_EMPTY, // used for tombstoning
     VAL_ERROR // used for error handling
 } ValueType;
 
+#ifdef NAN_BOXING
+
+/**
+ * @typedef Value
+ *
+ * Defines a Value in slo as a NaN-boxed 64-bit word.
+ *
+ * Any double that isn't a quiet NaN with our tag bits set is a number.
+ * Small integers set INT_TAG and keep their 32 bits in the low word.
+ * Objects set the sign bit and store the pointer in the low 48 bits.
+ * The singletons (nil, true, false, empty, error) are tagged quiet NaNs and
+ * native error objects are pointers carrying the extra ERROR_TAG bit.
+ */
+typedef uint64_t Value;
+
+#define SIGN_BIT  ((uint64_t)0x8000000000000000)
+#define QNAN      ((uint64_t)0x7ffc000000000000)
+#define ERROR_TAG ((uint64_t)0x0002000000000000)
+#define INT_TAG   ((uint64_t)0x0001000000000000)
+
+#define TAG_NIL   1
+#define TAG_FALSE 2
+#define TAG_TRUE  3
+#define TAG_EMPTY 4
+#define TAG_ERROR 5
+
+/**
+ * Method for reinterpreting a Value as a double.
+ */
+static inline double valueToNum(Value value) {
+    double num;
+    memcpy(&num, &value, sizeof(Value));
+    return num;
+}
+
+/**
+ * The one NaN every number that's NaN is stored as.
+ */
+#define CANONICAL_NAN ((uint64_t)0x7ff8000000000000)
+
+/**
+ * Method for reinterpreting a double as a Value.
+ *
+ * A NaN decoded from raw bits can carry any payload, including our tag
+ * bits, so every NaN is stored as CANONICAL_NAN instead.
+ */
+static inline Value numToValue(double num) {
+    Value value;
+    memcpy(&value, &num, sizeof(double));
+    return num == num ? value : CANONICAL_NAN;
+}
+
+#define ERROR_VAL_PTR(message) ((Value)(QNAN | ERROR_TAG | (uint64_t)(uintptr_t)newError(message)))
+
+/** Macro for checking if the given value is a VAL_BOOL. */
+#define IS_BOOL(value)    (((value) | 1) == TRUE_VAL)
+
+/** Macro for checking if the given value is a VAL_NIL. */
+#define IS_NIL(value)     ((value) == NIL_VAL)
+
+/** Macro for checking if the given value is a VAL_NUMBER stored as a double. */
+#define IS_DOUBLE(value)  (((value) & QNAN) != QNAN)
+
+/** Macro for checking if the given value is a VAL_INT. */
+#define IS_INT(value)     (((value) & ~(uint64_t)0xffffffff) == (QNAN | INT_TAG))
+
+/** Macro for checking if the given value is a VAL_OBJ. */
+#define IS_OBJ(value)     (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+/** Macro for checking if the given value is a VAL_EMPTY. */
+#define IS_EMPTY(value)   ((value) == EMPTY_VAL)
+
+/** Macro for checking if the given value is a VAL_ERROR. */
+#define IS_ERROR(value)   ((value) == ERROR_VAL || \
+                           ((value) & (QNAN | SIGN_BIT | ERROR_TAG)) == (QNAN | ERROR_TAG))
+
+/** Macro for checking if the given error carries an ObjError, rather than being a bare ERROR_VAL. */
+#define HAS_ERROR_OBJ(value) (IS_ERROR(value) && (value) != ERROR_VAL)
+
+/** Macro for converting a boolean Value into a bool. */
+#define AS_BOOL(value)    ((value) == TRUE_VAL)
+
+/** Macro for converting a double Value into a double. */
+#define AS_DOUBLE(value)  valueToNum(value)
+
+/** Macro for converting an int Value into an int32_t. */
+#define AS_INT(value)     ((int32_t)(uint32_t)(value))
+
+/** Macro for converting a value to an object. */
+#define AS_OBJ(value)     ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN | ERROR_TAG)))
+
+/**Macro for creating a boolean Value from true/false. */
+#define BOOL_VAL(b)       ((b) ? TRUE_VAL : FALSE_VAL)
+
+#define FALSE_VAL         ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL          ((Value)(uint64_t)(QNAN | TAG_TRUE))
+
+/**Macro for creating a nil Value. */
+#define NIL_VAL           ((Value)(uint64_t)(QNAN | TAG_NIL))
+
+/**Macro for creating a number Value from the given number. */
+#define NUMBER_VAL(num)   numToValue(num)
+
+/**Macro for creating an int Value from the given int32_t. */
+#define INT_VAL(i)        ((Value)(QNAN | INT_TAG | (uint64_t)(uint32_t)(int32_t)(i)))
+
+/** Macro for creating a Obj Value from the given value. */
+#define OBJ_VAL(obj)      (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
+
+/** Macro for creating an Empty value. */
+#define EMPTY_VAL         ((Value)(uint64_t)(QNAN | TAG_EMPTY))
+
+/** Macro for creating an Error value. */
+#define ERROR_VAL         ((Value)(uint64_t)(QNAN | TAG_ERROR))
+
+/**
+ * Method for working out the ValueType of a NaN-boxed value.
+ */
+static inline ValueType valueType(Value value) {
+    if (IS_DOUBLE(value)) return VAL_NUMBER;
+    if (IS_INT(value)) return VAL_INT;
+    if (IS_OBJ(value)) return VAL_OBJ;
+    if (IS_ERROR(value)) return VAL_ERROR;
+    switch (value & 7) {
+        case TAG_NIL: return VAL_NIL;
+        case TAG_FALSE:
+        case TAG_TRUE: return VAL_BOOL;
+        default: return VAL_EMPTY;
+    }
+}
+
+/** Macro for getting the ValueType of a given value. */
+#define VALUE_TYPE(value) valueType(value)
+
+#else
+
 /**
  * @struct Value
  *
@@ -40,11 +180,11 @@ typedef struct Value {
     union {
         bool boolean;
         double number;
+        int32_t integer;
         Obj* obj;
     } as;
 } Value;
 
-
 #define ERROR_VAL_PTR(message) ((Value){VAL_ERROR, { .obj = (Obj*)newError(message) }})
 
 /**
@@ -57,8 +197,11 @@ typedef struct Value {
 /** Macro for checking if the given value is a VAL_NIL. */
 #define IS_NIL(value)     ((value).type == VAL_NIL)
 
-/** Macro for checking if the given value is a VAL_NUMBER. */
-#define IS_NUMBER(value)  ((value).type == VAL_NUMBER)
+/** Macro for checking if the given value is a VAL_NUMBER stored as a double. */
+#define IS_DOUBLE(value)  ((value).type == VAL_NUMBER)
+
+/** Macro for checking if the given value is a VAL_INT. */
+#define IS_INT(value)     ((value).type == VAL_INT)
 
 /** Macro for checking if the given value is a VAL_OBJ. */
 #define IS_OBJ(value)     ((value).type == VAL_OBJ)
@@ -69,6 +212,9 @@ typedef struct Value {
 /** Macro for checking if the given value is a VAL_ERROR. */
 #define IS_ERROR(value)   ((value).type == VAL_ERROR)
 
+/** Macro for checking if the given error carries an ObjError, rather than being a bare ERROR_VAL. */
+#define HAS_ERROR_OBJ(value) (IS_ERROR(value) && (value).as.obj != NULL)
+
 /**
  * Macros for converting slo Values into C values.
  */
@@ -76,8 +222,11 @@ typedef struct Value {
 /** Macro for converting a boolean Value into a bool. */
 #define AS_BOOL(value)    ((value).as.boolean)
 
-/** Macro for converting a number Value into a double. */
-#define AS_NUMBER(value)  ((value).as.number)
+/** Macro for converting a double Value into a double. */
+#define AS_DOUBLE(value)  ((value).as.number)
+
+/** Macro for converting an int Value into an int32_t. */
+#define AS_INT(value)     ((value).as.integer)
 
 /** Macro for converting a value to an object. */
 #define AS_OBJ(value)     ((value).as.obj)
@@ -95,6 +244,9 @@ typedef struct Value {
 /**Macro for creating a number Value from the given number. */
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
 
+/**Macro for creating an int Value from the given int32_t. */
+#define INT_VAL(value)    ((Value){VAL_INT, {.integer = value}})
+
 /** Macro for creating a Obj Value from the given value. */
 #define OBJ_VAL(object)   ((Value){VAL_OBJ, {.obj = (Obj*)object}})
 
@@ -104,6 +256,120 @@ typedef struct Value {
 /** Macro for creating an Error value. */
 #define ERROR_VAL         ((Value){VAL_ERROR, { .number = 0 } })
 
+/** Macro for getting the ValueType of a given value. */
+#define VALUE_TYPE(value) ((value).type)
+
+#endif
+
+/**
+ * Numbers are doubles, but the small integers loop counters, indexes and
+ * dictionary keys mostly are have their own VAL_INT so arithmetic on them
+ * stays in integers. Both are the one "number" type to slo code, and
+ * anything that overflows an int32_t, or would be -0, becomes a double.
+ */
+
+/** Macro for checking if the given value is a number, either a double or an int. */
+#define IS_NUMBER(value)  isNumber(value)
+
+/** Macro for converting a number Value, either a double or an int, into a double. */
+#define AS_NUMBER(value)  asNumber(value)
+
+/**
+ * Method for checking if the given value is a number, either a double or an int.
+ */
+static inline bool isNumber(Value value) {
+    return IS_DOUBLE(value) || IS_INT(value);
+}
+
+/**
+ * Method for converting a number Value, either a double or an int, into a double.
+ */
+static inline double asNumber(Value value) {
+    return IS_INT(value) ? (double)AS_INT(value) : AS_DOUBLE(value);
+}
+
+/**
+ * Method for converting a number Value into an int, truncating a double as (int) does.
+ */
+static inline int numberToInt(Value value) {
+    return IS_INT(value) ? AS_INT(value) : (int)AS_DOUBLE(value);
+}
+
+/**
+ * Method for making a number Value from a double, as an int if it's a small integer.
+ */
+static inline Value integralNumber(double number) {
+    if (number >= INT32_MIN && number <= INT32_MAX && number == (double)(int32_t)number
+            && (number != 0 || !signbit(number))) {
+        return INT_VAL((int32_t)number);
+    }
+    return NUMBER_VAL(number);
+}
+
+/**
+ * Method for adding two ints, returning false if the sum doesn't fit in one.
+ */
+static inline bool addInts(int32_t a, int32_t b, int32_t* result) {
+    int64_t sum = (int64_t)a + b;
+    *result = (int32_t)sum;
+    return sum >= INT32_MIN && sum <= INT32_MAX;
+}
+
+/**
+ * Method for subtracting two ints, returning false if the difference doesn't fit in one.
+ */
+static inline bool subtractInts(int32_t a, int32_t b, int32_t* result) {
+    int64_t difference = (int64_t)a - b;
+    *result = (int32_t)difference;
+    return difference >= INT32_MIN && difference <= INT32_MAX;
+}
+
+/**
+ * Method for multiplying two ints, returning false if the product doesn't fit in one or is -0.
+ */
+static inline bool multiplyInts(int32_t a, int32_t b, int32_t* result) {
+    int64_t product = (int64_t)a * b;
+    *result = (int32_t)product;
+    if (product == 0) {
+        // 0 * -1 is -0 as a double
+        return (a | b) >= 0;
+    }
+    return product >= INT32_MIN && product <= INT32_MAX;
+}
+
+/**
+ * Method for the IEEE remainder() of two ints, returning false if it's -0 or b is 0.
+ *
+ * The quotient is rounded to the nearest integer, ties to even, so the
+ * result always matches remainder() on the same numbers as doubles.
+ */
+static inline bool remainderInts(int32_t a, int32_t b, int32_t* result) {
+    if (b == 0) {
+        return false;
+    }
+    int64_t divisor = b < 0 ? -(int64_t)b : b;
+    int64_t rest = (int64_t)a % divisor;
+    // rest is in (-divisor, divisor), pull it into [-divisor / 2, divisor / 2]
+    if (2 * rest > divisor || (2 * rest == divisor && ((int64_t)a / divisor) % 2 != 0)) {
+        rest -= divisor;
+    } else if (-2 * rest > divisor || (-2 * rest == divisor && ((int64_t)a / divisor) % 2 != 0)) {
+        rest += divisor;
+    }
+    *result = (int32_t)rest;
+    return rest != 0 || a >= 0;
+}
+
+/**
+ * Method for negating an int, returning false if the result is -0 or doesn't fit in one.
+ */
+static inline bool negateInt(int32_t a, int32_t* result) {
+    *result = -(a == INT32_MIN ? 0 : a);
+    return a != 0 && a != INT32_MIN;
+}
+
+/** The most characters a number needs when formatted as a string, plus the terminator. */
+#define NUMBER_CHARS 32
+
 /**
  * @struct ValueArray
  *
@@ -135,6 +401,20 @@ void initValueArray(ValueArray* array);
  */
 void growValueArray(ValueArray* array);
 
+/**
+ * Method for making sure an array has room for at least capacity values.
+ */
+void reserveValueArray(ValueArray* array, int capacity);
+
+/**
+ * Method for copying count values in one go, which may be none from an empty buffer.
+ */
+static inline void copyValues(Value* dest, const Value* src, int count) {
+    if (count > 0) {
+        memcpy(dest, src, sizeof(Value) * count);
+    }
+}
+
 /**
  * Method for shrinking the capacity of an array.
  */
@@ -6,12 +6,28 @@
 #define cslo_vm_h
 
 #include "chunk.h"
+#include "core/gc.h"
+#include "core/memory.h"
 #include "core/object.h"
 #include "table.h"
 #include "core/value.h"
 
-#define FRAMES_MAX 256
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+// the deepest calls can go, and most values the stack can hold, before it's a stack overflow
+#define FRAMES_MAX (1024 * 1024)
+#define STACK_MAX (64 * 1024 * 1024)
+
+// the stack and frames start this big and double as they're needed
+#define FRAMES_INITIAL 64
+#define STACK_INITIAL 1024
+
+// room made above the stack top on entering a frame, so it rarely has to grow while running it
+#define STACK_RESERVE (2 * UINT8_COUNT)
+
+// room kept above the stack top between instructions, more than any one instruction pushes
+#define STACK_SLACK 8
+
+// most values a comprehension reserves room for up front, past this it grows as it goes
+#define MAX_RESERVED_LENGTH (1024 * 1024)
 
 /**
  * @struct CallFrame
@@ -22,37 +38,152 @@ typedef struct CallFrame {
     Value* slots;
 } CallFrame;
 
+/**
+ * @struct MemoCall
+ *
+ * A call to a memoised function that missed, waiting for the function's
+ * frame to return so its result can be remembered under the args.
+ */
+typedef struct MemoCall {
+    ObjMemo* memo;
+    // the index of the function's frame
+    int frame;
+    uint32_t hash;
+    // a copy, as the function can assign to its parameters
+    Value* args;
+    int argCount;
+} MemoCall;
+
+struct EventLoop;
+struct OpcodeStats;
+
 /**
  * @struct VM
+ *
+ * Everything an interpreter needs to run, down to the pools its objects
+ * are allocated from. No objects are shared between VMs, so each thread
+ * can run its own, with the one it's running in vm.
  */
 typedef struct VM {
-    CallFrame frames[FRAMES_MAX];
+    CallFrame* frames;
     int frameCount;
+    int frameCapacity;
+    // the frame count 'run()' returns at, non-zero while natives call back into slo
+    int baseFrame;
 
-    Value stack[STACK_MAX];
+    Value* stack;
     Value* stackTop;
+    int stackCapacity;
+    // one past the end of the stack, so pushing only has to compare against it
+    Value* stackLimit;
+    // stacks that have been outgrown, kept until nothing can be holding pointers into them
+    Value** retiredStacks;
+    int retiredCount;
+    int retiredCapacity;
     Table globals;
-    Table globalFinals;
+    ValueArray globalValues;
+    ValueArray globalNames;
+    ValueArray globalFinals;
+    // for each slot of a module's global, the builtin slot to use if the module hasn't defined it
+    ValueArray globalFallbacks;
+    Table builtins;
+    // every module imported so far, by name
+    Table modules;
+    // values native extensions have pinned, kept alive until they're unpinned
+    ValueArray pinned;
+    // the open bundle's strings, by their index in its pool, once anything's been loaded from it
+    ValueArray bundleStrings;
     Table strings;
     ObjString* initString;
 
     ObjUpvalue* openUpvalues;
 
+    // the fiber that's running, or NULL when it's the main script
+    ObjFiber* fiber;
+    // set by a native that suspended the running fiber, until resumeFiber sees it
+    bool yielding;
+    // the message of the last error a native returned with nativeError
+    const char* nativeError;
+    // how many natives are calling back into slo through callFunction
+    int callDepth;
+    // an exception on its way out to the try block that catches it, otherwise nil
+    Value exception;
+    // calls to memoised functions still running, innermost last
+    MemoCall* memoCalls;
+    int memoCallCount;
+    int memoCallCapacity;
+    // the async module's tasks, made the first time they're needed
+    struct EventLoop* eventLoop;
+
     ObjClass* containerClass;
     ObjClass* listClass;
     ObjClass* dictClass;
     ObjClass* stringClass;
     ObjClass* fileClass;
+    ObjClass* stringBuilderClass;
+    ObjClass* arrayClass;
+    ObjClass* setClass;
+    ObjClass* bytesClass;
+    ObjClass* fiberClass;
+    ObjClass* socketClass;
+    ObjClass* threadClass;
+    ObjClass* channelClass;
+    ObjClass* randomClass;
+    ObjClass* dictViewClass;
+    ObjClass* memoClass;
+    ObjClass* exceptionClass;
 
     size_t bytesAllocated;
     size_t nextGC;
 
     Obj* objects;
+    Obj* youngObjects;
+    // lists and dicts that frames free themselves, newest first, see newLocalList
+    Obj* localObjects;
+    bool allocateLocal;
+    // what's been allocated since the current region started, see beginRegion
+    Obj* regionObjects;
+    int regionDepth;
 
     bool markValue;
     int grayCount;
     int grayCapacity;
     Obj** grayStack;
+
+    GCMode gcMode;
+    bool minorGC;
+    size_t nurserySize;
+    size_t nextMajorGC;
+    int rememberedCount;
+    int rememberedCapacity;
+    Obj** remembered;
+    GCStats gcStats;
+    // set while the program's turned collections off
+    bool gcDisabled;
+    double heapGrowFactor;
+    // major collections of heaps at least parallelHeap bytes mark on gcThreads threads
+    int gcThreads;
+    size_t parallelHeap;
+    // the last major collection's sweep while it's still running in the background
+    struct Sweeper* sweeper;
+    // small objects are carved from these, see allocateObjectMemory
+    ObjectPool pools[POOL_CLASSES];
+
+    bool bytecodeCache;
+    // threads the modules a script imports are compiled ahead on, 0 for none, see loader.h
+    int importThreads;
+    struct Precompiler* precompiler;
+    // set on the VMs compiling ahead, whose errors are reported when the module's imported instead
+    bool quietErrors;
+    // whether hot loops are compiled to machine code, see jit.h
+    bool jit;
+    // what's being profiled, PROFILE_CALLS and PROFILE_SAMPLES, see profiler.h
+    int profile;
+    // the random module's generator, so each thread's VM has its own
+    RandomState random;
+#ifdef SLO_OPCODE_STATS
+    struct OpcodeStats* opcodeStats;
+#endif
 } VM;
 
 /**
@@ -64,15 +195,26 @@ typedef enum InterpretResult {
     INTERPRET_RUNTIME_ERROR
 } InterpretResult;
 
-extern VM vm;
+/**
+ * The VM running on this thread.
+ */
+extern THREAD_LOCAL VM* vm;
+
+/**
+ * Method for initialising a virtual machine, and making it the one this thread runs.
+ */
+void initVM(VM* instance);
 
 /**
- * Method for initialising the virtual machine on startup.
+ * Method for making an initialised virtual machine the one this thread runs.
+ *
+ * A VM must only be run by one thread at a time.
  */
-void initVM();
+void useVM(VM* instance);
 
 /**
- * Method for freeing the virtual machine on shutdown.
+ * Method for freeing everything the running virtual machine holds, on shutdown.
+ * The VM itself belongs to the caller.
  */
 void freeVM();
 
@@ -82,18 +224,107 @@ void freeVM();
 InterpretResult interpret(const char* source, const char* file);
 
 /**
- * Method for pushing a value onto the stack.
+ * Method for executing a slo file.
+ *
+ * If the bytecode cache is enabled this runs the file's .sloc
+ * when it's still valid, and writes one after compiling otherwise.
+ * The modules it imports are compiled ahead on vm->importThreads threads.
+ */
+InterpretResult interpretFile(const char* source, const char* path);
+
+/**
+ * Method for executing the script in a .slob bundle.
+ *
+ * The modules it imports are loaded from the bundle too, so nothing's compiled.
+ */
+InterpretResult interpretBundle(const char* path);
+
+/**
+ * Method for calling a slo function, method or class from a native.
+ *
+ * The callee is run to completion and its return value written to result.
+ * Returns false if the call raised a runtime error, which has already been reported.
+ * It can also be called on a VM that isn't running anything, to start a thread.
+ */
+bool callFunction(Value callee, int argCount, Value* args, Value* result);
+
+/**
+ * Method for calling the callee that's on the stack below its argCount arguments.
+ *
+ * They're popped, and the return value written to result, as callFunction does.
+ */
+bool callOnStack(int argCount, Value* result);
+
+/**
+ * Method for running a fiber until it yields or returns.
+ *
+ * The value is what the fiber's yield returns, or its argument the first time
+ * it's resumed. The value it yields or returns is written to result.
+ * Returns false if the fiber raised a runtime error or can't be resumed.
+ */
+bool resumeFiber(ObjFiber* fiber, Value value, Value* result);
+
+/**
+ * Method for suspending the running fiber from a native, once that native returns.
+ *
+ * The value is passed out to whatever resumed the fiber. Returns false if
+ * there's no fiber to suspend, or natives are calling back into it so the
+ * native frames in between can't be suspended.
+ */
+bool yieldFiber(Value value);
+
+/**
+ * Method for raising a runtime error in a suspended fiber, where it last yielded.
+ *
+ * For natives whose work finished while the fiber was suspended, and failed.
+ * The fiber is finished afterwards. Always returns false.
+ */
+bool failFiber(ObjFiber* fiber, const char* message);
+
+/**
+ * Method for resolving a global name to its slot, creating the slot if needed.
+ */
+int globalSlot(ObjString* name);
+
+/**
+ * Method for defining a global by name.
+ */
+void defineGlobal(ObjString* name, Value value);
+
+/**
+ * Method for getting a global by name.
+ */
+bool getGlobal(ObjString* name, Value* value);
+
+/**
+ * Method for growing the stack to fit at least count more values.
+ */
+COLD void growStack(int count);
+
+/**
+ * Method for pushing a value onto the stack, growing it if it's full.
  */
-void push(Value value);
+static inline void push(Value value) {
+    if (UNLIKELY(vm->stackTop == vm->stackLimit)) {
+        growStack(1);
+    }
+    *vm->stackTop = value;
+    vm->stackTop++;
+}
 
 /**
  * Method for popping a value off of the stack.
  */
-Value pop();
+static inline Value pop() {
+    vm->stackTop--;
+    return *vm->stackTop;
+}
 
 /**
  * Method for peeking at the stack.
  */
-Value peek(int distance);
+static inline Value peek(int distance) {
+    return vm->stackTop[-1 - distance];
+}
 
 #endif
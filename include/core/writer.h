@@ -0,0 +1,118 @@
+/**
+ * @file writer.h
+ * @brief A growable buffer that values are written into as text.
+ */
+
+#ifndef cslo_writer_h
+#define cslo_writer_h
+
+#include <stdio.h>
+
+#include "core/common.h"
+#include "core/value.h"
+
+/**
+ * How deeply nested containers are written before the rest of
+ * them is elided, which also stops one containing itself from
+ * recursing forever.
+ */
+#define WRITER_NESTING_LIMIT 256
+
+/**
+ * The size of the buffer values are printed through on their way to stdout.
+ */
+#define PRINT_BUFFER_SIZE 1024
+
+/**
+ * @struct Writer
+ *
+ * Somewhere to put the text form of values.
+ *
+ * A writer either grows as it's written to, with its buffer allocated on
+ * the VM's heap so it can become a string without being copied, or it
+ * writes to a file through a fixed size buffer that's flushed as it fills.
+ * Printing, converting a value to a string, interpolation and json.dumps
+ * all write into one, so a container is turned into text in one buffer
+ * rather than as a string per element.
+ */
+typedef struct Writer {
+    char* chars;
+    size_t length;
+    size_t capacity;
+    FILE* file;
+    const char* error;
+} Writer;
+
+/**
+ * Method for starting a writer that grows as it's written to.
+ */
+void initWriter(Writer* writer);
+
+/**
+ * Method for starting a writer that writes to a file through the given buffer.
+ */
+void initFileWriter(Writer* writer, FILE* file, char* buffer, size_t capacity);
+
+/**
+ * Method for freeing a growing writer's buffer.
+ */
+void freeWriter(Writer* writer);
+
+/**
+ * Method for recording the first error a writer hits. Always returns false.
+ */
+bool writerError(Writer* writer, const char* message);
+
+/**
+ * Method for writing out whatever a file writer has buffered.
+ */
+bool flushWriter(Writer* writer);
+
+/**
+ * Method for making sure a growing writer has room for length more characters.
+ */
+bool reserveWriter(Writer* writer, size_t length);
+
+/**
+ * Method for writing length characters.
+ */
+bool writeChars(Writer* writer, const char* chars, size_t length);
+
+/**
+ * Method for writing a NUL terminated string.
+ */
+bool writeCString(Writer* writer, const char* chars);
+
+/**
+ * Method for writing a number the way it's converted to a string.
+ */
+bool writeNumber(Writer* writer, double number);
+
+/**
+ * Method for writing a value the way it's converted to a string, as str() does.
+ */
+bool writeValue(Writer* writer, Value value);
+
+/**
+ * Method for writing a value the way it's printed.
+ */
+bool writePrintedValue(Writer* writer, Value value);
+
+/**
+ * Method for turning what a growing writer has written into a string.
+ * The writer's buffer becomes the string's, so the writer is left empty.
+ */
+ObjString* writerToString(Writer* writer);
+
+/**
+ * Method for writing a single character.
+ */
+static inline bool writeChar(Writer* writer, char c) {
+    if (writer->length < writer->capacity) {
+        writer->chars[writer->length++] = c;
+        return true;
+    }
+    return writeChars(writer, &c, 1);
+}
+
+#endif
@@ -0,0 +1,18 @@
+/**
+ * @file array_methods.h
+ * @brief Header file for typed array methods in CSLO.
+ */
+
+#ifndef cslo_array_methods_h
+#define cslo_array_methods_h
+
+#include "core/object.h"
+#include "core/value.h"
+
+/**
+ * @brief Registers typed array methods for the given ObjClass.
+ * @param cls The ObjClass representing the array type.
+ */
+void registerArrayMethods(ObjClass* cls);
+
+#endif  // cslo_array_methods_h
@@ -0,0 +1,23 @@
+/**
+ * @file bytes_methods.h
+ * @brief Header file for bytes methods in CSLO.
+ */
+
+#ifndef cslo_bytes_methods_h
+#define cslo_bytes_methods_h
+
+#include "core/object.h"
+#include "core/value.h"
+
+/**
+ * @brief Registers bytes methods for the given ObjClass.
+ * @param cls The ObjClass representing the bytes type.
+ */
+void registerBytesMethods(ObjClass* cls);
+
+/**
+ * Method for appending a byte to a bytes object, growing it if needed.
+ */
+void bytesAppend(ObjBytes* bytes, uint8_t byte);
+
+#endif  // cslo_bytes_methods_h
@@ -15,4 +15,10 @@
  */
 void registerDictMethods(ObjClass* cls);
 
+/**
+ * @brief Registers dict view methods for the given ObjClass.
+ * @param cls The ObjClass representing the dict view type.
+ */
+void registerDictViewMethods(ObjClass* cls);
+
 #endif  // cslo_dict_methods_h
@@ -0,0 +1,18 @@
+/**
+ * @file exception_methods.h
+ * @brief Header file for exception methods in CSLO.
+ */
+
+#ifndef cslo_obj_exception_methods_h
+#define cslo_obj_exception_methods_h
+
+#include "core/object.h"
+#include "core/value.h"
+
+/**
+ * @brief Registers the properties of caught exceptions for the given ObjClass.
+ * @param cls The ObjClass representing the exception type.
+ */
+void registerExceptionMethods(ObjClass* cls);
+
+#endif  // cslo_obj_exception_methods_h
@@ -0,0 +1,18 @@
+/**
+ * @file fiber_methods.h
+ * @brief Header file for fiber methods in CSLO.
+ */
+
+#ifndef cslo_fiber_methods_h
+#define cslo_fiber_methods_h
+
+#include "core/object.h"
+#include "core/value.h"
+
+/**
+ * @brief Registers fiber methods for the given ObjClass.
+ * @param cls The ObjClass representing the fiber type.
+ */
+void registerFiberMethods(ObjClass* cls);
+
+#endif  // cslo_fiber_methods_h
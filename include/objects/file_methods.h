@@ -15,4 +15,11 @@
  */
 void registerFileMethods(ObjClass* cls);
 
+/**
+ * Method for reading the next line of a file, including its newline.
+ *
+ * Returns NULL at the end of the file.
+ */
+ObjString* readFileLine(ObjFile* file);
+
 #endif  // cslo_file_methods_h
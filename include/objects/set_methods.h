@@ -0,0 +1,25 @@
+/**
+ * @file set_methods.h
+ * @brief Header file for set methods in CSLO.
+ */
+
+#ifndef cslo_set_methods_h
+#define cslo_set_methods_h
+
+#include "core/object.h"
+#include "core/value.h"
+
+/**
+ * @brief Registers set methods for the given ObjClass.
+ * @param cls The ObjClass representing the set type.
+ */
+void registerSetMethods(ObjClass* cls);
+
+/**
+ * Method for adding a value to a set.
+ *
+ * Returns true if the value wasn't already in the set.
+ */
+bool setAdd(ObjSet* set, Value value);
+
+#endif  // cslo_set_methods_h
@@ -0,0 +1,35 @@
+/**
+ * @file socket_methods.h
+ * @brief Header file for socket methods in CSLO.
+ */
+
+#ifndef cslo_socket_methods_h
+#define cslo_socket_methods_h
+
+#include "core/object.h"
+#include "core/value.h"
+#include "std/async.h"
+
+/**
+ * @brief Registers socket methods for the given ObjClass.
+ * @param cls The ObjClass representing the socket type.
+ */
+void registerSocketMethods(ObjClass* cls);
+
+/**
+ * Method for putting a file descriptor into non-blocking mode.
+ */
+bool setNonBlocking(int fd);
+
+/**
+ * Method for making an error value from a failed call's errno, such as "recv() failed: ...".
+ */
+Value socketError(const char* call);
+
+/**
+ * I/O step that sends all of a request's buffer (bytes or a string) from its
+ * offset, finishing with the number of bytes sent.
+ */
+bool sendStep(IoRequest* request, Value* result);
+
+#endif  // cslo_socket_methods_h
@@ -0,0 +1,18 @@
+/**
+ * @file string_builder_methods.h
+ * @brief Header file for string builder methods in CSLO.
+ */
+
+#ifndef cslo_string_builder_methods_h
+#define cslo_string_builder_methods_h
+
+#include "core/object.h"
+#include "core/value.h"
+
+/**
+ * @brief Registers string builder methods for the given ObjClass.
+ * @param cls The ObjClass representing the string builder type.
+ */
+void registerStringBuilderMethods(ObjClass* cls);
+
+#endif  // cslo_string_builder_methods_h
@@ -0,0 +1,24 @@
+/**
+ * @file thread_methods.h
+ * @brief Header file for thread and channel methods in CSLO.
+ */
+
+#ifndef cslo_thread_methods_h
+#define cslo_thread_methods_h
+
+#include "core/object.h"
+#include "core/value.h"
+
+/**
+ * @brief Registers thread methods for the given ObjClass.
+ * @param cls The ObjClass representing the thread type.
+ */
+void registerThreadMethods(ObjClass* cls);
+
+/**
+ * @brief Registers channel methods for the given ObjClass.
+ * @param cls The ObjClass representing the channel type.
+ */
+void registerChannelMethods(ObjClass* cls);
+
+#endif  // cslo_thread_methods_h
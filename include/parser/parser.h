@@ -28,12 +28,14 @@ typedef struct Parser {
     bool interpolating;
     bool hadError;
     bool panicMode;
+    // whether errors are only noted, as they've been reported for the same source already
+    bool quiet;
 } Parser;
 
 /**
  * Global parser instance.
  */
-extern Parser parser;
+extern THREAD_LOCAL Parser parser;
 
 // define all the functions here
 
@@ -70,6 +72,16 @@ ParseRule* getRule(TokenType type);
  */
 Token peekToken(int n);
 
+/**
+ * Method for checking whether the bracketed expression the current token starts is a comprehension.
+ */
+bool comprehensionAhead();
+
+/**
+ * Method for finding the '{' of the finally clause of the try statement whose block the current token starts.
+ */
+bool finallyAhead(Token* brace);
+
 /**
  * Method for consuming a given token type.
  *
@@ -60,4 +60,14 @@ void parseImportStatement();
  */
 void assertStatement();
 
+/**
+ * Method for compiling a try statement.
+ */
+void tryStatement();
+
+/**
+ * Method for compiling a raise statement.
+ */
+void raiseStatement();
+
 #endif
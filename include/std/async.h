@@ -0,0 +1,68 @@
+/**
+ * @file async.h
+ * @brief Header file for the async module, an event loop that runs fibers as tasks.
+ */
+
+#ifndef cslo_std_async_h
+#define cslo_std_async_h
+
+#include "core/object.h"
+#include "core/value.h"
+
+typedef struct IoRequest IoRequest;
+
+/**
+ * A step of an I/O request, run whenever its file descriptor is ready.
+ *
+ * Does as much as it can without blocking and returns true once the request
+ * has finished, with its result (or an error) written to result.
+ */
+typedef bool (*IoStep)(IoRequest* request, Value* result);
+
+/**
+ * @struct IoRequest
+ *
+ * An I/O operation on a file descriptor, such as reading from a socket.
+ * The state and buffer are kept alive by the event loop until it finishes.
+ */
+struct IoRequest {
+    int fd;
+    // what to wait for (POLLIN or POLLOUT) before the next step, which a step can change
+    short events;
+    IoStep step;
+    Value state;
+    Value buffer;
+    // how far a step has got, for those that take several
+    int phase;
+    size_t offset;
+    IoRequest* next;
+};
+
+/**
+ * Method for running an I/O request.
+ *
+ * Runs its first step straight away. If that can't finish it and a task is
+ * running, the task is parked until the file descriptor is ready and the
+ * request is finished by the event loop, which resumes the task with the
+ * result (or raises the error in it); the caller should return nil, which
+ * the result replaces. Anywhere else this blocks until it's finished.
+ */
+Value performIo(IoRequest* request);
+
+/**
+ * @brief Gets the async module with all its functions.
+ * @return A pointer to the ObjModule containing the async functions.
+ */
+ObjModule* getAsyncModule();
+
+/**
+ * Method for marking the tasks the event loop is holding on to.
+ */
+void markEventLoop();
+
+/**
+ * Method for freeing the running VM's event loop, on shutdown.
+ */
+void freeEventLoop();
+
+#endif  // cslo_std_async_h
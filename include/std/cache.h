@@ -0,0 +1,24 @@
+/**
+ * @file cache.h
+ * @brief Header of the cache module, for remembering the results of functions.
+ */
+
+#ifndef cslo_std_cache_h
+#define cslo_std_cache_h
+
+#include "core/object.h"
+#include "core/value.h"
+
+/**
+ * @brief Gets the cache module with all its functions.
+ * @return A pointer to the ObjModule containing the cache functions.
+ */
+ObjModule* getCacheModule();
+
+/**
+ * @brief Registers the methods of memoised functions for the given ObjClass.
+ * @param cls The ObjClass representing the memo type.
+ */
+void registerMemoMethods(ObjClass* cls);
+
+#endif // cslo_std_cache_h
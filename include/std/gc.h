@@ -0,0 +1,18 @@
+/**
+ * @file gc.h
+ * @brief Header of the gc module, for controlling the collector and reading its statistics.
+ */
+
+#ifndef cslo_std_gc_h
+#define cslo_std_gc_h
+
+#include "core/object.h"
+#include "core/value.h"
+
+/**
+ * @brief Gets the gc module with all its functions.
+ * @return A pointer to the ObjModule containing the gc functions.
+ */
+ObjModule* getGCModule();
+
+#endif // cslo_std_gc_h
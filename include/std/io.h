@@ -0,0 +1,18 @@
+/**
+ * @file io.h
+ * @brief Header of the io module, for writing to the standard streams.
+ */
+
+#ifndef cslo_std_io_h
+#define cslo_std_io_h
+
+#include "core/object.h"
+#include "core/value.h"
+
+/**
+ * @brief Gets the io module with all its functions and streams.
+ * @return A pointer to the ObjModule containing the io functions.
+ */
+ObjModule* getIOModule();
+
+#endif // cslo_std_io_h
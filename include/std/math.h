@@ -15,4 +15,22 @@
  */
 ObjModule* getMathModule();
 
+/**
+ * @brief Adds up doubles with pairwise summation, so the rounding error grows
+ * with the log of the count rather than the count.
+ * @param values The doubles to add up.
+ * @param count The number of doubles.
+ * @return The total.
+ */
+double sumDoubles(const double* values, int count);
+
+/**
+ * @brief Works out the dot product of two runs of doubles, summed pairwise.
+ * @param a The first run of doubles.
+ * @param b The second run of doubles, the same length as the first.
+ * @param count The number of doubles in each.
+ * @return The dot product.
+ */
+double dotDoubles(const double* a, const double* b, int count);
+
 #endif  // cslo_std_math_h
@@ -0,0 +1,18 @@
+/**
+ * @file net.h
+ * @brief Header file for the net module, with TCP sockets and a minimal HTTP client and server.
+ */
+
+#ifndef cslo_std_net_h
+#define cslo_std_net_h
+
+#include "core/object.h"
+#include "core/value.h"
+
+/**
+ * @brief Gets the net module with all its functions.
+ * @return A pointer to the ObjModule containing the net functions.
+ */
+ObjModule* getNetModule();
+
+#endif  // cslo_std_net_h
@@ -6,6 +6,8 @@
 #ifndef cslo_std_random_h
 #define cslo_std_random_h
 
+#include <stdint.h>
+
 #include "core/object.h"
 #include "core/value.h"
 
@@ -15,4 +17,24 @@
  */
 ObjModule* getRandomModule();
 
+/**
+ * @brief Registers the methods of random.Random generators for the given ObjClass.
+ * @param cls The ObjClass representing the random type.
+ */
+void registerRandomMethods(ObjClass* cls);
+
+/**
+ * @brief Seeds a generator, spreading the seed over its whole state.
+ * @param state The generator to seed.
+ * @param seed The seed, any value gives a usable state.
+ */
+void seedRandom(RandomState* state, uint64_t seed);
+
+/**
+ * @brief Gets the generator's next 64 random bits.
+ * @param state The generator to advance.
+ * @return The next value.
+ */
+uint64_t nextRandom(RandomState* state);
+
 #endif // cslo_std_random_h
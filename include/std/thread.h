@@ -0,0 +1,137 @@
+/**
+ * @file thread.h
+ * @brief Header file for the thread module, OS threads that each run their own VM.
+ */
+
+#ifndef cslo_std_thread_h
+#define cslo_std_thread_h
+
+#include <pthread.h>
+
+#include "core/object.h"
+#include "core/value.h"
+
+/**
+ * @struct Message
+ *
+ * Values packed into a buffer that doesn't belong to any VM, so they can be
+ * handed to another thread and unpacked into its VM.
+ */
+typedef struct Message {
+    uint8_t* bytes;
+    size_t count;
+    size_t capacity;
+    // buffers moved out of arrays and bytes when sending with transfer,
+    // owned by the message until they're unpacked
+    void** owned;
+    int ownedCount;
+    int ownedCapacity;
+    // a reference to each channel in the message, dropped when it's freed
+    struct Channel** channels;
+    int channelCount;
+    int channelCapacity;
+    struct Message* next;
+} Message;
+
+/**
+ * @struct Channel
+ *
+ * A queue of messages shared by every VM holding it, freed once none of them do.
+ * A capacity of 0 means sending never waits.
+ */
+typedef struct Channel {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    Message* head;
+    Message* tail;
+    int count;
+    int capacity;
+    bool closed;
+    int refs;
+} Channel;
+
+/**
+ * @struct ThreadHandle
+ *
+ * A started thread. It's shared between the thread and the ObjThread that
+ * started it, and freed by whichever of them lets go of it last.
+ */
+typedef struct ThreadHandle {
+    pthread_t id;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    // the globals, function and arguments, until the thread unpacks them
+    Message* start;
+    // what the function returned, until it's joined
+    Message* result;
+    bool done;
+    bool failed;
+    bool joined;
+    char error[256];
+    int refs;
+} ThreadHandle;
+
+/**
+ * Method for packing a value into a new message.
+ *
+ * Lists, dicts, sets, arrays, bytes, enums, classes and their instances are
+ * deep copied, with anything referenced more than once (or cyclically)
+ * copied once. Functions are copied as bytecode and any variables they've
+ * captured by value. Builtins and native modules' functions are looked up
+ * again by name in the VM they're unpacked into. With transfer, arrays and bytes hand their buffers over instead and are
+ * left empty. Returns NULL and sets error if the value can't be sent.
+ */
+Message* packMessage(Value value, bool transfer, Value* error);
+
+/**
+ * Method for unpacking a message into the current VM.
+ *
+ * Returns an error value if it can't be unpacked.
+ */
+Value unpackMessage(Message* message);
+
+/**
+ * Method for packing every global that can be, followed by a value, into a new message.
+ *
+ * Globals that can't be packed are left out, with why written to stderr
+ * if warn is set. Returns NULL and sets error if the value can't be packed.
+ */
+Message* packWithGlobals(Value value, bool warn, Value* error);
+
+/**
+ * Method for unpacking a message made by packWithGlobals into the current VM.
+ *
+ * The globals are defined, by name, and the value after them is returned,
+ * or an error value if it can't be unpacked.
+ */
+Value unpackWithGlobals(Message* message);
+
+/**
+ * Method for freeing a message, and any buffers it still owns.
+ */
+void freeMessage(Message* message);
+
+/**
+ * Method for taking a reference to a channel.
+ */
+void retainChannel(Channel* channel);
+
+/**
+ * Method for dropping a reference to a channel, freeing it after the last one.
+ */
+void releaseChannel(Channel* channel);
+
+/**
+ * Method for dropping the ObjThread's reference to a thread.
+ *
+ * A thread that's still running carries on and frees the handle itself.
+ */
+void releaseThread(ThreadHandle* handle);
+
+/**
+ * @brief Gets the thread module with all its functions.
+ * @return A pointer to the ObjModule containing the thread functions.
+ */
+ObjModule* getThreadModule();
+
+#endif  // cslo_std_thread_h
@@ -0,0 +1 @@
+#define SLO_VERSION "1.1.0"
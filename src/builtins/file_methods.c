@@ -4,7 +4,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "core/flusher.h"
 #include "core/object.h"
 #include "core/table.h"
 #include "core/value.h"
@@ -19,7 +21,8 @@ static Value open(int argCount, Value* args, ParamInfo* params);
  * @param tbl The Table to register the methods in.
  */
 void registerBuiltInFileMethods(Table* tbl) {
-    defineBuiltIn(tbl, "open", open, 1, 2, PARAMS({copyString("path", 4), true}, {copyString("mode", 4), false}));
+    defineBuiltIn(tbl, "open", open, 1, 4,
+        PARAMS({"path", true}, {"mode", false}, {"buffer", false}, {"background", false}));
 }
 
 /**
@@ -27,22 +30,45 @@ void registerBuiltInFileMethods(Table* tbl) {
  * @param argCount The number of arguments passed to the function.
  * @param args The arguments passed to the function.
  * @return An ObjFile object or an error value if the file cannot be opened.
+ *
+ * The file's buffered through buffer bytes, FILE_BUFFER_SIZE unless it's
+ * given. A file opened for writing in the background has what's written
+ * to it handed to a thread of its own a buffer at a time instead.
  */
 static Value open(int argCount, Value* args, ParamInfo* params) {
     if (!IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("open() expects a file path (string) and optional mode.");
+        return nativeError("open() expects a file path (string) and optional mode.");
     }
 
     const char* path = AS_CSTRING(args[0]);
-    const char* mode = (argCount == 2 && IS_STRING(args[1])) ? AS_CSTRING(args[1]) : "r";
+    const char* mode = (argCount >= 2 && IS_STRING(args[1])) ? AS_CSTRING(args[1]) : "r";
     FileMode fileMode = mode[0] == 'r' ? FILE_READ : (mode[0] == 'w' ? FILE_WRITE : FILE_APPEND);
+
+    size_t bufferSize = FILE_BUFFER_SIZE;
+    if (argCount >= 3 && !IS_NIL(args[2])) {
+        if (!IS_NUMBER(args[2]) || AS_NUMBER(args[2]) < 1 || AS_NUMBER(args[2]) > FILE_MAX_BUFFER_SIZE
+                || AS_NUMBER(args[2]) != (int)AS_NUMBER(args[2])) {
+            return nativeError("open() buffer must be a whole number of bytes, at least 1.");
+        }
+        bufferSize = (size_t)AS_NUMBER(args[2]);
+    }
+    bool background = argCount == 4 && !isFalsey(args[3]);
+    if (background && (fileMode == FILE_READ || strchr(mode, '+') != NULL)) {
+        return nativeError("open() can only write in the background to a file opened just for writing.");
+    }
+
     FILE* f = fopen(path, mode);
     if (!f) {
-        return ERROR_VAL_PTR("Failed to open file.");
+        return nativeError("Failed to open file.");
     }
 
     // Ownership of 'f' is transferred to ObjFile.
     // ObjFile is responsible for closing the file
-    ObjFile* sFile = newFile(f, fileMode, AS_STRING(args[0]));
+    // (what's written in the background doesn't go through stdio, so its buffer's left as it is)
+    ObjFile* sFile = newFile(f, fileMode, AS_STRING(args[0]), background ? 0 : bufferSize);
+    if (background) {
+        // if the thread can't be started it's written on this one instead
+        sFile->flusher = startFlusher(fileno(f), bufferSize);
+    }
     return OBJ_VAL(sFile);
 }
@@ -9,12 +9,11 @@
 
 #include "core/object.h"
 #include "core/value.h"
+#include "core/writer.h"
 
 #include "builtins/print_methods.h"
 #include "builtins/util.h"
 
-#include "util.h"
-
 Value printNative(int argCount, Value* args, ParamInfo* params);
 Value printLNNative(int argCount, Value* args, ParamInfo* params);
 
@@ -23,26 +22,23 @@ Value printLNNative(int argCount, Value* args, ParamInfo* params);
  * @param tbl The Table to register the methods in.
  */
 void registerBuiltInPrintMethods(Table* tbl) {
-    defineBuiltIn(tbl, "print", printNative, 0, -1, PARAMS({copyString("message", 7), true}, {copyString("...args", 7), false}));
-    defineBuiltIn(tbl, "println", printLNNative, 0, -1, PARAMS({copyString("message", 7), true}, {copyString("...args", 7), false}));
+    defineBuiltIn(tbl, "print", printNative, 0, -1, PARAMS({"message", true}, {"...args", false}));
+    defineBuiltIn(tbl, "println", printLNNative, 0, -1, PARAMS({"message", true}, {"...args", false}));
 }
 
 /**
  * Print native function.
  */
 Value printNative(int argCount, Value* args, ParamInfo* params) {
+    // every argument goes through one buffer, handed to stdout in one go
+    char buffer[PRINT_BUFFER_SIZE];
+    Writer writer;
+    initFileWriter(&writer, stdout, buffer, sizeof(buffer));
     for (int i = 0; i < argCount; i++) {
-        if (IS_STRING(args[i])) {
-            ObjString* str = AS_STRING(args[i]);
-            size_t unescLen;
-            char* unesc = unescapeString(str->chars, str->length, &unescLen);
-            printf("%s", unesc);
-            free(unesc);
-        } else {
-            printValue(args[i]);
-        }
+        writePrintedValue(&writer, args[i]);
     }
-    printf("\n");
+    writeChar(&writer, '\n');
+    flushWriter(&writer);
     return NIL_VAL;
 }
 
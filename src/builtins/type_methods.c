@@ -7,8 +7,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "core/gc.h"
 #include "core/object.h"
 #include "core/value.h"
+#include "core/vm.h"
+#include "objects/bytes_methods.h"
+#include "objects/set_methods.h"
 
 #include "builtins/type_methods.h"
 #include "builtins/util.h"
@@ -17,15 +21,25 @@
 Value boolCvrt(int argCount, Value* args, ParamInfo* params);
 Value numberCvrt(int argCount, Value* args, ParamInfo* params);
 Value strCvrt(int argCount, Value* args, ParamInfo* params);
+Value stringBuilderNew(int argCount, Value* args, ParamInfo* params);
+Value arrayNew(int argCount, Value* args, ParamInfo* params);
+Value setNew(int argCount, Value* args, ParamInfo* params);
+Value bytesNew(int argCount, Value* args, ParamInfo* params);
+Value fiberNew(int argCount, Value* args, ParamInfo* params);
 
 /**
  * @brief Registers built-in type methods
  * @param tbl The Table to register the methods in.
  */
 void registerBuiltInTypeMethods(Table* tbl) {
-    defineBuiltIn(tbl, "bool", boolCvrt, 1, 1, PARAMS({copyString("value", 5), true}));
-    defineBuiltIn(tbl, "number", numberCvrt, 1, 1, PARAMS({copyString("value", 5), true}));
-    defineBuiltIn(tbl, "str", strCvrt, 1, 1, PARAMS({copyString("value", 5), true}));
+    defineBuiltIn(tbl, "bool", boolCvrt, 1, 1, PARAMS({"value", true}));
+    defineBuiltIn(tbl, "number", numberCvrt, 1, 1, PARAMS({"value", true}));
+    defineBuiltIn(tbl, "str", strCvrt, 1, 1, PARAMS({"value", true}));
+    defineBuiltIn(tbl, "StringBuilder", stringBuilderNew, 0, 0, NULL);
+    defineBuiltIn(tbl, "array", arrayNew, 2, 2, PARAMS({"type", true}, {"values", true}));
+    defineBuiltIn(tbl, "set", setNew, 0, 1, PARAMS({"values", false}));
+    defineBuiltIn(tbl, "bytes", bytesNew, 0, 1, PARAMS({"values", false}));
+    defineBuiltIn(tbl, "fiber", fiberNew, 1, 1, PARAMS({"function", true}));
 }
 
 /**
@@ -53,17 +67,17 @@ Value numberCvrt(int argCount, Value* args, ParamInfo* params) {
     } else if (IS_NUMBER(value)) {
         return value;
     } else if (IS_STRING(value)) {
-        ObjString* str = AS_STRING(value);
+        char* chars = AS_CSTRING(value);
         char* endptr;
-        double num = strtod(str->chars, &endptr);
+        double num = strtod(chars, &endptr);
         // Check if the entire string was consumed and it's not empty
-        if (endptr != str->chars && *endptr == '\0') {
+        if (endptr != chars && *endptr == '\0') {
             return NUMBER_VAL(num);
         } else {
-            return ERROR_VAL_PTR("number() could not convert string to number.");
+            return nativeError("number() could not convert string to number.");
         }
     }
-    return ERROR_VAL_PTR("number() could not convert value to number.");
+    return nativeError("number() could not convert value to number.");
 }
 
 /**
@@ -79,5 +93,160 @@ Value strCvrt(int argCount, Value* args, ParamInfo* params) {
     if (IS_STRING(result)) {
         return result;
     }
-    return ERROR_VAL_PTR("str() could not convert value to string.");
+    return nativeError("str() could not convert value to string.");
+}
+
+/**
+ * @brief Creates a new, empty string builder.
+ * @param argCount The number of arguments passed to the function.
+ * @param args The arguments passed to the function.
+ * @return The new string builder.
+*/
+Value stringBuilderNew(int argCount, Value* args, ParamInfo* params) {
+    return OBJ_VAL(newStringBuilder());
+}
+
+/**
+ * @brief Creates a new typed array.
+ * @param argCount The number of arguments passed to the function.
+ * @param args The element type ("f64" or "i64") and either a length or a list of numbers.
+ * @return The new array, zeroed if it was given a length.
+*/
+Value arrayNew(int argCount, Value* args, ParamInfo* params) {
+    if (!IS_STRING(args[0])) {
+        return nativeError("array() type must be \"f64\" or \"i64\".");
+    }
+    ObjString* name = AS_STRING(args[0]);
+    ArrayType type;
+    if (name->length == 3 && memcmp(name->chars, "f64", 3) == 0) {
+        type = ARRAY_F64;
+    } else if (name->length == 3 && memcmp(name->chars, "i64", 3) == 0) {
+        type = ARRAY_I64;
+    } else {
+        return nativeError("array() type must be \"f64\" or \"i64\".");
+    }
+
+    if (IS_NUMBER(args[1])) {
+        double length = AS_NUMBER(args[1]);
+        if (length < 0 || length > INT32_MAX || length != (int)length) {
+            return nativeError("array() length must be a non-negative whole number.");
+        }
+        return OBJ_VAL(newArray(type, (int)length));
+    }
+
+    if (!IS_LIST(args[1])) {
+        return nativeError("array() expects a length or a list of numbers.");
+    }
+    ObjList* list = AS_LIST(args[1]);
+    for (int i = 0; i < list->count; i++) {
+        if (!IS_NUMBER(list->values.values[i])) {
+            return nativeError("array() can only be made from a list of numbers.");
+        }
+    }
+    ObjArray* array = newArray(type, list->count);
+    for (int i = 0; i < list->count; i++) {
+        arraySet(array, i, AS_NUMBER(list->values.values[i]));
+    }
+    return OBJ_VAL(array);
+}
+
+/**
+ * @brief Creates a new set.
+ * @param argCount The number of arguments passed to the function.
+ * @param args Optionally a list, array, set or dict (its keys) of values to start with.
+ * @return The new set, with any duplicate values removed.
+*/
+Value setNew(int argCount, Value* args, ParamInfo* params) {
+    ObjSet* set = newSet();
+    if (argCount == 0) {
+        return OBJ_VAL(set);
+    }
+
+    Value values = args[0];
+    // keep the set rooted while its table grows
+    push(OBJ_VAL(set));
+    if (IS_LIST(values)) {
+        ObjList* list = AS_LIST(values);
+        for (int i = 0; i < list->count; i++) {
+            setAdd(set, list->values.values[i]);
+        }
+    } else if (IS_ARRAY(values)) {
+        ObjArray* array = AS_ARRAY(values);
+        for (int i = 0; i < array->count; i++) {
+            setAdd(set, NUMBER_VAL(arrayGet(array, i)));
+        }
+    } else if (IS_SET(values) || IS_DICT(values)) {
+        Table* table = IS_SET(values) ? &AS_SET(values)->data : &AS_DICT(values)->data;
+        for (int i = 0; i < table->entryCount; i++) {
+            if (!IS_EMPTY(table->entries[i].key)) {
+                setAdd(set, table->entries[i].key);
+            }
+        }
+    } else {
+        pop();
+        return nativeError("set() expects a list, array, set or dict of values.");
+    }
+    pop();
+    return OBJ_VAL(set);
+}
+
+/**
+ * @brief Creates a new bytes object.
+ * @param argCount The number of arguments passed to the function.
+ * @param args Optionally a length, a list of numbers from 0 to 255, or a string to copy.
+ * @return The new bytes, zeroed if it was given a length.
+*/
+Value bytesNew(int argCount, Value* args, ParamInfo* params) {
+    if (argCount == 0) {
+        return OBJ_VAL(newBytes(0));
+    }
+
+    Value values = args[0];
+    if (IS_NUMBER(values)) {
+        double length = AS_NUMBER(values);
+        if (length < 0 || length > INT32_MAX || length != (int)length) {
+            return nativeError("bytes() length must be a non-negative whole number.");
+        }
+        return OBJ_VAL(newBytes((int)length));
+    } else if (IS_STRING(values)) {
+        ObjString* string = AS_STRING(values);
+        ObjBytes* bytes = newBytes(string->length);
+        if (string->length > 0) {
+            memcpy(bytes->data, string->chars, string->length);
+        }
+        return OBJ_VAL(bytes);
+    } else if (!IS_LIST(values)) {
+        return nativeError("bytes() expects a length, a list of numbers or a string.");
+    }
+
+    ObjList* list = AS_LIST(values);
+    for (int i = 0; i < list->count; i++) {
+        Value value = list->values.values[i];
+        if (!IS_NUMBER(value) || AS_NUMBER(value) < 0 || AS_NUMBER(value) > 255
+                || AS_NUMBER(value) != (int)AS_NUMBER(value)) {
+            return nativeError("bytes() can only be made from whole numbers from 0 to 255.");
+        }
+    }
+    ObjBytes* bytes = newBytes(list->count);
+    for (int i = 0; i < list->count; i++) {
+        bytes->data[i] = (uint8_t)AS_NUMBER(list->values.values[i]);
+    }
+    return OBJ_VAL(bytes);
+}
+
+/**
+ * @brief Creates a new fiber that runs the given function when it's first resumed.
+ * @param argCount The number of arguments passed to the function.
+ * @param args The arguments passed to the function.
+ * @return The new fiber.
+ */
+Value fiberNew(int argCount, Value* args, ParamInfo* params) {
+    if (!IS_CLOSURE(args[0])) {
+        return nativeError("fiber() expects a function.");
+    }
+    ObjClosure* closure = AS_CLOSURE(args[0]);
+    if (closure->function->arity > 1) {
+        return nativeError("fiber() function must take no more than one argument.");
+    }
+    return OBJ_VAL(newFiber(closure));
 }
@@ -5,6 +5,7 @@
 
 #include <string.h>
 
+#include "core/gc.h"
 #include "core/object.h"
 #include "core/table.h"
 #include "core/value.h"
@@ -25,6 +26,28 @@ void defineBuiltIn(Table* tbl, const char* name, NativeFn function, int arityMin
     // pop();
 }
 
+bool lookupNative(Obj* owner, Table* methods, NativeDef* natives, ObjString* name, Value* value) {
+    if (tableGet(methods, OBJ_VAL(name), value)) {
+        return true;
+    }
+    if (natives == NULL) {
+        return false;
+    }
+    for (NativeDef* def = natives; def->name != NULL; def++) {
+        if ((int)strlen(def->name) != name->length || memcmp(def->name, name->chars, name->length) != 0) {
+            continue;
+        }
+        ParamInfo* params = def->params[0].name != NULL ? def->params : NULL;
+        *value = OBJ_VAL(newNative(def->function, def->arityMin, def->arityMax, params));
+        push(*value);
+        tableSet(methods, OBJ_VAL(name), *value);
+        writeBarrier(owner, OBJ_VAL(name));
+        pop();
+        return true;
+    }
+    return false;
+}
+
 /**
  *
  */
@@ -0,0 +1,137 @@
+/**
+ * @file arena.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "compiler/arena.h"
+#include "core/memory.h"
+
+// allocations are aligned for anything the compiler keeps in them
+#define ARENA_ALIGNMENT 16
+#define ARENA_ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+/**
+ * @struct ArenaBlock
+ */
+struct ArenaBlock {
+    ArenaBlock* next;
+    size_t size;
+    size_t used;
+};
+
+// where a block's memory starts, after its header
+#define BLOCK_DATA(block) ((char*)(block) + ARENA_ALIGN(sizeof(ArenaBlock)))
+
+/**
+ * Implementation of method for initialising an arena.
+ */
+void initArena(Arena* arena) {
+    arena->blocks = NULL;
+    arena->spare = NULL;
+}
+
+/**
+ * Implementation of method for allocating from an arena.
+ */
+void* arenaAllocate(Arena* arena, size_t size) {
+    size = ARENA_ALIGN(size);
+    ArenaBlock* block = arena->blocks;
+    if (block == NULL || block->used + size > block->size) {
+        if (arena->spare != NULL && size <= arena->spare->size) {
+            block = arena->spare;
+            arena->spare = block->next;
+        } else {
+            size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+            block = (ArenaBlock*)malloc(ARENA_ALIGN(sizeof(ArenaBlock)) + blockSize);
+            if (block == NULL) {
+                exit(1);
+            }
+            block->size = blockSize;
+        }
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    void* memory = BLOCK_DATA(block) + block->used;
+    block->used += size;
+    return memory;
+}
+
+/**
+ * Implementation of method for growing an array allocated from an arena.
+ */
+void* arenaGrowArray(Arena* arena, void* array, int* capacity, size_t itemSize) {
+    int oldCapacity = *capacity;
+    int newCapacity = GROW_CAPACITY(oldCapacity);
+    size_t oldSize = ARENA_ALIGN(itemSize * oldCapacity);
+    size_t newSize = ARENA_ALIGN(itemSize * newCapacity);
+    *capacity = newCapacity;
+
+    // the last thing allocated can just take more of its block
+    ArenaBlock* block = arena->blocks;
+    if (array != NULL && block != NULL && (char*)array + oldSize == BLOCK_DATA(block) + block->used
+            && block->used - oldSize + newSize <= block->size) {
+        block->used += newSize - oldSize;
+        return array;
+    }
+
+    void* grown = arenaAllocate(arena, newSize);
+    if (array != NULL) {
+        memcpy(grown, array, itemSize * oldCapacity);
+    }
+    return grown;
+}
+
+/**
+ * Implementation of method for marking how far into an arena it's been allocated.
+ */
+ArenaMark arenaMark(Arena* arena) {
+    ArenaMark mark = {arena->blocks, arena->blocks != NULL ? arena->blocks->used : 0};
+    return mark;
+}
+
+/**
+ * Implementation of method for giving back everything allocated from an arena since a mark.
+ *
+ * Blocks started since are kept as spares, unless they were made bigger for
+ * something that needed a block to itself.
+ */
+void arenaReset(Arena* arena, ArenaMark mark) {
+    while (arena->blocks != mark.block) {
+        ArenaBlock* block = arena->blocks;
+        arena->blocks = block->next;
+        if (block->size == ARENA_BLOCK_SIZE) {
+            block->next = arena->spare;
+            arena->spare = block;
+        } else {
+            free(block);
+        }
+    }
+    if (mark.block != NULL) {
+        mark.block->used = mark.used;
+    }
+}
+
+/**
+ * Method for freeing a list of blocks.
+ */
+static void freeBlocks(ArenaBlock* block) {
+    while (block != NULL) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+/**
+ * Implementation of method for freeing everything allocated from an arena.
+ */
+void freeArena(Arena* arena) {
+    freeBlocks(arena->blocks);
+    freeBlocks(arena->spare);
+    arena->blocks = NULL;
+    arena->spare = NULL;
+}
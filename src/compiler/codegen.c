@@ -5,12 +5,15 @@
  */
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "compiler/codegen.h"
 #include "compiler/compiler.h"
 #include "parser/parser.h"
 #include "compiler/scanner.h"
 #include "core/chunk.h"
+#include "core/gc.h"
 #include "core/value.h"
 
  /**
@@ -34,6 +37,29 @@ void emitBytes(uint8_t byte1, uint8_t byte2) {
     emitByte(byte2, parser.previous.line);
 }
 
+/**
+ * Method for emitting an instruction with a two byte operand.
+ * The operand is written high byte first to match READ_SHORT.
+ */
+void emitShortOp(uint8_t op, uint16_t operand) {
+    emitByte(op, parser.previous.line);
+    emitByte((operand >> 8) & 0xff, parser.previous.line);
+    emitByte(operand & 0xff, parser.previous.line);
+}
+
+/**
+ * Method for emitting the operand for a new inline cache.
+ * Each property access and invoke site gets its own cache.
+ */
+void emitInlineCache() {
+    int cache = addInlineCache(currentChunk());
+    if (cache > UINT16_MAX) {
+        error("Too many property accesses in one function.");
+    }
+    emitByte((cache >> 8) & 0xff, parser.previous.line);
+    emitByte(cache & 0xff, parser.previous.line);
+}
+
 /**
  * Method for emitting a loop instruction.
  */
@@ -73,23 +99,213 @@ void emitReturn() {
 }
 
 /**
- * makeConstant
+ * Method for checking two constants are the same value.
+ *
+ * Numbers have to match to the bit, so 0 and -0 (and an int and the double
+ * it stands for) stay apart, and objects have to be the same object, which
+ * for strings is the same as being equal as they're interned.
+ */
+static bool sameConstant(Value a, Value b) {
+#ifdef NAN_BOXING
+    return a == b;
+#else
+    if (a.type != b.type) {
+        return false;
+    }
+    switch (a.type) {
+        case VAL_BOOL:
+            return a.as.boolean == b.as.boolean;
+        case VAL_NUMBER:
+            return memcmp(&a.as.number, &b.as.number, sizeof(double)) == 0;
+        case VAL_INT:
+            return a.as.integer == b.as.integer;
+        case VAL_OBJ:
+            return a.as.obj == b.as.obj;
+        default:
+            return true;
+    }
+#endif
+}
+
+/**
+ * Method for adding a constant's index to the current compiler's index of them.
+ */
+static void indexConstant(int constant) {
+    Compiler* compiler = current;
+    int mask = compiler->constantIndexCapacity - 1;
+    int slot = (int)(hashValue(currentChunk()->constants.values[constant]) & mask);
+    while (compiler->constantIndex[slot] != -1) {
+        slot = (slot + 1) & mask;
+    }
+    compiler->constantIndex[slot] = constant;
+    compiler->constantIndexCount++;
+}
+
+/**
+ * Method for growing the current compiler's index of its constants.
+ *
+ * It's rebuilt from the constants themselves, which drops any indices
+ * left pointing past the end by code being rewound.
+ */
+static bool growConstantIndex() {
+    Compiler* compiler = current;
+    int capacity = compiler->constantIndexCapacity < 16 ? 16 : compiler->constantIndexCapacity * 2;
+    int* index = (int*)malloc(sizeof(int) * capacity);
+    if (index == NULL) {
+        return false;
+    }
+    free(compiler->constantIndex);
+    compiler->constantIndex = index;
+    compiler->constantIndexCapacity = capacity;
+    compiler->constantIndexCount = 0;
+    for (int i = 0; i < capacity; i++) {
+        index[i] = -1;
+    }
+    for (int i = 0; i < currentChunk()->constants.count; i++) {
+        indexConstant(i);
+    }
+    return true;
+}
+
+/**
+ * Method for finding a constant already in the current chunk, or -1 if it isn't.
  */
-uint8_t makeConstant(Value value) {
-    int constant = addConstant(currentChunk(), value);
-    if (constant > UINT8_MAX) {
+static int findConstant(Value value) {
+    Compiler* compiler = current;
+    if (compiler->constantIndexCapacity == 0) {
+        return -1;
+    }
+    ValueArray* constants = &currentChunk()->constants;
+    int mask = compiler->constantIndexCapacity - 1;
+    for (int slot = (int)(hashValue(value) & mask); compiler->constantIndex[slot] != -1; slot = (slot + 1) & mask) {
+        int constant = compiler->constantIndex[slot];
+        if (constant < constants->count && sameConstant(constants->values[constant], value)) {
+            return constant;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Implementation of method for adding a constant to the chunk.
+ */
+uint16_t makeConstant(Value value) {
+    int constant = findConstant(value);
+    if (constant != -1) {
+        return (uint16_t)constant;
+    }
+
+    constant = addConstant(currentChunk(), value);
+    writeBarrier((Obj*)current->function, value);
+    if (constant > UINT16_MAX) {
         error("Too many constants in one chunk.");
         return 0;
     }
+    // kept at most half full
+    if ((current->constantIndexCount + 1) * 2 > current->constantIndexCapacity) {
+        if (!growConstantIndex()) {
+            return (uint16_t)constant;
+        }
+    } else {
+        indexConstant(constant);
+    }
+    return (uint16_t)constant;
+}
 
-    return (uint8_t)constant;
+/**
+ * The most recently emitted literal, which constant folding checks operands against.
+ */
+static THREAD_LOCAL struct {
+    Chunk* chunk;
+    int start;
+    int end;
+    Value value;
+} lastLiteral = {NULL, -1, -1, NIL_VAL};
+
+/**
+ * Method for recording a literal that was just emitted from the given offset.
+ */
+static void recordLiteral(int start, Value value) {
+    lastLiteral.chunk = currentChunk();
+    lastLiteral.start = start;
+    lastLiteral.end = currentChunk()->count;
+    lastLiteral.value = value;
 }
 
 /**
  * Method for writing a constant to the chunk.
  */
 void emitConstant(Value value) {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+    int start = currentChunk()->count;
+    uint16_t constant = makeConstant(value);
+    if (constant <= UINT8_MAX) {
+        emitBytes(OP_CONSTANT, (uint8_t)constant);
+    } else {
+        emitShortOp(OP_CONSTANT_LONG, constant);
+    }
+    recordLiteral(start, value);
+}
+
+/**
+ * Method for writing a literal value to the chunk.
+ *
+ * nil and booleans have their own instructions, anything else is a constant.
+ */
+void emitLiteral(Value value) {
+    int start = currentChunk()->count;
+    if (IS_NIL(value)) {
+        emitByte(OP_NIL, parser.previous.line);
+    } else if (IS_BOOL(value)) {
+        emitByte(AS_BOOL(value) ? OP_TRUE : OP_FALSE, parser.previous.line);
+    } else {
+        emitConstant(value);
+        return;
+    }
+    recordLiteral(start, value);
+}
+
+/**
+ * Method for getting the current position in the chunk.
+ */
+CodeMark markCode() {
+    CodeMark mark;
+    mark.offset = currentChunk()->count;
+    mark.constantCount = currentChunk()->constants.count;
+    mark.handlerCount = currentChunk()->handlerCount;
+    return mark;
+}
+
+/**
+ * Method for checking whether the code since the given mark is a single literal.
+ */
+bool constantExpression(CodeMark mark, Value* value) {
+    if (lastLiteral.chunk != currentChunk()
+        || lastLiteral.start != mark.offset
+        || lastLiteral.end != currentChunk()->count) {
+        return false;
+    }
+    *value = lastLiteral.value;
+    return true;
+}
+
+/**
+ * Method for discarding everything emitted since the given mark.
+ *
+ * Constants and try blocks added since the mark can only belong to the
+ * discarded code so they're dropped as well.
+ */
+void rewindCode(CodeMark mark) {
+    Chunk* chunk = currentChunk();
+    if (lastLiteral.chunk == chunk && lastLiteral.end > mark.offset) {
+        lastLiteral.chunk = NULL;
+    }
+
+    chunk->count = mark.offset;
+    chunk->constants.count = mark.constantCount;
+    chunk->handlerCount = mark.handlerCount;
+    while (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].offset >= mark.offset) {
+        chunk->lineCount--;
+    }
 }
 
 /**
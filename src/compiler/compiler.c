@@ -8,20 +8,48 @@
 
 #include "core/common.h"
 #include "core/errors.h"
+#include "core/memory.h"
 #include "compiler/compiler.h"
 #include "core/debug.h"
 #include "compiler/codegen.h"
+#include "compiler/optimizer.h"
 #include "parser/parser.h"
 #include "compiler/scanner.h"
 #include "parser/statements.h"
 
-Compiler* current;
-ClassCompiler* currentClass = NULL;
-Token lastVariableToken;
+THREAD_LOCAL Compiler* current;
+THREAD_LOCAL ClassCompiler* currentClass = NULL;
+THREAD_LOCAL Token lastVariableToken;
 
-static Token globalFinals[UINT8_MAX];
-static int globalFinalCount = 0;
-Token lastVariableToken;
+static THREAD_LOCAL Token globalFinals[UINT8_MAX];
+static THREAD_LOCAL int globalFinalCount = 0;
+// the first of globalFinals that belongs to what's being compiled
+static THREAD_LOCAL int globalFinalBase = 0;
+// the most members a compile can remember across its global enums
+#define MAX_ENUM_MEMBERS 512
+
+/**
+ * @struct KnownEnum
+ *
+ * A global enum declared in what's being compiled, whose members can be
+ * resolved to their values as they're read. One with a count of -1 has
+ * been declared again, so can't be relied on.
+ */
+typedef struct KnownEnum {
+    Token name;
+    // where its members start in enumMembers
+    int first;
+    int count;
+} KnownEnum;
+
+static THREAD_LOCAL KnownEnum knownEnums[UINT8_MAX];
+static THREAD_LOCAL int knownEnumCount = 0;
+static THREAD_LOCAL Token enumMembers[MAX_ENUM_MEMBERS];
+static THREAD_LOCAL int enumMemberCount = 0;
+// the module being compiled, or NULL for a script
+static THREAD_LOCAL ObjString* compilingModule = NULL;
+// where the compilers' arrays are allocated from, freed when the compile finishes
+static THREAD_LOCAL Arena* compilerArena = NULL;
 
 /**
  * Method for reporting an error.
@@ -30,6 +58,11 @@ static void errorAt(Token* token, const char* message) {
     if (parser.panicMode) {
         return;
     }
+    if (parser.quiet) {
+        parser.panicMode = true;
+        parser.hadError = true;
+        return;
+    }
 
     Exception exc = {
         .type = ERROR_SYNTAX,
@@ -72,6 +105,7 @@ void patchJump(int offset) {
 
     currentChunk()->code[offset] = (jump >> 8) & 0xff;
     currentChunk()->code[offset + 1] = jump & 0xff;
+    current->lastJumpTarget = currentChunk()->count;
 }
 
 /**
@@ -89,6 +123,28 @@ void patchJumpTo(int offset, int target) {
     currentChunk()->code[offset + 1] = jump & 0xff;
 }
 
+/**
+ * Method for taking the next of the current compiler's locals, growing them if they're full.
+ */
+static Local* pushLocal() {
+    if (current->localCount == current->localCapacity) {
+        current->locals = (Local*)arenaGrowArray(compilerArena, current->locals, &current->localCapacity, sizeof(Local));
+    }
+    return &current->locals[current->localCount++];
+}
+
+/**
+ * Method for giving a finished compiler's arrays back to the arena, once its upvalues have been emitted.
+ *
+ * If an enclosing compiler's upvalues were grown after it started they're
+ * kept, along with the rest, until that one's given back.
+ */
+static void freeCompiler(Compiler* compiler) {
+    if (!compiler->keepArena) {
+        arenaReset(compilerArena, compiler->mark);
+    }
+}
+
 /**
  * Method for initialising our compiler.
  */
@@ -96,27 +152,55 @@ static void initCompiler(Compiler* compiler, FunctionType type, const char* file
     compiler->enclosing = current;
     compiler->function = NULL;
     compiler->type = type;
+    compiler->mark = arenaMark(compilerArena);
+    compiler->keepArena = false;
+    compiler->locals = NULL;
     compiler->localCount = 0;
+    compiler->localCapacity = 0;
+    compiler->upvalues = NULL;
+    compiler->upvalueCapacity = 0;
     compiler->scopeDepth = 0;
     compiler->innermostLoopStart = -1;
     compiler->innermostLoopScopeDepth = 0;
+    compiler->continueJumps = NULL;
     compiler->continueCount = 0;
+    compiler->continueCapacity = 0;
+    compiler->breakJumps = NULL;
     compiler->breakCount = 0;
+    compiler->breakCapacity = 0;
+    compiler->lastCall = -1;
+    compiler->lastGetProperty = -1;
+    compiler->lastJumpTarget = -1;
+    compiler->innermostTry = NULL;
+    compiler->lastLiteral = -1;
+    compiler->lastLiteralStart = NULL;
+    compiler->localPops = NULL;
+    compiler->localPopCount = 0;
+    compiler->localPopCapacity = 0;
+    compiler->hasLocalObjects = false;
+    compiler->constantIndex = NULL;
+    compiler->constantIndexCapacity = 0;
+    compiler->constantIndexCount = 0;
     compiler->function = newFunction();
+    // make the function reachable before allocating anything else
+    current = compiler;
     if (file != NULL) {
         compiler->function->file = copyString(file, (int)strlen(file));
     } else {
         compiler->function->file = copyString("<repl>", 6);
     }
-    current = compiler;
+    writeBarrier((Obj*)compiler->function, OBJ_VAL(compiler->function->file));
 
     if (type != TYPE_SCRIPT) {
         current->function->name = copyString(parser.previous.start, parser.previous.length);
+        writeBarrier((Obj*)current->function, OBJ_VAL(current->function->name));
     }
 
-    Local* local = &current->locals[current->localCount++];
+    Local* local = pushLocal();
     local->depth = 0;
     local->isCaptured = false;
+    local->isFinal = false;
+    local->literal = -1;
     if (type != TYPE_FUNCTION) {
         local->name.start = "self";
         local->name.length = 4;
@@ -126,12 +210,61 @@ static void initCompiler(Compiler* compiler, FunctionType type, const char* file
     }
 }
 
+/**
+ * Method for settling whether a local going out of scope kept the literal
+ * it was declared with in the frame.
+ *
+ * If it did, the literal's made local to the frame, and so are the pops
+ * any break or continue emitted for it, so it's freed as soon as the
+ * local's gone rather than left for the collector.
+ */
+static void settleLocal(int index) {
+    Local* local = &current->locals[index];
+    uint8_t* code = currentChunk()->code;
+    bool kept = local->literal != -1;
+    if (kept) {
+        code[local->literal] = code[local->literal] == OP_LIST ? OP_LIST_LOCAL : OP_DICT_LOCAL;
+        current->hasLocalObjects = true;
+    }
+
+    int count = 0;
+    for (int i = 0; i < current->localPopCount; i++) {
+        LocalPop pop = current->localPops[i];
+        if (pop.local != index) {
+            current->localPops[count++] = pop;
+        } else if (kept) {
+            code[pop.offset] = OP_POP_LOCAL;
+        }
+    }
+    current->localPopCount = count;
+}
+
 /**
  * Method for ending the compiler.
+ *
+ * The function's own locals are never popped, so if any of them or those
+ * of a block returned out of kept a literal in the frame, its returns free
+ * them instead.
  */
 static ObjFunction* endCompiler() {
     emitReturn();
+    for (int i = 1; i < current->localCount; i++) {
+        settleLocal(i);
+    }
+    if (current->hasLocalObjects) {
+        Chunk* chunk = currentChunk();
+        for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+            if (chunk->code[offset] == OP_RETURN) {
+                chunk->code[offset] = OP_RETURN_LOCALS;
+            }
+        }
+    }
     ObjFunction* function = current->function;
+    free(current->constantIndex);
+    if (!parser.hadError) {
+        optimizeChunk(currentChunk());
+    }
+    compactLines(currentChunk());
 #ifdef DEBUG_PRINT_CODE
     if (!parser.hadError) {
         disassembleChunk(currentChunk(), function->name != NULL ? function->name->chars : "<script>");
@@ -171,8 +304,12 @@ void endScope() {
         printf("Popping local: %.*s", current->locals[current->localCount - 1].name.length, current->locals[current->localCount - 1].name.start);
         printf("  (depth=%d, scopeDepth now=%d)\n", current->locals[current->localCount - 1].depth, current->scopeDepth);
         #endif
-        if (current->locals[current->localCount - 1].isCaptured) {
+        Local* local = &current->locals[current->localCount - 1];
+        settleLocal(current->localCount - 1);
+        if (local->isCaptured) {
             emitByte(OP_CLOSE_UPVALUE, parser.previous.line);
+        } else if (local->literal != -1) {
+            emitByte(OP_POP_LOCAL, parser.previous.line);
         } else {
             emitByte(OP_POP, parser.previous.line);
         }
@@ -183,12 +320,52 @@ void endScope() {
 /**
  * Method for identifying a constant.
  */
-uint8_t identifierConstant(Token* name) {
+uint16_t identifierConstant(Token* name) {
     return makeConstant(
         OBJ_VAL(copyString(name->start, name->length))
     );
 }
 
+/**
+ * Method for resolving a global variable to its slot in the VM.
+ *
+ * Globals are given a slot the first time the compiler sees them so
+ * the VM can index straight into its global array at runtime instead of
+ * hashing the name.
+ */
+uint16_t resolveGlobal(Token* name) {
+    ObjString* global;
+    if (compilingModule != NULL) {
+        int length = compilingModule->length + 1 + name->length;
+        char* chars = ALLOCATE(char, length + 1);
+        memcpy(chars, compilingModule->chars, compilingModule->length);
+        chars[compilingModule->length] = '.';
+        memcpy(chars + compilingModule->length + 1, name->start, name->length);
+        chars[length] = '\0';
+        global = takeString(chars, length);
+    } else {
+        global = copyString(name->start, name->length);
+    }
+    int slot = globalSlot(global);
+    if (slot > UINT16_MAX) {
+        error("Too many global variables.");
+        return 0;
+    }
+    return (uint16_t)slot;
+}
+
+/**
+ * Method for emitting a get/set for a local, upvalue or global variable.
+ * Global slots take a two byte operand; locals and upvalues take one.
+ */
+void emitVariableOp(uint8_t op, int arg) {
+    if (op == OP_GET_GLOBAL || op == OP_SET_GLOBAL) {
+        emitShortOp(op, (uint16_t)arg);
+    } else {
+        emitBytes(op, (uint8_t)arg);
+    }
+}
+
 /**
  * Method for comparing two identifiers.
  */
@@ -216,6 +393,14 @@ int resolveLocal(Compiler* compiler, Token* name) {
     return -1;
 }
 
+/**
+ * Method for getting the flags a closure's upvalue is emitted with.
+ * Finals are captured flat as their value can't change.
+*/
+static uint8_t captureFlags(Upvalue* upvalue) {
+    return (upvalue->isLocal ? CAPTURE_LOCAL : 0) | (upvalue->isFinal ? CAPTURE_FLAT : 0);
+}
+
 /**
  * Method for adding an upvalue to the current compiler
 */
@@ -235,6 +420,14 @@ int addUpvalue(Compiler* compiler, uint8_t index, bool isLocal, bool isFinal) {
         error("Too many closure variables in function.");
         return 0;
     }
+    if (upvalueCount == compiler->upvalueCapacity) {
+        compiler->upvalues = (Upvalue*)arenaGrowArray(compilerArena, compiler->upvalues,
+            &compiler->upvalueCapacity, sizeof(Upvalue));
+        // the compilers inside it can't give their part of the arena back now
+        for (Compiler* inner = current; inner != compiler; inner = inner->enclosing) {
+            inner->keepArena = true;
+        }
+    }
 
     compiler->upvalues[upvalueCount].isLocal = isLocal;
     compiler->upvalues[upvalueCount].index = index;
@@ -252,8 +445,13 @@ int resolveUpvalue(Compiler* compiler, Token* name) {
 
     int local = resolveLocal(compiler->enclosing, name);
     if (local != -1) {
-        compiler->enclosing->locals[local].isCaptured = true;
+        // a closure can keep it long after the frame's gone
+        compiler->enclosing->locals[local].literal = -1;
         bool isFinal = compiler->enclosing->locals[local].isFinal;
+        // finals are copied into the closure, so they never need closing over
+        if (!isFinal) {
+            compiler->enclosing->locals[local].isCaptured = true;
+        }
         return addUpvalue(compiler, (uint8_t)local, true, isFinal);
     }
 
@@ -279,11 +477,44 @@ void addLocal(Token name, bool isFinal) {
         return;
     }
 
-    Local* local = &current->locals[current->localCount++];
+    Local* local = pushLocal();
     local->name = name;
     local->depth = -1;
     local->isCaptured = false;
     local->isFinal = isFinal;
+    local->literal = -1;
+}
+
+/**
+ * Implementation of method for adding a break's jump.
+ */
+void addBreakJump(int jump) {
+    if (current->breakCount == current->breakCapacity) {
+        current->breakJumps = (int*)arenaGrowArray(compilerArena, current->breakJumps, &current->breakCapacity, sizeof(int));
+    }
+    current->breakJumps[current->breakCount++] = jump;
+}
+
+/**
+ * Implementation of method for adding a continue's jump.
+ */
+void addContinueJump(int jump) {
+    if (current->continueCount == current->continueCapacity) {
+        current->continueJumps = (int*)arenaGrowArray(compilerArena, current->continueJumps,
+            &current->continueCapacity, sizeof(int));
+    }
+    current->continueJumps[current->continueCount++] = jump;
+}
+
+/**
+ * Implementation of method for adding a pop emitted for a local holding a literal.
+ */
+void addLocalPop(int offset, int local) {
+    if (current->localPopCount == current->localPopCapacity) {
+        current->localPops = (LocalPop*)arenaGrowArray(compilerArena, current->localPops,
+            &current->localPopCapacity, sizeof(LocalPop));
+    }
+    current->localPops[current->localPopCount++] = (LocalPop){offset, local};
 }
 
 /**
@@ -307,7 +538,7 @@ void declareVariable(bool isFinal) {
         }
     }
 
-    for (int i = 0; i < globalFinalCount; i++) {
+    for (int i = globalFinalBase; i < globalFinalCount; i++) {
         if (identifiersEqual(name, &globalFinals[i])) {
             error("Cannot shadow a final global variable.");
         }
@@ -319,7 +550,7 @@ void declareVariable(bool isFinal) {
 /**
  * Method for parsing a variable.
  */
-uint8_t parseVariable(bool isFinal, const char* errorMessage) {
+uint16_t parseVariable(bool isFinal, const char* errorMessage) {
     consumeToken(TOKEN_IDENTIFIER, errorMessage);
 
     lastVariableToken = parser.previous;
@@ -328,7 +559,7 @@ uint8_t parseVariable(bool isFinal, const char* errorMessage) {
     if (current->scopeDepth > 0) {
         return 0;
     }
-    return identifierConstant(&parser.previous);
+    return resolveGlobal(&parser.previous);
 }
 
 /**
@@ -348,10 +579,22 @@ void markInitialized() {
     current->locals[current->localCount - 1].depth = current->scopeDepth;
 }
 
+/**
+ * Method for finding a known global enum by name, or NULL if there isn't one.
+ */
+static KnownEnum* findEnum(Token* name) {
+    for (int i = 0; i < knownEnumCount; i++) {
+        if (identifiersEqual(name, &knownEnums[i].name)) {
+            return &knownEnums[i];
+        }
+    }
+    return NULL;
+}
+
 /**
  * Method for defining a variale.
  */
-void defineVariable(uint8_t global, bool isFinal) {
+void defineVariable(uint16_t global, bool isFinal) {
     if (current->scopeDepth > 0) {
         markInitialized();
         return;
@@ -361,9 +604,14 @@ void defineVariable(uint8_t global, bool isFinal) {
             error("Can't have more than 255 final globals.");
         }
         globalFinals[globalFinalCount++] = lastVariableToken;
+        // a final defined over an enum replaces it when it's run
+        KnownEnum* known = findEnum(&lastVariableToken);
+        if (known != NULL) {
+            known->count = -1;
+        }
     }
     OpCode op = isFinal ? OP_DEFINE_FINAL_GLOBAL : OP_DEFINE_GLOBAL;
-    emitBytes((uint8_t)op, global);
+    emitShortOp((uint8_t)op, global);
 }
 
 /**
@@ -399,7 +647,7 @@ void function(FunctionType type) {
             if (current->function->arity > 255) {
                 errorAtCurrent("Can't have more than 255 parameters.");
             }
-            uint8_t constant = parseVariable(false, "Expected parameter name.");
+            uint16_t constant = parseVariable(false, "Expected parameter name.");
             defineVariable(constant, false);
         } while (matchToken(TOKEN_COMMA));
     }
@@ -408,12 +656,144 @@ void function(FunctionType type) {
     parseBlock();
 
     ObjFunction* function = endCompiler();
-    emitBytes(OP_CLOSURE, makeConstant(OBJ_VAL(function)));
+    emitShortOp(OP_CLOSURE, makeConstant(OBJ_VAL(function)));
 
     for (int i = 0; i < function->upvalueCount; i++) {
-        emitByte(compiler.upvalues[i].isLocal ? 1 : 0, parser.previous.line);
+        emitByte(captureFlags(&compiler.upvalues[i]), parser.previous.line);
         emitByte(compiler.upvalues[i].index, parser.previous.line);
     }
+    freeCompiler(&compiler);
+}
+
+/**
+ * Method for advancing the parser to the next top level token of the given type,
+ * skipping over anything nested in brackets on the way.
+ */
+static void skipTo(TokenType type) {
+    int depth = 0;
+    while (!checkToken(TOKEN_EOF) && (depth > 0 || !checkToken(type))) {
+        if (checkToken(TOKEN_LEFT_PAREN) || checkToken(TOKEN_LEFT_BRACKET) || checkToken(TOKEN_LEFT_BRACE)) {
+            depth++;
+        } else if (checkToken(TOKEN_RIGHT_PAREN) || checkToken(TOKEN_RIGHT_BRACKET) || checkToken(TOKEN_RIGHT_BRACE)) {
+            depth--;
+        }
+        parserAdvance();
+    }
+}
+
+/**
+ * Method for moving the parser back (or forward) to a saved position,
+ * keeping any errors reported since.
+ */
+static void seekParser(Scanner* savedScanner, Parser* savedParser) {
+    bool hadError = parser.hadError;
+    bool panicMode = parser.panicMode;
+    scanner = *savedScanner;
+    parser = *savedParser;
+    parser.hadError |= hadError;
+    parser.panicMode |= panicMode;
+}
+
+/**
+ * Method for compiling a list or dict comprehension, after its opening bracket.
+ *
+ * [expr for (var x in iterable) if (cond)] is compiled into a function that's
+ * called straight away with the iterable, so the loop gets its own frame and
+ * its locals don't collide with anything the surrounding expression has pushed.
+ * The function iterates with OP_ITER_NEXT like a for-in loop, and appends each
+ * value straight into a list (or dict) presized from the iterable's length.
+ *
+ * The element expression comes first but has to be compiled inside the loop,
+ * so the parser skips ahead to the 'for' clause and comes back for it.
+ */
+void comprehension(bool isDict) {
+    TokenType closing = isDict ? TOKEN_RIGHT_BRACE : TOKEN_RIGHT_BRACKET;
+    Scanner elementScanner = scanner;
+    Parser elementParser = parser;
+
+    skipTo(TOKEN_FOR);
+    consumeToken(TOKEN_FOR, "Expect 'for' in comprehension.");
+    consumeToken(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+    consumeToken(TOKEN_VAR, "Expect 'var' in comprehension.");
+    consumeToken(TOKEN_IDENTIFIER, "Expect variable name.");
+    Token varName = parser.previous;
+    consumeToken(TOKEN_IN, "Expect 'in' after variable name.");
+    Scanner iterableScanner = scanner;
+    Parser iterableParser = parser;
+    skipTo(TOKEN_RIGHT_PAREN);
+    consumeToken(TOKEN_RIGHT_PAREN, "Expect ')' after 'for' clauses.");
+
+    Compiler compiler;
+    initCompiler(&compiler, TYPE_FUNCTION, current->function->file->chars);
+    current->function->name = copyString("<comprehension>", 15);
+    writeBarrier((Obj*)current->function, OBJ_VAL(current->function->name));
+    beginScope();
+
+    // the iterable is the only argument, then the cursor and loop variable follow it like a for-in loop
+    current->function->arity = 1;
+    addLocal(syntheticToken("__iterable"), false);
+    markInitialized();
+    emitConstant(INT_VAL(0));
+    addLocal(syntheticToken("__idx"), false);
+    markInitialized();
+    emitByte(OP_NIL, parser.previous.line);
+    addLocal(varName, false);
+    markInitialized();
+    emitBytes(isDict ? OP_NEW_DICT : OP_NEW_LIST, 1);
+    addLocal(syntheticToken("__result"), false);
+    markInitialized();
+    uint8_t resultSlot = (uint8_t)current->localCount - 1;
+
+    int loopStart = currentChunk()->count;
+    emitByte(OP_ITER_NEXT, parser.previous.line);
+    emitByte(1, parser.previous.line);
+    emitByte(0xff, parser.previous.line);
+    emitByte(0xff, parser.previous.line);
+    int exitJump = currentChunk()->count - 2;
+
+    int skipJump = -1;
+    if (matchToken(TOKEN_IF)) {
+        parseExpression();
+        skipJump = emitJump(OP_JUMP_IF_FALSE);
+        emitByte(OP_POP, parser.previous.line);
+    }
+    Scanner endScanner = scanner;
+    Parser endParser = parser;
+
+    seekParser(&elementScanner, &elementParser);
+    parseExpression();
+    if (isDict) {
+        consumeToken(TOKEN_COLON, "Expected ':' after dict key.");
+        parseExpression();
+    }
+    if (!checkToken(TOKEN_FOR)) {
+        errorAtCurrent("Expect 'for' after comprehension expression.");
+    }
+    emitBytes(isDict ? OP_DICT_INSERT : OP_LIST_APPEND, resultSlot);
+    emitLoop(loopStart);
+    if (skipJump != -1) {
+        patchJump(skipJump);
+        emitByte(OP_POP, parser.previous.line);
+        emitLoop(loopStart);
+    }
+    patchJump(exitJump);
+    emitBytes(OP_GET_LOCAL, resultSlot);
+    emitByte(OP_RETURN, parser.previous.line);
+
+    ObjFunction* function = endCompiler();
+    emitShortOp(OP_CLOSURE, makeConstant(OBJ_VAL(function)));
+    for (int i = 0; i < function->upvalueCount; i++) {
+        emitByte(captureFlags(&compiler.upvalues[i]), parser.previous.line);
+        emitByte(compiler.upvalues[i].index, parser.previous.line);
+    }
+    freeCompiler(&compiler);
+
+    // the iterable is evaluated where the comprehension is, then passed in
+    seekParser(&iterableScanner, &iterableParser);
+    parseExpression();
+    seekParser(&endScanner, &endParser);
+    consumeToken(closing, isDict ? "Expected '}' after dict comprehension." : "Expect ']' after list comprehension.");
+    emitBytes(OP_CALL, 1);
 }
 
 /**
@@ -422,14 +802,14 @@ void function(FunctionType type) {
 void method() {
     consumeToken(TOKEN_FUN, "Expected 'func' to define method.");
     consumeToken(TOKEN_IDENTIFIER, "Expected method name.");
-    uint8_t constant = identifierConstant(&parser.previous);
+    uint16_t constant = identifierConstant(&parser.previous);
 
     FunctionType type = TYPE_METHOD;
     if (parser.previous.length == 8 && memcmp(parser.previous.start, "__init__", 8) == 0) {
         type = TYPE_INITIALISER;
     }
     function(type);
-    emitBytes(OP_METHOD, constant);
+    emitShortOp(OP_METHOD, constant);
 }
 
 /**
@@ -438,11 +818,11 @@ void method() {
 void classDeclaration() {
     consumeToken(TOKEN_IDENTIFIER, "Expected class name.");
     Token className = parser.previous;
-    uint8_t nameConstant = identifierConstant(&parser.previous);
+    uint16_t nameConstant = identifierConstant(&parser.previous);
     declareVariable(false);
 
-    emitBytes(OP_CLASS, nameConstant);
-    defineVariable(nameConstant, false);
+    emitShortOp(OP_CLASS, nameConstant);
+    defineVariable(current->scopeDepth > 0 ? 0 : resolveGlobal(&className), false);
 
     ClassCompiler classCompiler;
     classCompiler.hasSuperClass = false;
@@ -485,7 +865,7 @@ void classDeclaration() {
  * Method for compiling functions.
  */
 void funDeclaration() {
-    uint8_t global = parseVariable(false, "Expected function name.");
+    uint16_t global = parseVariable(false, "Expected function name.");
     markInitialized();
     function(TYPE_FUNCTION);
     defineVariable(global, false);
@@ -499,14 +879,17 @@ void varDeclaration(bool isFinal) {
         // consume the var
         consumeToken(TOKEN_VAR, "Expected 'var' after 'final'.");
     }
-    uint8_t global = parseVariable(isFinal, "Expected a variable name.");
+    uint16_t global = parseVariable(isFinal, "Expected a variable name.");
 
+    const char* initialiser = NULL;
     if (isFinal) {
         // we have to define the variable value here for final
         consumeToken(TOKEN_EQUAL, "Expect '=' after variable name for final variables.");
+        initialiser = parser.current.start;
         parseExpression();
     } else {
         if (matchToken(TOKEN_EQUAL)) {
+            initialiser = parser.current.start;
             parseExpression();
         } else {
             emitByte(OP_NIL, parser.previous.line);
@@ -515,23 +898,35 @@ void varDeclaration(bool isFinal) {
 
     consumeToken(TOKEN_SEMICOLON, "Expected ';' after variable declaration.");
     defineVariable(global, isFinal);
+
+    // a local declared with nothing but a list or dict literal may keep it in the frame
+    if (current->scopeDepth > 0 && initialiser != NULL && initialiser == current->lastLiteralStart
+            && current->lastLiteral == currentChunk()->count - 3) {
+        current->locals[current->localCount - 1].literal = current->lastLiteral;
+    }
 }
 
 /**
  * Method for compiling an enum declaration.
  */
 void enumDeclaration() {
-    uint8_t global = parseVariable(false, "Expected enum name.");
+    uint16_t global = parseVariable(true, "Expected enum name.");
+    Token name = parser.previous;
+    uint16_t nameConstant = identifierConstant(&parser.previous);
     markInitialized();
 
+    int first = enumMemberCount;
     uint8_t count = 0;
     consumeToken(TOKEN_LEFT_BRACE, "Expected '{' before enum body.");
 
     if (!checkToken(TOKEN_RIGHT_BRACE)) {
         do {
             consumeToken(TOKEN_IDENTIFIER, "Expected enum member name.");
+            if (enumMemberCount < MAX_ENUM_MEMBERS) {
+                enumMembers[enumMemberCount++] = parser.previous;
+            }
             emitConstant(OBJ_VAL(copyString(parser.previous.start, parser.previous.length)));
-            emitConstant(NUMBER_VAL(count));
+            emitConstant(INT_VAL(count));
             count++;
         } while (matchToken(TOKEN_COMMA));
     }
@@ -540,12 +935,56 @@ void enumDeclaration() {
 
     emitByte(OP_ENUM, parser.previous.line);
     emitByte(count, parser.previous.line);
-    // emitByte((count >> 8) & 0xff, parser.previous.line);
-    // emitByte(count & 0xff, parser.previous.line);
+    emitByte((nameConstant >> 8) & 0xff, parser.previous.line);
+    emitByte(nameConstant & 0xff, parser.previous.line);
 
-    emitByte(global, parser.previous.line);
+    bool known = current->scopeDepth == 0 && findEnum(&name) == NULL;
+    defineVariable(global, true);
+    if (!known || enumMemberCount - first != count || knownEnumCount == UINT8_MAX) {
+        enumMemberCount = first;
+        return;
+    }
+    knownEnums[knownEnumCount].name = name;
+    knownEnums[knownEnumCount].first = first;
+    knownEnums[knownEnumCount++].count = count;
+}
 
-    defineVariable(global, false);
+/**
+ * Method for resolving a read of a known global enum's member to its value.
+ *
+ * The member's value is emitted as a constant in place of looking it up
+ * when it's run. Returns false, consuming nothing, if the name isn't a
+ * known enum, the member isn't one of its members, or it's being assigned
+ * or called rather than read.
+ */
+static bool enumMember(Token* name) {
+    KnownEnum* known = findEnum(name);
+    Token member = peekToken(1);
+    if (known == NULL || known->count == -1 || !checkToken(TOKEN_DOT) || member.type != TOKEN_IDENTIFIER) {
+        return false;
+    }
+    switch (peekToken(2).type) {
+        case TOKEN_EQUAL:
+        case TOKEN_PLUS_EQUAL:
+        case TOKEN_MINUS_EQUAL:
+        case TOKEN_STAR_EQUAL:
+        case TOKEN_SLASH_EQUAL:
+        case TOKEN_PLUS_PLUS:
+        case TOKEN_MINUS_MINUS:
+        case TOKEN_LEFT_PAREN:
+            return false;
+        default:
+            break;
+    }
+    for (int i = 0; i < known->count; i++) {
+        if (identifiersEqual(&member, &enumMembers[known->first + i])) {
+            parserAdvance();
+            parserAdvance();
+            emitConstant(INT_VAL(i));
+            return true;
+        }
+    }
+    return false;
 }
 
 /**
@@ -568,6 +1007,8 @@ void synchronize() {
             case TOKEN_ELIF:
             case TOKEN_WHILE:
             case TOKEN_RETURN:
+            case TOKEN_TRY:
+            case TOKEN_RAISE:
                 return;
             default:
                 ;
@@ -577,6 +1018,52 @@ void synchronize() {
     }
 }
 
+/**
+ * Method for noting a list or dict literal that opened at start was just emitted.
+ */
+void markLiteral(const char* start) {
+    current->lastLiteral = currentChunk()->count - 3;
+    current->lastLiteralStart = start;
+}
+
+/**
+ * The methods of lists that neither hand back nor keep the one they're called on.
+ */
+static const char* const listFrameMethods[] = {
+    "append", "insert", "remove", "index", "count", "extend", "sort", "reserve",
+    "clear", "pop", "clone", NULL
+};
+
+/**
+ * The methods of dicts that neither hand back nor keep the one they're called on.
+ */
+static const char* const dictFrameMethods[] = {
+    "get", "update", "reserve", "clear", "pop", "clone", NULL
+};
+
+/**
+ * Method for checking whether what follows a local keeps the list or dict
+ * it holds in the frame: indexing it or calling one of the frame methods of
+ * its type on it. Anything else could let it escape, such as passing it to
+ * a function, storing it or returning it.
+ */
+static bool staysInFrame(Local* local) {
+    if (checkToken(TOKEN_LEFT_BRACKET)) {
+        return true;
+    }
+    Token name = peekToken(1);
+    if (!checkToken(TOKEN_DOT) || name.type != TOKEN_IDENTIFIER || peekToken(2).type != TOKEN_LEFT_PAREN) {
+        return false;
+    }
+    const char* const* methods = currentChunk()->code[local->literal] == OP_LIST ? listFrameMethods : dictFrameMethods;
+    for (int i = 0; methods[i] != NULL; i++) {
+        if ((int)strlen(methods[i]) == name.length && memcmp(methods[i], name.start, name.length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /**
  * Method for compiling a named variable.
  */
@@ -591,12 +1078,19 @@ void namedVariable(Token name, bool canAssign) {
         getOp = OP_GET_LOCAL;
         setOp = OP_SET_LOCAL;
         isFinal = current->locals[arg].isFinal;
+        // assigning it drops the literal, and reading it has to leave it in the frame
+        if (current->locals[arg].literal != -1 && (checkToken(TOKEN_EQUAL) || !staysInFrame(&current->locals[arg]))) {
+            current->locals[arg].literal = -1;
+        }
     } else if ((arg = resolveUpvalue(current, &name)) != -1) {
-        getOp = OP_GET_UPVALUE;
-        setOp = OP_SET_UPVALUE;
         isFinal = current->upvalues[arg].isFinal;
+        getOp = isFinal ? OP_GET_CAPTURED : OP_GET_UPVALUE;
+        setOp = OP_SET_UPVALUE;
     } else {
-        arg = identifierConstant(&name);
+        if (enumMember(&name)) {
+            return;
+        }
+        arg = resolveGlobal(&name);
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
     }
@@ -606,9 +1100,9 @@ void namedVariable(Token name, bool canAssign) {
             errorAt(&name, "Cannot assign to final variable.");
         }
         parseExpression();
-        emitBytes(setOp, (uint8_t)arg);
+        emitVariableOp(setOp, arg);
     } else {
-        emitBytes(getOp, (uint8_t)arg);
+        emitVariableOp(getOp, arg);
     }
 }
 
@@ -638,21 +1132,51 @@ ObjFunction* compile(const char* source, const char* file) {
     initScanner(source);
     initParser();
 
+    Arena arena;
+    initArena(&arena);
+    Arena* enclosingArena = compilerArena;
+    compilerArena = &arena;
+
     Compiler compiler;
     initCompiler(&compiler, TYPE_SCRIPT, file);
 
     parser.hadError = false;
     parser.panicMode = false;
 
+    int enclosingEnumCount = knownEnumCount;
+    int enclosingMemberCount = enumMemberCount;
+
     parserAdvance();
 
     while (!matchToken(TOKEN_EOF)) {
         parseDeclaration();
     }
 
+    knownEnumCount = enclosingEnumCount;
+    enumMemberCount = enclosingMemberCount;
     ObjFunction* function = endCompiler();
+    compilerArena = enclosingArena;
+    freeArena(&arena);
     if (file != NULL) {
+        push(OBJ_VAL(function));
         function->file = copyString(file, (int)strlen(file));
+        writeBarrier((Obj*)function, OBJ_VAL(function->file));
+        pop();
     }
     return parser.hadError ? NULL : function;
 }
+
+ObjFunction* compileModule(const char* source, const char* file, ObjString* module) {
+    ObjString* enclosingModule = compilingModule;
+    int enclosingFinalBase = globalFinalBase;
+    int enclosingFinalCount = globalFinalCount;
+    compilingModule = module;
+    globalFinalBase = globalFinalCount;
+
+    ObjFunction* function = compile(source, file);
+
+    compilingModule = enclosingModule;
+    globalFinalBase = enclosingFinalBase;
+    globalFinalCount = enclosingFinalCount;
+    return function;
+}
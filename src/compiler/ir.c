@@ -0,0 +1,232 @@
+/**
+ * @file ir.c
+ *
+ * Lifting a chunk's code into a list of instructions and lowering it back.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "compiler/ir.h"
+#include "core/memory.h"
+
+/**
+ * Implementation of method for checking whether the given opcode is a jump.
+ */
+bool isJumpInstruction(uint8_t instruction) {
+    switch (instruction) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_LOOP:
+        case OP_LESS_JUMP:
+        case OP_ITER_NEXT:
+        case OP_EXCEPT_JUMP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Method for getting the number of bytes an instruction takes up in the code.
+ *
+ * A jump's offset is always its last two bytes.
+ */
+static int irLength(IrInstruction* instruction) {
+    return 1 + instruction->operandCount + (isJumpInstruction(instruction->opcode) ? 2 : 0);
+}
+
+/**
+ * Implementation of method for adding operand bytes to the IR.
+ */
+int addOperands(Ir* ir, const uint8_t* bytes, int count) {
+    if (ir->byteCount + count > ir->byteCapacity) {
+        int capacity = (ir->byteCount + count) * 2;
+        uint8_t* grown = (uint8_t*)realloc(ir->bytes, capacity);
+        if (grown == NULL) {
+            return -1;
+        }
+        ir->bytes = grown;
+        ir->byteCapacity = capacity;
+    }
+    int start = ir->byteCount;
+    // most instructions have no operands, and then there's nothing to copy from
+    if (count > 0) {
+        memcpy(ir->bytes + start, bytes, count);
+    }
+    ir->byteCount += count;
+    return start;
+}
+
+/**
+ * Implementation of method for lifting a chunk's code into the IR.
+ */
+bool liftChunk(Ir* ir, Chunk* chunk) {
+    ir->chunk = chunk;
+    ir->count = 0;
+    ir->byteCount = 0;
+    ir->byteCapacity = chunk->count + 1;
+    // every instruction is at least a byte long
+    ir->instructions = (IrInstruction*)malloc(sizeof(IrInstruction) * (chunk->count + 1));
+    ir->bytes = (uint8_t*)malloc(chunk->count + 1);
+    ir->handlers = (IrHandler*)malloc(sizeof(IrHandler) * (chunk->handlerCount + 1));
+    // maps each original offset to the index of the instruction there
+    int* indices = (int*)malloc(sizeof(int) * (chunk->count + 1));
+    if (ir->instructions == NULL || ir->bytes == NULL || ir->handlers == NULL || indices == NULL) {
+        freeIr(ir);
+        free(indices);
+        return false;
+    }
+
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        IrInstruction* instruction = &ir->instructions[ir->count];
+        indices[offset] = ir->count++;
+        instruction->opcode = chunk->code[offset];
+        instruction->operandCount = instructionLength(chunk, offset) - 1
+            - (isJumpInstruction(instruction->opcode) ? 2 : 0);
+        instruction->operands = addOperands(ir, chunk->code + offset + 1, instruction->operandCount);
+        instruction->line = getLine(*chunk, offset);
+        instruction->original = offset;
+        instruction->target = -1;
+        instruction->isTarget = false;
+        instruction->removed = false;
+    }
+    indices[chunk->count] = ir->count;
+
+    for (int i = 0; i < ir->count; i++) {
+        IrInstruction* instruction = &ir->instructions[i];
+        if (isJumpInstruction(instruction->opcode)) {
+            int end = instruction->original + irLength(instruction);
+            int jump = (chunk->code[end - 2] << 8) | chunk->code[end - 1];
+            instruction->target = indices[instruction->opcode == OP_LOOP ? end - jump : end + jump];
+        }
+    }
+    for (int i = 0; i < chunk->handlerCount; i++) {
+        ir->handlers[i].start = indices[chunk->handlers[i].start];
+        ir->handlers[i].end = indices[chunk->handlers[i].end];
+        ir->handlers[i].handler = indices[chunk->handlers[i].handler];
+    }
+
+    free(indices);
+    return true;
+}
+
+/**
+ * Implementation of method for writing the IR back into its chunk.
+ *
+ * Passes only ever shrink the code, so it fits in a buffer the size of the original.
+ */
+void lowerChunk(Ir* ir) {
+    Chunk* chunk = ir->chunk;
+    // maps each instruction to where it's laid out, a removed one to where the next live one is
+    int* offsets = (int*)malloc(sizeof(int) * (ir->count + 1));
+    if (offsets == NULL) {
+        return;
+    }
+    int count = 0;
+    for (int i = 0; i < ir->count; i++) {
+        offsets[i] = count;
+        if (!ir->instructions[i].removed) {
+            count += irLength(&ir->instructions[i]);
+        }
+    }
+    offsets[ir->count] = count;
+
+    uint8_t* code = GROW_ARRAY(uint8_t, NULL, 0, chunk->count);
+    LineStart* lines = GROW_ARRAY(LineStart, NULL, 0, chunk->lineCount);
+    int lineCount = 0;
+    for (int i = 0; i < ir->count; i++) {
+        IrInstruction* instruction = &ir->instructions[i];
+        if (instruction->removed) {
+            continue;
+        }
+        int offset = offsets[i];
+        if (lineCount == 0 || lines[lineCount - 1].line != instruction->line) {
+            lines[lineCount].offset = offset;
+            lines[lineCount++].line = instruction->line;
+        }
+        code[offset] = instruction->opcode;
+        memcpy(code + offset + 1, irOperands(ir, instruction), instruction->operandCount);
+        if (isJumpInstruction(instruction->opcode)) {
+            int end = offset + irLength(instruction);
+            int target = offsets[instruction->target];
+            int jump = instruction->opcode == OP_LOOP ? end - target : target - end;
+            code[end - 2] = (jump >> 8) & 0xff;
+            code[end - 1] = jump & 0xff;
+        }
+    }
+    for (int i = 0; i < chunk->handlerCount; i++) {
+        chunk->handlers[i].start = offsets[ir->handlers[i].start];
+        chunk->handlers[i].end = offsets[ir->handlers[i].end];
+        chunk->handlers[i].handler = offsets[ir->handlers[i].handler];
+    }
+
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+    chunk->code = code;
+    chunk->capacity = chunk->count;
+    chunk->count = count;
+    chunk->lines = lines;
+    chunk->lineCapacity = chunk->lineCount;
+    chunk->lineCount = lineCount;
+    free(offsets);
+}
+
+/**
+ * Implementation of method for freeing the IR.
+ */
+void freeIr(Ir* ir) {
+    free(ir->instructions);
+    free(ir->bytes);
+    free(ir->handlers);
+    ir->instructions = NULL;
+    ir->bytes = NULL;
+    ir->handlers = NULL;
+    ir->count = 0;
+}
+
+/**
+ * Implementation of method for working out which instructions are jump targets.
+ */
+void markTargets(Ir* ir) {
+    for (int i = 0; i < ir->count; i++) {
+        ir->instructions[i].isTarget = false;
+    }
+    for (int i = 0; i < ir->count; i++) {
+        IrInstruction* instruction = &ir->instructions[i];
+        if (instruction->removed || instruction->target < 0) {
+            continue;
+        }
+        int target = liveInstruction(ir, instruction->target);
+        if (target < ir->count) {
+            ir->instructions[target].isTarget = true;
+        }
+    }
+    for (int i = 0; i < ir->chunk->handlerCount; i++) {
+        int edges[] = {ir->handlers[i].start, ir->handlers[i].end, ir->handlers[i].handler};
+        for (int j = 0; j < 3; j++) {
+            int edge = liveInstruction(ir, edges[j]);
+            if (edge < ir->count) {
+                ir->instructions[edge].isTarget = true;
+            }
+        }
+    }
+}
+
+/**
+ * Implementation of method for getting the first live instruction at or after the given index.
+ */
+int liveInstruction(Ir* ir, int index) {
+    while (index < ir->count && ir->instructions[index].removed) {
+        index++;
+    }
+    return index;
+}
+
+/**
+ * Implementation of method for getting the live instruction following the one at the given index.
+ */
+int nextInstruction(Ir* ir, int index) {
+    return liveInstruction(ir, index + 1);
+}
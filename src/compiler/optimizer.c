@@ -0,0 +1,390 @@
+/**
+ * @file optimizer.c
+ *
+ * Optimisation of compiled chunks.
+ *
+ * A finished chunk is lifted into the IR and run through each pass in
+ * turn, then lowered back if any of them changed it. The passes are,
+ * with dead code removed again once fusion's done:
+ *
+ *   Jump threading: a jump that lands on an unconditional forward JUMP goes
+ *   straight to where that one goes, and a JUMP to the next instruction is
+ *   removed.
+ *
+ *   Dead code removal: anything that can't be reached from the start of the
+ *   code or from a try block's handler is removed, such as code after a
+ *   return, break or throw and the jumps left over an else that always returns.
+ *
+ *   Fusion of common instruction sequences into superinstructions:
+ *     GET_LOCAL s, CONSTANT 1, ADD, SET_LOCAL s, POP             -> INC_LOCAL s
+ *     GET_LOCAL s, DUP, CONSTANT 1, ADD, SET_LOCAL s, POP, POP   -> INC_LOCAL s
+ *     LESS, JUMP_IF_FALSE, POP                                   -> LESS_JUMP
+ *     GET_LOCAL a, GET_LOCAL b, <arith>, SET_LOCAL c, POP         -> LOCALS_ARITH_SET <arith> a b c
+ *     GET_LOCAL a, CONSTANT k, <arith>, SET_LOCAL c, POP          -> LOCAL_CONSTANT_ARITH_SET <arith> a k c
+ *     GET_LOCAL a, GET_LOCAL b, <arith>                          -> LOCALS_ARITH <arith> a b
+ *     GET_LOCAL a, CONSTANT k, <arith>                           -> LOCAL_CONSTANT_ARITH <arith> a k
+ *     GET_LOCAL a, GET_LOCAL b                                   -> GET_LOCAL_GET_LOCAL a b
+ *     POP, POP, ...                                              -> POP_N n
+ *
+ *   where <arith> is one of ADD, SUBTRACT, MULTIPLY, DIVIDE or MODULO.
+ *   The arithmetic forms read their operands straight from the frame's slots
+ *   (and write the result to one) rather than going through the stack.
+ *   A sequence is only fused if nothing jumps into the middle of it,
+ *   and the edges of try blocks count as jump targets for that too.
+ *
+ * No pass moves code backwards past a loop's OP_LOOP or adds new back edges,
+ * so the loops the JIT finds are the same ones the compiler wrote.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "compiler/ir.h"
+#include "compiler/optimizer.h"
+#include "core/object.h"
+
+/**
+ * How many jumps in a row threading follows before giving up.
+ */
+#define MAX_THREAD_HOPS 8
+
+/**
+ * A pass over the IR, returning whether it changed anything.
+ */
+typedef bool (*Pass)(Ir* ir);
+
+/**
+ * Method for getting where the instruction at the given index was in the original code.
+ */
+static int originalOffset(Ir* ir, int index) {
+    return index < ir->count ? ir->instructions[index].original : ir->chunk->count;
+}
+
+/**
+ * Method for threading jumps through the unconditional jumps they land on.
+ *
+ * Only forward jumps are threaded, and only as far as the original code
+ * could have reached, as the code between only ever shrinks.
+ */
+static bool threadJumps(Ir* ir) {
+    bool changed = false;
+    for (int i = 0; i < ir->count; i++) {
+        IrInstruction* jump = &ir->instructions[i];
+        if (jump->removed || jump->target < 0 || jump->opcode == OP_LOOP) {
+            continue;
+        }
+
+        int original = liveInstruction(ir, jump->target);
+        int target = original;
+        for (int hops = 0; hops < MAX_THREAD_HOPS && target < ir->count; hops++) {
+            IrInstruction* next = &ir->instructions[target];
+            if (next->opcode != OP_JUMP) {
+                break;
+            }
+            int further = liveInstruction(ir, next->target);
+            if (further <= i || originalOffset(ir, further) - jump->original > UINT16_MAX) {
+                break;
+            }
+            target = further;
+        }
+
+        if (jump->opcode == OP_JUMP && target == nextInstruction(ir, i)) {
+            jump->removed = true;
+            changed = true;
+        } else if (target != original) {
+            jump->target = target;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/**
+ * Method for checking whether the given opcode never carries on to the next instruction.
+ */
+static bool endsBlock(uint8_t instruction) {
+    switch (instruction) {
+        case OP_JUMP:
+        case OP_LOOP:
+        case OP_RETURN:
+        case OP_RETURN_LOCALS:
+        case OP_THROW:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Method for removing the instructions nothing can reach.
+ */
+static bool removeUnreachable(Ir* ir) {
+    bool* reached = (bool*)calloc(ir->count + 1, sizeof(bool));
+    // each instruction reached adds at most its target and the one after it
+    int* pending = (int*)malloc(sizeof(int) * (2 * ir->count + ir->chunk->handlerCount + 1));
+    if (reached == NULL || pending == NULL) {
+        free(reached);
+        free(pending);
+        return false;
+    }
+
+    int pendingCount = 0;
+    pending[pendingCount++] = 0;
+    for (int i = 0; i < ir->chunk->handlerCount; i++) {
+        pending[pendingCount++] = ir->handlers[i].handler;
+    }
+    while (pendingCount > 0) {
+        int index = liveInstruction(ir, pending[--pendingCount]);
+        if (index >= ir->count || reached[index]) {
+            continue;
+        }
+        reached[index] = true;
+        IrInstruction* instruction = &ir->instructions[index];
+        if (instruction->target >= 0) {
+            pending[pendingCount++] = instruction->target;
+        }
+        if (!endsBlock(instruction->opcode)) {
+            pending[pendingCount++] = index + 1;
+        }
+    }
+
+    bool changed = false;
+    for (int i = 0; i < ir->count; i++) {
+        if (!ir->instructions[i].removed && !reached[i]) {
+            ir->instructions[i].removed = true;
+            changed = true;
+        }
+    }
+    free(pending);
+    free(reached);
+    return changed;
+}
+
+/**
+ * Method for gathering up to max live instructions starting at the given index.
+ *
+ * Stops before any instruction after the first that's a jump target,
+ * as there'd be nowhere for the jump to land once the sequence is fused.
+ * Returns how many were gathered.
+ */
+static int gather(Ir* ir, int start, int* sequence, int max) {
+    int length = 0;
+    for (int i = start; i < ir->count && length < max; i = nextInstruction(ir, i)) {
+        if (length > 0 && ir->instructions[i].isTarget) {
+            break;
+        }
+        sequence[length++] = i;
+    }
+    return length;
+}
+
+/**
+ * Method for getting the given operand of the instruction at the given index.
+ */
+static uint8_t operand(Ir* ir, int index, int n) {
+    return irOperands(ir, &ir->instructions[index])[n];
+}
+
+/**
+ * Method for checking the nth instruction of a sequence is the given opcode.
+ */
+static bool matches(Ir* ir, int* sequence, int length, int n, uint8_t instruction) {
+    return n < length && ir->instructions[sequence[n]].opcode == instruction;
+}
+
+/**
+ * Method for checking the nth instruction of a sequence loads the constant one.
+ */
+static bool matchesOne(Ir* ir, int* sequence, int length, int n) {
+    if (!matches(ir, sequence, length, n, OP_CONSTANT)) {
+        return false;
+    }
+    Value constant = ir->chunk->constants.values[operand(ir, sequence[n], 0)];
+    return IS_NUMBER(constant) && AS_NUMBER(constant) == 1;
+}
+
+/**
+ * Method for checking the nth instruction of a sequence is arithmetic with a three address form.
+ */
+static bool matchesArith(Ir* ir, int* sequence, int length, int n) {
+    if (n >= length) {
+        return false;
+    }
+    switch (ir->instructions[sequence[n]].opcode) {
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_MODULO:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Method for finding where a LESS at the given index jumps to if it becomes a LESS_JUMP.
+ *
+ * The false branch of the JUMP_IF_FALSE has to start by popping the condition,
+ * as the fused instruction consumes it and jumps past that POP instead.
+ * Returns -1 if it can't become one.
+ */
+static int lessJumpTarget(Ir* ir, int index) {
+    int jump = nextInstruction(ir, index);
+    if (jump >= ir->count || ir->instructions[jump].opcode != OP_JUMP_IF_FALSE) {
+        return -1;
+    }
+    int pop = nextInstruction(ir, jump);
+    if (pop >= ir->count || ir->instructions[pop].opcode != OP_POP) {
+        return -1;
+    }
+
+    int falseBranch = liveInstruction(ir, ir->instructions[jump].target);
+    if (falseBranch >= ir->count || ir->instructions[falseBranch].opcode != OP_POP) {
+        return -1;
+    }
+    return nextInstruction(ir, falseBranch);
+}
+
+/**
+ * Method for replacing a sequence with a single instruction.
+ *
+ * The instruction takes the place and line of the first in the sequence.
+ */
+static bool replace(Ir* ir, int* sequence, int length, uint8_t instruction, const uint8_t* operands, int operandCount) {
+    int start = addOperands(ir, operands, operandCount);
+    if (start < 0) {
+        return false;
+    }
+    IrInstruction* first = &ir->instructions[sequence[0]];
+    first->opcode = instruction;
+    first->operands = start;
+    first->operandCount = operandCount;
+    first->target = -1;
+    for (int i = 1; i < length; i++) {
+        ir->instructions[sequence[i]].removed = true;
+    }
+    return true;
+}
+
+/**
+ * Method for trying to fuse the sequence starting at the given index.
+ */
+static bool fuse(Ir* ir, int index) {
+    int sequence[UINT8_MAX];
+    int length;
+
+    switch (ir->instructions[index].opcode) {
+        case OP_GET_LOCAL: {
+            length = gather(ir, index, sequence, 7);
+            uint8_t slot = operand(ir, index, 0);
+            if (matchesOne(ir, sequence, length, 1)
+                && matches(ir, sequence, length, 2, OP_ADD)
+                && matches(ir, sequence, length, 3, OP_SET_LOCAL) && operand(ir, sequence[3], 0) == slot
+                && matches(ir, sequence, length, 4, OP_POP)) {
+                return replace(ir, sequence, 5, OP_INC_LOCAL, &slot, 1);
+            }
+            if (matches(ir, sequence, length, 1, OP_DUP)
+                && matchesOne(ir, sequence, length, 2)
+                && matches(ir, sequence, length, 3, OP_ADD)
+                && matches(ir, sequence, length, 4, OP_SET_LOCAL) && operand(ir, sequence[4], 0) == slot
+                && matches(ir, sequence, length, 5, OP_POP)
+                && matches(ir, sequence, length, 6, OP_POP)) {
+                return replace(ir, sequence, 7, OP_INC_LOCAL, &slot, 1);
+            }
+            bool constant = matches(ir, sequence, length, 1, OP_CONSTANT);
+            if ((constant || matches(ir, sequence, length, 1, OP_GET_LOCAL)) && matchesArith(ir, sequence, length, 2)) {
+                uint8_t operands[] = {
+                    ir->instructions[sequence[2]].opcode, slot, operand(ir, sequence[1], 0), 0
+                };
+                if (matches(ir, sequence, length, 3, OP_SET_LOCAL) && matches(ir, sequence, length, 4, OP_POP)) {
+                    operands[3] = operand(ir, sequence[3], 0);
+                    return replace(ir, sequence, 5,
+                                   constant ? OP_LOCAL_CONSTANT_ARITH_SET : OP_LOCALS_ARITH_SET, operands, 4);
+                }
+                return replace(ir, sequence, 3, constant ? OP_LOCAL_CONSTANT_ARITH : OP_LOCALS_ARITH, operands, 3);
+            }
+            if (matches(ir, sequence, length, 1, OP_GET_LOCAL)) {
+                uint8_t operands[] = {slot, operand(ir, sequence[1], 0)};
+                return replace(ir, sequence, 2, OP_GET_LOCAL_GET_LOCAL, operands, 2);
+            }
+            return false;
+        }
+        case OP_LESS: {
+            length = gather(ir, index, sequence, 3);
+            int target = lessJumpTarget(ir, index);
+            if (length < 3 || target < 0 || !replace(ir, sequence, 3, OP_LESS_JUMP, NULL, 0)) {
+                return false;
+            }
+            ir->instructions[index].target = target;
+            return true;
+        }
+        case OP_POP: {
+            length = gather(ir, index, sequence, UINT8_MAX - 1);
+            int pops = 1;
+            while (matches(ir, sequence, length, pops, OP_POP)) {
+                pops++;
+            }
+            if (pops < 2) {
+                return false;
+            }
+            uint8_t count = (uint8_t)pops;
+            return replace(ir, sequence, pops, OP_POP_N, &count, 1);
+        }
+        default:
+            return false;
+    }
+}
+
+/**
+ * Method for fusing instruction sequences into superinstructions.
+ */
+static bool fuseInstructions(Ir* ir) {
+    // a LESS_JUMP lands after its false branch's POP, so nothing can be fused across there
+    for (int i = liveInstruction(ir, 0); i < ir->count; i = nextInstruction(ir, i)) {
+        int target;
+        if (ir->instructions[i].opcode == OP_LESS && (target = lessJumpTarget(ir, i)) >= 0 && target < ir->count) {
+            ir->instructions[target].isTarget = true;
+        }
+    }
+
+    bool changed = false;
+    for (int i = liveInstruction(ir, 0); i < ir->count; i = nextInstruction(ir, i)) {
+        changed |= fuse(ir, i);
+    }
+    return changed;
+}
+
+/**
+ * The passes, in the order they're run.
+ */
+static const Pass passes[] = {
+    threadJumps,
+    removeUnreachable,
+    fuseInstructions,
+    // a LESS_JUMP skips over its false branch's POP, which can leave it unreachable
+    removeUnreachable,
+};
+
+/**
+ * Implementation of method to run the optimiser over a chunk.
+ */
+void optimizeChunk(Chunk* chunk) {
+    if (chunk->count == 0) {
+        return;
+    }
+
+    Ir ir;
+    if (!liftChunk(&ir, chunk)) {
+        return;
+    }
+    bool changed = false;
+    for (size_t i = 0; i < sizeof(passes) / sizeof(passes[0]); i++) {
+        markTargets(&ir);
+        changed |= passes[i](&ir);
+    }
+    if (changed) {
+        lowerChunk(&ir);
+    }
+    freeIr(&ir);
+}
@@ -4,6 +4,7 @@
  * The scanner is responsible for turning source code into tokens.
  */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -12,7 +13,28 @@
 #include "compiler/scanner.h"
 #include "compiler/tokens.h"
 
-Scanner scanner;
+THREAD_LOCAL Scanner scanner;
+
+// keywords by KEYWORD_HASH, as their index in keywords[] plus one so 0 is an empty slot
+static THREAD_LOCAL uint8_t keywordSlots[KEYWORD_SLOTS];
+static THREAD_LOCAL uint8_t keywordLengths[KEYWORD_COUNT];
+static THREAD_LOCAL bool keywordsIndexed = false;
+
+/**
+ * Method for filling the keyword hash table from keywords[].
+ */
+static void indexKeywords() {
+    for (size_t i = 0; i < KEYWORD_COUNT; i++) {
+        int length = (int)strlen(keywords[i].keyword);
+        unsigned slot = KEYWORD_HASH(keywords[i].keyword[0], keywords[i].keyword[length - 1], length);
+        while (keywordSlots[slot] != 0) {
+            slot = (slot + 1) & (KEYWORD_SLOTS - 1);
+        }
+        keywordSlots[slot] = (uint8_t)(i + 1);
+        keywordLengths[i] = (uint8_t)length;
+    }
+    keywordsIndexed = true;
+}
 
 /**
  * Method for initialising our scanner.
@@ -20,6 +42,9 @@ Scanner scanner;
  * Sets the start and 'current' to the start of our code and sets the line to 1.
  */
 void initScanner(const char* source) {
+    if (!keywordsIndexed) {
+        indexKeywords();
+    }
     scanner.start = source;
     scanner.current = source;
     scanner.line = 1;
@@ -49,29 +74,32 @@ static bool isAtEnd() {
 /**
  * Method for working out the identifier type.
  *
- * We use an array of keywords to determine if the identifier
- * is actually a keyword or not. If it is, we return the corresponding
- * token type. If not, we return TOKEN_IDENTIFIER.
+ * The identifier is looked up in the keyword hash table, so it's compared
+ * against at most the keywords that share its slot rather than all of them.
+ * If it's a keyword we return the corresponding token type. If not, we
+ * return TOKEN_IDENTIFIER.
  */
 static TokenType identifierType() {
     int length = (int)(scanner.current - scanner.start);
-    for (size_t i = 0; i < KEYWORD_COUNT; i++) {
-        if ((int)strlen(keywords[i].keyword) == length &&
-            memcmp(scanner.start, keywords[i].keyword, length) == 0) {
-
-            // special handling for 'has not' 'keyword' as this is actually two keywords
-            if (keywords[i].type == TOKEN_HAS) {
-                // save current position
-                const char* afterHas = scanner.current;
-                while (*afterHas == ' ') afterHas++;
-                if (strncmp(afterHas, "not", 3) == 0 && !isAlpha(afterHas[3]) && !isDigit(afterHas[3])) {
-                    // advance scanner.current to after "not"
-                    scanner.current = afterHas + 3;
-                    return TOKEN_HAS_NOT;
-                }
+    unsigned slot = KEYWORD_HASH(scanner.start[0], scanner.current[-1], length);
+    for (; keywordSlots[slot] != 0; slot = (slot + 1) & (KEYWORD_SLOTS - 1)) {
+        int index = keywordSlots[slot] - 1;
+        if (keywordLengths[index] != length || memcmp(scanner.start, keywords[index].keyword, length) != 0) {
+            continue;
+        }
+
+        // special handling for 'has not' 'keyword' as this is actually two keywords
+        if (keywords[index].type == TOKEN_HAS) {
+            // save current position
+            const char* afterHas = scanner.current;
+            while (*afterHas == ' ') afterHas++;
+            if (strncmp(afterHas, "not", 3) == 0 && !isAlpha(afterHas[3]) && !isDigit(afterHas[3])) {
+                // advance scanner.current to after "not"
+                scanner.current = afterHas + 3;
+                return TOKEN_HAS_NOT;
             }
-            return keywords[i].type;
         }
+        return keywords[index].type;
     }
     return TOKEN_IDENTIFIER;
 }
@@ -0,0 +1,1277 @@
+/**
+ * @file bytecode.c
+ * @brief Implementation of the .sloc bytecode cache and .slob bundles.
+ *
+ * A .sloc file is laid out as:
+ *   - the magic bytes, format version and slo version
+ *   - the source's mtime, size and hash, plus when the cache was written
+ *   - the names of every global the code references
+ *   - the size of the line section
+ *   - the script function, with nested functions stored in its constants
+ *   - the line section, every function's line table one after another
+ *
+ * Global slots are assigned per process so the code stores an index into
+ * the file's global names instead, which is resolved back to a slot on load.
+ * All integers are written little-endian.
+ *
+ * A .slob bundle holds a script and every module it imports, compiled the
+ * same way, but with each string written once into a pool at the start of
+ * the file and referred to by its index everywhere
+ * else. The bundle is mapped into memory once per process and each VM
+ * interns the pool the first time it loads something from it:
+ *   - the magic bytes, format version and slo version
+ *   - the string pool, each string's length and null terminated chars
+ *   - the name, offset and size of each module, the script's name is NO_STRING
+ *   - for each module, its file, the names of its globals, the size of its
+ *     line section, its function and then its line section
+ *
+ * A function only stores where its line table is in the line section, so
+ * the tables are kept out of the way of the code. They're only needed for
+ * errors, so a bundle's are left in the mapping to be read from when they
+ * are, and a cache's are copied as they are without being decoded.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "core/bytecode.h"
+#include "core/chunk.h"
+#include "core/memory.h"
+#include "core/table.h"
+#include "core/vm.h"
+
+#include "version.h"
+
+/**
+ * @enum ConstantTag
+ *
+ * The type of each serialised constant.
+ */
+typedef enum ConstantTag {
+    CONSTANT_NIL,
+    CONSTANT_FALSE,
+    CONSTANT_TRUE,
+    CONSTANT_NUMBER,
+    CONSTANT_STRING,
+    CONSTANT_FUNCTION,
+    CONSTANT_INT,
+} ConstantTag;
+
+/**
+ * @struct ByteBuffer
+ *
+ * Growable buffer the cache is written into.
+ */
+typedef struct ByteBuffer {
+    int count;
+    int capacity;
+    uint8_t* bytes;
+} ByteBuffer;
+
+/**
+ * @struct ByteReader
+ *
+ * Cursor over a cache file's contents.
+ * error is set as soon as we read past the end or find something invalid.
+ * Strings are read from pool by their index, when there is one.
+ */
+typedef struct ByteReader {
+    const uint8_t* bytes;
+    size_t count;
+    size_t offset;
+    bool error;
+    const ValueArray* pool;
+    // the line section, and whether the chunks can keep pointing into it rather than copying it
+    const uint8_t* lines;
+    size_t linesSize;
+    bool borrowLines;
+} ByteReader;
+
+/**
+ * @struct GlobalRemap
+ *
+ * Mapping between a process's global slots and a file's global indexes.
+ * Strings are written to pool and referred to by their index, when there is one.
+ */
+typedef struct GlobalRemap {
+    int* indexes;
+    int slotCount;
+    ValueArray names;
+    ValueArray* pool;
+    Table* poolIndexes;
+    // the line section the functions' line tables are written to
+    ByteBuffer* lines;
+} GlobalRemap;
+
+/**
+ * @struct Bundle
+ *
+ * The bundle this process is running, mapped read-only and shared by every VM.
+ */
+typedef struct Bundle {
+    const uint8_t* bytes;
+    size_t size;
+    int stringCount;
+    size_t stringsOffset;
+    int moduleCount;
+    size_t modulesOffset;
+} Bundle;
+
+// the index of a string that isn't there, the script's name in a bundle
+#define NO_STRING 0xffffffffu
+
+static Bundle bundle = {NULL, 0, 0, 0, 0, 0};
+
+// where a 64-bit FNV-1a hash starts
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+
+/**
+ * Method for hashing the source of a script.
+ *
+ * 64-bit FNV-1a.
+ */
+static uint64_t hashSource(const char* source) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (const char* c = source; *c != '\0'; c++) {
+        hash ^= (uint8_t)*c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Method for hashing a run of bytes, carrying on from the given hash.
+ *
+ * 64-bit FNV-1a, like hashSource, so a checksum can be built up over the
+ * pieces of a cache as they're written.
+ */
+static uint64_t hashBytes(uint64_t hash, const uint8_t* bytes, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Implementation of method to get the path of the cache for a source file.
+ *
+ * 'script.slo' is cached as 'script.sloc', anything else gets '.sloc' appended.
+ */
+char* bytecodePath(const char* path) {
+    size_t length = strlen(path);
+    char* cachePath = (char*)malloc(length + 6);
+    if (cachePath == NULL) {
+        return NULL;
+    }
+
+    memcpy(cachePath, path, length + 1);
+    if (length >= 4 && strcmp(path + length - 4, ".slo") == 0) {
+        strcat(cachePath, "c");
+    } else {
+        strcat(cachePath, ".sloc");
+    }
+    return cachePath;
+}
+
+/**
+ * Method for writing a byte to the buffer.
+ */
+static void writeByte(ByteBuffer* buffer, uint8_t byte) {
+    if (buffer->capacity < buffer->count + 1) {
+        int oldCapacity = buffer->capacity;
+        buffer->capacity = GROW_CAPACITY(oldCapacity);
+        buffer->bytes = GROW_ARRAY(uint8_t, buffer->bytes, oldCapacity, buffer->capacity);
+    }
+    buffer->bytes[buffer->count++] = byte;
+}
+
+/**
+ * Method for writing a 32-bit integer to the buffer.
+ */
+static void writeInt(ByteBuffer* buffer, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        writeByte(buffer, (value >> (i * 8)) & 0xff);
+    }
+}
+
+/**
+ * Method for writing a 64-bit integer to the buffer.
+ */
+static void writeLong(ByteBuffer* buffer, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        writeByte(buffer, (value >> (i * 8)) & 0xff);
+    }
+}
+
+/**
+ * Method for writing a length prefixed string to the buffer.
+ */
+static void writeString(ByteBuffer* buffer, const char* chars, int length) {
+    writeInt(buffer, (uint32_t)length);
+    for (int i = 0; i < length; i++) {
+        writeByte(buffer, (uint8_t)chars[i]);
+    }
+}
+
+/**
+ * Method for getting a string's index in a bundle's pool, adding it if it isn't there yet.
+ */
+static uint32_t poolIndex(ValueArray* pool, Table* poolIndexes, ObjString* string) {
+    Value index;
+    if (!tableGet(poolIndexes, OBJ_VAL(string), &index)) {
+        index = NUMBER_VAL(pool->count);
+        writeValueArray(pool, OBJ_VAL(string));
+        tableSet(poolIndexes, OBJ_VAL(string), index);
+    }
+    return (uint32_t)AS_NUMBER(index);
+}
+
+/**
+ * Method for writing a reference to an interned string, its index in the pool if there is one.
+ */
+static void writeStringRef(ByteBuffer* buffer, GlobalRemap* remap, ObjString* string) {
+    if (remap->pool == NULL) {
+        writeString(buffer, string->chars, string->length);
+        return;
+    }
+    writeInt(buffer, poolIndex(remap->pool, remap->poolIndexes, string));
+}
+
+/**
+ * Method for getting the index in the file's global names for a given slot.
+ */
+static int globalIndex(GlobalRemap* remap, int slot) {
+    if (remap->indexes[slot] == -1) {
+        remap->indexes[slot] = remap->names.count;
+        writeValueArray(&remap->names, vm->globalNames.values[slot]);
+    }
+    return remap->indexes[slot];
+}
+
+/**
+ * Method for checking whether the given opcode has a global slot operand.
+ */
+static bool hasGlobalOperand(uint8_t instruction) {
+    switch (instruction) {
+        case OP_DEFINE_GLOBAL:
+        case OP_DEFINE_FINAL_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Method for serialising a function into the buffer.
+ *
+ * Returns false if the function holds a constant we can't serialise.
+ */
+static bool writeFunction(ByteBuffer* buffer, ObjFunction* function, GlobalRemap* remap) {
+    Chunk* chunk = &function->chunk;
+
+    writeInt(buffer, (uint32_t)function->arity);
+    writeInt(buffer, (uint32_t)function->upvalueCount);
+    if (function->name == NULL) {
+        writeByte(buffer, 0);
+    } else {
+        writeByte(buffer, 1);
+        writeStringRef(buffer, remap, function->name);
+    }
+
+    // constants go first so the loader can size OP_CLOSURE instructions
+    writeInt(buffer, (uint32_t)chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value constant = chunk->constants.values[i];
+        if (IS_NIL(constant)) {
+            writeByte(buffer, CONSTANT_NIL);
+        } else if (IS_BOOL(constant)) {
+            writeByte(buffer, AS_BOOL(constant) ? CONSTANT_TRUE : CONSTANT_FALSE);
+        } else if (IS_INT(constant)) {
+            writeByte(buffer, CONSTANT_INT);
+            writeInt(buffer, (uint32_t)AS_INT(constant));
+        } else if (IS_NUMBER(constant)) {
+            double number = AS_NUMBER(constant);
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(bits));
+            writeByte(buffer, CONSTANT_NUMBER);
+            writeLong(buffer, bits);
+        } else if (IS_STRING(constant)) {
+            writeByte(buffer, CONSTANT_STRING);
+            writeStringRef(buffer, remap, AS_STRING(constant));
+        } else if (IS_FUNCTION(constant)) {
+            writeByte(buffer, CONSTANT_FUNCTION);
+            if (!writeFunction(buffer, AS_FUNCTION(constant), remap)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+
+    writeInt(buffer, (uint32_t)chunk->count);
+    for (int offset = 0; offset < chunk->count;) {
+        int length = instructionLength(chunk, offset);
+        // a function that's already run may have been quickened, which only means anything to this VM
+        writeByte(buffer, genericInstruction(chunk->code[offset]));
+        if (hasGlobalOperand(chunk->code[offset])) {
+            int slot = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+            int index = globalIndex(remap, slot);
+            writeByte(buffer, (index >> 8) & 0xff);
+            writeByte(buffer, index & 0xff);
+        } else {
+            for (int i = 1; i < length; i++) {
+                writeByte(buffer, chunk->code[offset + i]);
+            }
+        }
+        offset += length;
+    }
+
+    if (chunk->lineTable == NULL) {
+        compactLines(chunk);
+    }
+    writeInt(buffer, (uint32_t)remap->lines->count);
+    writeInt(buffer, (uint32_t)chunk->lineTableSize);
+    for (int i = 0; i < chunk->lineTableSize; i++) {
+        writeByte(remap->lines, chunk->lineTable[i]);
+    }
+
+    writeInt(buffer, (uint32_t)chunk->cacheCount);
+
+    writeInt(buffer, (uint32_t)chunk->handlerCount);
+    for (int i = 0; i < chunk->handlerCount; i++) {
+        writeInt(buffer, (uint32_t)chunk->handlers[i].start);
+        writeInt(buffer, (uint32_t)chunk->handlers[i].end);
+        writeInt(buffer, (uint32_t)chunk->handlers[i].handler);
+        writeInt(buffer, (uint32_t)chunk->handlers[i].depth);
+    }
+    return true;
+}
+
+/**
+ * Implementation of method to write a compiled script's cache.
+ *
+ * The cache is written to a temporary file first and renamed over the old
+ * one so a concurrent run never sees a partially written cache.
+ */
+bool writeBytecode(ObjFunction* function, const char* path, const char* source) {
+    struct stat sourceStat;
+    if (stat(path, &sourceStat) != 0) {
+        return false;
+    }
+
+    GlobalRemap remap;
+    remap.slotCount = vm->globalValues.count;
+    remap.indexes = (int*)malloc(sizeof(int) * (remap.slotCount + 1));
+    if (remap.indexes == NULL) {
+        return false;
+    }
+    for (int i = 0; i < remap.slotCount; i++) {
+        remap.indexes[i] = -1;
+    }
+    initValueArray(&remap.names);
+    remap.pool = NULL;
+    remap.poolIndexes = NULL;
+    ByteBuffer lines = {0, 0, NULL};
+    remap.lines = &lines;
+
+    ByteBuffer body = {0, 0, NULL};
+    bool serialised = writeFunction(&body, function, &remap);
+
+    ByteBuffer header = {0, 0, NULL};
+    ByteBuffer globals = {0, 0, NULL};
+    if (serialised) {
+        for (int i = 0; i < 4; i++) {
+            writeByte(&header, (uint8_t)SLOC_MAGIC[i]);
+        }
+        writeInt(&header, SLOC_FORMAT_VERSION);
+        writeString(&header, SLO_VERSION, (int)strlen(SLO_VERSION));
+        writeLong(&header, (uint64_t)sourceStat.st_mtime);
+        writeLong(&header, (uint64_t)time(NULL));
+        writeLong(&header, (uint64_t)strlen(source));
+        writeLong(&header, hashSource(source));
+        writeInt(&globals, (uint32_t)remap.names.count);
+        for (int i = 0; i < remap.names.count; i++) {
+            ObjString* name = AS_STRING(remap.names.values[i]);
+            writeString(&globals, name->chars, name->length);
+        }
+        writeInt(&globals, (uint32_t)lines.count);
+
+        // a checksum of everything after it, the size and mtime only say the source hasn't changed
+        uint64_t checksum = hashBytes(FNV_OFFSET_BASIS, globals.bytes, globals.count);
+        checksum = hashBytes(checksum, body.bytes, body.count);
+        writeLong(&header, hashBytes(checksum, lines.bytes, lines.count));
+    }
+
+    bool written = false;
+    char* cachePath = bytecodePath(path);
+    char* tempPath = cachePath == NULL ? NULL : (char*)malloc(strlen(cachePath) + 5);
+    if (serialised && tempPath != NULL) {
+        sprintf(tempPath, "%s.tmp", cachePath);
+        FILE* file = fopen(tempPath, "wb");
+        if (file != NULL) {
+            written = fwrite(header.bytes, 1, header.count, file) == (size_t)header.count
+                && fwrite(globals.bytes, 1, globals.count, file) == (size_t)globals.count
+                && fwrite(body.bytes, 1, body.count, file) == (size_t)body.count
+                && fwrite(lines.bytes, 1, lines.count, file) == (size_t)lines.count;
+            written = fclose(file) == 0 && written;
+            if (written) {
+                written = rename(tempPath, cachePath) == 0;
+            }
+            if (!written) {
+                remove(tempPath);
+            }
+        }
+    }
+
+    free(tempPath);
+    free(cachePath);
+    FREE_ARRAY(uint8_t, header.bytes, header.capacity);
+    FREE_ARRAY(uint8_t, globals.bytes, globals.capacity);
+    FREE_ARRAY(uint8_t, body.bytes, body.capacity);
+    FREE_ARRAY(uint8_t, lines.bytes, lines.capacity);
+    freeValueArray(&remap.names);
+    free(remap.indexes);
+    return written;
+}
+
+/**
+ * Method for reading a byte from the cache.
+ */
+static uint8_t readByte(ByteReader* reader) {
+    if (reader->offset + 1 > reader->count) {
+        reader->error = true;
+        return 0;
+    }
+    return reader->bytes[reader->offset++];
+}
+
+/**
+ * Method for reading a 32-bit integer from the cache.
+ */
+static uint32_t readInt(ByteReader* reader) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (uint32_t)readByte(reader) << (i * 8);
+    }
+    return value;
+}
+
+/**
+ * Method for reading a 64-bit integer from the cache.
+ */
+static uint64_t readLong(ByteReader* reader) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t)readByte(reader) << (i * 8);
+    }
+    return value;
+}
+
+/**
+ * Method for reading a count that must fit in the remaining bytes.
+ *
+ * Each counted element takes at least elementSize bytes so this stops
+ * a corrupt count from allocating huge arrays.
+ */
+static int readCount(ByteReader* reader, size_t elementSize) {
+    uint32_t count = readInt(reader);
+    if (reader->error || count > (reader->count - reader->offset) / elementSize) {
+        reader->error = true;
+        return 0;
+    }
+    return (int)count;
+}
+
+/**
+ * Method for reading the size of the line section and setting it aside.
+ *
+ * The section's at the end, so what's left to read stops before it.
+ */
+static void readLineSection(ByteReader* reader, bool borrow) {
+    int size = readCount(reader, 1);
+    if (reader->error) {
+        return;
+    }
+    reader->count -= size;
+    reader->lines = reader->bytes + reader->count;
+    reader->linesSize = (size_t)size;
+    reader->borrowLines = borrow;
+}
+
+/**
+ * Method for reading a length prefixed string from the cache, or a reference to one in the pool.
+ */
+static ObjString* readString(ByteReader* reader) {
+    if (reader->pool != NULL) {
+        uint32_t index = readInt(reader);
+        if (reader->error || index >= (uint32_t)reader->pool->count) {
+            reader->error = true;
+            return NULL;
+        }
+        return AS_STRING(reader->pool->values[index]);
+    }
+
+    int length = readCount(reader, 1);
+    if (reader->error) {
+        return NULL;
+    }
+    ObjString* string = copyString((const char*)reader->bytes + reader->offset, length);
+    reader->offset += length;
+    return string;
+}
+
+/**
+ * Method for checking the magic, versions, checksum and source of a cache.
+ */
+static bool readHeader(ByteReader* reader, const char* path, const char* source) {
+    for (int i = 0; i < 4; i++) {
+        if (readByte(reader) != (uint8_t)SLOC_MAGIC[i]) {
+            return false;
+        }
+    }
+    if (readInt(reader) != SLOC_FORMAT_VERSION) {
+        return false;
+    }
+
+    int versionLength = readCount(reader, 1);
+    if (reader->error || versionLength != (int)strlen(SLO_VERSION)
+        || memcmp(reader->bytes + reader->offset, SLO_VERSION, versionLength) != 0) {
+        return false;
+    }
+    reader->offset += versionLength;
+
+    uint64_t mtime = readLong(reader);
+    uint64_t writtenAt = readLong(reader);
+    uint64_t size = readLong(reader);
+    uint64_t hash = readLong(reader);
+    uint64_t checksum = readLong(reader);
+    if (reader->error || size != strlen(source)
+        || checksum != hashBytes(FNV_OFFSET_BASIS, reader->bytes + reader->offset, reader->count - reader->offset)) {
+        return false;
+    }
+
+    // trusting the mtime is only safe if the source wasn't modified
+    // in the same second the cache was written
+    struct stat sourceStat;
+    if (stat(path, &sourceStat) == 0 && (uint64_t)sourceStat.st_mtime == mtime && mtime < writtenAt) {
+        return true;
+    }
+    return hash == hashSource(source);
+}
+
+/**
+ * Method for reading a two byte operand.
+ */
+static int readOperand(Chunk* chunk, int offset) {
+    return (chunk->code[offset] << 8) | chunk->code[offset + 1];
+}
+
+/**
+ * Method for checking the operands of a function read from a cache.
+ *
+ * run() trusts every operand it reads, so constant and inline cache indexes
+ * must be in range, names must be strings and jumps must land on an instruction.
+ */
+static bool checkOperands(Chunk* chunk) {
+    bool* starts = (bool*)calloc(chunk->count + 1, sizeof(bool));
+    if (starts == NULL) {
+        return false;
+    }
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        starts[offset] = true;
+    }
+
+    bool valid = true;
+    int constantCount = chunk->constants.count;
+    for (int offset = 0; offset < chunk->count && valid;) {
+        uint8_t instruction = chunk->code[offset];
+        int length = instructionLength(chunk, offset);
+        int constant = -1;
+        int name = -1;
+        int cache = -1;
+        int target = -1;
+
+        switch (instruction) {
+            case OP_CONSTANT:
+                constant = chunk->code[offset + 1];
+                break;
+            case OP_LOCAL_CONSTANT_ARITH:
+            case OP_LOCAL_CONSTANT_ARITH_SET:
+                constant = chunk->code[offset + 3];
+                break;
+            case OP_CONSTANT_LONG:
+                constant = readOperand(chunk, offset + 1);
+                break;
+            case OP_CLASS:
+            case OP_METHOD:
+            case OP_GET_SUPER:
+            case OP_IMPORT:
+            case OP_SUPER_INVOKE:
+                name = readOperand(chunk, offset + 1);
+                break;
+            case OP_ENUM:
+                name = readOperand(chunk, offset + 2);
+                break;
+            case OP_GET_PROPERTY:
+            case OP_SET_PROPERTY:
+                name = readOperand(chunk, offset + 1);
+                cache = readOperand(chunk, offset + 3);
+                break;
+            case OP_INVOKE:
+                name = readOperand(chunk, offset + 1);
+                cache = readOperand(chunk, offset + 4);
+                break;
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE:
+            case OP_LESS_JUMP:
+                target = offset + 3 + readOperand(chunk, offset + 1);
+                break;
+            case OP_LOOP:
+                target = offset + 3 - readOperand(chunk, offset + 1);
+                break;
+            case OP_ITER_NEXT:
+                target = offset + 4 + readOperand(chunk, offset + 2);
+                break;
+            case OP_EXCEPT_JUMP:
+                target = offset + 5 + readOperand(chunk, offset + 3);
+                break;
+            default:
+                valid = instruction <= OP_HAS_SET;
+                break;
+        }
+
+        if (constant >= constantCount || cache >= chunk->cacheCount
+            || (name != -1 && (name >= constantCount || !IS_STRING(chunk->constants.values[name])))
+            || (target != -1 && (target < 0 || target >= chunk->count || !starts[target]))) {
+            valid = false;
+        }
+        offset += length;
+    }
+
+    free(starts);
+    return valid;
+}
+
+/**
+ * Method for reading a function from the cache.
+ *
+ * The function is kept on the stack while we read it so it, and everything
+ * already in its constants, survives any collections.
+ */
+static ObjFunction* readFunction(ByteReader* reader, int* slots, int globalCount, ObjString* file, int depth) {
+    // guard against corrupt files recursing forever
+    if (depth > UINT8_COUNT) {
+        reader->error = true;
+        return NULL;
+    }
+
+    ObjFunction* function = newFunction();
+    push(OBJ_VAL(function));
+    Chunk* chunk = &function->chunk;
+
+    function->file = file;
+    writeBarrier((Obj*)function, OBJ_VAL(file));
+    function->arity = (int)readInt(reader);
+    function->upvalueCount = (int)readInt(reader);
+    if (function->arity < 0 || function->arity >= UINT8_COUNT
+        || function->upvalueCount < 0 || function->upvalueCount > UINT8_COUNT) {
+        reader->error = true;
+    }
+    if (readByte(reader) == 1) {
+        function->name = readString(reader);
+        if (function->name != NULL) {
+            writeBarrier((Obj*)function, OBJ_VAL(function->name));
+        }
+    }
+
+    int constantCount = readCount(reader, 1);
+    for (int i = 0; i < constantCount && !reader->error; i++) {
+        Value constant = NIL_VAL;
+        switch (readByte(reader)) {
+            case CONSTANT_NIL:
+                break;
+            case CONSTANT_FALSE:
+                constant = BOOL_VAL(false);
+                break;
+            case CONSTANT_TRUE:
+                constant = BOOL_VAL(true);
+                break;
+            case CONSTANT_NUMBER: {
+                uint64_t bits = readLong(reader);
+                double number;
+                memcpy(&number, &bits, sizeof(number));
+                constant = NUMBER_VAL(number);
+                break;
+            }
+            case CONSTANT_INT:
+                constant = INT_VAL((int32_t)readInt(reader));
+                break;
+            case CONSTANT_STRING: {
+                ObjString* string = readString(reader);
+                if (string != NULL) {
+                    constant = OBJ_VAL(string);
+                }
+                break;
+            }
+            case CONSTANT_FUNCTION: {
+                ObjFunction* nested = readFunction(reader, slots, globalCount, file, depth + 1);
+                if (nested != NULL) {
+                    constant = OBJ_VAL(nested);
+                }
+                break;
+            }
+            default:
+                reader->error = true;
+                break;
+        }
+        addConstant(chunk, constant);
+        writeBarrier((Obj*)function, constant);
+    }
+
+    int codeCount = readCount(reader, 1);
+    if (!reader->error && codeCount > 0) {
+        chunk->code = GROW_ARRAY(uint8_t, NULL, 0, codeCount);
+        chunk->capacity = codeCount;
+        chunk->count = codeCount;
+        memcpy(chunk->code, reader->bytes + reader->offset, codeCount);
+        reader->offset += codeCount;
+
+        for (int offset = 0; offset < chunk->count && !reader->error;) {
+            uint8_t instruction = chunk->code[offset];
+            if (instruction == OP_CLOSURE && (offset + 2 >= chunk->count
+                || ((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]) >= chunk->constants.count
+                || !IS_FUNCTION(chunk->constants.values[(chunk->code[offset + 1] << 8) | chunk->code[offset + 2]]))) {
+                reader->error = true;
+                break;
+            }
+            if (instruction == OP_FORMAT && offset + 1 >= chunk->count) {
+                reader->error = true;
+                break;
+            }
+
+            int length = instructionLength(chunk, offset);
+            if (offset + length > chunk->count) {
+                reader->error = true;
+                break;
+            }
+
+            if (hasGlobalOperand(instruction)) {
+                int index = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+                if (index >= globalCount) {
+                    reader->error = true;
+                    break;
+                }
+                chunk->code[offset + 1] = (slots[index] >> 8) & 0xff;
+                chunk->code[offset + 2] = slots[index] & 0xff;
+            }
+            offset += length;
+        }
+    }
+
+    uint32_t linesOffset = readInt(reader);
+    uint32_t linesSize = readInt(reader);
+    if (!reader->error && linesSize > 0
+        && ((size_t)linesOffset + linesSize > reader->linesSize
+            || !setLineTable(chunk, reader->lines + linesOffset, (int)linesSize, reader->borrowLines))) {
+        reader->error = true;
+    }
+
+    int cacheCount = (int)readInt(reader);
+    if (cacheCount < 0 || cacheCount > chunk->count) {
+        reader->error = true;
+    }
+    for (int i = 0; i < cacheCount && !reader->error; i++) {
+        addInlineCache(chunk);
+    }
+
+    int handlerCount = readCount(reader, 16);
+    for (int i = 0; i < handlerCount && !reader->error; i++) {
+        int start = (int)readInt(reader);
+        int end = (int)readInt(reader);
+        int handler = (int)readInt(reader);
+        int depth = (int)readInt(reader);
+        if (start < 0 || end < start || end > chunk->count || handler < 0 || handler >= chunk->count
+            || depth < 0 || depth > UINT8_COUNT) {
+            reader->error = true;
+            break;
+        }
+        addExceptionHandler(chunk, start, end, handler, depth);
+    }
+
+    if (!reader->error && !checkOperands(chunk)) {
+        reader->error = true;
+    }
+
+    pop();
+    return reader->error ? NULL : function;
+}
+
+/**
+ * Method for reading the whole cache file into memory.
+ */
+static uint8_t* readCacheFile(const char* cachePath, size_t* size) {
+    FILE* file = fopen(cachePath, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    fseek(file, 0L, SEEK_END);
+    long fileSize = ftell(file);
+    rewind(file);
+
+    uint8_t* buffer = fileSize > 0 ? (uint8_t*)malloc(fileSize) : NULL;
+    if (buffer != NULL && fread(buffer, 1, fileSize, file) != (size_t)fileSize) {
+        free(buffer);
+        buffer = NULL;
+    }
+    fclose(file);
+
+    *size = (size_t)fileSize;
+    return buffer;
+}
+
+/**
+ * Implementation of method to load a cached compiled script.
+ */
+/**
+ * Method for checking a cached global belongs to what's being loaded.
+ *
+ * A module's globals are all named "module.name", a script's never have a '.'.
+ */
+static bool globalBelongsTo(ObjString* name, ObjString* module) {
+    if (module == NULL) {
+        return memchr(name->chars, '.', name->length) == NULL;
+    }
+    return name->length > module->length && name->chars[module->length] == '.'
+        && memcmp(name->chars, module->chars, module->length) == 0;
+}
+
+ObjFunction* readBytecode(const char* path, const char* source, ObjString* module) {
+    char* cachePath = bytecodePath(path);
+    if (cachePath == NULL) {
+        return NULL;
+    }
+
+    size_t size = 0;
+    uint8_t* bytes = readCacheFile(cachePath, &size);
+    free(cachePath);
+    if (bytes == NULL) {
+        return NULL;
+    }
+
+    ByteReader reader = {bytes, size, 0, false, NULL, NULL, 0, false};
+    ObjFunction* function = NULL;
+    if (readHeader(&reader, path, source)) {
+        int globalCount = readCount(&reader, 4);
+        int* slots = (int*)malloc(sizeof(int) * (globalCount + 1));
+        for (int i = 0; i < globalCount && !reader.error && slots != NULL; i++) {
+            ObjString* name = readString(&reader);
+            if (name != NULL && !globalBelongsTo(name, module)) {
+                reader.error = true;
+            } else if (name != NULL) {
+                slots[i] = globalSlot(name);
+            }
+        }
+        readLineSection(&reader, false);
+
+        if (!reader.error && slots != NULL) {
+            ObjString* file = copyString(path, (int)strlen(path));
+            push(OBJ_VAL(file));
+            function = readFunction(&reader, slots, globalCount, file, 0);
+            pop();
+        }
+
+        // trailing bytes mean this isn't a cache we wrote, and a script never takes arguments
+        if (reader.error || reader.offset != reader.count || (function != NULL && function->arity != 0)) {
+            function = NULL;
+        }
+        free(slots);
+    }
+
+    free(bytes);
+    return function;
+}
+
+/**
+ * Implementation of method to serialise a function on its own.
+ */
+uint8_t* packFunction(ObjFunction* function, size_t* size) {
+    GlobalRemap remap;
+    remap.slotCount = vm->globalValues.count;
+    remap.indexes = (int*)malloc(sizeof(int) * (remap.slotCount + 1));
+    if (remap.indexes == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < remap.slotCount; i++) {
+        remap.indexes[i] = -1;
+    }
+    initValueArray(&remap.names);
+    remap.pool = NULL;
+    remap.poolIndexes = NULL;
+    ByteBuffer lines = {0, 0, NULL};
+    remap.lines = &lines;
+
+    ByteBuffer body = {0, 0, NULL};
+    bool serialised = writeFunction(&body, function, &remap);
+
+    ByteBuffer header = {0, 0, NULL};
+    uint8_t* packed = NULL;
+    if (serialised) {
+        ObjString* file = function->file;
+        if (file == NULL) {
+            writeString(&header, "", 0);
+        } else {
+            writeString(&header, file->chars, file->length);
+        }
+        writeInt(&header, (uint32_t)remap.names.count);
+        for (int i = 0; i < remap.names.count; i++) {
+            ObjString* name = AS_STRING(remap.names.values[i]);
+            writeString(&header, name->chars, name->length);
+        }
+        writeInt(&header, (uint32_t)lines.count);
+
+        *size = (size_t)header.count + body.count + lines.count;
+        packed = (uint8_t*)malloc(*size > 0 ? *size : 1);
+        if (packed != NULL) {
+            memcpy(packed, header.bytes, header.count);
+            memcpy(packed + header.count, body.bytes, body.count);
+            memcpy(packed + header.count + body.count, lines.bytes, lines.count);
+        }
+    }
+
+    FREE_ARRAY(uint8_t, header.bytes, header.capacity);
+    FREE_ARRAY(uint8_t, body.bytes, body.capacity);
+    FREE_ARRAY(uint8_t, lines.bytes, lines.capacity);
+    freeValueArray(&remap.names);
+    free(remap.indexes);
+    return packed;
+}
+
+/**
+ * Implementation of method to load a function serialised by packFunction.
+ */
+ObjFunction* unpackFunction(const uint8_t* bytes, size_t size) {
+    ByteReader reader = {bytes, size, 0, false, NULL, NULL, 0, false};
+    ObjString* file = readString(&reader);
+    if (file == NULL) {
+        return NULL;
+    }
+    push(OBJ_VAL(file));
+
+    ObjFunction* function = NULL;
+    int globalCount = readCount(&reader, 4);
+    int* slots = (int*)malloc(sizeof(int) * (globalCount + 1));
+    for (int i = 0; i < globalCount && !reader.error && slots != NULL; i++) {
+        ObjString* name = readString(&reader);
+        if (name != NULL) {
+            slots[i] = globalSlot(name);
+        }
+    }
+    readLineSection(&reader, false);
+    if (!reader.error && slots != NULL) {
+        function = readFunction(&reader, slots, globalCount, file, 0);
+    }
+    if (reader.error || reader.offset != reader.count) {
+        function = NULL;
+    }
+
+    free(slots);
+    pop();
+    return function;
+}
+
+/**
+ * Method for serialising a bundled module: its file, the names of its globals and its function.
+ */
+static bool writeBundledFunction(ByteBuffer* buffer, ObjFunction* function, ValueArray* pool, Table* poolIndexes) {
+    if (function->file == NULL) {
+        return false;
+    }
+
+    GlobalRemap remap;
+    remap.slotCount = vm->globalValues.count;
+    remap.indexes = (int*)malloc(sizeof(int) * (remap.slotCount + 1));
+    if (remap.indexes == NULL) {
+        return false;
+    }
+    for (int i = 0; i < remap.slotCount; i++) {
+        remap.indexes[i] = -1;
+    }
+    initValueArray(&remap.names);
+    remap.pool = pool;
+    remap.poolIndexes = poolIndexes;
+    ByteBuffer lines = {0, 0, NULL};
+    remap.lines = &lines;
+
+    ByteBuffer body = {0, 0, NULL};
+    bool serialised = writeFunction(&body, function, &remap);
+    if (serialised) {
+        writeStringRef(buffer, &remap, function->file);
+        writeInt(buffer, (uint32_t)remap.names.count);
+        for (int i = 0; i < remap.names.count; i++) {
+            writeStringRef(buffer, &remap, AS_STRING(remap.names.values[i]));
+        }
+        writeInt(buffer, (uint32_t)lines.count);
+        for (int i = 0; i < body.count; i++) {
+            writeByte(buffer, body.bytes[i]);
+        }
+        for (int i = 0; i < lines.count; i++) {
+            writeByte(buffer, lines.bytes[i]);
+        }
+    }
+
+    FREE_ARRAY(uint8_t, body.bytes, body.capacity);
+    FREE_ARRAY(uint8_t, lines.bytes, lines.capacity);
+    freeValueArray(&remap.names);
+    free(remap.indexes);
+    return serialised;
+}
+
+/**
+ * Implementation of method to write a bundle.
+ */
+bool writeBundle(const char* path, ObjFunction* script, ObjString** names, ObjFunction** modules, int moduleCount) {
+    int total = moduleCount + 1;
+    ValueArray pool;
+    initValueArray(&pool);
+    Table poolIndexes;
+    initTable(&poolIndexes);
+
+    ByteBuffer* bodies = (ByteBuffer*)calloc(total, sizeof(ByteBuffer));
+    bool serialised = bodies != NULL;
+    for (int i = 0; i < total && serialised; i++) {
+        serialised = writeBundledFunction(&bodies[i], i == 0 ? script : modules[i - 1], &pool, &poolIndexes);
+    }
+    // the module names go in the pool too, before it's written out
+    uint32_t* nameIndexes = serialised ? (uint32_t*)malloc(sizeof(uint32_t) * total) : NULL;
+    serialised = nameIndexes != NULL;
+    for (int i = 0; i < total && serialised; i++) {
+        nameIndexes[i] = i == 0 ? NO_STRING : poolIndex(&pool, &poolIndexes, names[i - 1]);
+    }
+
+    ByteBuffer header = {0, 0, NULL};
+    if (serialised) {
+        for (int i = 0; i < 4; i++) {
+            writeByte(&header, (uint8_t)SLOB_MAGIC[i]);
+        }
+        writeInt(&header, SLOC_FORMAT_VERSION);
+        writeString(&header, SLO_VERSION, (int)strlen(SLO_VERSION));
+
+        writeInt(&header, (uint32_t)pool.count);
+        for (int i = 0; i < pool.count; i++) {
+            ObjString* string = AS_STRING(pool.values[i]);
+            writeString(&header, string->chars, string->length);
+            writeByte(&header, '\0');
+        }
+
+        writeInt(&header, (uint32_t)total);
+        uint32_t offset = (uint32_t)header.count + (uint32_t)total * 12;
+        for (int i = 0; i < total; i++) {
+            writeInt(&header, nameIndexes[i]);
+            writeInt(&header, offset);
+            writeInt(&header, (uint32_t)bodies[i].count);
+            offset += (uint32_t)bodies[i].count;
+        }
+    }
+
+    bool written = false;
+    FILE* file = serialised ? fopen(path, "wb") : NULL;
+    if (file != NULL) {
+        written = fwrite(header.bytes, 1, header.count, file) == (size_t)header.count;
+        for (int i = 0; i < total && written; i++) {
+            written = fwrite(bodies[i].bytes, 1, bodies[i].count, file) == (size_t)bodies[i].count;
+        }
+        written = fclose(file) == 0 && written;
+        if (!written) {
+            remove(path);
+        }
+    }
+
+    for (int i = 0; bodies != NULL && i < total; i++) {
+        FREE_ARRAY(uint8_t, bodies[i].bytes, bodies[i].capacity);
+    }
+    free(bodies);
+    free(nameIndexes);
+    FREE_ARRAY(uint8_t, header.bytes, header.capacity);
+    freeTable(&poolIndexes);
+    freeValueArray(&pool);
+    return written;
+}
+
+/**
+ * Implementation of method to map a bundle into memory.
+ */
+bool openBundle(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat bundleStat;
+    if (fstat(fd, &bundleStat) != 0 || bundleStat.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t)bundleStat.st_size;
+    void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+
+    ByteReader reader = {(const uint8_t*)mapped, size, 0, false, NULL, NULL, 0, false};
+    for (int i = 0; i < 4; i++) {
+        if (readByte(&reader) != (uint8_t)SLOB_MAGIC[i]) {
+            reader.error = true;
+        }
+    }
+    if (readInt(&reader) != SLOC_FORMAT_VERSION) {
+        reader.error = true;
+    }
+    int versionLength = readCount(&reader, 1);
+    if (reader.error || versionLength != (int)strlen(SLO_VERSION)
+        || memcmp(reader.bytes + reader.offset, SLO_VERSION, versionLength) != 0) {
+        reader.error = true;
+    }
+    reader.offset += reader.error ? 0 : versionLength;
+
+    // check every string's in the file and terminated, so interning them needn't
+    int stringCount = readCount(&reader, 5);
+    size_t stringsOffset = reader.offset;
+    for (int i = 0; i < stringCount && !reader.error; i++) {
+        int length = readCount(&reader, 1);
+        if (reader.error || length >= (int)(reader.count - reader.offset) || reader.bytes[reader.offset + length] != '\0') {
+            reader.error = true;
+            break;
+        }
+        reader.offset += length + 1;
+    }
+
+    int moduleCount = readCount(&reader, 12);
+    size_t modulesOffset = reader.offset;
+    for (int i = 0; i < moduleCount && !reader.error; i++) {
+        uint32_t name = readInt(&reader);
+        uint64_t offset = readInt(&reader);
+        uint64_t moduleSize = readInt(&reader);
+        if ((name != NO_STRING && name >= (uint32_t)stringCount) || offset + moduleSize > size) {
+            reader.error = true;
+        }
+    }
+
+    if (reader.error || moduleCount == 0) {
+        munmap(mapped, size);
+        return false;
+    }
+
+    // the mapping is kept until the process exits, as any VM can import from it
+    bundle.bytes = (const uint8_t*)mapped;
+    bundle.size = size;
+    bundle.stringCount = stringCount;
+    bundle.stringsOffset = stringsOffset;
+    bundle.moduleCount = moduleCount;
+    bundle.modulesOffset = modulesOffset;
+    return true;
+}
+
+/**
+ * Method for interning the bundle's strings into this VM, the first time it needs them.
+ *
+ * They're kept in vm->bundleStrings, by their index in the pool.
+ */
+static void internBundleStrings() {
+    if (vm->bundleStrings.count == bundle.stringCount) {
+        return;
+    }
+
+    ByteReader reader = {bundle.bytes, bundle.size, bundle.stringsOffset, false, NULL, NULL, 0, false};
+    for (int i = 0; i < bundle.stringCount; i++) {
+        int length = (int)readInt(&reader);
+        push(OBJ_VAL(copyString((const char*)reader.bytes + reader.offset, length)));
+        writeValueArray(&vm->bundleStrings, peek(0));
+        pop();
+        reader.offset += length + 1;
+    }
+}
+
+/**
+ * Method for finding a module in the bundle, or the script if name is NULL.
+ *
+ * Returns its index in the bundle's modules, or -1 if it isn't there.
+ */
+static int findBundledModule(ObjString* name) {
+    internBundleStrings();
+    ByteReader reader = {bundle.bytes, bundle.size, bundle.modulesOffset, false, NULL, NULL, 0, false};
+    for (int i = 0; i < bundle.moduleCount; i++) {
+        uint32_t index = readInt(&reader);
+        reader.offset += 8;
+        if (index == NO_STRING || name == NULL) {
+            if (index == NO_STRING && name == NULL) {
+                return i;
+            }
+            continue;
+        }
+
+        ObjString* bundled = AS_STRING(vm->bundleStrings.values[index]);
+        if (bundled->length == name->length && memcmp(bundled->chars, name->chars, name->length) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Implementation of method to check for a module in the bundle.
+ */
+bool isBundled(ObjString* module) {
+    return bundle.bytes != NULL && findBundledModule(module) != -1;
+}
+
+/**
+ * Implementation of method to load a function from the bundle.
+ */
+ObjFunction* readBundledFunction(ObjString* module) {
+    int index = bundle.bytes != NULL ? findBundledModule(module) : -1;
+    if (index == -1) {
+        return NULL;
+    }
+
+    ByteReader entry = {bundle.bytes, bundle.size, bundle.modulesOffset + (size_t)index * 12 + 4, false, NULL, NULL, 0, false};
+    uint32_t offset = readInt(&entry);
+    uint32_t size = readInt(&entry);
+    ByteReader reader = {bundle.bytes + offset, size, 0, false, &vm->bundleStrings, NULL, 0, false};
+
+    ObjFunction* function = NULL;
+    ObjString* file = readString(&reader);
+    int globalCount = readCount(&reader, 4);
+    int* slots = (int*)malloc(sizeof(int) * (globalCount + 1));
+    for (int i = 0; i < globalCount && !reader.error && slots != NULL; i++) {
+        ObjString* name = readString(&reader);
+        if (name != NULL && !globalBelongsTo(name, module)) {
+            reader.error = true;
+        } else if (name != NULL) {
+            slots[i] = globalSlot(name);
+        }
+    }
+    // the bundle stays mapped, so its line tables are read from there when they're needed
+    readLineSection(&reader, true);
+    if (!reader.error && slots != NULL) {
+        function = readFunction(&reader, slots, globalCount, file, 0);
+    }
+    if (reader.error || reader.offset != reader.count) {
+        function = NULL;
+    }
+
+    free(slots);
+    return function;
+}
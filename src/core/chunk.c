@@ -3,8 +3,10 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "core/chunk.h"
+#include "core/jit.h"
 #include "core/memory.h"
 #include "core/vm.h"
 
@@ -19,6 +21,18 @@ void initChunk(Chunk* chunk) {
     chunk->lineCount = 0;
     chunk->lineCapacity = 0;
     chunk->lines = NULL;
+    chunk->lineTable = NULL;
+    chunk->lineTableSize = 0;
+    chunk->ownsLineTable = false;
+    chunk->cacheCount = 0;
+    chunk->cacheCapacity = 0;
+    chunk->caches = NULL;
+    chunk->loopCount = 0;
+    chunk->loopCapacity = 0;
+    chunk->loops = NULL;
+    chunk->handlerCount = 0;
+    chunk->handlerCapacity = 0;
+    chunk->handlers = NULL;
     initValueArray(&chunk->constants);
 }
 
@@ -28,6 +42,12 @@ void initChunk(Chunk* chunk) {
 void freeChunk(Chunk* chunk) {
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
     FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+    if (chunk->ownsLineTable) {
+        FREE_ARRAY(uint8_t, (uint8_t*)chunk->lineTable, chunk->lineTableSize);
+    }
+    FREE_ARRAY(InlineCache, chunk->caches, chunk->cacheCapacity);
+    FREE_ARRAY(ExceptionHandler, chunk->handlers, chunk->handlerCapacity);
+    freeJitLoops(chunk);
     freeValueArray(&chunk->constants);
     initChunk(chunk);
 }
@@ -73,30 +93,368 @@ int addConstant(Chunk* chunk, Value value) {
     return chunk->constants.count - 1;
 }
 
-int getLine(Chunk chunk, size_t instruction) {
-    int start = 0;
-    int end = chunk.lineCount;
-    int _instruction = (int) instruction;
-
-    for (;;) {
-        int mid = (start + end) / 2;
-        LineStart* line = &chunk.lines[mid];
-        if (_instruction < line->offset) {
-            end = mid - 1;
-        } else if (mid == chunk.lineCount - 1 || _instruction < chunk.lines[mid + 1].offset) {
-            return line->line;
-        } else {
-        start = mid + 1;
+/**
+ * Implementation of method to add an inline cache to a chunk.
+ *
+ * Returns the index of the new cache which the instruction
+ * using it carries as a two byte operand.
+ */
+int addInlineCache(Chunk* chunk) {
+    if (chunk->cacheCapacity < chunk->cacheCount + 1) {
+        int oldCapacity = chunk->cacheCapacity;
+        chunk->cacheCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->caches = GROW_ARRAY(InlineCache, chunk->caches, oldCapacity, chunk->cacheCapacity);
+    }
+
+    InlineCache* cache = &chunk->caches[chunk->cacheCount];
+    for (int i = 0; i < INLINE_CACHE_WAYS; i++) {
+        cache->entries[i].shape = NULL;
+        cache->entries[i].builtIn = NULL;
+        cache->entries[i].transition = NULL;
+        cache->entries[i].fieldIndex = -1;
+        cache->entries[i].method = NIL_VAL;
+    }
+    cache->next = 0;
+    return chunk->cacheCount++;
+}
+
+/**
+ * Implementation of method to add an exception handler to a chunk.
+ */
+void addExceptionHandler(Chunk* chunk, int start, int end, int handler, int depth) {
+    if (chunk->handlerCapacity < chunk->handlerCount + 1) {
+        int oldCapacity = chunk->handlerCapacity;
+        chunk->handlerCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->handlers = GROW_ARRAY(ExceptionHandler, chunk->handlers, oldCapacity, chunk->handlerCapacity);
+    }
+
+    ExceptionHandler* entry = &chunk->handlers[chunk->handlerCount++];
+    entry->start = start;
+    entry->end = end;
+    entry->handler = handler;
+    entry->depth = depth;
+}
+
+/**
+ * Implementation of method to find the exception handler for an offset.
+ *
+ * Inner blocks are added before the ones around them, so the first match is the innermost.
+ */
+ExceptionHandler* findExceptionHandler(Chunk* chunk, int offset) {
+    for (int i = 0; i < chunk->handlerCount; i++) {
+        ExceptionHandler* entry = &chunk->handlers[i];
+        if (offset >= entry->start && offset < entry->end) {
+            return entry;
         }
     }
+    return NULL;
 }
 
-int getColumn(Chunk chunk, size_t instruction) {
-    int line = getLine(chunk, instruction);
-    for (int i = 0; i < chunk.lineCount; i++) {
-        if (chunk.lines[i].line == line) {
-            return instruction - chunk.lines[i].offset;
+/**
+ * Implementation of method to get the length of an instruction.
+ *
+ * This has to be kept in step with the operands the VM reads for each opcode.
+ */
+int instructionLength(Chunk* chunk, int offset) {
+    switch (chunk->code[offset]) {
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_CAPTURED:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_CONSTANT:
+        case OP_INC_LOCAL:
+        case OP_POP_N:
+        case OP_INTERPOLATE:
+        case OP_NEW_LIST:
+        case OP_NEW_DICT:
+        case OP_LIST_APPEND:
+        case OP_DICT_INSERT:
+        case OP_THROW:
+            return 2;
+        case OP_CONSTANT_LONG:
+        case OP_CLASS:
+        case OP_METHOD:
+        case OP_GET_SUPER:
+        case OP_IMPORT:
+        case OP_DEFINE_GLOBAL:
+        case OP_DEFINE_FINAL_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_LOOP:
+        case OP_LIST:
+        case OP_DICT:
+        case OP_LIST_LOCAL:
+        case OP_DICT_LOCAL:
+        case OP_GET_LOCAL_GET_LOCAL:
+        case OP_LESS_JUMP:
+            return 3;
+        case OP_SUPER_INVOKE:
+        case OP_ENUM:
+        case OP_ITER_NEXT:
+        case OP_LOCALS_ARITH:
+        case OP_LOCAL_CONSTANT_ARITH:
+            return 4;
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_EXCEPT_JUMP:
+        case OP_LOCALS_ARITH_SET:
+        case OP_LOCAL_CONSTANT_ARITH_SET:
+            return 5;
+        case OP_INVOKE:
+            return 6;
+        case OP_FORMAT:
+            return 2 + chunk->code[offset + 1] * FORMAT_SPEC_BYTES;
+        case OP_CLOSURE: {
+            uint16_t constant = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+            ObjFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
+            return 3 + function->upvalueCount * 2;
+        }
+        default:
+            return 1;
+    }
+}
+
+/**
+ * Implementation of method to get the generic form of a quickened instruction.
+ */
+uint8_t genericInstruction(uint8_t instruction) {
+    switch (instruction) {
+        case OP_GET_INDEX_LIST:
+        case OP_GET_INDEX_DICT:
+            return OP_GET_INDEX;
+        case OP_SET_INDEX_LIST:
+        case OP_SET_INDEX_DICT:
+            return OP_SET_INDEX;
+        case OP_HAS_DICT:
+        case OP_HAS_SET:
+            return OP_HAS;
+        default:
+            return instruction;
+    }
+}
+
+// the bytes each of a line table's checkpoints takes up
+#define CHECKPOINT_SIZE 12
+
+/**
+ * Method for writing an unsigned varint, seven bits a byte with the high bit set on all but the last.
+ */
+static int writeVarint(uint8_t* bytes, uint32_t value) {
+    int count = 0;
+    while (value >= 0x80) {
+        bytes[count++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[count++] = (uint8_t)value;
+    return count;
+}
+
+/**
+ * Method for reading a varint, returning false if it runs past the end.
+ */
+static bool readVarint(const uint8_t* bytes, int size, int* position, uint32_t* value) {
+    uint32_t result = 0;
+    for (int shift = 0; *position < size && shift < 35; shift += 7) {
+        uint8_t byte = bytes[(*position)++];
+        result |= (uint32_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Method for writing a little-endian 32-bit int.
+ */
+static void writeUint32(uint8_t* bytes, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = (uint8_t)(value >> (i * 8));
+    }
+}
+
+/**
+ * Method for reading a little-endian 32-bit int.
+ */
+static uint32_t readUint32(const uint8_t* bytes) {
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+/**
+ * Implementation of method for compacting a finished chunk's line runs.
+ */
+void compactLines(Chunk* chunk) {
+    int checkpointCount = chunk->lineCount / LINE_CHECKPOINT_INTERVAL;
+    // the count and each run are at most two five byte varints
+    uint8_t* table = (uint8_t*)malloc(5 + checkpointCount * CHECKPOINT_SIZE + chunk->lineCount * 10);
+    if (table == NULL) {
+        return;
+    }
+
+    int runsStart = writeVarint(table, (uint32_t)checkpointCount);
+    uint8_t* checkpoint = table + runsStart;
+    runsStart += checkpointCount * CHECKPOINT_SIZE;
+    int size = runsStart;
+    int offset = 0;
+    int line = 0;
+    for (int i = 0; i < chunk->lineCount; i++) {
+        LineStart* run = &chunk->lines[i];
+        int32_t lineDelta = run->line - line;
+        size += writeVarint(table + size, (uint32_t)(run->offset - offset));
+        size += writeVarint(table + size, ((uint32_t)lineDelta << 1) ^ (uint32_t)(lineDelta >> 31));
+        offset = run->offset;
+        line = run->line;
+        if ((i + 1) % LINE_CHECKPOINT_INTERVAL == 0) {
+            writeUint32(checkpoint, (uint32_t)(size - runsStart));
+            writeUint32(checkpoint + 4, (uint32_t)offset);
+            writeUint32(checkpoint + 8, (uint32_t)line);
+            checkpoint += CHECKPOINT_SIZE;
         }
     }
-    return -1; // Not found
+
+    uint8_t* compacted = GROW_ARRAY(uint8_t, NULL, 0, size);
+    memcpy(compacted, table, size);
+    free(table);
+    if (chunk->ownsLineTable) {
+        FREE_ARRAY(uint8_t, (uint8_t*)chunk->lineTable, chunk->lineTableSize);
+    }
+    chunk->lineTable = compacted;
+    chunk->lineTableSize = size;
+    chunk->ownsLineTable = true;
+
+    FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+    chunk->lines = NULL;
+    chunk->lineCount = 0;
+    chunk->lineCapacity = 0;
+}
+
+/**
+ * Method for reading where a line table's runs start and how many checkpoints it has.
+ *
+ * Returns false if the checkpoints don't fit in it.
+ */
+static bool readLineTableHeader(const uint8_t* table, int size, int* checkpointCount, int* runsStart) {
+    int position = 0;
+    uint32_t count;
+    if (!readVarint(table, size, &position, &count) || count > (uint32_t)(size - position) / CHECKPOINT_SIZE) {
+        return false;
+    }
+    *checkpointCount = (int)count;
+    *runsStart = position + (int)count * CHECKPOINT_SIZE;
+    return true;
+}
+
+/**
+ * Implementation of method for giving a chunk the line table it was stored with.
+ */
+bool setLineTable(Chunk* chunk, const uint8_t* table, int size, bool borrow) {
+    int checkpointCount, runsStart;
+    if (!readLineTableHeader(table, size, &checkpointCount, &runsStart)) {
+        return false;
+    }
+    if (borrow) {
+        chunk->lineTable = table;
+    } else {
+        uint8_t* copy = GROW_ARRAY(uint8_t, NULL, 0, size);
+        memcpy(copy, table, size);
+        chunk->lineTable = copy;
+    }
+    chunk->lineTableSize = size;
+    chunk->ownsLineTable = !borrow;
+    return true;
+}
+
+/**
+ * Method for finding the run an instruction's in, from the line table or the runs still being written.
+ *
+ * Returns false if there's no line info for it.
+ */
+static bool findRun(const Chunk* chunk, int instruction, int* runOffset, int* runLine) {
+    if (chunk->lineTable == NULL) {
+        // the last run starting at or before the instruction
+        int low = 0;
+        int high = chunk->lineCount - 1;
+        if (high < 0) {
+            return false;
+        }
+        while (low < high) {
+            int mid = (low + high + 1) / 2;
+            if (chunk->lines[mid].offset <= instruction) {
+                low = mid;
+            } else {
+                high = mid - 1;
+            }
+        }
+        *runOffset = chunk->lines[low].offset;
+        *runLine = chunk->lines[low].line;
+        return true;
+    }
+
+    const uint8_t* table = chunk->lineTable;
+    int checkpointCount, runsStart;
+    if (!readLineTableHeader(table, chunk->lineTableSize, &checkpointCount, &runsStart)) {
+        return false;
+    }
+
+    // start from the last checkpoint at or before the instruction, or the first run if there's none
+    const uint8_t* checkpoints = table + runsStart - checkpointCount * CHECKPOINT_SIZE;
+    int low = -1;
+    int high = checkpointCount - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if ((int)readUint32(checkpoints + mid * CHECKPOINT_SIZE + 4) <= instruction) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    int position = runsStart;
+    int offset = 0;
+    int line = 0;
+    bool found = false;
+    if (low >= 0) {
+        const uint8_t* checkpoint = checkpoints + low * CHECKPOINT_SIZE;
+        position += (int)readUint32(checkpoint);
+        offset = (int)readUint32(checkpoint + 4);
+        line = (int)readUint32(checkpoint + 8);
+        found = true;
+    }
+
+    for (int i = 0; i < LINE_CHECKPOINT_INTERVAL; i++) {
+        uint32_t offsetDelta, lineDelta;
+        if (!readVarint(table, chunk->lineTableSize, &position, &offsetDelta)
+            || !readVarint(table, chunk->lineTableSize, &position, &lineDelta)
+            || (found && offset + (int)offsetDelta > instruction)) {
+            break;
+        }
+        offset += (int)offsetDelta;
+        line += (int)((lineDelta >> 1) ^ -(lineDelta & 1));
+        found = true;
+    }
+    *runOffset = offset;
+    *runLine = line;
+    return found;
+}
+
+/**
+ * Implementation of method for getting the line of a given instruction.
+ */
+int getLine(Chunk chunk, size_t instruction) {
+    int offset, line;
+    return findRun(&chunk, (int)instruction, &offset, &line) ? line : -1;
+}
+
+/**
+ * Implementation of method for getting the column of a given instruction.
+ */
+int getColumn(Chunk chunk, size_t instruction) {
+    int offset, line;
+    return findRun(&chunk, (int)instruction, &offset, &line) ? (int)instruction - offset : -1;
 }
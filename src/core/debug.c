@@ -7,6 +7,7 @@
 #include "core/debug.h"
 #include "core/object.h"
 #include "core/value.h"
+#include "core/vm.h"
 
 /**
  * Implementation of method to disassemble a chunk.
@@ -21,6 +22,10 @@ void disassembleChunk(Chunk* chunk, const char* name) {
     for (int offset = 0; offset < chunk->count;) {
         offset = disassembleInstruction(chunk, offset);
     }
+    for (int i = 0; i < chunk->handlerCount; i++) {
+        ExceptionHandler* entry = &chunk->handlers[i];
+        printf("handler [%d, %d) -> %d depth %d\n", entry->start, entry->end, entry->handler, entry->depth);
+    }
 }
 
 /**
@@ -42,16 +47,96 @@ static int byteInstruction(const char* name, Chunk* chunk, int offset) {
     return offset + 2;
 }
 
+/**
+ * Method for printing an instruction with two byte operands.
+ */
+static int twoByteInstruction(const char* name, Chunk* chunk, int offset) {
+    printf("%-16s %4d %4d\n", name, chunk->code[offset + 1], chunk->code[offset + 2]);
+    return offset + 3;
+}
+
+/**
+ * Method for printing an instruction with a two byte count operand.
+ */
+static int countInstruction(const char* name, Chunk* chunk, int offset) {
+    uint16_t count = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    printf("%-16s %4d\n", name, count);
+    return offset + 3;
+}
+
+/**
+ * Method for printing a three address arithmetic instruction.
+ *
+ * These carry the arithmetic opcode, the slot of the left operand, the slot
+ * or constant of the right one and, for those that set one, the slot the
+ * result goes in.
+ */
+static int arithInstruction(const char* name, Chunk* chunk, int offset, bool constant, bool set) {
+    uint8_t* code = chunk->code + offset;
+    const char* op = code[1] == OP_ADD ? "+" : code[1] == OP_SUBTRACT ? "-"
+        : code[1] == OP_MULTIPLY ? "*" : code[1] == OP_DIVIDE ? "/" : "%";
+    if (set) {
+        printf("%-16s %4d = ", name, code[4]);
+    } else {
+        printf("%-16s ", name);
+    }
+    printf("%d %s ", code[2], op);
+    if (constant) {
+        printf("'");
+        printValue(chunk->constants.values[code[3]]);
+        printf("'\n");
+    } else {
+        printf("%d\n", code[3]);
+    }
+    return offset + (set ? 5 : 4);
+}
+
 /**
  * Method for printing a jump instruction.
  */
 static int jumpInstruction(const char* name, int sign, Chunk* chunk, int offset) {
     uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
-    jump |= chunk->code[offset] + 2;
-    printf("%-16s %4d -> %d\n", name, offset, offset + 3 * sign * jump);
+    jump |= chunk->code[offset + 2];
+    printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
     return offset + 3;
 }
 
+/**
+ * Method for printing an OP_EXCEPT_JUMP instruction.
+ * This carries the mask of the exception types caught followed by the jump past the clause.
+ */
+static int exceptJumpInstruction(const char* name, Chunk* chunk, int offset) {
+    uint16_t mask = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    uint16_t jump = (uint16_t)((chunk->code[offset + 3] << 8) | chunk->code[offset + 4]);
+    printf("%-16s %#06x %4d -> %d\n", name, mask, offset, offset + 5 + jump);
+    return offset + 5;
+}
+
+/**
+ * Method for printing an OP_FORMAT instruction.
+ * This carries the number of parts followed by the flags, width and precision of each.
+ */
+static int formatInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t count = chunk->code[offset + 1];
+    printf("%-16s %4d", name, count);
+    for (int i = 0; i < count; i++) {
+        const uint8_t* spec = &chunk->code[offset + 2 + i * FORMAT_SPEC_BYTES];
+        printf(" [%02x %d %d]", spec[0], spec[1], spec[2]);
+    }
+    printf("\n");
+    return offset + 2 + count * FORMAT_SPEC_BYTES;
+}
+
+/**
+ * Method for printing an OP_ITER_NEXT instruction.
+ * This carries the iterable's slot followed by the jump out of the loop.
+ */
+static int iterInstruction(const char* name, Chunk* chunk, int offset) {
+    uint16_t jump = (uint16_t)((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+    printf("%-16s %4d -> %d\n", name, chunk->code[offset + 1], offset + 4 + jump);
+    return offset + 4;
+}
+
 /**
  * Method for printing a constant instruction.
  *
@@ -65,16 +150,59 @@ static int constantInstruction(const char* name, Chunk* chunk, int offset) {
     return offset + 2;
 }
 
+/**
+ * Method for printing an instruction whose operand is a two byte constant index.
+ */
+static int longConstantInstruction(const char* name, Chunk* chunk, int offset) {
+    uint16_t constant = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    printf("%-16s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 3;
+}
+
+/**
+ * Method for printing a global instruction.
+ * The operand is a two byte slot into the VM's globals.
+ */
+static int globalInstruction(const char* name, Chunk* chunk, int offset) {
+    uint16_t slot = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    printf("%-16s %4d '", name, slot);
+    if (slot < vm->globalNames.count) {
+        printValue(vm->globalNames.values[slot]);
+    }
+    printf("'\n");
+    return offset + 3;
+}
+
 /**
  * Method for printing an invoke instruction.
  */
 static int invokeInstruction(const char* name, Chunk* chunk, int offset) {
-    uint8_t constant = chunk->code[offset + 1];
-    uint8_t argCount = chunk->code[offset + 2];
+    uint16_t constant = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    uint8_t argCount = chunk->code[offset + 3];
     printf("%-16s (%d args) %4d '", name, argCount, constant);
     printValue(chunk->constants.values[constant]);
     printf("'\n");
-    return offset + 3;
+    return offset + 4;
+}
+
+/**
+ * Method for printing an instruction that uses an inline cache.
+ * These carry the two byte constant for the name followed by a two byte cache index.
+ */
+static int cachedInstruction(const char* name, Chunk* chunk, int offset, bool hasArgs) {
+    uint16_t constant = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    int next = offset + 3;
+    if (hasArgs) {
+        printf("%-16s (%d args) %4d '", name, chunk->code[next++], constant);
+    } else {
+        printf("%-16s %4d '", name, constant);
+    }
+    printValue(chunk->constants.values[constant]);
+    uint16_t cache = (uint16_t)((chunk->code[next] << 8) | chunk->code[next + 1]);
+    printf("' ic %d\n", cache);
+    return next + 2;
 }
 
 /**
@@ -96,6 +224,8 @@ int disassembleInstruction(Chunk* chunk, int offset) {
     switch (instruction) {
         case OP_CONSTANT:
             return constantInstruction("OP_CONSTANT", chunk, offset);
+        case OP_CONSTANT_LONG:
+            return longConstantInstruction("OP_CONSTANT_LONG", chunk, offset);
         case OP_NIL:
             return simpleInstruction("OP_NIL", offset);
         case OP_TRUE:
@@ -109,17 +239,19 @@ int disassembleInstruction(Chunk* chunk, int offset) {
         case OP_SET_LOCAL:
             return byteInstruction("OP_SET_LOCAL", chunk, offset);
         case OP_GET_GLOBAL:
-            return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+            return globalInstruction("OP_GET_GLOBAL", chunk, offset);
         case OP_SET_GLOBAL:
-            return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+            return globalInstruction("OP_SET_GLOBAL", chunk, offset);
         case OP_GET_UPVALUE:
             return byteInstruction("OP_GET_UPVALUE", chunk, offset);
         case OP_SET_UPVALUE:
             return byteInstruction("OP_SET_UPVALUE", chunk, offset);
+        case OP_GET_CAPTURED:
+            return byteInstruction("OP_GET_CAPTURED", chunk, offset);
         case OP_DEFINE_GLOBAL:
-            return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+            return globalInstruction("OP_DEFINE_GLOBAL", chunk, offset);
         case OP_DEFINE_FINAL_GLOBAL:
-            return constantInstruction("OP_DEFINE_FINAL_GLOBAL", chunk, offset);
+            return globalInstruction("OP_DEFINE_FINAL_GLOBAL", chunk, offset);
         case OP_EQUAL:
             return simpleInstruction("OP_EQUAL", offset);
         case OP_NOT_EQUAL:
@@ -162,30 +294,33 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return jumpInstruction("OP_LOOP", -1, chunk, offset);
         case OP_CALL:
             return byteInstruction("OP_CALL", chunk, offset);
+        case OP_TAIL_CALL:
+            return byteInstruction("OP_TAIL_CALL", chunk, offset);
         case OP_GET_PROPERTY:
-            return constantInstruction("OP_GET_PROPERTY", chunk, offset);
+            return cachedInstruction("OP_GET_PROPERTY", chunk, offset, false);
         case OP_SET_PROPERTY:
-            return constantInstruction("OP_SET_PROPERTY", chunk, offset);
+            return cachedInstruction("OP_SET_PROPERTY", chunk, offset, false);
         case OP_GET_SUPER: {
-            return constantInstruction("OP_GET_SUPER", chunk, offset);
+            return longConstantInstruction("OP_GET_SUPER", chunk, offset);
         }
         case OP_CLOSURE: {
-            offset++;
-            uint8_t constant = chunk->code[offset++];
+            uint16_t constant = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+            offset += 3;
             printf("%-16s %4d ", "OP_CLOSURE", constant);
             printValue(chunk->constants.values[constant]);
             printf("\n");
 
             ObjFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
             for (int j = 0; j < function->upvalueCount; j++) {
-                int isLocal = chunk->code[offset++];
+                int flags = chunk->code[offset++];
                 int index = chunk->code[offset++];
-                printf("%04d      |                     %s %d\n", offset - 2, isLocal ? "local" : "upvalue", index);
+                printf("%04d      |                     %s %s %d\n", offset - 2,
+                    flags & CAPTURE_FLAT ? "flat" : "shared", flags & CAPTURE_LOCAL ? "local" : "upvalue", index);
             }
             return offset;
         }
         case OP_INVOKE: {
-            return invokeInstruction("OP_INVOKE", chunk, offset);
+            return cachedInstruction("OP_INVOKE", chunk, offset, true);
         }
         case OP_SUPER_INVOKE: {
             return invokeInstruction("OP_SUPER_INSTRUCTION", chunk, offset);
@@ -194,17 +329,25 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return simpleInstruction("OP_CLOSE_UPVALUE", offset);
         }
         case OP_CLASS: {
-            return constantInstruction("OP_CLASS", chunk, offset);
+            return longConstantInstruction("OP_CLASS", chunk, offset);
         }
         case OP_INHERIT: {
             return simpleInstruction("OP_INHERIT", offset);
         }
         case OP_METHOD: {
-            return constantInstruction("OP_METHOD", chunk, offset);
+            return longConstantInstruction("OP_METHOD", chunk, offset);
         }
         case OP_LIST: {
-            return simpleInstruction("OP_LIST", offset);
+            return countInstruction("OP_LIST", chunk, offset);
         }
+        case OP_LIST_LOCAL:
+            return countInstruction("OP_LIST_LOCAL", chunk, offset);
+        case OP_DICT_LOCAL:
+            return countInstruction("OP_DICT_LOCAL", chunk, offset);
+        case OP_POP_LOCAL:
+            return simpleInstruction("OP_POP_LOCAL", offset);
+        case OP_RETURN_LOCALS:
+            return simpleInstruction("OP_RETURN_LOCALS", offset);
         case OP_GET_INDEX: {
             return simpleInstruction("OP_GET_INDEX", offset);
         }
@@ -224,19 +367,20 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return simpleInstruction("OP_LEN", offset);
         }
         case OP_DICT: {
-            return simpleInstruction("OP_DICT", offset);
+            return countInstruction("OP_DICT", chunk, offset);
         }
         case OP_ENUM: {
-            return simpleInstruction("OP_ENUM", offset);
+            uint16_t constant = (uint16_t)((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+            printf("%-16s (%d members) %4d '", "OP_ENUM", chunk->code[offset + 1], constant);
+            printValue(chunk->constants.values[constant]);
+            printf("'\n");
+            return offset + 4;
         }
         case OP_IMPORT: {
-            return constantInstruction("OP_IMPORT", chunk, offset);
-        }
-        case OP_IMPORT_AS: {
-            return constantInstruction("OP_IMPORT_AS", chunk, offset);
+            return longConstantInstruction("OP_IMPORT", chunk, offset);
         }
         case OP_INTERPOLATE: {
-            return simpleInstruction("OP_INTERPOLATE", offset);
+            return byteInstruction("OP_INTERPOLATE", chunk, offset);
         }
         case OP_ASSERT: {
             return simpleInstruction("OP_ASSERT", offset);
@@ -244,9 +388,148 @@ int disassembleInstruction(Chunk* chunk, int offset) {
         case OP_RETURN: {
             return simpleInstruction("OP_RETURN", offset);
         }
+        case OP_ITER_NEXT:
+            return iterInstruction("OP_ITER_NEXT", chunk, offset);
+        case OP_NEW_LIST:
+            return byteInstruction("OP_NEW_LIST", chunk, offset);
+        case OP_NEW_DICT:
+            return byteInstruction("OP_NEW_DICT", chunk, offset);
+        case OP_LIST_APPEND:
+            return byteInstruction("OP_LIST_APPEND", chunk, offset);
+        case OP_DICT_INSERT:
+            return byteInstruction("OP_DICT_INSERT", chunk, offset);
+        case OP_THROW:
+            return byteInstruction("OP_THROW", chunk, offset);
+        case OP_EXCEPT_JUMP:
+            return exceptJumpInstruction("OP_EXCEPT_JUMP", chunk, offset);
+        case OP_FORMAT:
+            return formatInstruction("OP_FORMAT", chunk, offset);
+        case OP_INC_LOCAL:
+            return byteInstruction("OP_INC_LOCAL", chunk, offset);
+        case OP_GET_LOCAL_GET_LOCAL:
+            return twoByteInstruction("OP_GET_LOCAL_GET_LOCAL", chunk, offset);
+        case OP_LOCALS_ARITH:
+            return arithInstruction("OP_LOCALS_ARITH", chunk, offset, false, false);
+        case OP_LOCAL_CONSTANT_ARITH:
+            return arithInstruction("OP_LOCAL_CONSTANT_ARITH", chunk, offset, true, false);
+        case OP_LOCALS_ARITH_SET:
+            return arithInstruction("OP_LOCALS_ARITH_SET", chunk, offset, false, true);
+        case OP_LOCAL_CONSTANT_ARITH_SET:
+            return arithInstruction("OP_LOCAL_CONSTANT_ARITH_SET", chunk, offset, true, true);
+        case OP_LESS_JUMP:
+            return jumpInstruction("OP_LESS_JUMP", 1, chunk, offset);
+        case OP_POP_N:
+            return byteInstruction("OP_POP_N", chunk, offset);
+        case OP_GET_INDEX_LIST:
+            return simpleInstruction("OP_GET_INDEX_LIST", offset);
+        case OP_GET_INDEX_DICT:
+            return simpleInstruction("OP_GET_INDEX_DICT", offset);
+        case OP_SET_INDEX_LIST:
+            return simpleInstruction("OP_SET_INDEX_LIST", offset);
+        case OP_SET_INDEX_DICT:
+            return simpleInstruction("OP_SET_INDEX_DICT", offset);
+        case OP_HAS_DICT:
+            return simpleInstruction("OP_HAS_DICT", offset);
+        case OP_HAS_SET:
+            return simpleInstruction("OP_HAS_SET", offset);
         default: {
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
         }
     }
 }
+
+/**
+ * Implementation of method for getting an opcode's name.
+ */
+const char* opcodeName(uint8_t instruction) {
+    static const char* names[UINT8_COUNT] = {
+        [OP_CONSTANT] = "OP_CONSTANT",
+        [OP_NIL] = "OP_NIL",
+        [OP_TRUE] = "OP_TRUE",
+        [OP_FALSE] = "OP_FALSE",
+        [OP_POP] = "OP_POP",
+        [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+        [OP_DEFINE_FINAL_GLOBAL] = "OP_DEFINE_FINAL_GLOBAL",
+        [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+        [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+        [OP_GET_LOCAL] = "OP_GET_LOCAL",
+        [OP_SET_LOCAL] = "OP_SET_LOCAL",
+        [OP_GET_UPVALUE] = "OP_GET_UPVALUE",
+        [OP_SET_UPVALUE] = "OP_SET_UPVALUE",
+        [OP_CLOSE_UPVALUE] = "OP_CLOSE_UPVALUE",
+        [OP_EQUAL] = "OP_EQUAL",
+        [OP_NOT_EQUAL] = "OP_NOT_EQUAL",
+        [OP_GREATER] = "OP_GREATER",
+        [OP_GREATER_EQUAL] = "OP_GREATER_EQUAL",
+        [OP_LESS] = "OP_LESS",
+        [OP_LESS_EQUAL] = "OP_LESS_EQUAL",
+        [OP_NEGATE] = "OP_NEGATE",
+        [OP_ADD] = "OP_ADD",
+        [OP_SUBTRACT] = "OP_SUBTRACT",
+        [OP_MULTIPLY] = "OP_MULTIPLY",
+        [OP_DIVIDE] = "OP_DIVIDE",
+        [OP_MODULO] = "OP_MODULO",
+        [OP_POW] = "OP_POW",
+        [OP_NOT] = "OP_NOT",
+        [OP_JUMP] = "OP_JUMP",
+        [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+        [OP_JUMP_IF_TRUE] = "OP_JUMP_IF_TRUE",
+        [OP_LOOP] = "OP_LOOP",
+        [OP_CALL] = "OP_CALL",
+        [OP_TAIL_CALL] = "OP_TAIL_CALL",
+        [OP_INVOKE] = "OP_INVOKE",
+        [OP_SUPER_INVOKE] = "OP_SUPER_INVOKE",
+        [OP_CLOSURE] = "OP_CLOSURE",
+        [OP_RETURN] = "OP_RETURN",
+        [OP_CLASS] = "OP_CLASS",
+        [OP_METHOD] = "OP_METHOD",
+        [OP_INHERIT] = "OP_INHERIT",
+        [OP_GET_SUPER] = "OP_GET_SUPER",
+        [OP_SET_PROPERTY] = "OP_SET_PROPERTY",
+        [OP_GET_PROPERTY] = "OP_GET_PROPERTY",
+        [OP_DUP] = "OP_DUP",
+        [OP_DUP2] = "OP_DUP2",
+        [OP_LIST] = "OP_LIST",
+        [OP_GET_INDEX] = "OP_GET_INDEX",
+        [OP_SET_INDEX] = "OP_SET_INDEX",
+        [OP_SLICE] = "OP_SLICE",
+        [OP_HAS] = "OP_HAS",
+        [OP_HAS_NOT] = "OP_HAS_NOT",
+        [OP_LEN] = "OP_LEN",
+        [OP_DICT] = "OP_DICT",
+        [OP_ENUM] = "OP_ENUM",
+        [OP_IMPORT] = "OP_IMPORT",
+        [OP_INTERPOLATE] = "OP_INTERPOLATE",
+        [OP_ASSERT] = "OP_ASSERT",
+        [OP_ITER_NEXT] = "OP_ITER_NEXT",
+        [OP_NEW_LIST] = "OP_NEW_LIST",
+        [OP_NEW_DICT] = "OP_NEW_DICT",
+        [OP_LIST_APPEND] = "OP_LIST_APPEND",
+        [OP_DICT_INSERT] = "OP_DICT_INSERT",
+        [OP_THROW] = "OP_THROW",
+        [OP_EXCEPT_JUMP] = "OP_EXCEPT_JUMP",
+        [OP_FORMAT] = "OP_FORMAT",
+        [OP_GET_CAPTURED] = "OP_GET_CAPTURED",
+        [OP_CONSTANT_LONG] = "OP_CONSTANT_LONG",
+        [OP_LIST_LOCAL] = "OP_LIST_LOCAL",
+        [OP_DICT_LOCAL] = "OP_DICT_LOCAL",
+        [OP_POP_LOCAL] = "OP_POP_LOCAL",
+        [OP_RETURN_LOCALS] = "OP_RETURN_LOCALS",
+        [OP_INC_LOCAL] = "OP_INC_LOCAL",
+        [OP_GET_LOCAL_GET_LOCAL] = "OP_GET_LOCAL_GET_LOCAL",
+        [OP_LESS_JUMP] = "OP_LESS_JUMP",
+        [OP_POP_N] = "OP_POP_N",
+        [OP_LOCALS_ARITH] = "OP_LOCALS_ARITH",
+        [OP_LOCAL_CONSTANT_ARITH] = "OP_LOCAL_CONSTANT_ARITH",
+        [OP_LOCALS_ARITH_SET] = "OP_LOCALS_ARITH_SET",
+        [OP_LOCAL_CONSTANT_ARITH_SET] = "OP_LOCAL_CONSTANT_ARITH_SET",
+        [OP_GET_INDEX_LIST] = "OP_GET_INDEX_LIST",
+        [OP_GET_INDEX_DICT] = "OP_GET_INDEX_DICT",
+        [OP_SET_INDEX_LIST] = "OP_SET_INDEX_LIST",
+        [OP_SET_INDEX_DICT] = "OP_SET_INDEX_DICT",
+        [OP_HAS_DICT] = "OP_HAS_DICT",
+        [OP_HAS_SET] = "OP_HAS_SET",
+    };
+    return names[instruction];
+}
@@ -0,0 +1,140 @@
+/**
+ * @file embed.c
+ * @brief The interface for running slo from inside a C program.
+ */
+
+#include <string.h>
+
+#include "compiler/compiler.h"
+#include "core/embed.h"
+#include "core/extension.h"
+
+/**
+ * Implementation of method for compiling a script without running it.
+ */
+bool sloCompile(const char* source, const char* file, Value* script) {
+    ObjFunction* function = compile(source, file);
+    if (function == NULL) {
+        return false;
+    }
+    push(OBJ_VAL(function));
+    ObjClosure* closure = newClosure(function);
+    pop();
+    *script = OBJ_VAL(closure);
+    pinValue(*script);
+    return true;
+}
+
+/**
+ * Implementation of method for running a compiled script's top level.
+ */
+InterpretResult sloRun(Value script) {
+    Value result;
+    push(script);
+    return callOnStack(0, &result) ? INTERPRET_OK : INTERPRET_RUNTIME_ERROR;
+}
+
+/**
+ * Implementation of method for looking up a global function by name.
+ */
+bool sloFunction(const char* name, Value* function) {
+    Value value;
+    if (!getGlobal(copyString(name, (int)strlen(name)), &value)
+            || !(IS_CLOSURE(value) || IS_NATIVE(value) || IS_CLASS(value) || IS_BOUND_METHOD(value))) {
+        return false;
+    }
+    *function = value;
+    pinValue(value);
+    return true;
+}
+
+/**
+ * Implementation of method for calling a function with the values last pushed as its arguments.
+ *
+ * The function goes below the arguments, where a call expects its callee.
+ */
+bool sloCall(Value function, int argCount, Value* result) {
+    push(NIL_VAL);
+    Value* callee = vm->stackTop - 1 - argCount;
+    memmove(callee + 1, callee, sizeof(Value) * argCount);
+    *callee = function;
+    return callOnStack(argCount, result);
+}
+
+/**
+ * Implementation of method for keeping a value alive while it's only referenced from C.
+ */
+void sloHold(Value value) {
+    pinValue(value);
+}
+
+/**
+ * Implementation of method for releasing a held value.
+ */
+void sloRelease(Value value) {
+    unpinValue(value);
+}
+
+/**
+ * Implementation of method for pushing an argument.
+ */
+void sloPush(Value value) {
+    push(value);
+}
+
+/**
+ * Implementation of method for pushing a number argument.
+ */
+void sloPushNumber(double number) {
+    push(NUMBER_VAL(number));
+}
+
+/**
+ * Implementation of method for pushing a bool argument.
+ */
+void sloPushBool(bool boolean) {
+    push(BOOL_VAL(boolean));
+}
+
+/**
+ * Implementation of method for pushing a nil argument.
+ */
+void sloPushNil() {
+    push(NIL_VAL);
+}
+
+/**
+ * Implementation of method for pushing a string argument.
+ */
+void sloPushString(const char* chars) {
+    push(OBJ_VAL(copyString(chars, (int)strlen(chars))));
+}
+
+/**
+ * Implementation of method for reading a number.
+ */
+bool sloToNumber(Value value, double* number) {
+    if (!IS_NUMBER(value)) {
+        return false;
+    }
+    *number = AS_NUMBER(value);
+    return true;
+}
+
+/**
+ * Implementation of method for reading a bool.
+ */
+bool sloToBool(Value value, bool* boolean) {
+    if (!IS_BOOL(value)) {
+        return false;
+    }
+    *boolean = AS_BOOL(value);
+    return true;
+}
+
+/**
+ * Implementation of method for reading a string.
+ */
+const char* sloToString(Value value) {
+    return IS_STRING(value) ? AS_CSTRING(value) : NULL;
+}
@@ -9,8 +9,12 @@
 #include <math.h>
 
 #include "core/errors.h"
+#include "core/vm.h"
 
-static const char* errorTypeToString(enum ErrorType type) {
+/**
+ * Implementation of method for getting the name of an error type.
+ */
+const char* errorTypeToString(enum ErrorType type) {
     switch (type) {
         case ERROR_RUNTIME:
             return "RuntimeException";
@@ -37,6 +41,19 @@ static const char* errorTypeToString(enum ErrorType type) {
     }
 }
 
+/**
+ * Implementation of method for getting the error type with the given name.
+ */
+int errorTypeFromName(const char* name, int length) {
+    for (int type = ERROR_RUNTIME; type <= ERROR_ASSERTION; type++) {
+        const char* typeName = errorTypeToString((enum ErrorType)type);
+        if ((int)strlen(typeName) == length && memcmp(typeName, name, length) == 0) {
+            return type;
+        }
+    }
+    return -1;
+}
+
 /**
  * @brief Reports an error to the standard error output.
  *
@@ -46,10 +63,12 @@ static const char* errorTypeToString(enum ErrorType type) {
  * @param exc Pointer to the Exception to report.
  */
 void reportError(Exception* exc) {
-    if (exc == NULL) {
+    if (exc == NULL || (vm != NULL && vm->quietErrors)) {
         return;
     }
 
+    // stdout may be buffered, so anything printed before the error comes out first
+    fflush(stdout);
     fprintf(stderr, "[%s] %s at %s:%d:%d\n", errorTypeToString(exc->type), exc->message, exc->file, exc->line, exc->column);
 
     // Print the actual source line if possible
@@ -0,0 +1,194 @@
+/**
+ * @file flusher.c
+ *
+ * A flusher double buffers: the program fills one buffer while the thread
+ * writes the other, so it only waits on the disk when it's filled a whole
+ * buffer faster than the last one could be written.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "core/flusher.h"
+
+/**
+ * @struct Flusher
+ */
+struct Flusher {
+    int fd;
+    size_t capacity;
+    // the buffer being filled
+    char* filling;
+    size_t length;
+    // the buffer being written, which pending says has something in it
+    char* writing;
+    size_t writingLength;
+    bool pending;
+    bool stopping;
+    bool failed;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_t thread;
+};
+
+/**
+ * Method for writing a whole buffer to a descriptor, however many writes it takes.
+ */
+static bool writeAll(int fd, const char* chars, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, chars, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        chars += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+/**
+ * Method for the flusher's thread, which writes each buffer it's handed until it's stopped.
+ */
+static void* runFlusher(void* arg) {
+    Flusher* flusher = (Flusher*)arg;
+
+    pthread_mutex_lock(&flusher->lock);
+    for (;;) {
+        while (!flusher->pending && !flusher->stopping) {
+            pthread_cond_wait(&flusher->changed, &flusher->lock);
+        }
+        if (!flusher->pending) {
+            break;
+        }
+
+        // the program only touches the buffer being written to hand over the next
+        pthread_mutex_unlock(&flusher->lock);
+        bool written = writeAll(flusher->fd, flusher->writing, flusher->writingLength);
+        pthread_mutex_lock(&flusher->lock);
+
+        if (!written) {
+            flusher->failed = true;
+        }
+        flusher->pending = false;
+        pthread_cond_broadcast(&flusher->changed);
+    }
+    pthread_mutex_unlock(&flusher->lock);
+    return NULL;
+}
+
+/**
+ * Implementation of method for starting a flusher.
+ */
+Flusher* startFlusher(int fd, size_t capacity) {
+    Flusher* flusher = (Flusher*)calloc(1, sizeof(Flusher));
+    if (flusher == NULL) {
+        return NULL;
+    }
+    flusher->fd = fd;
+    flusher->capacity = capacity;
+    flusher->filling = (char*)malloc(capacity);
+    flusher->writing = (char*)malloc(capacity);
+    if (flusher->filling == NULL || flusher->writing == NULL) {
+        free(flusher->filling);
+        free(flusher->writing);
+        free(flusher);
+        return NULL;
+    }
+
+    pthread_mutex_init(&flusher->lock, NULL);
+    pthread_cond_init(&flusher->changed, NULL);
+    if (pthread_create(&flusher->thread, NULL, runFlusher, flusher) != 0) {
+        pthread_mutex_destroy(&flusher->lock);
+        pthread_cond_destroy(&flusher->changed);
+        free(flusher->filling);
+        free(flusher->writing);
+        free(flusher);
+        return NULL;
+    }
+    return flusher;
+}
+
+/**
+ * Method for handing the buffer being filled to the thread, once it's finished the last one.
+ */
+static bool handOver(Flusher* flusher) {
+    pthread_mutex_lock(&flusher->lock);
+    while (flusher->pending) {
+        pthread_cond_wait(&flusher->changed, &flusher->lock);
+    }
+    if (flusher->length > 0) {
+        char* filled = flusher->filling;
+        flusher->filling = flusher->writing;
+        flusher->writing = filled;
+        flusher->writingLength = flusher->length;
+        flusher->length = 0;
+        flusher->pending = true;
+        pthread_cond_broadcast(&flusher->changed);
+    }
+    bool failed = flusher->failed;
+    pthread_mutex_unlock(&flusher->lock);
+    return !failed;
+}
+
+/**
+ * Implementation of method for writing through a flusher.
+ */
+bool flusherWrite(Flusher* flusher, const char* chars, size_t length) {
+    while (length > 0) {
+        size_t room = flusher->capacity - flusher->length;
+        size_t count = length < room ? length : room;
+        memcpy(flusher->filling + flusher->length, chars, count);
+        flusher->length += count;
+        chars += count;
+        length -= count;
+        if (flusher->length == flusher->capacity && !handOver(flusher)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Implementation of method for waiting on a flusher.
+ */
+bool syncFlusher(Flusher* flusher) {
+    if (!handOver(flusher)) {
+        return false;
+    }
+    pthread_mutex_lock(&flusher->lock);
+    while (flusher->pending) {
+        pthread_cond_wait(&flusher->changed, &flusher->lock);
+    }
+    bool failed = flusher->failed;
+    pthread_mutex_unlock(&flusher->lock);
+    return !failed;
+}
+
+/**
+ * Implementation of method for stopping a flusher.
+ */
+bool stopFlusher(Flusher* flusher) {
+    bool synced = syncFlusher(flusher);
+
+    pthread_mutex_lock(&flusher->lock);
+    flusher->stopping = true;
+    pthread_cond_broadcast(&flusher->changed);
+    pthread_mutex_unlock(&flusher->lock);
+    pthread_join(flusher->thread, NULL);
+
+    pthread_mutex_destroy(&flusher->lock);
+    pthread_cond_destroy(&flusher->changed);
+    free(flusher->filling);
+    free(flusher->writing);
+    free(flusher);
+    return synced;
+}
@@ -2,50 +2,921 @@
  * @file gc.c
  */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "core/common.h"
 #include "compiler/compiler.h"
 #include "core/gc.h"
 #include "core/memory.h"
+#include "core/probes.h"
 #include "core/table.h"
 #include "core/value.h"
 #include "core/vm.h"
+#include "std/async.h"
 
 #ifdef DEBUG_LOG_GC
 #include <stdio.h>
 #include "core/debug.h"
+#include "core/extension.h"
 #endif
 
-#define GC_HEAP_GROW_FACTOR 2
+// a marker with at least this many gray objects shares half of them with idle markers
+#define MARK_SHARE_MIN 64
+
+struct MarkWork;
+
+/**
+ * @struct Marker
+ *
+ * One of the threads marking in a parallel collection. Its own gray objects
+ * are in stack, which only it touches, and it moves some of them to shared
+ * for the others to steal when they run out.
+ */
+typedef struct Marker {
+    Obj** stack;
+    int count;
+    int capacity;
+
+    pthread_mutex_t lock;
+    Obj** shared;
+    int sharedCount;
+    int sharedCapacity;
+
+    struct MarkWork* work;
+    VM* vm;
+    pthread_t thread;
+} Marker;
+
+/**
+ * @struct MarkWork
+ *
+ * The markers of a parallel collection. Marking is finished once every
+ * running marker is idle, as they only go idle with nothing left to share.
+ */
+typedef struct MarkWork {
+    Marker* markers;
+    int count;
+    int running;
+    int idle;
+} MarkWork;
+
+/**
+ * @struct Sweeper
+ *
+ * A major collection's sweep running on its own thread. The objects it's
+ * given are taken off vm->objects, and the survivors go back on once it's finished.
+ */
+typedef struct Sweeper {
+    pthread_t thread;
+    Obj* objects;
+    bool markValue;
+    Obj* survivors;
+    Obj* survivorsTail;
+    FreedMemory freed;
+    size_t objectsFreed;
+    // the heap when marking finished, what the program may grow to before it waits for the sweep
+    size_t bytesMarked;
+    size_t heapLimit;
+    bool done;
+} Sweeper;
+
+// the marker this thread is, during a parallel collection
+static THREAD_LOCAL Marker* marker = NULL;
+
+/**
+ * Implementation of method for getting a monotonic timestamp in seconds.
+ */
+double gcClock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/**
+ * Method for getting the heap a collection's survivors can grow to before the next.
+ */
+static inline size_t grownHeap(size_t bytes) {
+    return (size_t)(bytes * vm->heapGrowFactor);
+}
+
+/**
+ * Method for making room for more gray objects on a stack.
+ */
+static void reserveGray(Obj*** stack, int count, int* capacity, int needed) {
+    if (*capacity >= count + needed) {
+        return;
+    }
+    while (*capacity < count + needed) {
+        *capacity = GROW_CAPACITY(*capacity);
+    }
+    *stack = (Obj**)realloc(*stack, sizeof(Obj*) * *capacity);
+    if (*stack == NULL) {
+        exit(1);
+    }
+}
+
+/**
+ * Method for pushing an object onto a gray stack.
+ */
+static inline void pushGray(Obj*** stack, int* count, int* capacity, Obj* object) {
+    reserveGray(stack, *count, capacity, 1);
+    (*stack)[(*count)++] = object;
+}
+
+/**
+ * Method for moving the bottom half of a marker's stack to where the others can steal it.
+ *
+ * Those are the oldest gray objects, so the most likely to lead to more work.
+ */
+static void shareWork(Marker* self) {
+    int half = self->count / 2;
+    pthread_mutex_lock(&self->lock);
+    reserveGray(&self->shared, self->sharedCount, &self->sharedCapacity, half);
+    memcpy(self->shared + self->sharedCount, self->stack, sizeof(Obj*) * half);
+    // idle markers check the count without taking the lock
+    __atomic_store_n(&self->sharedCount, self->sharedCount + half, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&self->lock);
+
+    memmove(self->stack, self->stack + half, sizeof(Obj*) * (self->count - half));
+    self->count -= half;
+}
+
+/**
+ * Method for taking gray objects from a marker's shared ones, all of its own
+ * or half of another's. Returns false if there weren't any.
+ */
+static bool takeWork(Marker* self, Marker* victim) {
+    if (__atomic_load_n(&victim->sharedCount, __ATOMIC_ACQUIRE) == 0) {
+        return false;
+    }
+
+    pthread_mutex_lock(&victim->lock);
+    int take = victim == self ? victim->sharedCount : (victim->sharedCount + 1) / 2;
+    reserveGray(&self->stack, self->count, &self->capacity, take);
+    memcpy(self->stack + self->count, victim->shared + victim->sharedCount - take, sizeof(Obj*) * take);
+    self->count += take;
+    __atomic_store_n(&victim->sharedCount, victim->sharedCount - take, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&victim->lock);
+    return take > 0;
+}
+
+/**
+ * Method for finding a marker more gray objects, its own shared ones first.
+ */
+static bool findWork(Marker* self) {
+    MarkWork* work = self->work;
+    int index = (int)(self - work->markers);
+    for (int i = 0; i < work->count; i++) {
+        if (takeWork(self, &work->markers[(index + i) % work->count])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Method for waiting while a marker has nothing to do.
+ *
+ * Returns false once every marker is idle, as there's nothing left to mark.
+ */
+static bool waitForWork(Marker* self) {
+    MarkWork* work = self->work;
+    __atomic_add_fetch(&work->idle, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+        bool available = false;
+        for (int i = 0; i < work->count && !available; i++) {
+            available = __atomic_load_n(&work->markers[i].sharedCount, __ATOMIC_ACQUIRE) > 0;
+        }
+
+        if (available) {
+            __atomic_sub_fetch(&work->idle, 1, __ATOMIC_SEQ_CST);
+            if (findWork(self)) {
+                return true;
+            }
+            __atomic_add_fetch(&work->idle, 1, __ATOMIC_SEQ_CST);
+        } else if (__atomic_load_n(&work->idle, __ATOMIC_SEQ_CST) == __atomic_load_n(&work->running, __ATOMIC_SEQ_CST)) {
+            return false;
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+/**
+ * Method for running a marker until there's nothing left to mark.
+ */
+static void* runMarker(void* arg) {
+    Marker* self = (Marker*)arg;
+    useVM(self->vm);
+    marker = self;
+
+    do {
+        while (self->count > 0 || findWork(self)) {
+            while (self->count > 0) {
+                blackenObject(self->stack[--self->count]);
+                if (self->count >= MARK_SHARE_MIN && __atomic_load_n(&self->sharedCount, __ATOMIC_ACQUIRE) == 0
+                        && __atomic_load_n(&self->work->idle, __ATOMIC_RELAXED) > 0) {
+                    shareWork(self);
+                }
+            }
+        }
+    } while (waitForWork(self));
+
+    marker = NULL;
+    return NULL;
+}
+
+/**
+ * Method for tracing references on several threads at once.
+ *
+ * The gray objects the roots left are dealt out between the markers, and
+ * each marks from its own stack, stealing from the others when it runs out.
+ * This thread is the first marker.
+ */
+static void traceInParallel(int threads) {
+    MarkWork work = {0};
+    work.markers = (Marker*)calloc(threads, sizeof(Marker));
+    if (work.markers == NULL) {
+        traceReferences();
+        return;
+    }
+    work.count = threads;
+    work.running = threads;
+
+    for (int i = 0; i < threads; i++) {
+        Marker* each = &work.markers[i];
+        pthread_mutex_init(&each->lock, NULL);
+        each->work = &work;
+        each->vm = vm;
+    }
+    for (int i = 0; i < vm->grayCount; i++) {
+        Marker* each = &work.markers[i % threads];
+        pushGray(&each->shared, &each->sharedCount, &each->sharedCapacity, vm->grayStack[i]);
+    }
+    vm->grayCount = 0;
+
+    int started = 1;
+    for (; started < threads; started++) {
+        if (pthread_create(&work.markers[started].thread, NULL, runMarker, &work.markers[started]) != 0) {
+            // the markers that did start steal the rest's share
+            __atomic_store_n(&work.running, started, __ATOMIC_SEQ_CST);
+            break;
+        }
+    }
+    runMarker(&work.markers[0]);
+
+    for (int i = 0; i < threads; i++) {
+        Marker* each = &work.markers[i];
+        if (i > 0 && i < started) {
+            pthread_join(each->thread, NULL);
+        }
+        free(each->stack);
+        free(each->shared);
+        pthread_mutex_destroy(&each->lock);
+    }
+    free(work.markers);
+}
+
+/**
+ * Method for sweeping the objects given to a background sweep.
+ *
+ * Everything it frees is recorded in its FreedMemory rather than the VM's
+ * pools, as the program is allocating from those at the same time.
+ */
+static void* runSweeper(void* arg) {
+    Sweeper* sweeper = (Sweeper*)arg;
+    freedMemory = &sweeper->freed;
+
+    Obj* object = sweeper->objects;
+    while (object != NULL) {
+        Obj* next = object->next;
+        if (object->type == OBJ_NATIVE || object->mark == sweeper->markValue) {
+            object->next = NULL;
+            if (sweeper->survivorsTail != NULL) {
+                sweeper->survivorsTail->next = object;
+            } else {
+                sweeper->survivors = object;
+            }
+            sweeper->survivorsTail = object;
+        } else {
+            freeObject(object);
+            sweeper->objectsFreed++;
+        }
+        object = next;
+    }
+
+    freedMemory = NULL;
+    __atomic_store_n(&sweeper->done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/**
+ * Method for handing the heap to a background sweep.
+ *
+ * The program carries on allocating into an empty vm->objects meanwhile.
+ * Returns false if the thread couldn't be started, to sweep here instead.
+ */
+static bool startSweep() {
+    Sweeper* sweeper = (Sweeper*)calloc(1, sizeof(Sweeper));
+    if (sweeper == NULL) {
+        return false;
+    }
+    sweeper->objects = vm->objects;
+    sweeper->markValue = vm->markValue;
+    sweeper->bytesMarked = vm->bytesAllocated;
+    sweeper->heapLimit = grownHeap(vm->bytesAllocated);
+
+    if (pthread_create(&sweeper->thread, NULL, runSweeper, sweeper) != 0) {
+        free(sweeper);
+        return false;
+    }
+    vm->objects = NULL;
+    vm->sweeper = sweeper;
+    // check back on it after a little allocation, rather than at the full threshold
+    vm->nextGC = vm->bytesAllocated + vm->bytesAllocated / 16;
+    return true;
+}
+
+/**
+ * Method for waiting on a background sweep and reclaiming what it freed.
+ *
+ * The next threshold is set from what survived, as if it had swept straight away.
+ */
+void finishSweep() {
+    Sweeper* sweeper = vm->sweeper;
+    if (sweeper == NULL) {
+        return;
+    }
+
+    pthread_join(sweeper->thread, NULL);
+    vm->sweeper = NULL;
+    vm->gcStats.bytesFreed += sweeper->freed.bytes;
+    vm->gcStats.objectsFreed += sweeper->objectsFreed;
+    vm->gcStats.lastBytesFreed = sweeper->freed.bytes;
+    vm->gcStats.lastObjectsFreed = sweeper->objectsFreed;
+    reclaimFreedMemory(&sweeper->freed);
+    if (sweeper->survivors != NULL) {
+        sweeper->survivorsTail->next = vm->objects;
+        vm->objects = sweeper->survivors;
+    }
+
+    size_t survived = sweeper->bytesMarked - sweeper->freed.bytes;
+    vm->nextGC = grownHeap(survived);
+    free(sweeper);
+}
+
+/**
+ * Method for checking on a background sweep before collecting again.
+ *
+ * Returns true if the collection isn't needed yet: the sweep is still running
+ * and the heap hasn't outgrown the limit it had when marking, or the sweep
+ * has freed enough to be back under the threshold.
+ */
+static bool deferToSweep() {
+    Sweeper* sweeper = vm->sweeper;
+    if (sweeper == NULL) {
+        return false;
+    }
+
+    if (!__atomic_load_n(&sweeper->done, __ATOMIC_ACQUIRE) && vm->bytesAllocated < sweeper->heapLimit) {
+        vm->nextGC = vm->bytesAllocated + sweeper->bytesMarked / 16;
+        return true;
+    }
+    finishSweep();
+    return vm->bytesAllocated <= vm->nextGC;
+}
+
+/**
+ * Method for handing everything the current region's allocated to the rest of the heap.
+ *
+ * A collection during a region takes what it's allocated so far, so the
+ * region's end only frees what it's allocated since.
+ */
+static void mergeRegion(Obj** list, bool old) {
+    Obj* object = vm->regionObjects;
+    while (object != NULL) {
+        Obj* next = object->next;
+        object->old = old;
+        object->next = *list;
+        *list = object;
+        object = next;
+    }
+    vm->regionObjects = NULL;
+}
+
+/**
+ * Method for sweeping the lists and dicts frames own.
+ *
+ * Frames free their own, even when an exception unwinds them, so the only
+ * unreachable ones are those an exception nothing caught or a fiber that never
+ * finished left behind, which a major collection frees. A minor collection doesn't trace everything that can
+ * reach them, so only resets the marks of those it did trace, as they're
+ * never promoted.
+ */
+static void sweepLocals(bool major) {
+    Obj** link = &vm->localObjects;
+    while (*link != NULL) {
+        Obj* object = *link;
+        if (object->mark == vm->markValue) {
+            if (!major) {
+                object->mark = !vm->markValue;
+            }
+            link = &object->next;
+        } else if (major) {
+            *link = object->next;
+            freeObject(object);
+            vm->gcStats.objectsFreed++;
+        } else {
+            link = &object->next;
+        }
+    }
+}
+
+/**
+ * Method for a full collection of the whole heap.
+ *
+ * In generational mode the nursery is merged into the old generation first
+ * and everything that survives is old afterwards.
+ */
+static void majorCollection() {
+    if (vm->youngObjects != NULL) {
+        Obj* tail = vm->youngObjects;
+        while (tail->next != NULL) {
+            tail = tail->next;
+        }
+        tail->next = vm->objects;
+        vm->objects = vm->youngObjects;
+        vm->youngObjects = NULL;
+    }
+    // marked old first, as a background sweep doesn't touch it
+    mergeRegion(&vm->objects, true);
+
+    for (int i = 0; i < vm->rememberedCount; i++) {
+        vm->remembered[i]->remembered = false;
+    }
+    vm->rememberedCount = 0;
+
+    bool parallel = vm->gcThreads > 1 && vm->bytesAllocated >= vm->parallelHeap;
+    markRoots();
+    if (parallel) {
+        traceInParallel(vm->gcThreads);
+    } else {
+        traceReferences();
+    }
+    tableRemoveWhite(&vm->strings);
+    sweepLocals(true);
+
+    // survivors are marked old when sweeping in generational mode, which the program
+    // reads in its write barrier, so only the full collector sweeps in the background
+    if (parallel && vm->gcMode == GC_FULL && startSweep()) {
+        vm->markValue = !vm->markValue;
+        return;
+    }
+    sweep();
+
+    vm->nextGC = grownHeap(vm->bytesAllocated);
+    if (vm->gcMode == GC_GENERATIONAL) {
+        vm->nextMajorGC = grownHeap(vm->bytesAllocated);
+        if (vm->nextMajorGC < grownHeap(vm->nurserySize)) {
+            vm->nextMajorGC = grownHeap(vm->nurserySize);
+        }
+        vm->nextGC = vm->bytesAllocated + vm->nurserySize;
+    }
+    vm->markValue = !vm->markValue;
+}
+
+/**
+ * Method for sweeping the nursery after a minor collection.
+ *
+ * Survivors are promoted into the old generation and have their mark
+ * reset so they look unmarked to the next collection, the same as after
+ * a full collection flips vm->markValue.
+ */
+static void sweepYoung() {
+    Obj* object = vm->youngObjects;
+    while (object != NULL) {
+        Obj* next = object->next;
+        if (object->type == OBJ_NATIVE || object->mark == vm->markValue) {
+            object->old = true;
+            object->mark = !vm->markValue;
+            object->next = vm->objects;
+            vm->objects = object;
+        } else {
+            freeObject(object);
+            vm->gcStats.objectsFreed++;
+        }
+        object = next;
+    }
+    vm->youngObjects = NULL;
+}
+
+/**
+ * Method for a minor collection of just the nursery.
+ *
+ * Old objects are treated as live and aren't traced, except for those in
+ * the remembered set which may point at young objects.
+ */
+static void minorCollection() {
+    vm->minorGC = true;
+    mergeRegion(&vm->youngObjects, false);
+
+    markRoots();
+    for (int i = 0; i < vm->rememberedCount; i++) {
+        Obj* object = vm->remembered[i];
+        object->remembered = false;
+        blackenObject(object);
+    }
+    vm->rememberedCount = 0;
+    traceReferences();
+    tableRemoveWhite(&vm->strings);
+    sweepYoung();
+    sweepLocals(false);
+
+    vm->minorGC = false;
+    vm->nextGC = vm->bytesAllocated + vm->nurserySize;
+}
+
+/**
+ * Implementation of method for starting a region.
+ *
+ * In generational mode the nursery's collected first, so everything from
+ * before the region is old and what escapes from it can be promoted too.
+ */
+void beginRegion() {
+    if (vm->regionDepth++ == 0 && vm->youngObjects != NULL && !vm->gcDisabled) {
+        collectGarbage();
+    }
+}
+
+/**
+ * Method for sweeping a region once it's traced.
+ *
+ * What's left of it escaped into something older, so it's promoted.
+ */
+static void sweepRegion() {
+    Obj* object = vm->regionObjects;
+    while (object != NULL) {
+        Obj* next = object->next;
+        if (object->type == OBJ_NATIVE || object->mark == vm->markValue) {
+            object->old = true;
+            object->mark = !vm->markValue;
+            object->next = vm->objects;
+            vm->objects = object;
+        } else {
+            freeObject(object);
+            vm->gcStats.objectsFreed++;
+        }
+        object = next;
+    }
+    vm->regionObjects = NULL;
+}
+
+/**
+ * Implementation of method for ending a region.
+ *
+ * It's collected the way a minor collection collects the nursery: only the
+ * region's objects are traced, from the roots and the remembered set, which
+ * holds everything older the write barrier saw them stored into.
+ */
+void endRegion() {
+    if (--vm->regionDepth > 0) {
+        return;
+    }
+    if (vm->gcDisabled || vm->youngObjects != NULL) {
+        // left to the next collection, as is a nursery that couldn't be collected when it started
+        bool old = vm->gcMode == GC_FULL;
+        mergeRegion(old ? &vm->objects : &vm->youngObjects, old);
+        return;
+    }
+    finishSweep();
+
+    size_t before = vm->bytesAllocated;
+    size_t objectsBefore = vm->gcStats.objectsFreed;
+    double start = gcClock();
+    vm->minorGC = true;
+
+    markRoots();
+    for (int i = 0; i < vm->rememberedCount; i++) {
+        Obj* object = vm->remembered[i];
+        object->remembered = false;
+        blackenObject(object);
+    }
+    vm->rememberedCount = 0;
+    traceReferences();
+    tableRemoveWhite(&vm->strings);
+    sweepRegion();
+    sweepLocals(false);
+
+    vm->minorGC = false;
+    double pause = gcClock() - start;
+    vm->gcStats.minorCollections++;
+    vm->gcStats.minorPauseTotal += pause;
+    if (pause > vm->gcStats.maxPause) {
+        vm->gcStats.maxPause = pause;
+    }
+    vm->gcStats.bytesFreed += before - vm->bytesAllocated;
+    vm->gcStats.lastBytesFreed = before - vm->bytesAllocated;
+    vm->gcStats.lastObjectsFreed = vm->gcStats.objectsFreed - objectsBefore;
+}
 
 /**
  * Method for gc processing.
  */
 void collectGarbage() {
+    if (vm->gcDisabled) {
+        // not checked again until they're turned back on, which collects straight away
+        vm->nextGC = SIZE_MAX;
+        return;
+    }
 
 #ifdef DEBUG_LOG_GC
     printf("--> gc begin\n");
-    size_t before = vm.bytesAllocated;
 #endif
 
-    markRoots();
-    traceReferences();
-    tableRemoveWhite(&vm.strings);
-    sweep();
+    if (deferToSweep()) {
+        return;
+    }
+
+    size_t before = vm->bytesAllocated;
+    size_t objectsBefore = vm->gcStats.objectsFreed;
+    double start = gcClock();
+
+    bool minor = vm->gcMode == GC_GENERATIONAL && vm->bytesAllocated < vm->nextMajorGC;
+    PROBE_GC_START(before, !minor);
+    if (minor) {
+        minorCollection();
+    } else {
+        majorCollection();
+    }
 
-    vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
-    vm.markValue = !vm.markValue;
+    double pause = gcClock() - start;
+    PROBE_GC_DONE(before, vm->bytesAllocated, !minor);
+    if (minor) {
+        vm->gcStats.minorCollections++;
+        vm->gcStats.minorPauseTotal += pause;
+    } else {
+        vm->gcStats.majorCollections++;
+        vm->gcStats.majorPauseTotal += pause;
+    }
+    if (pause > vm->gcStats.maxPause) {
+        vm->gcStats.maxPause = pause;
+    }
+    vm->gcStats.bytesFreed += before - vm->bytesAllocated;
+    // a background sweep sets these when it's finished
+    if (vm->sweeper == NULL) {
+        vm->gcStats.lastBytesFreed = before - vm->bytesAllocated;
+        vm->gcStats.lastObjectsFreed = vm->gcStats.objectsFreed - objectsBefore;
+    }
 
 #ifdef DEBUG_LOG_GC
     printf("--> gc end\n");
     printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
-         before - vm.bytesAllocated, before, vm.bytesAllocated,
-         vm.nextGC);
+         before - vm->bytesAllocated, before, vm->bytesAllocated,
+         vm->nextGC);
 #endif
 
 }
 
+/**
+ * Method for choosing the collector.
+ *
+ * Anything allocated before switching to generational mode (the builtins)
+ * starts off in the old generation.
+ */
+void setGCMode(GCMode mode, size_t nurserySize) {
+    finishSweep();
+    vm->gcMode = mode;
+    vm->nurserySize = nurserySize;
+    if (mode != GC_GENERATIONAL) {
+        return;
+    }
+
+    for (Obj* object = vm->objects; object != NULL; object = object->next) {
+        object->old = true;
+    }
+    vm->nextGC = vm->bytesAllocated + vm->nurserySize;
+    vm->nextMajorGC = grownHeap(vm->bytesAllocated + vm->nurserySize);
+}
+
+/**
+ * Method for choosing how many threads major collections use.
+ */
+void setGCThreads(int threads, size_t minHeap) {
+    vm->gcThreads = threads < 1 ? 1 : threads;
+    vm->parallelHeap = minHeap;
+}
+
+/**
+ * Implementation of method for setting how far the heap grows between collections.
+ */
+void setHeapGrowFactor(double factor) {
+    vm->heapGrowFactor = factor;
+}
+
+/**
+ * Implementation of method for turning collections on or off.
+ */
+void setGCEnabled(bool enabled) {
+    vm->gcDisabled = !enabled;
+    if (enabled && vm->nextGC == SIZE_MAX) {
+        // the heap grew past the limit while they were off
+        vm->nextGC = vm->bytesAllocated;
+    }
+}
+
+/**
+ * Implementation of method for a full collection now.
+ */
+size_t collectNow() {
+    finishSweep();
+    bool disabled = vm->gcDisabled;
+    size_t nextMajorGC = vm->nextMajorGC;
+    size_t before = vm->bytesAllocated;
+
+    vm->gcDisabled = false;
+    // generational mode would only collect the nursery otherwise
+    vm->nextMajorGC = 0;
+    collectGarbage();
+    finishSweep();
+
+    if (vm->gcMode == GC_GENERATIONAL && nextMajorGC > vm->nextMajorGC) {
+        vm->nextMajorGC = nextMajorGC;
+    }
+    vm->gcDisabled = disabled;
+    return before > vm->bytesAllocated ? before - vm->bytesAllocated : 0;
+}
+
+/**
+ * Implementation of method for counting the live objects by type.
+ */
+void countObjects(size_t* counts, int typeCount) {
+    finishSweep();
+    for (int i = 0; i < typeCount; i++) {
+        counts[i] = 0;
+    }
+    for (Obj* object = vm->objects; object != NULL; object = object->next) {
+        counts[object->type]++;
+    }
+    for (Obj* object = vm->youngObjects; object != NULL; object = object->next) {
+        counts[object->type]++;
+    }
+    for (Obj* object = vm->regionObjects; object != NULL; object = object->next) {
+        counts[object->type]++;
+    }
+    for (Obj* object = vm->localObjects; object != NULL; object = object->next) {
+        counts[object->type]++;
+    }
+}
+
+/**
+ * Implementation of method for getting the name of an object type.
+ */
+const char* objTypeName(ObjType type) {
+    static const char* names[] = {
+        [OBJ_BOUND_METHOD] = "bound_method",
+        [OBJ_CLASS] = "class",
+        [OBJ_CLOSURE] = "closure",
+        [OBJ_FUNCTION] = "function",
+        [OBJ_NATIVE] = "native",
+        [OBJ_NATIVE_PROPERTY] = "native_property",
+        [OBJ_INSTANCE] = "instance",
+        [OBJ_STRING] = "string",
+        [OBJ_UPVALUE] = "upvalue",
+        [OBJ_LIST] = "list",
+        [OBJ_DICT] = "dict",
+        [OBJ_MODULE] = "module",
+        [OBJ_ENUM] = "enum",
+        [OBJ_FILE] = "file",
+        [OBJ_STRING_BUILDER] = "string_builder",
+        [OBJ_ARRAY] = "array",
+        [OBJ_SET] = "set",
+        [OBJ_BYTES] = "bytes",
+        [OBJ_FIBER] = "fiber",
+        [OBJ_SOCKET] = "socket",
+        [OBJ_THREAD] = "thread",
+        [OBJ_CHANNEL] = "channel",
+        [OBJ_RANGE] = "range",
+        [OBJ_RANDOM] = "random",
+        [OBJ_DICT_VIEW] = "dict_view",
+        [OBJ_MEMO] = "memo",
+        [OBJ_ERROR] = "error",
+    };
+    return names[type];
+}
+
+/**
+ * Implementation of method for getting how fast the program's allocating.
+ *
+ * Everything allocated is either still allocated or has been freed by a collection,
+ * so it's only out by what's freed outside of one, like a list's old storage.
+ */
+double allocationRate() {
+    double elapsed = gcClock() - vm->gcStats.startTime;
+    if (elapsed <= 0) {
+        return 0;
+    }
+    return (double)(vm->bytesAllocated + vm->gcStats.bytesFreed) / elapsed;
+}
+
+/**
+ * Method for keeping a value alive while it's only referenced from C.
+ */
+void pinValue(Value value) {
+    // kept on the stack in case growing the array collects
+    push(value);
+    writeValueArray(&vm->pinned, value);
+    pop();
+}
+
+/**
+ * Method for releasing a pinned value.
+ */
+void unpinValue(Value value) {
+    for (int i = vm->pinned.count - 1; i >= 0; i--) {
+        Value pinned = vm->pinned.values[i];
+        bool same = IS_OBJ(value) ? IS_OBJ(pinned) && AS_OBJ(pinned) == AS_OBJ(value) : valuesEqual(pinned, value);
+        if (same) {
+            vm->pinned.values[i] = vm->pinned.values[vm->pinned.count - 1];
+            vm->pinned.count--;
+            return;
+        }
+    }
+}
+
+/**
+ * Method for adding an old object to the remembered set.
+ */
+void rememberObject(Obj* object) {
+    // outside a region the full collector has nothing young for it to point at
+    if (!object->old || object->remembered || (vm->gcMode == GC_FULL && vm->regionDepth == 0)) {
+        return;
+    }
+
+    if (vm->rememberedCapacity < vm->rememberedCount + 1) {
+        vm->rememberedCapacity = GROW_CAPACITY(vm->rememberedCapacity);
+        vm->remembered = (Obj**)realloc(vm->remembered, sizeof(Obj*) * vm->rememberedCapacity);
+        if (vm->remembered == NULL) {
+            exit(1);
+        }
+    }
+
+    object->remembered = true;
+    vm->remembered[vm->rememberedCount++] = object;
+}
+
+/**
+ * Method for printing the collector's pause statistics.
+ */
+void printGCStats(FILE* out) {
+    finishSweep();
+    const GCStats* stats = &vm->gcStats;
+    int total = stats->minorCollections + stats->majorCollections;
+    double pauseTotal = stats->minorPauseTotal + stats->majorPauseTotal;
+
+    fprintf(out, "gc: %s collector\n", vm->gcMode == GC_GENERATIONAL ? "generational" : "full");
+    fprintf(out, "gc: %d collections (%d minor, %d major), %zu bytes freed\n",
+        total, stats->minorCollections, stats->majorCollections, stats->bytesFreed);
+    fprintf(out, "gc: total pause %.3f ms, max pause %.3f ms, mean pause %.3f ms\n",
+        pauseTotal * 1000, stats->maxPause * 1000, total > 0 ? pauseTotal * 1000 / total : 0.0);
+    if (stats->minorCollections > 0) {
+        fprintf(out, "gc: mean minor pause %.3f ms\n", stats->minorPauseTotal * 1000 / stats->minorCollections);
+    }
+    if (stats->majorCollections > 0) {
+        fprintf(out, "gc: mean major pause %.3f ms\n", stats->majorPauseTotal * 1000 / stats->majorCollections);
+    }
+    if (total > 0) {
+        fprintf(out, "gc: %zu objects freed, %zu bytes and %zu objects per collection\n",
+            stats->objectsFreed, stats->bytesFreed / total, stats->objectsFreed / total);
+    }
+    fprintf(out, "gc: %zu bytes live, allocating %.1f MB/s, %d interned strings\n",
+        vm->bytesAllocated, allocationRate() / (1024 * 1024), vm->strings.count);
+
+    size_t counts[OBJ_TYPE_COUNT];
+    countObjects(counts, OBJ_TYPE_COUNT);
+    fprintf(out, "gc: live objects:");
+    for (int i = 0; i < OBJ_TYPE_COUNT; i++) {
+        if (counts[i] > 0) {
+            fprintf(out, " %s %zu", objTypeName((ObjType)i), counts[i]);
+        }
+    }
+    fprintf(out, "\n");
+}
+
+/**
+ * Method for marking the args of a call to a memoised function.
+ */
+static void markArgs(Value* args, int argCount) {
+    for (int i = 0; i < argCount; i++) {
+        markValue(args[i]);
+    }
+}
+
 /**
  * Method for marking roots.
  */
@@ -55,22 +926,53 @@ void markRoots() {
     printf("--> marking roots\n");
 #endif
 
-    for (const Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+    for (const Value* slot = vm->stack; slot < vm->stackTop; slot++) {
         markValue(*slot);
     }
 
-    markTable(&vm.globals);
+    markTable(&vm->globals);
+    markTable(&vm->builtins);
+    markTable(&vm->modules);
+    // each array has its own count as a GC can happen between growing one and the other
+    markArray(&vm->globalValues);
+    markArray(&vm->globalNames);
+    markArray(&vm->pinned);
+    markArray(&vm->bundleStrings);
 
-    for (int f = 0; f < vm.frameCount; f++) {
-        markObject((Obj*)vm.frames[f].closure);
+    for (int f = 0; f < vm->frameCount; f++) {
+        markObject((Obj*)vm->frames[f].closure);
     }
 
-    for (ObjUpvalue* upvalue = vm.openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+    for (ObjUpvalue* upvalue = vm->openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
         markObject((Obj*)upvalue);
     }
 
     markCompilerRoots();
-    markObject((Obj*)vm.initString);
+    markObject((Obj*)vm->initString);
+    markObject((Obj*)vm->containerClass);
+    markObject((Obj*)vm->listClass);
+    markObject((Obj*)vm->dictClass);
+    markObject((Obj*)vm->stringClass);
+    markObject((Obj*)vm->fileClass);
+    markObject((Obj*)vm->exceptionClass);
+    markValue(vm->exception);
+    markObject((Obj*)vm->stringBuilderClass);
+    markObject((Obj*)vm->arrayClass);
+    markObject((Obj*)vm->setClass);
+    markObject((Obj*)vm->bytesClass);
+    markObject((Obj*)vm->fiberClass);
+    markObject((Obj*)vm->socketClass);
+    markObject((Obj*)vm->threadClass);
+    markObject((Obj*)vm->channelClass);
+    markObject((Obj*)vm->randomClass);
+    markObject((Obj*)vm->dictViewClass);
+    markObject((Obj*)vm->memoClass);
+    for (int i = 0; i < vm->memoCallCount; i++) {
+        markObject((Obj*)vm->memoCalls[i].memo);
+        markArgs(vm->memoCalls[i].args, vm->memoCalls[i].argCount);
+    }
+    markObject((Obj*)vm->fiber);
+    markEventLoop();
 
 #ifdef DEBUG_LOG_GC
     printf("--> finished marking roots\n");
@@ -100,35 +1002,50 @@ void markObject(Obj* object) {
         return;
     }
 
-    if (object->mark == vm.markValue) {
+    // minor collections treat the old generation as live
+    if (vm->minorGC && object->old) {
         return;
     }
 
+    if (marker != NULL) {
+        // other markers can reach the same object, only the one that marks it first traces it
+        if (__atomic_load_n(&object->mark, __ATOMIC_RELAXED) == vm->markValue
+                || __atomic_exchange_n(&object->mark, vm->markValue, __ATOMIC_RELAXED) == vm->markValue) {
+            return;
+        }
+    } else {
+        if (object->mark == vm->markValue) {
+            return;
+        }
+        object->mark = vm->markValue;
+    }
+
 #ifdef DEBUG_LOG_GC
     printf("%p mark ", (void*)object);
     printValue(OBJ_VAL(object));
     printf("\n");
 #endif
 
-    object->mark = vm.markValue;
-
     /**
-     * Optimisation as ObjStrings and ObjNatives have no outgoing references,
+     * Optimisation as ObjStrings, ObjNatives, ObjArrays and ObjBytes have no outgoing references,
      * we don't need to process them further so don't need adding to the graystack.
+     * The only exception is a string view's parent, which is never a view itself.
      */
-    if (object->type == OBJ_STRING || object->type == OBJ_NATIVE) {
+    if (object->type == OBJ_STRING) {
+        markObject((Obj*)((ObjString*)object)->parent);
         return;
     }
-
-    if (vm.grayCapacity < vm.grayCount + 1) {
-        vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
-        vm.grayStack = (Obj**)realloc(vm.grayStack, sizeof(Obj*) * vm.grayCapacity);
-        if (vm.grayStack == NULL) {
-            exit(1);
-        }
+    if (object->type == OBJ_NATIVE || object->type == OBJ_ARRAY || object->type == OBJ_BYTES
+            || object->type == OBJ_SOCKET || object->type == OBJ_THREAD || object->type == OBJ_CHANNEL
+            || object->type == OBJ_RANGE || object->type == OBJ_RANDOM) {
+        return;
     }
 
-    vm.grayStack[vm.grayCount++] = object;
+    if (marker != NULL) {
+        pushGray(&marker->stack, &marker->count, &marker->capacity, object);
+    } else {
+        pushGray(&vm->grayStack, &vm->grayCount, &vm->grayCapacity, object);
+    }
 }
 
 /**
@@ -139,7 +1056,7 @@ void markTable(Table* table) {
     printf("--> marking table %p\n", (void*)table);
 #endif
 
-    for (int i = 0; i < table->capacity; i++) {
+    for (int i = 0; i < table->entryCount; i++) {
         const Entry* entry = &table->entries[i];
         markValue(entry->key);
         markValue(entry->value);
@@ -192,8 +1109,8 @@ void traceReferences() {
     printf("--> tracing references\n");
 #endif
 
-    while (vm.grayCount > 0) {
-        Obj* object = vm.grayStack[--vm.grayCount];
+    while (vm->grayCount > 0) {
+        Obj* object = vm->grayStack[--vm->grayCount];
         blackenObject(object);
     }
 
@@ -223,6 +1140,7 @@ void blackenObject(Obj* object) {
             ObjClass* sClass = (ObjClass*)object;
             markObject((Obj*)sClass->name);
             markTable(&sClass->methods);
+            markShape(sClass->rootShape);
             break;
         }
         case OBJ_CLOSURE: {
@@ -230,19 +1148,35 @@ void blackenObject(Obj* object) {
             markObject((Obj*)closure->function);
             for (int c = 0; c < closure->upvalueCount; c++) {
                 markObject((Obj*)closure->upvalues[c]);
+                if (closure->captured != NULL) {
+                    markValue(closure->captured[c]);
+                }
             }
             break;
         }
         case OBJ_INSTANCE: {
             ObjInstance* instance = (ObjInstance*)object;
             markObject((Obj*)instance->sClass);
-            markTable(&instance->fields);
+            markObject((Obj*)instance->bound);
+            for (int i = 0; i < instance->shape->fieldCount; i++) {
+                markValue(instance->fields[i]);
+            }
             break;
         }
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)object;
             markObject((Obj*)function->name);
+            markObject((Obj*)function->file);
             markArray(&function->chunk.constants);
+            for (int i = 0; i < function->chunk.cacheCount; i++) {
+                InlineCache* cache = &function->chunk.caches[i];
+                for (int e = 0; e < INLINE_CACHE_WAYS; e++) {
+                    if (cache->entries[e].shape != NULL) {
+                        markObject((Obj*)cache->entries[e].shape->owner);
+                    }
+                    markValue(cache->entries[e].method);
+                }
+            }
             break;
         }
         case OBJ_UPVALUE: {
@@ -252,6 +1186,7 @@ void blackenObject(Obj* object) {
         case OBJ_LIST: {
             ObjList* list = (ObjList*)object;
             markObject((Obj*)list->sClass);
+            markObject((Obj*)list->storage);
             markArray(&list->values);
             break;
         }
@@ -261,6 +1196,23 @@ void blackenObject(Obj* object) {
             markTable(&dict->data);
             break;
         }
+        case OBJ_SET: {
+            ObjSet* set = (ObjSet*)object;
+            markTable(&set->data);
+            break;
+        }
+        case OBJ_DICT_VIEW:
+            markObject((Obj*)((ObjDictView*)object)->dict);
+            break;
+        case OBJ_MEMO: {
+            ObjMemo* memo = (ObjMemo*)object;
+            markValue(memo->function);
+            for (int i = 0; i < memo->count; i++) {
+                markArgs(memo->entries[i].args, memo->entries[i].argCount);
+                markValue(memo->entries[i].result);
+            }
+            break;
+        }
         case OBJ_ENUM: {
             ObjEnum* enumObj = (ObjEnum*)object;
             markObject((Obj*)enumObj->name);
@@ -270,6 +1222,22 @@ void blackenObject(Obj* object) {
         case OBJ_MODULE: {
             ObjModule* module = (ObjModule*)object;
             markTable(&module->methods);
+            markObject((Obj*)module->name);
+            break;
+        }
+        case OBJ_FIBER: {
+            ObjFiber* fiber = (ObjFiber*)object;
+            markObject((Obj*)fiber->closure);
+            for (int i = 0; i < fiber->frameCount; i++) {
+                markObject((Obj*)fiber->frames[i].closure);
+            }
+            for (int i = 0; i < fiber->stackCount; i++) {
+                markValue(fiber->stack[i]);
+            }
+            for (ObjUpvalue* upvalue = fiber->openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+                markObject((Obj*)upvalue);
+            }
+            markValue(fiber->transfer);
             break;
         }
         case OBJ_ERROR: {
@@ -277,7 +1245,19 @@ void blackenObject(Obj* object) {
             markObject((Obj*)error->message);
             break;
         }
-        case OBJ_FILE:
+        case OBJ_FILE: {
+            ObjFile* sFile = (ObjFile*)object;
+            markObject((Obj*)sFile->name);
+            break;
+        }
+        case OBJ_STRING_BUILDER:
+        case OBJ_ARRAY:
+        case OBJ_BYTES:
+        case OBJ_SOCKET:
+        case OBJ_THREAD:
+        case OBJ_CHANNEL:
+        case OBJ_RANGE:
+        case OBJ_RANDOM:
             break;
         case OBJ_NATIVE:
             break;
@@ -297,15 +1277,17 @@ void sweep() {
 #endif
 
     Obj* previous = NULL;
-    Obj* object = vm.objects;
+    Obj* object = vm->objects;
     while (object != NULL){
         if(object->type == OBJ_NATIVE) {
             // don't touch natives
+            object->old = true;
             previous = object;
             object = object->next;
             continue;
         }
-        if (object->mark == vm.markValue) {
+        if (object->mark == vm->markValue) {
+            object->old = true;
             previous = object;
             object = object->next;
         } else {
@@ -314,7 +1296,7 @@ void sweep() {
             if (previous != NULL) {
                 previous->next = object;
             } else {
-                vm.objects = object;
+                vm->objects = object;
             }
 
 #ifdef DEBUG_LOG_GC
@@ -324,6 +1306,7 @@ void sweep() {
             printf("\n");
 #endif
             freeObject(unreached);
+            vm->gcStats.objectsFreed++;
         }
     }
 
@@ -336,9 +1319,10 @@ void sweep() {
  * Removes all white entries from the table.
  */
 void tableRemoveWhite(Table* table) {
-    for (int i = 0; i < table->capacity; i++) {
+    for (int i = 0; i < table->entryCount; i++) {
         Entry* entry = &table->entries[i];
-        if (!IS_EMPTY(entry->key) && IS_OBJ(entry->key) && AS_OBJ(entry->key)->mark != vm.markValue) {
+        if (!IS_EMPTY(entry->key) && IS_OBJ(entry->key) && AS_OBJ(entry->key)->mark != vm->markValue
+                && !(vm->minorGC && AS_OBJ(entry->key)->old)) {
             tableDelete(table, entry->key);
         }
     }
@@ -0,0 +1,117 @@
+/**
+ * @file hash.c
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "core/hash.h"
+
+#define HASH_P2 0x8ebc6af09c88c6e3ull
+#define HASH_P3 0x589965cc75374cc3ull
+
+uint64_t hashSeed = 0;
+
+static pthread_once_t seedOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Method for picking the seed, from the environment if it's fixed there.
+ *
+ * Otherwise the time and where things have been put in memory, which
+ * changes between runs wherever addresses are randomised, are mixed together.
+ */
+static void pickHashSeed() {
+    const char* fixed = getenv(HASH_SEED_ENV);
+    if (fixed != NULL && *fixed != '\0') {
+        hashSeed = hashMix(strtoull(fixed, NULL, 10) ^ HASH_P2, HASH_P1);
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t entropy = (uint64_t)now.tv_sec ^ ((uint64_t)now.tv_nsec << 20);
+    entropy = hashMix(entropy ^ HASH_P0, (uint64_t)(uintptr_t)&hashSeed ^ HASH_P3);
+    hashSeed = hashMix(entropy ^ (uint64_t)(uintptr_t)&entropy, HASH_P1);
+}
+
+/**
+ * Implementation of method for picking the process's seed.
+ */
+void initHashSeed() {
+    pthread_once(&seedOnce, pickHashSeed);
+}
+
+/**
+ * Method for reading 8 bytes, wherever they are.
+ */
+static inline uint64_t read8(const uint8_t* bytes) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+/**
+ * Method for reading 4 bytes, wherever they are.
+ */
+static inline uint64_t read4(const uint8_t* bytes) {
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+/**
+ * Method for reading up to 3 bytes, the first, middle and last.
+ */
+static inline uint64_t read3(const uint8_t* bytes, int length) {
+    return ((uint64_t)bytes[0] << 16) | ((uint64_t)bytes[length >> 1] << 8) | bytes[length - 1];
+}
+
+/**
+ * Implementation of method for hashing a run of bytes.
+ *
+ * Up to 16 bytes are read as two words, overlapping if they have to, and
+ * longer runs 16 bytes at a time, 48 at a time in three lanes once they're
+ * long enough for it to pay off.
+ */
+uint32_t hashBytes(const char* chars, int length) {
+    const uint8_t* bytes = (const uint8_t*)chars;
+    uint64_t seed = hashSeed ^ hashMix(hashSeed ^ HASH_P0, HASH_P1);
+    uint64_t a, b;
+
+    if (length <= 16) {
+        if (length >= 4) {
+            int middle = (length >> 3) << 2;
+            a = (read4(bytes) << 32) | read4(bytes + middle);
+            b = (read4(bytes + length - 4) << 32) | read4(bytes + length - 4 - middle);
+        } else if (length > 0) {
+            a = read3(bytes, length);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        int remaining = length;
+        if (remaining > 48) {
+            uint64_t seed1 = seed, seed2 = seed;
+            do {
+                seed = hashMix(read8(bytes) ^ HASH_P1, read8(bytes + 8) ^ seed);
+                seed1 = hashMix(read8(bytes + 16) ^ HASH_P2, read8(bytes + 24) ^ seed1);
+                seed2 = hashMix(read8(bytes + 32) ^ HASH_P3, read8(bytes + 40) ^ seed2);
+                bytes += 48;
+                remaining -= 48;
+            } while (remaining > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (remaining > 16) {
+            seed = hashMix(read8(bytes) ^ HASH_P1, read8(bytes + 8) ^ seed);
+            bytes += 16;
+            remaining -= 16;
+        }
+        a = read8(bytes + remaining - 16);
+        b = read8(bytes + remaining - 8);
+    }
+
+    return (uint32_t)hashMix(hashMix(a ^ HASH_P1, b ^ seed) ^ HASH_P0 ^ (uint64_t)length, HASH_P1);
+}
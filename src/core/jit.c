@@ -0,0 +1,990 @@
+/**
+ * @file jit.c
+ *
+ * Template compiler from a loop's bytecode to x86-64 machine code.
+ *
+ * Each instruction is translated on its own into the machine code that does
+ * what its handler in run() does, on the same stack and slots, so there's no
+ * dispatch between them and jumps within the loop are native jumps. The top
+ * of the stack is kept in rdx while the code runs, the frame's slots in rdi.
+ * Only numbers (and the bools comparing them makes) are worked on directly;
+ * each instruction checks its operands' types first and, if they aren't what
+ * it handles, stores the stack top back and returns that instruction's offset
+ * so the interpreter runs it instead. Nothing the code does allocates, so the
+ * collector never runs while it does.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/jit.h"
+#include "core/memory.h"
+#include "core/natives.h"
+#include "core/object.h"
+#include "core/vm.h"
+
+// SLO_JIT comes from common.h
+#ifdef SLO_JIT
+#include <sys/mman.h>
+#endif
+
+/**
+ * Method for finding a loop by where it starts, adding it if it hasn't been seen.
+ */
+static JitLoop* findLoop(Chunk* chunk, int start, int end) {
+    for (int i = 0; i < chunk->loopCount; i++) {
+        if (chunk->loops[i].start == start) {
+            return &chunk->loops[i];
+        }
+    }
+
+    if (chunk->loopCapacity < chunk->loopCount + 1) {
+        int oldCapacity = chunk->loopCapacity;
+        chunk->loopCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->loops = GROW_ARRAY(JitLoop, chunk->loops, oldCapacity, chunk->loopCapacity);
+    }
+    JitLoop* loop = &chunk->loops[chunk->loopCount++];
+    loop->start = start;
+    loop->end = end;
+    loop->count = 0;
+    loop->pushes = 0;
+    loop->failed = false;
+    loop->code = NULL;
+    loop->size = 0;
+    return loop;
+}
+
+#ifdef SLO_JIT
+
+#define VALUE_SIZE ((int32_t)sizeof(Value))
+
+#ifdef NAN_BOXING
+#define NUMBER_OFFSET 0
+#else
+#define NUMBER_OFFSET ((int32_t)offsetof(Value, as))
+#endif
+
+typedef enum Register {
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RSI = 6,
+    RDI = 7,
+    R8 = 8,
+    R9 = 9,
+} Register;
+
+// the low nibble of the jcc and setcc opcodes
+typedef enum Condition {
+    CC_ABOVE_EQUAL = 0x3,
+    CC_EQUAL = 0x4,
+    CC_NOT_EQUAL = 0x5,
+    CC_BELOW_EQUAL = 0x6,
+    CC_ABOVE = 0x7,
+    CC_PARITY = 0xa,
+    CC_NO_PARITY = 0xb,
+    CC_ALWAYS = -1,
+} Condition;
+
+/**
+ * @struct JumpFixup
+ *
+ * A jump whose displacement is filled in once the code it goes to is placed,
+ * either an instruction in the loop or the exit back to the interpreter at target.
+ */
+typedef struct JumpFixup {
+    int at;
+    int target;
+    bool exit;
+} JumpFixup;
+
+/**
+ * @struct IntStub
+ *
+ * A number guard's out of line code for turning an int into a double,
+ * emitted after the loop so the guard only branches when it finds one.
+ */
+typedef struct IntStub {
+    int at;
+    int resume;
+    Register base;
+    int32_t disp;
+    int offset;
+} IntStub;
+
+/**
+ * @struct Assembler
+ */
+typedef struct Assembler {
+    Chunk* chunk;
+    int start;
+    int end;
+    uint8_t* code;
+    int count;
+    int capacity;
+    // where each instruction's machine code starts, by its offset from the loop's start
+    int* labels;
+    JumpFixup* fixups;
+    int fixupCount;
+    int fixupCapacity;
+    IntStub* stubs;
+    int stubCount;
+    int stubCapacity;
+    bool failed;
+} Assembler;
+
+static void emitByte(Assembler* as, uint8_t byte) {
+    if (as->count == as->capacity) {
+        as->capacity = as->capacity < 256 ? 256 : as->capacity * 2;
+        uint8_t* code = (uint8_t*)realloc(as->code, as->capacity);
+        if (code == NULL) {
+            as->failed = true;
+            as->count = 0;
+            return;
+        }
+        as->code = code;
+    }
+    as->code[as->count++] = byte;
+}
+
+static void emitInt(Assembler* as, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        emitByte(as, (uint8_t)(value >> (i * 8)));
+    }
+}
+
+static void emitLong(Assembler* as, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        emitByte(as, (uint8_t)(value >> (i * 8)));
+    }
+}
+
+/**
+ * Method for emitting a REX prefix when the instruction needs one.
+ */
+static void emitRex(Assembler* as, bool wide, int reg, int base) {
+    uint8_t rex = 0x40 | (wide ? 0x08 : 0) | (reg >= 8 ? 0x04 : 0) | (base >= 8 ? 0x01 : 0);
+    if (rex != 0x40) {
+        emitByte(as, rex);
+    }
+}
+
+/**
+ * Method for emitting the ModRM byte and displacement of a [base + disp] operand.
+ *
+ * Always uses a 32 bit displacement, which is fine for every base but rsp and r12.
+ */
+static void emitMemory(Assembler* as, int reg, Register base, int32_t disp) {
+    emitByte(as, 0x80 | ((reg & 7) << 3) | (base & 7));
+    emitInt(as, (uint32_t)disp);
+}
+
+/**
+ * Method for emitting an instruction between two registers.
+ */
+static void emitRegisters(Assembler* as, uint8_t opcode, Register rm, Register reg) {
+    emitRex(as, true, reg, rm);
+    emitByte(as, opcode);
+    emitByte(as, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void emitLoad(Assembler* as, Register reg, Register base, int32_t disp) {
+    emitRex(as, true, reg, base);
+    emitByte(as, 0x8b);
+    emitMemory(as, reg, base, disp);
+}
+
+static void emitStore(Assembler* as, Register base, int32_t disp, Register reg) {
+    emitRex(as, true, reg, base);
+    emitByte(as, 0x89);
+    emitMemory(as, reg, base, disp);
+}
+
+static void emitMoveImmediate(Assembler* as, Register reg, uint64_t value) {
+    emitRex(as, true, 0, reg);
+    emitByte(as, 0xb8 + (reg & 7));
+    emitLong(as, value);
+}
+
+/**
+ * Method for adding to (or with subtract, taking from) rdx, the stack top.
+ */
+static void emitMoveTop(Assembler* as, int32_t values) {
+    if (values == 0) {
+        return;
+    }
+    bool subtract = values < 0;
+    emitRex(as, true, 0, RDX);
+    emitByte(as, 0x81);
+    emitByte(as, 0xc0 | ((subtract ? 5 : 0) << 3) | RDX);
+    emitInt(as, (uint32_t)((subtract ? -values : values) * VALUE_SIZE));
+}
+
+/**
+ * Method for emitting an SSE instruction with a memory operand.
+ */
+static void emitSSEMemory(Assembler* as, uint8_t prefix, uint8_t opcode, int xmm, Register base, int32_t disp) {
+    if (prefix != 0) {
+        emitByte(as, prefix);
+    }
+    emitByte(as, 0x0f);
+    emitByte(as, opcode);
+    emitMemory(as, xmm, base, disp);
+}
+
+/**
+ * Method for emitting an SSE instruction between two xmm registers.
+ */
+static void emitSSERegisters(Assembler* as, uint8_t prefix, uint8_t opcode, int dst, int src) {
+    emitByte(as, prefix);
+    emitByte(as, 0x0f);
+    emitByte(as, opcode);
+    emitByte(as, 0xc0 | (dst << 3) | src);
+}
+
+static void emitLoadNumber(Assembler* as, int xmm, Register base, int32_t disp) {
+    emitSSEMemory(as, 0xf2, 0x10, xmm, base, disp + NUMBER_OFFSET);
+}
+
+/**
+ * Method for loading a number known when compiling into an xmm register.
+ */
+static void emitNumberImmediate(Assembler* as, int xmm, double number) {
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    emitMoveImmediate(as, RAX, bits);
+    emitByte(as, 0x66);
+    emitRex(as, true, xmm, RAX);
+    emitByte(as, 0x0f);
+    emitByte(as, 0x6e);
+    emitByte(as, 0xc0 | (xmm << 3) | RAX);
+}
+
+#ifndef NAN_BOXING
+/**
+ * Method for storing a value's type.
+ *
+ * This writes the whole word the type is in, padding and all, so copying
+ * the value a word at a time later reads back just what was stored.
+ */
+static void emitStoreType(Assembler* as, Register base, int32_t disp, ValueType type) {
+    emitRex(as, true, 0, base);
+    emitByte(as, 0xc7);
+    emitMemory(as, 0, base, disp + (int32_t)offsetof(Value, type));
+    emitInt(as, type);
+}
+#endif
+
+/**
+ * Method for storing the number in an xmm register as a value.
+ */
+static void emitStoreNumber(Assembler* as, Register base, int32_t disp, int xmm) {
+#ifndef NAN_BOXING
+    emitStoreType(as, base, disp, VAL_NUMBER);
+#endif
+    emitSSEMemory(as, 0xf2, 0x11, xmm, base, disp + NUMBER_OFFSET);
+}
+
+/**
+ * Method for storing the bool in al as a value.
+ */
+static void emitStoreBool(Assembler* as, Register base, int32_t disp) {
+    // movzx eax, al
+    emitByte(as, 0x0f);
+    emitByte(as, 0xb6);
+    emitByte(as, 0xc0);
+#ifdef NAN_BOXING
+    emitMoveImmediate(as, RCX, FALSE_VAL);
+    emitRegisters(as, 0x01, RAX, RCX);
+    emitStore(as, base, disp, RAX);
+#else
+    emitStoreType(as, base, disp, VAL_BOOL);
+    emitStore(as, base, disp + (int32_t)offsetof(Value, as), RAX);
+#endif
+}
+
+/**
+ * Method for storing a value known when compiling.
+ */
+static void emitStoreValue(Assembler* as, Register base, int32_t disp, Value value) {
+    uint64_t words[sizeof(Value) / 8];
+    memset(words, 0, sizeof(words));
+    memcpy(words, &value, sizeof(Value));
+    for (size_t i = 0; i < sizeof(Value) / 8; i++) {
+        emitMoveImmediate(as, RAX, words[i]);
+        emitStore(as, base, disp + (int32_t)(i * 8), RAX);
+    }
+}
+
+/**
+ * Method for copying a value from one place to another.
+ */
+static void emitCopyValue(Assembler* as, Register dstBase, int32_t dstDisp, Register srcBase, int32_t srcDisp) {
+#ifdef NAN_BOXING
+    emitLoad(as, RAX, srcBase, srcDisp);
+    emitStore(as, dstBase, dstDisp, RAX);
+#else
+    // two words rather than one movups, so each load can be forwarded from the store that wrote it
+    emitLoad(as, RAX, srcBase, srcDisp);
+    emitStore(as, dstBase, dstDisp, RAX);
+    emitLoad(as, RAX, srcBase, srcDisp + 8);
+    emitStore(as, dstBase, dstDisp + 8, RAX);
+#endif
+}
+
+/**
+ * Method for emitting a jump (or with a condition, a branch) to the instruction at target.
+ *
+ * Targets outside the loop, and any target when leave is set, go back to the interpreter.
+ */
+static void emitJump(Assembler* as, Condition condition, int target, bool leave) {
+    if (condition == CC_ALWAYS) {
+        emitByte(as, 0xe9);
+    } else {
+        emitByte(as, 0x0f);
+        emitByte(as, 0x80 | condition);
+    }
+
+    if (as->fixupCount == as->fixupCapacity) {
+        as->fixupCapacity = as->fixupCapacity < 16 ? 16 : as->fixupCapacity * 2;
+        JumpFixup* fixups = (JumpFixup*)realloc(as->fixups, sizeof(JumpFixup) * as->fixupCapacity);
+        if (fixups == NULL) {
+            as->failed = true;
+            return;
+        }
+        as->fixups = fixups;
+    }
+    JumpFixup* fixup = &as->fixups[as->fixupCount++];
+    fixup->at = as->count;
+    fixup->target = target;
+    fixup->exit = leave || target < as->start || target >= as->end;
+    emitInt(as, 0);
+}
+
+/**
+ * Method for leaving for the interpreter at offset unless the value is a number.
+ *
+ * Doubles fall straight through, and an int branches to a stub that turns it
+ * into the double it stands for where it is, so everything after the guard only sees doubles.
+ */
+static void emitNumberGuard(Assembler* as, Register base, int32_t disp, int offset) {
+#ifdef NAN_BOXING
+    // r8 holds QNAN for the whole of the loop
+    emitLoad(as, RAX, base, disp);
+    emitRegisters(as, 0x21, RAX, R8);
+    emitRegisters(as, 0x39, RAX, R8);
+    emitByte(as, 0x0f);
+    emitByte(as, 0x80 | CC_EQUAL);
+#else
+    emitByte(as, 0x81);
+    emitMemory(as, 7, base, disp + (int32_t)offsetof(Value, type));
+    emitInt(as, VAL_NUMBER);
+    emitByte(as, 0x0f);
+    emitByte(as, 0x80 | CC_NOT_EQUAL);
+#endif
+    emitInt(as, 0);
+
+    if (as->stubCount == as->stubCapacity) {
+        as->stubCapacity = as->stubCapacity < 16 ? 16 : as->stubCapacity * 2;
+        IntStub* stubs = (IntStub*)realloc(as->stubs, sizeof(IntStub) * as->stubCapacity);
+        if (stubs == NULL) {
+            as->failed = true;
+            return;
+        }
+        as->stubs = stubs;
+    }
+    IntStub* stub = &as->stubs[as->stubCount++];
+    stub->at = as->count - 4;
+    stub->resume = as->count;
+    stub->base = base;
+    stub->disp = disp;
+    stub->offset = offset;
+}
+
+/**
+ * Method for emitting the number guards' stubs, each leaving for the interpreter if the value isn't an int either.
+ */
+static void emitIntStubs(Assembler* as) {
+    for (int i = 0; i < as->stubCount && !as->failed; i++) {
+        IntStub* stub = &as->stubs[i];
+        int32_t displacement = as->count - (stub->at + 4);
+        memcpy(as->code + stub->at, &displacement, sizeof(displacement));
+#ifdef NAN_BOXING
+        // shr rax, 32 of the value, then cmp eax, the int tag
+        emitLoad(as, RAX, stub->base, stub->disp);
+        emitByte(as, 0x48);
+        emitByte(as, 0xc1);
+        emitByte(as, 0xe8);
+        emitByte(as, 32);
+        emitByte(as, 0x3d);
+        emitInt(as, (uint32_t)((QNAN | INT_TAG) >> 32));
+#else
+        emitByte(as, 0x81);
+        emitMemory(as, 7, stub->base, stub->disp + (int32_t)offsetof(Value, type));
+        emitInt(as, VAL_INT);
+#endif
+        emitJump(as, CC_NOT_EQUAL, stub->offset, true);
+        // cvtsi2sd xmm0, dword [int], the guards come before anything else uses xmm0
+        emitSSEMemory(as, 0xf2, 0x2a, 0, stub->base, stub->disp + NUMBER_OFFSET);
+        emitStoreNumber(as, stub->base, stub->disp, 0);
+        emitByte(as, 0xe9);
+        emitInt(as, (uint32_t)(stub->resume - (as->count + 4)));
+    }
+}
+
+/**
+ * Method for leaving for the interpreter at offset if the value is empty, as an undefined global is.
+ */
+static void emitEmptyGuard(Assembler* as, Register base, int32_t disp, int offset) {
+#ifdef NAN_BOXING
+    emitLoad(as, RAX, base, disp);
+    emitMoveImmediate(as, R9, EMPTY_VAL);
+    emitRegisters(as, 0x39, RAX, R9);
+#else
+    emitByte(as, 0x81);
+    emitMemory(as, 7, base, disp + (int32_t)offsetof(Value, type));
+    emitInt(as, VAL_EMPTY);
+#endif
+    emitJump(as, CC_EQUAL, offset, true);
+}
+
+/**
+ * Method for loading the object a value holds into rcx, leaving for the interpreter at offset if it's anything else.
+ */
+static void emitObjectGuard(Assembler* as, Register base, int32_t disp, ObjType type, int offset) {
+#ifdef NAN_BOXING
+    emitLoad(as, RCX, base, disp);
+    emitRegisters(as, 0x89, RAX, RCX);
+    emitMoveImmediate(as, R9, SIGN_BIT | QNAN);
+    emitRegisters(as, 0x21, RAX, R9);
+    emitRegisters(as, 0x39, RAX, R9);
+    emitJump(as, CC_NOT_EQUAL, offset, true);
+    // pointers only use the low 48 bits, so shifting the tag out and back leaves the object
+    emitRex(as, true, 0, RCX);
+    emitByte(as, 0xc1);
+    emitByte(as, 0xc0 | (4 << 3) | RCX);
+    emitByte(as, 16);
+    emitRex(as, true, 0, RCX);
+    emitByte(as, 0xc1);
+    emitByte(as, 0xc0 | (5 << 3) | RCX);
+    emitByte(as, 16);
+#else
+    emitByte(as, 0x81);
+    emitMemory(as, 7, base, disp + (int32_t)offsetof(Value, type));
+    emitInt(as, VAL_OBJ);
+    emitJump(as, CC_NOT_EQUAL, offset, true);
+    emitLoad(as, RCX, base, disp + (int32_t)offsetof(Value, as));
+#endif
+    emitByte(as, 0x81);
+    emitMemory(as, 7, RCX, (int32_t)offsetof(Obj, type));
+    emitInt(as, type);
+    emitJump(as, CC_NOT_EQUAL, offset, true);
+}
+
+/**
+ * Method for calling remainder() on xmm0 and xmm1, keeping the registers the loop uses.
+ */
+static void emitRemainder(Assembler* as) {
+    static const uint8_t save[] = {
+        0x57, 0x56, 0x52, 0x41, 0x50,   // push rdi, rsi, rdx and r8
+        0x48, 0x83, 0xec, 0x08,         // sub rsp, 8 so the stack is aligned for the call
+    };
+    static const uint8_t restore[] = {
+        0x48, 0x83, 0xc4, 0x08,         // add rsp, 8
+        0x41, 0x58, 0x5a, 0x5e, 0x5f,   // pop r8, rdx, rsi and rdi
+    };
+    for (size_t i = 0; i < sizeof(save); i++) {
+        emitByte(as, save[i]);
+    }
+    double (*function)(double, double) = remainder;
+    emitMoveImmediate(as, RAX, (uint64_t)(uintptr_t)function);
+    // call rax
+    emitByte(as, 0xff);
+    emitByte(as, 0xd0);
+    for (size_t i = 0; i < sizeof(restore); i++) {
+        emitByte(as, restore[i]);
+    }
+}
+
+/**
+ * Method for applying an arithmetic opcode to xmm0 and xmm1, leaving the result in xmm0.
+ */
+static bool emitArithmetic(Assembler* as, uint8_t op) {
+    uint8_t opcode;
+    switch (op) {
+        case OP_ADD: opcode = 0x58; break;
+        case OP_SUBTRACT: opcode = 0x5c; break;
+        case OP_MULTIPLY: opcode = 0x59; break;
+        case OP_DIVIDE: opcode = 0x5e; break;
+        case OP_MODULO:
+            emitRemainder(as);
+            return true;
+        default: return false;
+    }
+    emitSSERegisters(as, 0xf2, opcode, 0, 1);
+    return true;
+}
+
+/**
+ * Method for comparing the top two numbers on the stack into al.
+ *
+ * The unordered result of comparing a NaN sets every flag ucomisd sets,
+ * so each condition here comes out false for it, as it does in C.
+ */
+static void emitComparison(Assembler* as, uint8_t op) {
+    bool swap = op == OP_LESS || op == OP_LESS_EQUAL;
+    emitLoadNumber(as, 0, RDX, (swap ? -1 : -2) * VALUE_SIZE);
+    emitLoadNumber(as, 1, RDX, (swap ? -2 : -1) * VALUE_SIZE);
+    emitSSERegisters(as, 0x66, 0x2e, 0, 1);
+
+    Condition condition;
+    switch (op) {
+        case OP_GREATER:
+        case OP_LESS:
+            condition = CC_ABOVE;
+            break;
+        case OP_GREATER_EQUAL:
+        case OP_LESS_EQUAL:
+            condition = CC_ABOVE_EQUAL;
+            break;
+        case OP_EQUAL:
+            condition = CC_EQUAL;
+            break;
+        default:
+            condition = CC_NOT_EQUAL;
+            break;
+    }
+    emitByte(as, 0x0f);
+    emitByte(as, 0x90 | condition);
+    emitByte(as, 0xc0 | RAX);
+
+    if (op == OP_EQUAL || op == OP_NOT_EQUAL) {
+        // and al with "not unordered" for ==, or it with "unordered" for !=
+        emitByte(as, 0x0f);
+        emitByte(as, 0x90 | (op == OP_EQUAL ? CC_NO_PARITY : CC_PARITY));
+        emitByte(as, 0xc0 | RCX);
+        emitByte(as, op == OP_EQUAL ? 0x20 : 0x08);
+        emitByte(as, 0xc0 | (RCX << 3) | RAX);
+    }
+}
+
+/**
+ * Method for branching on the bool on top of the stack, without popping it.
+ *
+ * Anything else is left to the interpreter, as it has its own truthiness.
+ */
+static void emitBranch(Assembler* as, bool ifTrue, int target, int offset) {
+#ifdef NAN_BOXING
+    emitLoad(as, RAX, RDX, -VALUE_SIZE);
+    emitMoveImmediate(as, RCX, ifTrue ? TRUE_VAL : FALSE_VAL);
+    emitRegisters(as, 0x39, RAX, RCX);
+    emitJump(as, CC_EQUAL, target, false);
+    emitMoveImmediate(as, RCX, ifTrue ? FALSE_VAL : TRUE_VAL);
+    emitRegisters(as, 0x39, RAX, RCX);
+    emitJump(as, CC_NOT_EQUAL, offset, true);
+#else
+    emitByte(as, 0x81);
+    emitMemory(as, 7, RDX, -VALUE_SIZE + (int32_t)offsetof(Value, type));
+    emitInt(as, VAL_BOOL);
+    emitJump(as, CC_NOT_EQUAL, offset, true);
+    emitByte(as, 0x80);
+    emitMemory(as, 7, RDX, -VALUE_SIZE + (int32_t)offsetof(Value, as));
+    emitByte(as, 0);
+    emitJump(as, ifTrue ? CC_NOT_EQUAL : CC_EQUAL, target, false);
+#endif
+}
+
+/**
+ * Method for loading the address a global array's values are kept at into rcx.
+ *
+ * The array can be reallocated as globals are added, so it's read each time.
+ */
+static void emitGlobals(Assembler* as, Value** values) {
+    emitMoveImmediate(as, RCX, (uint64_t)(uintptr_t)values);
+    emitLoad(as, RCX, RCX, 0);
+}
+
+/**
+ * Method for compiling the instruction at offset, returning its length or 0 if it can't be.
+ */
+static int compileInstruction(Assembler* as, int offset, int* pushes) {
+    Chunk* chunk = as->chunk;
+    uint8_t* code = chunk->code + offset;
+    int length = instructionLength(chunk, offset);
+
+    switch (code[0]) {
+        case OP_GET_LOCAL:
+            emitCopyValue(as, RDX, 0, RDI, code[1] * VALUE_SIZE);
+            emitMoveTop(as, 1);
+            *pushes += 1;
+            break;
+        case OP_GET_LOCAL_GET_LOCAL:
+            emitCopyValue(as, RDX, 0, RDI, code[1] * VALUE_SIZE);
+            emitCopyValue(as, RDX, VALUE_SIZE, RDI, code[2] * VALUE_SIZE);
+            emitMoveTop(as, 2);
+            *pushes += 2;
+            break;
+        case OP_SET_LOCAL:
+            emitCopyValue(as, RDI, code[1] * VALUE_SIZE, RDX, -VALUE_SIZE);
+            break;
+        case OP_GET_GLOBAL: {
+            int32_t slot = ((code[1] << 8) | code[2]) * VALUE_SIZE;
+            emitGlobals(as, &vm->globalValues.values);
+            emitEmptyGuard(as, RCX, slot, offset);
+            emitCopyValue(as, RDX, 0, RCX, slot);
+            emitMoveTop(as, 1);
+            *pushes += 1;
+            break;
+        }
+        case OP_SET_GLOBAL: {
+            int32_t slot = ((code[1] << 8) | code[2]) * VALUE_SIZE;
+            emitGlobals(as, &vm->globalFinals.values);
+#ifdef NAN_BOXING
+            emitLoad(as, RAX, RCX, slot);
+            emitMoveImmediate(as, R9, TRUE_VAL);
+            emitRegisters(as, 0x39, RAX, R9);
+            emitJump(as, CC_EQUAL, offset, true);
+#else
+            emitByte(as, 0x80);
+            emitMemory(as, 7, RCX, slot + (int32_t)offsetof(Value, as));
+            emitByte(as, 0);
+            emitJump(as, CC_NOT_EQUAL, offset, true);
+#endif
+            emitGlobals(as, &vm->globalValues.values);
+            emitEmptyGuard(as, RCX, slot, offset);
+            emitCopyValue(as, RCX, slot, RDX, -VALUE_SIZE);
+            break;
+        }
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG: {
+            // ints are pushed as the doubles they stand for, which is all the guards would turn them into
+            Value constant = chunk->constants.values[code[0] == OP_CONSTANT ? code[1] : (code[1] << 8) | code[2]];
+            emitStoreValue(as, RDX, 0, IS_INT(constant) ? NUMBER_VAL(AS_INT(constant)) : constant);
+            emitMoveTop(as, 1);
+            *pushes += 1;
+            break;
+        }
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+            emitStoreValue(as, RDX, 0, code[0] == OP_NIL ? NIL_VAL : BOOL_VAL(code[0] == OP_TRUE));
+            emitMoveTop(as, 1);
+            *pushes += 1;
+            break;
+        case OP_DUP:
+            emitCopyValue(as, RDX, 0, RDX, -VALUE_SIZE);
+            emitMoveTop(as, 1);
+            *pushes += 1;
+            break;
+        case OP_POP:
+            emitMoveTop(as, -1);
+            break;
+        case OP_POP_N:
+            emitMoveTop(as, -code[1]);
+            break;
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_MODULO:
+            emitNumberGuard(as, RDX, -2 * VALUE_SIZE, offset);
+            emitNumberGuard(as, RDX, -VALUE_SIZE, offset);
+            emitLoadNumber(as, 0, RDX, -2 * VALUE_SIZE);
+            emitLoadNumber(as, 1, RDX, -VALUE_SIZE);
+            emitArithmetic(as, code[0]);
+            emitStoreNumber(as, RDX, -2 * VALUE_SIZE, 0);
+            emitMoveTop(as, -1);
+            break;
+        case OP_NEGATE:
+            emitNumberGuard(as, RDX, -VALUE_SIZE, offset);
+            emitLoad(as, RAX, RDX, -VALUE_SIZE + NUMBER_OFFSET);
+            // btc rax, 63
+            emitByte(as, 0x48);
+            emitByte(as, 0x0f);
+            emitByte(as, 0xba);
+            emitByte(as, 0xf8);
+            emitByte(as, 63);
+            emitStore(as, RDX, -VALUE_SIZE + NUMBER_OFFSET, RAX);
+            break;
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_GREATER:
+        case OP_GREATER_EQUAL:
+        case OP_LESS:
+        case OP_LESS_EQUAL:
+            emitNumberGuard(as, RDX, -2 * VALUE_SIZE, offset);
+            emitNumberGuard(as, RDX, -VALUE_SIZE, offset);
+            emitComparison(as, code[0]);
+            emitStoreBool(as, RDX, -2 * VALUE_SIZE);
+            emitMoveTop(as, -1);
+            break;
+        case OP_INC_LOCAL: {
+            int32_t slot = code[1] * VALUE_SIZE;
+            emitNumberGuard(as, RDI, slot, offset);
+            emitLoadNumber(as, 0, RDI, slot);
+            emitNumberImmediate(as, 1, 1);
+            emitArithmetic(as, OP_ADD);
+            emitStoreNumber(as, RDI, slot, 0);
+            break;
+        }
+        case OP_LOCALS_ARITH:
+        case OP_LOCAL_CONSTANT_ARITH:
+        case OP_LOCALS_ARITH_SET:
+        case OP_LOCAL_CONSTANT_ARITH_SET: {
+            bool constant = code[0] == OP_LOCAL_CONSTANT_ARITH || code[0] == OP_LOCAL_CONSTANT_ARITH_SET;
+            if (constant && !IS_NUMBER(chunk->constants.values[code[3]])) {
+                // concatenating a string, which is always the interpreter's
+                emitJump(as, CC_ALWAYS, offset, true);
+                break;
+            }
+            emitNumberGuard(as, RDI, code[2] * VALUE_SIZE, offset);
+            if (!constant) {
+                emitNumberGuard(as, RDI, code[3] * VALUE_SIZE, offset);
+            }
+            emitLoadNumber(as, 0, RDI, code[2] * VALUE_SIZE);
+            if (constant) {
+                emitNumberImmediate(as, 1, AS_NUMBER(chunk->constants.values[code[3]]));
+            } else {
+                emitLoadNumber(as, 1, RDI, code[3] * VALUE_SIZE);
+            }
+            if (!emitArithmetic(as, code[1])) {
+                return 0;
+            }
+            if (code[0] == OP_LOCALS_ARITH_SET || code[0] == OP_LOCAL_CONSTANT_ARITH_SET) {
+                emitStoreNumber(as, RDI, code[4] * VALUE_SIZE, 0);
+            } else {
+                emitStoreNumber(as, RDX, 0, 0);
+                emitMoveTop(as, 1);
+                *pushes += 1;
+            }
+            break;
+        }
+        case OP_GET_INDEX:
+        case OP_GET_INDEX_LIST:
+            emitObjectGuard(as, RDX, -2 * VALUE_SIZE, OBJ_LIST, offset);
+            emitNumberGuard(as, RDX, -VALUE_SIZE, offset);
+            emitLoadNumber(as, 0, RDX, -VALUE_SIZE);
+            // cvttsd2si eax, xmm0, then an unsigned compare sends negative indexes to the interpreter too
+            emitByte(as, 0xf2);
+            emitByte(as, 0x0f);
+            emitByte(as, 0x2c);
+            emitByte(as, 0xc0);
+            emitByte(as, 0x3b);
+            emitMemory(as, RAX, RCX, (int32_t)offsetof(ObjList, count));
+            emitJump(as, CC_ABOVE_EQUAL, offset, true);
+            emitLoad(as, RCX, RCX, (int32_t)(offsetof(ObjList, values) + offsetof(ValueArray, values)));
+            // shl rax, log2(sizeof(Value)), then add rcx, rax
+            emitByte(as, 0x48);
+            emitByte(as, 0xc1);
+            emitByte(as, 0xe0);
+            emitByte(as, VALUE_SIZE == 16 ? 4 : 3);
+            emitRegisters(as, 0x01, RCX, RAX);
+            emitCopyValue(as, RDX, -2 * VALUE_SIZE, RCX, 0);
+            emitMoveTop(as, -1);
+            break;
+        case OP_CALL:
+            // only len() of a list, which loop conditions are full of, everything else is left to the interpreter
+            if (code[1] != 1) {
+                return 0;
+            }
+            emitObjectGuard(as, RDX, -2 * VALUE_SIZE, OBJ_NATIVE, offset);
+            emitMoveImmediate(as, RAX, (uint64_t)(uintptr_t)lenNative);
+            emitRex(as, true, RAX, RCX);
+            emitByte(as, 0x39);
+            emitMemory(as, RAX, RCX, (int32_t)offsetof(ObjNative, function));
+            emitJump(as, CC_NOT_EQUAL, offset, true);
+            emitObjectGuard(as, RDX, -VALUE_SIZE, OBJ_LIST, offset);
+            // cvtsi2sd xmm0, dword [rcx + count]
+            emitSSEMemory(as, 0xf2, 0x2a, 0, RCX, (int32_t)offsetof(ObjList, count));
+            emitStoreNumber(as, RDX, -2 * VALUE_SIZE, 0);
+            emitMoveTop(as, -1);
+            break;
+        case OP_JUMP:
+            emitJump(as, CC_ALWAYS, offset + 3 + ((code[1] << 8) | code[2]), false);
+            break;
+        case OP_LOOP:
+            emitJump(as, CC_ALWAYS, offset + 3 - ((code[1] << 8) | code[2]), false);
+            break;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+            emitBranch(as, code[0] == OP_JUMP_IF_TRUE, offset + 3 + ((code[1] << 8) | code[2]), offset);
+            break;
+        case OP_LESS_JUMP:
+            emitNumberGuard(as, RDX, -2 * VALUE_SIZE, offset);
+            emitNumberGuard(as, RDX, -VALUE_SIZE, offset);
+            emitLoadNumber(as, 0, RDX, -VALUE_SIZE);
+            emitLoadNumber(as, 1, RDX, -2 * VALUE_SIZE);
+            emitMoveTop(as, -2);
+            emitSSERegisters(as, 0x66, 0x2e, 0, 1);
+            emitJump(as, CC_BELOW_EQUAL, offset + 3 + ((code[1] << 8) | code[2]), false);
+            break;
+        default:
+            return 0;
+    }
+    return length;
+}
+
+/**
+ * Method for placing the loop's code in executable memory.
+ */
+static void installCode(Assembler* as, JitLoop* loop) {
+    size_t size = (size_t)as->count;
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return;
+    }
+    memcpy(memory, as->code, size);
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return;
+    }
+    // the POSIX way of turning a data pointer into a function pointer
+    *(void**)(&loop->code) = memory;
+    loop->size = size;
+}
+
+/**
+ * Method for finding where the code to compile for a loop starts.
+ *
+ * That's usually where its back edge goes, but a for loop's increment is
+ * jumped back to and then jumps back again to the condition before it,
+ * so the code is widened to take in any loop inside it that goes further back.
+ */
+static int loopStart(Chunk* chunk, JitLoop* loop) {
+    int start = loop->start;
+    bool widened = true;
+    while (widened) {
+        widened = false;
+        for (int offset = start; offset < loop->end;) {
+            uint8_t* code = chunk->code + offset;
+            if (code[0] == OP_LOOP && offset + 3 - ((code[1] << 8) | code[2]) < start) {
+                start = offset + 3 - ((code[1] << 8) | code[2]);
+                widened = true;
+                break;
+            }
+            offset += instructionLength(chunk, offset);
+        }
+    }
+    return start;
+}
+
+/**
+ * Method for compiling a loop, leaving its code NULL if it has anything that can't be.
+ */
+static void compileLoop(Chunk* chunk, JitLoop* loop) {
+    Assembler as;
+    as.chunk = chunk;
+    as.start = loopStart(chunk, loop);
+    as.end = loop->end;
+    as.code = NULL;
+    as.count = 0;
+    as.capacity = 0;
+    as.labels = (int*)malloc(sizeof(int) * (as.end - as.start));
+    as.fixups = NULL;
+    as.fixupCount = 0;
+    as.fixupCapacity = 0;
+    as.stubs = NULL;
+    as.stubCount = 0;
+    as.stubCapacity = 0;
+    as.failed = as.labels == NULL;
+
+    // mov rdx, [rsi]
+    emitLoad(&as, RDX, RSI, 0);
+#ifdef NAN_BOXING
+    emitMoveImmediate(&as, R8, QNAN);
+#endif
+    emitJump(&as, CC_ALWAYS, loop->start, false);
+
+    int pushes = 0;
+    for (int offset = as.start; offset < as.end && !as.failed;) {
+        as.labels[offset - as.start] = as.count;
+        int length = compileInstruction(&as, offset, &pushes);
+        if (length == 0) {
+            as.failed = true;
+            break;
+        }
+        for (int i = 1; i < length; i++) {
+            as.labels[offset - as.start + i] = -1;
+        }
+        offset += length;
+    }
+
+    emitIntStubs(&as);
+
+    // each exit stores the stack top back and returns where to carry on
+    for (int i = 0; i < as.fixupCount && !as.failed; i++) {
+        JumpFixup* fixup = &as.fixups[i];
+        int to;
+        if (fixup->exit) {
+            to = as.count;
+            emitStore(&as, RSI, 0, RDX);
+            emitByte(&as, 0xb8);
+            emitInt(&as, (uint32_t)fixup->target);
+            emitByte(&as, 0xc3);
+        } else {
+            to = as.labels[fixup->target - as.start];
+            if (to < 0) {
+                as.failed = true;
+                break;
+            }
+        }
+        int32_t displacement = to - (fixup->at + 4);
+        memcpy(as.code + fixup->at, &displacement, sizeof(displacement));
+    }
+
+    if (!as.failed) {
+        loop->pushes = pushes;
+        installCode(&as, loop);
+    }
+    free(as.code);
+    free(as.labels);
+    free(as.fixups);
+    free(as.stubs);
+}
+
+#else
+
+static void compileLoop(Chunk* chunk, JitLoop* loop) {
+}
+
+#endif
+
+/**
+ * Implementation of method to take a loop's back edge.
+ */
+uint8_t* enterLoop(Chunk* chunk, uint8_t* start, uint8_t* end, Value* slots) {
+    JitLoop* loop = findLoop(chunk, (int)(start - chunk->code), (int)(end - chunk->code));
+    if (loop->code == NULL) {
+        if (loop->failed || ++loop->count < JIT_THRESHOLD) {
+            return start;
+        }
+        compileLoop(chunk, loop);
+        if (loop->code == NULL) {
+            loop->failed = true;
+            return start;
+        }
+    }
+
+    // the code pushes without checking, and growing the stack here would move the slots from under it
+    if (vm->stackLimit - vm->stackTop < loop->pushes + STACK_SLACK) {
+        return start;
+    }
+    return chunk->code + loop->code(slots, &vm->stackTop);
+}
+
+/**
+ * Implementation of method to free a chunk's loops.
+ */
+void freeJitLoops(Chunk* chunk) {
+#ifdef SLO_JIT
+    for (int i = 0; i < chunk->loopCount; i++) {
+        if (chunk->loops[i].code != NULL) {
+            munmap(*(void**)(&chunk->loops[i].code), chunk->loops[i].size);
+        }
+    }
+#endif
+    FREE_ARRAY(JitLoop, chunk->loops, chunk->loopCapacity);
+}
@@ -1,22 +1,54 @@
 /**
  * @file loader.c
  * @brief Implementation of the module loader for CSLO.
+ *
+ * Every module is loaded once and kept in vm->modules by name, so importing
+ * it again just binds the existing module. Modules written in slo are
+ * compiled into their own namespace: each global they define is named
+ * "module.name" and the ObjModule maps the plain names to those slots.
+ * Native extensions are shared libraries that hand over a NativeDef array,
+ * the same as the standard library modules use.
+ *
+ * When a bundle is being run, the modules in it are loaded from there rather
+ * than from their files. compileBundle() makes one by following the imports
+ * of a script through every module they reach.
+ *
+ * When a script's run from a file, a precompiler follows its imports the
+ * same way while it runs, compiling each module on a pool of threads. The
+ * modules are packed as they would be to send to another thread, and
+ * unpacked when they're imported.
  */
 
+#define _XOPEN_SOURCE 700
+
+#include <dlfcn.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "compiler/compiler.h"
+#include "core/bytecode.h"
+#include "core/chunk.h"
+#include "core/extension.h"
+#include "core/gc.h"
 #include "core/loader.h"
+#include "core/probes.h"
 #include "core/value.h"
 #include "core/vm.h"
 
 // add all the std library imports here
+#include "std/async.h"
+#include "std/cache.h"
+#include "std/gc.h"
+#include "std/io.h"
 #include "std/json.h"
 #include "std/math.h"
+#include "std/net.h"
 #include "std/os.h"
 #include "std/random.h"
+#include "std/thread.h"
 
 typedef struct {
     const char* name;
@@ -31,121 +63,732 @@ NativeModule nativeModules[] = {
     {"random", getRandomModule},
     {"os", getOSModule},
     {"json", getJsonModule},
+    {"async", getAsyncModule},
+    {"net", getNetModule},
+    {"thread", getThreadModule},
+    {"gc", getGCModule},
+    {"io", getIOModule},
+    {"cache", getCacheModule},
     {NULL, NULL}
 };
 
-static char* findModule(const char* moduleName) {
-    // check current directory first
-    // malloc for name + '.slo\0'
-    char* localPath = malloc(strlen(moduleName) + 5);
-    if (localPath == NULL) {
-        fprintf(stderr, "Memory allocation failed for module path.\n");
+/**
+ * Method for checking whether a module's one of the standard library's native modules.
+ */
+static bool isNativeModule(ObjString* name) {
+    for (int i = 0; nativeModules[i].name != NULL; i++) {
+        if (strcmp(nativeModules[i].name, name->chars) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Method for checking for "<directory>/<name><suffix>" and returning its canonical path.
+ *
+ * The caller is responsible for freeing the returned path.
+ */
+static char* tryModulePath(const char* directory, int directoryLength, const char* moduleName, const char* suffix) {
+    size_t length = directoryLength + strlen(moduleName) + strlen(suffix) + 2;
+    char* path = malloc(length);
+    if (path == NULL) {
         return NULL;
     }
-    sprintf(localPath, "%s.slo", moduleName);
-    printf("Trying local path: %s\n", localPath);
-    // check if path exists
-    FILE* file = fopen(localPath, "r");
-    if (file != NULL) {
-        printf("Found module at local path: %s\n", localPath);
-        fclose(file);
-        return localPath;
+    snprintf(path, length, "%.*s/%s%s", directoryLength, directory, moduleName, suffix);
+    char* canonical = realpath(path, NULL);
+    free(path);
+    return canonical;
+}
+
+/**
+ * Method for finding a module's file, either its source (".slo") or a native extension (".so").
+ *
+ * Looks next to the importing file first, then in the current directory,
+ * then in SLO_PATH (or /usr/bin/slo/lib).
+ */
+static char* findModule(const char* moduleName, ObjString* importer, const char* suffix) {
+    if (importer != NULL) {
+        const char* slash = strrchr(importer->chars, '/');
+        if (slash != NULL) {
+            char* path = tryModulePath(importer->chars, (int)(slash - importer->chars), moduleName, suffix);
+            if (path != NULL) {
+                return path;
+            }
+        }
     }
-    free(localPath);
 
-    // check lib directory
-    char* value = getenv("SLO_PATH");
-    if (value == NULL) {
-        value = "/usr/bin/slo/lib";
+    char* path = tryModulePath(".", 1, moduleName, suffix);
+    if (path != NULL) {
+        return path;
     }
-    printf("%s\n", value);
-    char* libPath = malloc(strlen(value) + strlen(moduleName) + 6);
+
+    const char* libPath = getenv("SLO_PATH");
     if (libPath == NULL) {
-        fprintf(stderr, "Memory allocation failed for module path.\n");
-        return NULL;
-    }
-    sprintf(libPath, "%s/%s.slo", value, moduleName);
-    printf("Trying lib path: %s\n", libPath);
-    // check if path exists
-    FILE* libFile = fopen(libPath, "r");
-    if (libFile != NULL) {
-        printf("Found module at lib path: %s\n", libPath);
-        fclose(libFile);
-        return libPath;
+        libPath = "/usr/bin/slo/lib";
     }
-    free(libPath);
-    return NULL;
+    return tryModulePath(libPath, (int)strlen(libPath), moduleName, suffix);
 }
 
-static bool loadFileModule(const char* path) {
-    // read the file object
+/**
+ * Method for reading a module's source in.
+ *
+ * The caller is responsible for freeing the returned source.
+ */
+static char* readModuleSource(const char* path) {
     FILE* file = fopen(path, "rb");
-    if (!file) return NULL;
+    if (file == NULL) {
+        return NULL;
+    }
     fseek(file, 0, SEEK_END);
-    size_t size = ftell(file);
+    long size = ftell(file);
     rewind(file);
 
-    char* buffer = malloc(size + 1);
-    if (!buffer) {
+    char* source = size >= 0 ? malloc(size + 1) : NULL;
+    if (source == NULL || fread(source, 1, size, file) != (size_t)size) {
+        free(source);
         fclose(file);
-        return false;
+        return NULL;
     }
-    fread(buffer, 1, size, file);
-    buffer[size] = '\0';
+    source[size] = '\0';
     fclose(file);
+    return source;
+}
 
-    InterpretResult result = interpret(buffer, path);
-    free(buffer);
+/**
+ * Method for compiling a module, or loading it from the bytecode cache if that's on.
+ */
+static ObjFunction* compileModuleSource(const char* source, const char* path, ObjString* name) {
+    if (!vm->bytecodeCache) {
+        return compileModule(source, path, name);
+    }
 
-    if (result != INTERPRET_OK) {
-        return false;
+    ObjFunction* function = readBytecode(path, source, name);
+    if (function == NULL) {
+        function = compileModule(source, path, name);
+        if (function != NULL) {
+            push(OBJ_VAL(function));
+            // failing to write the cache just means the next run compiles again
+            writeBytecode(function, path, source);
+            pop();
+        }
     }
+    return function;
+}
 
-    return true;
+/**
+ * @enum PrecompileState
+ */
+typedef enum PrecompileState {
+    PRECOMPILE_QUEUED,
+    PRECOMPILE_COMPILING,
+    PRECOMPILE_DONE,
+    // imported, or being compiled by the thread importing it
+    PRECOMPILE_TAKEN,
+} PrecompileState;
+
+/**
+ * @struct PrecompiledModule
+ *
+ * Everything but its state is only touched by the thread compiling it until it's done.
+ */
+typedef struct PrecompiledModule {
+    struct PrecompiledModule* next;
+    PrecompileState state;
+    char* name;
+    // the file of the first module seen importing it, which it's looked for next to
+    char* importer;
+    // where it was found, and its source, kept to write it to the bytecode cache
+    char* path;
+    char* source;
+    // NULL if it wasn't found, didn't compile or is in the bytecode cache
+    uint8_t* packed;
+    size_t size;
+} PrecompiledModule;
+
+typedef struct Precompiler Precompiler;
+
+/**
+ * @struct Precompiler
+ */
+struct Precompiler {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    // in the order they were found, so they're compiled in about the order they're imported
+    PrecompiledModule* modules;
+    PrecompiledModule* last;
+    // modules being compiled whose imports haven't been queued yet, so idle threads wait for them
+    int compiling;
+    bool stopping;
+    bool bytecodeCache;
+    int threadCount;
+    pthread_t* threads;
+};
+
+/**
+ * Method for finding a module the precompiler's seen, with its lock held.
+ */
+static PrecompiledModule* findPrecompiled(Precompiler* precompiler, const char* name) {
+    for (PrecompiledModule* module = precompiler->modules; module != NULL; module = module->next) {
+        if (strcmp(module->name, name) == 0) {
+            return module;
+        }
+    }
+    return NULL;
 }
 
 /**
- * @brief Loads a module by its name.
+ * Method for queueing a module to compile, unless it's already been seen.
  */
-bool loadModule(const char* moduleName, const char* nickName) {
-    Value moduleVal = NIL_VAL;
-    ObjString* canonicalName = copyString(moduleName, strlen(moduleName));
+static void queueModule(Precompiler* precompiler, ObjString* name, const char* importer) {
+    pthread_mutex_lock(&precompiler->lock);
+    if (findPrecompiled(precompiler, name->chars) == NULL) {
+        PrecompiledModule* module = (PrecompiledModule*)calloc(1, sizeof(PrecompiledModule));
+        if (module == NULL) exit(1);
+        module->state = PRECOMPILE_QUEUED;
+        module->name = strdup(name->chars);
+        module->importer = strdup(importer);
+        if (module->name == NULL || module->importer == NULL) exit(1);
+        if (precompiler->last == NULL) {
+            precompiler->modules = module;
+        } else {
+            precompiler->last->next = module;
+        }
+        precompiler->last = module;
+        pthread_cond_broadcast(&precompiler->changed);
+    }
+    pthread_mutex_unlock(&precompiler->lock);
+}
 
-    if (tableGet(&vm.globals, OBJ_VAL(canonicalName), &moduleVal)) {
-        tableSet(&vm.globals, OBJ_VAL(copyString(nickName, strlen(nickName))), moduleVal);
-        return true;
+/**
+ * Method for queueing every module a function imports that might be a .slo file.
+ */
+static void queueImports(Precompiler* precompiler, ObjFunction* function, const char* importer) {
+    Chunk* chunk = &function->chunk;
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value constant = chunk->constants.values[i];
+        if (IS_FUNCTION(constant)) {
+            queueImports(precompiler, AS_FUNCTION(constant), importer);
+        }
+    }
+
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        if (chunk->code[offset] != OP_IMPORT) {
+            continue;
+        }
+        ObjString* name = AS_STRING(chunk->constants.values[(chunk->code[offset + 1] << 8) | chunk->code[offset + 2]]);
+        if (!isNativeModule(name)) {
+            queueModule(precompiler, name, importer);
+        }
+    }
+}
+
+/**
+ * Method for compiling a module on a precompiler's thread and packing it, queueing what it imports.
+ */
+static void precompileModule(Precompiler* precompiler, PrecompiledModule* module) {
+    ObjString* importer = copyString(module->importer, (int)strlen(module->importer));
+    push(OBJ_VAL(importer));
+    module->path = findModule(module->name, importer, ".slo");
+    pop();
+    module->source = module->path != NULL ? readModuleSource(module->path) : NULL;
+    if (module->source == NULL) {
+        return;
+    }
+
+    ObjString* name = copyString(module->name, (int)strlen(module->name));
+    push(OBJ_VAL(name));
+    // a cached module is as quick to read again when it's imported as to unpack, so it's only followed
+    ObjFunction* function = vm->bytecodeCache ? readBytecode(module->path, module->source, name) : NULL;
+    bool cached = function != NULL;
+    if (function == NULL) {
+        function = compileModule(module->source, module->path, name);
+    }
+    if (function != NULL) {
+        push(OBJ_VAL(function));
+        if (!cached) {
+            module->packed = packFunction(function, &module->size);
+        }
+        queueImports(precompiler, function, module->path);
+        pop();
+    }
+    pop();
+}
+
+/**
+ * Method for taking the next queued module, with the precompiler's lock held.
+ */
+static PrecompiledModule* nextQueued(Precompiler* precompiler) {
+    for (PrecompiledModule* module = precompiler->modules; module != NULL; module = module->next) {
+        if (module->state == PRECOMPILE_QUEUED) {
+            return module;
+        }
     }
+    return NULL;
+}
+
+/**
+ * Method for running one of a precompiler's threads in its own VM.
+ *
+ * It stops once there's nothing left queued or being compiled that could queue more.
+ */
+static void* runPrecompiler(void* argument) {
+    Precompiler* precompiler = (Precompiler*)argument;
+    VM* instance = (VM*)malloc(sizeof(VM));
+    if (instance == NULL) exit(1);
+    initVM(instance);
+    vm->bytecodeCache = precompiler->bytecodeCache;
+    vm->quietErrors = true;
+
+    pthread_mutex_lock(&precompiler->lock);
+    while (!precompiler->stopping) {
+        PrecompiledModule* module = nextQueued(precompiler);
+        if (module == NULL) {
+            if (precompiler->compiling == 0) {
+                break;
+            }
+            pthread_cond_wait(&precompiler->changed, &precompiler->lock);
+            continue;
+        }
+        module->state = PRECOMPILE_COMPILING;
+        precompiler->compiling++;
+        pthread_mutex_unlock(&precompiler->lock);
 
+        precompileModule(precompiler, module);
+
+        pthread_mutex_lock(&precompiler->lock);
+        module->state = PRECOMPILE_DONE;
+        precompiler->compiling--;
+        pthread_cond_broadcast(&precompiler->changed);
+    }
+    pthread_mutex_unlock(&precompiler->lock);
+
+    freeVM();
+    free(instance);
+    return NULL;
+}
+
+/**
+ * Implementation of method for starting to compile a script's imports ahead.
+ */
+void startPrecompiling(ObjFunction* script) {
+    if (vm->importThreads < 1 || vm->precompiler != NULL || script->file == NULL) {
+        return;
+    }
+    Precompiler* precompiler = (Precompiler*)calloc(1, sizeof(Precompiler));
+    if (precompiler == NULL) {
+        return;
+    }
+    pthread_mutex_init(&precompiler->lock, NULL);
+    pthread_cond_init(&precompiler->changed, NULL);
+    precompiler->bytecodeCache = vm->bytecodeCache;
+    vm->precompiler = precompiler;
+
+    queueImports(precompiler, script, script->file->chars);
+    if (precompiler->modules != NULL) {
+        precompiler->threads = (pthread_t*)malloc(sizeof(pthread_t) * vm->importThreads);
+        if (precompiler->threads == NULL) exit(1);
+        while (precompiler->threadCount < vm->importThreads
+                && pthread_create(&precompiler->threads[precompiler->threadCount], NULL, runPrecompiler, precompiler) == 0) {
+            precompiler->threadCount++;
+        }
+    }
+}
+
+/**
+ * Implementation of method for stopping the precompiler.
+ */
+void stopPrecompiling() {
+    Precompiler* precompiler = vm->precompiler;
+    if (precompiler == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&precompiler->lock);
+    precompiler->stopping = true;
+    pthread_cond_broadcast(&precompiler->changed);
+    pthread_mutex_unlock(&precompiler->lock);
+    for (int i = 0; i < precompiler->threadCount; i++) {
+        pthread_join(precompiler->threads[i], NULL);
+    }
+
+    PrecompiledModule* module = precompiler->modules;
+    while (module != NULL) {
+        PrecompiledModule* next = module->next;
+        free(module->name);
+        free(module->importer);
+        free(module->path);
+        free(module->source);
+        free(module->packed);
+        free(module);
+        module = next;
+    }
+    pthread_mutex_destroy(&precompiler->lock);
+    pthread_cond_destroy(&precompiler->changed);
+    free(precompiler->threads);
+    free(precompiler);
+    vm->precompiler = NULL;
+}
+
+/**
+ * Method for taking a module that's been compiled ahead, waiting for it if it's being compiled.
+ *
+ * Returns NULL if it has to be compiled here, claiming it first if it was
+ * still queued so its imports are queued once it's compiled.
+ */
+static ObjFunction* takePrecompiledModule(ObjString* name, const char* path, bool* claimed) {
+    Precompiler* precompiler = vm->precompiler;
+    *claimed = false;
+    if (precompiler == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&precompiler->lock);
+    PrecompiledModule* module = findPrecompiled(precompiler, name->chars);
+    if (module == NULL || module->state == PRECOMPILE_TAKEN) {
+        pthread_mutex_unlock(&precompiler->lock);
+        return NULL;
+    }
+    if (module->state == PRECOMPILE_QUEUED) {
+        // it's quicker to compile it here than to wait for a thread to get to it
+        module->state = PRECOMPILE_TAKEN;
+        precompiler->compiling++;
+        *claimed = true;
+        pthread_mutex_unlock(&precompiler->lock);
+        return NULL;
+    }
+    while (module->state == PRECOMPILE_COMPILING) {
+        pthread_cond_wait(&precompiler->changed, &precompiler->lock);
+    }
+    module->state = PRECOMPILE_TAKEN;
+    pthread_mutex_unlock(&precompiler->lock);
+
+    ObjFunction* function = NULL;
+    // modules are looked for next to what imports them, so it may have been found somewhere else
+    if (module->packed != NULL && strcmp(module->path, path) == 0) {
+        function = unpackFunction(module->packed, module->size);
+        if (function != NULL && vm->bytecodeCache) {
+            push(OBJ_VAL(function));
+            writeBytecode(function, path, module->source);
+            pop();
+        }
+    }
+    free(module->source);
+    free(module->packed);
+    module->source = NULL;
+    module->packed = NULL;
+    return function;
+}
+
+/**
+ * Method for queueing what a module claimed from the precompiler imports, once it's been compiled here.
+ */
+static void releaseClaimedModule(ObjFunction* function, const char* path) {
+    Precompiler* precompiler = vm->precompiler;
+    if (function != NULL) {
+        queueImports(precompiler, function, path);
+    }
+    pthread_mutex_lock(&precompiler->lock);
+    precompiler->compiling--;
+    pthread_cond_broadcast(&precompiler->changed);
+    pthread_mutex_unlock(&precompiler->lock);
+}
+
+/**
+ * Method for compiling a module's file, unless it's been compiled ahead.
+ */
+static ObjFunction* compileFileModule(const char* path, ObjString* name) {
+    bool claimed;
+    ObjFunction* function = takePrecompiledModule(name, path, &claimed);
+    if (function != NULL) {
+        return function;
+    }
+
+    char* source = readModuleSource(path);
+    function = source != NULL ? compileModuleSource(source, path, name) : NULL;
+    free(source);
+    if (claimed) {
+        releaseClaimedModule(function, path);
+    }
+    return function;
+}
+
+/**
+ * Method for pointing a module at each global its code uses.
+ *
+ * This is done before the module runs so a module that is imported again
+ * while it's still loading (a circular import) sees each name once it's defined.
+ */
+static void exportModuleGlobals(ObjModule* module) {
+    ObjString* name = module->name;
+    for (int slot = 0; slot < vm->globalNames.count; slot++) {
+        ObjString* global = AS_STRING(vm->globalNames.values[slot]);
+        if (global->length <= name->length || global->chars[name->length] != '.'
+                || memcmp(global->chars, name->chars, name->length) != 0) {
+            continue;
+        }
+        const char* base = global->chars + name->length + 1;
+        ObjString* export = copyString(base, global->length - name->length - 1);
+        push(OBJ_VAL(export));
+        tableSet(&module->methods, OBJ_VAL(export), NUMBER_VAL((double)slot));
+        writeBarrier((Obj*)module, OBJ_VAL(export));
+        pop();
+    }
+}
+
+/**
+ * Method for registering a module written in slo before it runs,
+ * so circular imports get this module rather than recursing.
+ */
+static ObjModule* registerFileModule(ObjString* name) {
+    ObjModule* module = newModule();
+    module->name = name;
+    module->fromFile = true;
+    push(OBJ_VAL(module));
+    tableSet(&vm->modules, OBJ_VAL(name), OBJ_VAL(module));
+    pop();
+    return module;
+}
+
+/**
+ * Method for running a registered module's compiled code, which defines its globals.
+ *
+ * The module's unregistered again if it has no code or fails while running.
+ */
+static ObjModule* runFileModule(ObjModule* module, ObjFunction* function) {
+    ObjString* name = module->name;
+    if (function == NULL) {
+        tableDelete(&vm->modules, OBJ_VAL(name));
+        return NULL;
+    }
+
+    push(OBJ_VAL(function));
+    exportModuleGlobals(module);
+    ObjClosure* closure = newClosure(function);
+    pop();
+
+    Value result;
+    if (!callFunction(OBJ_VAL(closure), 0, NULL, &result)) {
+        tableDelete(&vm->modules, OBJ_VAL(name));
+        return NULL;
+    }
+    return module;
+}
+
+/**
+ * Method for loading a module from a .slo file.
+ */
+static ObjModule* loadFileModule(const char* path, ObjString* name) {
+    ObjModule* module = registerFileModule(name);
+    return runFileModule(module, compileFileModule(path, name));
+}
+
+/**
+ * Method for loading a module from the bundle being run.
+ */
+static ObjModule* loadBundledModule(ObjString* name) {
+    ObjModule* module = registerFileModule(name);
+    return runFileModule(module, readBundledFunction(name));
+}
+
+/**
+ * Method for loading a native extension from a shared library.
+ *
+ * The library is never closed as the natives it defines can be referenced
+ * until the VM exits.
+ */
+static ObjModule* loadExtensionModule(const char* path, ObjString* name) {
+    void* library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (library == NULL) {
+        fprintf(stderr, "Could not load extension \"%s\": %s\n", path, dlerror());
+        return NULL;
+    }
+
+    SloExtensionInitFn init;
+    // the POSIX way of getting a function pointer back from dlsym
+    *(void**)(&init) = dlsym(library, SLO_EXTENSION_INIT);
+    SloExtension* extension = init != NULL ? init() : NULL;
+    if (extension == NULL || extension->abiVersion != SLO_EXTENSION_ABI
+            || extension->valueSize != (int)sizeof(Value) || extension->natives == NULL) {
+        fprintf(stderr, "Extension \"%s\" wasn't built for this version of slo.\n", path);
+        dlclose(library);
+        return NULL;
+    }
+
+    ObjModule* module = newModule();
+    module->name = name;
+    module->natives = extension->natives;
+    push(OBJ_VAL(module));
+    tableSet(&vm->modules, OBJ_VAL(name), OBJ_VAL(module));
+    pop();
+    return module;
+}
+
+/**
+ * @brief Finds a module that isn't loaded yet and loads it.
+ */
+static ObjModule* findAndLoadModule(ObjString* name, ObjString* importer) {
     for (int i = 0; nativeModules[i].name != NULL; i++) {
-        if (strcmp(nativeModules[i].name, moduleName) == 0) {
-            moduleVal = OBJ_VAL(nativeModules[i].initFunc(&vm));
-            break;
+        if (strcmp(nativeModules[i].name, name->chars) == 0) {
+            ObjModule* native = nativeModules[i].initFunc(vm);
+            native->name = name;
+            push(OBJ_VAL(native));
+            tableSet(&vm->modules, OBJ_VAL(name), OBJ_VAL(native));
+            pop();
+            return native;
         }
     }
 
-    if (!IS_NIL(moduleVal)) {
-        tableSet(&vm.globals, OBJ_VAL(canonicalName), moduleVal);
-        tableSet(&vm.globals, OBJ_VAL(copyString(nickName, strlen(nickName))), moduleVal);
-        return true;
+    if (isBundled(name)) {
+        return loadBundledModule(name);
     }
-    return false;
 
-    // commenting out our loading local modules for now
-    // couldn't find a native module - look for named module
-    if (IS_NIL(moduleVal)) {
+    char* path = findModule(name->chars, importer, ".slo");
+    if (path != NULL) {
+        ObjModule* module = loadFileModule(path, name);
+        free(path);
+        return module;
+    }
+    path = findModule(name->chars, importer, ".so");
+    if (path != NULL) {
+        ObjModule* module = loadExtensionModule(path, name);
+        free(path);
+        return module;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Loads a module by its name.
+ */
+ObjModule* loadModule(ObjString* name, ObjString* importer) {
+    Value loaded;
+    if (tableGet(&vm->modules, OBJ_VAL(name), &loaded)) {
+        return AS_MODULE(loaded);
+    }
 
-        char* path = findModule(moduleName);
-        if (path == NULL) {
+    PROBE_MODULE_LOAD_START(name->chars, importer != NULL ? importer->chars : "<script>");
+    ObjModule* module = findAndLoadModule(name, importer);
+    PROBE_MODULE_LOAD_DONE(name->chars, module != NULL);
+    return module;
+}
+
+/**
+ * @brief Registers a .slo module whose globals have already been defined.
+ */
+ObjModule* adoptFileModule(ObjString* name) {
+    Value existing;
+    if (tableGet(&vm->modules, OBJ_VAL(name), &existing)) {
+        return AS_MODULE(existing);
+    }
+
+    ObjModule* module = newModule();
+    module->name = name;
+    module->fromFile = true;
+    push(OBJ_VAL(module));
+    tableSet(&vm->modules, OBJ_VAL(name), OBJ_VAL(module));
+    exportModuleGlobals(module);
+    pop();
+    return module;
+}
+
+/**
+ * Method for compiling every module a function imports, and the ones they import, into bundled.
+ *
+ * bundled maps each module's name to its compiled function, and is rooted by the caller.
+ */
+static bool bundleImports(ObjFunction* function, ObjDict* bundled) {
+    Chunk* chunk = &function->chunk;
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value constant = chunk->constants.values[i];
+        if (IS_FUNCTION(constant) && !bundleImports(AS_FUNCTION(constant), bundled)) {
             return false;
         }
+    }
+
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        if (chunk->code[offset] != OP_IMPORT) {
+            continue;
+        }
+        ObjString* name = AS_STRING(chunk->constants.values[(chunk->code[offset + 1] << 8) | chunk->code[offset + 2]]);
+        Value existing;
+        if (isNativeModule(name) || tableGet(&bundled->data, OBJ_VAL(name), &existing)) {
+            continue;
+        }
 
-        // Mark as loading: insert a placeholder (could just be NIL_VAL)
-        tableSet(&vm.globals, OBJ_VAL(canonicalName), NIL_VAL);
-        tableSet(&vm.globals, OBJ_VAL(copyString(nickName, strlen(nickName))), NIL_VAL);
+        char* path = findModule(name->chars, function->file, ".slo");
+        if (path == NULL) {
+            char* extension = findModule(name->chars, function->file, ".so");
+            if (extension == NULL) {
+                fprintf(stderr, "Could not find module '%s' to bundle.\n", name->chars);
+                return false;
+            }
+            // shared libraries can't be bundled, so it's still looked for when it's imported
+            fprintf(stderr, "Module '%s' is a native extension and will be loaded from '%s'.\n", name->chars, extension);
+            free(extension);
+            continue;
+        }
 
-        // we found the module! We need to import it now
-        loadFileModule(path);
+        char* source = readModuleSource(path);
+        ObjFunction* module = source != NULL ? compileModule(source, path, name) : NULL;
+        free(source);
         free(path);
+        if (module == NULL) {
+            return false;
+        }
+        // added before its own imports are followed, so circular imports end
+        push(OBJ_VAL(module));
+        tableSet(&bundled->data, OBJ_VAL(name), OBJ_VAL(module));
+        pop();
+        if (!bundleImports(module, bundled)) {
+            return false;
+        }
     }
     return true;
 }
+
+/**
+ * @brief Compiles a script and every module it imports into a bundle.
+ */
+bool compileBundle(const char* path, const char* output) {
+    char* source = readModuleSource(path);
+    if (source == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        return false;
+    }
+    ObjFunction* script = compile(source, path);
+    free(source);
+    if (script == NULL) {
+        return false;
+    }
+    push(OBJ_VAL(script));
+
+    ObjDict* bundled = newDict();
+    push(OBJ_VAL(bundled));
+    bool compiled = bundleImports(script, bundled);
+
+    int count = bundled->data.count;
+    ObjString** names = (ObjString**)malloc(sizeof(ObjString*) * (count + 1));
+    ObjFunction** modules = (ObjFunction**)malloc(sizeof(ObjFunction*) * (count + 1));
+    bool written = false;
+    if (compiled && names != NULL && modules != NULL) {
+        int index = 0;
+        for (int i = 0; i < bundled->data.entryCount; i++) {
+            Entry* entry = &bundled->data.entries[i];
+            if (!IS_EMPTY(entry->key) && index < count) {
+                names[index] = AS_STRING(entry->key);
+                modules[index] = AS_FUNCTION(entry->value);
+                index++;
+            }
+        }
+        written = writeBundle(output, script, names, modules, index);
+        if (!written) {
+            fprintf(stderr, "Could not write bundle \"%s\".\n", output);
+        }
+    }
+
+    free(names);
+    free(modules);
+    pop();
+    pop();
+    return written;
+}
@@ -0,0 +1,200 @@
+/**
+ * @file memo.c
+ *
+ * A chained hash table from a call's args to its result, with the entries
+ * linked in the order they were last used so the oldest can be dropped
+ * when there's a limit. Entries are only ever replaced, never removed on
+ * their own, so they stay packed in entries[0..count).
+ */
+
+#include "core/gc.h"
+#include "core/memo.h"
+#include "core/memory.h"
+
+// the most entries there are per bucket before there are twice as many buckets
+#define MEMO_MAX_LOAD 0.75
+
+/**
+ * Implementation of method for hashing the args of a call.
+ */
+uint32_t hashArguments(Value* args, int argCount) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < argCount; i++) {
+        hash = (hash ^ hashValue(args[i])) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Method for finding the entry for the given args, or -1 if there isn't one.
+ */
+static int findEntry(ObjMemo* memo, Value* args, int argCount, uint32_t hash) {
+    if (memo->bucketCount == 0) {
+        return -1;
+    }
+    for (int i = memo->buckets[hash & (memo->bucketCount - 1)]; i != -1; i = memo->entries[i].chain) {
+        MemoEntry* entry = &memo->entries[i];
+        if (entry->hash != hash || entry->argCount != argCount) {
+            continue;
+        }
+        int arg = 0;
+        while (arg < argCount && valuesEqual(entry->args[arg], args[arg])) {
+            arg++;
+        }
+        if (arg == argCount) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Method for taking an entry out of the order they were used in.
+ */
+static void unlinkUsed(ObjMemo* memo, int index) {
+    MemoEntry* entry = &memo->entries[index];
+    if (entry->newer != -1) {
+        memo->entries[entry->newer].older = entry->older;
+    } else {
+        memo->newest = entry->older;
+    }
+    if (entry->older != -1) {
+        memo->entries[entry->older].newer = entry->newer;
+    } else {
+        memo->oldest = entry->newer;
+    }
+}
+
+/**
+ * Method for making an entry the most recently used.
+ */
+static void linkNewest(ObjMemo* memo, int index) {
+    MemoEntry* entry = &memo->entries[index];
+    entry->newer = -1;
+    entry->older = memo->newest;
+    if (memo->newest != -1) {
+        memo->entries[memo->newest].newer = index;
+    } else {
+        memo->oldest = index;
+    }
+    memo->newest = index;
+}
+
+/**
+ * Method for adding an entry to the front of its bucket.
+ */
+static void chainEntry(ObjMemo* memo, int index) {
+    int* bucket = &memo->buckets[memo->entries[index].hash & (memo->bucketCount - 1)];
+    memo->entries[index].chain = *bucket;
+    *bucket = index;
+}
+
+/**
+ * Method for taking an entry out of its bucket.
+ */
+static void unchainEntry(ObjMemo* memo, int index) {
+    int* link = &memo->buckets[memo->entries[index].hash & (memo->bucketCount - 1)];
+    while (*link != index) {
+        link = &memo->entries[*link].chain;
+    }
+    *link = memo->entries[index].chain;
+}
+
+/**
+ * Method for doubling the buckets and sharing the entries out between them again.
+ */
+static void growBuckets(ObjMemo* memo) {
+    int bucketCount = memo->bucketCount == 0 ? 8 : memo->bucketCount * 2;
+    int* buckets = ALLOCATE(int, bucketCount);
+    FREE_ARRAY(int, memo->buckets, memo->bucketCount);
+    memo->buckets = buckets;
+    memo->bucketCount = bucketCount;
+    for (int i = 0; i < bucketCount; i++) {
+        buckets[i] = -1;
+    }
+    for (int i = 0; i < memo->count; i++) {
+        chainEntry(memo, i);
+    }
+}
+
+/**
+ * Implementation of method for getting the result remembered for the given args.
+ */
+bool memoGet(ObjMemo* memo, Value* args, int argCount, uint32_t hash, Value* result) {
+    int index = findEntry(memo, args, argCount, hash);
+    if (index == -1) {
+        memo->misses++;
+        return false;
+    }
+    memo->hits++;
+    if (memo->newest != index) {
+        unlinkUsed(memo, index);
+        linkNewest(memo, index);
+    }
+    *result = memo->entries[index].result;
+    return true;
+}
+
+/**
+ * Implementation of method for remembering the result for the given args.
+ */
+void memoSet(ObjMemo* memo, Value* args, int argCount, uint32_t hash, Value result) {
+    int index = findEntry(memo, args, argCount, hash);
+    if (index != -1) {
+        // a call with the same args finished while this one was running
+        FREE_ARRAY(Value, args, argCount);
+        memo->entries[index].result = result;
+        writeBarrier((Obj*)memo, result);
+        return;
+    }
+
+    if (memo->maxSize > 0 && memo->count == memo->maxSize) {
+        index = memo->oldest;
+        unchainEntry(memo, index);
+        unlinkUsed(memo, index);
+        FREE_ARRAY(Value, memo->entries[index].args, memo->entries[index].argCount);
+    } else {
+        if (memo->count == memo->capacity) {
+            int capacity = memo->capacity;
+            memo->capacity = GROW_CAPACITY(capacity);
+            if (memo->maxSize > 0 && memo->capacity > memo->maxSize) {
+                memo->capacity = memo->maxSize;
+            }
+            memo->entries = GROW_ARRAY(MemoEntry, memo->entries, capacity, memo->capacity);
+        }
+        if (memo->count + 1 > memo->bucketCount * MEMO_MAX_LOAD) {
+            growBuckets(memo);
+        }
+        index = memo->count++;
+    }
+
+    MemoEntry* entry = &memo->entries[index];
+    entry->args = args;
+    entry->argCount = argCount;
+    entry->hash = hash;
+    entry->result = result;
+    chainEntry(memo, index);
+    linkNewest(memo, index);
+    for (int i = 0; i < argCount; i++) {
+        writeBarrier((Obj*)memo, args[i]);
+    }
+    writeBarrier((Obj*)memo, result);
+}
+
+/**
+ * Implementation of method for forgetting every result a memo has.
+ */
+void clearMemo(ObjMemo* memo) {
+    for (int i = 0; i < memo->count; i++) {
+        FREE_ARRAY(Value, memo->entries[i].args, memo->entries[i].argCount);
+    }
+    FREE_ARRAY(MemoEntry, memo->entries, memo->capacity);
+    FREE_ARRAY(int, memo->buckets, memo->bucketCount);
+    memo->entries = NULL;
+    memo->buckets = NULL;
+    memo->count = 0;
+    memo->capacity = 0;
+    memo->bucketCount = 0;
+    memo->newest = -1;
+    memo->oldest = -1;
+}
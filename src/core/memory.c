@@ -3,20 +3,32 @@
  */
 
 #include <stdlib.h>
+#include <sys/mman.h>
 
 #include "core/gc.h"
+#include "core/memo.h"
 #include "core/memory.h"
 #include "core/object.h"
 #include "core/vm.h"
+#include "std/thread.h"
+
+THREAD_LOCAL FreedMemory* freedMemory = NULL;
 
 /**
  * Implementation of reallocate function.
  */
 void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
-    vm.bytesAllocated += newSize - oldSize;
+    // a background sweep only ever frees, and mustn't touch the VM's counters
+    if (newSize == 0 && freedMemory != NULL) {
+        freedMemory->bytes += oldSize;
+        free(pointer);
+        return NULL;
+    }
+
+    vm->bytesAllocated += newSize - oldSize;
 
     if (newSize > oldSize) {
-        if (vm.bytesAllocated > vm.nextGC) {
+        if (vm->bytesAllocated > vm->nextGC) {
             collectGarbage();
         }
     }
@@ -31,6 +43,116 @@ void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
     return result;
 }
 
+/**
+ * Method for getting the size class for a given size.
+ */
+static inline int poolClass(size_t size) {
+    return (int)((size + POOL_GRANULE - 1) / POOL_GRANULE) - 1;
+}
+
+/**
+ * Method for carving a slot out of the pool's current slab,
+ * starting a new slab if it's full.
+ */
+static void* carveSlot(ObjectPool* pool, size_t slotSize) {
+    PoolSlab* slab = pool->slabs;
+    if (slab == NULL || slab->used + slotSize > POOL_SLAB_SIZE) {
+        slab = (PoolSlab*)malloc(POOL_SLAB_SIZE);
+        if (slab == NULL) exit(1);
+        slab->next = pool->slabs;
+        // keep slots aligned to the granule
+        slab->used = (sizeof(PoolSlab) + POOL_GRANULE - 1) / POOL_GRANULE * POOL_GRANULE;
+        pool->slabs = slab;
+    }
+
+    void* slot = (char*)slab + slab->used;
+    slab->used += slotSize;
+    return slot;
+}
+
+/**
+ * Implementation of method to allocate the memory for an Obj.
+ *
+ * This does the same GC accounting as reallocate so collections
+ * are triggered the same way.
+ */
+void* allocateObjectMemory(size_t size) {
+    if (size > POOL_MAX_SIZE) {
+        return reallocate(NULL, 0, size);
+    }
+
+    vm->bytesAllocated += size;
+    if (vm->bytesAllocated > vm->nextGC) {
+        collectGarbage();
+    }
+
+    int sizeClass = poolClass(size);
+    ObjectPool* pool = &vm->pools[sizeClass];
+    if (pool->freeList != NULL) {
+        FreeObject* slot = pool->freeList;
+        pool->freeList = slot->next;
+        return slot;
+    }
+    return carveSlot(pool, (size_t)(sizeClass + 1) * POOL_GRANULE);
+}
+
+/**
+ * Implementation of method to return an Obj's memory to its pool.
+ */
+void freeObjectMemory(void* pointer, size_t size) {
+    if (size > POOL_MAX_SIZE) {
+        reallocate(pointer, size, 0);
+        return;
+    }
+
+    FreeObject* slot = (FreeObject*)pointer;
+    if (freedMemory != NULL) {
+        int sizeClass = poolClass(size);
+        freedMemory->bytes += size;
+        slot->next = freedMemory->freeLists[sizeClass];
+        if (slot->next == NULL) {
+            freedMemory->freeTails[sizeClass] = slot;
+        }
+        freedMemory->freeLists[sizeClass] = slot;
+        return;
+    }
+
+    vm->bytesAllocated -= size;
+    ObjectPool* pool = &vm->pools[poolClass(size)];
+    slot->next = pool->freeList;
+    pool->freeList = slot;
+}
+
+/**
+ * Implementation of method to hand memory freed by a background sweep back to the VM.
+ */
+void reclaimFreedMemory(FreedMemory* freed) {
+    vm->bytesAllocated -= freed->bytes;
+    for (int i = 0; i < POOL_CLASSES; i++) {
+        if (freed->freeLists[i] != NULL) {
+            freed->freeTails[i]->next = vm->pools[i].freeList;
+            vm->pools[i].freeList = freed->freeLists[i];
+        }
+    }
+    *freed = (FreedMemory){0};
+}
+
+/**
+ * Implementation of method to release the pools' slabs.
+ */
+void freeObjectPools() {
+    for (int i = 0; i < POOL_CLASSES; i++) {
+        PoolSlab* slab = vm->pools[i].slabs;
+        while (slab != NULL) {
+            PoolSlab* next = slab->next;
+            free(slab);
+            slab = next;
+        }
+        vm->pools[i].slabs = NULL;
+        vm->pools[i].freeList = NULL;
+    }
+}
+
 /**
  * Method for freeing an object.
  *
@@ -39,82 +161,160 @@ void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
 void freeObject(Obj* object) {
     switch (object->type) {
         case OBJ_BOUND_METHOD: {
-            FREE(ObjBoundMethod, object);
+            FREE_OBJ(ObjBoundMethod, object);
             break;
         }
         case OBJ_CLASS: {
             ObjClass* sClass = (ObjClass*)object;
             freeTable(&sClass->methods);
-            FREE(ObjClass, object);
+            freeShape(sClass->rootShape);
+            FREE_OBJ(ObjClass, object);
             break;
         }
         case OBJ_CLOSURE: {
             ObjClosure* closure = (ObjClosure*)object;
             FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
-            FREE(OBJ_CLOSURE, object);
+            if (closure->captured != NULL) {
+                FREE_ARRAY(Value, closure->captured, closure->upvalueCount);
+            }
+            FREE_OBJ(ObjClosure, object);
             break;
         }
         case OBJ_INSTANCE: {
             ObjInstance* instance = (ObjInstance*)object;
-            freeTable(&instance->fields);
-            FREE(ObjInstance, object);
+            FREE_ARRAY(Value, instance->fields, instance->fieldCapacity);
+            FREE_OBJ(ObjInstance, object);
             break;
         }
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)object;
             freeChunk(&function->chunk);
-            FREE(ObjFunction, object);
+            FREE_OBJ(ObjFunction, object);
             break;
         }
         case OBJ_NATIVE: {
-            FREE(ObjNative, object);
+            FREE_OBJ(ObjNative, object);
             break;
         }
         case OBJ_STRING: {
             ObjString* string = (ObjString*)object;
-            FREE_ARRAY(char, string->chars, string->length + 1);
-            FREE(ObjString, object);
+            // views share their parent's characters
+            if (string->mapped) {
+                munmap(string->chars, string->length);
+            } else if (string->parent == NULL) {
+                FREE_ARRAY(char, string->chars, string->length + 1);
+            }
+            FREE_OBJ(ObjString, object);
             break;
         }
         case OBJ_UPVALUE: {
-            FREE(ObjUpvalue, object);
+            FREE_OBJ(ObjUpvalue, object);
             break;
         }
         case OBJ_LIST: {
             ObjList* list = (ObjList*)object;
-            FREE_ARRAY(Value, list->values.values, list->values.capacity);
-            FREE(ObjList, object);
+            // shared values belong to the storage list
+            if (list->storage == NULL) {
+                FREE_ARRAY(Value, list->values.values, list->values.capacity);
+            }
+            FREE_OBJ(ObjList, object);
             break;
         }
         case OBJ_DICT: {
             ObjDict* dict = (ObjDict*)object;
             freeTable(&dict->data);
-            FREE(ObjDict, object);
+            FREE_OBJ(ObjDict, object);
+            break;
+        }
+        case OBJ_BYTES: {
+            ObjBytes* bytes = (ObjBytes*)object;
+            FREE_ARRAY(uint8_t, bytes->data, bytes->capacity);
+            FREE_OBJ(ObjBytes, object);
+            break;
+        }
+        case OBJ_SOCKET: {
+            closeSocket((ObjSocket*)object);
+            FREE_OBJ(ObjSocket, object);
+            break;
+        }
+        case OBJ_THREAD: {
+            releaseThread(((ObjThread*)object)->handle);
+            FREE_OBJ(ObjThread, object);
+            break;
+        }
+        case OBJ_CHANNEL: {
+            releaseChannel(((ObjChannel*)object)->channel);
+            FREE_OBJ(ObjChannel, object);
+            break;
+        }
+        case OBJ_FIBER: {
+            ObjFiber* fiber = (ObjFiber*)object;
+            FREE_ARRAY(FiberFrame, fiber->frames, fiber->frameCapacity);
+            FREE_ARRAY(Value, fiber->stack, fiber->stackCapacity);
+            FREE_OBJ(ObjFiber, object);
+            break;
+        }
+        case OBJ_SET: {
+            ObjSet* set = (ObjSet*)object;
+            freeTable(&set->data);
+            FREE_OBJ(ObjSet, object);
             break;
         }
         case OBJ_MODULE: {
             ObjModule* module = (ObjModule*)object;
             freeTable(&module->methods);
-            FREE(ObjModule, object);
+            FREE_OBJ(ObjModule, object);
             break;
         }
         case OBJ_ENUM: {
             ObjEnum* sEnum = (ObjEnum*)object;
             freeTable(&sEnum->values);
-            FREE(ObjEnum, object);
+            FREE_OBJ(ObjEnum, object);
             break;
         }
         case OBJ_FILE: {
             ObjFile* sFile = (ObjFile*)object;
-            if (sFile->file && !sFile->closed) {
-                fclose(sFile->file);
-                sFile->closed = true;
+            if (sFile->file) {
+                closeFile(sFile);
+            }
+            FREE_OBJ(ObjFile, object);
+            break;
+        }
+        case OBJ_STRING_BUILDER: {
+            ObjStringBuilder* builder = (ObjStringBuilder*)object;
+            FREE_ARRAY(char, builder->chars, builder->capacity);
+            FREE_OBJ(ObjStringBuilder, object);
+            break;
+        }
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            if (array->type == ARRAY_F64) {
+                FREE_ARRAY(double, array->as.f64, array->count);
+            } else {
+                FREE_ARRAY(int64_t, array->as.i64, array->count);
             }
-            FREE(ObjFile, object);
+            FREE_OBJ(ObjArray, object);
+            break;
+        }
+        case OBJ_RANGE: {
+            FREE_OBJ(ObjRange, object);
+            break;
+        }
+        case OBJ_RANDOM: {
+            FREE_OBJ(ObjRandom, object);
+            break;
+        }
+        case OBJ_DICT_VIEW: {
+            FREE_OBJ(ObjDictView, object);
+            break;
+        }
+        case OBJ_MEMO: {
+            clearMemo((ObjMemo*)object);
+            FREE_OBJ(ObjMemo, object);
             break;
         }
         case OBJ_ERROR: {
-            FREE(ObjError, object);
+            FREE_OBJ(ObjError, object);
             break;
         }
         default:
@@ -128,10 +328,52 @@ void freeObject(Obj* object) {
  * This walks the linked list of Objs and calls freeObject for each.
  */
 void freeObjects() {
-    Obj* object = vm.objects;
+    Obj* object = vm->objects;
     while (object != NULL) {
         Obj* next = object->next;
         freeObject(object);
         object = next;
-  }
+    }
+
+    object = vm->youngObjects;
+    while (object != NULL) {
+        Obj* next = object->next;
+        freeObject(object);
+        object = next;
+    }
+    vm->youngObjects = NULL;
+
+    object = vm->regionObjects;
+    while (object != NULL) {
+        Obj* next = object->next;
+        freeObject(object);
+        object = next;
+    }
+    vm->regionObjects = NULL;
+
+    object = vm->localObjects;
+    while (object != NULL) {
+        Obj* next = object->next;
+        freeObject(object);
+        object = next;
+    }
+    vm->localObjects = NULL;
+}
+
+/**
+ * Method for freeing an object a frame owns.
+ *
+ * Frames free theirs in the reverse order they made them, so it's nearly always the first.
+ */
+void freeLocalObject(Obj* object) {
+    if (!object->local) {
+        return;
+    }
+    for (Obj** link = &vm->localObjects; *link != NULL; link = &(*link)->next) {
+        if (*link == object) {
+            *link = object->next;
+            freeObject(object);
+            return;
+        }
+    }
 }
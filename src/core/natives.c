@@ -24,20 +24,22 @@
  */
 void defineNatives() {
     defineNative("clock", clockNative, 0, 0, NULL);
-    defineNative("exit", exitNative, 0, 1, PARAMS({copyString("code", 4), false}));
-    defineNative("sleep", sleepNative, 1, 1, PARAMS({copyString("seconds", 7), true}));
+    defineNative("exit", exitNative, 0, 1, PARAMS({"code", false}));
+    defineNative("sleep", sleepNative, 1, 1, PARAMS({"seconds", true}));
+    defineNative("yield", yieldNative, 0, 1, PARAMS({"value", false}));
     defineNative("time", timeNative, 0, 0, NULL);
-    defineNative("len", lenNative, 1, 1, PARAMS({copyString("sequence", 9), true}));
+    defineNative("len", lenNative, 1, 1, PARAMS({"sequence", true}));
+    defineNative("range", rangeNative, 1, 3, PARAMS({"start", true}, {"stop", false}, {"step", false}));
 
     // math functions
-    defineNative("abs", absNative, 1, 1, PARAMS({copyString("value", 5), true}));
-    defineNative("min", minNative, 2, 2, PARAMS({copyString("a", 1), true}, {copyString("b", 1), true}));
-    defineNative("max", maxNative, 2, 2, PARAMS({copyString("a", 1), true}, {copyString("b", 1), true}));
+    defineNative("abs", absNative, 1, 1, PARAMS({"value", true}));
+    defineNative("min", minNative, 2, 2, PARAMS({"a", true}, {"b", true}));
+    defineNative("max", maxNative, 2, 2, PARAMS({"a", true}, {"b", true}));
 }
 
 /**
  * Method for defining a native function.
- * We wrap the C function pointer as an ObjNative and adds it to the globals
+ * We wrap the C function pointer as an ObjNative and adds it to the builtins
  * table with the gven name.
  *
  * Pushes the name and native values onto the stack to prevent GC.
@@ -45,7 +47,7 @@ void defineNatives() {
 void defineNative(const char* name, NativeFn function, int arityMin, int arityMax, ParamInfo* params) {
     push(OBJ_VAL(copyString(name, (int)strlen(name))));
     push(OBJ_VAL(newNative(function, arityMin, arityMax, params)));
-    tableSet(&vm.globals, OBJ_VAL(AS_STRING(vm.stack[0])), vm.stack[1]);
+    tableSet(&vm->builtins, OBJ_VAL(AS_STRING(vm->stack[0])), vm->stack[1]);
     pop();
     pop();
 }
@@ -72,13 +74,26 @@ Value timeNative(int argCount, Value* args, ParamInfo* params) {
  */
 Value sleepNative(int argCount, Value* args, ParamInfo* params) {
     if (!IS_NUMBER(args[0])) {
-        return ERROR_VAL_PTR("sleep() expects a single numeric argument.");
+        return nativeError("sleep() expects a single numeric argument.");
     }
     double t = AS_NUMBER(args[0]);
     sleep(t);
     return NIL_VAL;
 }
 
+/**
+ * Yield native function.
+ *
+ * Suspends the running fiber once this returns. What this returns is
+ * replaced with the value the fiber is next resumed with.
+ */
+Value yieldNative(int argCount, Value* args, ParamInfo* params) {
+    if (!yieldFiber(argCount > 0 ? args[0] : NIL_VAL)) {
+        return nativeError("yield() can only be called from a fiber, outside of any native callbacks.");
+    }
+    return NIL_VAL;
+}
+
 /**
  * Exit native function.
  *
@@ -86,7 +101,7 @@ Value sleepNative(int argCount, Value* args, ParamInfo* params) {
  */
 Value exitNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount > 0 && !IS_NUMBER(args[0])) {
-        return ERROR_VAL_PTR("exit() expects a numeric argument (if any).");
+        return nativeError("exit() expects a numeric argument (if any).");
     }
     int status = 0;
     if (0 < argCount) {
@@ -101,19 +116,59 @@ Value exitNative(int argCount, Value* args, ParamInfo* params) {
  * len native function.
  */
 Value lenNative(int argCount, Value* args, ParamInfo* params) {
-    if (!IS_LIST(args[0]) && !IS_STRING(args[0]) && !IS_DICT(args[0])) {
-        return ERROR_VAL_PTR("len() expects a single argument of type string, list, or dict.");
+    if (!IS_LIST(args[0]) && !IS_STRING(args[0]) && !IS_DICT(args[0]) && !IS_STRING_BUILDER(args[0]) && !IS_ARRAY(args[0]) && !IS_SET(args[0]) && !IS_BYTES(args[0]) && !IS_RANGE(args[0])
+            && !IS_DICT_VIEW(args[0])) {
+        return nativeError("len() expects a single argument of type string, list, or dict.");
     }
     switch (OBJ_TYPE(args[0])) {
         case OBJ_STRING:
-            return NUMBER_VAL((double)AS_STRING(args[0])->length);
+            return INT_VAL(AS_STRING(args[0])->length);
+        case OBJ_STRING_BUILDER:
+            return INT_VAL(AS_STRING_BUILDER(args[0])->length);
         case OBJ_LIST:
-            return NUMBER_VAL((double)AS_LIST(args[0])->count);
+            return INT_VAL(AS_LIST(args[0])->count);
+        case OBJ_ARRAY:
+            return INT_VAL(AS_ARRAY(args[0])->count);
         case OBJ_DICT:
-            return NUMBER_VAL((double)AS_DICT(args[0])->data.count);
+            return INT_VAL(AS_DICT(args[0])->data.count);
+        case OBJ_SET:
+            return INT_VAL(AS_SET(args[0])->data.count);
+        case OBJ_BYTES:
+            return INT_VAL(AS_BYTES(args[0])->count);
+        case OBJ_RANGE:
+            return INT_VAL(rangeLength(AS_RANGE(args[0])));
+        case OBJ_DICT_VIEW:
+            return INT_VAL(AS_DICT_VIEW(args[0])->dict->data.count);
         default:
-            return ERROR_VAL_PTR("len() expects a single argument of type string, list, or dict.");
+            return nativeError("len() expects a single argument of type string, list, or dict.");
+    }
+}
+
+/**
+ * range native function.
+ * With a single argument that's the stop and the range starts from zero,
+ * otherwise it's start, stop and an optional step that defaults to one.
+ */
+Value rangeNative(int argCount, Value* args, ParamInfo* params) {
+    for (int i = 0; i < argCount; i++) {
+        if (!IS_NUMBER(args[i])) {
+            return nativeError("range() expects numeric arguments.");
+        }
+    }
+    double start = 0;
+    double stop = AS_NUMBER(args[0]);
+    double step = 1;
+    if (argCount > 1) {
+        start = AS_NUMBER(args[0]);
+        stop = AS_NUMBER(args[1]);
+    }
+    if (argCount > 2) {
+        step = AS_NUMBER(args[2]);
+    }
+    if (step == 0) {
+        return nativeError("range() step can't be zero.");
     }
+    return OBJ_VAL(newRange(start, stop, step));
 }
 
 // MATH FUNCTIONS
@@ -124,7 +179,7 @@ Value lenNative(int argCount, Value* args, ParamInfo* params) {
  */
 Value absNative(int argCount, Value* args, ParamInfo* params) {
     if (!IS_NUMBER(args[0])) {
-        return ERROR_VAL_PTR("abs() expects a single numeric argument.");
+        return nativeError("abs() expects a single numeric argument.");
     }
     double value = AS_NUMBER(args[0]);
     return NUMBER_VAL(value < 0 ? -value : value);
@@ -136,7 +191,7 @@ Value absNative(int argCount, Value* args, ParamInfo* params) {
  */
 Value minNative(int argCount, Value* args, ParamInfo* params) {
     if (!IS_NUMBER(args[0]) || !IS_NUMBER(args[1])) {
-        return ERROR_VAL_PTR("min() expects two numeric arguments.");
+        return nativeError("min() expects two numeric arguments.");
     }
     double a = AS_NUMBER(args[0]);
     double b = AS_NUMBER(args[1]);
@@ -149,7 +204,7 @@ Value minNative(int argCount, Value* args, ParamInfo* params) {
  */
 Value maxNative(int argCount, Value* args, ParamInfo* params) {
     if (!IS_NUMBER(args[0]) || !IS_NUMBER(args[1])) {
-        return ERROR_VAL_PTR("max() expects two numeric arguments.");
+        return nativeError("max() expects two numeric arguments.");
     }
     double a = AS_NUMBER(args[0]);
     double b = AS_NUMBER(args[1]);
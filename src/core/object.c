@@ -2,15 +2,22 @@
  * @file object.c
  */
 
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "core/flusher.h"
+#include "core/gc.h"
+#include "core/hash.h"
 #include "core/memory.h"
 #include "core/object.h"
 #include "core/table.h"
 #include "core/value.h"
 #include "core/vm.h"
+#include "std/thread.h"
 
 /** Macro for wrapping allocateObject with the right type. */
 #define ALLOCATE_OBJ(type, objectType) \
@@ -20,11 +27,28 @@
  * Method for creating the given ObjType with the right size.
  */
 static Obj* allocateObject(size_t size, ObjType type) {
-    Obj* object = (Obj*)reallocate(NULL, 0, size);
+    Obj* object = (Obj*)allocateObjectMemory(size);
     object->type = type;
-    object->mark = !vm.markValue;
-    object->next = vm.objects;
-    vm.objects = object;
+    object->mark = !vm->markValue;
+    object->remembered = false;
+    object->local = vm->allocateLocal;
+    // the full collector keeps everything old but a region's objects, so only they're barriered
+    object->old = vm->gcMode == GC_FULL && vm->regionDepth == 0 && !object->local;
+
+    // the generational collector allocates into the nursery
+    if (object->local) {
+        object->next = vm->localObjects;
+        vm->localObjects = object;
+    } else if (vm->regionDepth > 0) {
+        object->next = vm->regionObjects;
+        vm->regionObjects = object;
+    } else if (vm->gcMode == GC_GENERATIONAL) {
+        object->next = vm->youngObjects;
+        vm->youngObjects = object;
+    } else {
+        object->next = vm->objects;
+        vm->objects = object;
+    }
 
 #ifdef DEBUG_LOG_GC
     printf("%p allocate %zu for %d\n", (void*)object, size, type);
@@ -52,6 +76,13 @@ ObjClass* newClass(ObjString* name, ObjClass* superClass) {
     sClass->superclass = superClass;
     initTable(&sClass->methods);
     initTable(&sClass->nativeProperties);
+    sClass->natives = NULL;
+    sClass->rootShape = NULL;
+    sClass->instanceSize = 0;
+
+    push(OBJ_VAL(sClass));
+    sClass->rootShape = newShape(sClass);
+    pop();
     return sClass;
 }
 
@@ -67,6 +98,7 @@ ObjClosure* newClosure(ObjFunction* function) {
     ObjClosure* closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
     closure->function = function;
     closure->upvalues = upvalues;
+    closure->captured = NULL;
     closure->upvalueCount = function->upvalueCount;
     return closure;
 }
@@ -77,10 +109,71 @@ ObjClosure* newClosure(ObjFunction* function) {
 ObjInstance* newInstance(ObjClass* sClass) {
     ObjInstance* instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
     instance->sClass = sClass;
-    initTable(&instance->fields);
+    instance->shape = sClass->rootShape;
+    instance->fields = NULL;
+    instance->fieldCapacity = 0;
+    instance->bound = NULL;
+
+    // size the fields for what earlier instances of the class ended up with
+    if (sClass->instanceSize > 0) {
+        push(OBJ_VAL(instance));
+        instance->fields = ALLOCATE(Value, sClass->instanceSize);
+        instance->fieldCapacity = sClass->instanceSize;
+        pop();
+    }
     return instance;
 }
 
+/**
+ * Implementation of method to get a field from an instance.
+ */
+bool instanceGetField(ObjInstance* instance, ObjString* name, Value* value) {
+    int slot = shapeSlot(instance->shape, name);
+    if (slot == -1) {
+        return false;
+    }
+    *value = instance->fields[slot];
+    return true;
+}
+
+/**
+ * Implementation of method to add a field to an instance.
+ *
+ * The instance must be reachable by the GC as growing the array may allocate.
+ */
+void instanceAddField(ObjInstance* instance, Shape* next, Value value) {
+    if (instance->fieldCapacity < next->fieldCount) {
+        int oldCapacity = instance->fieldCapacity;
+        int capacity = oldCapacity == 0 ? next->fieldCount : oldCapacity * 2;
+        instance->fields = GROW_ARRAY(Value, instance->fields, oldCapacity, capacity);
+        instance->fieldCapacity = capacity;
+    }
+    instance->fields[next->fieldCount - 1] = value;
+    instance->shape = next;
+    writeBarrier((Obj*)instance, value);
+
+    if (next->fieldCount > instance->sClass->instanceSize) {
+        instance->sClass->instanceSize = next->fieldCount;
+    }
+}
+
+/**
+ * Implementation of method to set a field on an instance.
+ *
+ * New fields move the instance along a transition to the next shape.
+ */
+bool instanceSetField(ObjInstance* instance, ObjString* name, Value value) {
+    int slot = shapeSlot(instance->shape, name);
+    if (slot != -1) {
+        instance->fields[slot] = value;
+        writeBarrier((Obj*)instance, value);
+        return false;
+    }
+
+    instanceAddField(instance, shapeTransition(instance->shape, name), value);
+    return true;
+}
+
 /**
  * Method for creating a ObjFunction.
  */
@@ -140,20 +233,110 @@ ObjList* newList() {
     ObjList* list = ALLOCATE_OBJ(ObjList, OBJ_LIST);
     list->count = 0;
     initValueArray(&list->values);
-    list->sClass = vm.listClass;
+    list->sClass = vm->listClass;
+    list->storage = NULL;
+    return list;
+}
+
+/**
+ * Method for creating a new, empty ObjList with room for capacity values,
+ * so it can be filled without growing.
+ */
+ObjList* newListWithCapacity(int capacity) {
+    ObjList* list = newList();
+    // keep the list rooted while its buffer is allocated
+    push(OBJ_VAL(list));
+    reserveValueArray(&list->values, capacity);
+    pop();
+    return list;
+}
+
+/**
+ * Method for creating a list that never leaves the frame making it.
+ */
+ObjList* newLocalList(int capacity) {
+    vm->allocateLocal = true;
+    ObjList* list = newListWithCapacity(capacity);
+    vm->allocateLocal = false;
     return list;
 }
 
+/**
+ * Method for creating a list of count of the given list's values from start,
+ * sharing them with it rather than copying them.
+ *
+ * The first time a list is shared its buffer moves into a hidden storage list,
+ * so the original becomes one more list pointing into it. Lists sharing
+ * storage always point straight at it, so they never chain.
+ */
+ObjList* shareList(ObjList* list, int start, int count) {
+    if (list->storage == NULL) {
+        ObjList* storage = newList();
+        storage->values = list->values;
+        storage->count = list->count;
+        list->storage = storage;
+        list->values.capacity = list->count;
+        rememberObject((Obj*)list);
+    }
+    ObjList* shared = newList();
+    shared->storage = list->storage;
+    shared->values.values = list->values.values + start;
+    shared->values.count = count;
+    shared->values.capacity = count;
+    shared->count = count;
+    return shared;
+}
+
+/**
+ * Method for giving a list its own copy of the values it shares with others.
+ */
+void copySharedValues(ObjList* list) {
+    // the storage keeps the shared values alive while the copy is allocated
+    Value* values = ALLOCATE(Value, list->count);
+    copyValues(values, list->values.values, list->count);
+    list->values.values = values;
+    list->values.capacity = list->count;
+    list->values.count = list->count;
+    list->storage = NULL;
+    rememberObject((Obj*)list);
+}
+
 ObjDict* newDict() {
     ObjDict* dict = ALLOCATE_OBJ(ObjDict, OBJ_DICT);
     initTable(&dict->data);
-    dict->sClass = vm.dictClass;
+    dict->sClass = vm->dictClass;
+    return dict;
+}
+
+/**
+ * Method for creating a new, empty ObjDict with room for count entries,
+ * so it can be filled without rehashing.
+ */
+ObjDict* newDictWithCapacity(int count) {
+    ObjDict* dict = newDict();
+    // keep the dict rooted while its table is allocated
+    push(OBJ_VAL(dict));
+    tableReserve(&dict->data, count);
+    pop();
+    return dict;
+}
+
+/**
+ * Method for creating a dict that never leaves the frame making it.
+ */
+ObjDict* newLocalDict(int count) {
+    vm->allocateLocal = true;
+    ObjDict* dict = newDictWithCapacity(count);
+    vm->allocateLocal = false;
     return dict;
 }
 
 ObjModule* newModule() {
     ObjModule* module = ALLOCATE_OBJ(ObjModule, OBJ_MODULE);
     initTable(&module->methods);
+    module->natives = NULL;
+    module->name = NULL;
+    module->fromFile = false;
     return module;
 }
 
@@ -164,24 +347,428 @@ ObjEnum* newEnum(ObjString* name) {
     return sEnum;
 }
 
-ObjFile* newFile(FILE* file, FileMode mode, ObjString* name) {
+ObjFile* newFile(FILE* file, FileMode mode, ObjString* name, size_t bufferSize) {
     ObjFile* sFile = ALLOCATE_OBJ(ObjFile, OBJ_FILE);
     sFile->file = file;
     sFile->closed = false;
     sFile->mode = mode;
     sFile->name = name;
+    sFile->line = NULL;
+    sFile->lineCapacity = 0;
+    sFile->buffer = NULL;
+    sFile->flusher = NULL;
+    if (bufferSize > 0) {
+        // not allocated through the GC as the file isn't rooted yet
+        sFile->buffer = (char*)malloc(bufferSize);
+        if (sFile->buffer != NULL) {
+            setvbuf(file, sFile->buffer, _IOFBF, bufferSize);
+        }
+    }
     return sFile;
 }
 
+/**
+ * Method for closing an ObjFile.
+ *
+ * A flusher's stopped first, as closing the FILE* closes the descriptor
+ * it writes to, and the stdio buffer can only be freed once the file is closed.
+ */
+bool closeFile(ObjFile* file) {
+    bool written = true;
+    if (file->flusher != NULL) {
+        written = stopFlusher(file->flusher);
+        file->flusher = NULL;
+    }
+    if (!file->closed) {
+        // io's stdout and stderr are only flushed, print still needs them
+        if (file->file == stdout || file->file == stderr) {
+            written = fflush(file->file) == 0 && written;
+        } else {
+            written = fclose(file->file) == 0 && written;
+        }
+        file->closed = true;
+    }
+    free(file->buffer);
+    free(file->line);
+    file->buffer = NULL;
+    file->line = NULL;
+    file->lineCapacity = 0;
+    return written;
+}
+
+/**
+ * Implementation of method for syncing a file written in the background.
+ */
+bool syncFile(ObjFile* file) {
+    return file->flusher == NULL || syncFlusher(file->flusher);
+}
+
+/**
+ * Method for creating a new ObjStringBuilder.
+ */
+ObjStringBuilder* newStringBuilder() {
+    ObjStringBuilder* builder = ALLOCATE_OBJ(ObjStringBuilder, OBJ_STRING_BUILDER);
+    builder->chars = NULL;
+    builder->length = 0;
+    builder->capacity = 0;
+    return builder;
+}
+
+/**
+ * Method for appending a value's string form to a string builder.
+ *
+ * Numbers and strings are written straight into the buffer; anything else
+ * is converted with valueToString first. The buffer doubles as it grows
+ * so building a string of n characters only copies O(n) bytes.
+ */
+bool stringBuilderAppend(ObjStringBuilder* builder, Value value) {
+    char number[NUMBER_CHARS];
+    const char* chars;
+    int length;
+    if (IS_NUMBER(value)) {
+        // a NaN without its sign, as writeNumber has it
+        double raw = AS_NUMBER(value);
+        length = snprintf(number, sizeof(number), "%.14g", isnan(raw) ? NAN : raw);
+        chars = number;
+    } else {
+        if (!IS_STRING(value)) {
+            value = valueToString(value);
+            if (!IS_STRING(value)) {
+                return false;
+            }
+        }
+        chars = AS_STRING(value)->chars;
+        length = AS_STRING(value)->length;
+    }
+
+    if (builder->length + length > builder->capacity) {
+        // keep the string rooted while growing the buffer
+        push(value);
+        int oldCapacity = builder->capacity;
+        int capacity = GROW_CAPACITY(oldCapacity);
+        while (capacity < builder->length + length) {
+            capacity = GROW_CAPACITY(capacity);
+        }
+        builder->chars = GROW_ARRAY(char, builder->chars, oldCapacity, capacity);
+        builder->capacity = capacity;
+        pop();
+    }
+    memcpy(builder->chars + builder->length, chars, length);
+    builder->length += length;
+    return true;
+}
+
+/**
+ * Method for creating a new zeroed ObjArray of the given type and length.
+ */
+ObjArray* newArray(ArrayType type, int count) {
+    ObjArray* array = ALLOCATE_OBJ(ObjArray, OBJ_ARRAY);
+    array->type = type;
+    array->count = 0;
+    array->as.f64 = NULL;
+
+    // keep the array rooted while its buffer is allocated
+    push(OBJ_VAL(array));
+    // an empty array has no buffer to clear
+    if (type == ARRAY_F64) {
+        array->as.f64 = ALLOCATE(double, count);
+        if (count > 0) {
+            memset(array->as.f64, 0, sizeof(double) * count);
+        }
+    } else {
+        array->as.i64 = ALLOCATE(int64_t, count);
+        if (count > 0) {
+            memset(array->as.i64, 0, sizeof(int64_t) * count);
+        }
+    }
+    array->count = count;
+    pop();
+    return array;
+}
+
+/**
+ * Method for creating a new zeroed ObjBytes of the given length.
+ */
+ObjBytes* newBytes(int count) {
+    ObjBytes* bytes = ALLOCATE_OBJ(ObjBytes, OBJ_BYTES);
+    bytes->count = 0;
+    bytes->capacity = 0;
+    bytes->data = NULL;
+
+    // keep the bytes rooted while the buffer is allocated
+    push(OBJ_VAL(bytes));
+    if (count > 0) {
+        bytes->data = ALLOCATE(uint8_t, count);
+        memset(bytes->data, 0, count);
+    }
+    bytes->count = count;
+    bytes->capacity = count;
+    pop();
+    return bytes;
+}
+
+/**
+ * Method for creating a new ObjRange. The step must not be zero.
+ */
+ObjRange* newRange(double start, double stop, double step) {
+    ObjRange* range = ALLOCATE_OBJ(ObjRange, OBJ_RANGE);
+    range->start = start;
+    range->stop = stop;
+    range->step = step;
+    return range;
+}
+
+/**
+ * Method for creating a new ObjDictView over the given dict.
+ */
+ObjDictView* newDictView(ObjDict* dict, DictViewKind kind) {
+    ObjDictView* view = ALLOCATE_OBJ(ObjDictView, OBJ_DICT_VIEW);
+    view->dict = dict;
+    view->kind = kind;
+    writeBarrier((Obj*)view, OBJ_VAL(dict));
+    return view;
+}
+
+/**
+ * Method for creating a new ObjMemo remembering the results of the given function.
+ */
+ObjMemo* newMemo(Value function, int maxSize) {
+    ObjMemo* memo = ALLOCATE_OBJ(ObjMemo, OBJ_MEMO);
+    memo->function = function;
+    memo->maxSize = maxSize;
+    memo->count = 0;
+    memo->capacity = 0;
+    memo->entries = NULL;
+    memo->buckets = NULL;
+    memo->bucketCount = 0;
+    memo->newest = -1;
+    memo->oldest = -1;
+    memo->hits = 0;
+    memo->misses = 0;
+    writeBarrier((Obj*)memo, function);
+    return memo;
+}
+
+/**
+ * Method for creating a new ObjRandom, which has to be seeded before it's used.
+ */
+ObjRandom* newRandom() {
+    ObjRandom* random = ALLOCATE_OBJ(ObjRandom, OBJ_RANDOM);
+    memset(&random->state, 0, sizeof(random->state));
+    return random;
+}
+
+/**
+ * Method for getting the number of values a range produces.
+ */
+int rangeLength(ObjRange* range) {
+    double count = ceil((range->stop - range->start) / range->step);
+    if (count >= INT_MAX) {
+        return INT_MAX;
+    }
+    return count > 0 ? (int)count : 0;
+}
+
+/**
+ * Method for getting the nth entry a dict view produces, or NULL if there isn't one.
+ *
+ * Without any deleted entries in the way that's the nth entry of the table.
+ */
+Entry* dictViewEntry(ObjDictView* view, int index) {
+    Table* table = &view->dict->data;
+    if (index < 0 || index >= table->count) {
+        return NULL;
+    }
+    if (table->count == table->entryCount) {
+        return &table->entries[index];
+    }
+    for (int i = 0; i < table->entryCount; i++) {
+        if (!IS_EMPTY(table->entries[i].key) && index-- == 0) {
+            return &table->entries[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Method for getting what a dict view produces for one of its dict's entries.
+ */
+Value dictViewValue(ObjDictView* view, Entry* entry) {
+    if (view->kind == VIEW_KEYS) {
+        return entry->key;
+    }
+    if (view->kind == VIEW_VALUES) {
+        return entry->value;
+    }
+    ObjList* pair = newList();
+    push(OBJ_VAL(pair));
+    growValueArray(&pair->values);
+    pair->values.values[0] = entry->key;
+    pair->values.values[1] = entry->value;
+    pair->count = 2;
+    pair->values.count = 2;
+    writeBarrier((Obj*)pair, entry->key);
+    writeBarrier((Obj*)pair, entry->value);
+    pop();
+    return OBJ_VAL(pair);
+}
+
+/**
+ * Method for checking whether a dict view would produce the given value.
+ *
+ * Keys and pairs are looked up in the dict, values have to be searched for.
+ */
+bool dictViewHas(ObjDictView* view, Value value) {
+    Table* table = &view->dict->data;
+    Value found;
+    switch (view->kind) {
+        case VIEW_KEYS:
+            return tableGet(table, value, &found);
+        case VIEW_VALUES:
+            for (int i = 0; i < table->entryCount; i++) {
+                if (!IS_EMPTY(table->entries[i].key) && valuesEqual(table->entries[i].value, value)) {
+                    return true;
+                }
+            }
+            return false;
+        case VIEW_ITEMS:
+            if (!IS_LIST(value) || AS_LIST(value)->count != 2) {
+                return false;
+            }
+            return tableGet(table, AS_LIST(value)->values.values[0], &found)
+                && valuesEqual(found, AS_LIST(value)->values.values[1]);
+    }
+    return false;
+}
+
+/**
+ * Method for copying what a dict view produces into a new list.
+ */
+ObjList* dictViewToList(ObjDictView* view) {
+    Table* table = &view->dict->data;
+    ObjList* list = newListWithCapacity(table->count);
+    // keep the list rooted while making pairs
+    push(OBJ_VAL(list));
+    for (int i = 0; i < table->entryCount; i++) {
+        Entry* entry = &table->entries[i];
+        if (!IS_EMPTY(entry->key)) {
+            Value value = dictViewValue(view, entry);
+            writeValueArray(&list->values, value);
+            list->count = list->values.count;
+            writeBarrier((Obj*)list, value);
+        }
+    }
+    pop();
+    return list;
+}
+
+/**
+ * Method for creating a new ObjFiber that runs the given closure.
+ */
+ObjFiber* newFiber(ObjClosure* closure) {
+    ObjFiber* fiber = ALLOCATE_OBJ(ObjFiber, OBJ_FIBER);
+    fiber->state = FIBER_NEW;
+    fiber->closure = closure;
+    fiber->frames = NULL;
+    fiber->frameCount = 0;
+    fiber->frameCapacity = 0;
+    fiber->stack = NULL;
+    fiber->stackCount = 0;
+    fiber->stackCapacity = 0;
+    fiber->openUpvalues = NULL;
+    fiber->transfer = NIL_VAL;
+    fiber->callDepth = 0;
+    return fiber;
+}
+
+/**
+ * Method for creating a new ObjSocket that owns the given file descriptor.
+ */
+ObjSocket* newSocket(int fd, bool listening) {
+    ObjSocket* socket = ALLOCATE_OBJ(ObjSocket, OBJ_SOCKET);
+    socket->fd = fd;
+    socket->listening = listening;
+    socket->closed = false;
+    return socket;
+}
+
+/**
+ * Method for closing an ObjSocket's file descriptor.
+ */
+void closeSocket(ObjSocket* socket) {
+    if (!socket->closed) {
+        close(socket->fd);
+        socket->closed = true;
+    }
+}
+
+/**
+ * Method for creating a new ObjThread for a started thread.
+ */
+ObjThread* newThread(ThreadHandle* handle) {
+    ObjThread* thread = ALLOCATE_OBJ(ObjThread, OBJ_THREAD);
+    thread->handle = handle;
+    return thread;
+}
+
+/**
+ * Method for creating a new ObjChannel, taking a reference to the channel.
+ */
+ObjChannel* newChannel(Channel* channel) {
+    ObjChannel* object = ALLOCATE_OBJ(ObjChannel, OBJ_CHANNEL);
+    retainChannel(channel);
+    object->channel = channel;
+    return object;
+}
+
+/**
+ * Method for creating a new, empty ObjSet.
+ */
+ObjSet* newSet() {
+    ObjSet* set = ALLOCATE_OBJ(ObjSet, OBJ_SET);
+    initTable(&set->data);
+    return set;
+}
+
 /**
  * Method for creating a new ObjError.
  */
 ObjError* newError(const char* message) {
+    return newException(ERROR_RUNTIME, message);
+}
+
+/**
+ * Implementation of method for creating a new exception.
+ */
+ObjError* newException(enum ErrorType type, const char* message) {
     ObjError* error = ALLOCATE_OBJ(ObjError, OBJ_ERROR);
-    error->message = copyString(message, strlen(message) + 1);
+    error->type = type;
+    error->message = NULL;
+    push(OBJ_VAL(error));
+    error->message = copyString(message, strlen(message));
+    writeBarrier((Obj*)error, OBJ_VAL(error->message));
+    pop();
     return error;
 }
 
+/**
+ * Implementation of method for returning an error from a native without allocating.
+ */
+Value nativeError(const char* message) {
+    vm->nativeError = message;
+    return ERROR_VAL;
+}
+
+/**
+ * Implementation of method for getting the message of an error a native returned.
+ */
+const char* errorMessage(Value error) {
+    if (!HAS_ERROR_OBJ(error)) {
+        return vm->nativeError != NULL ? vm->nativeError : "Native function failed.";
+    }
+    return AS_ERROR(error)->message->chars;
+}
+
 /**
  * Method for creating an ObjString.
  *
@@ -189,172 +776,137 @@ ObjError* newError(const char* message) {
  * allocates enough memory for it.
  * Initialises the other struct values too.
  */
-static ObjString* allocateString(char* chars, int length, uint32_t hash) {
+static ObjString* allocateString(char* chars, int length) {
     ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
     string->length = length;
+    string->interned = false;
+    string->hashed = false;
+    string->mapped = false;
     string->chars = chars;
-    string->hash = hash;
-
-    push(OBJ_VAL(string));
-    tableSet(&vm.strings, OBJ_VAL(string), NIL_VAL);
-    pop();
+    string->hash = 0;
+    string->parent = NULL;
     return string;
 }
 
 /**
- * Method for generating a hash for a string.
+ * Method for allocating a string and adding it to the intern table.
  */
-static uint32_t hashString(const char* key, int length) {
-    uint32_t hash = 2166136261u;
-    for (int i = 0; i < length; i++) {
-        hash ^= (uint8_t)key[i];
-        hash *= 16777619;
-    }
-    return hash;
+static ObjString* internString(char* chars, int length, uint32_t hash) {
+    ObjString* string = allocateString(chars, length);
+    string->interned = true;
+    string->hashed = true;
+    string->hash = hash;
+
+    push(OBJ_VAL(string));
+    tableSet(&vm->strings, OBJ_VAL(string), NIL_VAL);
+    pop();
+    return string;
 }
 
 /**
  * Method for creating an ObjString an taking ownership of the given string.
  */
 ObjString* takeString(char* chars, int length) {
-    uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    uint32_t hash = hashBytes(chars, length);
+    ObjString* interned = tableFindString(&vm->strings, chars, length, hash);
     if (interned != NULL) {
         FREE_ARRAY(char, chars, length + 1);
         return interned;
     }
-    return allocateString(chars, length, hash);
+    return internString(chars, length, hash);
 }
 
 /**
  * Method for creating an ObjString and copying the given string onto the heap.
  */
 ObjString* copyString(const char* chars, int length) {
-    char* heapChars = ALLOCATE(char, length + 1);
-    uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    return copyStringHashed(chars, length, hashBytes(chars, length));
+}
+
+/**
+ * Method for interning a copy of the given string when its hash is already known.
+ */
+ObjString* copyStringHashed(const char* chars, int length, uint32_t hash) {
+    ObjString* interned = tableFindString(&vm->strings, chars, length, hash);
     if (interned != NULL) {
         return interned;
     }
+    char* heapChars = ALLOCATE(char, length + 1);
     memcpy(heapChars, chars, length);
     heapChars[length] = '\0';
-    return allocateString(heapChars, length, hash);
+    return internString(heapChars, length, hash);
 }
 
 /**
- * Method for prining a function.
+ * Method for creating an uninterned ObjString and taking ownership of the given string.
  */
-static void printFunction(ObjFunction* function) {
-    if (function->name == NULL) {
-        printf("<script>");
-        return;
+ObjString* takeRuntimeString(char* chars, int length) {
+    return allocateString(chars, length);
+}
+
+/**
+ * Method for creating an uninterned ObjString and copying the given string onto the heap.
+ */
+ObjString* copyRuntimeString(const char* chars, int length) {
+    char* heapChars = ALLOCATE(char, length + 1);
+    memcpy(heapChars, chars, length);
+    heapChars[length] = '\0';
+    return allocateString(heapChars, length);
+}
+
+/**
+ * Method for getting a string's hash, working it out on first use.
+ */
+uint32_t stringHash(ObjString* string) {
+    if (!string->hashed) {
+        string->hash = hashBytes(string->chars, string->length);
+        string->hashed = true;
     }
-    printf("<fn %s>", function->name->chars);
+    return string->hash;
+}
+
+/**
+ * Method for creating a string that views part of another string without copying it.
+ *
+ * Views of views point straight at the string that owns the characters,
+ * so there's never more than one parent to keep alive.
+ */
+ObjString* newStringView(ObjString* parent, int start, int length) {
+    if (parent->parent != NULL) {
+        start += (int)(parent->chars - parent->parent->chars);
+        parent = parent->parent;
+    }
+    ObjString* string = allocateString(parent->chars + start, length);
+    string->parent = parent;
+    return string;
+}
+
+ObjString* newMappedString(char* chars, int length) {
+    ObjString* owner = allocateString(chars, length);
+    owner->mapped = true;
+    push(OBJ_VAL(owner));
+    ObjString* string = newStringView(owner, 0, length);
+    pop();
+    return string;
+}
+
+/**
+ * Method for getting a string's null terminated characters.
+ */
+char* stringChars(ObjString* string) {
+    if (string->parent != NULL) {
+        char* chars = ALLOCATE(char, string->length + 1);
+        memcpy(chars, string->chars, string->length);
+        chars[string->length] = '\0';
+        string->chars = chars;
+        string->parent = NULL;
+    }
+    return string->chars;
 }
 
 /**
  * Method for printing an object.
  */
 void printObject(Value value) {
-    switch (OBJ_TYPE(value)) {
-        case OBJ_BOUND_METHOD: {
-            printFunction(AS_BOUND_METHOD(value)->method->function);
-            break;
-        }
-        case OBJ_CLASS: {
-            printf("%s", AS_CLASS(value)->name->chars);
-            break;
-        }
-        case OBJ_CLOSURE: {
-            printFunction(AS_CLOSURE(value)->function);
-            break;
-        }
-        case OBJ_INSTANCE: {
-            printf("%s instance", AS_INSTANCE(value)->sClass->name->chars);
-            break;
-        }
-        case OBJ_FUNCTION: {
-            printFunction(AS_FUNCTION(value));
-            break;
-        }
-        case OBJ_NATIVE: {
-            printf("<native fn>");
-            break;
-        }
-        case OBJ_STRING: {
-            printf("%s", AS_CSTRING(value));
-            break;
-        }
-        case OBJ_UPVALUE: {
-            printf("upvalue");
-            break;
-        }
-        case OBJ_MODULE: {
-            printf("<module>");
-            break;
-        }
-        case OBJ_LIST: {
-            ObjList *list = AS_LIST(value);
-            printf("list[%d]: [", list->count);
-            for (int i = 0; i < list->count; i++) {
-                printValue(list->values.values[i]);
-                if (i < list->count - 1) {
-                    printf(", ");
-                }
-            }
-            printf("]");
-            break;
-        }
-        case OBJ_DICT: {
-            ObjDict* dict = AS_DICT(value);
-            printf("dict[%d]: {", dict->data.count);
-            for (int i = 0; i < dict->data.capacity; i++) {
-                Entry* entry = &dict->data.entries[i];
-                if (entry->key.type != VAL_NIL && entry->key.type != VAL_EMPTY) {
-                    printValue(entry->key);
-                    printf(": ");
-                    printValue(entry->value);
-                    if (i < dict->data.capacity - 1) {
-                        printf(", ");
-                    }
-                }
-            }
-            printf("}");
-            break;
-        }
-        case OBJ_ENUM: {
-            ObjEnum* sEnum = AS_ENUM(value);
-            printf("enum %s: {", sEnum->name->chars);
-            int first = 1;
-            for (Entry* entry = sEnum->values.entries; entry < sEnum->values.entries + sEnum->values.capacity; entry++) {
-                if (entry->key.type != VAL_NIL && entry->key.type != VAL_EMPTY) {
-                    if (!first) {
-                        printf(", ");
-                    }
-                    first = 0;
-                    printValue(entry->key);
-                    printf(": ");
-                    printValue(entry->value);
-                }
-            }
-            printf("}");
-            break;
-        }
-        case OBJ_FILE: {
-            ObjFile* sFile = AS_FILE(value);
-            printf("file %p", (void*)sFile->file);
-            if (sFile->closed) {
-                printf(" (closed)");
-            } else {
-                printf(" (open)");
-            }
-            break;
-        }
-        case OBJ_ERROR:
-            // shouldn't be printed directly anyway
-            printf("<error>");
-            break;
-        default:
-            return;
-    }
+    printValue(value);
 }
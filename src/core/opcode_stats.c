@@ -0,0 +1,200 @@
+/**
+ * @file opcode_stats.c
+ */
+
+#include "core/opcode_stats.h"
+
+#ifdef SLO_OPCODE_STATS
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "core/debug.h"
+#include "core/vm.h"
+
+/**
+ * @struct OpcodePair
+ *
+ * An opcode pair with its count, for sorting.
+ */
+typedef struct OpcodePair {
+    uint8_t first;
+    uint8_t second;
+    uint64_t count;
+} OpcodePair;
+
+// every freed VM's counts added together, threads' VMs are freed while others are running
+static OpcodeStats totals;
+static pthread_mutex_t totalsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Implementation of method for making a VM's counts.
+ */
+OpcodeStats* newOpcodeStats() {
+    OpcodeStats* stats = (OpcodeStats*)calloc(1, sizeof(OpcodeStats));
+    stats->last = UINT8_MAX;
+    return stats;
+}
+
+/**
+ * Implementation of method for adding a VM's counts to the totals.
+ */
+void mergeOpcodeStats(OpcodeStats* stats) {
+    if (stats == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&totalsLock);
+    for (int i = 0; i < UINT8_COUNT; i++) {
+        totals.counts[i] += stats->counts[i];
+#ifdef SLO_OPCODE_CYCLES
+        totals.cycles[i] += stats->cycles[i];
+#endif
+        for (int j = 0; j < UINT8_COUNT; j++) {
+            totals.pairs[i][j] += stats->pairs[i][j];
+        }
+    }
+    pthread_mutex_unlock(&totalsLock);
+    free(stats);
+}
+
+/**
+ * Method for getting an opcode's name, including ones that aren't any.
+ */
+static const char* nameOf(uint8_t instruction) {
+    const char* name = opcodeName(instruction);
+    return name != NULL ? name : "OP_UNKNOWN";
+}
+
+/**
+ * Method for ordering opcodes by how often they ran, most first.
+ */
+static int compareOpcodes(const void* a, const void* b) {
+    uint64_t left = totals.counts[*(const uint8_t*)a];
+    uint64_t right = totals.counts[*(const uint8_t*)b];
+    if (left != right) {
+        return left < right ? 1 : -1;
+    }
+    return (int)*(const uint8_t*)a - (int)*(const uint8_t*)b;
+}
+
+/**
+ * Method for ordering opcode pairs by how often they ran, most first.
+ */
+static int comparePairs(const void* a, const void* b) {
+    const OpcodePair* left = (const OpcodePair*)a;
+    const OpcodePair* right = (const OpcodePair*)b;
+    if (left->count != right->count) {
+        return left->count < right->count ? 1 : -1;
+    }
+    if (left->first != right->first) {
+        return (int)left->first - (int)right->first;
+    }
+    return (int)left->second - (int)right->second;
+}
+
+/**
+ * Method for writing the totals as JSON.
+ */
+static void writeJson(FILE* file, const uint8_t* opcodes, int opcodeCount, const OpcodePair* pairs, int pairCount) {
+    fprintf(file, "{\n  \"opcodes\": [");
+    for (int i = 0; i < opcodeCount; i++) {
+        uint8_t instruction = opcodes[i];
+        fprintf(file, "%s\n    {\"name\": \"%s\", \"count\": %llu", i > 0 ? "," : "",
+            nameOf(instruction), (unsigned long long)totals.counts[instruction]);
+#ifdef SLO_OPCODE_CYCLES
+        fprintf(file, ", \"cycles\": %llu", (unsigned long long)totals.cycles[instruction]);
+#endif
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n  ],\n  \"pairs\": [");
+    for (int i = 0; i < pairCount; i++) {
+        fprintf(file, "%s\n    {\"first\": \"%s\", \"second\": \"%s\", \"count\": %llu}", i > 0 ? "," : "",
+            nameOf(pairs[i].first), nameOf(pairs[i].second), (unsigned long long)pairs[i].count);
+    }
+    fprintf(file, "\n  ]\n}\n");
+}
+
+/**
+ * Method for writing the totals as a table, with only the most run pairs.
+ */
+static void writeTable(FILE* out, const uint8_t* opcodes, int opcodeCount, const OpcodePair* pairs, int pairCount) {
+    uint64_t total = 0;
+    for (int i = 0; i < opcodeCount; i++) {
+        total += totals.counts[opcodes[i]];
+    }
+
+#ifdef SLO_OPCODE_CYCLES
+    fprintf(out, "%-28s %14s %7s %14s %9s\n", "opcode", "count", "%", "cycles", "cycles/op");
+#else
+    fprintf(out, "%-28s %14s %7s\n", "opcode", "count", "%");
+#endif
+    for (int i = 0; i < opcodeCount; i++) {
+        uint8_t instruction = opcodes[i];
+        uint64_t count = totals.counts[instruction];
+        fprintf(out, "%-28s %14llu %6.2f%%", nameOf(instruction), (unsigned long long)count, 100.0 * count / total);
+#ifdef SLO_OPCODE_CYCLES
+        fprintf(out, " %14llu %9.1f", (unsigned long long)totals.cycles[instruction],
+            (double)totals.cycles[instruction] / count);
+#endif
+        fprintf(out, "\n");
+    }
+
+    fprintf(out, "\n%-57s %14s %7s\n", "pair", "count", "%");
+    for (int i = 0; i < pairCount && i < OPCODE_STATS_PAIRS; i++) {
+        fprintf(out, "%-28s %-28s %14llu %6.2f%%\n", nameOf(pairs[i].first), nameOf(pairs[i].second),
+            (unsigned long long)pairs[i].count, 100.0 * pairs[i].count / total);
+    }
+}
+
+/**
+ * Implementation of method for writing the totals.
+ */
+void writeOpcodeStats(FILE* out) {
+    mergeOpcodeStats(vm->opcodeStats);
+    vm->opcodeStats = NULL;
+
+    pthread_mutex_lock(&totalsLock);
+
+    uint8_t opcodes[UINT8_COUNT];
+    int opcodeCount = 0;
+    int pairCount = 0;
+    for (int i = 0; i < UINT8_COUNT; i++) {
+        if (totals.counts[i] > 0) {
+            opcodes[opcodeCount++] = (uint8_t)i;
+        }
+        for (int j = 0; j < UINT8_COUNT; j++) {
+            pairCount += totals.pairs[i][j] > 0;
+        }
+    }
+    qsort(opcodes, opcodeCount, sizeof(uint8_t), compareOpcodes);
+
+    OpcodePair* pairs = (OpcodePair*)malloc(sizeof(OpcodePair) * (pairCount + 1));
+    pairCount = 0;
+    for (int i = 0; i < UINT8_COUNT; i++) {
+        for (int j = 0; j < UINT8_COUNT; j++) {
+            if (totals.pairs[i][j] > 0) {
+                pairs[pairCount++] = (OpcodePair){(uint8_t)i, (uint8_t)j, totals.pairs[i][j]};
+            }
+        }
+    }
+    qsort(pairs, pairCount, sizeof(OpcodePair), comparePairs);
+
+    const char* path = getenv(OPCODE_STATS_ENV);
+    if (path != NULL && path[0] != '\0') {
+        FILE* file = fopen(path, "w");
+        if (file == NULL) {
+            fprintf(out, "Could not write opcode stats to \"%s\".\n", path);
+        } else {
+            writeJson(file, opcodes, opcodeCount, pairs, pairCount);
+            fclose(file);
+        }
+    } else {
+        writeTable(out, opcodes, opcodeCount, pairs, pairCount);
+    }
+
+    free(pairs);
+    pthread_mutex_unlock(&totalsLock);
+}
+
+#endif
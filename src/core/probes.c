@@ -0,0 +1,67 @@
+/**
+ * @file probes.c
+ */
+
+#include "core/probes.h"
+
+#ifdef SLO_HAS_PROBES
+
+#include "core/vm.h"
+
+#define DEFINE_PROBE(name) \
+    __extension__ unsigned short PROBE_SEMAPHORE(name) __attribute__((unused)) __attribute__((section(".probes")))
+
+DEFINE_PROBE(function__entry);
+DEFINE_PROBE(function__return);
+DEFINE_PROBE(gc__start);
+DEFINE_PROBE(gc__done);
+DEFINE_PROBE(module__load__start);
+DEFINE_PROBE(module__load__done);
+DEFINE_PROBE(error);
+
+/**
+ * Method for getting the name of a function, the top level of a file having none.
+ */
+static const char* functionName(ObjFunction* function) {
+    return function->name != NULL ? function->name->chars : "<script>";
+}
+
+/**
+ * Method for getting the file a function was compiled from.
+ */
+static const char* functionFile(ObjFunction* function) {
+    return function->file != NULL ? function->file->chars : "<script>";
+}
+
+/**
+ * Implementation of method for firing function__entry.
+ */
+void probeFunctionEntry(ObjFunction* function) {
+    int line = function->chunk.count > 0 ? getLine(function->chunk, 0) : -1;
+    STAP_PROBE3(slo, function__entry, functionName(function), functionFile(function), line);
+}
+
+/**
+ * Implementation of method for firing function__return.
+ */
+void probeFunctionReturn(ObjFunction* function, int offset) {
+    int line = getLine(function->chunk, offset);
+    STAP_PROBE3(slo, function__return, functionName(function), functionFile(function), line);
+}
+
+/**
+ * Implementation of method for firing error.
+ */
+void probeError(const char* type, const char* message) {
+    const char* file = "<script>";
+    int line = -1;
+    if (vm->frameCount > 0) {
+        CallFrame* frame = &vm->frames[vm->frameCount - 1];
+        ObjFunction* function = frame->closure->function;
+        file = functionFile(function);
+        line = getLine(function->chunk, frame->ip - function->chunk.code - 1);
+    }
+    STAP_PROBE4(slo, error, type, message, file, line);
+}
+
+#endif
@@ -0,0 +1,481 @@
+/**
+ * @file profiler.c
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _XOPEN_SOURCE 700
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "core/profiler.h"
+#include "core/extension.h"
+#include "core/vm.h"
+
+// the longest collapsed stack recorded, deeper frames are left off the end
+#define PROFILE_STACK_MAX (64 * 1024)
+
+/**
+ * @struct FunctionProfile
+ *
+ * The calls made to one function, with its times in nanoseconds. Active is
+ * how many of its frames are running, so recursive calls only add to the
+ * total of the outermost one.
+ */
+typedef struct FunctionProfile {
+    ObjFunction* function;
+    char* name;
+    long calls;
+    int active;
+    uint64_t total;
+    uint64_t self;
+} FunctionProfile;
+
+/**
+ * @struct FrameProfile
+ *
+ * A frame that's been entered, at the same index as it is in vm->frames.
+ * Function is NULL once it's returned.
+ */
+typedef struct FrameProfile {
+    ObjFunction* function;
+    int profile;
+    uint64_t start;
+    // the time spent in the frames it's called
+    uint64_t children;
+} FrameProfile;
+
+/**
+ * @struct StackSamples
+ *
+ * How many samples were taken of one collapsed stack.
+ */
+typedef struct StackSamples {
+    char* stack;
+    uint32_t hash;
+    long count;
+} StackSamples;
+
+static VM* profiled;
+static int profileMode;
+
+static FunctionProfile* functions;
+static int functionCount;
+static int functionCapacity;
+// open addressed by function pointer, holding indexes into functions plus one
+static int* functionIndex;
+static int functionIndexCapacity;
+
+static FrameProfile* frames;
+static int frameCapacity;
+// one past the highest frame entered
+static int frameTop;
+
+static StackSamples* samples;
+static int sampleCount;
+static int sampleCapacity;
+static long sampleTotal;
+static char* stackBuffer;
+
+// samples the timer's asked for that haven't been taken, bumped from any thread
+static volatile int ticks;
+
+/**
+ * Method for getting the time in nanoseconds.
+ */
+static uint64_t now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+}
+
+/**
+ * Method for handling the profiling timer's signal.
+ */
+static void onTick(int signal) {
+    (void)signal;
+    __atomic_add_fetch(&ticks, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Method for getting the line a frame is running.
+ */
+static int frameLine(const CallFrame* frame) {
+    const Chunk* chunk = &frame->closure->function->chunk;
+    // a frame that's only just been entered hasn't run anything yet
+    size_t instruction = frame->ip > chunk->code ? (size_t)(frame->ip - chunk->code - 1) : 0;
+    return getLine(*chunk, instruction);
+}
+
+/**
+ * Method for describing a function by its name, file and the line it starts at.
+ */
+static char* describeFunction(ObjFunction* function) {
+    const char* name = function->name != NULL ? function->name->chars : "<script>";
+    const char* file = function->file != NULL ? function->file->chars : "<script>";
+    int line = function->chunk.count > 0 ? getLine(function->chunk, 0) : 0;
+
+    int length = snprintf(NULL, 0, "%s (%s:%d)", name, file, line);
+    char* description = (char*)malloc(length + 1);
+    snprintf(description, length + 1, "%s (%s:%d)", name, file, line);
+    return description;
+}
+
+/**
+ * Method for hashing a pointer into a table of capacity slots.
+ */
+static uint32_t hashPointer(const void* pointer) {
+    uintptr_t hash = (uintptr_t)pointer;
+    hash ^= hash >> 17;
+    hash *= 0x9e3779b1u;
+    return (uint32_t)(hash ^ (hash >> 15));
+}
+
+/**
+ * Method for getting the index of a function's profile, adding one the first time it's called.
+ */
+static int functionProfile(ObjFunction* function) {
+    if (functionIndexCapacity > 0) {
+        uint32_t slot = hashPointer(function) & (functionIndexCapacity - 1);
+        while (functionIndex[slot] != 0) {
+            int index = functionIndex[slot] - 1;
+            if (functions[index].function == function) {
+                return index;
+            }
+            slot = (slot + 1) & (functionIndexCapacity - 1);
+        }
+    }
+
+    if (functionCount == functionCapacity) {
+        functionCapacity = functionCapacity < 16 ? 16 : functionCapacity * 2;
+        functions = (FunctionProfile*)realloc(functions, sizeof(FunctionProfile) * functionCapacity);
+    }
+    int index = functionCount++;
+    functions[index] = (FunctionProfile){
+        .function = function,
+        .name = describeFunction(function),
+    };
+    // it's only known by its address, so it mustn't be freed and another function take its place
+    pinValue(OBJ_VAL(function));
+
+    if (functionCount * 2 > functionIndexCapacity) {
+        free(functionIndex);
+        functionIndexCapacity = functionIndexCapacity < 32 ? 32 : functionIndexCapacity * 2;
+        functionIndex = (int*)calloc(functionIndexCapacity, sizeof(int));
+        for (int i = 0; i < functionCount; i++) {
+            uint32_t slot = hashPointer(functions[i].function) & (functionIndexCapacity - 1);
+            while (functionIndex[slot] != 0) {
+                slot = (slot + 1) & (functionIndexCapacity - 1);
+            }
+            functionIndex[slot] = i + 1;
+        }
+    } else {
+        uint32_t slot = hashPointer(function) & (functionIndexCapacity - 1);
+        while (functionIndex[slot] != 0) {
+            slot = (slot + 1) & (functionIndexCapacity - 1);
+        }
+        functionIndex[slot] = index + 1;
+    }
+    return index;
+}
+
+/**
+ * Method for finishing the time of an entered frame.
+ */
+static void finishFrame(int index, uint64_t time) {
+    FrameProfile* frame = &frames[index];
+    FunctionProfile* profile = &functions[frame->profile];
+    uint64_t elapsed = time - frame->start;
+
+    profile->self += elapsed > frame->children ? elapsed - frame->children : 0;
+    if (--profile->active == 0) {
+        profile->total += elapsed;
+    }
+    if (index > 0 && frames[index - 1].function != NULL) {
+        frames[index - 1].children += elapsed;
+    }
+    frame->function = NULL;
+}
+
+/**
+ * Method for hashing a collapsed stack.
+ */
+static uint32_t hashStack(const char* stack, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t)stack[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+/**
+ * Method for adding samples of a collapsed stack.
+ */
+static void addSamples(const char* stack, int length, long count) {
+    uint32_t hash = hashStack(stack, length);
+
+    if ((sampleCount + 1) * 2 > sampleCapacity) {
+        int capacity = sampleCapacity < 64 ? 64 : sampleCapacity * 2;
+        StackSamples* grown = (StackSamples*)calloc(capacity, sizeof(StackSamples));
+        for (int i = 0; i < sampleCapacity; i++) {
+            if (samples[i].stack == NULL) continue;
+            uint32_t slot = samples[i].hash & (capacity - 1);
+            while (grown[slot].stack != NULL) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            grown[slot] = samples[i];
+        }
+        free(samples);
+        samples = grown;
+        sampleCapacity = capacity;
+    }
+
+    uint32_t slot = hash & (sampleCapacity - 1);
+    while (samples[slot].stack != NULL) {
+        if (samples[slot].hash == hash && strcmp(samples[slot].stack, stack) == 0) {
+            samples[slot].count += count;
+            return;
+        }
+        slot = (slot + 1) & (sampleCapacity - 1);
+    }
+
+    char* copy = (char*)malloc(length + 1);
+    memcpy(copy, stack, length + 1);
+    samples[slot] = (StackSamples){.stack = copy, .hash = hash, .count = count};
+    sampleCount++;
+}
+
+/**
+ * Method for taking the samples the timer's asked for, of the frames that are running.
+ */
+static void takeSamples() {
+    // checked first, as taking them is a locked exchange
+    if (ticks == 0) {
+        return;
+    }
+    int count = __atomic_exchange_n(&ticks, 0, __ATOMIC_RELAXED);
+    if (vm->frameCount == 0) {
+        return;
+    }
+
+    int length = 0;
+    for (int i = 0; i < vm->frameCount; i++) {
+        const CallFrame* frame = &vm->frames[i];
+        const ObjFunction* function = frame->closure->function;
+        const char* name = function->name != NULL ? function->name->chars : "<script>";
+        const char* file = function->file != NULL ? function->file->chars : "<script>";
+
+        int written = snprintf(stackBuffer + length, PROFILE_STACK_MAX - length, "%s%s (%s:%d)",
+            i > 0 ? ";" : "", name, file, frameLine(frame));
+        if (written >= PROFILE_STACK_MAX - length) {
+            // too deep to fit, so it's left at the last frame that did
+            stackBuffer[length] = '\0';
+            break;
+        }
+        length += written;
+    }
+
+    addSamples(stackBuffer, length, count);
+    sampleTotal += count;
+}
+
+/**
+ * Implementation of method for starting to profile the running VM.
+ */
+void startProfiler(int mode) {
+    profiled = vm;
+    profileMode = mode;
+    vm->profile = mode;
+
+    if (mode & PROFILE_SAMPLES) {
+        stackBuffer = (char*)malloc(PROFILE_STACK_MAX);
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = onTick;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGPROF, &action, NULL);
+
+        struct itimerval timer = {
+            .it_interval = {.tv_sec = 0, .tv_usec = PROFILE_INTERVAL},
+            .it_value = {.tv_sec = 0, .tv_usec = PROFILE_INTERVAL},
+        };
+        setitimer(ITIMER_PROF, &timer, NULL);
+    }
+}
+
+/**
+ * Implementation of method for recording that a frame has been entered.
+ */
+void profileCall(int frame) {
+    if (vm != profiled) {
+        return;
+    }
+
+    if (profileMode & PROFILE_SAMPLES) {
+        takeSamples();
+    }
+    if (!(profileMode & PROFILE_CALLS)) {
+        return;
+    }
+
+    if (frame >= frameCapacity) {
+        int capacity = frameCapacity < 64 ? 64 : frameCapacity;
+        while (capacity <= frame) {
+            capacity *= 2;
+        }
+        frames = (FrameProfile*)realloc(frames, sizeof(FrameProfile) * capacity);
+        memset(frames + frameCapacity, 0, sizeof(FrameProfile) * (capacity - frameCapacity));
+        frameCapacity = capacity;
+    }
+    if (frame >= frameTop) {
+        frameTop = frame + 1;
+    }
+
+    uint64_t time = now();
+    // a frame that was unwound by an error, or moved into a fiber, never returned here
+    if (frames[frame].function != NULL) {
+        functions[frames[frame].profile].active--;
+        frames[frame].function = NULL;
+    }
+
+    ObjFunction* function = vm->frames[frame].closure->function;
+    int index = functionProfile(function);
+    functions[index].calls++;
+    functions[index].active++;
+    frames[frame] = (FrameProfile){.function = function, .profile = index, .start = time};
+}
+
+/**
+ * Implementation of method for recording that a frame is about to return.
+ */
+void profileReturn(int frame) {
+    if (vm != profiled) {
+        return;
+    }
+
+    if (profileMode & PROFILE_SAMPLES) {
+        takeSamples();
+    }
+    if (!(profileMode & PROFILE_CALLS)) {
+        return;
+    }
+
+    // fibers resumed at a different depth return from frames that weren't entered there
+    if (frame < frameTop && frames[frame].function == vm->frames[frame].closure->function) {
+        finishFrame(frame, now());
+    }
+}
+
+/**
+ * Implementation of method for taking samples at a back edge.
+ */
+void profileSample() {
+    if (vm == profiled) {
+        takeSamples();
+    }
+}
+
+/**
+ * Method for ordering functions by their exclusive time, most first.
+ */
+static int compareFunctions(const void* a, const void* b) {
+    const FunctionProfile* left = (const FunctionProfile*)a;
+    const FunctionProfile* right = (const FunctionProfile*)b;
+    if (left->self != right->self) {
+        return left->self < right->self ? 1 : -1;
+    }
+    return strcmp(left->name, right->name);
+}
+
+/**
+ * Method for ordering collapsed stacks by name.
+ */
+static int compareSamples(const void* a, const void* b) {
+    return strcmp(((const StackSamples*)a)->stack, ((const StackSamples*)b)->stack);
+}
+
+/**
+ * Implementation of method for stopping the profiler and writing what it recorded.
+ */
+void writeProfile(FILE* out, const char* samplesPath) {
+    if (profileMode & PROFILE_SAMPLES) {
+        struct itimerval timer;
+        memset(&timer, 0, sizeof(timer));
+        setitimer(ITIMER_PROF, &timer, NULL);
+        signal(SIGPROF, SIG_IGN);
+    }
+
+    if (profileMode & PROFILE_CALLS) {
+        // frames still running, when an error stopped the program, end now
+        uint64_t time = now();
+        for (int i = frameTop - 1; i >= 0; i--) {
+            if (frames[i].function != NULL) {
+                finishFrame(i, time);
+            }
+        }
+
+        if (functionCount > 0) {
+            qsort(functions, functionCount, sizeof(FunctionProfile), compareFunctions);
+        }
+        fprintf(out, "%10s %12s %12s  %s\n", "calls", "total ms", "self ms", "function");
+        for (int i = 0; i < functionCount; i++) {
+            const FunctionProfile* profile = &functions[i];
+            fprintf(out, "%10ld %12.3f %12.3f  %s\n", profile->calls,
+                profile->total / 1e6, profile->self / 1e6, profile->name);
+        }
+    }
+
+    if (profileMode & PROFILE_SAMPLES) {
+        // packed down to the stacks that were sampled, to sort
+        int count = 0;
+        for (int i = 0; i < sampleCapacity; i++) {
+            if (samples[i].stack != NULL) {
+                samples[count++] = samples[i];
+            }
+        }
+        if (count > 0) {
+            qsort(samples, count, sizeof(StackSamples), compareSamples);
+        }
+
+        FILE* file = fopen(samplesPath, "w");
+        if (file == NULL) {
+            fprintf(out, "Could not write samples to \"%s\".\n", samplesPath);
+        } else {
+            for (int i = 0; i < count; i++) {
+                fprintf(file, "%s %ld\n", samples[i].stack, samples[i].count);
+            }
+            fclose(file);
+            fprintf(out, "%ld samples of %d stacks written to %s\n", sampleTotal, count, samplesPath);
+        }
+        for (int i = 0; i < count; i++) {
+            free(samples[i].stack);
+        }
+    }
+
+    for (int i = 0; i < functionCount; i++) {
+        free(functions[i].name);
+    }
+    free(functions);
+    free(functionIndex);
+    free(frames);
+    free(samples);
+    free(stackBuffer);
+    functions = NULL;
+    functionIndex = NULL;
+    frames = NULL;
+    samples = NULL;
+    stackBuffer = NULL;
+    functionCount = functionCapacity = functionIndexCapacity = 0;
+    frameCapacity = frameTop = 0;
+    sampleCount = sampleCapacity = 0;
+    profileMode = 0;
+    profiled->profile = 0;
+    profiled = NULL;
+}
@@ -0,0 +1,98 @@
+/**
+ * @file shape.c
+ */
+
+#include "core/gc.h"
+#include "core/memory.h"
+#include "core/object.h"
+#include "core/shape.h"
+
+/**
+ * Method for allocating a shape.
+ */
+static Shape* allocateShape(struct ObjClass* owner, Shape* parent, ObjString* name) {
+    Shape* shape = ALLOCATE(Shape, 1);
+    shape->owner = owner;
+    shape->parent = parent;
+    shape->name = name;
+    shape->fieldCount = parent == NULL ? 0 : parent->fieldCount + 1;
+    initTable(&shape->slots);
+    shape->transitionCount = 0;
+    shape->transitionCapacity = 0;
+    shape->transitions = NULL;
+    return shape;
+}
+
+/**
+ * Implementation of method to create a root shape.
+ */
+Shape* newShape(struct ObjClass* owner) {
+    return allocateShape(owner, NULL, NULL);
+}
+
+/**
+ * Implementation of method to get the index of a field in a shape.
+ */
+int shapeSlot(Shape* shape, ObjString* name) {
+    Value index;
+    if (!tableGet(&shape->slots, OBJ_VAL(name), &index)) {
+        return -1;
+    }
+    return (int)AS_NUMBER(index);
+}
+
+/**
+ * Implementation of method to transition a shape.
+ *
+ * The child is linked into the parent's transitions before its slots
+ * are filled in so it's reachable if filling the table triggers a GC.
+ */
+Shape* shapeTransition(Shape* shape, ObjString* name) {
+    for (int i = 0; i < shape->transitionCount; i++) {
+        if (shape->transitions[i]->name == name) {
+            return shape->transitions[i];
+        }
+    }
+
+    if (shape->transitionCapacity < shape->transitionCount + 1) {
+        int oldCapacity = shape->transitionCapacity;
+        shape->transitionCapacity = GROW_CAPACITY(oldCapacity);
+        shape->transitions = GROW_ARRAY(Shape*, shape->transitions, oldCapacity, shape->transitionCapacity);
+    }
+
+    Shape* child = allocateShape(shape->owner, shape, name);
+    shape->transitions[shape->transitionCount++] = child;
+    tableAddAll(&shape->slots, &child->slots);
+    tableSet(&child->slots, OBJ_VAL(name), NUMBER_VAL((double)shape->fieldCount));
+    writeBarrier((Obj*)shape->owner, OBJ_VAL(name));
+    return child;
+}
+
+/**
+ * Implementation of method to mark a shape.
+ */
+void markShape(Shape* shape) {
+    if (shape == NULL) {
+        return;
+    }
+    markObject((Obj*)shape->name);
+    markTable(&shape->slots);
+    for (int i = 0; i < shape->transitionCount; i++) {
+        markShape(shape->transitions[i]);
+    }
+}
+
+/**
+ * Implementation of method to free a shape.
+ */
+void freeShape(Shape* shape) {
+    if (shape == NULL) {
+        return;
+    }
+    for (int i = 0; i < shape->transitionCount; i++) {
+        freeShape(shape->transitions[i]);
+    }
+    FREE_ARRAY(Shape*, shape->transitions, shape->transitionCapacity);
+    freeTable(&shape->slots);
+    FREE(Shape, shape);
+}
@@ -0,0 +1,163 @@
+/**
+ * @file snapshot.c
+ * @brief Implementation of heap snapshots.
+ *
+ * A snapshot is laid out as:
+ *   - the magic bytes, format version and slo version
+ *   - the globals and everything they reach, packed as a thread's are
+ *
+ * The functions in it are stored as bytecode, so it's only valid for the
+ * version of slo that wrote it. The packed values are in the byte order
+ * of the machine that wrote it.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/bytecode.h"
+#include "core/snapshot.h"
+#include "core/vm.h"
+#include "std/thread.h"
+
+#include "version.h"
+
+/**
+ * Method for writing a 32-bit integer, little-endian.
+ */
+static bool writeUint32(FILE* file, uint32_t value) {
+    uint8_t bytes[4] = {value & 0xff, (value >> 8) & 0xff, (value >> 16) & 0xff, (value >> 24) & 0xff};
+    return fwrite(bytes, 1, sizeof(bytes), file) == sizeof(bytes);
+}
+
+/**
+ * Method for reading a 32-bit integer, little-endian.
+ */
+static uint32_t readUint32(const uint8_t* bytes) {
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+/**
+ * Implementation of method to write a snapshot.
+ */
+bool writeSnapshot(const char* path) {
+    Value error;
+    Message* message = packWithGlobals(NIL_VAL, true, &error);
+    if (message == NULL) {
+        return false;
+    }
+    if (message->channelCount > 0) {
+        // channels are shared with other threads, which won't be there when it's loaded
+        fprintf(stderr, "Channels can't be saved in a snapshot.\n");
+        freeMessage(message);
+        return false;
+    }
+
+    char* tempPath = (char*)malloc(strlen(path) + 5);
+    if (tempPath == NULL) {
+        freeMessage(message);
+        return false;
+    }
+    sprintf(tempPath, "%s.tmp", path);
+
+    bool written = false;
+    FILE* file = fopen(tempPath, "wb");
+    if (file != NULL) {
+        uint32_t versionLength = (uint32_t)strlen(SLO_VERSION);
+        written = fwrite(SNAPSHOT_MAGIC, 1, 4, file) == 4
+            && writeUint32(file, SLOC_FORMAT_VERSION)
+            && writeUint32(file, versionLength)
+            && fwrite(SLO_VERSION, 1, versionLength, file) == versionLength
+            && fwrite(message->bytes, 1, message->count, file) == message->count;
+        written = fclose(file) == 0 && written;
+        if (written) {
+            written = rename(tempPath, path) == 0;
+        }
+        if (!written) {
+            remove(tempPath);
+        }
+    }
+
+    free(tempPath);
+    freeMessage(message);
+    return written;
+}
+
+/**
+ * Method for reading a whole snapshot into memory.
+ */
+static uint8_t* readSnapshotFile(const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    fseek(file, 0L, SEEK_END);
+    long fileSize = ftell(file);
+    rewind(file);
+
+    uint8_t* buffer = fileSize > 0 ? (uint8_t*)malloc(fileSize) : NULL;
+    if (buffer != NULL && fread(buffer, 1, fileSize, file) != (size_t)fileSize) {
+        free(buffer);
+        buffer = NULL;
+    }
+    fclose(file);
+
+    *size = (size_t)fileSize;
+    return buffer;
+}
+
+/**
+ * Method for checking a snapshot was written by this version of slo, returning where its values start.
+ *
+ * Returns 0 if it wasn't.
+ */
+static size_t checkHeader(const uint8_t* bytes, size_t size) {
+    size_t versionLength = strlen(SLO_VERSION);
+    size_t headerSize = 12 + versionLength;
+    if (size < headerSize || memcmp(bytes, SNAPSHOT_MAGIC, 4) != 0
+            || readUint32(bytes + 4) != SLOC_FORMAT_VERSION || readUint32(bytes + 8) != versionLength
+            || memcmp(bytes + 12, SLO_VERSION, versionLength) != 0) {
+        return 0;
+    }
+    return headerSize;
+}
+
+/**
+ * Implementation of method to load a snapshot and call its main().
+ */
+InterpretResult interpretSnapshot(const char* path) {
+    size_t size = 0;
+    uint8_t* bytes = readSnapshotFile(path, &size);
+    if (bytes == NULL) {
+        fprintf(stderr, "Could not load snapshot \"%s\".\n", path);
+        return INTERPRET_COMPILE_ERROR;
+    }
+    size_t start = checkHeader(bytes, size);
+    if (start == 0) {
+        fprintf(stderr, "Snapshot \"%s\" wasn't made by this version of slo.\n", path);
+        free(bytes);
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    Message message;
+    memset(&message, 0, sizeof(message));
+    message.bytes = bytes + start;
+    message.count = size - start;
+    Value unpacked = unpackWithGlobals(&message);
+    free(bytes);
+    if (IS_ERROR(unpacked)) {
+        fprintf(stderr, "Snapshot \"%s\" is corrupt.\n", path);
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    Value entry;
+    if (!getGlobal(copyString(SNAPSHOT_ENTRY, (int)strlen(SNAPSHOT_ENTRY)), &entry)) {
+        fprintf(stderr, "Snapshot \"%s\" has no %s() to run.\n", path, SNAPSHOT_ENTRY);
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    Value result;
+    return callFunction(entry, 0, NULL, &result) ? INTERPRET_OK : INTERPRET_RUNTIME_ERROR;
+}
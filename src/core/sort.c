@@ -0,0 +1,267 @@
+/**
+ * @file sort.c
+ * @brief Implementation of stable sorting of values.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/object.h"
+#include "core/sort.h"
+
+/**
+ * Runs shorter than this are extended with an insertion sort before merging.
+ */
+#define MIN_RUN 32
+
+/**
+ * What a list of values (or keys) holds, so the fast paths can be picked.
+ */
+typedef enum SortKind {
+    SORT_NUMBERS,
+    SORT_STRINGS,
+    SORT_MIXED
+} SortKind;
+
+/**
+ * A value along with its pre-extracted key.
+ */
+typedef struct NumberItem {
+    double key;
+    Value value;
+} NumberItem;
+
+typedef struct StringItem {
+    ObjString* key;
+    Value value;
+} StringItem;
+
+typedef struct ValueItem {
+    Value key;
+    Value value;
+} ValueItem;
+
+/**
+ * Method for allocating a scratch buffer for sorting.
+ *
+ * These are freed before the sort returns and hold nothing the GC needs to see.
+ */
+static void* allocateScratch(size_t size) {
+    void* buffer = malloc(size > 0 ? size : 1);
+    if (buffer == NULL) {
+        exit(1);
+    }
+    return buffer;
+}
+
+/**
+ * Method for comparing two strings by their bytes, with the shorter first on a tie.
+ */
+static inline int compareStrings(const ObjString* a, const ObjString* b) {
+    int length = a->length < b->length ? a->length : b->length;
+    int result = memcmp(a->chars, b->chars, length);
+    return result != 0 ? result : (a->length > b->length) - (a->length < b->length);
+}
+
+#define NUMBER_LESS(a, b) ((a) < (b))
+#define STRING_LESS(a, b) (compareStrings((a), (b)) < 0)
+#define VALUE_LESS(a, b) (valueCompare(&(a), &(b)) < 0)
+#define NUMBER_ITEM_LESS(a, b) ((a).key < (b).key)
+#define STRING_ITEM_LESS(a, b) (compareStrings((a).key, (b).key) < 0)
+#define VALUE_ITEM_LESS(a, b) (valueCompare(&(a).key, &(b).key) < 0)
+
+/**
+ * Macro for defining a stable merge sort of TYPE ordered by LESS.
+ *
+ * Like timsort, the input is split into natural runs: ascending ones, or strictly
+ * descending ones that are reversed in place. Short runs are extended to MIN_RUN
+ * with an insertion sort and the runs are then merged pairwise until one is left.
+ * A merge is skipped when the two runs are already in order, so sorted and
+ * nearly sorted input is handled in close to linear time.
+ */
+#define DEFINE_MERGE_SORT(NAME, TYPE, LESS) \
+    static void NAME##Merge(TYPE* items, TYPE* scratch, int start, int mid, int end) { \
+        if (!LESS(items[mid], items[mid - 1])) { \
+            return; \
+        } \
+        int leftCount = mid - start; \
+        memcpy(scratch, items + start, sizeof(TYPE) * leftCount); \
+        int i = 0; \
+        int j = mid; \
+        int k = start; \
+        while (i < leftCount && j < end) { \
+            if (LESS(items[j], scratch[i])) { \
+                items[k++] = items[j++]; \
+            } else { \
+                items[k++] = scratch[i++]; \
+            } \
+        } \
+        while (i < leftCount) { \
+            items[k++] = scratch[i++]; \
+        } \
+    } \
+    \
+    static void NAME(TYPE* items, int count) { \
+        if (count < 2) { \
+            return; \
+        } \
+        /* every run but the last is at least MIN_RUN long, plus one for the end */ \
+        int* runs = (int*)allocateScratch(sizeof(int) * (count / MIN_RUN + 2)); \
+        int runCount = 0; \
+        int start = 0; \
+        while (start < count) { \
+            int end = start + 1; \
+            if (end < count && LESS(items[end], items[start])) { \
+                while (end < count && LESS(items[end], items[end - 1])) { \
+                    end++; \
+                } \
+                for (int lo = start, hi = end - 1; lo < hi; lo++, hi--) { \
+                    TYPE swap = items[lo]; \
+                    items[lo] = items[hi]; \
+                    items[hi] = swap; \
+                } \
+            } else { \
+                while (end < count && !LESS(items[end], items[end - 1])) { \
+                    end++; \
+                } \
+            } \
+            int limit = start + MIN_RUN < count ? start + MIN_RUN : count; \
+            for (; end < limit; end++) { \
+                TYPE item = items[end]; \
+                int slot = end; \
+                while (slot > start && LESS(item, items[slot - 1])) { \
+                    items[slot] = items[slot - 1]; \
+                    slot--; \
+                } \
+                items[slot] = item; \
+            } \
+            runs[runCount++] = start; \
+            start = end; \
+        } \
+        runs[runCount] = count; \
+        \
+        TYPE* scratch = (TYPE*)allocateScratch(sizeof(TYPE) * count); \
+        while (runCount > 1) { \
+            int merged = 0; \
+            for (int r = 0; r < runCount; r += 2) { \
+                if (r + 1 < runCount) { \
+                    NAME##Merge(items, scratch, runs[r], runs[r + 1], runs[r + 2]); \
+                } \
+                runs[merged++] = runs[r]; \
+            } \
+            runs[merged] = count; \
+            runCount = merged; \
+        } \
+        free(scratch); \
+        free(runs); \
+    }
+
+DEFINE_MERGE_SORT(sortNumbers, double, NUMBER_LESS)
+DEFINE_MERGE_SORT(sortStrings, ObjString*, STRING_LESS)
+DEFINE_MERGE_SORT(sortMixed, Value, VALUE_LESS)
+DEFINE_MERGE_SORT(sortNumberItems, NumberItem, NUMBER_ITEM_LESS)
+DEFINE_MERGE_SORT(sortStringItems, StringItem, STRING_ITEM_LESS)
+DEFINE_MERGE_SORT(sortValueItems, ValueItem, VALUE_ITEM_LESS)
+
+/**
+ * Method for checking whether values are all numbers, all strings or a mix.
+ */
+static SortKind sortKind(Value* values, int count) {
+    bool numbers = true;
+    bool strings = true;
+    for (int i = 0; i < count && (numbers || strings); i++) {
+        numbers = numbers && IS_NUMBER(values[i]);
+        strings = strings && IS_STRING(values[i]);
+    }
+    if (numbers) {
+        return SORT_NUMBERS;
+    }
+    return strings ? SORT_STRINGS : SORT_MIXED;
+}
+
+void sortValues(Value* values, int count) {
+    if (count < 2) {
+        return;
+    }
+
+    switch (sortKind(values, count)) {
+        case SORT_NUMBERS: {
+            double* numbers = (double*)allocateScratch(sizeof(double) * count);
+            for (int i = 0; i < count; i++) {
+                numbers[i] = AS_NUMBER(values[i]);
+            }
+            sortNumbers(numbers, count);
+            for (int i = 0; i < count; i++) {
+                values[i] = NUMBER_VAL(numbers[i]);
+            }
+            free(numbers);
+            break;
+        }
+        case SORT_STRINGS: {
+            ObjString** strings = (ObjString**)allocateScratch(sizeof(ObjString*) * count);
+            for (int i = 0; i < count; i++) {
+                strings[i] = AS_STRING(values[i]);
+            }
+            sortStrings(strings, count);
+            for (int i = 0; i < count; i++) {
+                values[i] = OBJ_VAL(strings[i]);
+            }
+            free(strings);
+            break;
+        }
+        case SORT_MIXED:
+            sortMixed(values, count);
+            break;
+    }
+}
+
+void sortValuesByKey(Value* values, Value* keys, int count) {
+    if (count < 2) {
+        return;
+    }
+
+    switch (sortKind(keys, count)) {
+        case SORT_NUMBERS: {
+            NumberItem* items = (NumberItem*)allocateScratch(sizeof(NumberItem) * count);
+            for (int i = 0; i < count; i++) {
+                items[i].key = AS_NUMBER(keys[i]);
+                items[i].value = values[i];
+            }
+            sortNumberItems(items, count);
+            for (int i = 0; i < count; i++) {
+                keys[i] = NUMBER_VAL(items[i].key);
+                values[i] = items[i].value;
+            }
+            free(items);
+            break;
+        }
+        case SORT_STRINGS: {
+            StringItem* items = (StringItem*)allocateScratch(sizeof(StringItem) * count);
+            for (int i = 0; i < count; i++) {
+                items[i].key = AS_STRING(keys[i]);
+                items[i].value = values[i];
+            }
+            sortStringItems(items, count);
+            for (int i = 0; i < count; i++) {
+                keys[i] = OBJ_VAL(items[i].key);
+                values[i] = items[i].value;
+            }
+            free(items);
+            break;
+        }
+        case SORT_MIXED: {
+            ValueItem* items = (ValueItem*)allocateScratch(sizeof(ValueItem) * count);
+            for (int i = 0; i < count; i++) {
+                items[i].key = keys[i];
+                items[i].value = values[i];
+            }
+            sortValueItems(items, count);
+            for (int i = 0; i < count; i++) {
+                keys[i] = items[i].key;
+                values[i] = items[i].value;
+            }
+            free(items);
+            break;
+        }
+    }
+}
@@ -1,5 +1,9 @@
 /**
  * @file table.c
+ *
+ * Tables keep their entries in a dense array in insertion order, with a
+ * separate open addressed index of positions into that array. The index
+ * is a power of two in size so probing can mask rather than divide.
  */
 
 #include <stdlib.h>
@@ -12,50 +16,63 @@
 
 #define TABLE_MAX_LOAD 0.75
 
+// markers for index slots that don't point at an entry
+#define INDEX_EMPTY -1
+#define INDEX_DELETED -2
+
+// the entries array holds as many entries as the index can take before growing
+#define ENTRY_CAPACITY(capacity) ((int)((capacity) * TABLE_MAX_LOAD))
+
 /**
  * Method for initialising a table.
  */
 void initTable(Table* table) {
     table->count = 0;
+    table->entryCount = 0;
     table->capacity = 0;
+    table->index = NULL;
     table->entries = NULL;
 }
 
 /**
  * Method for freeing a table.
  *
- * Frees the array and then re-initialises the table.
+ * Frees the arrays and then re-initialises the table.
  */
 void freeTable(Table* table) {
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    FREE_ARRAY(int32_t, table->index, table->capacity);
+    FREE_ARRAY(Entry, table->entries, ENTRY_CAPACITY(table->capacity));
     initTable(table);
 }
 
 /**
- * Method for finding an entry in the table for a given key.
+ * Method for finding the index slot for a given key.
+ *
+ * Returns the slot holding the key if it's in the table; otherwise the
+ * slot a new entry for it should go in, reusing the first deleted slot we passed.
+ * Entries whose cached hash differs are skipped without comparing the keys.
  */
-static Entry* findEntry(Entry* entries, int capacity, Value key) {
-
-    uint32_t index = hashValue(key) % capacity;
-    Entry* tombstone = NULL;
+static int32_t* findSlot(Table* table, Value key, uint32_t hash) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t index = hash & mask;
+    int32_t* tombstone = NULL;
 
     for (;;) {
-        Entry* entry = &entries[index];
-        if (IS_EMPTY(entry->key)) {
-            if (IS_NIL(entry->value)) {
-                // found an empty entry
-                return tombstone != NULL ? tombstone : entry;
-            } else {
-                // found a tombstone
-                if (tombstone == NULL) {
-                    tombstone = entry;
-                }
+        int32_t* slot = &table->index[index];
+        if (*slot == INDEX_EMPTY) {
+            return tombstone != NULL ? tombstone : slot;
+        } else if (*slot == INDEX_DELETED) {
+            if (tombstone == NULL) {
+                tombstone = slot;
+            }
+        } else {
+            Entry* entry = &table->entries[*slot];
+            if (entry->hash == hash && valuesEqual(key, entry->key)) {
+                return slot;
             }
-        } else if (valuesEqual(key, entry->key)) {
-            return entry;
         }
 
-        index = (index + 1) % capacity;
+        index = (index + 1) & mask;
     }
 }
 
@@ -67,12 +84,12 @@ bool tableGet(Table* table, Value key, Value* value) {
         return false;
     }
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (IS_EMPTY(entry->key) || IS_NIL(entry->key)) {
+    int32_t* slot = findSlot(table, key, hashValue(key));
+    if (*slot < 0) {
         return false;
     }
 
-    *value = entry->value;
+    *value = table->entries[*slot].value;
     return true;
 }
 
@@ -80,95 +97,159 @@ bool tableGet(Table* table, Value key, Value* value) {
  * Method for clearing the table.
  */
 void tableClear(Table* table) {
-    for (int i = 0; i < table->capacity; i++) {
-        Entry* entry = &table->entries[i];
-        entry->key = EMPTY_VAL;
-        entry->value = NIL_VAL;
-    }
     freeTable(table);
 }
 
+/**
+ * Method for pointing a free slot in an index at the given entry position.
+ *
+ * Only used when rebuilding an index, where we know the key isn't already present.
+ */
+static void indexEntry(int32_t* index, int capacity, uint32_t hash, int position) {
+    uint32_t mask = capacity - 1;
+    uint32_t slot = hash & mask;
+    while (index[slot] != INDEX_EMPTY) {
+        slot = (slot + 1) & mask;
+    }
+    index[slot] = position;
+}
+
 /**
  * Method for adjusting the capacity of a table.
+ *
+ * Rebuilds the index and moves the live entries to the front of the
+ * new entries array, dropping any deleted ones but keeping their order.
  */
 static void adjustCapacity(Table* table, int capacity) {
-    Entry* entries = ALLOCATE(Entry, capacity);
-
-    // initialise everything to null/nil
+    int32_t* index = ALLOCATE(int32_t, capacity);
+    Entry* entries = ALLOCATE(Entry, ENTRY_CAPACITY(capacity));
     for (int i = 0; i < capacity; i++) {
-        entries[i].key = EMPTY_VAL;
-        entries[i].value = NIL_VAL;
+        index[i] = INDEX_EMPTY;
     }
 
-    // reinsert any existing entries into the new table
-    table->count = 0;
-    for (int i = 0; i < table->capacity; i++) {
+    int count = 0;
+    for (int i = 0; i < table->entryCount; i++) {
         Entry* entry = &table->entries[i];
         if (IS_EMPTY(entry->key)) {
             continue;
         }
 
-        Entry* dest = findEntry(entries, capacity, entry->key);
-        dest->key = entry->key;
-        dest->value = entry->value;
-        table->count++;
+        indexEntry(index, capacity, entry->hash, count);
+        entries[count++] = *entry;
     }
 
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    FREE_ARRAY(int32_t, table->index, table->capacity);
+    FREE_ARRAY(Entry, table->entries, ENTRY_CAPACITY(table->capacity));
+    table->index = index;
     table->entries = entries;
     table->capacity = capacity;
+    table->count = count;
+    table->entryCount = count;
+}
+
+/**
+ * Method for growing a table so it can hold count entries without growing again.
+ */
+void tableReserve(Table* table, int count) {
+    int capacity = table->capacity;
+    while (ENTRY_CAPACITY(capacity) < count) {
+        capacity = GROW_CAPACITY(capacity);
+    }
+    if (capacity != table->capacity) {
+        adjustCapacity(table, capacity);
+    }
 }
 
 /**
  * Method for inserting an entry into the table.
  */
 bool tableSet(Table* table, Value key, Value value) {
-    // make sure to initialise the table's array and that it's big enough
-    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-        int capacity = GROW_CAPACITY(table->capacity);
-        adjustCapacity(table, capacity);
+    uint32_t hash = hashValue(key);
+    if (table->count > 0) {
+        int32_t* slot = findSlot(table, key, hash);
+        if (*slot >= 0) {
+            table->entries[*slot].value = value;
+            return false;
+        }
     }
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    bool isNewKey = IS_EMPTY(entry->key);
-    if (isNewKey && IS_NIL(entry->value)) {
-        table->count++;
+    // make sure there's room to append; if enough of the entries are
+    // deleted we can just compact them rather than growing
+    if (table->entryCount + 1 > ENTRY_CAPACITY(table->capacity)) {
+        int capacity = table->capacity;
+        if (table->count + 1 > ENTRY_CAPACITY(capacity) / 2) {
+            capacity = GROW_CAPACITY(capacity);
+        }
+        adjustCapacity(table, capacity);
     }
 
+    int32_t* slot = findSlot(table, key, hash);
+    *slot = table->entryCount;
+    Entry* entry = &table->entries[table->entryCount++];
     entry->key = key;
     entry->value = value;
-    return isNewKey;
+    entry->hash = hash;
+    table->count++;
+    return true;
 }
 
 /**
  * Method for deleting an entry from a table.
  *
- * To delete an entry, and maintain any linking, we replace the
- * entry with a 'tombstone' value. This indicates to findEntry that there
+ * To delete an entry, and maintain any probe sequences through it, we replace its
+ * index slot with a 'tombstone'. This indicates to findSlot that there
  * used to be value there - so when searching for a key we keep going if
- * we encounter a tombstone.
+ * we encounter a tombstone. The entry itself is emptied so iteration skips it.
  */
 bool tableDelete(Table* table, Value key) {
     if (table->count == 0) {
         return false;
     }
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (IS_EMPTY(entry->key)) {
+    int32_t* slot = findSlot(table, key, hashValue(key));
+    if (*slot < 0) {
         return false;
     }
 
-    // insert a tombstone
+    Entry* entry = &table->entries[*slot];
     entry->key = EMPTY_VAL;
-    entry->value = BOOL_VAL(true);
+    entry->value = NIL_VAL;
+    *slot = INDEX_DELETED;
+    table->count--;
     return true;
 }
 
 /**
  * Method for copying all the entries of one table to another.
+ *
+ * Copying into an empty table (e.g. cloning) sizes it once and copies
+ * the live entries straight across, rebuilding the index as it goes.
  */
 void tableAddAll(Table* from, Table* to) {
-    for (int i = 0; i < from->capacity; i++) {
+    if (from->count == 0) {
+        return;
+    }
+    if (to->count == 0) {
+        int capacity = to->capacity;
+        while (ENTRY_CAPACITY(capacity) < from->count) {
+            capacity = GROW_CAPACITY(capacity);
+        }
+        adjustCapacity(to, capacity);
+
+        for (int i = 0; i < from->entryCount; i++) {
+            Entry* entry = &from->entries[i];
+            if (!IS_EMPTY(entry->key)) {
+                indexEntry(to->index, to->capacity, entry->hash, to->entryCount);
+                to->entries[to->entryCount++] = *entry;
+            }
+        }
+        to->count = to->entryCount;
+        return;
+    }
+
+    // grown once for all of them, as if none of the keys were already there
+    tableReserve(to, to->count + from->count);
+    for (int i = 0; i < from->entryCount; i++) {
         Entry* entry = &from->entries[i];
         if (!IS_EMPTY(entry->key)) {
             tableSet(to, entry->key, entry->value);
@@ -183,18 +264,23 @@ ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t
     if (table->count == 0) {
         return NULL;
     }
-    uint32_t index = hash % table->capacity;
+    uint32_t mask = table->capacity - 1;
+    uint32_t index = hash & mask;
     for (;;) {
-        Entry* entry = &table->entries[index];
-        if (IS_EMPTY(entry->key)) {
+        int32_t slot = table->index[index];
+        if (slot == INDEX_EMPTY) {
             return NULL;
         }
 
-        ObjString* string = AS_STRING(entry->key);
-        if (string->length == length && memcmp(string->chars, chars, length) == 0) {
-            return string;
+        if (slot != INDEX_DELETED) {
+            Entry* entry = &table->entries[slot];
+            ObjString* string = AS_STRING(entry->key);
+            if (entry->hash == hash && string->length == length
+                    && memcmp(string->chars, chars, length) == 0) {
+                return string;
+            }
         }
 
-        index = (index + 1) % table->capacity;
+        index = (index + 1) & mask;
     }
 }
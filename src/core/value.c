@@ -6,9 +6,11 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "core/hash.h"
 #include "core/object.h"
 #include "core/memory.h"
 #include "core/value.h"
+#include "core/writer.h"
 
 /**
  * Implemention of method to initialise a value array.
@@ -30,6 +32,17 @@ void growValueArray(ValueArray* array) {
     array->values = GROW_ARRAY(Value, array->values, oldCapacity, array->capacity);
 }
 
+/**
+ * Method for making sure a ValueArray has room for at least capacity values.
+ */
+void reserveValueArray(ValueArray* array, int capacity) {
+    if (array->capacity >= capacity) {
+        return;
+    }
+    array->values = GROW_ARRAY(Value, array->values, array->capacity, capacity);
+    array->capacity = capacity;
+}
+
 /**
  * Method to shrink a ValueArray.
  */
@@ -73,27 +86,11 @@ void freeValueArray(ValueArray* array) {
  * Implementation of method to print a value.
  */
 void printValue(Value value) {
-    switch (value.type) {
-        case VAL_BOOL:
-            printf(AS_BOOL(value) ? "true" : "false");
-            break;
-        case VAL_NIL:
-            printf("nil");
-            break;
-        case VAL_NUMBER:
-            printf("%g", AS_NUMBER(value));
-            break;
-        case VAL_OBJ:
-            printObject(value);
-            break;
-        case VAL_EMPTY:
-            printf("<empty>");
-            break;
-        case VAL_ERROR:
-            printf("<exception>");
-        default:
-            return;
-    }
+    char buffer[PRINT_BUFFER_SIZE];
+    Writer writer;
+    initFileWriter(&writer, stdout, buffer, sizeof(buffer));
+    writePrintedValue(&writer, value);
+    flushWriter(&writer);
 }
 
 /**
@@ -101,27 +98,42 @@ void printValue(Value value) {
  *
  * First checks the types - if they're not the same then easy false.
  * Otherwise, get the raw values and compare.
+ * An int and a double are both numbers, so are compared by value.
  */
 bool valuesEqual(Value a, Value b) {
-    if (a.type != b.type) {
+    if (IS_INT(a) && IS_INT(b)) {
+        return AS_INT(a) == AS_INT(b);
+    }
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        return AS_NUMBER(a) == AS_NUMBER(b);
+    }
+    if (VALUE_TYPE(a) != VALUE_TYPE(b)) {
         return false;
     }
 
-    switch (a.type) {
+    switch (VALUE_TYPE(a)) {
         case VAL_BOOL:
             return AS_BOOL(a) == AS_BOOL(b);
         case VAL_NIL:
             return true;
-        case VAL_NUMBER:
-            return AS_NUMBER(a) == AS_NUMBER(b);
         case VAL_OBJ:
             if (OBJ_TYPE(a) != OBJ_TYPE(b)) {
                 return false;
             }
             switch (OBJ_TYPE(a)) {
-                case OBJ_STRING:
-                    return AS_STRING(a)->length == AS_STRING(b)->length &&
-                           memcmp(AS_STRING(a)->chars, AS_STRING(b)->chars, AS_STRING(a)->length) == 0;
+                case OBJ_STRING: {
+                    ObjString* sa = AS_STRING(a);
+                    ObjString* sb = AS_STRING(b);
+                    if (sa == sb) {
+                        return true;
+                    }
+                    // two interned strings are only equal if they're the same object
+                    if ((sa->interned && sb->interned) || sa->length != sb->length
+                            || (sa->hashed && sb->hashed && sa->hash != sb->hash)) {
+                        return false;
+                    }
+                    return memcmp(sa->chars, sb->chars, sa->length) == 0;
+                }
                 case OBJ_LIST:
                     ObjList* la = AS_LIST(a);
                     ObjList* lb = AS_LIST(b);
@@ -147,11 +159,17 @@ int valueCompare(const void* a, const void* b) {
     const Value* va = (const Value*)a;
     const Value* vb = (const Value*)b;
 
-    if (IS_NUMBER(*va) && IS_NUMBER(*vb)) {
+    if (IS_INT(*va) && IS_INT(*vb)) {
+        return (AS_INT(*va) > AS_INT(*vb)) - (AS_INT(*va) < AS_INT(*vb));
+    } else if (IS_NUMBER(*va) && IS_NUMBER(*vb)) {
         double diff = AS_NUMBER(*va) - AS_NUMBER(*vb);
         return (diff > 0) - (diff < 0);
     } else if (IS_STRING(*va) && IS_STRING(*vb)) {
-        return strcmp(AS_CSTRING(*va), AS_CSTRING(*vb));
+        ObjString* sa = AS_STRING(*va);
+        ObjString* sb = AS_STRING(*vb);
+        int length = sa->length < sb->length ? sa->length : sb->length;
+        int result = memcmp(sa->chars, sb->chars, length);
+        return result != 0 ? result : (sa->length > sb->length) - (sa->length < sb->length);
     } else {
         // Fallback: numbers < strings < others
         if (IS_NUMBER(*va)) return -1;
@@ -165,45 +183,42 @@ int valueCompare(const void* a, const void* b) {
 /**
  * Method for hashing a double.
  *
- * Taken from LUA's implementation for hashing a double.
+ * Doubles equal to an int hash as that int, as they're equal keys, and
+ * -0.0 hashes as 0. Anything else is hashed by its bits.
  */
 static uint32_t hashDouble(double value) {
-    union BitCast {
-        double value;
-        uint32_t ints[2];
-    };
+    if (value >= -9223372036854775808.0 && value < 9223372036854775808.0 && value == (double)(int64_t)value) {
+        return hashInteger((uint64_t)(int64_t)value);
+    }
 
-    union BitCast cast;
-    cast.value = (value) + 1.0;
-    return cast.ints[0] + cast.ints[1];
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return hashInteger(bits);
 }
 
 /**
  * Method for hashing a value.
  */
 uint32_t hashValue(Value value) {
-    switch (value.type) {
+    switch (VALUE_TYPE(value)) {
         case VAL_BOOL:
             return AS_BOOL(value) ? 3 : 5;
         case VAL_NIL:
             return 7;
         case VAL_NUMBER:
             return hashDouble(AS_NUMBER(value));
+        case VAL_INT:
+            return hashInteger((uint64_t)(int64_t)AS_INT(value));
         case VAL_OBJ:
-            Obj* obj = value.as.obj;
-            switch (obj->type) {
-                case OBJ_STRING:
-                    return AS_STRING(value)->hash;
-                case OBJ_LIST:
-                case OBJ_DICT:
-                    return (uint32_t)(uintptr_t)obj; // Use pointer as hash for lists and dicts
-                default:
-                    return (uint32_t)(uintptr_t)obj; // Use pointer as hash for other objects
+            if (IS_STRING(value)) {
+                return stringHash(AS_STRING(value));
             }
+            // everything else is keyed by identity
+            return hashAddress(AS_OBJ(value));
         case VAL_EMPTY:
             return 0;
         default:
-            printf("Unknown hash type: '%d'", value.type);
+            printf("Unknown hash type: '%d'", VALUE_TYPE(value));
             return 1;
     }
 }
@@ -212,10 +227,11 @@ uint32_t hashValue(Value value) {
  * Method for getting a ValueType as a string.
  */
 char* valueTypeToString(Value value) {
-    switch (value.type) {
+    switch (VALUE_TYPE(value)) {
         case VAL_BOOL: return "bool";
         case VAL_NIL: return "nil";
-        case VAL_NUMBER: return "number";
+        case VAL_NUMBER:
+        case VAL_INT: return "number";
         case VAL_OBJ: {
             switch (OBJ_TYPE(value)) {
                 case OBJ_STRING: return "string";
@@ -227,7 +243,20 @@ char* valueTypeToString(Value value) {
                 case OBJ_DICT: return "dict";
                 case OBJ_ENUM: return "enum";
                 case OBJ_FILE: return "file";
+                case OBJ_STRING_BUILDER: return "string builder";
+                case OBJ_ARRAY: return "array";
+                case OBJ_SET: return "set";
+                case OBJ_BYTES: return "bytes";
+                case OBJ_FIBER: return "fiber";
+                case OBJ_SOCKET: return "socket";
+                case OBJ_THREAD: return "thread";
+                case OBJ_RANGE: return "range";
+                case OBJ_RANDOM: return "random";
+                case OBJ_DICT_VIEW: return "dict view";
+                case OBJ_MEMO: return "memoised function";
+                case OBJ_CHANNEL: return "channel";
                 case OBJ_MODULE: return "module";
+                case OBJ_ERROR: return "exception";
                 default: return "object";
             }
         }
@@ -245,7 +274,7 @@ char* valueTypeToString(Value value) {
  *   - it is nil
  *   - it's a boolean 'false'
  *   - it's a number that's 0
- *   - an empty list or dict
+ *   - an empty list, dict, set or bytes
  *   - an empty string
  */
 bool isFalsey(Value value) {
@@ -262,6 +291,10 @@ bool isFalsey(Value value) {
         return AS_LIST(value)->count == 0;
     } else if (IS_DICT(value)) {
         return AS_DICT(value)->data.count == 0;
+    } else if (IS_SET(value)) {
+        return AS_SET(value)->data.count == 0;
+    } else if (IS_BYTES(value)) {
+        return AS_BYTES(value)->count == 0;
     } else {
         // everything else is truthy by default for now
         return false;
@@ -270,6 +303,9 @@ bool isFalsey(Value value) {
 
 /**
  * @brief converts a given value to a string.
+ *
+ * Containers are written into a single buffer that becomes the string,
+ * rather than each element being made into a string of its own first.
  */
 Value valueToString(Value value) {
     if (IS_STRING(value)) {
@@ -278,108 +314,12 @@ Value valueToString(Value value) {
         return OBJ_VAL(copyString("nil", 3));
     } else if (IS_BOOL(value)) {
         return OBJ_VAL(copyString(AS_BOOL(value) ? "true" : "false", AS_BOOL(value) ? 4 : 5));
-    } else if (IS_NUMBER(value)) {
-        char buffer[32];
-        int len = snprintf(buffer, sizeof(buffer), "%.14g", AS_NUMBER(value));
-        return OBJ_VAL(copyString(buffer, len));
-    } else if (IS_LIST(value)) {
-        ObjList* list = AS_LIST(value);
-        if (list->count == 0) {
-            return OBJ_VAL(copyString("[]", 2));
-        }
-        // Estimate buffer size: assume each element is up to 32 chars, plus commas and brackets
-        int bufSize = 2 + (list->count - 1) * 2 + list->count * 32;
-        char* buffer = ALLOCATE(char, bufSize);
-        int offset = 0;
-        buffer[offset++] = '[';
-        for (int i = 0; i < list->count; i++) {
-            Value itemStr = valueToString(list->values.values[i]);
-            if (IS_ERROR(itemStr)) {
-                FREE_ARRAY(char, buffer, bufSize);
-                return itemStr;
-            }
-            int len = AS_STRING(itemStr)->length;
-            if (offset + len + 3 > bufSize) {
-                // Grow buffer if needed
-                int newBufSize = bufSize * 2 + len + 3;
-                char* newBuffer = ALLOCATE(char, newBufSize);
-                memcpy(newBuffer, buffer, offset);
-                FREE_ARRAY(char, buffer, bufSize);
-                buffer = newBuffer;
-                bufSize = newBufSize;
-            }
-            memcpy(buffer + offset, AS_STRING(itemStr)->chars, len);
-            offset += len;
-            if (i < list->count - 1) {
-                buffer[offset++] = ',';
-                buffer[offset++] = ' ';
-            }
-        }
-        buffer[offset++] = ']';
-        buffer[offset] = '\0';
-        Value result = OBJ_VAL(copyString(buffer, offset));
-        FREE_ARRAY(char, buffer, bufSize);
-        return result;
-    } else if (IS_DICT(value)) {
-        ObjDict* dict = AS_DICT(value);
-        Table* table = &dict->data;
-        int count = 0;
-        // Count actual entries (non-empty)
-        for (int i = 0; i < table->capacity; i++) {
-            if (table->entries[i].key.type != VAL_EMPTY &&
-                table->entries[i].key.type != VAL_NIL) {
-                count++;
-            }
-        }
-        if (count == 0) {
-            return OBJ_VAL(copyString("{}", 2));
-        }
-        int bufSize = 2 + (count - 1) * 4 + count * 64;
-        char* buffer = ALLOCATE(char, bufSize);
-        int offset = 0;
-        buffer[offset++] = '{';
-        int seen = 0;
-        for (int i = 0; i < table->capacity; i++) {
-            Value key = table->entries[i].key;
-            Value val = table->entries[i].value;
-            if (key.type == VAL_EMPTY || key.type == VAL_NIL) continue;
-
-            Value keyStr = valueToString(key);
-            Value valStr = valueToString(val);
-            if (IS_ERROR(keyStr) || IS_ERROR(valStr)) {
-                FREE_ARRAY(char, buffer, bufSize);
-                return IS_ERROR(keyStr) ? keyStr : valStr;
-            }
-            int keyLen = AS_STRING(keyStr)->length;
-            int valLen = AS_STRING(valStr)->length;
-            if (offset + keyLen + valLen + 5 > bufSize) {
-                int newBufSize = bufSize * 2 + keyLen + valLen + 5;
-                char* newBuffer = ALLOCATE(char, newBufSize);
-                memcpy(newBuffer, buffer, offset);
-                FREE_ARRAY(char, buffer, bufSize);
-                buffer = newBuffer;
-                bufSize = newBufSize;
-            }
-            memcpy(buffer + offset, AS_STRING(keyStr)->chars, keyLen);
-            offset += keyLen;
-            buffer[offset++] = ':';
-            buffer[offset++] = ' ';
-            memcpy(buffer + offset, AS_STRING(valStr)->chars, valLen);
-            offset += valLen;
-            seen++;
-            if (seen < count) {
-                buffer[offset++] = ',';
-                buffer[offset++] = ' ';
-            }
-        }
-        buffer[offset++] = '}';
-        buffer[offset] = '\0';
-        Value result = OBJ_VAL(copyString(buffer, offset));
-        FREE_ARRAY(char, buffer, bufSize);
-        return result;
-    } else {
-        char buffer[64];
-        snprintf(buffer, sizeof(buffer), "<%s>", valueTypeToString(value));
-        return OBJ_VAL(copyString(buffer, strlen(buffer)));
     }
+    Writer writer;
+    initWriter(&writer);
+    if (!writeValue(&writer, value)) {
+        freeWriter(&writer);
+        return ERROR_VAL_PTR(writer.error);
+    }
+    return OBJ_VAL(writerToString(&writer));
 }
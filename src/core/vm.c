@@ -4,6 +4,7 @@
 
 #include <math.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,50 +13,180 @@
 #include "builtins/file_methods.h"
 #include "builtins/print_methods.h"
 #include "builtins/type_methods.h"
+#include "builtins/util.h"
 
+#include "core/bytecode.h"
 #include "core/common.h"
 #include "compiler/compiler.h"
 #include "core/debug.h"
 #include "core/errors.h"
+#include "core/hash.h"
+#include "core/jit.h"
+#include "core/profiler.h"
 #include "core/object.h"
 #include "core/loader.h"
+#include "core/opcode_stats.h"
+#include "core/probes.h"
+#include "core/memo.h"
 #include "core/memory.h"
 #include "core/natives.h"
 #include "core/vm.h"
+#include "core/writer.h"
 
+#include "objects/array_methods.h"
+#include "objects/bytes_methods.h"
 #include "objects/collection_methods.h"
 #include "objects/dict_methods.h"
+#include "objects/exception_methods.h"
+#include "objects/fiber_methods.h"
 #include "objects/file_methods.h"
 #include "objects/list_methods.h"
+#include "objects/set_methods.h"
+#include "objects/socket_methods.h"
+#include "objects/string_builder_methods.h"
 #include "objects/string_methods.h"
+#include "objects/thread_methods.h"
+#include "std/async.h"
+#include "std/cache.h"
+#include "std/random.h"
 
-VM vm;
+THREAD_LOCAL VM* vm = NULL;
+
+/**
+ * Method for forgetting the calls to memoised functions whose frames have gone without returning.
+ *
+ * Wherever frames are dropped other than by returning, like an exception
+ * unwinding them or a fiber suspending, this has to follow so a later frame
+ * at the same depth isn't mistaken for one of theirs. Their results just
+ * aren't remembered.
+ */
+static void dropMemoCalls() {
+    while (vm->memoCallCount > 0 && vm->memoCalls[vm->memoCallCount - 1].frame >= vm->frameCount) {
+        MemoCall* memoCall = &vm->memoCalls[--vm->memoCallCount];
+        FREE_ARRAY(Value, memoCall->args, memoCall->argCount);
+    }
+}
 
 /**
  * Method for resetting the stack.
  */
 static void resetStack() {
-    vm.stackTop = vm.stack;
-    vm.frameCount = 0;
-    vm.openUpvalues = NULL;
+    vm->stackTop = vm->stack;
+    vm->frameCount = 0;
+    dropMemoCalls();
+    vm->baseFrame = 0;
+    vm->openUpvalues = NULL;
+    vm->exception = NIL_VAL;
 }
 
 /**
- * Method for reporting a runtime error.
+ * Method for freeing the stacks that have been outgrown.
+ *
+ * Only safe once no natives are running, as they may be holding their args in one.
  */
-static void runtimeError(enum ErrorType errorType, const char* format, ...) {
-    char message[512];
-    va_list args;
-    va_start(args, format);
-    vsnprintf(message, sizeof(message), format, args);
-    va_end(args);
+static void freeRetiredStacks() {
+    for (int i = 0; i < vm->retiredCount; i++) {
+        free(vm->retiredStacks[i]);
+    }
+    vm->retiredCount = 0;
+}
+
+/**
+ * Implementation of method to grow the stack to fit at least count more values.
+ *
+ * The frames' slots and the open upvalues are moved over with the values.
+ * The old stack isn't freed straight away, as natives further down may
+ * still be reading their args from it.
+ */
+void growStack(int count) {
+    int used = (int)(vm->stackTop - vm->stack);
+    int capacity = vm->stackCapacity;
+    while (capacity < used + count) {
+        capacity *= 2;
+    }
+
+    Value* stack = (Value*)malloc(sizeof(Value) * capacity);
+    if (stack == NULL) {
+        exit(1);
+    }
+    memcpy(stack, vm->stack, sizeof(Value) * used);
+    for (int i = 0; i < vm->frameCount; i++) {
+        vm->frames[i].slots = stack + (vm->frames[i].slots - vm->stack);
+    }
+    for (ObjUpvalue* upvalue = vm->openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+        upvalue->location = stack + (upvalue->location - vm->stack);
+    }
+
+    if (vm->retiredCapacity < vm->retiredCount + 1) {
+        vm->retiredCapacity = GROW_CAPACITY(vm->retiredCapacity);
+        vm->retiredStacks = (Value**)realloc(vm->retiredStacks, sizeof(Value*) * vm->retiredCapacity);
+        if (vm->retiredStacks == NULL) {
+            exit(1);
+        }
+    }
+    vm->retiredStacks[vm->retiredCount++] = vm->stack;
+
+    vm->stack = stack;
+    vm->stackTop = stack + used;
+    vm->stackCapacity = capacity;
+    vm->stackLimit = stack + capacity;
+}
+
+/**
+ * Method for making sure there's room for count more values on the stack.
+ *
+ * Returns false if that would take it past STACK_MAX.
+ */
+static inline bool ensureStack(int count) {
+    int used = (int)(vm->stackTop - vm->stack);
+    if (used + count <= vm->stackCapacity) {
+        return true;
+    }
+    if (used + count > STACK_MAX) {
+        return false;
+    }
+    growStack(count);
+    return true;
+}
+
+/**
+ * Method for making sure there's room for count more frames.
+ *
+ * Returns false if that would take it past FRAMES_MAX.
+ */
+static inline bool ensureFrames(int count) {
+    if (vm->frameCount + count <= vm->frameCapacity) {
+        return true;
+    }
+    if (vm->frameCount + count > FRAMES_MAX) {
+        return false;
+    }
+
+    int capacity = vm->frameCapacity;
+    while (capacity < vm->frameCount + count) {
+        capacity *= 2;
+    }
+    vm->frames = (CallFrame*)realloc(vm->frames, sizeof(CallFrame) * capacity);
+    if (vm->frames == NULL) {
+        exit(1);
+    }
+    vm->frameCapacity = capacity;
+    return true;
+}
 
+/**
+ * Method for reporting an exception that nothing's going to catch.
+ *
+ * The stack trace is only put together here, raising and catching
+ * an exception never needs it.
+ */
+static void reportException(enum ErrorType errorType, const char* message) {
     // Get current frame for line info
     int line = -1;
     int column = -1;
     const char* file = "<script>";
-    if (vm.frameCount > 0) {
-        const CallFrame* frame = &vm.frames[vm.frameCount - 1];
+    if (vm->frameCount > 0) {
+        const CallFrame* frame = &vm->frames[vm->frameCount - 1];
         const ObjFunction* function = frame->closure->function;
         size_t instruction = frame->ip - function->chunk.code - 1;
         line = getLine(function->chunk, instruction);
@@ -67,9 +198,9 @@ static void runtimeError(enum ErrorType errorType, const char* format, ...) {
 
     char stacktrace[1024] = {0};
     size_t offset = 0;
-    for (int i = vm.frameCount - 1; i >= 0; i--) {
-        if (i < 0 || i >= FRAMES_MAX) break;  // defensive check
-        const CallFrame* frame = &vm.frames[i];
+    // deep recursion has far more frames than fit, so stop once it's full
+    for (int i = vm->frameCount - 1; i >= 0 && offset < sizeof(stacktrace); i--) {
+        const CallFrame* frame = &vm->frames[i];
         const ObjFunction* function = frame->closure->function;
         int line = getLine(function->chunk, frame->ip - function->chunk.code - 1);
         int column = getColumn(function->chunk, frame->ip - function->chunk.code - 1);
@@ -87,115 +218,350 @@ static void runtimeError(enum ErrorType errorType, const char* format, ...) {
         .stacktrace = stacktrace
     };
     reportError(&exc);
+}
+
+/**
+ * Method for checking whether any frame is in a try block that would catch an exception raised now.
+ */
+static bool exceptionHandled() {
+    for (int i = vm->frameCount - 1; i >= 0; i--) {
+        const CallFrame* frame = &vm->frames[i];
+        Chunk* chunk = &frame->closure->function->chunk;
+        if (chunk->handlerCount > 0 && findExceptionHandler(chunk, (int)(frame->ip - chunk->code - 1)) != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Method for raising an exception.
+ *
+ * One a try block will catch is left in vm->exception for catchException
+ * once the error has made its way back out to run(), anything else is
+ * reported and the stack reset.
+ */
+static void raiseException(ObjError* exception) {
+    PROBE_ERROR(errorTypeToString(exception->type), exception->message->chars);
+    if (exceptionHandled()) {
+        vm->exception = OBJ_VAL(exception);
+        return;
+    }
+    reportException(exception->type, exception->message->chars);
+    resetStack();
+}
+
+/**
+ * Method for raising a runtime error.
+ *
+ * Only an error that's going to be caught is made into an ObjError.
+ */
+static void runtimeError(enum ErrorType errorType, const char* format, ...) {
+    // one a try block further down will catch is already on its way there,
+    // and whatever fails because of it shouldn't replace it
+    if (!IS_NIL(vm->exception)) {
+        return;
+    }
+
+    char message[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    PROBE_ERROR(errorTypeToString(errorType), message);
 
+    if (exceptionHandled()) {
+        vm->exception = OBJ_VAL(newException(errorType, message));
+        return;
+    }
+    reportException(errorType, message);
     resetStack();
 }
 
 /**
  * Implementation of method to initialise the virtual machine.
  */
-void initVM() {
-    srand(time(NULL));
+void initVM(VM* instance) {
+    vm = instance;
+    initHashSeed();
+    // the address tells apart the VMs threads start in the same second
+    seedRandom(&vm->random, (uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)instance);
+    vm->stack = (Value*)malloc(sizeof(Value) * STACK_INITIAL);
+    vm->frames = (CallFrame*)malloc(sizeof(CallFrame) * FRAMES_INITIAL);
+    if (vm->stack == NULL || vm->frames == NULL) {
+        exit(1);
+    }
+    vm->stackCapacity = STACK_INITIAL;
+    vm->stackLimit = vm->stack + STACK_INITIAL;
+    vm->frameCapacity = FRAMES_INITIAL;
+    vm->retiredStacks = NULL;
+    vm->retiredCount = 0;
+    vm->retiredCapacity = 0;
+    vm->memoCalls = NULL;
+    vm->memoCallCount = 0;
+    vm->memoCallCapacity = 0;
     resetStack();
-    vm.objects = NULL;
-    vm.bytesAllocated = 0;
-    vm.nextGC = 1024 * 1024;
-    vm.grayCount = 0;
-    vm.grayCapacity = 0;
-    vm.grayStack = NULL;
-    vm.markValue = true;
-    initTable(&vm.globals);
-    initTable(&vm.globalFinals);
-    initTable(&vm.strings);
-    vm.initString = NULL;
-    vm.initString = copyString("__init__", 8);
-
-    registerBuiltInFileMethods(&vm.globals);
-    registerBuiltInPrintMethods(&vm.globals);
-    registerBuiltInTypeMethods(&vm.globals);
+    vm->objects = NULL;
+    vm->youngObjects = NULL;
+    vm->localObjects = NULL;
+    vm->allocateLocal = false;
+    vm->regionObjects = NULL;
+    vm->regionDepth = 0;
+    vm->gcMode = GC_FULL;
+    vm->minorGC = false;
+    vm->nurserySize = GC_DEFAULT_NURSERY_SIZE;
+    vm->nextMajorGC = 0;
+    vm->rememberedCount = 0;
+    vm->rememberedCapacity = 0;
+    vm->remembered = NULL;
+    vm->gcStats = (GCStats){0};
+    vm->gcStats.startTime = gcClock();
+    vm->gcThreads = 1;
+    vm->parallelHeap = GC_DEFAULT_PARALLEL_HEAP;
+    vm->sweeper = NULL;
+    vm->bytecodeCache = true;
+    vm->importThreads = 0;
+    vm->precompiler = NULL;
+    vm->quietErrors = false;
+#ifdef SLO_JIT
+    vm->jit = true;
+#else
+    vm->jit = false;
+#endif
+    vm->profile = 0;
+#ifdef SLO_OPCODE_STATS
+    vm->opcodeStats = newOpcodeStats();
+#endif
+    vm->bytesAllocated = 0;
+    vm->nextGC = GC_MIN_HEAP;
+    vm->gcDisabled = false;
+    vm->heapGrowFactor = GC_HEAP_GROW_FACTOR;
+    vm->grayCount = 0;
+    vm->grayCapacity = 0;
+    vm->grayStack = NULL;
+    vm->markValue = true;
+    initTable(&vm->globals);
+    initValueArray(&vm->globalValues);
+    initValueArray(&vm->globalNames);
+    initValueArray(&vm->globalFinals);
+    initValueArray(&vm->globalFallbacks);
+    initTable(&vm->builtins);
+    initTable(&vm->modules);
+    initValueArray(&vm->pinned);
+    initValueArray(&vm->bundleStrings);
+    initTable(&vm->strings);
+    vm->fiber = NULL;
+    vm->yielding = false;
+    vm->nativeError = NULL;
+    vm->callDepth = 0;
+    vm->exception = NIL_VAL;
+    vm->exceptionClass = NULL;
+    vm->eventLoop = NULL;
+    memset(vm->pools, 0, sizeof(vm->pools));
+    vm->initString = NULL;
+    vm->initString = copyString("__init__", 8);
+
+    registerBuiltInFileMethods(&vm->builtins);
+    registerBuiltInPrintMethods(&vm->builtins);
+    registerBuiltInTypeMethods(&vm->builtins);
 
     ObjString* containerName = copyString("container", 8);
-    vm.containerClass = newClass(containerName, NULL);
-    registerContainerMethods(vm.containerClass);
+    vm->containerClass = newClass(containerName, NULL);
+    registerContainerMethods(vm->containerClass);
 
     // Create the list class and its methods.
     ObjString* listName = copyString("list", 4);
-    vm.listClass = newClass(listName, vm.containerClass);
-    registerListMethods(vm.listClass);
+    vm->listClass = newClass(listName, vm->containerClass);
+    registerListMethods(vm->listClass);
 
     // Create the dict class and its methods.
     ObjString* dictName = copyString("dict", 4);
-    vm.dictClass = newClass(dictName, vm.containerClass);
-    registerDictMethods(vm.dictClass);
+    vm->dictClass = newClass(dictName, vm->containerClass);
+    registerDictMethods(vm->dictClass);
 
     ObjString* stringName = copyString("string", 6);
-    vm.stringClass = newClass(stringName, NULL);
-    registerStringMethods(vm.stringClass);
+    vm->stringClass = newClass(stringName, NULL);
+    registerStringMethods(vm->stringClass);
 
     ObjString* fileName = copyString("fileCls", 7);
-    vm.fileClass = newClass(fileName, NULL);
-    registerFileMethods(vm.fileClass);
+    vm->fileClass = newClass(fileName, NULL);
+    registerFileMethods(vm->fileClass);
+
+    ObjString* builderName = copyString("StringBuilder", 13);
+    vm->stringBuilderClass = newClass(builderName, NULL);
+    registerStringBuilderMethods(vm->stringBuilderClass);
+
+    ObjString* arrayName = copyString("array", 5);
+    vm->arrayClass = newClass(arrayName, NULL);
+    registerArrayMethods(vm->arrayClass);
+
+    ObjString* setName = copyString("set", 3);
+    vm->setClass = newClass(setName, NULL);
+    registerSetMethods(vm->setClass);
+
+    ObjString* bytesName = copyString("bytes", 5);
+    vm->bytesClass = newClass(bytesName, NULL);
+    registerBytesMethods(vm->bytesClass);
+
+    ObjString* fiberName = copyString("fiber", 5);
+    vm->fiberClass = newClass(fiberName, NULL);
+    registerFiberMethods(vm->fiberClass);
+
+    ObjString* socketName = copyString("socket", 6);
+    vm->socketClass = newClass(socketName, NULL);
+    registerSocketMethods(vm->socketClass);
+
+    ObjString* threadName = copyString("thread", 6);
+    vm->threadClass = newClass(threadName, NULL);
+    registerThreadMethods(vm->threadClass);
+
+    ObjString* exceptionName = copyString("exception", 9);
+    vm->exceptionClass = newClass(exceptionName, NULL);
+    registerExceptionMethods(vm->exceptionClass);
+
+    ObjString* channelName = copyString("channel", 7);
+    vm->channelClass = newClass(channelName, NULL);
+    registerChannelMethods(vm->channelClass);
+
+    ObjString* randomName = copyString("random", 6);
+    vm->randomClass = newClass(randomName, NULL);
+    registerRandomMethods(vm->randomClass);
+
+    ObjString* dictViewName = copyString("dict_view", 9);
+    vm->dictViewClass = newClass(dictViewName, NULL);
+    registerDictViewMethods(vm->dictViewClass);
+
+    ObjString* memoName = copyString("memo", 4);
+    vm->memoClass = newClass(memoName, NULL);
+    registerMemoMethods(vm->memoClass);
 
     defineNatives();
+
+    // give every builtin a global slot so compiled code can reach them
+    for (int i = 0; i < vm->builtins.entryCount; i++) {
+        Entry* entry = &vm->builtins.entries[i];
+        if (IS_STRING(entry->key)) {
+            defineGlobal(AS_STRING(entry->key), entry->value);
+        }
+    }
+}
+
+void useVM(VM* instance) {
+    vm = instance;
 }
 
 /**
  * Implementation of method to free the virtual machine.
  */
 void freeVM() {
-    freeTable(&vm.globals);
-    freeTable(&vm.strings);
-    vm.initString = NULL;
+    finishSweep();
+    freeEventLoop();
+    freeTable(&vm->globals);
+    freeValueArray(&vm->globalValues);
+    freeValueArray(&vm->globalNames);
+    freeValueArray(&vm->globalFinals);
+    freeValueArray(&vm->globalFallbacks);
+    freeTable(&vm->builtins);
+    freeTable(&vm->modules);
+    freeValueArray(&vm->pinned);
+    freeValueArray(&vm->bundleStrings);
+    freeTable(&vm->strings);
+    vm->initString = NULL;
     freeObjects();
+    freeObjectPools();
+    free(vm->remembered);
+    vm->remembered = NULL;
+    vm->rememberedCount = 0;
+    vm->rememberedCapacity = 0;
+    freeRetiredStacks();
+    free(vm->retiredStacks);
+    vm->retiredStacks = NULL;
+    vm->retiredCapacity = 0;
+    free(vm->memoCalls);
+    vm->memoCalls = NULL;
+    vm->memoCallCapacity = 0;
+    free(vm->stack);
+    free(vm->frames);
+    vm->stack = NULL;
+    vm->stackTop = NULL;
+    vm->frames = NULL;
+#ifdef SLO_OPCODE_STATS
+    mergeOpcodeStats(vm->opcodeStats);
+    vm->opcodeStats = NULL;
+#endif
 }
 
 /**
- * Pushes the given value onto the stack.
+ * Method for finding the builtin a module's global falls back to.
  *
- * Stores the value in the top unused value of the array.
- * stackTop is a pointer to that position.
- * Increments the pointer to point to the next unused element in the array.
+ * A module's globals are named "module.name"; if name is a builtin,
+ * this returns the builtin's slot, otherwise -1.
  */
-void push(Value value) {
-    #ifdef DEBUG_LOGGING
-    printf("Before push: stackTop=%ld\n", vm.stackTop - vm.stack);
-    for (Value* v = vm.stack; v < vm.stackTop; v++) {
-        printf("  [%ld] ", v - vm.stack);
-        printValue(*v);
-        printf("\n");
-    }
-    printf("Pushing to stack[%ld]: ", vm.stackTop - vm.stack);
-    printValue(value);
-    printf("\n");
-    #endif
-    *vm.stackTop = value;
-    vm.stackTop++;
-    #ifdef DEBUG_LOGGING
-    printf("After push: stackTop=%ld\n", vm.stackTop - vm.stack);
-    for (Value* v = vm.stack; v < vm.stackTop; v++) {
-        printf("  [%ld] ", v - vm.stack);
-        printValue(*v);
-        printf("\n");
+static int builtinFallback(ObjString* name) {
+    const char* dot = memchr(name->chars, '.', name->length);
+    if (dot == NULL) {
+        return -1;
     }
-    #endif
+    const char* base = dot + 1;
+    int length = name->length - (int)(base - name->chars);
+    for (int i = 0; i < vm->builtins.entryCount; i++) {
+        Value key = vm->builtins.entries[i].key;
+        if (IS_STRING(key) && AS_STRING(key)->length == length && memcmp(AS_STRING(key)->chars, base, length) == 0) {
+            Value index;
+            return tableGet(&vm->globals, key, &index) ? (int)AS_NUMBER(index) : -1;
+        }
+    }
+    return -1;
 }
 
 /**
- * Grabs the value on top of the stack.
+ * Implementation of method to resolve a global name to its slot.
  *
- * Decremenents the top of the stack pointer to the last used element in the array.
- * Returns the value stored at that position.
+ * vm->globals maps each name to an index into vm->globalValues so the compiler
+ * can bake the index into the bytecode and the VM can skip the hash lookup.
+ * Slots that haven't been defined yet hold EMPTY_VAL.
+ */
+int globalSlot(ObjString* name) {
+    Value index;
+    if (tableGet(&vm->globals, OBJ_VAL(name), &index)) {
+        return (int)AS_NUMBER(index);
+    }
+
+    push(OBJ_VAL(name));
+    int slot = vm->globalValues.count;
+    writeValueArray(&vm->globalValues, EMPTY_VAL);
+    writeValueArray(&vm->globalNames, OBJ_VAL(name));
+    writeValueArray(&vm->globalFinals, BOOL_VAL(false));
+    writeValueArray(&vm->globalFallbacks, NUMBER_VAL((double)builtinFallback(name)));
+    tableSet(&vm->globals, OBJ_VAL(name), NUMBER_VAL((double)slot));
+    pop();
+    return slot;
+}
+
+/**
+ * Implementation of method to define a global by name.
  */
-Value pop() {
-    vm.stackTop--;
-    return *vm.stackTop;
+void defineGlobal(ObjString* name, Value value) {
+    push(value);
+    int slot = globalSlot(name);
+    vm->globalValues.values[slot] = value;
+    pop();
 }
 
 /**
- * Method for peeking at the stack.
+ * Implementation of method to get a global by name.
  */
-Value peek(int distance) {
-  return vm.stackTop[-1 - distance];
+bool getGlobal(ObjString* name, Value* value) {
+    Value index;
+    if (!tableGet(&vm->globals, OBJ_VAL(name), &index)) {
+        return false;
+    }
+    Value global = vm->globalValues.values[(int)AS_NUMBER(index)];
+    if (IS_EMPTY(global)) {
+        return false;
+    }
+    *value = global;
+    return true;
 }
 
 /**
@@ -207,18 +573,45 @@ static bool call(ObjClosure* closure, int argCount) {
         return false;
     }
 
-    if (vm.frameCount == FRAMES_MAX) {
+    if (!ensureFrames(1) || !ensureStack(STACK_RESERVE)) {
         runtimeError(ERROR_RUNTIME, "Stack overflow.");
         return false;
     }
 
-    CallFrame* frame = &vm.frames[vm.frameCount++];
+    CallFrame* frame = &vm->frames[vm->frameCount++];
     frame->closure = closure;
     frame->ip = closure->function->chunk.code;
-    frame->slots = vm.stackTop - argCount - 1;
+    frame->slots = vm->stackTop - argCount - 1;
+    if (UNLIKELY(vm->profile)) {
+        profileCall(vm->frameCount - 1);
+    }
+    PROBE_FUNCTION_ENTRY(closure->function);
     return true;
 }
 
+/**
+ * Method for getting the closure a tail call can run in the calling frame.
+ *
+ * Returns NULL for anything that has to be called as normal: natives and
+ * classes, and calls with the wrong number of args so the error points here.
+ */
+static ObjClosure* tailCallee(int argCount) {
+    Value callee = peek(argCount);
+    if (IS_CLOSURE(callee)) {
+        ObjClosure* closure = AS_CLOSURE(callee);
+        return closure->function->arity == argCount ? closure : NULL;
+    }
+    if (IS_BOUND_METHOD(callee)) {
+        ObjBoundMethod* bound = AS_BOUND_METHOD(callee);
+        if (bound->method->function->arity != argCount) {
+            return NULL;
+        }
+        vm->stackTop[-argCount - 1] = bound->receiver;
+        return bound->method;
+    }
+    return NULL;
+}
+
 /**
  * Method for validating native args before a native call.
  * Checks the number of given args matches our expectations.
@@ -227,7 +620,7 @@ static bool validateNativeArgs(ObjNative* nativeObj, int argCount) {
     if (argCount < nativeObj->arityMin || (nativeObj->arityMax != -1 && argCount > nativeObj->arityMax)) {
         const char* paramName = NULL;
         if (nativeObj->params && argCount < nativeObj->arityMin) {
-            paramName = nativeObj->params[argCount].name->chars;
+            paramName = nativeObj->params[argCount].name;
             runtimeError(ERROR_TYPE, "Expected %d arguments but got %d. Missing parameter: '%s'", nativeObj->arityMin, argCount, paramName);
         } else {
             runtimeError(ERROR_TYPE, "Expected %d to %d arguments but got %d.", nativeObj->arityMin, nativeObj->arityMax, argCount);
@@ -237,25 +630,118 @@ static bool validateNativeArgs(ObjNative* nativeObj, int argCount) {
     return true;
 }
 
+/**
+ * Method for applying the write barrier after a native call.
+ *
+ * Natives update lists, dicts and other objects passed to them directly
+ * rather than through the VM's write barriers, so any old object
+ * passed to a native is conservatively remembered.
+ */
+static void nativeWriteBarrier(int argCount, Value* args) {
+    for (int i = 0; i < argCount; i++) {
+        if (IS_OBJ(args[i]) && !IS_STRING(args[i])) {
+            rememberObject(AS_OBJ(args[i]));
+        }
+    }
+}
+
+/**
+ * Method for calling a native with the top argCount values of the stack, once its args are checked.
+ *
+ * Those values and the callee below them are replaced with its result.
+ * Methods of the built in types have their receiver in the callee's slot,
+ * and get it as their first arg.
+ */
+static bool callNative(ObjNative* native, int argCount, bool passReceiver) {
+    int nativeArgCount = passReceiver ? argCount + 1 : argCount;
+    Value result = native->function(nativeArgCount, vm->stackTop - nativeArgCount, native->params);
+    nativeWriteBarrier(nativeArgCount, vm->stackTop - nativeArgCount);
+    if (IS_ERROR(result)) {
+        runtimeError(ERROR_RUNTIME, "%s", errorMessage(result));
+        vm->nativeError = NULL;
+        return false;
+    }
+    vm->stackTop -= argCount;
+    vm->stackTop[-1] = result;
+    // a native that suspended the fiber returns to resumeFiber rather than carrying on
+    return !vm->yielding;
+}
+
 /**
  * Method for executing a call.
  */
+static bool callValue(Value callee, int argCount, uint8_t* _ip);
+
+/**
+ * Method for remembering what a memoised function's frame returned, once it's returned.
+ */
+static void finishMemoCall(Value result) {
+    // left where it is until it's stored, so the collector still sees the args
+    MemoCall* memoCall = &vm->memoCalls[vm->memoCallCount - 1];
+    memoSet(memoCall->memo, memoCall->args, memoCall->argCount, memoCall->hash, result);
+    vm->memoCallCount--;
+}
+
+/**
+ * Method for calling a memoised function.
+ *
+ * A result that's remembered replaces the call without the function being
+ * called at all. Otherwise the function's called with a copy of the args
+ * kept aside, and its result is remembered as it returns, straight away for
+ * a native or when its frame returns for anything else.
+ */
+static bool callMemo(ObjMemo* memo, int argCount, uint8_t* ip) {
+    Value* args = vm->stackTop - argCount;
+    uint32_t hash = hashArguments(args, argCount);
+    Value result;
+    if (memoGet(memo, args, argCount, hash, &result)) {
+        vm->stackTop -= argCount;
+        vm->stackTop[-1] = result;
+        return true;
+    }
+
+    Value* copy = ALLOCATE(Value, argCount);
+    // the stack can move while allocating
+    memcpy(copy, vm->stackTop - argCount, sizeof(Value) * argCount);
+    if (vm->memoCallCapacity < vm->memoCallCount + 1) {
+        vm->memoCallCapacity = GROW_CAPACITY(vm->memoCallCapacity);
+        vm->memoCalls = (MemoCall*)realloc(vm->memoCalls, sizeof(MemoCall) * vm->memoCallCapacity);
+        if (vm->memoCalls == NULL) {
+            exit(1);
+        }
+    }
+    // the call's frame will be the next one
+    vm->memoCalls[vm->memoCallCount++] = (MemoCall){memo, vm->frameCount, hash, copy, argCount};
+
+    // the memo's kept alive by its call from here, the callee's slot is the function's
+    vm->stackTop[-argCount - 1] = memo->function;
+    int frameCount = vm->frameCount;
+    if (!callValue(memo->function, argCount, ip)) {
+        dropMemoCalls();
+        return false;
+    }
+    if (vm->frameCount == frameCount) {
+        finishMemoCall(vm->stackTop[-1]);
+    }
+    return true;
+}
+
 static bool callValue(Value callee, int argCount, uint8_t* _ip) {
     if (IS_OBJ(callee)) {
         switch (OBJ_TYPE(callee)) {
             case OBJ_BOUND_METHOD: {
                 ObjBoundMethod* bound = AS_BOUND_METHOD(callee);
-                vm.stackTop[-argCount - 1] = bound->receiver;
+                vm->stackTop[-argCount - 1] = bound->receiver;
                 return call(bound->method, argCount);
             }
             case OBJ_CLASS: {
                 ObjClass* sClass = AS_CLASS(callee);
-                vm.stackTop[-argCount - 1] = OBJ_VAL(newInstance(sClass));
+                vm->stackTop[-argCount - 1] = OBJ_VAL(newInstance(sClass));
                 Value initialiser;
-                if (tableGet(&sClass->methods, OBJ_VAL(vm.initString), &initialiser)) {
+                if (tableGet(&sClass->methods, OBJ_VAL(vm->initString), &initialiser)) {
                     return call(AS_CLOSURE(initialiser), argCount);
                 } else if (argCount != 0) {
-                    CallFrame* frame = &vm.frames[vm.frameCount - 1];
+                    CallFrame* frame = &vm->frames[vm->frameCount - 1];
                     frame->ip = _ip;
                     runtimeError(ERROR_TYPE, "Expected 0 arguments but got %d.", argCount);
                     return false;
@@ -265,29 +751,22 @@ static bool callValue(Value callee, int argCount, uint8_t* _ip) {
             case OBJ_CLOSURE: {
                 return call(AS_CLOSURE(callee), argCount);
             }
+            case OBJ_MEMO:
+                return callMemo(AS_MEMO(callee), argCount, _ip);
             case OBJ_NATIVE: {
                 ObjNative* nativeObj = (ObjNative*)AS_OBJ(callee);
                 if (!validateNativeArgs(nativeObj, argCount)) {
                     return false;
                 }
-                NativeFn native = nativeObj->function;
                 #ifdef DEBUG_LOGGING
                 printf("Stack before native call: ");
                 for (int i = 0; i < argCount + 1; i++) {
-                    printValue(vm.stackTop[-argCount - 1 + i]);
+                    printValue(vm->stackTop[-argCount - 1 + i]);
                     printf(" ");
                 }
                 printf("\n");
                 #endif
-                Value result = native(argCount, vm.stackTop - argCount, nativeObj->params);
-                if (IS_ERROR(result)) {
-                    ObjError* error = AS_ERROR(result);
-                    runtimeError(ERROR_RUNTIME, error->message->chars);
-                    return false;
-                }
-                vm.stackTop -= argCount + 1;
-                push(result);
-                return true;
+                return callNative(nativeObj, argCount, false);
             }
             default:
                 break;
@@ -318,36 +797,98 @@ static Value getContainerMethod(Value receiver, ObjString* name) {
     Value method;
     #ifdef DEBUG_LOGGING
     printf("All container methods:\n");
-    for (int i = 0; i < vm.containerClass->methods.count; i++) {
-        Entry* entry = &vm.containerClass->methods.entries[i];
+    for (int i = 0; i < vm->containerClass->methods.entryCount; i++) {
+        Entry* entry = &vm->containerClass->methods.entries[i];
         if (!IS_EMPTY(entry->key)) {
             printf("  %s\n", AS_STRING(entry->key)->chars);
         }
     }
     #endif
-    if (tableGet(&vm.containerClass->methods, OBJ_VAL(name), &method)) {
+    if (lookupNative((Obj*)vm->containerClass, &vm->containerClass->methods, vm->containerClass->natives, name, &method)) {
         return method;
     }
-    Table* methods;
+    ObjClass* sClass;
     if (IS_DICT(receiver)) {
-        methods = &AS_DICT(receiver)->sClass->methods;
+        sClass = AS_DICT(receiver)->sClass;
     } else if (IS_LIST(receiver)) {
-        methods = &AS_LIST(receiver)->sClass->methods;
+        sClass = AS_LIST(receiver)->sClass;
     } else {
         runtimeError(ERROR_TYPE, "Only containers have methods.");
         return NIL_VAL;
     }
     #ifdef DEBUG_LOGGING
     printf("All methods:\n");
-    for (int i = 0; i < methods->count; i++) {
-        Entry* entry = &methods->entries[i];
+    for (int i = 0; i < sClass->methods.entryCount; i++) {
+        Entry* entry = &sClass->methods.entries[i];
         if (!IS_EMPTY(entry->key)) {
             printf("  %s\n", AS_STRING(entry->key)->chars);
         }
     }
     #endif
-    return tableGet(methods, OBJ_VAL(name), &method) ? method : NIL_VAL;
+    return lookupNative((Obj*)sClass, &sClass->methods, sClass->natives, name, &method) ? method : NIL_VAL;
+
+}
+
+/**
+ * Method for calling a method found for one of the built in types.
+ *
+ * The receiver gets passed to native methods as their first argument.
+ */
+static bool callBuiltInMethod(Value method, ObjString* name, int argCount) {
+    if (IS_NATIVE(method)) {
+        ObjNative* native = (ObjNative*)AS_OBJ(method);
+        if (!validateNativeArgs(native, argCount + 1)) {
+            return false;
+        }
+        return callNative(native, argCount, true);
+    } else if (IS_CLOSURE(method)) {
+        return call(AS_CLOSURE(method), argCount);
+    }
+    runtimeError(ERROR_TYPE, "Method '%s' is not callable.", name->chars);
+    return false;
+}
+
+/**
+ * Method for invoking a method of one of the built in types.
+ */
+static bool invokeBuiltInMethod(ObjClass* sClass, ObjString* name, int argCount, const char* typeName) {
+    Value method;
+    if (!lookupNative((Obj*)sClass, &sClass->methods, sClass->natives, name, &method)) {
+        runtimeError(ERROR_ATTRIBUTE, "Undefined method '%s' for %s.", name->chars, typeName);
+        return false;
+    }
+    return callBuiltInMethod(method, name, argCount);
+}
+
+/**
+ * Method for invoking a method on a dict view.
+ *
+ * Views only have the list methods that don't change them, so for any other
+ * the error says how to get a list instead of just that it isn't there.
+ */
+static bool invokeDictViewMethod(ObjString* name, int argCount) {
+    ObjClass* sClass = vm->dictViewClass;
+    Value method;
+    if (!lookupNative((Obj*)sClass, &sClass->methods, sClass->natives, name, &method)) {
+        runtimeError(ERROR_ATTRIBUTE, "Undefined method '%s' for dict view, use tolist() to get a list to call it on.",
+            name->chars);
+        return false;
+    }
+    return callBuiltInMethod(method, name, argCount);
+}
 
+/**
+ * Method for getting a function or value from a module by name.
+ */
+static bool moduleGet(ObjModule* module, ObjString* name, Value* value) {
+    if (!lookupNative((Obj*)module, &module->methods, module->natives, name, value)) {
+        return false;
+    }
+    if (module->fromFile) {
+        *value = vm->globalValues.values[(int)AS_NUMBER(*value)];
+        return !IS_EMPTY(*value);
+    }
+    return true;
 }
 
 /**
@@ -360,111 +901,54 @@ static bool invoke(ObjString* name, int argCount, uint8_t* ip) {
         // implementation if receiver is an instance of a class
         ObjInstance* instance = AS_INSTANCE(receiver);
         Value value;
-        if (tableGet(&instance->fields, OBJ_VAL(name), &value)) {
-            vm.stackTop[-argCount - 1] = value;
+        if (instanceGetField(instance, name, &value)) {
+            vm->stackTop[-argCount - 1] = value;
             return callValue(value, argCount, ip);
         }
         return invokeFromClass(instance->sClass, name, argCount);
     } else if (IS_STRING(receiver)) {
-        Value method;
-        if (tableGet(&vm.stringClass->methods, OBJ_VAL(name), &method)) {
-            if (IS_NATIVE(method)) {
-                ObjNative* nativeObj = (ObjNative*)AS_OBJ(method);
-                int actualArgCount = argCount + 1;
-                if (!validateNativeArgs(nativeObj, actualArgCount)) {
-                    return false;
-                }
-                NativeFn native = nativeObj->function;
-                Value result = native(argCount + 1, vm.stackTop - argCount - 1, nativeObj->params);
-                if (IS_ERROR(result)) {
-                    ObjError* error = AS_ERROR(result);
-                    runtimeError(ERROR_RUNTIME, error->message->chars);
-                    return false;
-                }
-                vm.stackTop -= argCount + 1;
-                push(result);
-                return true;
-            } else if (IS_CLOSURE(method)) {
-                // If you support closures/methods on containers, handle here
-                return call(AS_CLOSURE(method), argCount);
-            } else {
-                runtimeError(ERROR_TYPE, "Method '%s' is not callable.", name->chars);
-                return false;
-            }
-        } else {
-            runtimeError(ERROR_ATTRIBUTE, "Undefined method '%s' for string.", name->chars);
-            return false;
-        }
+        return invokeBuiltInMethod(vm->stringClass, name, argCount, "string");
     } else if (IS_CONTAINER(receiver)) {
         Value method = getContainerMethod(receiver, name);
         if (IS_NIL(method)) {
             runtimeError(ERROR_ATTRIBUTE, "Undefined method '%s'.", name->chars);
             return false;
         }
-        // For native methods, pass the container as the first argument
-        if (IS_NATIVE(method)) {
-            ObjNative* nativeObj = (ObjNative*)AS_OBJ(method);
-            int actualArgCount = argCount + 1;
-            if (!validateNativeArgs(nativeObj, actualArgCount)) {
-                return false;
-            }
-            NativeFn native = nativeObj->function;
-            Value result = native(argCount + 1, vm.stackTop - argCount - 1, nativeObj->params);
-            if (IS_ERROR(result)) {
-                ObjError* error = AS_ERROR(result);
-                runtimeError(ERROR_RUNTIME, error->message->chars);
-                return false;
-            }
-            vm.stackTop -= argCount + 1;
-            push(result);
-            return true;
-        } else if (IS_CLOSURE(method)) {
-            // If you support closures/methods on containers, handle here
-            return call(AS_CLOSURE(method), argCount);
-        } else {
-            runtimeError(ERROR_TYPE, "Method '%s' is not callable.", name->chars);
-            return false;
-        }
+        return callBuiltInMethod(method, name, argCount);
     } else if (IS_MODULE(receiver)) {
         ObjModule* module = AS_MODULE(receiver);
         Value method;
-        if (tableGet(&module->methods, OBJ_VAL(name), &method)) {
-            vm.stackTop[-argCount - 1] = method;
+        if (moduleGet(module, name, &method)) {
+            vm->stackTop[-argCount - 1] = method;
             return callValue(method, argCount, ip);
         } else {
             runtimeError(ERROR_ATTRIBUTE, "Undefined method '%s' in module.", name->chars);
             return false;
         }
     } else if (IS_FILE(receiver)) {
-        Value method;
-        if (tableGet(&vm.fileClass->methods, OBJ_VAL(name), &method)) {
-            if (IS_NATIVE(method)) {
-                ObjNative* nativeObj = (ObjNative*)AS_OBJ(method);
-                int actualArgCount = argCount + 1;
-                if (!validateNativeArgs(nativeObj, actualArgCount)) {
-                    return false;
-                }
-                NativeFn native = nativeObj->function;
-                Value result = native(argCount + 1, vm.stackTop - argCount - 1, nativeObj->params);
-                if (IS_ERROR(result)) {
-                    ObjError* error = AS_ERROR(result);
-                    runtimeError(ERROR_RUNTIME, error->message->chars);
-                    return false;
-                }
-                vm.stackTop -= argCount + 1;
-                push(result);
-                return true;
-            } else if (IS_CLOSURE(method)) {
-                // If you support closures/methods on files, handle here
-                return call(AS_CLOSURE(method), argCount);
-            } else {
-                runtimeError(ERROR_TYPE, "Method '%s' is not callable.", name->chars);
-                return false;
-            }
-        } else {
-            runtimeError(ERROR_ATTRIBUTE, "Undefined method '%s' for file.", name->chars);
-            return false;
-        }
+        return invokeBuiltInMethod(vm->fileClass, name, argCount, "file");
+    } else if (IS_STRING_BUILDER(receiver)) {
+        return invokeBuiltInMethod(vm->stringBuilderClass, name, argCount, "string builder");
+    } else if (IS_ARRAY(receiver)) {
+        return invokeBuiltInMethod(vm->arrayClass, name, argCount, "array");
+    } else if (IS_SET(receiver)) {
+        return invokeBuiltInMethod(vm->setClass, name, argCount, "set");
+    } else if (IS_BYTES(receiver)) {
+        return invokeBuiltInMethod(vm->bytesClass, name, argCount, "bytes");
+    } else if (IS_FIBER(receiver)) {
+        return invokeBuiltInMethod(vm->fiberClass, name, argCount, "fiber");
+    } else if (IS_SOCKET(receiver)) {
+        return invokeBuiltInMethod(vm->socketClass, name, argCount, "socket");
+    } else if (IS_THREAD(receiver)) {
+        return invokeBuiltInMethod(vm->threadClass, name, argCount, "thread");
+    } else if (IS_CHANNEL(receiver)) {
+        return invokeBuiltInMethod(vm->channelClass, name, argCount, "channel");
+    } else if (IS_RANDOM(receiver)) {
+        return invokeBuiltInMethod(vm->randomClass, name, argCount, "random");
+    } else if (IS_DICT_VIEW(receiver)) {
+        return invokeDictViewMethod(name, argCount);
+    } else if (IS_MEMO(receiver)) {
+        return invokeBuiltInMethod(vm->memoClass, name, argCount, "memoised function");
     } else {
         runtimeError(ERROR_TYPE, "Only instances and lists have methods.");
         return false;
@@ -472,53 +956,234 @@ static bool invoke(ObjString* name, int argCount, uint8_t* ip) {
 }
 
 /**
- * Method for binding a method.
+ * Method for finding the inline cache entry for the given shape.
  */
-static bool bindMethod(ObjClass* sClass, ObjString* name) {
-    Value method;
-    if (!tableGet(&sClass->methods, OBJ_VAL(name), &method)) {
-        return false;
+static inline InlineCacheEntry* findInlineCache(InlineCache* cache, Shape* shape) {
+    for (int i = 0; i < INLINE_CACHE_WAYS; i++) {
+        if (cache->entries[i].shape == shape) {
+            return &cache->entries[i];
+        }
     }
-
-    ObjBoundMethod* bound = newBoundMethod(peek(0), AS_CLOSURE(method));
-    pop();
-    push(OBJ_VAL(bound));
-    return true;
+    return NULL;
 }
 
 /**
- * Method for capturing an upvalue.
+ * Method for recording a lookup result in an inline cache.
+ *
+ * Reuses the entry for the shape if there is one, then any empty entry.
+ * Once every entry is in use the site is polymorphic beyond what we track
+ * so we replace the entries in turn.
  */
-static ObjUpvalue* captureUpvalue(Value* local) {
-    ObjUpvalue* prevUpvalue = NULL;
-    ObjUpvalue* upvalue = vm.openUpvalues;
-    while (upvalue != NULL && upvalue->location > local) {
-        prevUpvalue = upvalue;
-        upvalue = upvalue->next;
+static void fillInlineCache(ObjFunction* function, InlineCache* cache, Shape* shape, Shape* transition, int fieldIndex, Value method) {
+    InlineCacheEntry* entry = findInlineCache(cache, shape);
+    if (entry == NULL) {
+        entry = findInlineCache(cache, NULL);
     }
-
-    if (upvalue != NULL && upvalue->location == local) {
-        return upvalue;
-    }
-
-    ObjUpvalue* createdUpvalue = newUpvalue(local);
-    if (prevUpvalue == NULL) {
-        vm.openUpvalues = createdUpvalue;
-    } else {
-        prevUpvalue->next = createdUpvalue;
+    if (entry == NULL) {
+        entry = &cache->entries[cache->next];
+        cache->next = (cache->next + 1) % INLINE_CACHE_WAYS;
     }
-    return createdUpvalue;
+    entry->shape = shape;
+    entry->builtIn = NULL;
+    entry->transition = transition;
+    entry->fieldIndex = fieldIndex;
+    entry->method = method;
+    writeBarrier((Obj*)function, OBJ_VAL(shape->owner));
+    writeBarrier((Obj*)function, method);
 }
 
 /**
- * Method for closing over values.
+ * Method for invoking a method on an instance through an inline cache.
+ *
+ * Shapes fix which fields an instance has so a cached method can't
+ * have been shadowed by a field since it was cached.
  */
-static void closeUpvalues(Value* last) {
-    while (vm.openUpvalues != NULL && vm.openUpvalues->location >= last) {
-        ObjUpvalue* upvalue = vm.openUpvalues;
-        upvalue->closed = *upvalue->location;
-        upvalue->location = &upvalue->closed;
-        vm.openUpvalues = upvalue->next;
+static bool invokeInstance(ObjInstance* instance, ObjString* name, int argCount, uint8_t* ip, ObjFunction* function, InlineCache* cache) {
+    InlineCacheEntry* entry = findInlineCache(cache, instance->shape);
+    if (entry != NULL) {
+        if (entry->fieldIndex < 0) {
+            return call(AS_CLOSURE(entry->method), argCount);
+        }
+        Value value = instance->fields[entry->fieldIndex];
+        vm->stackTop[-argCount - 1] = value;
+        return callValue(value, argCount, ip);
+    }
+
+    int slot = shapeSlot(instance->shape, name);
+    if (slot != -1) {
+        fillInlineCache(function, cache, instance->shape, NULL, slot, NIL_VAL);
+        Value value = instance->fields[slot];
+        vm->stackTop[-argCount - 1] = value;
+        return callValue(value, argCount, ip);
+    }
+
+    Value method;
+    if (!tableGet(&instance->sClass->methods, OBJ_VAL(name), &method)) {
+        runtimeError(ERROR_ATTRIBUTE, "Undefined property '%s'.", name->chars);
+        return false;
+    }
+    fillInlineCache(function, cache, instance->shape, NULL, -1, method);
+    return call(AS_CLOSURE(method), argCount);
+}
+
+/**
+ * Method for getting how many values iterating over the given value produces,
+ * or 0 if that isn't known up front.
+ */
+static int iterationLength(Value iterable) {
+    int length;
+    switch (IS_OBJ(iterable) ? OBJ_TYPE(iterable) : OBJ_ERROR) {
+        case OBJ_LIST: length = AS_LIST(iterable)->count; break;
+        case OBJ_STRING: length = AS_STRING(iterable)->length; break;
+        case OBJ_ARRAY: length = AS_ARRAY(iterable)->count; break;
+        case OBJ_BYTES: length = AS_BYTES(iterable)->count; break;
+        case OBJ_DICT: length = AS_DICT(iterable)->data.count; break;
+        case OBJ_SET: length = AS_SET(iterable)->data.count; break;
+        case OBJ_RANGE: length = rangeLength(AS_RANGE(iterable)); break;
+        case OBJ_DICT_VIEW: length = AS_DICT_VIEW(iterable)->dict->data.count; break;
+        default: return 0;
+    }
+    return length < MAX_RESERVED_LENGTH ? length : MAX_RESERVED_LENGTH;
+}
+
+/**
+ * Method for getting the class the methods of one of the built in types are found on.
+ *
+ * Returns NULL for anything else, like instances and modules.
+ */
+static ObjClass* builtInClass(Value receiver) {
+    if (!IS_OBJ(receiver)) {
+        return NULL;
+    }
+    switch (OBJ_TYPE(receiver)) {
+        case OBJ_STRING: return vm->stringClass;
+        case OBJ_LIST: return AS_LIST(receiver)->sClass;
+        case OBJ_DICT: return AS_DICT(receiver)->sClass;
+        case OBJ_FILE: return vm->fileClass;
+        case OBJ_STRING_BUILDER: return vm->stringBuilderClass;
+        case OBJ_ARRAY: return vm->arrayClass;
+        case OBJ_SET: return vm->setClass;
+        case OBJ_BYTES: return vm->bytesClass;
+        case OBJ_FIBER: return vm->fiberClass;
+        case OBJ_SOCKET: return vm->socketClass;
+        case OBJ_THREAD: return vm->threadClass;
+        case OBJ_CHANNEL: return vm->channelClass;
+        case OBJ_RANDOM: return vm->randomClass;
+        case OBJ_DICT_VIEW: return vm->dictViewClass;
+        case OBJ_MEMO: return vm->memoClass;
+        default: return NULL;
+    }
+}
+
+/**
+ * Method for invoking a method of one of the built in types through an inline cache.
+ *
+ * Their methods can't change once found, so a native that's cached for
+ * the call site has had its arity checked against the site's args already.
+ * Anything that isn't a native with the right arity goes through invoke.
+ */
+static bool invokeBuiltIn(ObjClass* sClass, ObjString* name, int argCount, uint8_t* ip, ObjFunction* function, InlineCache* cache) {
+    for (int i = 0; i < INLINE_CACHE_WAYS; i++) {
+        if (cache->entries[i].builtIn == sClass) {
+            return callNative((ObjNative*)AS_OBJ(cache->entries[i].method), argCount, true);
+        }
+    }
+
+    Value method;
+    bool found = sClass->superclass == vm->containerClass
+        ? !IS_NIL(method = getContainerMethod(peek(argCount), name))
+        : lookupNative((Obj*)sClass, &sClass->methods, sClass->natives, name, &method);
+    if (!found || !IS_NATIVE(method)) {
+        return invoke(name, argCount, ip);
+    }
+    ObjNative* native = (ObjNative*)AS_OBJ(method);
+    if (!validateNativeArgs(native, argCount + 1)) {
+        return false;
+    }
+
+    InlineCacheEntry* entry = findInlineCache(cache, NULL);
+    if (entry == NULL || entry->builtIn != NULL) {
+        entry = &cache->entries[cache->next];
+        cache->next = (cache->next + 1) % INLINE_CACHE_WAYS;
+    }
+    entry->shape = NULL;
+    entry->builtIn = sClass;
+    entry->transition = NULL;
+    entry->fieldIndex = -1;
+    entry->method = method;
+    writeBarrier((Obj*)function, method);
+    return callNative(native, argCount, true);
+}
+
+/**
+ * Method for binding a method to its receiver.
+ *
+ * Bound methods can't be changed, so an instance keeps the last one made
+ * for it and hands that out again while it's the same method being bound,
+ * rather than allocating one every time a method is fetched.
+ */
+static Value bindInstanceMethod(Value receiver, ObjClosure* method) {
+    if (!IS_INSTANCE(receiver)) {
+        return OBJ_VAL(newBoundMethod(receiver, method));
+    }
+    ObjInstance* instance = AS_INSTANCE(receiver);
+    if (instance->bound == NULL || instance->bound->method != method) {
+        instance->bound = newBoundMethod(receiver, method);
+        writeBarrier((Obj*)instance, OBJ_VAL(instance->bound));
+    }
+    return OBJ_VAL(instance->bound);
+}
+
+/**
+ * Method for binding a method.
+ */
+static bool bindMethod(ObjClass* sClass, ObjString* name) {
+    Value method;
+    if (!tableGet(&sClass->methods, OBJ_VAL(name), &method)) {
+        return false;
+    }
+
+    Value bound = bindInstanceMethod(peek(0), AS_CLOSURE(method));
+    pop();
+    push(bound);
+    return true;
+}
+
+/**
+ * Method for capturing an upvalue.
+ */
+static ObjUpvalue* captureUpvalue(Value* local) {
+    ObjUpvalue* prevUpvalue = NULL;
+    ObjUpvalue* upvalue = vm->openUpvalues;
+    while (upvalue != NULL && upvalue->location > local) {
+        prevUpvalue = upvalue;
+        upvalue = upvalue->next;
+    }
+
+    if (upvalue != NULL && upvalue->location == local) {
+        return upvalue;
+    }
+
+    ObjUpvalue* createdUpvalue = newUpvalue(local);
+    createdUpvalue->next = upvalue;
+    if (prevUpvalue == NULL) {
+        vm->openUpvalues = createdUpvalue;
+    } else {
+        prevUpvalue->next = createdUpvalue;
+    }
+    return createdUpvalue;
+}
+
+/**
+ * Method for closing over values.
+ */
+static void closeUpvalues(Value* last) {
+    while (vm->openUpvalues != NULL && vm->openUpvalues->location >= last) {
+        ObjUpvalue* upvalue = vm->openUpvalues;
+        upvalue->closed = *upvalue->location;
+        upvalue->location = &upvalue->closed;
+        writeBarrier((Obj*)upvalue, upvalue->closed);
+        vm->openUpvalues = upvalue->next;
     }
 }
 
@@ -529,10 +1194,25 @@ static void defineMethod(ObjString* name) {
     Value method = peek(0);
     ObjClass* sClass = AS_CLASS(peek(1));
     tableSet(&sClass->methods, OBJ_VAL(name), method);
+    writeBarrier((Obj*)sClass, method);
     pop();
 }
 
 
+/**
+ * Method for checking whether a string contains another.
+ *
+ * Compares by length rather than relying on the strings being null terminated.
+ */
+static bool stringContains(ObjString* string, ObjString* substring) {
+    for (int i = 0; i + substring->length <= string->length; i++) {
+        if (memcmp(string->chars + i, substring->chars, substring->length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /**
  *  Method for concatenating two strings.
  *
@@ -551,21 +1231,373 @@ static void concatenate() {
     memcpy(chars + a->length, b->chars, b->length);
     chars[length] = '\0';
 
-    ObjString* result = takeString(chars, length);
+    ObjString* result = takeRuntimeString(chars, length);
     pop();
     pop();
     push(OBJ_VAL(result));
 }
 
+/**
+ * The most characters a number formatted with a spec can take before its precision,
+ * enough for DBL_MAX written out in full with its sign and point.
+ */
+#define FORMAT_NUMBER_CHARS 320
+
+/**
+ * Method for formatting a number into chars as a format spec asks, returning its length.
+ */
+static int formatNumber(char* chars, double number, const uint8_t* spec) {
+    // a NaN's written without its sign, as printing it is
+    number = isnan(number) ? NAN : number;
+    int precision = spec[0] & FORMAT_PRECISION ? spec[2] : -1;
+    switch (spec[0] & FORMAT_TYPE_MASK) {
+        case FORMAT_FIXED:
+            return sprintf(chars, "%.*f", precision < 0 ? 6 : precision, number);
+        case FORMAT_EXPONENT:
+            return sprintf(chars, "%.*e", precision < 0 ? 6 : precision, number);
+        case FORMAT_GENERAL:
+            return sprintf(chars, "%.*g", precision < 0 ? 6 : precision, number);
+        case FORMAT_INTEGER:
+            // adding zero turns a truncated -0 into 0
+            return sprintf(chars, "%.0f", trunc(number) + 0.0);
+        case FORMAT_HEX:
+            if (fabs(number) < 9223372036854775808.0) {
+                long long integer = (long long)number;
+                return sprintf(chars, "%s%llx", integer < 0 ? "-" : "", (unsigned long long)llabs(integer));
+            }
+            return sprintf(chars, "%.0f", number);
+        default:
+            return precision < 0 ? sprintf(chars, "%.14g", number) : sprintf(chars, "%.*g", precision, number);
+    }
+}
+
+/**
+ * Method for padding a formatted part of length characters out to its spec's width.
+ * Numbers go to the right by default, with any zeros after the sign, and everything else to the left.
+ */
+static int padPart(char* chars, int length, const uint8_t* spec, bool number) {
+    int width = spec[1];
+    if (length >= width) {
+        return length;
+    }
+    int padding = width - length;
+    int align = spec[0] & FORMAT_ALIGN_MASK;
+    if (align == 0) {
+        align = number ? FORMAT_ALIGN_RIGHT : FORMAT_ALIGN_LEFT;
+    }
+    if (number && (spec[0] & FORMAT_ZERO_PAD) && align == FORMAT_ALIGN_RIGHT) {
+        int sign = chars[0] == '-' ? 1 : 0;
+        memmove(chars + sign + padding, chars + sign, length - sign);
+        memset(chars + sign, '0', padding);
+        return width;
+    }
+    int before = align == FORMAT_ALIGN_LEFT ? 0 : align == FORMAT_ALIGN_RIGHT ? padding : padding / 2;
+    memmove(chars + before, chars, length);
+    memset(chars, ' ', before);
+    memset(chars + before + length, ' ', padding - before);
+    return width;
+}
+
+/**
+ * Method for joining the top count values on the stack into one string.
+ *
+ * specs is OP_FORMAT's flags, width and precision for each part, or NULL for
+ * OP_INTERPOLATE's plain parts. Every part is written straight into the one
+ * buffer that becomes the result, so only the final string is allocated.
+ * Returns false if a value couldn't be formatted.
+ */
+static bool interpolate(int count, const uint8_t* specs) {
+    Value* parts = vm->stackTop - count;
+    Writer writer;
+    initWriter(&writer);
+    for (int i = 0; i < count; i++) {
+        const uint8_t* spec = specs == NULL ? NULL : &specs[i * FORMAT_SPEC_BYTES];
+        if (spec != NULL && spec[0] == 0 && spec[1] == 0) {
+            spec = NULL;
+        }
+        size_t start = writer.length;
+        bool number = IS_NUMBER(parts[i]);
+        bool written;
+        if (spec == NULL) {
+            written = writeValue(&writer, parts[i]);
+        } else if (number) {
+            written = reserveWriter(&writer, FORMAT_NUMBER_CHARS + spec[2]);
+            if (written) {
+                writer.length += formatNumber(writer.chars + start, AS_NUMBER(parts[i]), spec);
+            }
+        } else if ((spec[0] & FORMAT_TYPE_MASK) != FORMAT_NONE) {
+            freeWriter(&writer);
+            runtimeError(ERROR_TYPE, "Can't format %s as a number.", valueTypeToString(parts[i]));
+            return false;
+        } else {
+            written = writeValue(&writer, parts[i]);
+            if ((spec[0] & FORMAT_PRECISION) && writer.length - start > spec[2]) {
+                writer.length = start + spec[2];
+            }
+        }
+        if (written && spec != NULL && writer.length - start < spec[1]) {
+            written = reserveWriter(&writer, spec[1] - (writer.length - start));
+            if (written) {
+                writer.length = start + padPart(writer.chars + start, (int)(writer.length - start), spec, number);
+            }
+        }
+        if (!written) {
+            const char* message = writer.error;
+            freeWriter(&writer);
+            runtimeError(ERROR_RUNTIME, "%s", message);
+            return false;
+        }
+    }
+
+    ObjString* result = writerToString(&writer);
+    vm->stackTop -= count;
+    push(OBJ_VAL(result));
+    return true;
+}
+
+/**
+ * Method for adding the top two values on the stack when they aren't both numbers.
+ *
+ * Concatenates strings and lists, and raises a runtime error for anything else.
+ * A dict view adds like the list of what it produces.
+ * Returns false if an error was raised.
+ */
+static bool addValues() {
+    if (IS_STRING(peek(0)) || IS_STRING(peek(1))) {
+        concatenate();
+    } else if ((IS_LIST(peek(0)) || IS_DICT_VIEW(peek(0))) && (IS_LIST(peek(1)) || IS_DICT_VIEW(peek(1)))) {
+        // each view is swapped for its list where it is on the stack, so it stays rooted until then
+        for (int i = 0; i < 2; i++) {
+            if (IS_DICT_VIEW(peek(i))) {
+                vm->stackTop[-1 - i] = OBJ_VAL(dictViewToList(AS_DICT_VIEW(peek(i))));
+            }
+        }
+        ObjList* b = AS_LIST(peek(0));
+        ObjList* a = AS_LIST(peek(1));
+        ObjList* result = newListWithCapacity(a->count + b->count);
+        push(OBJ_VAL(result));
+        copyValues(result->values.values, a->values.values, a->count);
+        copyValues(result->values.values + a->count, b->values.values, b->count);
+        result->count = a->count + b->count;
+        result->values.count = result->count;
+        rememberObject((Obj*)result);
+
+        vm->stackTop -= 3;
+        push(OBJ_VAL(result));
+    } else {
+        if (VALUE_TYPE(peek(0)) != VALUE_TYPE(peek(1))) {
+            runtimeError(
+                ERROR_TYPE,
+                "Mismatched types: %s and %s.",
+                valueTypeToString(peek(0)),
+                valueTypeToString(peek(1))
+            );
+            return false;
+        }
+        runtimeError(ERROR_TYPE, "Addition not support for %s.", valueTypeToString(peek(0)));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Method for applying one of the three address arithmetic instructions' opcodes to two numbers.
+ */
+static inline double arithmetic(uint8_t op, double a, double b) {
+    switch (op) {
+        case OP_ADD: return a + b;
+        case OP_SUBTRACT: return a - b;
+        case OP_MULTIPLY: return a * b;
+        case OP_DIVIDE: return a / b;
+        default: return remainder(a, b);
+    }
+}
+
+/**
+ * Method for the remainder of two ints, which is an int unless it'd be -0 or b is 0.
+ */
+static Value intRemainder(int32_t a, int32_t b) {
+    int32_t rest;
+    if (remainderInts(a, b, &rest)) {
+        return INT_VAL(rest);
+    }
+    return NUMBER_VAL(remainder(a, b));
+}
+
+/**
+ * Method for applying an arithmetic opcode to two ints, doing it in doubles
+ * if the result doesn't fit in an int or the opcode always gives a double.
+ */
+static inline Value intArithmetic(uint8_t op, int32_t a, int32_t b) {
+    int32_t result;
+    switch (op) {
+        case OP_ADD:
+            if (addInts(a, b, &result)) {
+                return INT_VAL(result);
+            }
+            break;
+        case OP_SUBTRACT:
+            if (subtractInts(a, b, &result)) {
+                return INT_VAL(result);
+            }
+            break;
+        case OP_MULTIPLY:
+            if (multiplyInts(a, b, &result)) {
+                return INT_VAL(result);
+            }
+            break;
+        case OP_MODULO:
+            return intRemainder(a, b);
+    }
+    return NUMBER_VAL(arithmetic(op, a, b));
+}
+
+/**
+ * Method for applying an arithmetic opcode to the top two values on the stack when they aren't both numbers.
+ *
+ * Only addition has anything to do for other types, everything else is an error.
+ * Returns false if an error was raised.
+ */
+static bool arithmeticValues(uint8_t op) {
+    if (op == OP_ADD) {
+        return addValues();
+    }
+    runtimeError(ERROR_TYPE, "Operands must be numbers.");
+    return false;
+}
+
+/**
+ * Method for freeing the lists and dicts frames own that unwinding to the
+ * frame at index, keeping the stack below keep, drops.
+ *
+ * A frame's own only ever sit in its part of the stack, perhaps more than once
+ * while one's being used, so each is freed where it first appears as long as
+ * that's above keep.
+ */
+static void freeUnwoundLocals(int index, Value* keep) {
+    for (int i = index; i < vm->frameCount && vm->localObjects != NULL; i++) {
+        Value* start = vm->frames[i].slots;
+        Value* end = i + 1 < vm->frameCount ? vm->frames[i + 1].slots : vm->stackTop;
+        for (Value* slot = start < keep ? keep : start; slot < end; slot++) {
+            if (!IS_OBJ(*slot)) {
+                continue;
+            }
+            Value* first = start;
+            while (first < slot && !(IS_OBJ(*first) && AS_OBJ(*first) == AS_OBJ(*slot))) {
+                first++;
+            }
+            if (first == slot) {
+                freeLocalObject(AS_OBJ(*slot));
+            }
+        }
+    }
+}
+
+/**
+ * Method for jumping to the try block that catches the exception being raised.
+ *
+ * The frames above the try block's are dropped and its stack cut back to the
+ * locals it started with, with the exception pushed on top for the except clauses.
+ * Returns false if nothing's being raised, or the try block is below the frames
+ * this run() is for, in which case the exception's left for the native that
+ * started it to fail with.
+ */
+static bool catchException() {
+    if (IS_NIL(vm->exception)) {
+        return false;
+    }
+
+    for (int i = vm->frameCount - 1; i >= vm->baseFrame; i--) {
+        CallFrame* frame = &vm->frames[i];
+        Chunk* chunk = &frame->closure->function->chunk;
+        ExceptionHandler* handler = findExceptionHandler(chunk, (int)(frame->ip - chunk->code - 1));
+        if (handler == NULL) {
+            continue;
+        }
+
+        if (UNLIKELY(vm->profile)) {
+            for (int f = vm->frameCount - 1; f > i; f--) {
+                profileReturn(f);
+            }
+        }
+        Value* slots = frame->slots + handler->depth;
+        closeUpvalues(slots);
+        freeUnwoundLocals(i, slots);
+        vm->frameCount = i + 1;
+        dropMemoCalls();
+        vm->stackTop = slots;
+        push(vm->exception);
+        vm->exception = NIL_VAL;
+        frame->ip = chunk->code + handler->handler;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Method for raising the value on top of the stack with a raise statement.
+ *
+ * An exception that was caught is raised again as it is, anything
+ * else becomes the message of a new exception of the given type.
+ */
+static void raiseValue(enum ErrorType type) {
+    Value value = peek(0);
+    if (IS_EXCEPTION(value)) {
+        pop();
+        raiseException(AS_ERROR(value));
+        return;
+    }
+
+    // converting in place keeps the string rooted
+    vm->stackTop[-1] = valueToString(value);
+    if (!IS_STRING(peek(0))) {
+        runtimeError(ERROR_TYPE, "Can't convert %s to a string.", valueTypeToString(value));
+        return;
+    }
+    const char* message = AS_CSTRING(peek(0));
+    pop();
+    runtimeError(type, "%s", message);
+}
+
+#ifdef DEBUG_TRACE_EXECUTION
+/**
+ * Method for printing the stack and the instruction about to be executed.
+ */
+static void traceExecution(CallFrame* frame, uint8_t* ip) {
+    printf("          ");
+    for (Value* slot = vm->stack; slot < vm->stackTop; slot++) {
+        printf("[ ");
+        printValue(*slot);
+        printf(" ]");
+    }
+    printf("  <-- stack size: %ld\n", (long)(vm->stackTop - vm->stack));
+    disassembleInstruction(&frame->closure->function->chunk, (int)(ip - frame->closure->function->chunk.code));
+}
+#endif
+
 /**
  * Method for actually running byte code.
+ *
+ * Uses computed-goto dispatch when COMPUTED_GOTO is defined (see common.h)
+ * and falls back to a plain switch otherwise. Both share the same handlers;
+ * each one finishes with DISPATCH() rather than break.
  */
 static InterpretResult run() {
-    CallFrame* frame = &vm.frames[vm.frameCount - 1];
+    CallFrame* frame = &vm->frames[vm->frameCount - 1];
     register uint8_t* ip = frame->ip;
 
 #define READ_BYTE() (*ip++)
 
+// anything that raised an error carries on at the except clauses catching it, if there are any
+#define THROW() goto raised
+
+// there's always STACK_SLACK room above the top when an instruction starts, so no need to check
+#define PUSH(value) \
+    do { \
+        Value pushed = (value); \
+        *vm->stackTop++ = pushed; \
+    } while (false)
+
 #define READ_CONSTANT() \
     (frame->closure->function->chunk.constants.values[READ_BYTE()])
 
@@ -573,991 +1605,1830 @@ static InterpretResult run() {
     (ip += 2, \
     (uint16_t)((ip[-2] << 8) | ip[-1]))
 
-#define READ_STRING() AS_STRING(READ_CONSTANT())
+// names are always read with a two byte index
+#define READ_CONSTANT_LONG() \
+    (frame->closure->function->chunk.constants.values[READ_SHORT()])
+#define READ_STRING() AS_STRING(READ_CONSTANT_LONG())
+#define READ_CACHE() (&frame->closure->function->chunk.caches[READ_SHORT()])
 #define BINARY_OP(valueType, op) \
     do { \
         if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
             frame->ip = ip; \
             runtimeError(ERROR_TYPE, "Operands must be numbers."); \
-            return INTERPRET_RUNTIME_ERROR; \
+            THROW(); \
         } \
         double b = AS_NUMBER(pop()); \
         double a = AS_NUMBER(pop()); \
-        push(valueType(a op b)); \
+        PUSH(valueType(a op b)); \
+    } while (false)
+
+// two doubles are checked for first so code working in doubles pays nothing for ints,
+// then two ints stay ints while the result fits in one and anything else is done in doubles,
+// giving EMPTY_VAL if either isn't a number
+#define NUMBER_ARITHMETIC(op, a, b) \
+    (IS_DOUBLE(a) && IS_DOUBLE(b) ? NUMBER_VAL(arithmetic(op, AS_DOUBLE(a), AS_DOUBLE(b))) \
+        : IS_INT(a) && IS_INT(b) ? intArithmetic(op, AS_INT(a), AS_INT(b)) \
+        : IS_NUMBER(a) && IS_NUMBER(b) ? NUMBER_VAL(arithmetic(op, AS_NUMBER(a), AS_NUMBER(b))) \
+        : EMPTY_VAL)
+
+// doubles and ints are compared as they are, a mix goes through BINARY_OP
+#define COMPARISON_OP(op) \
+    do { \
+        Value b = peek(0); \
+        Value a = peek(1); \
+        if (IS_DOUBLE(a) && IS_DOUBLE(b)) { \
+            vm->stackTop -= 2; \
+            PUSH(BOOL_VAL(AS_DOUBLE(a) op AS_DOUBLE(b))); \
+        } else if (IS_INT(a) && IS_INT(b)) { \
+            vm->stackTop -= 2; \
+            PUSH(BOOL_VAL(AS_INT(a) op AS_INT(b))); \
+        } else { \
+            BINARY_OP(BOOL_VAL, op); \
+        } \
+    } while (false)
+
+// the other arithmetic instructions, which are only for numbers
+#define ARITHMETIC_OP(opcode) \
+    do { \
+        Value a = peek(1); \
+        Value b = peek(0); \
+        Value result = NUMBER_ARITHMETIC(opcode, a, b); \
+        if (IS_EMPTY(result)) { \
+            frame->ip = ip; \
+            runtimeError(ERROR_TYPE, "Operands must be numbers."); \
+            THROW(); \
+        } \
+        vm->stackTop--; \
+        vm->stackTop[-1] = result; \
+    } while (false)
+
+// the three address instructions work on numbers straight from the slots,
+// and only go through the stack to concatenate or raise an error
+#define LOCAL_ARITH(op, left, right, result) \
+    do { \
+        Value l = (left); \
+        Value r = (right); \
+        result = NUMBER_ARITHMETIC(op, l, r); \
+        if (IS_EMPTY(result)) { \
+            frame->ip = ip; \
+            PUSH(l); \
+            PUSH(r); \
+            if (!arithmeticValues(op)) { \
+                THROW(); \
+            } \
+            result = pop(); \
+        } \
     } while (false)
 
+// the generic instructions below rewrite themselves to a quickened form for the types they've just seen,
+// which checks those types first and rewrites itself back, then reruns as the generic one, if they change
+#define QUICKEN(instruction) (ip[-1] = (instruction))
+#define DEOPTIMISE(instruction) \
+    do { \
+        *--ip = (instruction); \
+        DISPATCH(); \
+    } while (false)
 
-    for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
-    printf("          ");
-    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
-        printf("[ ");
-        printValue(*slot);
-        printf(" ]");
-    }
-    printf("  <-- stack size: %ld\n", (long)(vm.stackTop - vm.stack));
-    disassembleInstruction(&frame->closure->function->chunk, (int)(frame->ip - frame->closure->function->chunk.code));
+#define TRACE_EXECUTION() traceExecution(frame, ip)
+#else
+#define TRACE_EXECUTION() do { } while (false)
 #endif
 
-        uint8_t instruction;
-        switch (instruction = READ_BYTE()) {
-            case OP_CONSTANT: {
-                Value constant = READ_CONSTANT();
-                push(constant);
-                break;
-            }
-            case OP_NIL: {
-                push(NIL_VAL);
-                break;
-            }
-            case OP_TRUE: {
-                push(BOOL_VAL(true));
-                break;
-            }
-            case OP_FALSE: {
-                push(BOOL_VAL(false));
-                break;
-            }
-            case OP_POP: {
-                pop();
-                #ifdef DEBUG_LOGGING
-                printf("DEBUG: Stack after OP_POP: ");
-                for (int i = 0; i < vm.stackTop - vm.stack; i++) {
-                    printValue(vm.stack[i]);
-                    printf(" ");
-                }
-                printf("\n");
-                #endif
-                break;
-            }
-            case OP_GET_LOCAL: {
-                uint8_t slot = READ_BYTE();
-                #ifdef DEBUG_LOGGING
-                printf("OP_GET_LOCAL: slot: %d, value: ", slot);
-                printValue(frame->slots[slot]);
-                printf("\n");
-                printf("DEBUG: Stack before OP_GET_LOCAL: ");
-                for (int i = 0; i < vm.stackTop - vm.stack; i++) {
-                    printValue(vm.stack[i]);
-                    printf(" ");
-                }
-                printf("\n");
-                printf("All slots: ");
-                for (Value* slot = frame->slots; slot < vm.stackTop; slot++) {
-                    printValue(*slot);
-                    printf(" ");
-                }
-                printf("\n");
-                #endif
-                push(frame->slots[slot]);
-                #ifdef DEBUG_LOGGING
-                printf("DEBUG: Stack after OP_GET_LOCAL: ");
-                for (int i = 0; i < vm.stackTop - vm.stack; i++) {
-                    printValue(vm.stack[i]);
-                    printf(" ");
-                }
-                printf("\n");
-                printf("All slots: ");
-                for (Value* slot = frame->slots; slot < vm.stackTop; slot++) {
-                    printValue(*slot);
-                    printf(" ");
-                }
-                printf("\n");
-                #endif
-                break;
-            }
-            case OP_SET_LOCAL: {
-                uint8_t slot = READ_BYTE();
-                #ifdef DEBUG_LOGGING
-                printf("OP_SET_LOCAL: slot: %d, value: ", slot);
-                printValue(peek(0));
-                printf("\n");
-                printf("DEBUG: Stack before OP_SET_LOCAL: ");
-                for (int i = 0; i < vm.stackTop - vm.stack; i++) {
-                    printValue(vm.stack[i]);
-                    printf(" ");
-                }
-                printf("\n");
-                printf("All slots: ");
-                for (Value* slot = frame->slots; slot < vm.stackTop; slot++) {
-                    printValue(*slot);
-                    printf(" ");
-                }
-                printf("\n");
-                #endif
-                frame->slots[slot] = peek(0);
-                #ifdef DEBUG_LOGGING
-                printf("DEBUG: Stack after OP_SET_LOCAL: ");
-                for (int i = 0; i < vm.stackTop - vm.stack; i++) {
-                    printValue(vm.stack[i]);
-                    printf(" ");
-                }
-                printf("\n");
-                printf("All slots: ");
-                for (Value* slot = frame->slots; slot < vm.stackTop; slot++) {
-                    printValue(*slot);
-                    printf(" ");
-                }
-                printf("\n");
-                #endif
-                break;
-            }
-            case OP_GET_GLOBAL: {
-                #ifdef DEBUG_LOGGING
-                // Debug: Print stack and slots before the call
-                printf("== Before OP_GET_GLOBAL ==\n");
-                printf("StackTop: %ld\n", vm.stackTop - vm.stack);
-                for (Value* v = vm.stack; v < vm.stackTop; v++) {
-                    printf("  [%ld] ", v - vm.stack);
-                    printValue(*v);
-                    printf("\n");
-                }
-                printf("All slots: ");
-                for (Value* slot = frame->slots; slot < vm.stackTop; slot++) {
-                    printValue(*slot);
-                    printf(" ");
-                }
-                printf("\n");
-                #endif
-                ObjString* name = READ_STRING();
-                Value value;
-                if (!tableGet(&vm.globals, OBJ_VAL(name), &value)) {
-                    frame->ip = ip;
-                    runtimeError(ERROR_NAME, "Undefined variable '%s'", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                push(value);
-                #ifdef DEBUG_LOGGING
-                // Debug: Print stack and slots before the call
-                printf("== After OP_GET_GLOBAL ==\n");
-                printf("StackTop: %ld\n", vm.stackTop - vm.stack);
-                for (Value* v = vm.stack; v < vm.stackTop; v++) {
-                    printf("  [%ld] ", v - vm.stack);
-                    printValue(*v);
-                    printf("\n");
-                }
-                printf("All slots: ");
-                for (Value* slot = frame->slots; slot < vm.stackTop; slot++) {
-                    printValue(*slot);
-                    printf(" ");
-                }
+#ifdef SLO_OPCODE_STATS
+#define COUNT_OPCODE() countOpcode(vm->opcodeStats, *ip)
+#else
+#define COUNT_OPCODE() do { } while (false)
+#endif
+
+#ifdef COMPUTED_GOTO
+    // One label per opcode so every handler ends with its own indirect jump,
+    // which gives the branch predictor far more to work with than a single switch.
+    // Anything not listed lands on the unknown opcode handler.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+    static void* dispatchTable[UINT8_COUNT] = {
+        [0 ... UINT8_MAX] = &&code_UNKNOWN,
+        [OP_CONSTANT] = &&code_OP_CONSTANT,
+        [OP_NIL] = &&code_OP_NIL,
+        [OP_TRUE] = &&code_OP_TRUE,
+        [OP_FALSE] = &&code_OP_FALSE,
+        [OP_POP] = &&code_OP_POP,
+        [OP_DEFINE_GLOBAL] = &&code_OP_DEFINE_GLOBAL,
+        [OP_DEFINE_FINAL_GLOBAL] = &&code_OP_DEFINE_FINAL_GLOBAL,
+        [OP_GET_GLOBAL] = &&code_OP_GET_GLOBAL,
+        [OP_SET_GLOBAL] = &&code_OP_SET_GLOBAL,
+        [OP_GET_LOCAL] = &&code_OP_GET_LOCAL,
+        [OP_SET_LOCAL] = &&code_OP_SET_LOCAL,
+        [OP_GET_UPVALUE] = &&code_OP_GET_UPVALUE,
+        [OP_SET_UPVALUE] = &&code_OP_SET_UPVALUE,
+        [OP_CLOSE_UPVALUE] = &&code_OP_CLOSE_UPVALUE,
+        [OP_EQUAL] = &&code_OP_EQUAL,
+        [OP_NOT_EQUAL] = &&code_OP_NOT_EQUAL,
+        [OP_GREATER] = &&code_OP_GREATER,
+        [OP_GREATER_EQUAL] = &&code_OP_GREATER_EQUAL,
+        [OP_LESS] = &&code_OP_LESS,
+        [OP_LESS_EQUAL] = &&code_OP_LESS_EQUAL,
+        [OP_NEGATE] = &&code_OP_NEGATE,
+        [OP_ADD] = &&code_OP_ADD,
+        [OP_SUBTRACT] = &&code_OP_SUBTRACT,
+        [OP_MULTIPLY] = &&code_OP_MULTIPLY,
+        [OP_DIVIDE] = &&code_OP_DIVIDE,
+        [OP_MODULO] = &&code_OP_MODULO,
+        [OP_POW] = &&code_OP_POW,
+        [OP_NOT] = &&code_OP_NOT,
+        [OP_JUMP] = &&code_OP_JUMP,
+        [OP_JUMP_IF_FALSE] = &&code_OP_JUMP_IF_FALSE,
+        [OP_JUMP_IF_TRUE] = &&code_OP_JUMP_IF_TRUE,
+        [OP_LOOP] = &&code_OP_LOOP,
+        [OP_CALL] = &&code_OP_CALL,
+        [OP_TAIL_CALL] = &&code_OP_TAIL_CALL,
+        [OP_INVOKE] = &&code_OP_INVOKE,
+        [OP_SUPER_INVOKE] = &&code_OP_SUPER_INVOKE,
+        [OP_CLOSURE] = &&code_OP_CLOSURE,
+        [OP_RETURN] = &&code_OP_RETURN,
+        [OP_CLASS] = &&code_OP_CLASS,
+        [OP_METHOD] = &&code_OP_METHOD,
+        [OP_INHERIT] = &&code_OP_INHERIT,
+        [OP_GET_SUPER] = &&code_OP_GET_SUPER,
+        [OP_SET_PROPERTY] = &&code_OP_SET_PROPERTY,
+        [OP_GET_PROPERTY] = &&code_OP_GET_PROPERTY,
+        [OP_DUP] = &&code_OP_DUP,
+        [OP_DUP2] = &&code_OP_DUP2,
+        [OP_LIST] = &&code_OP_LIST,
+        [OP_GET_INDEX] = &&code_OP_GET_INDEX,
+        [OP_SET_INDEX] = &&code_OP_SET_INDEX,
+        [OP_SLICE] = &&code_OP_SLICE,
+        [OP_HAS] = &&code_OP_HAS,
+        [OP_HAS_NOT] = &&code_OP_HAS_NOT,
+        [OP_LEN] = &&code_OP_LEN,
+        [OP_DICT] = &&code_OP_DICT,
+        [OP_ENUM] = &&code_OP_ENUM,
+        [OP_IMPORT] = &&code_OP_IMPORT,
+        [OP_INTERPOLATE] = &&code_OP_INTERPOLATE,
+        [OP_ASSERT] = &&code_OP_ASSERT,
+        [OP_ITER_NEXT] = &&code_OP_ITER_NEXT,
+        [OP_NEW_LIST] = &&code_OP_NEW_LIST,
+        [OP_NEW_DICT] = &&code_OP_NEW_DICT,
+        [OP_LIST_APPEND] = &&code_OP_LIST_APPEND,
+        [OP_DICT_INSERT] = &&code_OP_DICT_INSERT,
+        [OP_THROW] = &&code_OP_THROW,
+        [OP_EXCEPT_JUMP] = &&code_OP_EXCEPT_JUMP,
+        [OP_FORMAT] = &&code_OP_FORMAT,
+        [OP_GET_CAPTURED] = &&code_OP_GET_CAPTURED,
+        [OP_CONSTANT_LONG] = &&code_OP_CONSTANT_LONG,
+        [OP_LIST_LOCAL] = &&code_OP_LIST_LOCAL,
+        [OP_DICT_LOCAL] = &&code_OP_DICT_LOCAL,
+        [OP_POP_LOCAL] = &&code_OP_POP_LOCAL,
+        [OP_RETURN_LOCALS] = &&code_OP_RETURN_LOCALS,
+        [OP_INC_LOCAL] = &&code_OP_INC_LOCAL,
+        [OP_GET_LOCAL_GET_LOCAL] = &&code_OP_GET_LOCAL_GET_LOCAL,
+        [OP_LESS_JUMP] = &&code_OP_LESS_JUMP,
+        [OP_POP_N] = &&code_OP_POP_N,
+        [OP_LOCALS_ARITH] = &&code_OP_LOCALS_ARITH,
+        [OP_LOCAL_CONSTANT_ARITH] = &&code_OP_LOCAL_CONSTANT_ARITH,
+        [OP_LOCALS_ARITH_SET] = &&code_OP_LOCALS_ARITH_SET,
+        [OP_LOCAL_CONSTANT_ARITH_SET] = &&code_OP_LOCAL_CONSTANT_ARITH_SET,
+        [OP_GET_INDEX_LIST] = &&code_OP_GET_INDEX_LIST,
+        [OP_GET_INDEX_DICT] = &&code_OP_GET_INDEX_DICT,
+        [OP_SET_INDEX_LIST] = &&code_OP_SET_INDEX_LIST,
+        [OP_SET_INDEX_DICT] = &&code_OP_SET_INDEX_DICT,
+        [OP_HAS_DICT] = &&code_OP_HAS_DICT,
+        [OP_HAS_SET] = &&code_OP_HAS_SET,
+    };
+#pragma GCC diagnostic pop
+
+#define INTERPRET_LOOP DISPATCH();
+#define CASE_CODE(name) code_##name
+// handlers are plain labels, running on into the next one needs no marking
+#define CASE_FALLTHROUGH()
+#define DISPATCH() \
+    do { \
+        TRACE_EXECUTION(); \
+        COUNT_OPCODE(); \
+        if (UNLIKELY(vm->stackLimit - vm->stackTop < STACK_SLACK)) goto stackFull; \
+        goto *dispatchTable[instruction = READ_BYTE()]; \
+    } while (false)
+#else
+#define INTERPRET_LOOP \
+    loop: \
+        TRACE_EXECUTION(); \
+        COUNT_OPCODE(); \
+        if (UNLIKELY(vm->stackLimit - vm->stackTop < STACK_SLACK)) goto stackFull; \
+        switch (instruction = READ_BYTE())
+#define CASE_CODE(name) case name
+#define CASE_FALLTHROUGH() FALLTHROUGH
+#define DISPATCH() goto loop
+#endif
+
+    uint8_t instruction;
+    INTERPRET_LOOP {
+        CASE_CODE(OP_CONSTANT): {
+            Value constant = READ_CONSTANT();
+            PUSH(constant);
+            DISPATCH();
+        }
+        CASE_CODE(OP_CONSTANT_LONG): {
+            Value constant = READ_CONSTANT_LONG();
+            PUSH(constant);
+            DISPATCH();
+        }
+        CASE_CODE(OP_NIL): {
+            PUSH(NIL_VAL);
+            DISPATCH();
+        }
+        CASE_CODE(OP_TRUE): {
+            PUSH(BOOL_VAL(true));
+            DISPATCH();
+        }
+        CASE_CODE(OP_FALSE): {
+            PUSH(BOOL_VAL(false));
+            DISPATCH();
+        }
+        CASE_CODE(OP_POP_LOCAL): {
+            // the variable holding a list or dict that never left the frame is going out of scope
+            vm->stackTop--;
+            freeLocalObject(AS_OBJ(*vm->stackTop));
+            DISPATCH();
+        }
+        CASE_CODE(OP_POP): {
+            pop();
+            #ifdef DEBUG_LOGGING
+            printf("DEBUG: Stack after OP_POP: ");
+            for (int i = 0; i < vm->stackTop - vm->stack; i++) {
+                printValue(vm->stack[i]);
+                printf(" ");
+            }
+            printf("\n");
+            #endif
+            DISPATCH();
+        }
+        CASE_CODE(OP_POP_N): {
+            vm->stackTop -= READ_BYTE();
+            DISPATCH();
+        }
+        CASE_CODE(OP_GET_LOCAL_GET_LOCAL): {
+            uint8_t first = READ_BYTE();
+            uint8_t second = READ_BYTE();
+            PUSH(frame->slots[first]);
+            PUSH(frame->slots[second]);
+            DISPATCH();
+        }
+        CASE_CODE(OP_LOCALS_ARITH): {
+            uint8_t op = READ_BYTE();
+            uint8_t left = READ_BYTE();
+            uint8_t right = READ_BYTE();
+            Value result;
+            LOCAL_ARITH(op, frame->slots[left], frame->slots[right], result);
+            PUSH(result);
+            DISPATCH();
+        }
+        CASE_CODE(OP_LOCAL_CONSTANT_ARITH): {
+            uint8_t op = READ_BYTE();
+            uint8_t left = READ_BYTE();
+            Value constant = READ_CONSTANT();
+            Value result;
+            LOCAL_ARITH(op, frame->slots[left], constant, result);
+            PUSH(result);
+            DISPATCH();
+        }
+        CASE_CODE(OP_LOCALS_ARITH_SET): {
+            uint8_t op = READ_BYTE();
+            uint8_t left = READ_BYTE();
+            uint8_t right = READ_BYTE();
+            Value result;
+            LOCAL_ARITH(op, frame->slots[left], frame->slots[right], result);
+            frame->slots[READ_BYTE()] = result;
+            DISPATCH();
+        }
+        CASE_CODE(OP_LOCAL_CONSTANT_ARITH_SET): {
+            uint8_t op = READ_BYTE();
+            uint8_t left = READ_BYTE();
+            Value constant = READ_CONSTANT();
+            Value result;
+            LOCAL_ARITH(op, frame->slots[left], constant, result);
+            frame->slots[READ_BYTE()] = result;
+            DISPATCH();
+        }
+        CASE_CODE(OP_GET_LOCAL): {
+            uint8_t slot = READ_BYTE();
+            #ifdef DEBUG_LOGGING
+            printf("OP_GET_LOCAL: slot: %d, value: ", slot);
+            printValue(frame->slots[slot]);
+            printf("\n");
+            printf("DEBUG: Stack before OP_GET_LOCAL: ");
+            for (int i = 0; i < vm->stackTop - vm->stack; i++) {
+                printValue(vm->stack[i]);
+                printf(" ");
+            }
+            printf("\n");
+            printf("All slots: ");
+            for (Value* slot = frame->slots; slot < vm->stackTop; slot++) {
+                printValue(*slot);
+                printf(" ");
+            }
+            printf("\n");
+            #endif
+            PUSH(frame->slots[slot]);
+            #ifdef DEBUG_LOGGING
+            printf("DEBUG: Stack after OP_GET_LOCAL: ");
+            for (int i = 0; i < vm->stackTop - vm->stack; i++) {
+                printValue(vm->stack[i]);
+                printf(" ");
+            }
+            printf("\n");
+            printf("All slots: ");
+            for (Value* slot = frame->slots; slot < vm->stackTop; slot++) {
+                printValue(*slot);
+                printf(" ");
+            }
+            printf("\n");
+            #endif
+            DISPATCH();
+        }
+        CASE_CODE(OP_SET_LOCAL): {
+            uint8_t slot = READ_BYTE();
+            #ifdef DEBUG_LOGGING
+            printf("OP_SET_LOCAL: slot: %d, value: ", slot);
+            printValue(peek(0));
+            printf("\n");
+            printf("DEBUG: Stack before OP_SET_LOCAL: ");
+            for (int i = 0; i < vm->stackTop - vm->stack; i++) {
+                printValue(vm->stack[i]);
+                printf(" ");
+            }
+            printf("\n");
+            printf("All slots: ");
+            for (Value* slot = frame->slots; slot < vm->stackTop; slot++) {
+                printValue(*slot);
+                printf(" ");
+            }
+            printf("\n");
+            #endif
+            frame->slots[slot] = peek(0);
+            #ifdef DEBUG_LOGGING
+            printf("DEBUG: Stack after OP_SET_LOCAL: ");
+            for (int i = 0; i < vm->stackTop - vm->stack; i++) {
+                printValue(vm->stack[i]);
+                printf(" ");
+            }
+            printf("\n");
+            printf("All slots: ");
+            for (Value* slot = frame->slots; slot < vm->stackTop; slot++) {
+                printValue(*slot);
+                printf(" ");
+            }
+            printf("\n");
+            #endif
+            DISPATCH();
+        }
+        CASE_CODE(OP_GET_GLOBAL): {
+            #ifdef DEBUG_LOGGING
+            // Debug: Print stack and slots before the call
+            printf("== Before OP_GET_GLOBAL ==\n");
+            printf("StackTop: %ld\n", vm->stackTop - vm->stack);
+            for (Value* v = vm->stack; v < vm->stackTop; v++) {
+                printf("  [%ld] ", v - vm->stack);
+                printValue(*v);
                 printf("\n");
-                #endif
-                break;
             }
-            case OP_SET_GLOBAL: {
-                ObjString* name = READ_STRING();
-                Value temp;
-                if (tableGet(&vm.globalFinals, OBJ_VAL(name), &temp)) {
-                    frame->ip = ip;
-                    runtimeError(ERROR_TYPE, "Cannot assign to a 'final' variable.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                if (tableSet(&vm.globals, OBJ_VAL(name), peek(0))) {
-                    tableDelete(&vm.globals, OBJ_VAL(name));
-                    frame->ip = ip;
-                    runtimeError(ERROR_NAME, "Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
+            printf("All slots: ");
+            for (Value* slot = frame->slots; slot < vm->stackTop; slot++) {
+                printValue(*slot);
+                printf(" ");
             }
-            case OP_DEFINE_GLOBAL: {
-                ObjString* name = READ_STRING();
-                Value temp;
-                if (tableGet(&vm.globalFinals, OBJ_VAL(name), &temp)) {
-                    frame->ip = ip;
-                    runtimeError(ERROR_TYPE, "Cannot redfine a 'final' variable.");
-                    return INTERPRET_RUNTIME_ERROR;
+            printf("\n");
+            #endif
+            uint16_t slot = READ_SHORT();
+            Value value = vm->globalValues.values[slot];
+            if (IS_EMPTY(value)) {
+                // a module's own global that it hasn't defined may be a builtin
+                int fallback = (int)AS_NUMBER(vm->globalFallbacks.values[slot]);
+                if (fallback >= 0) {
+                    value = vm->globalValues.values[fallback];
                 }
-                tableSet(&vm.globals, OBJ_VAL(name), peek(0));
-                pop();
-                break;
-            }
-            case OP_DEFINE_FINAL_GLOBAL: {
-                ObjString* name = READ_STRING();
-                tableSet(&vm.globals, OBJ_VAL(name), peek(0));
-                tableSet(&vm.globalFinals, OBJ_VAL(name), NIL_VAL);
-                pop();
-                break;
-            }
-            case OP_GET_UPVALUE: {
-                uint8_t slot = READ_BYTE();
-                push(*frame->closure->upvalues[slot]->location);
-                break;
             }
-            case OP_SET_UPVALUE: {
-                uint8_t slot = READ_BYTE();
-                *frame->closure->upvalues[slot]->location = peek(0);
-                break;
+            if (IS_EMPTY(value)) {
+                frame->ip = ip;
+                runtimeError(ERROR_NAME, "Undefined variable '%s'", AS_CSTRING(vm->globalNames.values[slot]));
+                THROW();
+            }
+            PUSH(value);
+            #ifdef DEBUG_LOGGING
+            // Debug: Print stack and slots before the call
+            printf("== After OP_GET_GLOBAL ==\n");
+            printf("StackTop: %ld\n", vm->stackTop - vm->stack);
+            for (Value* v = vm->stack; v < vm->stackTop; v++) {
+                printf("  [%ld] ", v - vm->stack);
+                printValue(*v);
+                printf("\n");
             }
-            case OP_EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(valuesEqual(a, b)));
-                break;
+            printf("All slots: ");
+            for (Value* slot = frame->slots; slot < vm->stackTop; slot++) {
+                printValue(*slot);
+                printf(" ");
             }
-            case OP_NOT_EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(!valuesEqual(a, b)));
-                break;
+            printf("\n");
+            #endif
+            DISPATCH();
+        }
+        CASE_CODE(OP_SET_GLOBAL): {
+            uint16_t slot = READ_SHORT();
+            if (AS_BOOL(vm->globalFinals.values[slot])) {
+                frame->ip = ip;
+                runtimeError(ERROR_TYPE, "Cannot assign to a 'final' variable.");
+                THROW();
             }
-            case OP_GREATER: {
-                BINARY_OP(BOOL_VAL, >);
-                break;
+            if (IS_EMPTY(vm->globalValues.values[slot])) {
+                frame->ip = ip;
+                runtimeError(ERROR_NAME, "Undefined variable '%s'.", AS_CSTRING(vm->globalNames.values[slot]));
+                THROW();
             }
-            case OP_GREATER_EQUAL: {
-                if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
-                    runtimeError(ERROR_TYPE, "Operands must be numbers.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                double b = AS_NUMBER(pop());
-                double a = AS_NUMBER(pop());
-                push(BOOL_VAL(a >= b));
-                break;
+            vm->globalValues.values[slot] = peek(0);
+            DISPATCH();
+        }
+        CASE_CODE(OP_DEFINE_GLOBAL): {
+            uint16_t slot = READ_SHORT();
+            if (AS_BOOL(vm->globalFinals.values[slot])) {
+                frame->ip = ip;
+                runtimeError(ERROR_TYPE, "Cannot redfine a 'final' variable.");
+                THROW();
             }
-            case OP_LESS: {
-                #ifdef DEBUG_LOGGING
-                // Debug: Print stack and slots before the call
-                printf("== Before OP_LESS ==\n");
-                printf("StackTop: %ld\n", vm.stackTop - vm.stack);
-                for (Value* v = vm.stack; v < vm.stackTop; v++) {
-                    printf("  [%ld] ", v - vm.stack);
-                    printValue(*v);
-                    printf("\n");
-                }
-                printf("All slots: ");
-                for (Value* slot = frame->slots; slot < vm.stackTop; slot++) {
-                    printValue(*slot);
-                    printf(" ");
-                }
-                printf("\n");
-                #endif
-                BINARY_OP(BOOL_VAL, <);
-                #ifdef DEBUG_LOGGING
-                // Debug: Print stack and slots before the call
-                printf("== After OP_LESS ==\n");
-                printf("StackTop: %ld\n", vm.stackTop - vm.stack);
-                for (Value* v = vm.stack; v < vm.stackTop; v++) {
-                    printf("  [%ld] ", v - vm.stack);
-                    printValue(*v);
-                    printf("\n");
-                }
-                printf("All slots: ");
-                for (Value* slot = frame->slots; slot < vm.stackTop; slot++) {
-                    printValue(*slot);
-                    printf(" ");
-                }
+            vm->globalValues.values[slot] = peek(0);
+            pop();
+            DISPATCH();
+        }
+        CASE_CODE(OP_DEFINE_FINAL_GLOBAL): {
+            uint16_t slot = READ_SHORT();
+            vm->globalValues.values[slot] = peek(0);
+            vm->globalFinals.values[slot] = BOOL_VAL(true);
+            pop();
+            DISPATCH();
+        }
+        CASE_CODE(OP_GET_UPVALUE): {
+            uint8_t slot = READ_BYTE();
+            PUSH(*frame->closure->upvalues[slot]->location);
+            DISPATCH();
+        }
+        CASE_CODE(OP_GET_CAPTURED): {
+            uint8_t slot = READ_BYTE();
+            PUSH(frame->closure->captured[slot]);
+            DISPATCH();
+        }
+        CASE_CODE(OP_SET_UPVALUE): {
+            uint8_t slot = READ_BYTE();
+            ObjUpvalue* upvalue = frame->closure->upvalues[slot];
+            *upvalue->location = peek(0);
+            writeBarrier((Obj*)upvalue, peek(0));
+            DISPATCH();
+        }
+        CASE_CODE(OP_EQUAL): {
+            Value b = pop();
+            Value a = pop();
+            PUSH(BOOL_VAL(valuesEqual(a, b)));
+            DISPATCH();
+        }
+        CASE_CODE(OP_NOT_EQUAL): {
+            Value b = pop();
+            Value a = pop();
+            PUSH(BOOL_VAL(!valuesEqual(a, b)));
+            DISPATCH();
+        }
+        CASE_CODE(OP_GREATER): {
+            COMPARISON_OP(>);
+            DISPATCH();
+        }
+        CASE_CODE(OP_GREATER_EQUAL): {
+            COMPARISON_OP(>=);
+            DISPATCH();
+        }
+        CASE_CODE(OP_LESS): {
+            #ifdef DEBUG_LOGGING
+            // Debug: Print stack and slots before the call
+            printf("== Before OP_LESS ==\n");
+            printf("StackTop: %ld\n", vm->stackTop - vm->stack);
+            for (Value* v = vm->stack; v < vm->stackTop; v++) {
+                printf("  [%ld] ", v - vm->stack);
+                printValue(*v);
                 printf("\n");
-                #endif
-                break;
             }
-            case OP_LESS_EQUAL: {
-                if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
-                    runtimeError(ERROR_TYPE, "Operands must be numbers.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                double b = AS_NUMBER(pop());
-                double a = AS_NUMBER(pop());
-                push(BOOL_VAL(a <= b));
-                break;
-            }
-            case OP_ADD: {
-                #ifdef DEBUG_LOGGING
-                printf("DEBUG: Stack before OP_ADD: ");
-                for (int i = 0; i < vm.stackTop - vm.stack; i++) {
-                    printValue(vm.stack[i]);
-                    printf(" ");
-                }
+            printf("All slots: ");
+            for (Value* slot = frame->slots; slot < vm->stackTop; slot++) {
+                printValue(*slot);
+                printf(" ");
+            }
+            printf("\n");
+            #endif
+            COMPARISON_OP(<);
+            #ifdef DEBUG_LOGGING
+            // Debug: Print stack and slots before the call
+            printf("== After OP_LESS ==\n");
+            printf("StackTop: %ld\n", vm->stackTop - vm->stack);
+            for (Value* v = vm->stack; v < vm->stackTop; v++) {
+                printf("  [%ld] ", v - vm->stack);
+                printValue(*v);
                 printf("\n");
-                #endif
-                if (IS_STRING(peek(0)) || IS_STRING(peek(1))) {
-
-                    concatenate();
-                } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-                    double b = AS_NUMBER(pop());
-                    double a = AS_NUMBER(pop());
-                    push(NUMBER_VAL(a + b));
-                } else if (IS_LIST(peek(0)) && IS_LIST(peek(1))) {
-                    ObjList* b = AS_LIST(pop());
-                    ObjList* a = AS_LIST(pop());
-                    ObjList* result = newList();
-
-                    // Ensure enough capacity
-                    while (result->values.capacity < a->count + b->count) {
-                        growValueArray(&result->values);
-                    }
-
-                    // Copy elements from a
-                    for (int i = 0; i < a->count; i++) {
-                        result->values.values[result->count++] = a->values.values[i];
-                    }
-                    // Copy elements from b
-                    for (int i = 0; i < b->count; i++) {
-                        result->values.values[result->count++] = b->values.values[i];
-                    }
-                    result->values.count = result->count;
-
-                    push(OBJ_VAL(result));
-                } else {
-                    frame->ip = ip;
-                    if (peek(0).type != peek(1).type) {
-                        runtimeError(
-                            ERROR_TYPE,
-                            "Mismatched types: %s and %s.",
-                            valueTypeToString(peek(0)),
-                            valueTypeToString(peek(1))
-                        );
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                    runtimeError(ERROR_TYPE, "Addition not support for %s.", valueTypeToString(peek(0)));
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
             }
-            case OP_SUBTRACT: {
-                BINARY_OP(NUMBER_VAL, -);
-                break;
+            printf("All slots: ");
+            for (Value* slot = frame->slots; slot < vm->stackTop; slot++) {
+                printValue(*slot);
+                printf(" ");
             }
-            case OP_MULTIPLY: {
-                BINARY_OP(NUMBER_VAL, *);
-                break;
+            printf("\n");
+            #endif
+            DISPATCH();
+        }
+        CASE_CODE(OP_LESS_JUMP): {
+            uint16_t offset = READ_SHORT();
+            bool less;
+            if (IS_DOUBLE(peek(0)) && IS_DOUBLE(peek(1))) {
+                less = AS_DOUBLE(peek(1)) < AS_DOUBLE(peek(0));
+            } else if (IS_INT(peek(0)) && IS_INT(peek(1))) {
+                less = AS_INT(peek(1)) < AS_INT(peek(0));
+            } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+                less = AS_NUMBER(peek(1)) < AS_NUMBER(peek(0));
+            } else {
+                frame->ip = ip;
+                runtimeError(ERROR_TYPE, "Operands must be numbers.");
+                THROW();
             }
-            case OP_DIVIDE: {
-                BINARY_OP(NUMBER_VAL, /);
-                break;
+            vm->stackTop -= 2;
+            if (!less) {
+                ip += offset;
             }
-            case OP_MODULO: {
-                if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
-                    frame->ip = ip;
-                    runtimeError(ERROR_TYPE, "Operands must be numbers.");
-                    return INTERPRET_RUNTIME_ERROR;
+            DISPATCH();
+        }
+        CASE_CODE(OP_LESS_EQUAL): {
+            COMPARISON_OP(<=);
+            DISPATCH();
+        }
+        CASE_CODE(OP_ADD): {
+            #ifdef DEBUG_LOGGING
+            printf("DEBUG: Stack before OP_ADD: ");
+            for (int i = 0; i < vm->stackTop - vm->stack; i++) {
+                printValue(vm->stack[i]);
+                printf(" ");
+            }
+            printf("\n");
+            #endif
+            Value a = peek(1);
+            Value b = peek(0);
+            Value sum = NUMBER_ARITHMETIC(OP_ADD, a, b);
+            if (!IS_EMPTY(sum)) {
+                vm->stackTop--;
+                vm->stackTop[-1] = sum;
+            } else {
+                frame->ip = ip;
+                if (!addValues()) {
+                    THROW();
                 }
-                double b = AS_NUMBER(pop());
-                double a = AS_NUMBER(pop());
-                push(NUMBER_VAL(remainder(a, b)));
-                break;
             }
-            case OP_POW: {
-                if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
-                    frame->ip = ip;
-                    runtimeError(ERROR_TYPE, "Operands must be numbers.");
-                    return INTERPRET_RUNTIME_ERROR;
+            DISPATCH();
+        }
+        CASE_CODE(OP_INC_LOCAL): {
+            uint8_t slot = READ_BYTE();
+            Value value = frame->slots[slot];
+            int32_t incremented;
+            if (IS_DOUBLE(value)) {
+                frame->slots[slot] = NUMBER_VAL(AS_DOUBLE(value) + 1);
+            } else if (IS_INT(value) && addInts(AS_INT(value), 1, &incremented)) {
+                frame->slots[slot] = INT_VAL(incremented);
+            } else if (IS_NUMBER(value)) {
+                frame->slots[slot] = NUMBER_VAL(AS_NUMBER(value) + 1);
+            } else {
+                frame->ip = ip;
+                PUSH(value);
+                PUSH(INT_VAL(1));
+                if (!addValues()) {
+                    THROW();
                 }
-                double b = AS_NUMBER(pop());
-                double a = AS_NUMBER(pop());
-                push(NUMBER_VAL(pow(a, b)));
-                break;
-            }
-            case OP_NOT: {
-                push(BOOL_VAL(isFalsey(pop())));
-                break;
+                frame->slots[slot] = pop();
             }
-            case OP_NEGATE: {
-                if (!IS_NUMBER(peek(0))) {
-                    frame->ip = ip;
-                    runtimeError(ERROR_TYPE, "Operand must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                push(NUMBER_VAL(-AS_NUMBER(pop())));
-                break;
+            DISPATCH();
+        }
+        CASE_CODE(OP_SUBTRACT): {
+            ARITHMETIC_OP(OP_SUBTRACT);
+            DISPATCH();
+        }
+        CASE_CODE(OP_MULTIPLY): {
+            ARITHMETIC_OP(OP_MULTIPLY);
+            DISPATCH();
+        }
+        CASE_CODE(OP_DIVIDE): {
+            ARITHMETIC_OP(OP_DIVIDE);
+            DISPATCH();
+        }
+        CASE_CODE(OP_MODULO): {
+            ARITHMETIC_OP(OP_MODULO);
+            DISPATCH();
+        }
+        CASE_CODE(OP_POW): {
+            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+                frame->ip = ip;
+                runtimeError(ERROR_TYPE, "Operands must be numbers.");
+                THROW();
             }
-            case OP_DUP: {
-                // duplicates the top value on the stack
-                Value value = peek(0);
-                push(value);
-                break;
+            double b = AS_NUMBER(pop());
+            double a = AS_NUMBER(pop());
+            PUSH(NUMBER_VAL(pow(a, b)));
+            DISPATCH();
+        }
+        CASE_CODE(OP_NOT): {
+            PUSH(BOOL_VAL(isFalsey(pop())));
+            DISPATCH();
+        }
+        CASE_CODE(OP_NEGATE): {
+            int32_t negated;
+            if (IS_INT(peek(0)) && negateInt(AS_INT(peek(0)), &negated)) {
+                vm->stackTop[-1] = INT_VAL(negated);
+                DISPATCH();
             }
-            case OP_DUP2: {
-                // duplicates the top two values on the stack
-                Value value1 = peek(0);
-                Value value2 = peek(1);
-                push(value2);
-                push(value1);
-                break;
+            if (!IS_NUMBER(peek(0))) {
+                frame->ip = ip;
+                runtimeError(ERROR_TYPE, "Operand must be a number.");
+                THROW();
             }
-            case OP_JUMP: {
-                uint16_t offset = READ_SHORT();
+            PUSH(NUMBER_VAL(-AS_NUMBER(pop())));
+            DISPATCH();
+        }
+        CASE_CODE(OP_DUP): {
+            // duplicates the top value on the stack
+            Value value = peek(0);
+            PUSH(value);
+            DISPATCH();
+        }
+        CASE_CODE(OP_DUP2): {
+            // duplicates the top two values on the stack
+            Value value1 = peek(0);
+            Value value2 = peek(1);
+            PUSH(value2);
+            PUSH(value1);
+            DISPATCH();
+        }
+        CASE_CODE(OP_JUMP): {
+            uint16_t offset = READ_SHORT();
+            ip += offset;
+            DISPATCH();
+        }
+        CASE_CODE(OP_JUMP_IF_FALSE): {
+            uint16_t offset = READ_SHORT();
+            if (isFalsey(peek(0))) {
                 ip += offset;
-                break;
             }
-            case OP_JUMP_IF_FALSE: {
-                uint16_t offset = READ_SHORT();
-                if (isFalsey(peek(0))) {
-                    ip += offset;
-                }
-                break;
+            DISPATCH();
+        }
+        CASE_CODE(OP_JUMP_IF_TRUE): {
+            uint16_t offset = READ_SHORT();
+            if (!isFalsey(peek(0))) {
+                ip += offset;
             }
-            case OP_JUMP_IF_TRUE: {
-                uint16_t offset = READ_SHORT();
-                if (!isFalsey(peek(0))) {
-                    ip += offset;
-                }
-                break;
+            DISPATCH();
+        }
+        CASE_CODE(OP_LOOP): {
+            uint16_t offset = READ_SHORT();
+            if (UNLIKELY(vm->profile & PROFILE_SAMPLES)) {
+                frame->ip = ip;
+                profileSample();
             }
-            case OP_LOOP: {
-                uint16_t offset = READ_SHORT();
+            if (vm->jit) {
+                ip = enterLoop(&frame->closure->function->chunk, ip - offset, ip, frame->slots);
+            } else {
                 ip -= offset;
-                break;
             }
-            case OP_CALL: {
-                int argCount = READ_BYTE();
-                frame->ip = ip;
-
-                #ifdef DEBUG_LOGGING
-                // Debug: Print stack and slots before the call
-                printf("== Before OP_CALL ==\n");
-                printf("StackTop: %ld\n", vm.stackTop - vm.stack);
-                for (Value* v = vm.stack; v < vm.stackTop; v++) {
-                    printf("  [%ld] ", v - vm.stack);
-                    printValue(*v);
-                    printf("\n");
-                }
-                printf("All slots: ");
-                for (Value* slot = frame->slots; slot < vm.stackTop; slot++) {
-                    printValue(*slot);
-                    printf(" ");
-                }
+            DISPATCH();
+        }
+        CASE_CODE(OP_CALL): {
+            int argCount = READ_BYTE();
+            frame->ip = ip;
+
+            #ifdef DEBUG_LOGGING
+            // Debug: Print stack and slots before the call
+            printf("== Before OP_CALL ==\n");
+            printf("StackTop: %ld\n", vm->stackTop - vm->stack);
+            for (Value* v = vm->stack; v < vm->stackTop; v++) {
+                printf("  [%ld] ", v - vm->stack);
+                printValue(*v);
                 printf("\n");
-                #endif
-                if (!callValue(peek(argCount), argCount, ip)) {
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+            }
+            printf("All slots: ");
+            for (Value* slot = frame->slots; slot < vm->stackTop; slot++) {
+                printValue(*slot);
+                printf(" ");
+            }
+            printf("\n");
+            #endif
+            if (!callValue(peek(argCount), argCount, ip)) {
+                THROW();
+            }
 
-                #ifdef DEBUG_LOGGING
-                // Debug: Print stack and slots after the call
-                printf("== After OP_CALL ==\n");
-                printf("StackTop: %ld\n", vm.stackTop - vm.stack);
-                for (Value* v = vm.stack; v < vm.stackTop; v++) {
-                    printf("  [%ld] ", v - vm.stack);
-                    printValue(*v);
-                    printf("\n");
-                }
-                printf("All slots: ");
-                for (Value* slot = frame->slots; slot < vm.stackTop; slot++) {
-                    printValue(*slot);
-                    printf(" ");
-                }
+            #ifdef DEBUG_LOGGING
+            // Debug: Print stack and slots after the call
+            printf("== After OP_CALL ==\n");
+            printf("StackTop: %ld\n", vm->stackTop - vm->stack);
+            for (Value* v = vm->stack; v < vm->stackTop; v++) {
+                printf("  [%ld] ", v - vm->stack);
+                printValue(*v);
                 printf("\n");
-                #endif
-                frame = &vm.frames[vm.frameCount - 1];
-                ip = frame->ip;
-                break;
             }
-            case OP_CLOSURE: {
-                ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
-                ObjClosure* closure = newClosure(function);
-                push(OBJ_VAL(closure));
-                for (int i = 0; i < closure->upvalueCount; i++) {
-                    uint8_t isLocal = READ_BYTE();
-                    uint8_t index = READ_BYTE();
-                    if (isLocal) {
-                        closure->upvalues[i] = captureUpvalue(frame->slots + index);
-                    } else {
-                        closure->upvalues[i] = frame->closure->upvalues[index];
-                    }
+            printf("All slots: ");
+            for (Value* slot = frame->slots; slot < vm->stackTop; slot++) {
+                printValue(*slot);
+                printf(" ");
+            }
+            printf("\n");
+            #endif
+            frame = &vm->frames[vm->frameCount - 1];
+            ip = frame->ip;
+            DISPATCH();
+        }
+        CASE_CODE(OP_TAIL_CALL): {
+            int argCount = READ_BYTE();
+            frame->ip = ip;
+            ObjClosure* closure = tailCallee(argCount);
+            if (closure == NULL) {
+                // anything else is called as normal, and the OP_RETURN after it returns its result
+                if (!callValue(peek(argCount), argCount, ip)) {
+                    THROW();
                 }
-                break;
+                frame = &vm->frames[vm->frameCount - 1];
+                ip = frame->ip;
+                DISPATCH();
             }
-            case OP_CLOSE_UPVALUE: {
-                closeUpvalues(vm.stackTop - 1);
-                pop();
-                break;
+
+            // the callee and its args replace this frame's values
+            if (UNLIKELY(vm->profile)) {
+                profileReturn(vm->frameCount - 1);
             }
-            case OP_CLASS: {
-                push(OBJ_VAL(newClass(READ_STRING(), NULL)));
-                break;
+            PROBE_FUNCTION_RETURN(frame->closure->function, (int)(ip - frame->closure->function->chunk.code - 1));
+            closeUpvalues(frame->slots);
+            Value* args = vm->stackTop - argCount - 1;
+            memmove(frame->slots, args, sizeof(Value) * (argCount + 1));
+            vm->stackTop = frame->slots + argCount + 1;
+            frame->closure = closure;
+            ip = closure->function->chunk.code;
+            if (UNLIKELY(vm->profile)) {
+                frame->ip = ip;
+                profileCall(vm->frameCount - 1);
             }
-            case OP_GET_PROPERTY: {
-                if (!IS_INSTANCE(peek(0)) && !IS_ENUM(peek(0)) && !IS_FILE(peek(0)) && !IS_MODULE(peek(0))) {
-                    frame->ip = ip;
-                    runtimeError(ERROR_ATTRIBUTE, "Object doesn't have properties.");
-                    return INTERPRET_RUNTIME_ERROR;
+            PROBE_FUNCTION_ENTRY(closure->function);
+            DISPATCH();
+        }
+        CASE_CODE(OP_CLOSURE): {
+            ObjFunction* function = AS_FUNCTION(READ_CONSTANT_LONG());
+            ObjClosure* closure = newClosure(function);
+            PUSH(OBJ_VAL(closure));
+            for (int i = 0; i < closure->upvalueCount; i++) {
+                uint8_t flags = READ_BYTE();
+                uint8_t index = READ_BYTE();
+                if (flags & CAPTURE_FLAT) {
+                    // finals can't change, so their value is copied rather than shared
+                    if (closure->captured == NULL) {
+                        closure->captured = ALLOCATE(Value, closure->upvalueCount);
+                        for (int j = 0; j < closure->upvalueCount; j++) {
+                            closure->captured[j] = NIL_VAL;
+                        }
+                    }
+                    Value value = flags & CAPTURE_LOCAL ? frame->slots[index] : frame->closure->captured[index];
+                    closure->captured[i] = value;
+                    writeBarrier((Obj*)closure, value);
+                } else if (flags & CAPTURE_LOCAL) {
+                    closure->upvalues[i] = captureUpvalue(frame->slots + index);
+                    writeBarrier((Obj*)closure, OBJ_VAL(closure->upvalues[i]));
+                } else {
+                    closure->upvalues[i] = frame->closure->upvalues[index];
+                    writeBarrier((Obj*)closure, OBJ_VAL(closure->upvalues[i]));
                 }
-                if (IS_INSTANCE(peek(0))) {
-                    ObjInstance* instance = AS_INSTANCE(peek(0));
-                    ObjString* name = READ_STRING();
-                    Value value;
-                    if (tableGet(&instance->fields, OBJ_VAL(name), &value)) {
+            }
+            DISPATCH();
+        }
+        CASE_CODE(OP_CLOSE_UPVALUE): {
+            closeUpvalues(vm->stackTop - 1);
+            pop();
+            DISPATCH();
+        }
+        CASE_CODE(OP_CLASS): {
+            PUSH(OBJ_VAL(newClass(READ_STRING(), NULL)));
+            DISPATCH();
+        }
+        CASE_CODE(OP_GET_PROPERTY): {
+            ObjString* name = READ_STRING();
+            InlineCache* cache = READ_CACHE();
+            if (!IS_INSTANCE(peek(0)) && !IS_ENUM(peek(0)) && !IS_FILE(peek(0)) && !IS_MODULE(peek(0))
+                    && !IS_EXCEPTION(peek(0))) {
+                frame->ip = ip;
+                runtimeError(ERROR_ATTRIBUTE, "Object doesn't have properties.");
+                THROW();
+            }
+            if (IS_INSTANCE(peek(0))) {
+                ObjInstance* instance = AS_INSTANCE(peek(0));
+                InlineCacheEntry* entry = findInlineCache(cache, instance->shape);
+                if (entry != NULL) {
+                    if (entry->fieldIndex >= 0) {
+                        Value value = instance->fields[entry->fieldIndex];
                         pop();
-                        push(value);
-                        break;
+                        PUSH(value);
+                        DISPATCH();
                     }
+                    Value bound = bindInstanceMethod(peek(0), AS_CLOSURE(entry->method));
+                    pop();
+                    PUSH(bound);
+                    DISPATCH();
+                }
 
-                    if (!bindMethod(instance->sClass, name)) {
-                        frame->ip = ip;
-                        runtimeError(ERROR_ATTRIBUTE, "Undefined property '%s'.", name->chars);
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                } else if (IS_ENUM(peek(0))) {
-                    ObjEnum* sEnum = AS_ENUM(peek(0));
-                    ObjString* name = READ_STRING();
-                    Value value;
-                    if (tableGet(&sEnum->values, OBJ_VAL(name), &value)) {
-                        pop();
-                        push(value);
-                        break;
-                    }
+                int slot = shapeSlot(instance->shape, name);
+                if (slot != -1) {
+                    fillInlineCache(frame->closure->function, cache, instance->shape, NULL, slot, NIL_VAL);
+                    Value value = instance->fields[slot];
+                    pop();
+                    PUSH(value);
+                    DISPATCH();
+                }
 
+                Value method;
+                if (!tableGet(&instance->sClass->methods, OBJ_VAL(name), &method)) {
                     frame->ip = ip;
                     runtimeError(ERROR_ATTRIBUTE, "Undefined property '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                } else if (IS_FILE(peek(0))) {
-                    ObjString* name = READ_STRING();
-                    Value value;
-                    if (tableGet(&vm.fileClass->nativeProperties, OBJ_VAL(name), &value)) {
-                        if (IS_NATIVE_PROPERTY(value)) {
-                            NativeProperty native = AS_NATIVE_PROPERTY(value);
-                            Value result = native(pop());
-                            if (IS_ERROR(result)) {
-                                ObjError* error = AS_ERROR(result);
-                                runtimeError(ERROR_RUNTIME, error->message->chars);
-                                return INTERPRET_RUNTIME_ERROR;
-                            }
-                            push(result);
-                            break;
-                        } else {
+                    THROW();
+                }
+                fillInlineCache(frame->closure->function, cache, instance->shape, NULL, -1, method);
+                Value bound = bindInstanceMethod(peek(0), AS_CLOSURE(method));
+                pop();
+                PUSH(bound);
+            } else if (IS_ENUM(peek(0))) {
+                ObjEnum* sEnum = AS_ENUM(peek(0));
+                Value value;
+                if (tableGet(&sEnum->values, OBJ_VAL(name), &value)) {
+                    pop();
+                    PUSH(value);
+                    DISPATCH();
+                }
+
+                frame->ip = ip;
+                runtimeError(ERROR_ATTRIBUTE, "Undefined property '%s'.", name->chars);
+                THROW();
+            } else if (IS_FILE(peek(0))) {
+                Value value;
+                if (tableGet(&vm->fileClass->nativeProperties, OBJ_VAL(name), &value)) {
+                    if (IS_NATIVE_PROPERTY(value)) {
+                        NativeProperty native = AS_NATIVE_PROPERTY(value);
+                        Value result = native(pop());
+                        if (IS_ERROR(result)) {
                             frame->ip = ip;
-                            runtimeError(ERROR_ATTRIBUTE, "Undefined property '%s'.", name->chars);
-                            return INTERPRET_RUNTIME_ERROR;
+                            runtimeError(ERROR_RUNTIME, "%s", errorMessage(result));
+                            vm->nativeError = NULL;
+                            THROW();
                         }
+                        PUSH(result);
+                        DISPATCH();
+                    } else {
+                        frame->ip = ip;
+                        runtimeError(ERROR_ATTRIBUTE, "Undefined property '%s'.", name->chars);
+                        THROW();
                     }
+                }
 
-                    frame->ip = ip;
-                    runtimeError(ERROR_ATTRIBUTE, "Undefined property '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                } else if (IS_MODULE(peek(0))) {
-                    ObjModule* module = AS_MODULE(peek(0));
-                    ObjString* name = READ_STRING();
-                    Value value;
-                    if (tableGet(&module->methods, OBJ_VAL(name), &value)) {
-                        pop();
-                        push(value);
-                        break;
-                    }
+                frame->ip = ip;
+                runtimeError(ERROR_ATTRIBUTE, "Undefined property '%s'.", name->chars);
+                THROW();
+            } else if (IS_EXCEPTION(peek(0))) {
+                Value value;
+                if (tableGet(&vm->exceptionClass->nativeProperties, OBJ_VAL(name), &value)) {
+                    NativeProperty native = AS_NATIVE_PROPERTY(value);
+                    Value result = native(peek(0));
+                    pop();
+                    PUSH(result);
+                    DISPATCH();
+                }
 
-                    frame->ip = ip;
-                    runtimeError(ERROR_ATTRIBUTE, "Undefined property '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
+                frame->ip = ip;
+                runtimeError(ERROR_ATTRIBUTE, "Undefined property '%s'.", name->chars);
+                THROW();
+            } else if (IS_MODULE(peek(0))) {
+                ObjModule* module = AS_MODULE(peek(0));
+                Value value;
+                if (moduleGet(module, name, &value)) {
+                    pop();
+                    PUSH(value);
+                    DISPATCH();
+                }
+
+                frame->ip = ip;
+                runtimeError(ERROR_ATTRIBUTE, "Undefined property '%s'.", name->chars);
+                THROW();
+            } else {
+                frame->ip = ip;
+                runtimeError(ERROR_TYPE, "Object doesn't have properties.");
+                THROW();
+            }
+            DISPATCH();
+        }
+        CASE_CODE(OP_SET_PROPERTY): {
+            if (!IS_INSTANCE(peek(1))) {
+                frame->ip = ip;
+                runtimeError(ERROR_ATTRIBUTE, "Only instances have fields.");
+                THROW();
+            }
+            ObjInstance* instance = AS_INSTANCE(peek(1));
+            ObjString* name = READ_STRING();
+            InlineCache* cache = READ_CACHE();
+            InlineCacheEntry* entry = findInlineCache(cache, instance->shape);
+            if (entry != NULL && entry->transition != NULL) {
+                instanceAddField(instance, entry->transition, peek(0));
+            } else if (entry != NULL) {
+                instance->fields[entry->fieldIndex] = peek(0);
+                writeBarrier((Obj*)instance, peek(0));
+            } else {
+                Shape* shape = instance->shape;
+                if (instanceSetField(instance, name, peek(0))) {
+                    fillInlineCache(frame->closure->function, cache, shape, instance->shape, instance->shape->fieldCount - 1, NIL_VAL);
                 } else {
-                    frame->ip = ip;
-                    runtimeError(ERROR_TYPE, "Object doesn't have properties.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    fillInlineCache(frame->closure->function, cache, shape, NULL, shapeSlot(shape, name), NIL_VAL);
                 }
-                break;
             }
-            case OP_SET_PROPERTY: {
-                if (!IS_INSTANCE(peek(1))) {
+            Value value = pop();
+            pop();
+            PUSH(value);
+            DISPATCH();
+        }
+        CASE_CODE(OP_INHERIT): {
+            Value super = peek(1);
+            if (!IS_CLASS(super)) {
+                frame->ip = ip;
+                runtimeError(ERROR_TYPE, "Superclass must be a class.");
+                THROW();
+            }
+            ObjClass* subClass = AS_CLASS(peek(0));
+            tableAddAll(&AS_CLASS(super)->methods, &subClass->methods);
+            rememberObject((Obj*)subClass);
+            pop(); // pops the subclass
+            DISPATCH();
+        }
+        CASE_CODE(OP_GET_SUPER): {
+            ObjString* name = READ_STRING();
+            ObjClass* superclass = AS_CLASS(pop());
+
+            if (!bindMethod(superclass, name)) {
+                frame->ip = ip;
+                THROW();
+            }
+
+            DISPATCH();
+        }
+        CASE_CODE(OP_METHOD): {
+            defineMethod(READ_STRING());
+            DISPATCH();
+        }
+        CASE_CODE(OP_INVOKE): {
+            ObjString* method = READ_STRING();
+            int argCount = READ_BYTE();
+            InlineCache* cache = READ_CACHE();
+            frame->ip = ip;
+            Value receiver = peek(argCount);
+            ObjClass* builtIn;
+            bool invoked;
+            if (IS_INSTANCE(receiver)) {
+                invoked = invokeInstance(AS_INSTANCE(receiver), method, argCount, ip, frame->closure->function, cache);
+            } else if ((builtIn = builtInClass(receiver)) != NULL) {
+                invoked = invokeBuiltIn(builtIn, method, argCount, ip, frame->closure->function, cache);
+            } else {
+                invoked = invoke(method, argCount, ip);
+            }
+            if (!invoked) {
+                THROW();
+            }
+            frame = &vm->frames[vm->frameCount - 1];
+            ip = frame->ip;
+            DISPATCH();
+        }
+        CASE_CODE(OP_SUPER_INVOKE): {
+            ObjString* method = READ_STRING();
+            int argCount = READ_BYTE();
+            ObjClass* superclass = AS_CLASS(pop());
+            frame->ip = ip;
+            if (!invokeFromClass(superclass, method, argCount)) {
+                THROW();
+            }
+            frame = &vm->frames[vm->frameCount - 1];
+            ip = frame->ip;
+            DISPATCH();
+        }
+        CASE_CODE(OP_LIST): {
+            int count = READ_SHORT();
+            // the values stay on the stack while the list is allocated, then go in with one copy
+            ObjList* list = newListWithCapacity(count);
+            copyValues(list->values.values, vm->stackTop - count, count);
+            list->count = count;
+            list->values.count = count;
+            rememberObject((Obj*)list);
+            vm->stackTop -= count;
+            PUSH(OBJ_VAL(list));
+            DISPATCH();
+        }
+        CASE_CODE(OP_LIST_LOCAL): {
+            int count = READ_SHORT();
+            ObjList* list = newLocalList(count);
+            copyValues(list->values.values, vm->stackTop - count, count);
+            list->count = count;
+            list->values.count = count;
+            vm->stackTop -= count;
+            PUSH(OBJ_VAL(list));
+            DISPATCH();
+        }
+        CASE_CODE(OP_GET_INDEX): {
+            Value index = pop();
+            Value indexable = pop();
+            #ifdef DEBUG_LOGGING
+            printf("DEBUG: OP_GET_INDEX types: index=%d, value=%d\n", VALUE_TYPE(index), VALUE_TYPE(indexable));
+            #endif
+            if (IS_LIST(indexable)) {
+                ObjList* list = AS_LIST(indexable);
+                if (!IS_NUMBER(index)) {
                     frame->ip = ip;
-                    runtimeError(ERROR_ATTRIBUTE, "Only instances have fields.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    runtimeError(ERROR_TYPE, "Index must be a number.");
+                    THROW();
                 }
-                ObjInstance* instance = AS_INSTANCE(peek(1));
-                tableSet(&instance->fields, OBJ_VAL(READ_STRING()), peek(0));
-                Value value = pop();
-                pop();
-                push(value);
-                break;
-            }
-            case OP_INHERIT: {
-                Value super = peek(1);
-                if (!IS_CLASS(super)) {
+                int idx = numberToInt(index);
+                if (idx < 0) {
+                    idx += list->count; // allow negative indexing
+                }
+                if (idx < 0 || idx >= list->count) {
+                    frame->ip = ip;
+                    runtimeError(ERROR_INDEX, "Index out of bounds.");
+                    THROW();
+                }
+                PUSH(list->values.values[idx]);
+                QUICKEN(OP_GET_INDEX_LIST);
+            } else if (IS_ARRAY(indexable)) {
+                ObjArray* array = AS_ARRAY(indexable);
+                if (!IS_NUMBER(index)) {
                     frame->ip = ip;
-                    runtimeError(ERROR_TYPE, "Superclass must be a class.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    runtimeError(ERROR_TYPE, "Index must be a number.");
+                    THROW();
                 }
-                ObjClass* subClass = AS_CLASS(peek(0));
-                tableAddAll(&AS_CLASS(super)->methods, &subClass->methods);
-                pop(); // pops the subclass
-                break;
-            }
-            case OP_GET_SUPER: {
-                ObjString* name = READ_STRING();
-                ObjClass* superclass = AS_CLASS(pop());
-
-                if (!bindMethod(superclass, name)) {
+                int idx = numberToInt(index);
+                if (idx < 0) {
+                    idx += array->count;
+                }
+                if (idx < 0 || idx >= array->count) {
                     frame->ip = ip;
-                    return INTERPRET_RUNTIME_ERROR;
+                    runtimeError(ERROR_INDEX, "Index out of bounds.");
+                    THROW();
                 }
-
-                break;
-            }
-            case OP_METHOD: {
-                defineMethod(READ_STRING());
-                break;
-            }
-            case OP_INVOKE: {
-                ObjString* method = READ_STRING();
-                int argCount = READ_BYTE();
-                frame->ip = ip;
-                if (!invoke(method, argCount, ip)) {
+                PUSH(NUMBER_VAL(arrayGet(array, idx)));
+            } else if (IS_BYTES(indexable)) {
+                ObjBytes* bytes = AS_BYTES(indexable);
+                if (!IS_NUMBER(index)) {
                     frame->ip = ip;
-                    return INTERPRET_RUNTIME_ERROR;
+                    runtimeError(ERROR_TYPE, "Index must be a number.");
+                    THROW();
                 }
-                frame = &vm.frames[vm.frameCount - 1];
-                ip = frame->ip;
-                break;
-            }
-            case OP_SUPER_INVOKE: {
-                ObjString* method = READ_STRING();
-                int argCount = READ_BYTE();
-                ObjClass* superclass = AS_CLASS(pop());
-                frame->ip = ip;
-                if (!invokeFromClass(superclass, method, argCount)) {
+                int idx = numberToInt(index);
+                if (idx < 0) {
+                    idx += bytes->count;
+                }
+                if (idx < 0 || idx >= bytes->count) {
                     frame->ip = ip;
-                    return INTERPRET_RUNTIME_ERROR;
+                    runtimeError(ERROR_INDEX, "Index out of bounds.");
+                    THROW();
                 }
-                frame = &vm.frames[vm.frameCount - 1];
-                ip = frame->ip;
-                break;
-            }
-            case OP_LIST: {
-                int count = READ_SHORT();
-                ObjList* list = newList();
-                // Pop values into a temporary array
-                Value* temp = ALLOCATE(Value, count);
-                for (int i = count - 1; i >= 0; i--) {
-                    temp[i] = pop();
+                PUSH(INT_VAL(bytes->data[idx]));
+            } else if (IS_DICT(indexable)) {
+                ObjDict* dict = AS_DICT(indexable);
+                Value value;
+                if (tableGet(&dict->data, index, &value)) {
+                    PUSH(value);
+                } else {
+                    frame->ip = ip;
+                    runtimeError(ERROR_INDEX, "Key not found in dictionary.");
+                    THROW();
+                }
+                QUICKEN(OP_GET_INDEX_DICT);
+            } else if (IS_DICT_VIEW(indexable)) {
+                // only the entry asked for is found, nothing's copied out
+                ObjDictView* view = AS_DICT_VIEW(indexable);
+                if (!IS_NUMBER(index)) {
+                    frame->ip = ip;
+                    runtimeError(ERROR_TYPE, "Index must be a number.");
+                    THROW();
                 }
-                while (list->values.capacity < count) {
-                    growValueArray(&list->values);
+                int idx = numberToInt(index);
+                if (idx < 0) {
+                    idx += view->dict->data.count;
                 }
-                for (int i = 0; i < count; i++) {
-                    list->values.values[i] = temp[i];
-                    list->count++;
+                Entry* entry = dictViewEntry(view, idx);
+                if (entry == NULL) {
+                    frame->ip = ip;
+                    runtimeError(ERROR_INDEX, "Index out of bounds.");
+                    THROW();
                 }
-                list->values.count = list->count;
-                FREE_ARRAY(Value, temp, count);
-                push(OBJ_VAL(list));
-                break;
+                // a pair is made in place of the view, which keeps the dict alive until then
+                PUSH(OBJ_VAL(view));
+                Value value = dictViewValue(view, entry);
+                vm->stackTop[-1] = value;
+            } else {
+                frame->ip = ip;
+                runtimeError(ERROR_TYPE, "Expected a list.");
+                THROW();
             }
-            case OP_GET_INDEX: {
-                Value index = pop();
-                Value indexable = pop();
-                #ifdef DEBUG_LOGGING
-                printf("DEBUG: OP_GET_INDEX types: index=%d, value=%d\n", index.type, indexable.type);
-                #endif
-                if (IS_LIST(indexable)) {
-                    ObjList* list = AS_LIST(indexable);
-                    if (!IS_NUMBER(index)) {
-                        frame->ip = ip;
-                        runtimeError(ERROR_TYPE, "Index must be a number.");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                    int idx = (int)AS_NUMBER(index);
-                    if (idx < 0) {
-                        idx += list->count; // allow negative indexing
-                    }
-                    if (idx < 0 || idx >= list->count) {
-                        frame->ip = ip;
-                        runtimeError(ERROR_INDEX, "Index out of bounds.");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                    push(list->values.values[idx]);
-                } else if (IS_DICT(indexable)) {
-                    ObjDict* dict = AS_DICT(indexable);
-                    Value value;
-                    if (tableGet(&dict->data, index, &value)) {
-                        push(value);
-                    } else {
-                        frame->ip = ip;
-                        runtimeError(ERROR_INDEX, "Key not found in dictionary.");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                } else {
+            DISPATCH();
+        }
+        CASE_CODE(OP_GET_INDEX_LIST): {
+            Value index = peek(0);
+            Value indexable = peek(1);
+            if (!IS_LIST(indexable) || !IS_NUMBER(index)) {
+                DEOPTIMISE(OP_GET_INDEX);
+            }
+            ObjList* list = AS_LIST(indexable);
+            int idx = numberToInt(index);
+            if (idx < 0) {
+                idx += list->count;
+            }
+            if (idx < 0 || idx >= list->count) {
+                frame->ip = ip;
+                runtimeError(ERROR_INDEX, "Index out of bounds.");
+                THROW();
+            }
+            vm->stackTop -= 2;
+            PUSH(list->values.values[idx]);
+            DISPATCH();
+        }
+        CASE_CODE(OP_GET_INDEX_DICT): {
+            Value index = peek(0);
+            Value indexable = peek(1);
+            if (!IS_DICT(indexable)) {
+                DEOPTIMISE(OP_GET_INDEX);
+            }
+            Value value;
+            if (!tableGet(&AS_DICT(indexable)->data, index, &value)) {
+                frame->ip = ip;
+                runtimeError(ERROR_INDEX, "Key not found in dictionary.");
+                THROW();
+            }
+            vm->stackTop -= 2;
+            PUSH(value);
+            DISPATCH();
+        }
+        CASE_CODE(OP_SET_INDEX): {
+            Value value = peek(0);
+            Value index = peek(1);
+            Value indexable = peek(2);
+            #ifdef DEBUG_LOGGING
+            printf("DEBUG: OP_SET_INDEX types: list=%d, index=%d, value=%d\n", VALUE_TYPE(indexable), VALUE_TYPE(index), VALUE_TYPE(value));
+            #endif
+            if (IS_LIST(indexable)) {
+                ObjList* list = AS_LIST(indexable);
+                if (!IS_NUMBER(index)) {
                     frame->ip = ip;
-                    runtimeError(ERROR_TYPE, "Expected a list.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    runtimeError(ERROR_TYPE, "Index must be a number.");
+                    THROW();
                 }
-                break;
-            }
-            case OP_SET_INDEX: {
-                Value value = pop();
-                Value index = pop();
-                Value indexable = pop();
-                #ifdef DEBUG_LOGGING
-                printf("DEBUG: OP_SET_INDEX types: list=%d, index=%d, value=%d\n", indexable.type, index.type, value.type);
-                #endif
-                if (IS_LIST(indexable)) {
-                    ObjList* list = AS_LIST(indexable);
-                    if (!IS_NUMBER(index)) {
-                        frame->ip = ip;
-                        runtimeError(ERROR_TYPE, "Index must be a number.");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                    int idx = (int)AS_NUMBER(index);
-                    if (idx < 0) {
-                        idx += list->count; // allow negative indexing
-                    }
-                    if (idx < 0 || idx >= list->count) {
-                        frame->ip = ip;
-                        runtimeError(ERROR_INDEX, "Index out of bounds.");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                    list->values.values[idx] = value;
-                    push(value);
-                } else if (IS_DICT(indexable)) {
-                    ObjDict* dict = AS_DICT(indexable);
-                    tableSet(&dict->data, index, value);
-                    push(value);
-                } else {
+                int idx = numberToInt(index);
+                if (idx < 0) {
+                    idx += list->count; // allow negative indexing
+                }
+                if (idx < 0 || idx >= list->count) {
                     frame->ip = ip;
-                    runtimeError(ERROR_TYPE, "Expected a list or dictionary.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    runtimeError(ERROR_INDEX, "Index out of bounds.");
+                    THROW();
+                }
+                unshareList(list);
+                list->values.values[idx] = value;
+                writeBarrier((Obj*)list, value);
+                QUICKEN(OP_SET_INDEX_LIST);
+            } else if (IS_ARRAY(indexable)) {
+                ObjArray* array = AS_ARRAY(indexable);
+                if (!IS_NUMBER(index)) {
+                    frame->ip = ip;
+                    runtimeError(ERROR_TYPE, "Index must be a number.");
+                    THROW();
                 }
-                break;
-            }
-            case OP_SLICE: {
-                Value end = pop();
-                Value start = pop();
-                Value listValue = pop();
-                if (!IS_LIST(listValue)) {
+                if (!IS_NUMBER(value)) {
                     frame->ip = ip;
-                    runtimeError(ERROR_TYPE, "Expected a list.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    runtimeError(ERROR_TYPE, "Arrays can only hold numbers.");
+                    THROW();
                 }
-                ObjList* list = AS_LIST(listValue);
-
-                int iStart = IS_NIL(start) ? 0 : (int)AS_NUMBER(start);
-                int iEnd = IS_NIL(end) ? list->count : (int)AS_NUMBER(end);
-
-                // Handle negative indices
-                if (iStart < 0) {
-                    iStart += list->count;
+                int idx = numberToInt(index);
+                if (idx < 0) {
+                    idx += array->count;
                 }
-                if (iEnd < 0) {
-                    iEnd += list->count;
+                if (idx < 0 || idx >= array->count) {
+                    frame->ip = ip;
+                    runtimeError(ERROR_INDEX, "Index out of bounds.");
+                    THROW();
                 }
-                if (iStart < 0) {
-                    iStart = 0;
+                arraySet(array, idx, AS_NUMBER(value));
+            } else if (IS_BYTES(indexable)) {
+                ObjBytes* bytes = AS_BYTES(indexable);
+                if (!IS_NUMBER(index)) {
+                    frame->ip = ip;
+                    runtimeError(ERROR_TYPE, "Index must be a number.");
+                    THROW();
                 }
-                if (iEnd > list->count) {
-                    iEnd = list->count;
+                if (!IS_NUMBER(value) || AS_NUMBER(value) < 0 || AS_NUMBER(value) > 255
+                        || AS_NUMBER(value) != (int)AS_NUMBER(value)) {
+                    frame->ip = ip;
+                    runtimeError(ERROR_TYPE, "Bytes can only hold whole numbers from 0 to 255.");
+                    THROW();
                 }
-                if (iEnd < iStart) {
-                    iEnd = iStart;
+                int idx = numberToInt(index);
+                if (idx < 0) {
+                    idx += bytes->count;
                 }
+                if (idx < 0 || idx >= bytes->count) {
+                    frame->ip = ip;
+                    runtimeError(ERROR_INDEX, "Index out of bounds.");
+                    THROW();
+                }
+                bytes->data[idx] = (uint8_t)AS_NUMBER(value);
+            } else if (IS_DICT(indexable)) {
+                ObjDict* dict = AS_DICT(indexable);
+                tableSet(&dict->data, index, value);
+                writeBarrier((Obj*)dict, index);
+                writeBarrier((Obj*)dict, value);
+                QUICKEN(OP_SET_INDEX_DICT);
+            } else {
+                frame->ip = ip;
+                runtimeError(ERROR_TYPE, "Expected a list or dictionary.");
+                THROW();
+            }
+            vm->stackTop -= 3;
+            PUSH(value);
+            DISPATCH();
+        }
+        CASE_CODE(OP_SET_INDEX_LIST): {
+            Value value = peek(0);
+            Value index = peek(1);
+            Value indexable = peek(2);
+            if (!IS_LIST(indexable) || !IS_NUMBER(index)) {
+                DEOPTIMISE(OP_SET_INDEX);
+            }
+            ObjList* list = AS_LIST(indexable);
+            int idx = numberToInt(index);
+            if (idx < 0) {
+                idx += list->count;
+            }
+            if (idx < 0 || idx >= list->count) {
+                frame->ip = ip;
+                runtimeError(ERROR_INDEX, "Index out of bounds.");
+                THROW();
+            }
+            unshareList(list);
+            list->values.values[idx] = value;
+            writeBarrier((Obj*)list, value);
+            vm->stackTop -= 3;
+            PUSH(value);
+            DISPATCH();
+        }
+        CASE_CODE(OP_SET_INDEX_DICT): {
+            Value value = peek(0);
+            Value index = peek(1);
+            Value indexable = peek(2);
+            if (!IS_DICT(indexable)) {
+                DEOPTIMISE(OP_SET_INDEX);
+            }
+            ObjDict* dict = AS_DICT(indexable);
+            tableSet(&dict->data, index, value);
+            writeBarrier((Obj*)dict, index);
+            writeBarrier((Obj*)dict, value);
+            vm->stackTop -= 3;
+            PUSH(value);
+            DISPATCH();
+        }
+        CASE_CODE(OP_SLICE): {
+            Value end = pop();
+            Value start = pop();
+            Value listValue = pop();
+            int count;
+            if (IS_LIST(listValue)) {
+                count = AS_LIST(listValue)->count;
+            } else if (IS_ARRAY(listValue)) {
+                count = AS_ARRAY(listValue)->count;
+            } else if (IS_BYTES(listValue)) {
+                count = AS_BYTES(listValue)->count;
+            } else {
+                frame->ip = ip;
+                runtimeError(ERROR_TYPE, "Expected a list.");
+                THROW();
+            }
 
-                ObjList* result = newList();
-                for (int i = iStart; i < iEnd; i++) {
-                    // Copy each value
-                    if (result->count + 1 > result->values.capacity) {
-                        growValueArray(&result->values);
-                    }
-                    result->values.values[result->count++] = list->values.values[i];
-                    result->values.count = result->count;
+            int iStart = IS_NIL(start) ? 0 : numberToInt(start);
+            int iEnd = IS_NIL(end) ? count : numberToInt(end);
+
+            // Handle negative indices
+            if (iStart < 0) {
+                iStart += count;
+            }
+            if (iEnd < 0) {
+                iEnd += count;
+            }
+            if (iStart < 0) {
+                iStart = 0;
+            }
+            if (iEnd > count) {
+                iEnd = count;
+            }
+            if (iEnd < iStart) {
+                iEnd = iStart;
+            }
+
+            PUSH(listValue);
+            if (IS_ARRAY(listValue)) {
+                ObjArray* array = AS_ARRAY(listValue);
+                ObjArray* result = newArray(array->type, iEnd - iStart);
+                if (result->count == 0) {
+                    // nothing to copy
+                } else if (array->type == ARRAY_F64) {
+                    memcpy(result->as.f64, array->as.f64 + iStart, sizeof(double) * result->count);
+                } else {
+                    memcpy(result->as.i64, array->as.i64 + iStart, sizeof(int64_t) * result->count);
                 }
-                push(OBJ_VAL(result));
-                break;
+                vm->stackTop--;
+                PUSH(OBJ_VAL(result));
+                DISPATCH();
             }
-            case OP_HAS: {
-                Value value = pop();
-                Value container = pop();
-                if (IS_LIST(container)) {
-                    ObjList* list = AS_LIST(container);
-                    bool found = false;
-                    for (int i = 0; i < list->count; i++) {
-                        if (valuesEqual(list->values.values[i], value)) {
-                            found = true;
-                            break;
-                        }
-                    }
-                    push(BOOL_VAL(found));
-                } else if (IS_STRING(container)) {
-                    ObjString* str = AS_STRING(container);
-                    if (IS_STRING(value)) {
-                        ObjString* valStr = AS_STRING(value);
-                        push(BOOL_VAL(strstr(str->chars, valStr->chars) != NULL));
-                    } else {
-                        frame->ip = ip;
-                        runtimeError(ERROR_TYPE, "Can only check for strings in strings.");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                } else if (IS_DICT(container)) {
-                    ObjDict* dict = AS_DICT(container);
-                    Value val;
-                    if (tableGet(&dict->data, value, &val)) {
-                        push(BOOL_VAL(true));
-                    } else {
-                        push(BOOL_VAL(false));
+            if (IS_BYTES(listValue)) {
+                ObjBytes* result = newBytes(iEnd - iStart);
+                if (result->count > 0) {
+                    memcpy(result->data, AS_BYTES(listValue)->data + iStart, result->count);
+                }
+                vm->stackTop--;
+                PUSH(OBJ_VAL(result));
+                DISPATCH();
+            }
+
+            // long slices share the list's values until one of them is written to
+            ObjList* result;
+            if (iEnd - iStart >= LIST_SHARE_MIN) {
+                result = shareList(AS_LIST(listValue), iStart, iEnd - iStart);
+                PUSH(OBJ_VAL(result));
+            } else {
+                result = newListWithCapacity(iEnd - iStart);
+                PUSH(OBJ_VAL(result));
+                copyValues(result->values.values, AS_LIST(listValue)->values.values + iStart, iEnd - iStart);
+                result->count = iEnd - iStart;
+                result->values.count = result->count;
+                rememberObject((Obj*)result);
+            }
+            vm->stackTop -= 2;
+            PUSH(OBJ_VAL(result));
+            DISPATCH();
+        }
+        CASE_CODE(OP_HAS): {
+            Value value = pop();
+            Value container = pop();
+            if (IS_LIST(container)) {
+                ObjList* list = AS_LIST(container);
+                bool found = false;
+                for (int i = 0; i < list->count; i++) {
+                    if (valuesEqual(list->values.values[i], value)) {
+                        found = true;
+                        break;
                     }
+                }
+                PUSH(BOOL_VAL(found));
+            } else if (IS_STRING(container)) {
+                ObjString* str = AS_STRING(container);
+                if (IS_STRING(value)) {
+                    ObjString* valStr = AS_STRING(value);
+                    PUSH(BOOL_VAL(stringContains(str, valStr)));
                 } else {
                     frame->ip = ip;
-                    runtimeError(ERROR_TYPE, "'has' not supported for this type.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
+                    runtimeError(ERROR_TYPE, "Can only check for strings in strings.");
+                    THROW();
+                }
+            } else if (IS_DICT(container)) {
+                ObjDict* dict = AS_DICT(container);
+                Value val;
+                if (tableGet(&dict->data, value, &val)) {
+                    PUSH(BOOL_VAL(true));
+                } else {
+                    PUSH(BOOL_VAL(false));
+                }
+                QUICKEN(OP_HAS_DICT);
+            } else if (IS_SET(container)) {
+                Value val;
+                PUSH(BOOL_VAL(tableGet(&AS_SET(container)->data, value, &val)));
+                QUICKEN(OP_HAS_SET);
+            } else if (IS_DICT_VIEW(container)) {
+                PUSH(BOOL_VAL(dictViewHas(AS_DICT_VIEW(container), value)));
+            } else {
+                frame->ip = ip;
+                runtimeError(ERROR_TYPE, "'has' not supported for this type.");
+                THROW();
             }
-            case OP_HAS_NOT: {
-                Value value = pop();
-                Value container = pop();
-                if (IS_LIST(container)) {
-                    ObjList* list = AS_LIST(container);
-                    bool found = false;
-                    for (int i = 0; i < list->count; i++) {
-                        if (valuesEqual(list->values.values[i], value)) {
-                            found = true;
-                            break;
-                        }
-                    }
-                    push(BOOL_VAL(!found));
-                } else if (IS_STRING(container)) {
-                    ObjString* str = AS_STRING(container);
-                    if (IS_STRING(value)) {
-                        ObjString* valStr = AS_STRING(value);
-                        push(BOOL_VAL(!(strstr(str->chars, valStr->chars) != NULL)));
-                    } else {
-                        frame->ip = ip;
-                        runtimeError(ERROR_TYPE, "Can only check for strings in strings.");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                } else if (IS_DICT(container)) {
-                    ObjDict* dict = AS_DICT(container);
-                    Value val;
-                    if (tableGet(&dict->data, value, &val)) {
-                        push(BOOL_VAL(false));
-                    } else {
-                        push(BOOL_VAL(true));
+            DISPATCH();
+        }
+        CASE_CODE(OP_HAS_DICT): {
+            if (!IS_DICT(peek(1))) {
+                DEOPTIMISE(OP_HAS);
+            }
+            Value val;
+            bool found = tableGet(&AS_DICT(peek(1))->data, peek(0), &val);
+            vm->stackTop -= 2;
+            PUSH(BOOL_VAL(found));
+            DISPATCH();
+        }
+        CASE_CODE(OP_HAS_SET): {
+            if (!IS_SET(peek(1))) {
+                DEOPTIMISE(OP_HAS);
+            }
+            Value val;
+            bool found = tableGet(&AS_SET(peek(1))->data, peek(0), &val);
+            vm->stackTop -= 2;
+            PUSH(BOOL_VAL(found));
+            DISPATCH();
+        }
+        CASE_CODE(OP_HAS_NOT): {
+            Value value = pop();
+            Value container = pop();
+            if (IS_LIST(container)) {
+                ObjList* list = AS_LIST(container);
+                bool found = false;
+                for (int i = 0; i < list->count; i++) {
+                    if (valuesEqual(list->values.values[i], value)) {
+                        found = true;
+                        break;
                     }
+                }
+                PUSH(BOOL_VAL(!found));
+            } else if (IS_STRING(container)) {
+                ObjString* str = AS_STRING(container);
+                if (IS_STRING(value)) {
+                    ObjString* valStr = AS_STRING(value);
+                    PUSH(BOOL_VAL(!stringContains(str, valStr)));
                 } else {
                     frame->ip = ip;
-                    runtimeError(ERROR_TYPE, "'has' not supported for this type.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    runtimeError(ERROR_TYPE, "Can only check for strings in strings.");
+                    THROW();
+                }
+            } else if (IS_DICT(container)) {
+                ObjDict* dict = AS_DICT(container);
+                Value val;
+                if (tableGet(&dict->data, value, &val)) {
+                    PUSH(BOOL_VAL(false));
+                } else {
+                    PUSH(BOOL_VAL(true));
                 }
-                break;
+            } else if (IS_SET(container)) {
+                Value val;
+                PUSH(BOOL_VAL(!tableGet(&AS_SET(container)->data, value, &val)));
+            } else if (IS_DICT_VIEW(container)) {
+                PUSH(BOOL_VAL(!dictViewHas(AS_DICT_VIEW(container), value)));
+            } else {
+                frame->ip = ip;
+                runtimeError(ERROR_TYPE, "'has' not supported for this type.");
+                THROW();
             }
-            case OP_LEN: {
-                #ifdef DEBUG_LOGGING
-                printf("DEBUG: Value before OP_LEN: ");
-                printValue(peek(0));
-                printf("\n");
-                #endif
-                Value container = pop();
-                if (IS_LIST(container)) {
-                    ObjList* list = AS_LIST(container);
-                    push(NUMBER_VAL((double)list->count));
-                } else if (IS_STRING(container)) {
-                    ObjString* str = AS_STRING(container);
-                    push(NUMBER_VAL((double)str->length));
-                } else if (IS_DICT(container)) {
-                    ObjDict* dict = AS_DICT(container);
-                    push(NUMBER_VAL((double)dict->data.count));
+            DISPATCH();
+        }
+        CASE_CODE(OP_LEN): {
+            #ifdef DEBUG_LOGGING
+            printf("DEBUG: Value before OP_LEN: ");
+            printValue(peek(0));
+            printf("\n");
+            #endif
+            Value container = pop();
+            if (IS_LIST(container)) {
+                ObjList* list = AS_LIST(container);
+                PUSH(INT_VAL(list->count));
+            } else if (IS_STRING(container)) {
+                ObjString* str = AS_STRING(container);
+                PUSH(INT_VAL(str->length));
+            } else if (IS_DICT(container)) {
+                ObjDict* dict = AS_DICT(container);
+                PUSH(INT_VAL(dict->data.count));
+            } else if (IS_SET(container)) {
+                PUSH(INT_VAL(AS_SET(container)->data.count));
+            } else if (IS_BYTES(container)) {
+                PUSH(INT_VAL(AS_BYTES(container)->count));
+            } else if (IS_RANGE(container)) {
+                PUSH(INT_VAL(rangeLength(AS_RANGE(container))));
+            } else if (IS_DICT_VIEW(container)) {
+                PUSH(INT_VAL(AS_DICT_VIEW(container)->dict->data.count));
+            } else {
+                frame->ip = ip;
+                runtimeError(ERROR_TYPE, "Length only supported for lists and strings.");
+                THROW();
+            }
+            DISPATCH();
+        }
+        CASE_CODE(OP_ITER_NEXT): {
+            // the cursor and loop variable live in the two slots after the iterable
+            uint8_t slot = READ_BYTE();
+            uint16_t offset = READ_SHORT();
+            Value iterable = frame->slots[slot];
+            int cursor = numberToInt(frame->slots[slot + 1]);
+            if (IS_LIST(iterable)) {
+                ObjList* list = AS_LIST(iterable);
+                if (cursor < list->count) {
+                    frame->slots[slot + 2] = list->values.values[cursor];
+                    frame->slots[slot + 1] = INT_VAL(cursor + 1);
                 } else {
-                    frame->ip = ip;
-                    runtimeError(ERROR_TYPE, "Length only supported for lists and strings.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    ip += offset;
                 }
-                break;
-            }
-            case OP_DICT: {
-                int count = READ_SHORT();
-                ObjDict* dict = newDict();
-                Value* keys = ALLOCATE(Value, count);
-                Value* values = ALLOCATE(Value, count);
-                for (int i = count - 1; i >= 0; i--) {
-                    values[i] = pop();
-                    keys[i] = pop();
+            } else if (IS_RANGE(iterable)) {
+                // ranges work out each value from the cursor rather than storing them
+                ObjRange* range = AS_RANGE(iterable);
+                double value = range->start + cursor * range->step;
+                if (range->step > 0 ? value < range->stop : value > range->stop) {
+                    frame->slots[slot + 2] = integralNumber(value);
+                    frame->slots[slot + 1] = INT_VAL(cursor + 1);
+                } else {
+                    ip += offset;
                 }
-                for (int i = 0; i < count; i++) {
-                    tableSet(&dict->data, keys[i], values[i]);
+            } else if (IS_STRING(iterable)) {
+                ObjString* string = AS_STRING(iterable);
+                if (cursor < string->length) {
+                    frame->slots[slot + 2] = OBJ_VAL(copyString(string->chars + cursor, 1));
+                    frame->slots[slot + 1] = INT_VAL(cursor + 1);
+                } else {
+                    ip += offset;
                 }
-                FREE_ARRAY(Value, keys, count);
-                FREE_ARRAY(Value, values, count);
-                push(OBJ_VAL(dict));
-                break;
-            }
-            case OP_ENUM: {
-                #ifdef DEBUG_LOGGING
-                printf("DEBUG: OP_ENUM - reading enum with name: ");
-                #endif
-                int count = READ_BYTE();
-                ObjEnum* sEnum = newEnum(READ_STRING());
-                Value* keys = ALLOCATE(Value, count);
-                Value* values = ALLOCATE(Value, count);
-                for (int i = count - 1; i >= 0; i--) {
-                    values[i] = pop();
-                    keys[i] = pop();
+            } else if (IS_ARRAY(iterable)) {
+                ObjArray* array = AS_ARRAY(iterable);
+                if (cursor < array->count) {
+                    frame->slots[slot + 2] = NUMBER_VAL(arrayGet(array, cursor));
+                    frame->slots[slot + 1] = INT_VAL(cursor + 1);
+                } else {
+                    ip += offset;
                 }
-                for (int i = 0; i < count; i++) {
-                    tableSet(&sEnum->values, keys[i], values[i]);
+            } else if (IS_BYTES(iterable)) {
+                ObjBytes* bytes = AS_BYTES(iterable);
+                if (cursor < bytes->count) {
+                    frame->slots[slot + 2] = INT_VAL(bytes->data[cursor]);
+                    frame->slots[slot + 1] = INT_VAL(cursor + 1);
+                } else {
+                    ip += offset;
                 }
-                push(OBJ_VAL(sEnum));
-                break;
-            }
-            case OP_IMPORT: {
-                ObjString* moduleName = READ_STRING();
-                bool result = loadModule(moduleName->chars, moduleName->chars);
-                if (!result) {
-                    frame->ip = ip;
-                    runtimeError(ERROR_IMPORT, "Failed to import module '%s'.", moduleName->chars);
-                    return INTERPRET_RUNTIME_ERROR;
+            } else if (IS_DICT(iterable) || IS_SET(iterable)) {
+                // for dicts and sets the cursor is the index of the next entry to look at
+                Table* table = IS_DICT(iterable) ? &AS_DICT(iterable)->data : &AS_SET(iterable)->data;
+                while (cursor < table->entryCount && IS_EMPTY(table->entries[cursor].key)) {
+                    cursor++;
                 }
-                break;
-            }
-            case OP_IMPORT_AS: {
-                ObjString* moduleName = READ_STRING();
-                ObjString* moduleNickName = READ_STRING();
-                bool result = loadModule(moduleName->chars, moduleNickName->chars);
-                if (!result) {
+                if (cursor < table->entryCount) {
+                    frame->slots[slot + 2] = table->entries[cursor].key;
+                    frame->slots[slot + 1] = INT_VAL(cursor + 1);
+                } else {
+                    ip += offset;
+                }
+            } else if (IS_DICT_VIEW(iterable)) {
+                // views walk their dict's table the same way, producing keys, values or pairs
+                ObjDictView* view = AS_DICT_VIEW(iterable);
+                Table* table = &view->dict->data;
+                while (cursor < table->entryCount && IS_EMPTY(table->entries[cursor].key)) {
+                    cursor++;
+                }
+                if (cursor < table->entryCount) {
+                    frame->slots[slot + 2] = dictViewValue(view, &table->entries[cursor]);
+                    frame->slots[slot + 1] = INT_VAL(cursor + 1);
+                } else {
+                    ip += offset;
+                }
+            } else if (IS_FILE(iterable)) {
+                // files are read lazily a line at a time, so the cursor isn't needed
+                ObjFile* file = AS_FILE(iterable);
+                if (file->closed) {
                     frame->ip = ip;
-                    runtimeError(ERROR_IMPORT, "Failed to import module '%s'.", moduleName->chars);
-                    return INTERPRET_RUNTIME_ERROR;
+                    runtimeError(ERROR_RUNTIME, "Can't iterate over a closed file.");
+                    THROW();
                 }
-                break;
-            }
-            case OP_INTERPOLATE: {
-                #ifdef DEBUG_LOGGING
-                printf("DEBUG: Stack before OP_INTERPOLATE: ");
-                for (int i = 0; i < vm.stackTop - vm.stack; i++) {
-                    printValue(vm.stack[i]);
-                    printf(" ");
+                ObjString* line = readFileLine(file);
+                if (line != NULL) {
+                    frame->slots[slot + 2] = OBJ_VAL(line);
+                } else {
+                    ip += offset;
                 }
-                printf("\n");
-                #endif
-                Value b = valueToString(pop());
-                Value a = valueToString(pop());
-                push(a);
-                push(b);
-                concatenate();
-                break;
+            } else {
+                frame->ip = ip;
+                runtimeError(ERROR_TYPE, "Can only iterate over lists, ranges, strings, arrays, bytes, dicts, dict views, sets and files, not %s.", valueTypeToString(iterable));
+                THROW();
             }
-            case OP_ASSERT: {
-                Value cond = pop();
-                if (isFalsey(cond)) {
-                    // raise an assertion
-                    frame->ip = ip;
-                    runtimeError(ERROR_ASSERTION, "Assertion failed.");
-                    return INTERPRET_RUNTIME_ERROR;
+            DISPATCH();
+        }
+        CASE_CODE(OP_NEW_LIST): {
+            // comprehensions start with room for everything the iterable in the slot could produce
+            ObjList* list = newListWithCapacity(iterationLength(frame->slots[READ_BYTE()]));
+            PUSH(OBJ_VAL(list));
+            DISPATCH();
+        }
+        CASE_CODE(OP_NEW_DICT): {
+            ObjDict* dict = newDictWithCapacity(iterationLength(frame->slots[READ_BYTE()]));
+            PUSH(OBJ_VAL(dict));
+            DISPATCH();
+        }
+        CASE_CODE(OP_LIST_APPEND): {
+            // the list being built lives in a local slot, the value stays on the stack until it's in
+            ObjList* list = AS_LIST(frame->slots[READ_BYTE()]);
+            Value value = peek(0);
+            if (list->count + 1 > list->values.capacity) {
+                growValueArray(&list->values);
+            }
+            list->values.values[list->count++] = value;
+            list->values.count = list->count;
+            writeBarrier((Obj*)list, value);
+            vm->stackTop--;
+            DISPATCH();
+        }
+        CASE_CODE(OP_DICT_INSERT): {
+            ObjDict* dict = AS_DICT(frame->slots[READ_BYTE()]);
+            Value value = peek(0);
+            Value key = peek(1);
+            tableSet(&dict->data, key, value);
+            writeBarrier((Obj*)dict, key);
+            writeBarrier((Obj*)dict, value);
+            vm->stackTop -= 2;
+            DISPATCH();
+        }
+        CASE_CODE(OP_DICT): {
+            int count = READ_SHORT();
+            // sized for every pair up front, duplicate keys just leave it a little roomier
+            ObjDict* dict = newDictWithCapacity(count);
+            // keep the dict and its entries on the stack while we fill it
+            PUSH(OBJ_VAL(dict));
+            Value* items = vm->stackTop - 1 - count * 2;
+            for (int i = 0; i < count; i++) {
+                tableSet(&dict->data, items[i * 2], items[i * 2 + 1]);
+            }
+            rememberObject((Obj*)dict);
+            vm->stackTop -= count * 2 + 1;
+            PUSH(OBJ_VAL(dict));
+            DISPATCH();
+        }
+        CASE_CODE(OP_DICT_LOCAL): {
+            int count = READ_SHORT();
+            ObjDict* dict = newLocalDict(count);
+            PUSH(OBJ_VAL(dict));
+            Value* items = vm->stackTop - 1 - count * 2;
+            for (int i = 0; i < count; i++) {
+                tableSet(&dict->data, items[i * 2], items[i * 2 + 1]);
+            }
+            vm->stackTop -= count * 2 + 1;
+            PUSH(OBJ_VAL(dict));
+            DISPATCH();
+        }
+        CASE_CODE(OP_ENUM): {
+            #ifdef DEBUG_LOGGING
+            printf("DEBUG: OP_ENUM - reading enum with name: ");
+            #endif
+            int count = READ_BYTE();
+            ObjEnum* sEnum = newEnum(READ_STRING());
+            // keep the enum and its members on the stack while we fill it
+            PUSH(OBJ_VAL(sEnum));
+            Value* items = vm->stackTop - 1 - count * 2;
+            for (int i = 0; i < count; i++) {
+                tableSet(&sEnum->values, items[i * 2], items[i * 2 + 1]);
+            }
+            rememberObject((Obj*)sEnum);
+            vm->stackTop -= count * 2 + 1;
+            PUSH(OBJ_VAL(sEnum));
+            DISPATCH();
+        }
+        CASE_CODE(OP_IMPORT): {
+            ObjString* moduleName = READ_STRING();
+            frame->ip = ip;
+            ObjModule* module = loadModule(moduleName, frame->closure->function->file);
+            if (module == NULL) {
+                runtimeError(ERROR_IMPORT, "Failed to import module '%s'.", moduleName->chars);
+                THROW();
+            }
+            // running the module may have grown the frames
+            frame = &vm->frames[vm->frameCount - 1];
+            // the compiler follows this with a define of the name it's imported as
+            PUSH(OBJ_VAL(module));
+            DISPATCH();
+        }
+        CASE_CODE(OP_INTERPOLATE): {
+            #ifdef DEBUG_LOGGING
+            printf("DEBUG: Stack before OP_INTERPOLATE: ");
+            for (int i = 0; i < vm->stackTop - vm->stack; i++) {
+                printValue(vm->stack[i]);
+                printf(" ");
+            }
+            printf("\n");
+            #endif
+            uint8_t count = READ_BYTE();
+            frame->ip = ip;
+            if (!interpolate(count, NULL)) {
+                THROW();
+            }
+            DISPATCH();
+        }
+        CASE_CODE(OP_FORMAT): {
+            uint8_t count = READ_BYTE();
+            const uint8_t* specs = ip;
+            ip += count * FORMAT_SPEC_BYTES;
+            frame->ip = ip;
+            if (!interpolate(count, specs)) {
+                THROW();
+            }
+            DISPATCH();
+        }
+        CASE_CODE(OP_ASSERT): {
+            Value cond = pop();
+            if (isFalsey(cond)) {
+                // raise an assertion
+                frame->ip = ip;
+                runtimeError(ERROR_ASSERTION, "Assertion failed.");
+                THROW();
+            }
+            // nothing to do when the value is true
+            DISPATCH();
+        }
+        CASE_CODE(OP_THROW): {
+            enum ErrorType type = (enum ErrorType)READ_BYTE();
+            frame->ip = ip;
+            raiseValue(type);
+            THROW();
+        }
+        CASE_CODE(OP_EXCEPT_JUMP): {
+            // the exception an except clause is checking is on top of the stack
+            uint16_t types = READ_SHORT();
+            uint16_t offset = READ_SHORT();
+            if (!(types & (1 << AS_ERROR(peek(0))->type))) {
+                ip += offset;
+            }
+            DISPATCH();
+        }
+        CASE_CODE(OP_RETURN_LOCALS): {
+            // free the lists and dicts still in this frame's variables that never left it
+            for (Value* slot = frame->slots; slot < vm->stackTop - 1; slot++) {
+                if (IS_OBJ(*slot)) {
+                    freeLocalObject(AS_OBJ(*slot));
                 }
-                // nothing to do when the value is true
-                break;
             }
-            case OP_RETURN: {
-                Value result = pop();
-                closeUpvalues(frame->slots);
-                vm.frameCount--;
+            CASE_FALLTHROUGH();
+        }
+        CASE_CODE(OP_RETURN): {
+            if (UNLIKELY(vm->profile)) {
+                frame->ip = ip;
+                profileReturn(vm->frameCount - 1);
+            }
+            PROBE_FUNCTION_RETURN(frame->closure->function, (int)(ip - frame->closure->function->chunk.code - 1));
+            Value result = pop();
+            closeUpvalues(frame->slots);
+            vm->frameCount--;
 
-                if (vm.frameCount == 0) {
-                    // this means we've finished executing
-                    // the entry script - we're done!
-                    pop();
-                    return INTERPRET_OK;
-                }
+            if (vm->frameCount == 0 && vm->callDepth == 0) {
+                // this means we've finished executing
+                // the entry script - we're done!
+                pop();
+                return INTERPRET_OK;
+            }
 
-                vm.stackTop = frame->slots;
-                push(result);
-                frame = &vm.frames[vm.frameCount - 1];
-                ip = frame->ip;
-                break;
+            vm->stackTop = frame->slots;
+            PUSH(result);
+            if (UNLIKELY(vm->memoCallCount > 0) && vm->memoCalls[vm->memoCallCount - 1].frame == vm->frameCount) {
+                finishMemoCall(result);
             }
+            if (vm->frameCount == vm->baseFrame) {
+                // finished a call made from a native
+                return INTERPRET_OK;
+            }
+            frame = &vm->frames[vm->frameCount - 1];
+            ip = frame->ip;
+            DISPATCH();
         }
     }
 
+#ifdef COMPUTED_GOTO
+code_UNKNOWN:
+#endif
+    frame->ip = ip;
+    runtimeError(ERROR_RUNTIME, "Unknown opcode %d.", instruction);
+    THROW();
+
+stackFull:
+    // out of the way of the handlers, as calling out from them costs them registers
+    growStack(STACK_RESERVE);
+    DISPATCH();
+
+raised:
+    if (!catchException()) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    frame = &vm->frames[vm->frameCount - 1];
+    ip = frame->ip;
+    DISPATCH();
+
 #undef READ_BYTE
+#undef THROW
 #undef READ_CONSTANT
+#undef READ_CONSTANT_LONG
 #undef READ_SHORT
 #undef READ_STRING
+#undef READ_CACHE
 #undef BINARY_OP
+#undef LOCAL_ARITH
+#undef QUICKEN
+#undef DEOPTIMISE
+#undef TRACE_EXECUTION
+#undef COUNT_OPCODE
+#undef INTERPRET_LOOP
+#undef CASE_CODE
+#undef CASE_FALLTHROUGH
+#undef DISPATCH
+#undef PUSH
 
 }
 
@@ -1568,17 +3439,300 @@ static InterpretResult run() {
  * will fill up with bytecode. The chunk is passed to the VM
  * and then it's executed in 'run()'.
  */
+/**
+ * Method for running a compiled script.
+ */
+static InterpretResult interpretFunction(ObjFunction* function) {
+    push(OBJ_VAL(function));
+    ObjClosure* closure = newClosure(function);
+    pop();
+    push(OBJ_VAL(closure));
+    call(closure, 0);
+
+    InterpretResult result = run();
+    // nothing's running now to be holding on to an old stack
+    freeRetiredStacks();
+    return result;
+}
+
+/**
+ * Implementation of method for calling slo from a native.
+ */
+bool callFunction(Value callee, int argCount, Value* args, Value* result) {
+    if (!ensureStack(argCount + 1)) {
+        ptrdiff_t stackTop = vm->stackTop - vm->stack;
+        int frameCount = vm->frameCount;
+        int baseFrame = vm->baseFrame;
+        runtimeError(ERROR_RUNTIME, "Stack overflow.");
+        vm->stackTop = vm->stack + stackTop;
+        vm->frameCount = frameCount;
+        dropMemoCalls();
+        vm->baseFrame = baseFrame;
+        return false;
+    }
+    push(callee);
+    for (int i = 0; i < argCount; i++) {
+        push(args[i]);
+    }
+    return callOnStack(argCount, result);
+}
+
+/**
+ * Implementation of method for calling the callee on the stack below its arguments.
+ *
+ * The callee's frame is run to completion in a nested 'run()' which
+ * returns once the frame count drops back to vm->baseFrame.
+ */
+bool callOnStack(int argCount, Value* result) {
+    // kept as an offset as the stack can move while the callee runs
+    ptrdiff_t stackTop = vm->stackTop - vm->stack - argCount - 1;
+    int frameCount = vm->frameCount;
+    int baseFrame = vm->baseFrame;
+    Value callee = vm->stackTop[-1 - argCount];
+
+    vm->callDepth++;
+    // with no frames this is the entry point of a thread, rather than a native calling back
+    bool ok = callValue(callee, argCount, frameCount > 0 ? vm->frames[frameCount - 1].ip : NULL);
+    if (ok && vm->frameCount > frameCount) {
+        // a closure was called so run its frame until it returns
+        vm->baseFrame = frameCount;
+        ok = run() == INTERPRET_OK;
+    }
+    vm->callDepth--;
+
+    if (!ok) {
+        // the error reset the stack, put back the caller's so it can unwind
+        vm->stackTop = vm->stack + stackTop;
+        vm->frameCount = frameCount;
+        dropMemoCalls();
+        vm->baseFrame = baseFrame;
+        return false;
+    }
+
+    *result = pop();
+    vm->stackTop = vm->stack + stackTop;
+    vm->baseFrame = baseFrame;
+    if (frameCount == 0) {
+        // called from outside the VM, so nothing's left holding on to an old stack
+        freeRetiredStacks();
+    }
+    return true;
+}
+
+/**
+ * Method for moving a suspended fiber's frames and values onto the top of the stack.
+ */
+static bool restoreFiber(ObjFiber* fiber) {
+    if (!ensureFrames(fiber->frameCount) || !ensureStack(fiber->stackCount + STACK_RESERVE)) {
+        runtimeError(ERROR_RUNTIME, "Stack overflow.");
+        return false;
+    }
+
+    Value* base = vm->stackTop;
+    memcpy(base, fiber->stack, sizeof(Value) * fiber->stackCount);
+    vm->stackTop += fiber->stackCount;
+    for (int i = 0; i < fiber->frameCount; i++) {
+        CallFrame* frame = &vm->frames[vm->frameCount++];
+        frame->closure = fiber->frames[i].closure;
+        frame->ip = fiber->frames[i].ip;
+        frame->slots = base + fiber->frames[i].slots;
+    }
+
+    // its upvalues are all above the current ones so go back on the front of the list
+    if (fiber->openUpvalues != NULL) {
+        ObjUpvalue* last = fiber->openUpvalues;
+        for (ObjUpvalue* upvalue = fiber->openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+            upvalue->location = base + (upvalue->location - fiber->stack);
+            last = upvalue;
+        }
+        last->next = vm->openUpvalues;
+        vm->openUpvalues = fiber->openUpvalues;
+        fiber->openUpvalues = NULL;
+    }
+    fiber->frameCount = 0;
+    fiber->stackCount = 0;
+    return true;
+}
+
+/**
+ * Method for moving a yielding fiber's frames and values off the stack, down to base.
+ */
+static void suspendFiber(ObjFiber* fiber, Value* base, int baseFrame) {
+    int stackCount = (int)(vm->stackTop - base);
+    int frameCount = vm->frameCount - baseFrame;
+    // grown while everything is still on the stack, in case growing collects
+    if (fiber->stackCapacity < stackCount) {
+        int oldCapacity = fiber->stackCapacity;
+        fiber->stackCapacity = stackCount < 8 ? 8 : stackCount;
+        fiber->stack = GROW_ARRAY(Value, fiber->stack, oldCapacity, fiber->stackCapacity);
+    }
+    if (fiber->frameCapacity < frameCount) {
+        int oldCapacity = fiber->frameCapacity;
+        fiber->frameCapacity = frameCount < 4 ? 4 : frameCount;
+        fiber->frames = GROW_ARRAY(FiberFrame, fiber->frames, oldCapacity, fiber->frameCapacity);
+    }
+
+    memcpy(fiber->stack, base, sizeof(Value) * stackCount);
+    fiber->stackCount = stackCount;
+    for (int i = 0; i < frameCount; i++) {
+        CallFrame* frame = &vm->frames[baseFrame + i];
+        fiber->frames[i].closure = frame->closure;
+        fiber->frames[i].ip = frame->ip;
+        fiber->frames[i].slots = (int)(frame->slots - base);
+    }
+    fiber->frameCount = frameCount;
+
+    // upvalues still open over its values now point into its own stack
+    ObjUpvalue** tail = &fiber->openUpvalues;
+    while (vm->openUpvalues != NULL && vm->openUpvalues->location >= base) {
+        ObjUpvalue* upvalue = vm->openUpvalues;
+        vm->openUpvalues = upvalue->next;
+        upvalue->location = fiber->stack + (upvalue->location - base);
+        upvalue->next = NULL;
+        *tail = upvalue;
+        tail = &upvalue->next;
+    }
+    rememberObject((Obj*)fiber);
+
+    vm->stackTop = base;
+    vm->frameCount = baseFrame;
+    dropMemoCalls();
+}
+
+bool resumeFiber(ObjFiber* fiber, Value value, Value* result) {
+    // kept as an offset as the stack can move while the fiber runs
+    ptrdiff_t base = vm->stackTop - vm->stack;
+    int frameCount = vm->frameCount;
+    int baseFrame = vm->baseFrame;
+    ObjFiber* caller = vm->fiber;
+
+    if (fiber->state == FIBER_NEW) {
+        int argCount = fiber->closure->function->arity;
+        push(OBJ_VAL(fiber->closure));
+        if (argCount == 1) {
+            push(value);
+        }
+        if (!call(fiber->closure, argCount)) {
+            vm->stackTop = vm->stack + base;
+            vm->frameCount = frameCount;
+        dropMemoCalls();
+            return false;
+        }
+    } else {
+        if (!restoreFiber(fiber)) {
+            return false;
+        }
+        // what the native that suspended it returns
+        vm->stackTop[-1] = value;
+    }
+
+    fiber->state = FIBER_RUNNING;
+    fiber->callDepth = vm->callDepth;
+    vm->fiber = fiber;
+    vm->baseFrame = frameCount;
+    InterpretResult status = run();
+    vm->fiber = caller;
+    vm->baseFrame = baseFrame;
+
+    if (status == INTERPRET_OK) {
+        fiber->state = FIBER_DONE;
+        *result = pop();
+        vm->stackTop = vm->stack + base;
+        return true;
+    }
+    if (vm->yielding) {
+        vm->yielding = false;
+        fiber->state = FIBER_SUSPENDED;
+        *result = fiber->transfer;
+        fiber->transfer = NIL_VAL;
+        suspendFiber(fiber, vm->stack + base, frameCount);
+        return true;
+    }
+
+    // the error reset the stack, put back the caller's so it can unwind
+    fiber->state = FIBER_DONE;
+    vm->stackTop = vm->stack + base;
+    vm->frameCount = frameCount;
+    dropMemoCalls();
+    return false;
+}
+
+bool yieldFiber(Value value) {
+    if (vm->fiber == NULL || vm->callDepth != vm->fiber->callDepth) {
+        return false;
+    }
+    vm->fiber->transfer = value;
+    writeBarrier((Obj*)vm->fiber, value);
+    vm->yielding = true;
+    return true;
+}
+
+bool failFiber(ObjFiber* fiber, const char* message) {
+    ptrdiff_t base = vm->stackTop - vm->stack;
+    int frameCount = vm->frameCount;
+    // back on the stack so the error points at where it yielded
+    if (restoreFiber(fiber)) {
+        runtimeError(ERROR_RUNTIME, "%s", message);
+    }
+
+    // the error reset the stack, put back the caller's so it can unwind
+    fiber->state = FIBER_DONE;
+    vm->stackTop = vm->stack + base;
+    vm->frameCount = frameCount;
+    dropMemoCalls();
+    return false;
+}
+
 InterpretResult interpret(const char* source, const char* file) {
     ObjFunction* function = compile(source, file);
     if (function == NULL) {
         return INTERPRET_COMPILE_ERROR;
     }
+    return interpretFunction(function);
+}
 
-    push(OBJ_VAL(function));
-    ObjClosure* closure = newClosure(function);
-    pop();
-    push(OBJ_VAL(closure));
-    call(closure, 0);
+/**
+ * Method for running a script from a file, while the modules it imports are compiled ahead.
+ */
+static InterpretResult interpretScript(ObjFunction* function) {
+    startPrecompiling(function);
+    InterpretResult result = interpretFunction(function);
+    stopPrecompiling();
+    return result;
+}
+
+InterpretResult interpretFile(const char* source, const char* path) {
+    if (!vm->bytecodeCache) {
+        ObjFunction* function = compile(source, path);
+        if (function == NULL) {
+            return INTERPRET_COMPILE_ERROR;
+        }
+        return interpretScript(function);
+    }
+
+    ObjFunction* function = readBytecode(path, source, NULL);
+    if (function == NULL) {
+        function = compile(source, path);
+        if (function == NULL) {
+            return INTERPRET_COMPILE_ERROR;
+        }
+        push(OBJ_VAL(function));
+        // failing to write the cache just means the next run compiles again
+        writeBytecode(function, path, source);
+        pop();
+    }
+    return interpretScript(function);
+}
 
-    return run();
+InterpretResult interpretBundle(const char* path) {
+    if (!openBundle(path)) {
+        fprintf(stderr, "Could not load bundle \"%s\".\n", path);
+        return INTERPRET_COMPILE_ERROR;
+    }
+    ObjFunction* function = readBundledFunction(NULL);
+    if (function == NULL) {
+        fprintf(stderr, "Bundle \"%s\" is corrupt.\n", path);
+        return INTERPRET_COMPILE_ERROR;
+    }
+    return interpretFunction(function);
 }
@@ -0,0 +1,460 @@
+/**
+ * @file writer.c
+ * @brief Implementation of writing values as text.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "core/memory.h"
+#include "core/object.h"
+#include "core/writer.h"
+
+/**
+ * Implementation of method to start a growing writer.
+ */
+void initWriter(Writer* writer) {
+    writer->chars = NULL;
+    writer->length = 0;
+    writer->capacity = 0;
+    writer->file = NULL;
+    writer->error = NULL;
+}
+
+/**
+ * Implementation of method to start a writer for a file.
+ */
+void initFileWriter(Writer* writer, FILE* file, char* buffer, size_t capacity) {
+    writer->chars = buffer;
+    writer->length = 0;
+    writer->capacity = capacity;
+    writer->file = file;
+    writer->error = NULL;
+}
+
+/**
+ * Implementation of method to free a growing writer's buffer.
+ */
+void freeWriter(Writer* writer) {
+    if (writer->file == NULL) {
+        FREE_ARRAY(char, writer->chars, writer->capacity);
+    }
+    initWriter(writer);
+}
+
+/**
+ * Implementation of method to record a writer's error.
+ */
+bool writerError(Writer* writer, const char* message) {
+    if (writer->error == NULL) {
+        writer->error = message;
+    }
+    return false;
+}
+
+/**
+ * Implementation of method to flush a file writer.
+ */
+bool flushWriter(Writer* writer) {
+    if (writer->length > 0 && fwrite(writer->chars, 1, writer->length, writer->file) != writer->length) {
+        return writerError(writer, "Failed to write to file.");
+    }
+    writer->length = 0;
+    return true;
+}
+
+/**
+ * Implementation of method to make room in a writer.
+ *
+ * A growing writer doubles so writing n characters only copies O(n) of them,
+ * and a file writer flushes what it has.
+ */
+bool reserveWriter(Writer* writer, size_t length) {
+    if (writer->length + length <= writer->capacity) {
+        return true;
+    }
+    if (writer->file != NULL) {
+        return flushWriter(writer) && length <= writer->capacity;
+    }
+    size_t capacity = writer->capacity;
+    while (capacity < writer->length + length) {
+        capacity = GROW_CAPACITY(capacity);
+    }
+    if (capacity > INT32_MAX) {
+        return writerError(writer, "Text is too long for a string.");
+    }
+    writer->chars = GROW_ARRAY(char, writer->chars, writer->capacity, capacity);
+    writer->capacity = capacity;
+    return true;
+}
+
+/**
+ * Implementation of method to write some characters.
+ */
+bool writeChars(Writer* writer, const char* chars, size_t length) {
+    if (!reserveWriter(writer, length)) {
+        if (writer->file == NULL || writer->error != NULL) {
+            return false;
+        }
+        // too big to be worth buffering
+        if (fwrite(chars, 1, length, writer->file) != length) {
+            return writerError(writer, "Failed to write to file.");
+        }
+        return true;
+    }
+    memcpy(writer->chars + writer->length, chars, length);
+    writer->length += length;
+    return true;
+}
+
+/**
+ * Implementation of method to write a NUL terminated string.
+ */
+bool writeCString(Writer* writer, const char* chars) {
+    return writeChars(writer, chars, strlen(chars));
+}
+
+/**
+ * Method for writing a number with a printf format.
+ *
+ * A NaN is written as nan whatever its sign bit, as the NaN-boxed build
+ * only stores the one positive NaN and both builds should print alike.
+ */
+static bool writeFormattedNumber(Writer* writer, const char* format, double number) {
+    char buffer[NUMBER_CHARS];
+    int length = snprintf(buffer, sizeof(buffer), format, isnan(number) ? NAN : number);
+    return writeChars(writer, buffer, (size_t)length < sizeof(buffer) ? (size_t)length : sizeof(buffer) - 1);
+}
+
+/**
+ * Implementation of method to write a number.
+ */
+bool writeNumber(Writer* writer, double number) {
+    return writeFormattedNumber(writer, "%.14g", number);
+}
+
+/**
+ * Method for writing a string object's characters.
+ */
+static bool writeString(Writer* writer, ObjString* string) {
+    return writeChars(writer, string->chars, string->length);
+}
+
+/**
+ * Method for writing an exception as "Type: message".
+ */
+static bool writeException(Writer* writer, ObjError* error) {
+    return writeCString(writer, errorTypeToString(error->type)) && writeChars(writer, ": ", 2)
+        && writeString(writer, error->message);
+}
+
+static bool writeValueAt(Writer* writer, Value value, int depth);
+static bool writePrintedAt(Writer* writer, Value value, int depth);
+
+/**
+ * Method for writing what a dict view produces as a list, printed or as str() would.
+ *
+ * Pairs are written straight from the entries rather than being made.
+ */
+static bool writeDictView(Writer* writer, ObjDictView* view, bool printed, int depth) {
+    bool (*write)(Writer*, Value, int) = printed ? writePrintedAt : writeValueAt;
+    Table* table = &view->dict->data;
+    if (!writeChar(writer, '[')) {
+        return false;
+    }
+    bool first = true;
+    for (int i = 0; i < table->entryCount; i++) {
+        Entry* entry = &table->entries[i];
+        if (IS_EMPTY(entry->key)) {
+            continue;
+        }
+        if (!first && !writeChars(writer, ", ", 2)) {
+            return false;
+        }
+        first = false;
+        if (view->kind == VIEW_ITEMS) {
+            if (!writeChar(writer, '[') || !write(writer, entry->key, depth + 1) || !writeChars(writer, ", ", 2)
+                    || !write(writer, entry->value, depth + 1) || !writeChar(writer, ']')) {
+                return false;
+            }
+        } else if (!write(writer, view->kind == VIEW_KEYS ? entry->key : entry->value, depth + 1)) {
+            return false;
+        }
+    }
+    return writeChar(writer, ']');
+}
+
+/**
+ * Method for writing a value as str() would, nested depth containers deep.
+ */
+static bool writeValueAt(Writer* writer, Value value, int depth) {
+    if (IS_STRING(value)) {
+        return writeString(writer, AS_STRING(value));
+    } else if (IS_NIL(value)) {
+        return writeChars(writer, "nil", 3);
+    } else if (IS_BOOL(value)) {
+        return AS_BOOL(value) ? writeChars(writer, "true", 4) : writeChars(writer, "false", 5);
+    } else if (IS_NUMBER(value)) {
+        return writeNumber(writer, AS_NUMBER(value));
+    } else if ((IS_LIST(value) || IS_DICT(value) || IS_DICT_VIEW(value)) && depth >= WRITER_NESTING_LIMIT) {
+        return writeChars(writer, "...", 3);
+    } else if (IS_LIST(value)) {
+        ObjList* list = AS_LIST(value);
+        if (!writeChar(writer, '[')) {
+            return false;
+        }
+        for (int i = 0; i < list->count; i++) {
+            if ((i > 0 && !writeChars(writer, ", ", 2)) || !writeValueAt(writer, list->values.values[i], depth + 1)) {
+                return false;
+            }
+        }
+        return writeChar(writer, ']');
+    } else if (IS_DICT(value)) {
+        Table* table = &AS_DICT(value)->data;
+        if (!writeChar(writer, '{')) {
+            return false;
+        }
+        bool first = true;
+        for (int i = 0; i < table->entryCount; i++) {
+            Entry* entry = &table->entries[i];
+            if (IS_EMPTY(entry->key) || IS_NIL(entry->key)) {
+                continue;
+            }
+            if ((!first && !writeChars(writer, ", ", 2)) || !writeValueAt(writer, entry->key, depth + 1)
+                    || !writeChars(writer, ": ", 2) || !writeValueAt(writer, entry->value, depth + 1)) {
+                return false;
+            }
+            first = false;
+        }
+        return writeChar(writer, '}');
+    } else if (IS_DICT_VIEW(value)) {
+        return writeDictView(writer, AS_DICT_VIEW(value), false, depth);
+    } else if (IS_EXCEPTION(value)) {
+        return writeException(writer, AS_ERROR(value));
+    }
+    return writeChar(writer, '<') && writeCString(writer, valueTypeToString(value)) && writeChar(writer, '>');
+}
+
+/**
+ * Implementation of method to write a value as str() would.
+ */
+bool writeValue(Writer* writer, Value value) {
+    return writeValueAt(writer, value, 0);
+}
+
+/**
+ * Method for writing a function as it's printed.
+ */
+static bool writeFunction(Writer* writer, ObjFunction* function) {
+    if (function->name == NULL) {
+        return writeCString(writer, "<script>");
+    }
+    return writeCString(writer, "<fn ") && writeString(writer, function->name) && writeChar(writer, '>');
+}
+
+/**
+ * Method for writing the keys of a table, with their values if it has them, as they're printed.
+ */
+static bool writePrintedTable(Writer* writer, Table* table, bool values, int depth) {
+    bool first = true;
+    for (int i = 0; i < table->entryCount; i++) {
+        Entry* entry = &table->entries[i];
+        if (IS_EMPTY(entry->key) || (values && IS_NIL(entry->key))) {
+            continue;
+        }
+        if ((!first && !writeChars(writer, ", ", 2)) || !writePrintedAt(writer, entry->key, depth + 1)) {
+            return false;
+        }
+        if (values && (!writeChars(writer, ": ", 2) || !writePrintedAt(writer, entry->value, depth + 1))) {
+            return false;
+        }
+        first = false;
+    }
+    return writeChar(writer, '}');
+}
+
+/**
+ * Method for writing an object as it's printed.
+ */
+static bool writePrintedObject(Writer* writer, Value value, int depth) {
+    char buffer[64];
+    switch (OBJ_TYPE(value)) {
+        case OBJ_BOUND_METHOD:
+            return writeFunction(writer, AS_BOUND_METHOD(value)->method->function);
+        case OBJ_CLASS:
+            return writeString(writer, AS_CLASS(value)->name);
+        case OBJ_CLOSURE:
+            return writeFunction(writer, AS_CLOSURE(value)->function);
+        case OBJ_INSTANCE:
+            return writeString(writer, AS_INSTANCE(value)->sClass->name) && writeCString(writer, " instance");
+        case OBJ_FUNCTION:
+            return writeFunction(writer, AS_FUNCTION(value));
+        case OBJ_NATIVE:
+            return writeCString(writer, "<native fn>");
+        case OBJ_STRING:
+            return writeString(writer, AS_STRING(value));
+        case OBJ_UPVALUE:
+            return writeCString(writer, "upvalue");
+        case OBJ_MODULE:
+            return writeCString(writer, "<module>");
+        case OBJ_LIST: {
+            ObjList* list = AS_LIST(value);
+            snprintf(buffer, sizeof(buffer), "list[%d]: [", list->count);
+            if (!writeCString(writer, buffer)) {
+                return false;
+            }
+            for (int i = 0; i < list->count; i++) {
+                if ((i > 0 && !writeChars(writer, ", ", 2)) || !writePrintedAt(writer, list->values.values[i], depth + 1)) {
+                    return false;
+                }
+            }
+            return writeChar(writer, ']');
+        }
+        case OBJ_DICT: {
+            ObjDict* dict = AS_DICT(value);
+            snprintf(buffer, sizeof(buffer), "dict[%d]: {", dict->data.count);
+            return writeCString(writer, buffer) && writePrintedTable(writer, &dict->data, true, depth);
+        }
+        case OBJ_ENUM: {
+            ObjEnum* sEnum = AS_ENUM(value);
+            return writeCString(writer, "enum ") && writeString(writer, sEnum->name) && writeChars(writer, ": {", 3)
+                && writePrintedTable(writer, &sEnum->values, true, depth);
+        }
+        case OBJ_FILE: {
+            ObjFile* sFile = AS_FILE(value);
+            snprintf(buffer, sizeof(buffer), "file %p (%s)", (void*)sFile->file, sFile->closed ? "closed" : "open");
+            return writeCString(writer, buffer);
+        }
+        case OBJ_STRING_BUILDER:
+            snprintf(buffer, sizeof(buffer), "string builder (%d chars)", AS_STRING_BUILDER(value)->length);
+            return writeCString(writer, buffer);
+        case OBJ_ARRAY: {
+            ObjArray* array = AS_ARRAY(value);
+            snprintf(buffer, sizeof(buffer), "array %s[%d]: [", array->type == ARRAY_F64 ? "f64" : "i64", array->count);
+            if (!writeCString(writer, buffer)) {
+                return false;
+            }
+            for (int i = 0; i < array->count; i++) {
+                if (i > 0 && !writeChars(writer, ", ", 2)) {
+                    return false;
+                }
+                if (array->type == ARRAY_F64) {
+                    if (!writeNumber(writer, array->as.f64[i])) {
+                        return false;
+                    }
+                } else {
+                    int length = snprintf(buffer, sizeof(buffer), "%lld", (long long)array->as.i64[i]);
+                    if (!writeChars(writer, buffer, length)) {
+                        return false;
+                    }
+                }
+            }
+            return writeChar(writer, ']');
+        }
+        case OBJ_SET: {
+            ObjSet* set = AS_SET(value);
+            snprintf(buffer, sizeof(buffer), "set[%d]: {", set->data.count);
+            return writeCString(writer, buffer) && writePrintedTable(writer, &set->data, false, depth);
+        }
+        case OBJ_BYTES: {
+            ObjBytes* bytes = AS_BYTES(value);
+            snprintf(buffer, sizeof(buffer), "bytes[%d]: [", bytes->count);
+            if (!writeCString(writer, buffer)) {
+                return false;
+            }
+            for (int i = 0; i < bytes->count; i++) {
+                int length = snprintf(buffer, sizeof(buffer), i > 0 ? ", %d" : "%d", bytes->data[i]);
+                if (!writeChars(writer, buffer, length)) {
+                    return false;
+                }
+            }
+            return writeChar(writer, ']');
+        }
+        case OBJ_FIBER: {
+            static const char* states[] = {"new", "suspended", "running", "done"};
+            return writeCString(writer, "<fiber ") && writeCString(writer, states[AS_FIBER(value)->state])
+                && writeChar(writer, '>');
+        }
+        case OBJ_SOCKET: {
+            ObjSocket* socket = AS_SOCKET(value);
+            if (socket->closed) {
+                return writeCString(writer, "<socket closed>");
+            }
+            snprintf(buffer, sizeof(buffer), "<socket %s %d>", socket->listening ? "listening" : "connected", socket->fd);
+            return writeCString(writer, buffer);
+        }
+        case OBJ_THREAD:
+            return writeCString(writer, "<thread>");
+        case OBJ_CHANNEL:
+            return writeCString(writer, "<channel>");
+        case OBJ_RANGE: {
+            ObjRange* range = AS_RANGE(value);
+            return writeCString(writer, "range(") && writeFormattedNumber(writer, "%g", range->start)
+                && writeChars(writer, ", ", 2) && writeFormattedNumber(writer, "%g", range->stop)
+                && writeChars(writer, ", ", 2) && writeFormattedNumber(writer, "%g", range->step)
+                && writeChar(writer, ')');
+        }
+        case OBJ_RANDOM:
+            return writeCString(writer, "<random>");
+        case OBJ_MEMO:
+            return writeCString(writer, "<memoised ") && writePrintedAt(writer, AS_MEMO(value)->function, depth)
+                && writeChar(writer, '>');
+        case OBJ_DICT_VIEW: {
+            static const char* kinds[] = {"keys", "values", "items"};
+            ObjDictView* view = AS_DICT_VIEW(value);
+            snprintf(buffer, sizeof(buffer), "%s[%d]: ", kinds[view->kind], view->dict->data.count);
+            return writeCString(writer, buffer) && writeDictView(writer, view, true, depth);
+        }
+        case OBJ_ERROR:
+            return writeException(writer, AS_ERROR(value));
+        default:
+            return true;
+    }
+}
+
+/**
+ * Method for writing a value as it's printed, nested depth containers deep.
+ */
+static bool writePrintedAt(Writer* writer, Value value, int depth) {
+    switch (VALUE_TYPE(value)) {
+        case VAL_BOOL:
+            return AS_BOOL(value) ? writeChars(writer, "true", 4) : writeChars(writer, "false", 5);
+        case VAL_NIL:
+            return writeChars(writer, "nil", 3);
+        case VAL_NUMBER:
+        case VAL_INT:
+            return writeFormattedNumber(writer, "%g", AS_NUMBER(value));
+        case VAL_OBJ:
+            if ((IS_LIST(value) || IS_DICT(value) || IS_SET(value) || IS_DICT_VIEW(value))
+                    && depth >= WRITER_NESTING_LIMIT) {
+                return writeChars(writer, "...", 3);
+            }
+            return writePrintedObject(writer, value, depth);
+        case VAL_EMPTY:
+            return writeCString(writer, "<empty>");
+        case VAL_ERROR:
+            return writeCString(writer, "<exception>");
+        default:
+            return true;
+    }
+}
+
+/**
+ * Implementation of method to write a value as it's printed.
+ */
+bool writePrintedValue(Writer* writer, Value value) {
+    return writePrintedAt(writer, value, 0);
+}
+
+/**
+ * Implementation of method to turn a growing writer's text into a string.
+ */
+ObjString* writerToString(Writer* writer) {
+    // shrink to fit, with room for the terminator
+    char* chars = GROW_ARRAY(char, writer->chars, writer->capacity, writer->length + 1);
+    chars[writer->length] = '\0';
+    ObjString* string = takeRuntimeString(chars, (int)writer->length);
+    initWriter(writer);
+    return string;
+}
@@ -7,10 +7,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "core/common.h"
 #include "core/chunk.h"
 #include "core/debug.h"
+#include "core/gc.h"
+#include "core/loader.h"
+#include "core/opcode_stats.h"
+#include "core/profiler.h"
+#include "core/snapshot.h"
 #include "runtime/repl.h"
 #include "core/vm.h"
 
@@ -55,14 +61,98 @@ static char* readFile(const char* path) {
 
 /**
  * Method for running a slo file.
+ * Returns the exit code for the result of running the file.
  */
-static void runFile(const char* path) {
+static int runFile(const char* path) {
     char* source = readFile(path);
-    InterpretResult result = interpret(source, path);
+    InterpretResult result = interpretFile(source, path);
     free(source);
 
-    if (result == INTERPRET_COMPILE_ERROR) exit(65);
-    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+    if (result == INTERPRET_COMPILE_ERROR) return 65;
+    if (result == INTERPRET_RUNTIME_ERROR) return 70;
+    return 0;
+}
+
+/**
+ * Method for compiling a slo file and the modules it imports into a bundle.
+ * Returns the exit code, with the bundle written next to the file unless output is given.
+ */
+static int compileFile(const char* path, const char* output) {
+    char* defaultOutput = NULL;
+    if (output == NULL) {
+        size_t length = strlen(path);
+        defaultOutput = (char*)malloc(length + 6);
+        if (defaultOutput == NULL) {
+            return 74;
+        }
+        memcpy(defaultOutput, path, length + 1);
+        strcat(defaultOutput, length >= 4 && strcmp(path + length - 4, ".slo") == 0 ? "b" : ".slob");
+        output = defaultOutput;
+    }
+
+    bool compiled = compileBundle(path, output);
+    free(defaultOutput);
+    return compiled ? 0 : 65;
+}
+
+/**
+ * Method for running the script in a bundle.
+ * Returns the exit code for the result of running it.
+ */
+static int runBundle(const char* path) {
+    InterpretResult result = interpretBundle(path);
+    if (result == INTERPRET_COMPILE_ERROR) return 65;
+    if (result == INTERPRET_RUNTIME_ERROR) return 70;
+    return 0;
+}
+
+/**
+ * Method for running a slo file and saving the globals it leaves behind to a snapshot.
+ * Returns the exit code, which is the file's if it didn't run.
+ */
+static int snapshotFile(const char* path, const char* output) {
+    int exitCode = runFile(path);
+    if (exitCode != 0) {
+        return exitCode;
+    }
+    if (!writeSnapshot(output)) {
+        fprintf(stderr, "Could not write snapshot \"%s\".\n", output);
+        return 74;
+    }
+    return 0;
+}
+
+/**
+ * Method for running the main() of a snapshot.
+ * Returns the exit code for the result of running it.
+ */
+static int runSnapshot(const char* path) {
+    InterpretResult result = interpretSnapshot(path);
+    if (result == INTERPRET_COMPILE_ERROR) return 65;
+    if (result == INTERPRET_RUNTIME_ERROR) return 70;
+    return 0;
+}
+
+/**
+ * Method for printing the usage message.
+ */
+static void usage() {
+    fprintf(stderr, "Usage: cslo [--gc=full|generational] [--gc-nursery=BYTES] [--gc-threads=N] [--gc-parallel-heap=BYTES] [--gc-grow-factor=N] [--gc-stats] [--import-threads=N] [--no-cache] [--no-jit] [--profile[=calls|samples]] [--profile-output=PATH] [path] [--version]\n");
+    fprintf(stderr, "       cslo compile path [-o bundle]\n");
+    fprintf(stderr, "       cslo [options] run bundle\n");
+    fprintf(stderr, "       cslo [options] --snapshot image path\n");
+    fprintf(stderr, "       cslo [options] --from-snapshot image\n");
+}
+
+/**
+ * Method for getting the default number of collector threads, one per CPU up to 8.
+ */
+static int defaultGCThreads() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        return 1;
+    }
+    return cpus > 8 ? 8 : (int)cpus;
 }
 
 /**
@@ -71,21 +161,152 @@ static void runFile(const char* path) {
  * This is currently our REPL handler and program runner.
  */
 int main(int argc, const char* argv[]) {
-    initVM();
+    // too big for the stack, and there's only the one
+    static VM mainVM;
+    initVM(&mainVM);
 
-    if (argc == 1) {
-        repl();
-    } else if (argc == 2) {
-        if (strcmp(argv[1], "--version") == 0 || strcmp(argv[1], "-v") == 0) {
+    const char* path = NULL;
+    // "compile" or "run" before the path, for bundles
+    const char* command = NULL;
+    const char* output = NULL;
+    // the snapshot to save after running the path, or to run main() from instead of a path
+    const char* snapshot = NULL;
+    const char* fromSnapshot = NULL;
+    bool gcStats = false;
+    GCMode gcMode = GC_FULL;
+    size_t nurserySize = GC_DEFAULT_NURSERY_SIZE;
+    int gcThreads = defaultGCThreads();
+    // the script runs alongside them, so there's one fewer than there are CPUs
+    int importThreads = defaultGCThreads() - 1;
+    size_t parallelHeap = GC_DEFAULT_PARALLEL_HEAP;
+    int profile = 0;
+    const char* profileOutput = "cslo.folded";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--version") == 0 || strcmp(argv[i], "-v") == 0) {
             printf("slo version %s\n", SLO_VERSION);
             return 0;
+        } else if (strcmp(argv[i], "--gc=full") == 0) {
+            gcMode = GC_FULL;
+        } else if (strcmp(argv[i], "--gc=generational") == 0) {
+            gcMode = GC_GENERATIONAL;
+        } else if (strncmp(argv[i], "--gc-nursery=", 13) == 0) {
+            long size = strtol(argv[i] + 13, NULL, 10);
+            if (size <= 0) {
+                usage();
+                exit(64);
+            }
+            nurserySize = (size_t)size;
+        } else if (strncmp(argv[i], "--gc-threads=", 13) == 0) {
+            long threads = strtol(argv[i] + 13, NULL, 10);
+            if (threads <= 0) {
+                usage();
+                exit(64);
+            }
+            gcThreads = (int)threads;
+        } else if (strncmp(argv[i], "--import-threads=", 17) == 0) {
+            long threads = strtol(argv[i] + 17, NULL, 10);
+            if (threads < 0) {
+                usage();
+                exit(64);
+            }
+            importThreads = (int)threads;
+        } else if (strncmp(argv[i], "--gc-parallel-heap=", 19) == 0) {
+            long size = strtol(argv[i] + 19, NULL, 10);
+            if (size < 0) {
+                usage();
+                exit(64);
+            }
+            parallelHeap = (size_t)size;
+        } else if (strncmp(argv[i], "--gc-grow-factor=", 17) == 0) {
+            double factor = strtod(argv[i] + 17, NULL);
+            if (factor <= 1) {
+                usage();
+                exit(64);
+            }
+            setHeapGrowFactor(factor);
+        } else if (strcmp(argv[i], "--gc-stats") == 0) {
+            gcStats = true;
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            vm->bytecodeCache = false;
+        } else if (strcmp(argv[i], "--no-jit") == 0) {
+            vm->jit = false;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profile = PROFILE_CALLS | PROFILE_SAMPLES;
+        } else if (strcmp(argv[i], "--profile=calls") == 0) {
+            profile = PROFILE_CALLS;
+        } else if (strcmp(argv[i], "--profile=samples") == 0) {
+            profile = PROFILE_SAMPLES;
+        } else if (strncmp(argv[i], "--profile-output=", 17) == 0 && argv[i][17] != '\0') {
+            profileOutput = argv[i] + 17;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot = argv[++i];
+        } else if (strcmp(argv[i], "--from-snapshot") == 0 && i + 1 < argc) {
+            fromSnapshot = argv[++i];
+        } else if (path == NULL && command == NULL
+                && (strcmp(argv[i], "compile") == 0 || strcmp(argv[i], "run") == 0)) {
+            command = argv[i];
+        } else if (path == NULL && strncmp(argv[i], "--", 2) != 0) {
+            path = argv[i];
+        } else {
+            usage();
+            exit(64);
         }
-        runFile(argv[1]);
-    } else {
-        fprintf(stderr, "Usage: cslo [path] [--version]\n");
+    }
+
+    if ((command != NULL && path == NULL) || (output != NULL && (command == NULL || strcmp(command, "compile") != 0))
+            || (snapshot != NULL && (path == NULL || command != NULL))
+            || (fromSnapshot != NULL && (path != NULL || command != NULL || snapshot != NULL))) {
+        usage();
         exit(64);
     }
 
+    if ((path != NULL || fromSnapshot != NULL) && !isatty(STDOUT_FILENO)) {
+        // output going to a pipe or file is written a block at a time
+        static char stdoutBuffer[FILE_BUFFER_SIZE];
+        setvbuf(stdout, stdoutBuffer, _IOFBF, sizeof(stdoutBuffer));
+    }
+
+    setGCMode(gcMode, nurserySize);
+    setGCThreads(gcThreads, parallelHeap);
+    vm->importThreads = importThreads;
+    if (profile != 0) {
+        startProfiler(profile);
+    }
+
+    int exitCode = 0;
+    if (fromSnapshot != NULL) {
+        exitCode = runSnapshot(fromSnapshot);
+    } else if (path == NULL) {
+        repl();
+    } else if (snapshot != NULL) {
+        exitCode = snapshotFile(path, snapshot);
+    } else if (command == NULL) {
+        exitCode = runFile(path);
+    } else if (strcmp(command, "compile") == 0) {
+        exitCode = compileFile(path, output);
+    } else {
+        exitCode = runBundle(path);
+    }
+
+    if (gcStats) {
+        printGCStats(stderr);
+    }
+
+    if (profile != 0) {
+        writeProfile(stderr, profileOutput);
+    }
+
+#ifdef SLO_OPCODE_STATS
+    writeOpcodeStats(stderr);
+#endif
+
+    if (exitCode != 0) {
+        exit(exitCode);
+    }
+
     freeVM();
 
     return 0;
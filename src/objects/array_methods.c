@@ -0,0 +1,319 @@
+/**
+ * @file array_methods.c
+ * @brief Implementation of typed array methods in CSLO.
+ *
+ * The bulk operations are written as plain loops over the raw buffers
+ * so that the compiler can vectorise them.
+ */
+
+#include <stdlib.h>
+
+#include "builtins/util.h"
+#include "core/memory.h"
+#include "core/object.h"
+#include "core/table.h"
+#include "core/value.h"
+#include "core/vm.h"
+#include "objects/array_methods.h"
+#include "std/math.h"
+
+static Value arraySum(int argCount, Value* args, ParamInfo* params);
+static Value arrayMin(int argCount, Value* args, ParamInfo* params);
+static Value arrayMax(int argCount, Value* args, ParamInfo* params);
+static Value arrayDot(int argCount, Value* args, ParamInfo* params);
+static Value arrayAdd(int argCount, Value* args, ParamInfo* params);
+static Value arraySub(int argCount, Value* args, ParamInfo* params);
+static Value arrayMul(int argCount, Value* args, ParamInfo* params);
+static Value arrayDiv(int argCount, Value* args, ParamInfo* params);
+static Value arrayFill(int argCount, Value* args, ParamInfo* params);
+static Value arraySort(int argCount, Value* args, ParamInfo* params);
+static Value arrayToList(int argCount, Value* args, ParamInfo* params);
+
+/**
+ * The typed array methods, each one created the first time it's looked up.
+ */
+static NativeDef arrayNatives[] = {
+    {"sum", arraySum, 1, 1, {{"self", true}}},
+    {"min", arrayMin, 1, 1, {{"self", true}}},
+    {"max", arrayMax, 1, 1, {{"self", true}}},
+    {"dot", arrayDot, 2, 2, {{"self", true}, {"other", true}}},
+    {"add", arrayAdd, 2, 2, {{"self", true}, {"other", true}}},
+    {"sub", arraySub, 2, 2, {{"self", true}, {"other", true}}},
+    {"mul", arrayMul, 2, 2, {{"self", true}, {"other", true}}},
+    {"div", arrayDiv, 2, 2, {{"self", true}, {"other", true}}},
+    {"fill", arrayFill, 2, 2, {{"self", true}, {"value", true}}},
+    {"sort", arraySort, 1, 1, {{"self", true}}},
+    {"tolist", arrayToList, 1, 1, {{"self", true}}},
+    {NULL}
+};
+
+/**
+ * @brief Registers typed array methods for the given ObjClass.
+ * @param cls The ObjClass representing the array type.
+ */
+void registerArrayMethods(ObjClass* cls) {
+    cls->natives = arrayNatives;
+}
+
+/**
+ * @enum ElementOp
+ *
+ * The elementwise arithmetic operations.
+ */
+typedef enum ElementOp {
+    ELEMENT_ADD,
+    ELEMENT_SUB,
+    ELEMENT_MUL,
+    ELEMENT_DIV
+} ElementOp;
+
+// loops for combining two buffers, or a buffer and a scalar, with the given operator
+#define ARRAY_LOOP(out, a, b, count, op)                                    \
+    for (int i = 0; i < (count); i++) {                                     \
+        (out)[i] = (a)[i] op (b)[i];                                        \
+    }
+
+#define SCALAR_LOOP(out, a, scalar, count, op)                              \
+    for (int i = 0; i < (count); i++) {                                     \
+        (out)[i] = (a)[i] op (scalar);                                      \
+    }
+
+#define ELEMENTWISE(loop, out, a, b, count, op)                             \
+    switch (op) {                                                           \
+        case ELEMENT_ADD: loop(out, a, b, count, +); break;                 \
+        case ELEMENT_SUB: loop(out, a, b, count, -); break;                 \
+        case ELEMENT_MUL: loop(out, a, b, count, *); break;                 \
+        case ELEMENT_DIV: loop(out, a, b, count, /); break;                 \
+    }
+
+/**
+ * Applies an elementwise operation to the array and either another array
+ * of the same type and length, or a number.
+ * The result is a new array of the same type.
+ */
+static Value elementwise(int argCount, Value* args, ElementOp op, const char* error) {
+    if (argCount != 2 || !IS_ARRAY(args[0]) || !(IS_ARRAY(args[1]) || IS_NUMBER(args[1]))) {
+        return ERROR_VAL_PTR(error);
+    }
+    ObjArray* array = AS_ARRAY(args[0]);
+    ObjArray* other = IS_ARRAY(args[1]) ? AS_ARRAY(args[1]) : NULL;
+    if (other != NULL && (other->type != array->type || other->count != array->count)) {
+        return nativeError("Arrays must have the same type and length.");
+    }
+
+    if (array->type == ARRAY_I64 && op == ELEMENT_DIV) {
+        // integer division by zero is undefined, so check up front
+        if (other == NULL && (int64_t)AS_NUMBER(args[1]) == 0) {
+            return nativeError("Division by zero.");
+        }
+        for (int i = 0; other != NULL && i < other->count; i++) {
+            if (other->as.i64[i] == 0) {
+                return nativeError("Division by zero.");
+            }
+        }
+    }
+
+    ObjArray* result = newArray(array->type, array->count);
+    int count = array->count;
+    if (array->type == ARRAY_F64) {
+        double* restrict out = result->as.f64;
+        const double* restrict a = array->as.f64;
+        if (other != NULL) {
+            const double* restrict b = other->as.f64;
+            ELEMENTWISE(ARRAY_LOOP, out, a, b, count, op);
+        } else {
+            double scalar = AS_NUMBER(args[1]);
+            ELEMENTWISE(SCALAR_LOOP, out, a, scalar, count, op);
+        }
+    } else {
+        int64_t* restrict out = result->as.i64;
+        const int64_t* restrict a = array->as.i64;
+        if (other != NULL) {
+            const int64_t* restrict b = other->as.i64;
+            ELEMENTWISE(ARRAY_LOOP, out, a, b, count, op);
+        } else {
+            int64_t scalar = (int64_t)AS_NUMBER(args[1]);
+            ELEMENTWISE(SCALAR_LOOP, out, a, scalar, count, op);
+        }
+    }
+    return OBJ_VAL(result);
+}
+
+/**
+ * Adds a number, or the elements of another array, to each element.
+ */
+static Value arrayAdd(int argCount, Value* args, ParamInfo* params) {
+    return elementwise(argCount, args, ELEMENT_ADD, "add() must be called on an array with an array or number.");
+}
+
+/**
+ * Subtracts a number, or the elements of another array, from each element.
+ */
+static Value arraySub(int argCount, Value* args, ParamInfo* params) {
+    return elementwise(argCount, args, ELEMENT_SUB, "sub() must be called on an array with an array or number.");
+}
+
+/**
+ * Multiplies each element by a number, or the elements of another array.
+ */
+static Value arrayMul(int argCount, Value* args, ParamInfo* params) {
+    return elementwise(argCount, args, ELEMENT_MUL, "mul() must be called on an array with an array or number.");
+}
+
+/**
+ * Divides each element by a number, or the elements of another array.
+ * Integer arrays use integer division.
+ */
+static Value arrayDiv(int argCount, Value* args, ParamInfo* params) {
+    return elementwise(argCount, args, ELEMENT_DIV, "div() must be called on an array with an array or number.");
+}
+
+/**
+ * Adds up the elements of the array.
+ * Doubles are summed pairwise, see sumDoubles in the math module.
+ */
+static Value arraySum(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_ARRAY(args[0])) {
+        return nativeError("sum() must be called on an array.");
+    }
+    ObjArray* array = AS_ARRAY(args[0]);
+    if (array->type == ARRAY_I64) {
+        int64_t total = 0;
+        for (int i = 0; i < array->count; i++) {
+            total += array->as.i64[i];
+        }
+        return NUMBER_VAL((double)total);
+    }
+
+    return NUMBER_VAL(sumDoubles(array->as.f64, array->count));
+}
+
+/**
+ * Finds the smallest or largest element of a non-empty array.
+ */
+static Value extreme(int argCount, Value* args, bool largest, const char* error) {
+    if (argCount != 1 || !IS_ARRAY(args[0])) {
+        return ERROR_VAL_PTR(error);
+    }
+    ObjArray* array = AS_ARRAY(args[0]);
+    if (array->count == 0) {
+        return nativeError("Array is empty.");
+    }
+
+    if (array->type == ARRAY_I64) {
+        int64_t best = array->as.i64[0];
+        for (int i = 1; i < array->count; i++) {
+            int64_t value = array->as.i64[i];
+            best = (largest ? value > best : value < best) ? value : best;
+        }
+        return NUMBER_VAL((double)best);
+    }
+
+    double best = array->as.f64[0];
+    for (int i = 1; i < array->count; i++) {
+        double value = array->as.f64[i];
+        best = (largest ? value > best : value < best) ? value : best;
+    }
+    return NUMBER_VAL(best);
+}
+
+/**
+ * Gets the smallest element of the array.
+ */
+static Value arrayMin(int argCount, Value* args, ParamInfo* params) {
+    return extreme(argCount, args, false, "min() must be called on an array.");
+}
+
+/**
+ * Gets the largest element of the array.
+ */
+static Value arrayMax(int argCount, Value* args, ParamInfo* params) {
+    return extreme(argCount, args, true, "max() must be called on an array.");
+}
+
+/**
+ * Works out the dot product with another array of the same type and length.
+ */
+static Value arrayDot(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 2 || !IS_ARRAY(args[0]) || !IS_ARRAY(args[1])) {
+        return nativeError("dot() must be called on an array with another array.");
+    }
+    ObjArray* a = AS_ARRAY(args[0]);
+    ObjArray* b = AS_ARRAY(args[1]);
+    if (a->type != b->type || a->count != b->count) {
+        return nativeError("Arrays must have the same type and length.");
+    }
+
+    if (a->type == ARRAY_I64) {
+        int64_t total = 0;
+        for (int i = 0; i < a->count; i++) {
+            total += a->as.i64[i] * b->as.i64[i];
+        }
+        return NUMBER_VAL((double)total);
+    }
+
+    return NUMBER_VAL(dotDoubles(a->as.f64, b->as.f64, a->count));
+}
+
+/**
+ * Sets every element of the array to the given number.
+ * Returns the array so calls can be chained.
+ */
+static Value arrayFill(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 2 || !IS_ARRAY(args[0]) || !IS_NUMBER(args[1])) {
+        return nativeError("fill() must be called on an array with a number.");
+    }
+    ObjArray* array = AS_ARRAY(args[0]);
+    for (int i = 0; i < array->count; i++) {
+        arraySet(array, i, AS_NUMBER(args[1]));
+    }
+    return args[0];
+}
+
+/**
+ * Comparison functions for sorting the raw buffers with qsort.
+ */
+static int compareF64(const void* a, const void* b) {
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+static int compareI64(const void* a, const void* b) {
+    int64_t ia = *(const int64_t*)a;
+    int64_t ib = *(const int64_t*)b;
+    return (ia > ib) - (ia < ib);
+}
+
+/**
+ * Sorts the array in place, in ascending order.
+ */
+static Value arraySort(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_ARRAY(args[0])) {
+        return nativeError("sort() must be called on an array.");
+    }
+    ObjArray* array = AS_ARRAY(args[0]);
+    if (array->type == ARRAY_F64) {
+        qsort(array->as.f64, array->count, sizeof(double), compareF64);
+    } else {
+        qsort(array->as.i64, array->count, sizeof(int64_t), compareI64);
+    }
+    return NIL_VAL;
+}
+
+/**
+ * Creates a list holding the array's elements as numbers.
+ */
+static Value arrayToList(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_ARRAY(args[0])) {
+        return nativeError("tolist() must be called on an array.");
+    }
+    ObjArray* array = AS_ARRAY(args[0]);
+    ObjList* list = newListWithCapacity(array->count);
+    for (int i = 0; i < array->count; i++) {
+        list->values.values[i] = NUMBER_VAL(arrayGet(array, i));
+    }
+    list->count = array->count;
+    list->values.count = array->count;
+    return OBJ_VAL(list);
+}
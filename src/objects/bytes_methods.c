@@ -0,0 +1,263 @@
+/**
+ * @file bytes_methods.c
+ * @brief Implementation of bytes methods in CSLO.
+ *
+ * Bytes are mutable buffers of raw octets. pack() and unpack() read and write
+ * fixed-width integers and floats at an offset, byte by byte, so the result is
+ * the same whatever the host's endianness.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "builtins/util.h"
+#include "core/gc.h"
+#include "core/memory.h"
+#include "core/object.h"
+#include "core/value.h"
+#include "core/vm.h"
+#include "objects/bytes_methods.h"
+
+static Value bytesAppendNative(int argCount, Value* args, ParamInfo* params);
+static Value bytesPack(int argCount, Value* args, ParamInfo* params);
+static Value bytesUnpack(int argCount, Value* args, ParamInfo* params);
+static Value bytesDecode(int argCount, Value* args, ParamInfo* params);
+static Value bytesToList(int argCount, Value* args, ParamInfo* params);
+
+/**
+ * The bytes methods, each one created the first time it's looked up.
+ */
+static NativeDef bytesNatives[] = {
+    {"append", bytesAppendNative, 2, 2, {{"self", true}, {"byte", true}}},
+    {"pack", bytesPack, 4, 4, {{"self", true}, {"format", true}, {"offset", true}, {"value", true}}},
+    {"unpack", bytesUnpack, 3, 3, {{"self", true}, {"format", true}, {"offset", true}}},
+    {"decode", bytesDecode, 1, 1, {{"self", true}}},
+    {"tolist", bytesToList, 1, 1, {{"self", true}}},
+    {NULL}
+};
+
+/**
+ * @brief Registers bytes methods for the given ObjClass.
+ * @param cls The ObjClass representing the bytes type.
+ */
+void registerBytesMethods(ObjClass* cls) {
+    cls->natives = bytesNatives;
+}
+
+void bytesAppend(ObjBytes* bytes, uint8_t byte) {
+    if (bytes->capacity < bytes->count + 1) {
+        int oldCapacity = bytes->capacity;
+        bytes->capacity = GROW_CAPACITY(oldCapacity);
+        bytes->data = GROW_ARRAY(uint8_t, bytes->data, oldCapacity, bytes->capacity);
+    }
+    bytes->data[bytes->count++] = byte;
+}
+
+/**
+ * @struct PackFormat
+ *
+ * A parsed pack() / unpack() format such as "<u32" or ">f64".
+ */
+typedef struct PackFormat {
+    int width;
+    bool isSigned;
+    bool isFloat;
+    bool bigEndian;
+} PackFormat;
+
+/**
+ * Method for parsing a pack format: an optional '<' (little endian, the default)
+ * or '>' (big endian), followed by one of u8, i8, u16, i16, u32, i32, u64, i64,
+ * f32 or f64.
+ */
+static bool parseFormat(Value value, PackFormat* format) {
+    if (!IS_STRING(value)) {
+        return false;
+    }
+    ObjString* string = AS_STRING(value);
+    const char* chars = string->chars;
+    int length = string->length;
+
+    format->bigEndian = false;
+    if (length > 0 && (chars[0] == '<' || chars[0] == '>')) {
+        format->bigEndian = chars[0] == '>';
+        chars++;
+        length--;
+    }
+    if (length < 2 || (chars[0] != 'u' && chars[0] != 'i' && chars[0] != 'f')) {
+        return false;
+    }
+    format->isFloat = chars[0] == 'f';
+    format->isSigned = chars[0] != 'u';
+
+    int bits = 0;
+    for (int i = 1; i < length; i++) {
+        if (chars[i] < '0' || chars[i] > '9' || bits > 64) {
+            return false;
+        }
+        bits = bits * 10 + (chars[i] - '0');
+    }
+    format->width = bits / 8;
+    if (format->isFloat) {
+        return bits == 32 || bits == 64;
+    }
+    return bits == 8 || bits == 16 || bits == 32 || bits == 64;
+}
+
+/**
+ * Method for checking an offset is a whole number with room for width bytes after it.
+ */
+static bool checkOffset(ObjBytes* bytes, Value value, int width, int* offset) {
+    if (!IS_NUMBER(value)) {
+        return false;
+    }
+    double number = AS_NUMBER(value);
+    if (!(number >= 0 && number <= bytes->count - width) || number != (int)number) {
+        return false;
+    }
+    *offset = (int)number;
+    return true;
+}
+
+/**
+ * append native method.
+ * Appends a byte (0 to 255) to the end of the bytes.
+ */
+static Value bytesAppendNative(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 2 || !IS_BYTES(args[0])) {
+        return nativeError("append() must be called on bytes with a byte.");
+    }
+    if (!IS_NUMBER(args[1]) || AS_NUMBER(args[1]) < 0 || AS_NUMBER(args[1]) > 255
+            || AS_NUMBER(args[1]) != (int)AS_NUMBER(args[1])) {
+        return nativeError("append() expects a whole number from 0 to 255.");
+    }
+    bytesAppend(AS_BYTES(args[0]), (uint8_t)AS_NUMBER(args[1]));
+    return args[0];
+}
+
+/**
+ * pack native method.
+ * Writes a number at the offset in the given format, returning the offset after it.
+ */
+static Value bytesPack(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 4 || !IS_BYTES(args[0])) {
+        return nativeError("pack() must be called on bytes with a format, offset and value.");
+    }
+    PackFormat format;
+    if (!parseFormat(args[1], &format)) {
+        return nativeError("pack() format must be one of u8, i8, u16, i16, u32, i32, u64, i64, f32 or f64.");
+    }
+    ObjBytes* bytes = AS_BYTES(args[0]);
+    int offset;
+    if (!checkOffset(bytes, args[2], format.width, &offset)) {
+        return nativeError("pack() offset is out of bounds.");
+    }
+    if (!IS_NUMBER(args[3])) {
+        return nativeError("pack() value must be a number.");
+    }
+    double number = AS_NUMBER(args[3]);
+
+    uint64_t bits;
+    if (format.isFloat && format.width == 4) {
+        float single = (float)number;
+        uint32_t singleBits;
+        memcpy(&singleBits, &single, sizeof(singleBits));
+        bits = singleBits;
+    } else if (format.isFloat) {
+        memcpy(&bits, &number, sizeof(bits));
+    } else {
+        // the range a width-byte integer can hold, as doubles so 64 bit ones compare exactly
+        double limit = format.width == 8 ? 18446744073709551616.0 : (double)((uint64_t)1 << (format.width * 8));
+        double low = format.isSigned ? -limit / 2 : 0;
+        double high = format.isSigned ? limit / 2 : limit;
+        if (!(number >= low && number < high)) {
+            return nativeError("pack() value is out of range for the format.");
+        }
+        bits = number < 0 ? (uint64_t)(int64_t)number : (uint64_t)number;
+        if ((number < 0 ? (double)(int64_t)bits : (double)bits) != number) {
+            return nativeError("pack() value must be a whole number.");
+        }
+    }
+
+    for (int i = 0; i < format.width; i++) {
+        int index = format.bigEndian ? format.width - 1 - i : i;
+        bytes->data[offset + index] = (uint8_t)(bits >> (8 * i));
+    }
+    return NUMBER_VAL(offset + format.width);
+}
+
+/**
+ * unpack native method.
+ * Reads a number from the offset in the given format.
+ */
+static Value bytesUnpack(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 3 || !IS_BYTES(args[0])) {
+        return nativeError("unpack() must be called on bytes with a format and offset.");
+    }
+    PackFormat format;
+    if (!parseFormat(args[1], &format)) {
+        return nativeError("unpack() format must be one of u8, i8, u16, i16, u32, i32, u64, i64, f32 or f64.");
+    }
+    ObjBytes* bytes = AS_BYTES(args[0]);
+    int offset;
+    if (!checkOffset(bytes, args[2], format.width, &offset)) {
+        return nativeError("unpack() offset is out of bounds.");
+    }
+
+    uint64_t bits = 0;
+    for (int i = 0; i < format.width; i++) {
+        int index = format.bigEndian ? format.width - 1 - i : i;
+        bits |= (uint64_t)bytes->data[offset + index] << (8 * i);
+    }
+
+    if (format.isFloat) {
+        double number;
+        if (format.width == 4) {
+            uint32_t singleBits = (uint32_t)bits;
+            float single;
+            memcpy(&single, &singleBits, sizeof(single));
+            number = (double)single;
+        } else {
+            memcpy(&number, &bits, sizeof(number));
+        }
+        // the bytes can hold a NaN with any sign and payload, a number is only ever the one NaN
+        return NUMBER_VAL(isnan(number) ? NAN : number);
+    }
+    if (format.isSigned && format.width < 8 && (bits >> (format.width * 8 - 1)) & 1) {
+        // sign extend
+        bits |= ~(uint64_t)0 << (format.width * 8);
+    }
+    return NUMBER_VAL(format.isSigned ? (double)(int64_t)bits : (double)bits);
+}
+
+/**
+ * decode native method.
+ * Returns the bytes as a string.
+ */
+static Value bytesDecode(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_BYTES(args[0])) {
+        return nativeError("decode() must be called on bytes.");
+    }
+    ObjBytes* bytes = AS_BYTES(args[0]);
+    return OBJ_VAL(copyString((const char*)bytes->data, bytes->count));
+}
+
+/**
+ * tolist native method.
+ * Returns the bytes as a list of numbers.
+ */
+static Value bytesToList(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_BYTES(args[0])) {
+        return nativeError("tolist() must be called on bytes.");
+    }
+    ObjBytes* bytes = AS_BYTES(args[0]);
+    ObjList* list = newList();
+    push(OBJ_VAL(list));
+    for (int i = 0; i < bytes->count; i++) {
+        writeValueArray(&list->values, NUMBER_VAL(bytes->data[i]));
+    }
+    list->count = list->values.count;
+    pop();
+    return OBJ_VAL(list);
+}
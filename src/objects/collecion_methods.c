@@ -8,9 +8,11 @@
 #include <string.h>
 
 #include "builtins/util.h"
+#include "core/gc.h"
 #include "core/object.h"
 #include "core/table.h"
 #include "core/value.h"
+#include "core/vm.h"
 
 #include "objects/collection_methods.h"
 
@@ -21,15 +23,23 @@ Value clearNative(int argCount, Value* args, ParamInfo* params);
 Value popNative(int argCount, Value *args, ParamInfo* params);
 Value cloneNative(int argCount, Value* args, ParamInfo* params);
 
+/**
+ * The container methods, each one created the first time it's looked up.
+ */
+static NativeDef containerNatives[] = {
+    {"__index__", internalIndexNative, 2, 2, {{"self", true}, {"index", true}}},
+    {"clear", clearNative, 1, 1, {{"self", true}}},
+    {"pop", popNative, 1, 1, {{"self", true}}},
+    {"clone", cloneNative, 1, 1, {{"self", true}}},
+    {NULL}
+};
+
 /**
  * @brief Registers Container methods for the given ObjClass.
  * @param cls The ObjClass representing the string type.
  */
 void registerContainerMethods(ObjClass* cls) {
-    defineBuiltIn(&cls->methods, "__index__", internalIndexNative, 2, 2, PARAMS({copyString("self", 4), true}, {copyString("index", 5), true}));
-    defineBuiltIn(&cls->methods, "clear", clearNative, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "pop", popNative, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "clone", cloneNative, 1, 1, PARAMS({copyString("self", 4), true}));
+    cls->natives = containerNatives;
 }
 
 
@@ -40,7 +50,7 @@ void registerContainerMethods(ObjClass* cls) {
  */
 Value internalIndexNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 2 || !IS_CONTAINER(args[0]) || !IS_NUMBER(args[1])) {
-        return ERROR_VAL_PTR("Invalid arguments for __index__(). Expected a container and a number.");
+        return nativeError("Invalid arguments for __index__(). Expected a container and a number.");
     }
     switch (OBJ_TYPE(args[0])) {
         case OBJ_LIST: {
@@ -52,7 +62,7 @@ Value internalIndexNative(int argCount, Value* args, ParamInfo* params) {
             int idx = (int)AS_NUMBER(args[1]);
             ObjDict* dict = AS_DICT(args[0]);
             int found = 0;
-            for (int i = 0; i < dict->data.capacity; i++) {
+            for (int i = 0; i < dict->data.entryCount; i++) {
                 Entry* entry = &dict->data.entries[i];
                 if (!IS_EMPTY(entry->key) && !IS_NIL(entry->value)) {
                     if (found == idx) {
@@ -75,13 +85,20 @@ Value internalIndexNative(int argCount, Value* args, ParamInfo* params) {
  */
 Value clearNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_CONTAINER(args[0])) {
-        return ERROR_VAL_PTR("clear() must be called on a container.");
+        return nativeError("clear() must be called on a container.");
     }
 
     switch (OBJ_TYPE(args[0]))
     {
     case OBJ_LIST:
         ObjList* list = AS_LIST(args[0]);
+        if (list->storage != NULL) {
+            // nothing to copy, just stop sharing
+            list->storage = NULL;
+            initValueArray(&list->values);
+            list->count = 0;
+            break;
+        }
         // Set all elements to NIL_VAL to avoid holding references
         for (int i = 0; i < list->count; i++) {
             list->values.values[i] = NIL_VAL;
@@ -107,18 +124,24 @@ Value clearNative(int argCount, Value* args, ParamInfo* params) {
  */
 Value popNative(int argCount, Value *args, ParamInfo* params) {
     if (argCount == 0 || !IS_CONTAINER(args[0])) {
-        return ERROR_VAL_PTR("pop() must be called on a container.");
+        return nativeError("pop() must be called on a container.");
     }
     switch (OBJ_TYPE(args[0])) {
         case OBJ_LIST:
             if (argCount != 1) {
-                return ERROR_VAL_PTR("pop() must be called on a list with no arguments.");
+                return nativeError("pop() must be called on a list with no arguments.");
             }
             ObjList* list = AS_LIST(args[0]);
             if (list->count == 0) {
                 return NIL_VAL;
             }
             Value val = list->values.values[list->count - 1];
+            if (list->storage != NULL) {
+                // the shared values can't be written to, but dropping the last one is just a shorter view of them
+                list->count--;
+                list->values.count = list->count;
+                return val;
+            }
             list->values.values[list->count - 1] = NIL_VAL; // Clear the popped value
             if (list->values.capacity > 8 && list->count < list->values.capacity / 4) {
                 shrinkValueArray(&list->values);
@@ -128,7 +151,7 @@ Value popNative(int argCount, Value *args, ParamInfo* params) {
             return val;
         case OBJ_DICT:
             if (argCount < 2) {
-                return ERROR_VAL_PTR("pop() must be called on a dict with the key to pop.");
+                return nativeError("pop() must be called on a dict with the key to pop.");
             }
             ObjDict* dict = AS_DICT(args[0]);
             if (dict->data.count == 0) {
@@ -146,11 +169,11 @@ Value popNative(int argCount, Value *args, ParamInfo* params) {
                     // if a default value is provided, return it
                     return args[2];
                 }
-                return ERROR_VAL_PTR("Key not found in dict and no default provided.");
+                return nativeError("Key not found in dict and no default provided.");
             }
             return NIL_VAL;
         default:
-            return ERROR_VAL_PTR("pop() must be called on a container.");
+            return nativeError("pop() must be called on a container.");
     }
 }
 
@@ -160,31 +183,36 @@ Value popNative(int argCount, Value *args, ParamInfo* params) {
  */
 Value cloneNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_CONTAINER(args[0])) {
-        printf("clone() must be called on a container.\n");
-        return ERROR_VAL;
+        return nativeError("clone() must be called on a container.");
     }
     switch (OBJ_TYPE(args[0])) {
     case OBJ_LIST:
         ObjList* list = AS_LIST(args[0]);
-        ObjList* clone = newList();
-        if (list->count > 0) {
-            while (clone->values.capacity < list->count) {
-                growValueArray(&clone->values);
-            }
-            // copying memory blocks is faster than copying each element
-            memcpy(clone->values.values, list->values.values, sizeof(Value) * list->count);
-            clone->count = list->count;
-            clone->values.count = clone->count;
+        if (list->count >= LIST_SHARE_MIN) {
+            // long lists share their values with the clone until one of them is written to
+            return OBJ_VAL(shareList(list, 0, list->count));
         }
+        ObjList* clone = newListWithCapacity(list->count);
+        push(OBJ_VAL(clone));
+        // copying memory blocks is faster than copying each element
+        copyValues(clone->values.values, list->values.values, list->count);
+        clone->count = list->count;
+        clone->values.count = clone->count;
+        // it may have been promoted while allocating, before its elements were copied in
+        rememberObject((Obj*)clone);
+        pop();
         return OBJ_VAL(clone);
     case OBJ_DICT:
         ObjDict* dict = AS_DICT(args[0]);
         ObjDict* cloneD = newDict();
+        push(OBJ_VAL(cloneD));
         if (dict->data.count > 0) {
             // ensure the clone has enough capacity
             tableAddAll(&dict->data, &cloneD->data);
             cloneD->data.count = dict->data.count;
         }
+        rememberObject((Obj*)cloneD);
+        pop();
         return OBJ_VAL(cloneD);
     default:
         return NIL_VAL;
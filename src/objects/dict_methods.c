@@ -8,12 +8,16 @@
 #include <string.h>
 
 #include "builtins/util.h"
+#include "core/gc.h"
 #include "core/memory.h"
 #include "core/object.h"
 #include "core/table.h"
 #include "core/value.h"
+#include "core/vm.h"
 #include "objects/dict_methods.h"
 
+// the most a dict can be reserved for, so its index still fits in an int
+#define DICT_MAX_RESERVE (1 << 29)
 
 // forward declarations of native functions
 Value keysNative(int argCount, Value* args, ParamInfo* params);
@@ -21,62 +25,50 @@ Value valuesNative(int argCount, Value* args, ParamInfo* params);
 Value getNative(int argCount, Value* args, ParamInfo* params);
 Value updateNative(int argCount, Value* args, ParamInfo* params);
 Value itemsNative(int argCount, Value* args, ParamInfo* params);
+static Value dictReserveNative(int argCount, Value* args, ParamInfo* params);
 
 
+/**
+ * The dict methods, each one created the first time it's looked up.
+ */
+static NativeDef dictNatives[] = {
+    {"keys", keysNative, 1, 1, {{"self", true}}},
+    {"values", valuesNative, 1, 1, {{"self", true}}},
+    {"get", getNative, 2, 3, {{"self", true}, {"key", true}, {"default", false}}},
+    {"update", updateNative, 2, 2, {{"self", true}, {"other", true}}},
+    {"items", itemsNative, 1, 1, {{"self", true}}},
+    {"reserve", dictReserveNative, 2, 2, {{"self", true}, {"count", true}}},
+    {NULL}
+};
+
 /**
  * @brief Registers dict methods for the given ObjClass.
  * @param dictClass The ObjClass representing the string type.
  */
 void registerDictMethods(ObjClass* cls) {
-    defineBuiltIn(&cls->methods, "keys", keysNative, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "values", valuesNative, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "get", getNative, 2, 3, PARAMS({copyString("self", 4), true}, {copyString("key", 3), true}, {copyString("default", 7), false}));
-    defineBuiltIn(&cls->methods, "update", updateNative, 2, 2, PARAMS({copyString("self", 4), true}, {copyString("other", 6), true}));
-    defineBuiltIn(&cls->methods, "items", itemsNative, 1, 1, PARAMS({copyString("self", 4), true}));
+    cls->natives = dictNatives;
 }
 
 /**
  * keys native function.
- * Returns the keys of a dictionary as a list.
+ * Returns a view of the keys of a dictionary.
  */
 Value keysNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_DICT(args[0])) {
-        return ERROR_VAL_PTR("keys() must be called on a dict.");
-    }
-    ObjDict* dict = AS_DICT(args[0]);
-    ObjList* keys = newList();
-    for (int i = 0; i < dict->data.capacity; i++) {
-        Entry* entry = &dict->data.entries[i];
-        if (!IS_EMPTY(entry->key) && !IS_NIL(entry->value)) {
-            if (keys->count >= keys->values.capacity) {
-                growValueArray(&keys->values);
-            }
-            keys->values.values[keys->count++] = entry->key;
-        }
+        return nativeError("keys() must be called on a dict.");
     }
-    return OBJ_VAL(keys);
+    return OBJ_VAL(newDictView(AS_DICT(args[0]), VIEW_KEYS));
 }
 
 /**
  * values native function.
- * Returns the values of a dictionary as a list.
+ * Returns a view of the values of a dictionary.
  */
 Value valuesNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_DICT(args[0])) {
-        return ERROR_VAL_PTR("values() must be called on a dict.");
+        return nativeError("values() must be called on a dict.");
     }
-    ObjDict* dict = AS_DICT(args[0]);
-    ObjList* values = newList();
-    for (int i = 0; i < dict->data.capacity; i++) {
-        Entry* entry = &dict->data.entries[i];
-        if (!IS_EMPTY(entry->key) && !IS_NIL(entry->value)) {
-            if (values->count >= values->values.capacity) {
-                growValueArray(&values->values);
-            }
-            values->values.values[values->count++] = entry->value;
-        }
-    }
-    return OBJ_VAL(values);
+    return OBJ_VAL(newDictView(AS_DICT(args[0]), VIEW_VALUES));
 }
 
 /**
@@ -87,7 +79,7 @@ Value valuesNative(int argCount, Value* args, ParamInfo* params) {
  */
 Value getNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount < 2 || !IS_DICT(args[0])) {
-        return ERROR_VAL_PTR("get() must be called on a dict with a key.");
+        return nativeError("get() must be called on a dict with a key.");
     }
     ObjDict* dict = AS_DICT(args[0]);
     Value key = args[1];
@@ -111,12 +103,14 @@ Value getNative(int argCount, Value* args, ParamInfo* params) {
  */
 Value updateNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 2 || !IS_DICT(args[0]) || !IS_DICT(args[1])) {
-        return ERROR_VAL_PTR("update() must be called on a dict with another dict.");
+        return nativeError("update() must be called on a dict with another dict.");
     }
     ObjDict* target = AS_DICT(args[0]);
     ObjDict* source = AS_DICT(args[1]);
 
-    for (int i = 0; i < source->data.capacity; i++) {
+    // grown once for all of them, as if none of the keys were already there
+    tableReserve(&target->data, target->data.count + source->data.count);
+    for (int i = 0; i < source->data.entryCount; i++) {
         Entry* entry = &source->data.entries[i];
         if (!IS_EMPTY(entry->key) && !IS_NIL(entry->value)) {
             // Set the key-value pair in the target dict
@@ -128,28 +122,116 @@ Value updateNative(int argCount, Value* args, ParamInfo* params) {
 
 /**
  * items native method.
- * Returns a list of key-value pairs from a dict.
+ * Returns a view of the key-value pairs of a dict.
  */
 Value itemsNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_DICT(args[0])) {
-        return ERROR_VAL_PTR("items() must be called on a dict.");
+        return nativeError("items() must be called on a dict.");
     }
-    ObjDict* dict = AS_DICT(args[0]);
-    ObjList* items = newList();
-    for (int i = 0; i < dict->data.capacity; i++) {
-        Entry* entry = &dict->data.entries[i];
-        if (!IS_EMPTY(entry->key) && !IS_NIL(entry->value)) {
-            ObjList* pair = newList();
-            growValueArray(&pair->values);
-            pair->values.values[0] = entry->key; // key
-            pair->values.values[1] = entry->value; // value
-            pair->count = 2;
-            pair->values.count = 2;
-            if (items->values.capacity < items->count + 1) {
-                growValueArray(&items->values);
-            }
-            items->values.values[items->count++] = OBJ_VAL(pair);
+    return OBJ_VAL(newDictView(AS_DICT(args[0]), VIEW_ITEMS));
+}
+
+/**
+ * reserve native function.
+ * Makes room for at least count entries so adding up to it never rehashes the dict.
+ */
+static Value dictReserveNative(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 2 || !IS_DICT(args[0]) || !IS_NUMBER(args[1])
+            || AS_NUMBER(args[1]) < 0 || AS_NUMBER(args[1]) > DICT_MAX_RESERVE) {
+        return nativeError("reserve() must be called on a dict with a non-negative count.");
+    }
+    tableReserve(&AS_DICT(args[0])->data, (int)AS_NUMBER(args[1]));
+    return NIL_VAL;
+}
+
+/**
+ * tolist native method.
+ * Copies what a dict view produces into a new list.
+ */
+static Value viewToList(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_DICT_VIEW(args[0])) {
+        return nativeError("tolist() must be called on a dict view.");
+    }
+    return OBJ_VAL(dictViewToList(AS_DICT_VIEW(args[0])));
+}
+
+/**
+ * Method for checking whether a dict view produces the given value for an entry.
+ *
+ * Pairs are compared with the entry rather than being made.
+ */
+static bool viewEntryEquals(ObjDictView* view, Entry* entry, Value value) {
+    switch (view->kind) {
+        case VIEW_KEYS:
+            return valuesEqual(entry->key, value);
+        case VIEW_VALUES:
+            return valuesEqual(entry->value, value);
+        case VIEW_ITEMS:
+            return IS_LIST(value) && AS_LIST(value)->count == 2
+                && valuesEqual(AS_LIST(value)->values.values[0], entry->key)
+                && valuesEqual(AS_LIST(value)->values.values[1], entry->value);
+    }
+    return false;
+}
+
+/**
+ * index native method.
+ * Returns the position of the first occurrence of a value in a dict view, or nil.
+ */
+static Value viewIndex(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 2 || !IS_DICT_VIEW(args[0])) {
+        return nativeError("index() must be called on a dict view with a value.");
+    }
+    ObjDictView* view = AS_DICT_VIEW(args[0]);
+    Table* table = &view->dict->data;
+    int position = 0;
+    for (int i = 0; i < table->entryCount; i++) {
+        Entry* entry = &table->entries[i];
+        if (IS_EMPTY(entry->key)) {
+            continue;
+        }
+        if (viewEntryEquals(view, entry, args[1])) {
+            return NUMBER_VAL((double)position);
         }
+        position++;
     }
-    return OBJ_VAL(items);
+    return NIL_VAL;
+}
+
+/**
+ * count native method.
+ * Returns how many times a dict view produces a value.
+ */
+static Value viewCount(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 2 || !IS_DICT_VIEW(args[0])) {
+        return nativeError("count() must be called on a dict view with a value.");
+    }
+    ObjDictView* view = AS_DICT_VIEW(args[0]);
+    Table* table = &view->dict->data;
+    int occurrences = 0;
+    for (int i = 0; i < table->entryCount; i++) {
+        Entry* entry = &table->entries[i];
+        if (!IS_EMPTY(entry->key) && viewEntryEquals(view, entry, args[1])) {
+            occurrences++;
+        }
+    }
+    return NUMBER_VAL((double)occurrences);
+}
+
+/**
+ * The dict view methods, each one created the first time it's looked up.
+ */
+static NativeDef dictViewNatives[] = {
+    {"tolist", viewToList, 1, 1, {{"self", true}}},
+    {"index", viewIndex, 2, 2, {{"self", true}, {"value", true}}},
+    {"count", viewCount, 2, 2, {{"self", true}, {"value", true}}},
+    {NULL}
+};
+
+/**
+ * @brief Registers dict view methods for the given ObjClass.
+ * @param cls The ObjClass representing the dict view type.
+ */
+void registerDictViewMethods(ObjClass* cls) {
+    cls->natives = dictViewNatives;
 }
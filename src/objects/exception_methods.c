@@ -0,0 +1,37 @@
+/**
+ * @file exception_methods.c
+ * @brief Implementation of exception methods in CSLO.
+ */
+
+#include <string.h>
+
+#include "builtins/util.h"
+
+#include "core/errors.h"
+#include "core/object.h"
+#include "core/value.h"
+#include "core/vm.h"
+
+#include "objects/exception_methods.h"
+
+// native properties
+static Value propertyMessage(Value arg);
+static Value propertyType(Value arg);
+
+/**
+ * @brief Registers the properties of caught exceptions for the given ObjClass.
+ * @param cls The ObjClass representing the exception type.
+ */
+void registerExceptionMethods(ObjClass* cls) {
+    addNativeProperty(&cls->nativeProperties, "message", propertyMessage);
+    addNativeProperty(&cls->nativeProperties, "type", propertyType);
+}
+
+static Value propertyMessage(Value arg) {
+    return OBJ_VAL(AS_ERROR(arg)->message);
+}
+
+static Value propertyType(Value arg) {
+    const char* type = errorTypeToString(AS_ERROR(arg)->type);
+    return OBJ_VAL(copyString(type, (int)strlen(type)));
+}
@@ -0,0 +1,64 @@
+/**
+ * @file fiber_methods.c
+ * @brief Implementation of fiber methods in CSLO.
+ */
+
+#include "builtins/util.h"
+#include "core/object.h"
+#include "core/value.h"
+#include "core/vm.h"
+#include "objects/fiber_methods.h"
+
+static Value fiberResume(int argCount, Value* args, ParamInfo* params);
+static Value fiberDone(int argCount, Value* args, ParamInfo* params);
+
+/**
+ * The fiber methods, each one created the first time it's looked up.
+ */
+static NativeDef fiberNatives[] = {
+    {"resume", fiberResume, 1, 2, {{"self", true}, {"value", false}}},
+    {"done", fiberDone, 1, 1, {{"self", true}}},
+    {NULL}
+};
+
+/**
+ * @brief Registers fiber methods for the given ObjClass.
+ * @param cls The ObjClass representing the fiber type.
+ */
+void registerFiberMethods(ObjClass* cls) {
+    cls->natives = fiberNatives;
+}
+
+/**
+ * resume native method.
+ * Runs the fiber until it yields or returns, and returns the value it gave.
+ * The value passed in is what yield() returns inside the fiber.
+ */
+static Value fiberResume(int argCount, Value* args, ParamInfo* params) {
+    if (argCount < 1 || !IS_FIBER(args[0])) {
+        return nativeError("resume() must be called on a fiber.");
+    }
+    ObjFiber* fiber = AS_FIBER(args[0]);
+    if (fiber->state == FIBER_RUNNING) {
+        return nativeError("resume() can't resume a fiber that's already running.");
+    } else if (fiber->state == FIBER_DONE) {
+        return nativeError("resume() can't resume a fiber that's finished.");
+    }
+
+    Value result;
+    if (!resumeFiber(fiber, argCount > 1 ? args[1] : NIL_VAL, &result)) {
+        return nativeError("resume() fiber raised an error.");
+    }
+    return result;
+}
+
+/**
+ * done native method.
+ * Returns whether the fiber has finished.
+ */
+static Value fiberDone(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_FIBER(args[0])) {
+        return nativeError("done() must be called on a fiber.");
+    }
+    return BOOL_VAL(AS_FIBER(args[0])->state == FIBER_DONE);
+}
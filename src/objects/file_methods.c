@@ -5,24 +5,32 @@
 
 #define _POSIX_C_SOURCE 200809L
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "builtins/util.h"
 
+#include "core/flusher.h"
+#include "core/gc.h"
+#include "core/memory.h"
 #include "core/object.h"
 #include "core/value.h"
+#include "core/vm.h"
 
 #include "objects/file_methods.h"
 
-#include "util.h"
 
 static Value fileRead(int argCount, Value* args, ParamInfo* params);
 static Value fileReadline(int argCount, Value* args, ParamInfo* params);
 static Value fileReadLines(int argCount, Value* args, ParamInfo* params);
+static Value fileMap(int argCount, Value* args, ParamInfo* params);
 static Value fileClose(int argCount, Value* args, ParamInfo* params);
 static Value fileWrite(int argCount, Value* args, ParamInfo* params);
 static Value fileWriteLine(int argCount, Value* args, ParamInfo* params);
@@ -31,6 +39,9 @@ static Value fileSeek(int argCount, Value* args, ParamInfo* params);
 static Value fileFlush(int argCount, Value* args, ParamInfo* params);
 static Value fileTell(int argCount, Value* args, ParamInfo* params);
 static Value fileTruncate(int argCount, Value* args, ParamInfo* params);
+static Value fileReadBytes(int argCount, Value* args, ParamInfo* params);
+static Value fileReadInto(int argCount, Value* args, ParamInfo* params);
+static Value fileWriteBytes(int argCount, Value* args, ParamInfo* params);
 
 // native properties
 static void registerNativeProperties(ObjClass* cls);
@@ -38,23 +49,34 @@ static Value propertyMode(Value arg);
 static Value propertyClosed(Value arg);
 static Value propertyName(Value arg);
 
+/**
+ * The file methods, each one created the first time it's looked up.
+ */
+static NativeDef fileNatives[] = {
+    {"read", fileRead, 1, 1, {{"self", true}}},
+    {"readline", fileReadline, 1, 1, {{"self", true}}},
+    {"readlines", fileReadLines, 1, 1, {{"self", true}}},
+    {"map", fileMap, 1, 1, {{"self", true}}},
+    {"close", fileClose, 1, 1, {{"self", true}}},
+    {"write", fileWrite, 2, 2, {{"self", true}, {"data", true}}},
+    {"writeline", fileWriteLine, 2, 2, {{"self", true}, {"line", true}}},
+    {"writelines", fileWriteLines, 2, 2, {{"self", true}, {"lines", true}}},
+    {"seek", fileSeek, 2, 2, {{"self", true}, {"offset", true}}},
+    {"flush", fileFlush, 1, 1, {{"self", true}}},
+    {"tell", fileTell, 1, 1, {{"self", true}}},
+    {"truncate", fileTruncate, 1, 1, {{"self", true}}},
+    {"readbytes", fileReadBytes, 1, 2, {{"self", true}, {"size", false}}},
+    {"readinto", fileReadInto, 2, 2, {{"self", true}, {"buffer", true}}},
+    {"writebytes", fileWriteBytes, 2, 2, {{"self", true}, {"data", true}}},
+    {NULL}
+};
+
 /**
  * @brief Registers file methods for the given ObjClass.
  * @param cls The ObjClass representing the file type.
  */
 void registerFileMethods(ObjClass* cls) {
-    defineBuiltIn(&cls->methods, "read", fileRead, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "readline", fileReadline, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "readlines", fileReadLines, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "close", fileClose, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "write", fileWrite, 2, 2, PARAMS({copyString("self", 4), true}, {copyString("data", 4), true}));
-    defineBuiltIn(&cls->methods, "writeline", fileWriteLine, 2, 2, PARAMS({copyString("self", 4), true}, {copyString("line", 4), true}));
-    defineBuiltIn(&cls->methods, "writelines", fileWriteLines, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "seek", fileSeek, 2, 2, PARAMS({copyString("self", 4), true}, {copyString("offset", 6), true}));
-    defineBuiltIn(&cls->methods, "flush", fileFlush, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "tell", fileTell, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "truncate", fileTruncate, 1, 1, PARAMS({copyString("self", 4), true}));
-
+    cls->natives = fileNatives;
     registerNativeProperties(cls);
 }
 
@@ -66,67 +88,167 @@ static void registerNativeProperties(ObjClass* cls) {
 
 static Value fileRead(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_FILE(args[0])) {
-        return ERROR_VAL_PTR("read() must be called on a file object.");
+        return nativeError("read() must be called on a file object.");
     }
 
     ObjFile* sFile = AS_FILE(args[0]);
     if (sFile->closed) {
-        return ERROR_VAL_PTR("read() called on a closed file.");
+        return nativeError("read() called on a closed file.");
     }
 
     fseek(sFile->file, 0, SEEK_END);
     long size = ftell(sFile->file);
     rewind(sFile->file);
-    char* buffer = (char*)malloc(size + 1);
+    // read straight into the string's own buffer
+    char* buffer = ALLOCATE(char, size + 1);
     size_t bytesRead = fread(buffer, 1, size, sFile->file);
     if (bytesRead != (size_t)size) {
-        free(buffer);
-        return ERROR_VAL;
+        FREE_ARRAY(char, buffer, size + 1);
+        return nativeError("read() couldn't read the whole file.");
     }
     buffer[size] = '\0';
 
-    Value result = OBJ_VAL(copyString(buffer, size));
-    free(buffer);
-    return result;
+    return OBJ_VAL(takeRuntimeString(buffer, size));
+}
+
+/**
+ * Maps the whole file into memory and returns it as a read-only string,
+ * without reading or copying it. Methods like split() and find() then
+ * work directly on the mapping, which stays valid after the file is closed.
+ */
+static Value fileMap(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_FILE(args[0])) {
+        return nativeError("map() must be called on a file object.");
+    }
+
+    ObjFile* sFile = AS_FILE(args[0]);
+    if (sFile->closed) {
+        return nativeError("map() called on a closed file.");
+    }
+    if (sFile->mode != FILE_READ) {
+        return nativeError("map() called on a file not opened in read mode.");
+    }
+
+    struct stat info;
+    if (fstat(fileno(sFile->file), &info) != 0 || !S_ISREG(info.st_mode)) {
+        return nativeError("map() can only map regular files.");
+    }
+    if (info.st_size > INT32_MAX) {
+        return nativeError("map() file is too large to map.");
+    }
+    if (info.st_size == 0) {
+        // there's nothing to map
+        return OBJ_VAL(copyString("", 0));
+    }
+
+    char* chars = (char*)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fileno(sFile->file), 0);
+    if (chars == MAP_FAILED) {
+        return nativeError("Failed to map file.");
+    }
+    return OBJ_VAL(newMappedString(chars, (int)info.st_size));
+}
+
+ObjString* readFileLine(ObjFile* file) {
+    ssize_t length = getline(&file->line, &file->lineCapacity, file->file);
+    if (length == -1) {
+        return NULL;
+    }
+    return copyRuntimeString(file->line, (int)length);
+}
+
+/**
+ * Method for writing chars to a file, through its flusher if it's written in the background.
+ */
+static bool writeFileChars(ObjFile* file, const char* chars, size_t length) {
+    if (file->flusher != NULL) {
+        return flusherWrite(file->flusher, chars, length);
+    }
+    return fwrite(chars, sizeof(char), length, file->file) == length;
+}
+
+// lines given to each writev, two iovecs apiece to stay within the usual IOV_MAX of 1024
+#define WRITE_LINES_BATCH 512
+
+// below this many bytes a line on average, copying them into the stdio buffer is quicker
+#define WRITE_LINES_MIN_AVERAGE 128
+
+/**
+ * Method for writing a list of lines straight to a file's descriptor, a batch at a time.
+ *
+ * Anything already in the stdio buffer has to be flushed first.
+ */
+static bool writeLinesVectored(ObjFile* file, ObjList* list) {
+    static char newline = '\n';
+    struct iovec iov[WRITE_LINES_BATCH * 2];
+    int fd = fileno(file->file);
+
+    for (int start = 0; start < list->count; start += WRITE_LINES_BATCH) {
+        int end = start + WRITE_LINES_BATCH < list->count ? start + WRITE_LINES_BATCH : list->count;
+        int iovCount = 0;
+        for (int i = start; i < end; i++) {
+            ObjString* str = AS_STRING(list->values.values[i]);
+            iov[iovCount].iov_base = str->chars;
+            iov[iovCount++].iov_len = (size_t)str->length;
+            iov[iovCount].iov_base = &newline;
+            iov[iovCount++].iov_len = 1;
+        }
+
+        struct iovec* next = iov;
+        while (iovCount > 0) {
+            ssize_t written = writev(fd, next, iovCount);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            // a short write carries on from wherever it stopped
+            while (iovCount > 0 && (size_t)written >= next->iov_len) {
+                written -= (ssize_t)next->iov_len;
+                next++;
+                iovCount--;
+            }
+            if (iovCount > 0) {
+                next->iov_base = (char*)next->iov_base + written;
+                next->iov_len -= (size_t)written;
+            }
+        }
+    }
+    return true;
 }
 
 static Value fileClose(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_FILE(args[0])) {
-        return ERROR_VAL_PTR("close() must be called on a file object.");
+        return nativeError("close() must be called on a file object.");
     }
 
     ObjFile* sFile = AS_FILE(args[0]);
     if (sFile->closed) {
-        return ERROR_VAL_PTR("close() called on a closed file.");
+        return nativeError("close() called on a closed file.");
     }
 
-    fclose(sFile->file);
-    sFile->closed = true;
+    if (!closeFile(sFile)) {
+        return nativeError("Failed to write to file.");
+    }
     return NIL_VAL;
 }
 
 static Value fileWrite(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 2 || !IS_FILE(args[0]) || !IS_STRING(args[1])) {
-        return ERROR_VAL_PTR("write() must be called on a file object with a string argument.");
+        return nativeError("write() must be called on a file object with a string argument.");
     }
 
     ObjFile* sFile = AS_FILE(args[0]);
     if (sFile->closed) {
-        return ERROR_VAL_PTR("write() called on a closed file.");
+        return nativeError("write() called on a closed file.");
     }
     if (sFile->mode == FILE_READ) {
-        return ERROR_VAL_PTR("write() called on a file opened in read mode.");
+        return nativeError("write() called on a file opened in read mode.");
     }
 
     ObjString* str = AS_STRING(args[1]);
-    size_t unescLen;
-    char* unesc = unescapeString(str->chars, str->length, &unescLen);
-
-    size_t bytesWritten = fwrite(unesc, sizeof(char), unescLen, sFile->file);
-    free(unesc);
-
-    if (bytesWritten != unescLen) {
-        return ERROR_VAL_PTR("Failed to write to file.");
+    if (!writeFileChars(sFile, str->chars, (size_t)str->length)) {
+        return nativeError("Failed to write to file.");
     }
 
     return BOOL_VAL(true);
@@ -134,28 +256,23 @@ static Value fileWrite(int argCount, Value* args, ParamInfo* params) {
 
 static Value fileWriteLine(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 2 || !IS_FILE(args[0]) || !IS_STRING(args[1])) {
-        return ERROR_VAL_PTR("writeline() must be called on a file object with a string argument.");
+        return nativeError("writeline() must be called on a file object with a string argument.");
     }
 
     ObjFile* sFile = AS_FILE(args[0]);
     if (sFile->closed) {
-        return ERROR_VAL_PTR("writeline() called on a closed file.");
+        return nativeError("writeline() called on a closed file.");
     }
     if (sFile->mode == FILE_READ) {
-        return ERROR_VAL_PTR("writeline() called on a file opened in read mode.");
+        return nativeError("writeline() called on a file opened in read mode.");
     }
 
     ObjString* str = AS_STRING(args[1]);
-    size_t unescLen;
-    char* unesc = unescapeString(str->chars, str->length, &unescLen);
-    size_t bytesWritten = fwrite(unesc, sizeof(char), unescLen, sFile->file);
-    free(unesc);
-
-    if (bytesWritten != unescLen) {
-        return ERROR_VAL_PTR("Failed to write to file.");
+    if (!writeFileChars(sFile, str->chars, (size_t)str->length)) {
+        return nativeError("Failed to write to file.");
     }
-    if (fputc('\n', sFile->file) == EOF) {
-        return ERROR_VAL_PTR("Failed to write newline to file.");
+    if (!writeFileChars(sFile, "\n", 1)) {
+        return nativeError("Failed to write newline to file.");
     }
 
     return BOOL_VAL(true);
@@ -163,15 +280,15 @@ static Value fileWriteLine(int argCount, Value* args, ParamInfo* params) {
 
 static Value fileWriteLines(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 2 || !IS_FILE(args[0]) || !IS_LIST(args[1])) {
-        return ERROR_VAL_PTR("writelines() must be called on a file object with a list argument.");
+        return nativeError("writelines() must be called on a file object with a list argument.");
     }
 
     ObjFile* sFile = AS_FILE(args[0]);
     if (sFile->closed) {
-        return ERROR_VAL_PTR("writelines() called on a closed file.");
+        return nativeError("writelines() called on a closed file.");
     }
     if (sFile->mode == FILE_READ) {
-        return ERROR_VAL_PTR("writelines() called on a file opened in read mode.");
+        return nativeError("writelines() called on a file opened in read mode.");
     }
 
     ObjList* list = AS_LIST(args[1]);
@@ -179,24 +296,30 @@ static Value fileWriteLines(int argCount, Value* args, ParamInfo* params) {
         return BOOL_VAL(true);
     }
 
+    size_t total = 0;
     for (int i = 0; i < list->count; i++) {
         if (!IS_STRING(list->values.values[i])) {
-            return ERROR_VAL_PTR("writelines() requires a list of strings.");
+            return nativeError("writelines() requires a list of strings.");
         }
+        total += (size_t)AS_STRING(list->values.values[i])->length + 1;
+    }
+
+    // more than a buffer's worth of long lines would only be copied through it, so they're written as they are
+    if (sFile->flusher == NULL && total >= FILE_BUFFER_SIZE
+            && total >= (size_t)list->count * WRITE_LINES_MIN_AVERAGE) {
+        if (fflush(sFile->file) != 0 || !writeLinesVectored(sFile, list)) {
+            return nativeError("Failed to write to file.");
+        }
+        return BOOL_VAL(true);
     }
 
     for (int i = 0; i < list->count; i++) {
         ObjString* str = AS_STRING(list->values.values[i]);
-        size_t unescLen;
-        char* unesc = unescapeString(str->chars, str->length, &unescLen);
-        size_t bytesWritten = fwrite(unesc, sizeof(char), unescLen, sFile->file);
-        free(unesc);
-
-        if (bytesWritten != unescLen) {
-            return ERROR_VAL_PTR("Failed to write to file.");
+        if (!writeFileChars(sFile, str->chars, (size_t)str->length)) {
+            return nativeError("Failed to write to file.");
         }
-        if (fputc('\n', sFile->file) == EOF) {
-            return ERROR_VAL_PTR("Failed to write newline to file.");
+        if (!writeFileChars(sFile, "\n", 1)) {
+            return nativeError("Failed to write newline to file.");
         }
     }
 
@@ -205,124 +328,206 @@ static Value fileWriteLines(int argCount, Value* args, ParamInfo* params) {
 
 static Value fileSeek(int argCount, Value* args, ParamInfo* params) {
     if (argCount < 2 || !IS_FILE(args[0]) || !IS_NUMBER(args[1])) {
-        return ERROR_VAL_PTR("seek() must be called on a file object with a numeric argument.");
+        return nativeError("seek() must be called on a file object with a numeric argument.");
     }
 
     ObjFile* sFile = AS_FILE(args[0]);
     if (sFile->closed) {
-        return ERROR_VAL_PTR("seek() called on a closed file.");
+        return nativeError("seek() called on a closed file.");
     }
 
     if (argCount == 3 && !IS_NUMBER(args[2])) {
-        return ERROR_VAL_PTR("seek() requires a second numeric argument for whence.");
+        return nativeError("seek() requires a second numeric argument for whence.");
     }
 
     int whence = (argCount == 3) ? (int)AS_NUMBER(args[2]) : SEEK_SET;
     int offset = (int)AS_NUMBER(args[1]);
+    if (!syncFile(sFile)) {
+        return nativeError("Failed to write to file.");
+    }
     fseek(sFile->file, offset, whence);
     return NIL_VAL;
 }
 
 static Value fileReadline(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_FILE(args[0])) {
-        return ERROR_VAL_PTR("readline() must be called on a file object.");
+        return nativeError("readline() must be called on a file object.");
     }
     ObjFile* sFile = AS_FILE(args[0]);
     if (sFile->closed) {
-        return ERROR_VAL_PTR("readline() called on a closed file.");
+        return nativeError("readline() called on a closed file.");
     }
 
-    char* line = NULL;
-    size_t len = 0;
-    ssize_t read = getline(&line, &len, sFile->file);
-    if (read == -1) {
-        free(line);
+    ObjString* line = readFileLine(sFile);
+    if (line == NULL) {
         return NIL_VAL; // EOF or error
     }
-
-    Value result = OBJ_VAL(copyString(line, read));
-    free(line);
-    return result;
+    return OBJ_VAL(line);
 }
 
 static Value fileFlush(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_FILE(args[0])) {
-        return ERROR_VAL_PTR("flush() must be called on a file object.");
+        return nativeError("flush() must be called on a file object.");
     }
 
     ObjFile* sFile = AS_FILE(args[0]);
     if (sFile->closed) {
-        return ERROR_VAL_PTR("flush() called on a closed file.");
+        return nativeError("flush() called on a closed file.");
     }
 
-    if (fflush(sFile->file) != 0) {
-        return ERROR_VAL_PTR("Failed to flush file.");
+    if (!syncFile(sFile) || fflush(sFile->file) != 0) {
+        return nativeError("Failed to flush file.");
     }
     return NIL_VAL;
 }
 
 static Value fileReadLines(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_FILE(args[0])) {
-        return ERROR_VAL_PTR("readlines() must be called on a file object.");
+        return nativeError("readlines() must be called on a file object.");
     }
 
     ObjFile* sFile = AS_FILE(args[0]);
     if (sFile->closed) {
-        return ERROR_VAL_PTR("readlines() called on a closed file.");
+        return nativeError("readlines() called on a closed file.");
     }
 
     ObjList* lines = newList();
+    // keep the list and each line rooted while we allocate the next
+    push(OBJ_VAL(lines));
 
-    char* line = NULL;
-    size_t len = 0;
-    while (getline(&line, &len, sFile->file) != -1) {
-        ObjString* str = copyString(line, strlen(line));
+    ObjString* str;
+    while ((str = readFileLine(sFile)) != NULL) {
+        push(OBJ_VAL(str));
         if (lines->count + 1 > lines->values.capacity) {
             growValueArray(&lines->values);
         }
         lines->values.values[lines->count++] = OBJ_VAL(str);
+        writeBarrier((Obj*)lines, OBJ_VAL(str));
         lines->values.count = lines->count;
+        pop();
     }
-    free(line);
+    pop();
     return OBJ_VAL(lines);
 }
 
 static Value fileTell(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_FILE(args[0])) {
-        return ERROR_VAL_PTR("tell() must be called on a file object.");
+        return nativeError("tell() must be called on a file object.");
     }
     ObjFile* sFile = AS_FILE(args[0]);
     if (sFile->closed) {
-        return ERROR_VAL_PTR("tell() called on a closed file.");
+        return nativeError("tell() called on a closed file.");
+    }
+    if (!syncFile(sFile)) {
+        return nativeError("Failed to write to file.");
     }
     return NUMBER_VAL(ftell(sFile->file));
 }
 
 static Value fileTruncate(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_FILE(args[0])) {
-        return ERROR_VAL_PTR("truncate() must be called on a file object.");
+        return nativeError("truncate() must be called on a file object.");
     }
 
     ObjFile* sFile = AS_FILE(args[0]);
     if (sFile->closed) {
-        return ERROR_VAL_PTR("truncate() called on a closed file.");
+        return nativeError("truncate() called on a closed file.");
     }
 
     if (sFile->mode == FILE_READ) {
-        return ERROR_VAL_PTR("truncate() called on a file opened in read mode.");
+        return nativeError("truncate() called on a file opened in read mode.");
     }
 
-    if (ftruncate(fileno(sFile->file), 0) != 0) {
-        return ERROR_VAL_PTR("Failed to truncate file.");
+    if (!syncFile(sFile) || ftruncate(fileno(sFile->file), 0) != 0) {
+        return nativeError("Failed to truncate file.");
     }
     return NIL_VAL;
 }
 
 // properties
 
+/**
+ * readbytes native method.
+ * Reads up to size bytes from the current position, or the rest of the file.
+ */
+static Value fileReadBytes(int argCount, Value* args, ParamInfo* params) {
+    if (argCount < 1 || !IS_FILE(args[0])) {
+        return nativeError("readbytes() must be called on a file object.");
+    }
+    ObjFile* sFile = AS_FILE(args[0]);
+    if (sFile->closed) {
+        return nativeError("readbytes() called on a closed file.");
+    }
+
+    long size;
+    if (argCount == 2 && !IS_NIL(args[1])) {
+        if (!IS_NUMBER(args[1]) || AS_NUMBER(args[1]) < 0 || AS_NUMBER(args[1]) > INT32_MAX
+                || AS_NUMBER(args[1]) != (int)AS_NUMBER(args[1])) {
+            return nativeError("readbytes() size must be a non-negative whole number.");
+        }
+        size = (long)AS_NUMBER(args[1]);
+    } else {
+        long position = ftell(sFile->file);
+        fseek(sFile->file, 0, SEEK_END);
+        size = ftell(sFile->file) - position;
+        fseek(sFile->file, position, SEEK_SET);
+        if (position < 0 || size < 0 || size > INT32_MAX) {
+            return nativeError("readbytes() could not size the file.");
+        }
+    }
+
+    ObjBytes* bytes = newBytes((int)size);
+    size_t bytesRead = size > 0 ? fread(bytes->data, 1, size, sFile->file) : 0;
+    // a short read at the end of the file just gives fewer bytes
+    bytes->count = (int)bytesRead;
+    return OBJ_VAL(bytes);
+}
+
+/**
+ * readinto native method.
+ * Reads into an existing bytes object, up to its length, returning how many bytes
+ * were read. This lets a loop reuse one buffer rather than allocate per read.
+ */
+static Value fileReadInto(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 2 || !IS_FILE(args[0]) || !IS_BYTES(args[1])) {
+        return nativeError("readinto() must be called on a file object with a bytes argument.");
+    }
+    ObjFile* sFile = AS_FILE(args[0]);
+    if (sFile->closed) {
+        return nativeError("readinto() called on a closed file.");
+    }
+
+    ObjBytes* bytes = AS_BYTES(args[1]);
+    size_t bytesRead = bytes->count > 0 ? fread(bytes->data, 1, bytes->count, sFile->file) : 0;
+    return NUMBER_VAL((double)bytesRead);
+}
+
+/**
+ * writebytes native method.
+ * Writes the bytes as they are, returning how many were written.
+ */
+static Value fileWriteBytes(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 2 || !IS_FILE(args[0]) || !IS_BYTES(args[1])) {
+        return nativeError("writebytes() must be called on a file object with a bytes argument.");
+    }
+    ObjFile* sFile = AS_FILE(args[0]);
+    if (sFile->closed) {
+        return nativeError("writebytes() called on a closed file.");
+    }
+    if (sFile->mode == FILE_READ) {
+        return nativeError("writebytes() called on a file opened in read mode.");
+    }
+
+    ObjBytes* bytes = AS_BYTES(args[1]);
+    if (bytes->count > 0 && !writeFileChars(sFile, (const char*)bytes->data, (size_t)bytes->count)) {
+        return nativeError("Failed to write to file.");
+    }
+    return NUMBER_VAL((double)bytes->count);
+}
+
 static Value propertyMode(Value arg) {
     if (!IS_FILE(arg)) {
-        return ERROR_VAL_PTR("mode must be called on a file object.");
+        return nativeError("mode must be called on a file object.");
     }
     ObjFile* sFile = AS_FILE(arg);
     switch (sFile->mode) {
@@ -335,7 +540,7 @@ static Value propertyMode(Value arg) {
 
 static Value propertyClosed(Value arg) {
     if (!IS_FILE(arg)) {
-        return ERROR_VAL_PTR("closed must be called on a file object.");
+        return nativeError("closed must be called on a file object.");
     }
     ObjFile* sFile = AS_FILE(arg);
     return BOOL_VAL(sFile->closed);
@@ -343,7 +548,7 @@ static Value propertyClosed(Value arg) {
 
 static Value propertyName(Value arg) {
     if (!IS_FILE(arg)) {
-        return ERROR_VAL_PTR("name must be called on a file object.");
+        return nativeError("name must be called on a file object.");
     }
     ObjFile* sFile = AS_FILE(arg);
     return OBJ_VAL(sFile->name);
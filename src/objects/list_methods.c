@@ -3,13 +3,17 @@
  * @brief Implementation of list methods in CSLO.
  */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "builtins/util.h"
+#include "core/gc.h"
 #include "core/object.h"
+#include "core/sort.h"
 #include "core/value.h"
+#include "core/vm.h"
 
 // forward declarations of native functions
 Value appendNative(int argCount, Value* args, ParamInfo* params);
@@ -20,20 +24,32 @@ Value indexNative(int argCount, Value* args, ParamInfo* params);
 Value countNative(int argCount, Value* args, ParamInfo* params);
 Value extendNative(int argCount, Value* args, ParamInfo* params);
 Value sortNative(int argCount, Value* args, ParamInfo* params);
+Value reserveNative(int argCount, Value* args, ParamInfo* params);
+Value fillNative(int argCount, Value* args, ParamInfo* params);
+
+/**
+ * The list methods, each one created the first time it's looked up.
+ */
+static NativeDef listNatives[] = {
+    {"append", appendNative, 2, 2, {{"self", true}, {"value", true}}},
+    {"insert", insertNative, 3, 3, {{"self", true}, {"index", true}, {"value", true}}},
+    {"remove", removeNative, 2, 2, {{"self", true}, {"index", true}}},
+    {"reverse", reverseNative, 1, 1, {{"self", true}}},
+    {"index", indexNative, 2, 2, {{"self", true}, {"value", true}}},
+    {"count", countNative, 2, 2, {{"self", true}, {"value", true}}},
+    {"extend", extendNative, 2, 2, {{"self", true}, {"other", true}}},
+    {"sort", sortNative, 1, 2, {{"self", true}, {"key", false}}},
+    {"reserve", reserveNative, 2, 2, {{"self", true}, {"capacity", true}}},
+    {"fill", fillNative, 3, 3, {{"self", true}, {"value", true}, {"count", true}}},
+    {NULL}
+};
 
 /**
  * @brief Registers list methods for the given ObjClass.
  * @param cls The ObjClass representing the string type.
  */
 void registerListMethods(ObjClass* cls) {
-    defineBuiltIn(&cls->methods, "append", appendNative, 2, 2, PARAMS({copyString("self", 4), true}, {copyString("value", 5), true}));
-    defineBuiltIn(&cls->methods, "insert", insertNative, 3, 3, PARAMS({copyString("self", 4), true}, {copyString("index", 5), true}, {copyString("value", 5), true}));
-    defineBuiltIn(&cls->methods, "remove", removeNative, 2, 2, PARAMS({copyString("self", 4), true}, {copyString("index", 5), true}));
-    defineBuiltIn(&cls->methods, "reverse", reverseNative, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "index", indexNative, 2, 2, PARAMS({copyString("self", 4), true}, {copyString("value", 5), true}));
-    defineBuiltIn(&cls->methods, "count", countNative, 2, 2, PARAMS({copyString("self", 4), true}, {copyString("value", 5), true}));
-    defineBuiltIn(&cls->methods, "extend", extendNative, 2, 2, PARAMS({copyString("self", 4), true}, {copyString("other", 5), true}));
-    defineBuiltIn(&cls->methods, "sort", sortNative, 1, 1, PARAMS({copyString("self", 4), true}));
+    cls->natives = listNatives;
 }
 
 /**
@@ -41,9 +57,10 @@ void registerListMethods(ObjClass* cls) {
  */
 Value appendNative(int argCount, Value *args, ParamInfo* params) {
     if (argCount != 2 || !IS_LIST(args[0])) {
-        return ERROR_VAL_PTR("append() must be called on a list with one argument.");
+        return nativeError("append() must be called on a list with one argument.");
     }
     ObjList* list = AS_LIST(args[0]);
+    unshareList(list);
     if (list->count + 1 > list->values.capacity) {
         growValueArray(&list->values);
     }
@@ -58,7 +75,7 @@ Value appendNative(int argCount, Value *args, ParamInfo* params) {
  */
 Value insertNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 3 || !IS_LIST(args[0]) || !IS_NUMBER(args[1])) {
-        return ERROR_VAL_PTR("insert() must be called on a list with an index and a value.");
+        return nativeError("insert() must be called on a list with an index and a value.");
     }
     ObjList* list = AS_LIST(args[0]);
     int idx = (int)AS_NUMBER(args[1]);
@@ -76,6 +93,7 @@ Value insertNative(int argCount, Value* args, ParamInfo* params) {
     #endif
 
     // Grow the array if needed
+    unshareList(list);
     if (list->count + 1 > list->values.capacity) {
         growValueArray(&list->values);
     }
@@ -92,15 +110,16 @@ Value insertNative(int argCount, Value* args, ParamInfo* params) {
  */
 Value removeNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 2 || !IS_LIST(args[0]) || !IS_NUMBER(args[1])) {
-        return ERROR_VAL_PTR("remove() must be called on a list with an index.");
+        return nativeError("remove() must be called on a list with an index.");
     }
     ObjList* list = AS_LIST(args[0]);
     int idx = (int)AS_NUMBER(args[1]);
     if (idx < 0 || idx >= list->count) {
-        return ERROR_VAL_PTR("Index out of bounds for remove().");
+        return nativeError("Index out of bounds for remove().");
     }
 
     Value removed = list->values.values[idx];
+    unshareList(list);
     memmove(&list->values.values[idx], &list->values.values[idx + 1], sizeof(Value) * (list->count - idx - 1));
     list->count--;
     list->values.count = list->count;
@@ -116,20 +135,19 @@ Value removeNative(int argCount, Value* args, ParamInfo* params) {
  */
 Value reverseNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_LIST(args[0])) {
-        return ERROR_VAL_PTR("reverse() must be called on a list.");
+        return nativeError("reverse() must be called on a list.");
     }
     ObjList* list = AS_LIST(args[0]);
     if (list->count == 0 || list->count == 1) {
         // nothing to reverse; can just return current list as is
         return args[0];
     }
-    ObjList* reversed = newList();
+    ObjList* reversed = newListWithCapacity(list->count);
     for (int i = list->count - 1; i >= 0; i--) {
-        if (reversed->count >= reversed->values.capacity) {
-            growValueArray(&reversed->values);
-        }
         reversed->values.values[reversed->count++] = list->values.values[i];
     }
+    reversed->values.count = reversed->count;
+    rememberObject((Obj*)reversed);
     return OBJ_VAL(reversed);
 }
 
@@ -138,7 +156,7 @@ Value reverseNative(int argCount, Value* args, ParamInfo* params) {
  */
 Value indexNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 2 || !IS_LIST(args[0])) {
-        return ERROR_VAL_PTR("index() must be called on a list with a value.");
+        return nativeError("index() must be called on a list with a value.");
     }
     ObjList* list = AS_LIST(args[0]);
     if (list->count == 0) {
@@ -158,7 +176,7 @@ Value indexNative(int argCount, Value* args, ParamInfo* params) {
  */
 Value countNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 2 || !IS_LIST(args[0])) {
-        return ERROR_VAL_PTR("count() must be called on a list with a value.");
+        return nativeError("count() must be called on a list with a value.");
     }
     ObjList* list = AS_LIST(args[0]);
     if (list->count == 0) {
@@ -181,21 +199,23 @@ Value countNative(int argCount, Value* args, ParamInfo* params) {
  */
 Value extendNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 2 || !IS_LIST(args[0]) || !IS_LIST(args[1])) {
-        return ERROR_VAL_PTR("extend() must be called on a list with a list.");
+        return nativeError("extend() must be called on a list with a list.");
     }
     ObjList* list = AS_LIST(args[0]);
     ObjList* other = AS_LIST(args[1]);
 
     int oldCount = list->count;
     int newCount = oldCount + other->count;
+    unshareList(list);
 
-    while (list->values.capacity < newCount) {
-        growValueArray(&list->values);
+    // grow once, but at least as much as appending would so repeated extends stay cheap
+    if (list->values.capacity < newCount) {
+        int capacity = GROW_CAPACITY(list->values.capacity);
+        reserveValueArray(&list->values, capacity > newCount ? capacity : newCount);
     }
 
-    // copy the values from the other list
-    // faster than copying the values one by one
-    memcpy(&list->values.values[oldCount], other->values.values, sizeof(Value) * other->count);
+    // the other list may be this one, so only read its buffer after growing
+    copyValues(&list->values.values[oldCount], other->values.values, other->count);
     list->count = newCount;
     list->values.count = newCount;
     return NIL_VAL;
@@ -203,21 +223,86 @@ Value extendNative(int argCount, Value* args, ParamInfo* params) {
 
 /**
  * Sort native function.
- * Sorts a list in-place.
+ * Sorts a list in-place, optionally by calling key on each item once.
  */
 Value sortNative(int argCount, Value* args, ParamInfo* params) {
-    if (argCount != 1 || !IS_LIST(args[0])) {
-        return ERROR_VAL_PTR("sort() must be called on a list.");
+    if (argCount < 1 || !IS_LIST(args[0])) {
+        return nativeError("sort() must be called on a list.");
     }
     ObjList* list = AS_LIST(args[0]);
+    Value key = argCount == 2 ? args[1] : NIL_VAL;
+    if (!IS_NIL(key) && !IS_CLOSURE(key) && !IS_NATIVE(key) && !IS_BOUND_METHOD(key) && !IS_CLASS(key)) {
+        return nativeError("sort() key must be a function.");
+    }
 
     if (list->count <= 1) {
         // nothing to sort
         return NIL_VAL;
     }
 
-    // add sort function here
-    qsort(list->values.values, list->count, sizeof(Value), valueCompare);
+    if (IS_NIL(key)) {
+        unshareList(list);
+        sortValues(list->values.values, list->count);
+        return NIL_VAL;
+    }
 
+    // work out every key up front, keeping them rooted as the key function may allocate
+    ObjList* keys = newListWithCapacity(list->count);
+    push(OBJ_VAL(keys));
+    for (int i = 0; i < list->count; i++) {
+        Value result;
+        if (!callFunction(key, 1, &list->values.values[i], &result)) {
+            pop();
+            return nativeError("sort() key function raised an error.");
+        }
+        keys->values.values[keys->count++] = result;
+        keys->values.count = keys->count;
+        writeBarrier((Obj*)keys, result);
+    }
+    if (keys->count != list->count) {
+        pop();
+        return nativeError("list changed size during sort().");
+    }
+
+    // the key function may have shared the list, so make sure it's still ours to write
+    unshareList(list);
+    sortValuesByKey(list->values.values, keys->values.values, list->count);
+    pop();
     return NIL_VAL;
 }
+
+/**
+ * reserve native function.
+ * Makes room for at least capacity values so appending up to it never grows the list.
+ */
+Value reserveNative(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 2 || !IS_LIST(args[0]) || !IS_NUMBER(args[1])
+            || AS_NUMBER(args[1]) < 0 || AS_NUMBER(args[1]) > INT_MAX) {
+        return nativeError("reserve() must be called on a list with a non-negative capacity.");
+    }
+    ObjList* list = AS_LIST(args[0]);
+    unshareList(list);
+    reserveValueArray(&list->values, (int)AS_NUMBER(args[1]));
+    return NIL_VAL;
+}
+
+/**
+ * fill native function.
+ * Replaces the contents of a list with count copies of value, growing it at most once.
+ */
+Value fillNative(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 3 || !IS_LIST(args[0]) || !IS_NUMBER(args[2])
+            || AS_NUMBER(args[2]) < 0 || AS_NUMBER(args[2]) > INT_MAX) {
+        return nativeError("fill() must be called on a list with a value and a non-negative count.");
+    }
+    ObjList* list = AS_LIST(args[0]);
+    int count = (int)AS_NUMBER(args[2]);
+    unshareList(list);
+    reserveValueArray(&list->values, count);
+    for (int i = 0; i < count; i++) {
+        list->values.values[i] = args[1];
+    }
+    list->count = count;
+    list->values.count = count;
+    return args[0];
+}
@@ -0,0 +1,217 @@
+/**
+ * @file set_methods.c
+ * @brief Implementation of set methods in CSLO.
+ *
+ * Sets are tables whose keys are the values, so membership checks
+ * and the set operations hash each value rather than scanning.
+ */
+
+#include "builtins/util.h"
+#include "core/gc.h"
+#include "core/object.h"
+#include "core/table.h"
+#include "core/value.h"
+#include "core/vm.h"
+#include "objects/set_methods.h"
+
+static Value setAddNative(int argCount, Value* args, ParamInfo* params);
+static Value setRemove(int argCount, Value* args, ParamInfo* params);
+static Value setUnion(int argCount, Value* args, ParamInfo* params);
+static Value setIntersection(int argCount, Value* args, ParamInfo* params);
+static Value setDifference(int argCount, Value* args, ParamInfo* params);
+static Value setClear(int argCount, Value* args, ParamInfo* params);
+static Value setClone(int argCount, Value* args, ParamInfo* params);
+static Value setToList(int argCount, Value* args, ParamInfo* params);
+
+/**
+ * The set methods, each one created the first time it's looked up.
+ */
+static NativeDef setNatives[] = {
+    {"add", setAddNative, 2, 2, {{"self", true}, {"value", true}}},
+    {"remove", setRemove, 2, 2, {{"self", true}, {"value", true}}},
+    {"union", setUnion, 2, 2, {{"self", true}, {"other", true}}},
+    {"intersection", setIntersection, 2, 2, {{"self", true}, {"other", true}}},
+    {"difference", setDifference, 2, 2, {{"self", true}, {"other", true}}},
+    {"clear", setClear, 1, 1, {{"self", true}}},
+    {"clone", setClone, 1, 1, {{"self", true}}},
+    {"tolist", setToList, 1, 1, {{"self", true}}},
+    {NULL}
+};
+
+/**
+ * @brief Registers set methods for the given ObjClass.
+ * @param cls The ObjClass representing the set type.
+ */
+void registerSetMethods(ObjClass* cls) {
+    cls->natives = setNatives;
+}
+
+bool setAdd(ObjSet* set, Value value) {
+    bool isNew = tableSet(&set->data, value, BOOL_VAL(true));
+    writeBarrier((Obj*)set, value);
+    return isNew;
+}
+
+/**
+ * Method for checking whether a value is in a set.
+ */
+static inline bool setContains(ObjSet* set, Value value) {
+    Value found;
+    return tableGet(&set->data, value, &found);
+}
+
+/**
+ * Method for checking the arguments of the binary set operations.
+ */
+static inline bool isSetPair(int argCount, Value* args) {
+    return argCount == 2 && IS_SET(args[0]) && IS_SET(args[1]);
+}
+
+/**
+ * add native method.
+ * Adds a value to the set, returning true if it wasn't already there.
+ */
+static Value setAddNative(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 2 || !IS_SET(args[0])) {
+        return nativeError("add() must be called on a set with a value.");
+    }
+    return BOOL_VAL(setAdd(AS_SET(args[0]), args[1]));
+}
+
+/**
+ * remove native method.
+ * Removes a value from the set, returning true if it was there.
+ */
+static Value setRemove(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 2 || !IS_SET(args[0])) {
+        return nativeError("remove() must be called on a set with a value.");
+    }
+    return BOOL_VAL(tableDelete(&AS_SET(args[0])->data, args[1]));
+}
+
+/**
+ * union native method.
+ * Returns a new set of the values in either set.
+ */
+static Value setUnion(int argCount, Value* args, ParamInfo* params) {
+    if (!isSetPair(argCount, args)) {
+        return nativeError("union() must be called on a set with another set.");
+    }
+    ObjSet* set = AS_SET(args[0]);
+    ObjSet* other = AS_SET(args[1]);
+    ObjSet* result = newSet();
+    // keep the result rooted while its table grows
+    push(OBJ_VAL(result));
+    tableAddAll(&set->data, &result->data);
+    for (int i = 0; i < other->data.entryCount; i++) {
+        Entry* entry = &other->data.entries[i];
+        if (!IS_EMPTY(entry->key)) {
+            tableSet(&result->data, entry->key, entry->value);
+        }
+    }
+    // it may have been promoted while growing, before its values were added
+    rememberObject((Obj*)result);
+    pop();
+    return OBJ_VAL(result);
+}
+
+/**
+ * intersection native method.
+ * Returns a new set of the values in both sets.
+ */
+static Value setIntersection(int argCount, Value* args, ParamInfo* params) {
+    if (!isSetPair(argCount, args)) {
+        return nativeError("intersection() must be called on a set with another set.");
+    }
+    ObjSet* set = AS_SET(args[0]);
+    ObjSet* other = AS_SET(args[1]);
+    // look up the values of the smaller set in the bigger one
+    ObjSet* smaller = set->data.count <= other->data.count ? set : other;
+    ObjSet* bigger = smaller == set ? other : set;
+    ObjSet* result = newSet();
+    push(OBJ_VAL(result));
+    for (int i = 0; i < smaller->data.entryCount; i++) {
+        Entry* entry = &smaller->data.entries[i];
+        if (!IS_EMPTY(entry->key) && setContains(bigger, entry->key)) {
+            tableSet(&result->data, entry->key, entry->value);
+        }
+    }
+    rememberObject((Obj*)result);
+    pop();
+    return OBJ_VAL(result);
+}
+
+/**
+ * difference native method.
+ * Returns a new set of the values in this set but not the other.
+ */
+static Value setDifference(int argCount, Value* args, ParamInfo* params) {
+    if (!isSetPair(argCount, args)) {
+        return nativeError("difference() must be called on a set with another set.");
+    }
+    ObjSet* set = AS_SET(args[0]);
+    ObjSet* other = AS_SET(args[1]);
+    ObjSet* result = newSet();
+    push(OBJ_VAL(result));
+    for (int i = 0; i < set->data.entryCount; i++) {
+        Entry* entry = &set->data.entries[i];
+        if (!IS_EMPTY(entry->key) && !setContains(other, entry->key)) {
+            tableSet(&result->data, entry->key, entry->value);
+        }
+    }
+    rememberObject((Obj*)result);
+    pop();
+    return OBJ_VAL(result);
+}
+
+/**
+ * clear native method.
+ * Removes every value from the set.
+ */
+static Value setClear(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_SET(args[0])) {
+        return nativeError("clear() must be called on a set.");
+    }
+    tableClear(&AS_SET(args[0])->data);
+    return NIL_VAL;
+}
+
+/**
+ * clone native method.
+ * Shallow copies the set.
+ */
+static Value setClone(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_SET(args[0])) {
+        return nativeError("clone() must be called on a set.");
+    }
+    ObjSet* set = AS_SET(args[0]);
+    ObjSet* result = newSet();
+    push(OBJ_VAL(result));
+    tableAddAll(&set->data, &result->data);
+    rememberObject((Obj*)result);
+    pop();
+    return OBJ_VAL(result);
+}
+
+/**
+ * tolist native method.
+ * Returns the set's values as a list, in the order they were added.
+ */
+static Value setToList(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_SET(args[0])) {
+        return nativeError("tolist() must be called on a set.");
+    }
+    ObjSet* set = AS_SET(args[0]);
+    ObjList* list = newList();
+    push(OBJ_VAL(list));
+    for (int i = 0; i < set->data.entryCount; i++) {
+        Entry* entry = &set->data.entries[i];
+        if (!IS_EMPTY(entry->key)) {
+            writeValueArray(&list->values, entry->key);
+            list->count = list->values.count;
+        }
+    }
+    rememberObject((Obj*)list);
+    pop();
+    return OBJ_VAL(list);
+}
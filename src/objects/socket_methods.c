@@ -0,0 +1,299 @@
+/**
+ * @file socket_methods.c
+ * @brief Implementation of socket methods in CSLO.
+ *
+ * Sockets are always non-blocking. Each method does its I/O through
+ * performIo, so inside an async task it parks the task rather than blocking
+ * the whole loop, and anywhere else it simply blocks.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "builtins/util.h"
+#include "core/object.h"
+#include "core/value.h"
+#include "core/vm.h"
+#include "objects/socket_methods.h"
+#include "std/async.h"
+
+// how much recv() reads when it isn't given a size
+#define SOCKET_RECV_SIZE (1 << 16)
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static Value socketAccept(int argCount, Value* args, ParamInfo* params);
+static Value socketRecv(int argCount, Value* args, ParamInfo* params);
+static Value socketRecvInto(int argCount, Value* args, ParamInfo* params);
+static Value socketSend(int argCount, Value* args, ParamInfo* params);
+static Value socketClose(int argCount, Value* args, ParamInfo* params);
+static Value socketPort(int argCount, Value* args, ParamInfo* params);
+
+/**
+ * The socket methods, each one created the first time it's looked up.
+ */
+static NativeDef socketNatives[] = {
+    {"accept", socketAccept, 1, 1, {{"self", true}}},
+    {"recv", socketRecv, 1, 2, {{"self", true}, {"size", false}}},
+    {"recvinto", socketRecvInto, 2, 2, {{"self", true}, {"buffer", true}}},
+    {"send", socketSend, 2, 2, {{"self", true}, {"data", true}}},
+    {"close", socketClose, 1, 1, {{"self", true}}},
+    {"port", socketPort, 1, 1, {{"self", true}}},
+    {NULL}
+};
+
+/**
+ * @brief Registers socket methods for the given ObjClass.
+ * @param cls The ObjClass representing the socket type.
+ */
+void registerSocketMethods(ObjClass* cls) {
+    cls->natives = socketNatives;
+}
+
+bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+Value socketError(const char* call) {
+    char message[256];
+    snprintf(message, sizeof(message), "%s failed: %s", call, strerror(errno));
+    return ERROR_VAL_PTR(message);
+}
+
+/**
+ * Method for checking whether a failed call just needs waiting for the socket to be ready.
+ */
+static bool wouldBlock() {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+/**
+ * I/O step that accepts a connection on the listening socket.
+ */
+static bool acceptStep(IoRequest* request, Value* result) {
+    for (;;) {
+        int fd = accept(request->fd, NULL, NULL);
+        if (fd >= 0) {
+            if (!setNonBlocking(fd)) {
+                close(fd);
+                *result = socketError("accept()");
+                return true;
+            }
+            *result = OBJ_VAL(newSocket(fd, false));
+            return true;
+        }
+        if (errno == EINTR || errno == ECONNABORTED) {
+            continue;
+        }
+        if (wouldBlock()) {
+            return false;
+        }
+        *result = socketError("accept()");
+        return true;
+    }
+}
+
+/**
+ * Method for reading whatever's available into the request's bytes buffer.
+ * Returns how many bytes were read, 0 at the end of the stream, or -1 if there's nothing yet.
+ */
+static ssize_t recvSome(IoRequest* request, Value* result) {
+    ObjBytes* bytes = AS_BYTES(request->buffer);
+    for (;;) {
+        ssize_t count = recv(request->fd, bytes->data, bytes->count, 0);
+        if (count >= 0) {
+            return count;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (!wouldBlock()) {
+            *result = socketError("recv()");
+        }
+        return -1;
+    }
+}
+
+/**
+ * I/O step that reads into a new bytes buffer, finishing with the bytes read.
+ */
+static bool recvStep(IoRequest* request, Value* result) {
+    ssize_t count = recvSome(request, result);
+    if (count < 0) {
+        return IS_ERROR(*result);
+    }
+    AS_BYTES(request->buffer)->count = (int)count;
+    *result = request->buffer;
+    return true;
+}
+
+/**
+ * I/O step that reads into the caller's bytes buffer, finishing with the number read.
+ */
+static bool recvIntoStep(IoRequest* request, Value* result) {
+    ssize_t count = recvSome(request, result);
+    if (count < 0) {
+        return IS_ERROR(*result);
+    }
+    *result = NUMBER_VAL((double)count);
+    return true;
+}
+
+bool sendStep(IoRequest* request, Value* result) {
+    const char* data;
+    size_t length;
+    if (IS_BYTES(request->buffer)) {
+        data = (const char*)AS_BYTES(request->buffer)->data;
+        length = AS_BYTES(request->buffer)->count;
+    } else {
+        data = AS_CSTRING(request->buffer);
+        length = AS_STRING(request->buffer)->length;
+    }
+
+    while (request->offset < length) {
+        ssize_t count = send(request->fd, data + request->offset, length - request->offset, MSG_NOSIGNAL);
+        if (count >= 0) {
+            request->offset += count;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (wouldBlock()) {
+            return false;
+        } else {
+            *result = socketError("send()");
+            return true;
+        }
+    }
+    *result = NUMBER_VAL((double)length);
+    return true;
+}
+
+/**
+ * accept native method.
+ * Waits for a connection on a listening socket, and returns a socket for it.
+ */
+static Value socketAccept(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_SOCKET(args[0])) {
+        return ERROR_VAL_PTR("accept() must be called on a socket.");
+    }
+    ObjSocket* socket = AS_SOCKET(args[0]);
+    if (socket->closed || !socket->listening) {
+        return ERROR_VAL_PTR("accept() must be called on an open, listening socket.");
+    }
+
+    IoRequest request = {socket->fd, POLLIN, acceptStep, NIL_VAL, NIL_VAL, 0, 0, NULL};
+    return performIo(&request);
+}
+
+/**
+ * recv native method.
+ * Reads up to size bytes (64KiB by default) once some are available, and
+ * returns them. The bytes are empty once the other end has closed.
+ */
+static Value socketRecv(int argCount, Value* args, ParamInfo* params) {
+    if (argCount < 1 || !IS_SOCKET(args[0])) {
+        return ERROR_VAL_PTR("recv() must be called on a socket.");
+    }
+    ObjSocket* socket = AS_SOCKET(args[0]);
+    if (socket->closed || socket->listening) {
+        return ERROR_VAL_PTR("recv() must be called on an open, connected socket.");
+    }
+    int size = SOCKET_RECV_SIZE;
+    if (argCount == 2 && !IS_NIL(args[1])) {
+        if (!IS_NUMBER(args[1]) || AS_NUMBER(args[1]) < 1 || AS_NUMBER(args[1]) > INT32_MAX
+                || AS_NUMBER(args[1]) != (int)AS_NUMBER(args[1])) {
+            return ERROR_VAL_PTR("recv() size must be a positive whole number.");
+        }
+        size = (int)AS_NUMBER(args[1]);
+    }
+
+    IoRequest request = {socket->fd, POLLIN, recvStep, NIL_VAL, NIL_VAL, 0, 0, NULL};
+    request.buffer = OBJ_VAL(newBytes(size));
+    return performIo(&request);
+}
+
+/**
+ * recvinto native method.
+ * Reads into an existing bytes object, up to its length, once some bytes are
+ * available, and returns how many were read (0 once the other end has closed).
+ * Reading straight into the caller's buffer saves allocating and copying per read.
+ */
+static Value socketRecvInto(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 2 || !IS_SOCKET(args[0]) || !IS_BYTES(args[1])) {
+        return ERROR_VAL_PTR("recvinto() must be called on a socket with a bytes argument.");
+    }
+    ObjSocket* socket = AS_SOCKET(args[0]);
+    if (socket->closed || socket->listening) {
+        return ERROR_VAL_PTR("recvinto() must be called on an open, connected socket.");
+    }
+    if (AS_BYTES(args[1])->count == 0) {
+        return NUMBER_VAL(0);
+    }
+
+    IoRequest request = {socket->fd, POLLIN, recvIntoStep, NIL_VAL, args[1], 0, 0, NULL};
+    return performIo(&request);
+}
+
+/**
+ * send native method.
+ * Sends all of the bytes or string, and returns how many bytes were sent.
+ */
+static Value socketSend(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 2 || !IS_SOCKET(args[0]) || (!IS_BYTES(args[1]) && !IS_STRING(args[1]))) {
+        return ERROR_VAL_PTR("send() must be called on a socket with a bytes or string argument.");
+    }
+    ObjSocket* socket = AS_SOCKET(args[0]);
+    if (socket->closed || socket->listening) {
+        return ERROR_VAL_PTR("send() must be called on an open, connected socket.");
+    }
+
+    IoRequest request = {socket->fd, POLLOUT, sendStep, NIL_VAL, args[1], 0, 0, NULL};
+    return performIo(&request);
+}
+
+static Value socketClose(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_SOCKET(args[0])) {
+        return ERROR_VAL_PTR("close() must be called on a socket.");
+    }
+    ObjSocket* socket = AS_SOCKET(args[0]);
+    if (socket->closed) {
+        return ERROR_VAL_PTR("close() called on a closed socket.");
+    }
+    closeSocket(socket);
+    return NIL_VAL;
+}
+
+/**
+ * port native method.
+ * Returns the local port the socket is bound to, such as the one picked when listening on port 0.
+ */
+static Value socketPort(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_SOCKET(args[0])) {
+        return ERROR_VAL_PTR("port() must be called on a socket.");
+    }
+    ObjSocket* socket = AS_SOCKET(args[0]);
+    if (socket->closed) {
+        return ERROR_VAL_PTR("port() called on a closed socket.");
+    }
+
+    struct sockaddr_storage address;
+    socklen_t length = sizeof(address);
+    if (getsockname(socket->fd, (struct sockaddr*)&address, &length) != 0) {
+        return socketError("port()");
+    }
+    if (address.ss_family == AF_INET6) {
+        return NUMBER_VAL(ntohs(((struct sockaddr_in6*)&address)->sin6_port));
+    }
+    return NUMBER_VAL(ntohs(((struct sockaddr_in*)&address)->sin_port));
+}
@@ -0,0 +1,70 @@
+/**
+ * @file string_builder_methods.c
+ * @brief Implementation of string builder methods in CSLO.
+ */
+
+#include "builtins/util.h"
+#include "core/memory.h"
+#include "core/object.h"
+#include "core/table.h"
+#include "core/value.h"
+#include "objects/string_builder_methods.h"
+
+static Value builderAppend(int argCount, Value* args, ParamInfo* params);
+static Value builderBuild(int argCount, Value* args, ParamInfo* params);
+static Value builderClear(int argCount, Value* args, ParamInfo* params);
+
+/**
+ * The string builder methods, each one created the first time it's looked up.
+ */
+static NativeDef stringBuilderNatives[] = {
+    {"append", builderAppend, 2, 2, {{"self", true}, {"value", true}}},
+    {"build", builderBuild, 1, 1, {{"self", true}}},
+    {"clear", builderClear, 1, 1, {{"self", true}}},
+    {NULL}
+};
+
+/**
+ * @brief Registers string builder methods for the given ObjClass.
+ * @param cls The ObjClass representing the string builder type.
+ */
+void registerStringBuilderMethods(ObjClass* cls) {
+    cls->natives = stringBuilderNatives;
+}
+
+/**
+ * Appends a value's string form to the builder.
+ * Returns the builder so that appends can be chained.
+ */
+static Value builderAppend(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 2 || !IS_STRING_BUILDER(args[0])) {
+        return nativeError("append() must be called on a string builder with a value.");
+    }
+    if (!stringBuilderAppend(AS_STRING_BUILDER(args[0]), args[1])) {
+        return nativeError("append() couldn't convert the value to a string.");
+    }
+    return args[0];
+}
+
+/**
+ * Creates a string from everything appended so far.
+ * The builder is left as it is so it can carry on being appended to.
+ */
+static Value builderBuild(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_STRING_BUILDER(args[0])) {
+        return nativeError("build() must be called on a string builder.");
+    }
+    ObjStringBuilder* builder = AS_STRING_BUILDER(args[0]);
+    return OBJ_VAL(copyRuntimeString(builder->length == 0 ? "" : builder->chars, builder->length));
+}
+
+/**
+ * Empties the builder, keeping its buffer for reuse.
+ */
+static Value builderClear(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_STRING_BUILDER(args[0])) {
+        return nativeError("clear() must be called on a string builder.");
+    }
+    AS_STRING_BUILDER(args[0])->length = 0;
+    return NIL_VAL;
+}
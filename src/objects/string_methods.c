@@ -7,10 +7,12 @@
 #include <string.h>
 
 #include "builtins/util.h"
+#include "core/gc.h"
 #include "core/memory.h"
 #include "core/object.h"
 #include "core/table.h"
 #include "core/value.h"
+#include "core/vm.h"
 #include "objects/string_methods.h"
 
 // forward declarations of native functions
@@ -29,25 +31,33 @@ Value replace(int argCount, Value* args, ParamInfo* params);
 Value count(int argCount, Value* args, ParamInfo* params);
 Value strIndex(int argCount, Value* args, ParamInfo* params);
 
+/**
+ * The string methods, each one created the first time it's looked up.
+ */
+static NativeDef stringNatives[] = {
+    {"upper", upper, 1, 1, {{"self", true}}},
+    {"lower", lower, 1, 1, {{"self", true}}},
+    {"title", title, 1, 1, {{"self", true}}},
+    {"split", split, 2, 2, {{"self", true}, {"delimiter", true}}},
+    {"strip", strip, 1, 1, {{"self", true}}},
+    {"startswith", startsWith, 2, 2, {{"self", true}, {"prefix", true}}},
+    {"endswith", endsWith, 2, 2, {{"self", true}, {"suffix", true}}},
+    {"isalpha", isAlpha, 1, 1, {{"self", true}}},
+    {"isdigit", isDigit, 1, 1, {{"self", true}}},
+    {"isalphanum", isAlphaNumeric, 1, 1, {{"self", true}}},
+    {"find", find, 2, 2, {{"self", true}, {"substring", true}}},
+    {"replace", replace, 3, 3, {{"self", true}, {"old", true}, {"new", true}}},
+    {"count", count, 2, 2, {{"self", true}, {"substring", true}}},
+    {"index", strIndex, 2, 2, {{"self", true}, {"substring", true}}},
+    {NULL}
+};
+
 /**
  * @brief Registers string methods for the given ObjClass.
  * @param cls The ObjClass representing the string type.
  */
 void registerStringMethods(ObjClass* cls) {
-    defineBuiltIn(&cls->methods, "upper", upper, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "lower", lower, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "title", title, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "split", split, 2, 2, PARAMS({copyString("self", 4), true}, {copyString("delimiter", 9), true}));
-    defineBuiltIn(&cls->methods, "strip", strip, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "startswith", startsWith, 2, 2, PARAMS({copyString("self", 4), true}, {copyString("prefix", 6), true}));
-    defineBuiltIn(&cls->methods, "endswith", endsWith, 2, 2, PARAMS({copyString("self", 4), true}, {copyString("suffix", 6), true}));
-    defineBuiltIn(&cls->methods, "isalpha", isAlpha, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "isdigit", isDigit, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "isalphanum", isAlphaNumeric, 1, 1, PARAMS({copyString("self", 4), true}));
-    defineBuiltIn(&cls->methods, "find", find, 2, 2, PARAMS({copyString("self", 4), true}, {copyString("substring", 9), true}));
-    defineBuiltIn(&cls->methods, "replace", replace, 3, 3, PARAMS({copyString("self", 4), true}, {copyString("old", 3), true}, {copyString("new", 3), true}));
-    defineBuiltIn(&cls->methods, "count", count, 2, 2, PARAMS({copyString("self", 4), true}, {copyString("substring", 9), true}));
-    defineBuiltIn(&cls->methods, "index", strIndex, 2, 2, PARAMS({copyString("self", 4), true}, {copyString("substring", 9), true}));
+    cls->natives = stringNatives;
 }
 
 /**
@@ -58,7 +68,7 @@ void registerStringMethods(ObjClass* cls) {
  */
 Value upper(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("upper() must be called on a string.");
+        return nativeError("upper() must be called on a string.");
     }
 
     ObjString* original = AS_STRING(args[0]);
@@ -70,7 +80,7 @@ Value upper(int argCount, Value* args, ParamInfo* params) {
     }
     upperChars[length] = '\0';
 
-    ObjString* upperString = takeString(upperChars, length);
+    ObjString* upperString = takeRuntimeString(upperChars, length);
     return OBJ_VAL(upperString);
 }
 
@@ -82,7 +92,7 @@ Value upper(int argCount, Value* args, ParamInfo* params) {
  */
 Value lower(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("lower() must be called on a string.");
+        return nativeError("lower() must be called on a string.");
     }
 
     ObjString* original = AS_STRING(args[0]);
@@ -94,7 +104,7 @@ Value lower(int argCount, Value* args, ParamInfo* params) {
     }
     lowerChars[length] = '\0';
 
-    ObjString* lowerString = takeString(lowerChars, length);
+    ObjString* lowerString = takeRuntimeString(lowerChars, length);
     return OBJ_VAL(lowerString);
 }
 
@@ -106,7 +116,7 @@ Value lower(int argCount, Value* args, ParamInfo* params) {
  */
 Value title(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("title() must be called on a string.");
+        return nativeError("title() must be called on a string.");
     }
 
     ObjString* original = AS_STRING(args[0]);
@@ -127,57 +137,86 @@ Value title(int argCount, Value* args, ParamInfo* params) {
     }
     titleChars[length] = '\0';
 
-    ObjString* titleString = takeString(titleChars, length);
+    ObjString* titleString = takeRuntimeString(titleChars, length);
     return OBJ_VAL(titleString);
 }
 
+/**
+ * Finds the first occurrence of a substring at or after the given index.
+ * Scans for the substring's first character with memchr, which libc
+ * vectorises, and only compares the rest where that character turns up.
+ * Returns -1 if the substring isn't found.
+ */
+static int findSubstring(ObjString* string, ObjString* substring, int from) {
+    if (substring->length == 0) {
+        return from <= string->length ? from : -1;
+    }
+
+    const char* chars = string->chars;
+    const char* last = chars + string->length - substring->length;
+    const char* current = chars + from;
+    while (current <= last) {
+        current = memchr(current, substring->chars[0], last - current + 1);
+        if (current == NULL) {
+            return -1;
+        }
+        if (memcmp(current + 1, substring->chars + 1, substring->length - 1) == 0) {
+            return (int)(current - chars);
+        }
+        current++;
+    }
+    return -1;
+}
+
+/**
+ * Appends a view of part of a string to a list.
+ * The substring is kept rooted while the list grows, which may promote the list.
+ */
+static void appendSubstring(ObjList* list, ObjString* string, int start, int length) {
+    ObjString* substring = newStringView(string, start, length);
+    push(OBJ_VAL(substring));
+    if (list->count >= list->values.capacity) {
+        growValueArray(&list->values);
+    }
+    list->values.values[list->count++] = OBJ_VAL(substring);
+    writeBarrier((Obj*)list, OBJ_VAL(substring));
+    list->values.count = list->count;
+    pop();
+}
+
 /**
  * @brief Splits a string into a list of substrings based on a delimiter.
  * @param argCount The number of arguments passed to the function.
  * @param args The arguments passed to the function.
  * @return A list of substrings or an error if the arguments are invalid.
+ *
+ * The delimiter can be any length and empty parts are skipped.
+ * The substrings are views onto the original string rather than copies.
  */
 Value split(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 2 || !IS_STRING(args[0]) || !IS_STRING(args[1])) {
-        return ERROR_VAL_PTR("split() must be called on a string and a delimiter string.");
+        return nativeError("split() must be called on a string and a delimiter string.");
     }
 
     ObjString* original = AS_STRING(args[0]);
     ObjString* delimiter = AS_STRING(args[1]);
     if (delimiter->length == 0 || delimiter->length > original->length) {
-        return ERROR_VAL_PTR("Delimiter must be non-empty and shorter than the string.");
+        return nativeError("Delimiter must be non-empty and shorter than the string.");
     }
-    char delim = delimiter->chars[0];
     ObjList* list = newList();
+    push(OBJ_VAL(list));
     int start = 0;
-    for (int i = 0; i < original->length; i++) {
-        if (original->chars[i] == delim) {
-            if (i > start) {
-                int length = i - start;
-                char* substring = ALLOCATE(char, length + 1);
-                memcpy(substring, original->chars + start, length);
-                substring[length] = '\0';
-                ObjString* subStrObj = takeString(substring, length);
-                if (list->values.count >= list->values.capacity) {
-                    growValueArray(&list->values);
-                }
-                list->values.values[list->count++] = OBJ_VAL(subStrObj);
-            }
-            start = i + 1;
+    int match;
+    while ((match = findSubstring(original, delimiter, start)) != -1) {
+        if (match > start) {
+            appendSubstring(list, original, start, match - start);
         }
+        start = match + delimiter->length;
     }
     if (start < original->length) {
-        int length = original->length - start;
-        char* substring = ALLOCATE(char, length + 1);
-        memcpy(substring, original->chars + start, length);
-        substring[length] = '\0';
-        ObjString* subStrObj = takeString(substring, length);
-        if (list->values.count >= list->values.capacity) {
-            growValueArray(&list->values);
-        }
-        list->values.values[list->count++] = OBJ_VAL(subStrObj);
+        appendSubstring(list, original, start, original->length - start);
     }
-    list->values.count = list->count;
+    pop();
     return OBJ_VAL(list);
 }
 
@@ -185,11 +224,11 @@ Value split(int argCount, Value* args, ParamInfo* params) {
  * @brief Strips whitespace from the start and end of a string.
  * @param argCount The number of arguments passed to the function.
  * @param args The arguments passed to the function.
- * @return A new string with leading and trailing whitespace removed.
+ * @return A view of the string with leading and trailing whitespace removed.
  */
 Value strip(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("strip() must be called on a string.");
+        return nativeError("strip() must be called on a string.");
     }
 
     ObjString* original = AS_STRING(args[0]);
@@ -217,12 +256,10 @@ Value strip(int argCount, Value* args, ParamInfo* params) {
     }
 
     int length = end - start + 1;
-    char* strippedChars = ALLOCATE(char, length + 1);
-    memcpy(strippedChars, original->chars + start, length);
-    strippedChars[length] = '\0';
-
-    ObjString* strippedString = takeString(strippedChars, length);
-    return OBJ_VAL(strippedString);
+    if (length == original->length) {
+        return args[0];
+    }
+    return OBJ_VAL(newStringView(original, start, length));
 }
 
 /**
@@ -233,7 +270,7 @@ Value strip(int argCount, Value* args, ParamInfo* params) {
  */
 Value startsWith(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 2 || !IS_STRING(args[0]) || !IS_STRING(args[1])) {
-        return ERROR_VAL_PTR("startswith() must be called on a string and a prefix string.");
+        return nativeError("startswith() must be called on a string and a prefix string.");
     }
 
     ObjString* original = AS_STRING(args[0]);
@@ -260,7 +297,7 @@ Value startsWith(int argCount, Value* args, ParamInfo* params) {
  */
 Value endsWith(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 2 || !IS_STRING(args[0]) || !IS_STRING(args[1])) {
-        return ERROR_VAL_PTR("endswith() must be called on a string and a suffix string.");
+        return nativeError("endswith() must be called on a string and a suffix string.");
     }
 
     ObjString* original = AS_STRING(args[0]);
@@ -288,7 +325,7 @@ Value endsWith(int argCount, Value* args, ParamInfo* params) {
  */
 Value isAlpha(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("isalpha() must be called on a string.");
+        return nativeError("isalpha() must be called on a string.");
     }
     ObjString* str = AS_STRING(args[0]);
     for (int i = 0; i < str->length; i++) {
@@ -307,7 +344,7 @@ Value isAlpha(int argCount, Value* args, ParamInfo* params) {
  */
 Value isAlphaNumeric(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("isalphanum() must be called on a string.");
+        return nativeError("isalphanum() must be called on a string.");
     }
     ObjString* str = AS_STRING(args[0]);
     for (int i = 0; i < str->length; i++) {
@@ -326,7 +363,7 @@ Value isAlphaNumeric(int argCount, Value* args, ParamInfo* params) {
  */
 Value isDigit(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("isdigit() must be called on a string.");
+        return nativeError("isdigit() must be called on a string.");
     }
     ObjString* str = AS_STRING(args[0]);
     for (int i = 0; i < str->length; i++) {
@@ -345,28 +382,12 @@ Value isDigit(int argCount, Value* args, ParamInfo* params) {
  */
 Value find(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 2 || !IS_STRING(args[0]) || !IS_STRING(args[1])) {
-        return ERROR_VAL_PTR("find() must be called on a string and a substring.");
+        return nativeError("find() must be called on a string and a substring.");
     }
     ObjString* original = AS_STRING(args[0]);
     ObjString* sub = AS_STRING(args[1]);
 
-    if (sub->length > original->length) {
-        return NUMBER_VAL(-1.0);
-    }
-
-    for (int i = 0; i <= original->length - sub->length; i++) {
-        bool match = true;
-        for (int j = 0; j < sub->length; j++) {
-            if (original->chars[i + j] != sub->chars[j]) {
-                match = false;
-                break;
-            }
-        }
-        if (match) {
-            return NUMBER_VAL((double)i);
-        }
-    }
-    return NUMBER_VAL(-1.0);
+    return NUMBER_VAL((double)findSubstring(original, sub, 0));
 }
 
 /**
@@ -377,58 +398,41 @@ Value find(int argCount, Value* args, ParamInfo* params) {
  */
 Value replace(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 3 || !IS_STRING(args[0]) || !IS_STRING(args[1]) || !IS_STRING(args[2])) {
-        return ERROR_VAL_PTR("replace() must be called on a string, old substring, and new substring.");
+        return nativeError("replace() must be called on a string, old substring, and new substring.");
     }
     ObjString* original = AS_STRING(args[0]);
     ObjString* oldSub = AS_STRING(args[1]);
     ObjString* newSub = AS_STRING(args[2]);
 
     if (oldSub->length == 0) {
-        return OBJ_VAL(copyString(original->chars, original->length));
+        return OBJ_VAL(copyRuntimeString(original->chars, original->length));
     }
 
     int count = 0;
-    for (int i = 0; i <= original->length - oldSub->length; i++) {
-        bool match = true;
-        for (int j = 0; j < oldSub->length; j++) {
-            if (original->chars[i + j] != oldSub->chars[j]) {
-                match = false;
-                break;
-            }
-        }
-        if (match) {
-            count++;
-            i += oldSub->length - 1;
-        }
+    for (int i = findSubstring(original, oldSub, 0); i != -1; i = findSubstring(original, oldSub, i + oldSub->length)) {
+        count++;
     }
 
     if (count == 0) {
-        return OBJ_VAL(copyString(original->chars, original->length));
+        return OBJ_VAL(copyRuntimeString(original->chars, original->length));
     }
 
     int newLength = original->length + count * (newSub->length - oldSub->length);
     char* newChars = ALLOCATE(char, newLength + 1);
     int newIndex = 0;
 
-    for (int i = 0; i < original->length;) {
-        bool match = true;
-        for (int j = 0; j < oldSub->length && i + j < original->length; j++) {
-            if (original->chars[i + j] != oldSub->chars[j]) {
-                match = false;
-                break;
-            }
-        }
-        if (match) {
-            memcpy(newChars + newIndex, newSub->chars, newSub->length);
-            newIndex += newSub->length;
-            i += oldSub->length;
-        } else {
-            newChars[newIndex++] = original->chars[i++];
-        }
+    int start = 0;
+    for (int i = findSubstring(original, oldSub, 0); i != -1; i = findSubstring(original, oldSub, start)) {
+        memcpy(newChars + newIndex, original->chars + start, i - start);
+        newIndex += i - start;
+        memcpy(newChars + newIndex, newSub->chars, newSub->length);
+        newIndex += newSub->length;
+        start = i + oldSub->length;
     }
-    newChars[newIndex] = '\0';
+    memcpy(newChars + newIndex, original->chars + start, original->length - start);
+    newChars[newLength] = '\0';
 
-    ObjString* resultString = takeString(newChars, newLength);
+    ObjString* resultString = takeRuntimeString(newChars, newLength);
     return OBJ_VAL(resultString);
 }
 
@@ -440,7 +444,7 @@ Value replace(int argCount, Value* args, ParamInfo* params) {
  */
 Value count(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 2 || !IS_STRING(args[0]) || !IS_STRING(args[1])) {
-        return ERROR_VAL_PTR("count() must be called on a string and a substring.");
+        return nativeError("count() must be called on a string and a substring.");
     }
     ObjString* original = AS_STRING(args[0]);
     ObjString* sub = AS_STRING(args[1]);
@@ -450,18 +454,8 @@ Value count(int argCount, Value* args, ParamInfo* params) {
     }
 
     int count = 0;
-    for (int i = 0; i <= original->length - sub->length; i++) {
-        bool match = true;
-        for (int j = 0; j < sub->length; j++) {
-            if (original->chars[i + j] != sub->chars[j]) {
-                match = false;
-                break;
-            }
-        }
-        if (match) {
-            count++;
-            i += sub->length - 1;
-        }
+    for (int i = findSubstring(original, sub, 0); i != -1; i = findSubstring(original, sub, i + sub->length)) {
+        count++;
     }
     return NUMBER_VAL((double)count);
 }
@@ -474,17 +468,16 @@ Value count(int argCount, Value* args, ParamInfo* params) {
  */
 Value strIndex(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 2 || !IS_STRING(args[0]) || !IS_STRING(args[1])) {
-        return ERROR_VAL_PTR("index() must be called on a string and a substring.");
+        return nativeError("index() must be called on a string and a substring.");
     }
     ObjString* str = AS_STRING(args[0]);
     ObjString* index = AS_STRING(args[1]);
     if (index->length != 1) {
-        return ERROR_VAL_PTR("index() second argument must be a single character.");
+        return nativeError("index() second argument must be a single character.");
     }
-    for (int i = 0; i < str->length; i++) {
-        if (str->chars[i] == index->chars[0]) {
-            return NUMBER_VAL((double)i);
-        }
+    int position = findSubstring(str, index, 0);
+    if (position != -1) {
+        return NUMBER_VAL((double)position);
     }
-    return ERROR_VAL_PTR("Character not found in string.");
+    return nativeError("Character not found in string.");
 }
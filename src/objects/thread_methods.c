@@ -0,0 +1,190 @@
+/**
+ * @file thread_methods.c
+ * @brief Implementation of thread and channel methods in CSLO.
+ *
+ * Waiting on a thread or a channel blocks the whole VM, including any
+ * async tasks, until the other thread gets there.
+ */
+
+#include <pthread.h>
+
+#include "builtins/util.h"
+#include "core/object.h"
+#include "core/value.h"
+#include "core/vm.h"
+#include "objects/thread_methods.h"
+#include "std/thread.h"
+
+static Value threadJoin(int argCount, Value* args, ParamInfo* params);
+static Value threadDone(int argCount, Value* args, ParamInfo* params);
+static Value channelSend(int argCount, Value* args, ParamInfo* params);
+static Value channelRecv(int argCount, Value* args, ParamInfo* params);
+static Value channelClose(int argCount, Value* args, ParamInfo* params);
+
+/**
+ * The thread methods, each one created the first time it's looked up.
+ */
+static NativeDef threadNatives[] = {
+    {"join", threadJoin, 1, 1, {{"self", true}}},
+    {"done", threadDone, 1, 1, {{"self", true}}},
+    {NULL}
+};
+
+/**
+ * The channel methods, each one created the first time it's looked up.
+ */
+static NativeDef channelNatives[] = {
+    {"send", channelSend, 2, 3, {{"self", true}, {"value", true}, {"transfer", false}}},
+    {"recv", channelRecv, 1, 1, {{"self", true}}},
+    {"close", channelClose, 1, 1, {{"self", true}}},
+    {NULL}
+};
+
+/**
+ * @brief Registers thread methods for the given ObjClass.
+ * @param cls The ObjClass representing the thread type.
+ */
+void registerThreadMethods(ObjClass* cls) {
+    cls->natives = threadNatives;
+}
+
+/**
+ * @brief Registers channel methods for the given ObjClass.
+ * @param cls The ObjClass representing the channel type.
+ */
+void registerChannelMethods(ObjClass* cls) {
+    cls->natives = channelNatives;
+}
+
+/**
+ * join native method.
+ * Waits for the thread to finish and returns what its function returned.
+ * Raises an error if the thread did.
+ */
+static Value threadJoin(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_THREAD(args[0])) {
+        return nativeError("join() must be called on a thread.");
+    }
+    ThreadHandle* handle = AS_THREAD(args[0])->handle;
+    if (handle->joined) {
+        return nativeError("join() can't join a thread that's already been joined.");
+    }
+
+    pthread_join(handle->id, NULL);
+    handle->joined = true;
+    if (handle->failed) {
+        return ERROR_VAL_PTR(handle->error);
+    }
+    Value result = unpackMessage(handle->result);
+    freeMessage(handle->result);
+    handle->result = NULL;
+    return result;
+}
+
+/**
+ * done native method.
+ * Returns whether the thread has finished, without waiting for it.
+ */
+static Value threadDone(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_THREAD(args[0])) {
+        return nativeError("done() must be called on a thread.");
+    }
+    ThreadHandle* handle = AS_THREAD(args[0])->handle;
+    pthread_mutex_lock(&handle->lock);
+    bool done = handle->done;
+    pthread_mutex_unlock(&handle->lock);
+    return BOOL_VAL(done);
+}
+
+/**
+ * send native method.
+ * Sends a copy of a value, waiting first if the channel is full.
+ * With transfer, arrays and bytes are moved rather than copied and left empty.
+ */
+static Value channelSend(int argCount, Value* args, ParamInfo* params) {
+    if (argCount < 2 || !IS_CHANNEL(args[0])) {
+        return nativeError("send() must be called on a channel.");
+    }
+    if (argCount == 3 && !IS_BOOL(args[2])) {
+        return nativeError("send() expects transfer to be a bool.");
+    }
+    Channel* channel = AS_CHANNEL(args[0])->channel;
+
+    Value error;
+    Message* message = packMessage(args[1], argCount == 3 && AS_BOOL(args[2]), &error);
+    if (message == NULL) {
+        return error;
+    }
+
+    pthread_mutex_lock(&channel->lock);
+    while (channel->capacity > 0 && channel->count >= channel->capacity && !channel->closed) {
+        pthread_cond_wait(&channel->changed, &channel->lock);
+    }
+    if (channel->closed) {
+        pthread_mutex_unlock(&channel->lock);
+        freeMessage(message);
+        return nativeError("send() can't send on a closed channel.");
+    }
+    if (channel->tail == NULL) {
+        channel->head = message;
+    } else {
+        channel->tail->next = message;
+    }
+    channel->tail = message;
+    channel->count++;
+    pthread_cond_broadcast(&channel->changed);
+    pthread_mutex_unlock(&channel->lock);
+    return NIL_VAL;
+}
+
+/**
+ * recv native method.
+ * Waits for a value and returns it, or returns nil once the channel is
+ * closed and everything sent before that has been received.
+ */
+static Value channelRecv(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_CHANNEL(args[0])) {
+        return nativeError("recv() must be called on a channel.");
+    }
+    Channel* channel = AS_CHANNEL(args[0])->channel;
+
+    pthread_mutex_lock(&channel->lock);
+    while (channel->head == NULL && !channel->closed) {
+        pthread_cond_wait(&channel->changed, &channel->lock);
+    }
+    Message* message = channel->head;
+    if (message != NULL) {
+        channel->head = message->next;
+        if (channel->head == NULL) {
+            channel->tail = NULL;
+        }
+        channel->count--;
+        pthread_cond_broadcast(&channel->changed);
+    }
+    pthread_mutex_unlock(&channel->lock);
+
+    if (message == NULL) {
+        return NIL_VAL;
+    }
+    Value value = unpackMessage(message);
+    freeMessage(message);
+    return value;
+}
+
+/**
+ * close native method.
+ * Closes the channel: sending raises an error from then on, and receiving
+ * returns nil once the values already sent have been received.
+ */
+static Value channelClose(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 1 || !IS_CHANNEL(args[0])) {
+        return nativeError("close() must be called on a channel.");
+    }
+    Channel* channel = AS_CHANNEL(args[0])->channel;
+
+    pthread_mutex_lock(&channel->lock);
+    channel->closed = true;
+    pthread_cond_broadcast(&channel->changed);
+    pthread_mutex_unlock(&channel->lock);
+    return NIL_VAL;
+}
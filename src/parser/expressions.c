@@ -5,19 +5,27 @@
  * variables, and control flow statements.
  */
 
+#include "ctype.h"
 #include "stdbool.h"
 #include "stdlib.h"
+#include "string.h"
 
 #include "core/chunk.h"
 #include "compiler/codegen.h"
 #include "parser/parser.h"
 #include "compiler/scanner.h"
 #include "parser/expressions.h"
+#include "util.h"
 
  /**
   * Method for parsing a dictionary literal.
   */
 void parseDictLiteral(bool canAssign) {
+    if (comprehensionAhead()) {
+        comprehension(true);
+        return;
+    }
+    const char* start = parser.previous.start;
     int kVPairsCount = 0;
     if (!checkToken(TOKEN_RIGHT_BRACE)) {
         do {
@@ -31,39 +39,133 @@ void parseDictLiteral(bool canAssign) {
     emitByte(OP_DICT, parser.previous.line);
     emitByte((kVPairsCount >> 8) & 0xff, parser.previous.line);
     emitByte(kVPairsCount & 0xff, parser.previous.line);
+    markLiteral(start);
 }
 
 /**
  * @brief Compiles a numeric literal.
  *
- * Emits bytecode to load the number onto the stack.
+ * Emits bytecode to load the number onto the stack, as an int when
+ * it's written without a fraction and fits in one.
  *
  * @param canAssign Indicates if assignment is allowed (unused).
  */
 void parseNumberLiteral(bool canAssign) {
     double value = strtod(parser.previous.start, NULL);
-    emitConstant(NUMBER_VAL(value));
+    bool fraction = memchr(parser.previous.start, '.', parser.previous.length) != NULL;
+    emitConstant(!fraction && value <= INT32_MAX ? INT_VAL((int32_t)value) : NUMBER_VAL(value));
+}
+
+/**
+ * Method for emitting a literal chunk of a string, unescaped once here rather
+ * than every time it's printed or written.
+ */
+static void emitStringChunk(const char* start, int length) {
+    size_t unescLength;
+    char* unesc = unescapeString(start, length, &unescLength);
+    emitConstant(OBJ_VAL(copyString(unesc, (int)unescLength)));
+    free(unesc);
+}
+
+/**
+ * Method for finding the colon that starts a ${} expression's format spec.
+ * Colons inside brackets belong to the expression, like a slice or a dict.
+ */
+static const char* findFormatSpec(const char* start, int length) {
+    int depth = 0;
+    for (const char* curr = start; curr < start + length; curr++) {
+        if (curr[0] == '(' || curr[0] == '[' || curr[0] == '{') depth++;
+        else if (curr[0] == ')' || curr[0] == ']' || curr[0] == '}') depth--;
+        else if (curr[0] == ':' && depth == 0) return curr;
+    }
+    return NULL;
+}
+
+/**
+ * Method for compiling a format spec into OP_FORMAT's bytes for its part.
+ *
+ * Specs are [<>^][0][width][.precision][f|e|g|d|x], aligning to the left,
+ * right or centre, padding numbers with zeros and converting them as fixed
+ * point, exponent, general, integer or hex.
+ */
+static void parseFormatSpec(const char* start, int length, uint8_t* spec) {
+    const char* curr = start;
+    const char* end = start + length;
+    spec[0] = 0;
+    spec[1] = 0;
+    spec[2] = 0;
+    if (curr < end && (*curr == '<' || *curr == '>' || *curr == '^')) {
+        spec[0] |= *curr == '<' ? FORMAT_ALIGN_LEFT : *curr == '>' ? FORMAT_ALIGN_RIGHT : FORMAT_ALIGN_CENTER;
+        curr++;
+    }
+    if (curr < end && *curr == '0') {
+        spec[0] |= FORMAT_ZERO_PAD;
+        curr++;
+    }
+    int width = 0;
+    while (curr < end && isdigit((unsigned char)*curr)) {
+        width = width * 10 + (*curr++ - '0');
+        if (width > UINT8_MAX) {
+            error("Format width can't be more than 255.");
+            return;
+        }
+    }
+    spec[1] = (uint8_t)width;
+    if (curr < end && *curr == '.') {
+        curr++;
+        if (curr == end || !isdigit((unsigned char)*curr)) {
+            error("Expect a precision after '.' in format spec.");
+            return;
+        }
+        int precision = 0;
+        while (curr < end && isdigit((unsigned char)*curr)) {
+            precision = precision * 10 + (*curr++ - '0');
+            if (precision > UINT8_MAX) {
+                error("Format precision can't be more than 255.");
+                return;
+            }
+        }
+        spec[0] |= FORMAT_PRECISION;
+        spec[2] = (uint8_t)precision;
+    }
+    if (curr < end) {
+        const char* types = "fegdx";
+        const char* type = memchr(types, *curr, strlen(types));
+        if (type == NULL) {
+            error("Unknown format spec type.");
+            return;
+        }
+        spec[0] |= (uint8_t)(FORMAT_FIXED + (type - types));
+        curr++;
+    }
+    if (curr < end) {
+        error("Invalid format spec.");
+    }
 }
 
 /**
  * @brief Compiles a string literal.
  *
  * Emits bytecode to load the string onto the stack.
+ * An interpolated ${} expression can end with a format spec after a colon,
+ * like ${price:.2f} or ${name:>10}, compiled into the OP_FORMAT that joins the
+ * parts so the values are formatted straight into the result.
  *
  * @param canAssign Indicates if assignment is allowed (unused).
  */
 void parseStringLiteral(bool canAssign) {
-    // emitConstant(OBJ_VAL(copyString(parser.previous.start +1, parser.previous.length - 2)));
     const char* start = parser.previous.start + 1;
     const char* end = start + parser.previous.length - 2;
     const char* curr = start;
     int chunkCount = 0;
+    uint8_t specs[UINT8_MAX * FORMAT_SPEC_BYTES] = {0};
+    bool formatted = false;
 
     while (curr < end) {
         if (curr[0] == '$' && curr[1] == '{') {
             // Emit string chunk before ${
             if (curr > start) {
-                emitConstant(OBJ_VAL(copyString(start, curr - start)));
+                emitStringChunk(start, curr - start);
                 chunkCount++;
             }
             curr += 2; // skip ${
@@ -76,9 +178,14 @@ void parseStringLiteral(bool canAssign) {
                 curr++;
             }
             int exprLen = (curr - exprStart) - 1; // exclude closing }
-            // Parse the expression in exprStart[0..exprLen]
-            // Option 1: Temporarily re-init scanner/parser for this substring
-            // Option 2: Add a helper to parse an expression from a string
+            const char* colon = findFormatSpec(exprStart, exprLen);
+            if (colon != NULL) {
+                if (chunkCount < UINT8_MAX) {
+                    parseFormatSpec(colon + 1, exprLen - (int)(colon + 1 - exprStart), &specs[chunkCount * FORMAT_SPEC_BYTES]);
+                }
+                exprLen = (int)(colon - exprStart);
+                formatted = true;
+            }
             parseEmbeddedExpression(exprStart, exprLen);
             chunkCount++;
             start = curr;
@@ -88,15 +195,22 @@ void parseStringLiteral(bool canAssign) {
     }
     // Emit remaining string chunk, if any
     if (start < end) {
-        emitConstant(OBJ_VAL(copyString(start, end - start)));
+        emitStringChunk(start, end - start);
         chunkCount++;
     }
 
     if (chunkCount == 0) {
         emitConstant(OBJ_VAL(copyString("", 0))); // Emit empty string if nothing was emitted
-    } else {
-        for (int i = 1; i < chunkCount; i++) {
-            emitByte(OP_INTERPOLATE, parser.previous.line);
+    } else if (chunkCount > UINT8_MAX) {
+        error("Can't have more than 255 parts in an interpolated string.");
+    } else if (formatted) {
+        // the specs follow the count, one for each part with plain ones all zero
+        emitBytes(OP_FORMAT, (uint8_t)chunkCount);
+        for (int i = 0; i < chunkCount * FORMAT_SPEC_BYTES; i++) {
+            emitByte(specs[i], parser.previous.line);
         }
+    } else if (chunkCount > 1) {
+        // join all the parts in one go rather than a pair at a time
+        emitBytes(OP_INTERPOLATE, (uint8_t)chunkCount);
     }
 }
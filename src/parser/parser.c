@@ -5,12 +5,15 @@
 
 #include "stdio.h"
 #include "stdlib.h"
+#include <math.h>
 #include <string.h>
 
 #include "compiler/codegen.h"
 #include "compiler/scanner.h"
 #include "parser/parser.h"
 #include "core/chunk.h"
+#include "core/memory.h"
+#include "core/object.h"
 #include "parser/statements.h"
 #include "parser/rules.h"
 
@@ -20,6 +23,7 @@
 void initParser() {
     parser.hadError = false;
     parser.panicMode = false;
+    parser.quiet = false;
     parser.previous = (Token){0};
     parser.current = (Token){0};
     parser.interpolating = false;
@@ -62,6 +66,11 @@ void parserAdvance() {
     }
 }
 
+/**
+ * Where the left operand of the infix rule being compiled starts.
+ */
+static THREAD_LOCAL CodeMark infixOperand;
+
 /**
  * Method for parsing an expression with a given precedence.
  *
@@ -69,6 +78,7 @@ void parserAdvance() {
  * and advance the parser's token.
  */
 void parsePrecedence(Precedence precedence) {
+    CodeMark start = markCode();
     parserAdvance();
     ParseFn prefixRule = getRule(parser.previous.type)->prefix;
     if (prefixRule == NULL) {
@@ -82,6 +92,7 @@ void parsePrecedence(Precedence precedence) {
     while (precedence <= getRule(parser.current.type)->precedence) {
         parserAdvance();
         ParseFn infixRule = getRule(parser.previous.type)->infix;
+        infixOperand = start;
         infixRule(canAssign);
     }
 
@@ -122,6 +133,71 @@ Token peekToken(int n) {
     return parser.lookahead[n - 1];
 }
 
+/**
+ * Method for checking whether the bracketed expression the current token starts
+ * is a comprehension, by scanning ahead for a 'for' before the first top level
+ * ',' or closing bracket. Nothing is consumed.
+ */
+bool comprehensionAhead() {
+    Scanner savedScanner = scanner;
+    bool found = false;
+    int depth = 0;
+    for (int i = 0; !found; i++) {
+        Token token = i <= MAX_LOOKAHEAD ? peekToken(i) : scanToken();
+        if (token.type == TOKEN_EOF || token.type == TOKEN_ERROR) {
+            break;
+        }
+        if (token.type == TOKEN_LEFT_PAREN || token.type == TOKEN_LEFT_BRACKET || token.type == TOKEN_LEFT_BRACE) {
+            depth++;
+        } else if (token.type == TOKEN_RIGHT_PAREN || token.type == TOKEN_RIGHT_BRACKET || token.type == TOKEN_RIGHT_BRACE) {
+            if (depth-- == 0) {
+                break;
+            }
+        } else if (depth == 0 && token.type == TOKEN_COMMA) {
+            break;
+        } else if (depth == 0 && token.type == TOKEN_FOR) {
+            found = true;
+        }
+    }
+    scanner = savedScanner;
+    return found;
+}
+
+/**
+ * Method for finding where the finally clause of the try statement whose block
+ * the current token starts begins, by scanning ahead over the block and any
+ * except clauses. Nothing is consumed. Returns false if it has none.
+ */
+bool finallyAhead(Token* brace) {
+    Scanner savedScanner = scanner;
+    bool found = false;
+    bool finally = false;
+    int depth = 0;
+    for (int i = 0;; i++) {
+        Token token = i <= MAX_LOOKAHEAD ? peekToken(i) : scanToken();
+        if (token.type == TOKEN_EOF || token.type == TOKEN_ERROR) {
+            break;
+        }
+        if (finally) {
+            found = token.type == TOKEN_LEFT_BRACE;
+            *brace = token;
+            break;
+        }
+        if (token.type == TOKEN_LEFT_BRACE) {
+            depth++;
+        } else if (token.type == TOKEN_RIGHT_BRACE) {
+            depth--;
+        } else if (depth == 0 && token.type == TOKEN_FINALLY) {
+            finally = true;
+        } else if (depth == 0 && token.type != TOKEN_EXCEPT && token.type != TOKEN_IDENTIFIER
+                && token.type != TOKEN_COMMA && token.type != TOKEN_AS) {
+            break;
+        }
+    }
+    scanner = savedScanner;
+    return found;
+}
+
 /**
  * Method for consuming a given token type.
  *
@@ -261,6 +337,33 @@ void variable(bool canAssign) {
     namedVariable(parser.previous, canAssign);
 }
 
+/**
+ * Method for storing the value on top of the stack into a variable
+ * that's being incremented or compound assigned.
+ */
+static void emitAssignment(Token* name) {
+    uint8_t setOp;
+    bool isFinal = false;
+    int arg = resolveLocal(current, name);
+
+    if (arg != -1) {
+        setOp = OP_SET_LOCAL;
+        isFinal = current->locals[arg].isFinal;
+        current->locals[arg].literal = -1;
+    } else if ((arg = resolveUpvalue(current, name)) != -1) {
+        setOp = OP_SET_UPVALUE;
+        isFinal = current->upvalues[arg].isFinal;
+    } else {
+        arg = resolveGlobal(name);
+        setOp = OP_SET_GLOBAL;
+    }
+
+    if (isFinal) {
+        error("Cannot assign to final variable.");
+    }
+    emitVariableOp(setOp, arg);
+}
+
 /**
  * @brief Compiles a postfix increment or decrement expression (x++ or x--).
  *
@@ -276,23 +379,11 @@ void postfixIncDec(bool canAssign) {
     // The variable is already on the stack (from the prefix rule for identifiers)
     // Duplicate the value for the result
     emitByte(OP_DUP, parser.previous.line);
-    emitConstant(NUMBER_VAL(1));
+    emitConstant(INT_VAL(1));
     emitByte(op == TOKEN_PLUS_PLUS ? OP_ADD : OP_SUBTRACT, parser.previous.line);
 
 
-    uint8_t setOp;
-    int arg = resolveLocal(current, &lastVariableToken);
-
-    if (arg != -1) {
-        setOp = OP_SET_LOCAL;
-    } else if ((arg = resolveUpvalue(current, &lastVariableToken)) != -1) {
-        setOp = OP_SET_UPVALUE;
-    } else {
-        arg = identifierConstant(&lastVariableToken);
-        setOp = OP_SET_GLOBAL;
-    }
-
-    emitBytes(setOp, (uint8_t)arg);
+    emitAssignment(&lastVariableToken);
     emitByte(OP_POP, parser.previous.line);
 }
 
@@ -309,20 +400,9 @@ void prefixIncDec(bool canAssign) {
     TokenType op = parser.previous.type;
     parserAdvance();
     variable(false);
-    emitConstant(NUMBER_VAL(1));
+    emitConstant(INT_VAL(1));
     emitByte(op == TOKEN_PLUS_PLUS ? OP_ADD : OP_SUBTRACT, parser.previous.line);
-    uint8_t setOp;
-    int arg = resolveLocal(current, &lastVariableToken);
-
-    if (arg != -1) {
-        setOp = OP_SET_LOCAL;
-    } else if ((arg = resolveUpvalue(current, &lastVariableToken)) != -1) {
-        setOp = OP_SET_UPVALUE;
-    } else {
-        arg = identifierConstant(&lastVariableToken);
-        setOp = OP_SET_GLOBAL;
-    }
-    emitBytes(setOp, (uint8_t)arg);
+    emitAssignment(&lastVariableToken);
 }
 
 /**
@@ -360,23 +440,18 @@ void compoundAssign(bool canAssign) {
     }
 
     // Assign the result back to the variable
-    uint8_t setOp;
-    int arg = resolveLocal(current, &varToken);
-    if (arg != -1) {
-        setOp = OP_SET_LOCAL;
-    } else if ((arg = resolveUpvalue(current, &varToken)) != -1) {
-        setOp = OP_SET_UPVALUE;
-    } else {
-        arg = identifierConstant(&varToken);
-        setOp = OP_SET_GLOBAL;
-    }
-    emitBytes(setOp, (uint8_t)arg);
+    emitAssignment(&varToken);
 }
 
 /**
  * Method for compiling a list.
  */
 void list(bool canAssign) {
+    if (comprehensionAhead()) {
+        comprehension(false);
+        return;
+    }
+    const char* start = parser.previous.start;
     int32_t argCount = 0;
 
     if (!checkToken(TOKEN_RIGHT_BRACKET)) {
@@ -393,6 +468,7 @@ void list(bool canAssign) {
     emitByte(OP_LIST, parser.previous.line);
     emitByte((argCount >> 8) & 0xff, parser.previous.line);
     emitByte(argCount & 0xff, parser.previous.line);
+    markLiteral(start);
 }
 
 /**
@@ -494,16 +570,90 @@ void hasNot(bool canAssign) {
     emitByte(OP_HAS_NOT, parser.previous.line);
 }
 
+/**
+ * Method for evaluating a binary operator on two literals at compile time.
+ *
+ * This mirrors what the VM does for each operator and returns false for
+ * anything it'd raise an error for, so those still fail at runtime.
+ */
+static bool foldBinary(TokenType operatorType, Value left, Value right, Value* result) {
+    if (operatorType == TOKEN_EQUAL_EQUAL || operatorType == TOKEN_BANG_EQUAL) {
+        bool equal = valuesEqual(left, right);
+        *result = BOOL_VAL(operatorType == TOKEN_EQUAL_EQUAL ? equal : !equal);
+        return true;
+    }
+
+    if (operatorType == TOKEN_PLUS && IS_STRING(left) && IS_STRING(right)) {
+        ObjString* a = AS_STRING(left);
+        ObjString* b = AS_STRING(right);
+        int length = a->length + b->length;
+        char* chars = ALLOCATE(char, length + 1);
+        memcpy(chars, a->chars, a->length);
+        memcpy(chars + a->length, b->chars, b->length);
+        chars[length] = '\0';
+        *result = OBJ_VAL(takeString(chars, length));
+        return true;
+    }
+
+    if (!IS_NUMBER(left) || !IS_NUMBER(right)) {
+        return false;
+    }
+
+    if (IS_INT(left) && IS_INT(right)) {
+        int32_t folded;
+        bool fits;
+        switch (operatorType) {
+            case TOKEN_PLUS:   fits = addInts(AS_INT(left), AS_INT(right), &folded); break;
+            case TOKEN_MINUS:  fits = subtractInts(AS_INT(left), AS_INT(right), &folded); break;
+            case TOKEN_STAR:   fits = multiplyInts(AS_INT(left), AS_INT(right), &folded); break;
+            case TOKEN_MODULO: fits = remainderInts(AS_INT(left), AS_INT(right), &folded); break;
+            default:           fits = false; break;
+        }
+        if (fits) {
+            *result = INT_VAL(folded);
+            return true;
+        }
+    }
+
+    double a = AS_NUMBER(left);
+    double b = AS_NUMBER(right);
+    switch (operatorType) {
+        case TOKEN_GREATER:       *result = BOOL_VAL(a > b); return true;
+        case TOKEN_GREATER_EQUAL: *result = BOOL_VAL(a >= b); return true;
+        case TOKEN_LESS:          *result = BOOL_VAL(a < b); return true;
+        case TOKEN_LESS_EQUAL:    *result = BOOL_VAL(a <= b); return true;
+        case TOKEN_PLUS:          *result = NUMBER_VAL(a + b); return true;
+        case TOKEN_MINUS:         *result = NUMBER_VAL(a - b); return true;
+        case TOKEN_STAR:          *result = NUMBER_VAL(a * b); return true;
+        case TOKEN_SLASH:         *result = NUMBER_VAL(a / b); return true;
+        case TOKEN_MODULO:        *result = NUMBER_VAL(remainder(a, b)); return true;
+        case TOKEN_EXPO:          *result = NUMBER_VAL(pow(a, b)); return true;
+        default:                  return false;
+    }
+}
+
 /**
  *
  */
 void binary(bool canAssign) {
     TokenType operatorType = parser.previous.type;
+    CodeMark leftStart = infixOperand;
+    Value left;
+    bool leftConstant = constantExpression(leftStart, &left);
 
     int tLine = parser.previous.line;
     ParseRule* rule = getRule(operatorType);
+    CodeMark rightStart = markCode();
     parsePrecedence((Precedence)(rule->precedence + 1));
 
+    Value right;
+    Value result;
+    if (leftConstant && constantExpression(rightStart, &right) && foldBinary(operatorType, left, right, &result)) {
+        rewindCode(leftStart);
+        emitLiteral(result);
+        return;
+    }
+
     switch (operatorType) {
         case TOKEN_BANG_EQUAL:
             emitByte(OP_NOT_EQUAL, tLine);
@@ -550,10 +700,33 @@ void binary(bool canAssign) {
  * Method for compiling function calls.
  */
 void parseCall(bool canAssign) {
+    // a property that's called straight away, like "(a.b)(c)", is invoked rather than bound to a.
+    // Not if a jump lands after it though, as then something else could be the callee.
+    Chunk* chunk = currentChunk();
+    int getProperty = current->lastGetProperty;
+    if (getProperty != -1 && getProperty == chunk->count - 5 && chunk->code[getProperty] == OP_GET_PROPERTY
+            && current->lastJumpTarget != chunk->count) {
+        uint16_t name = (uint16_t)((chunk->code[getProperty + 1] << 8) | chunk->code[getProperty + 2]);
+        uint8_t cacheHigh = chunk->code[getProperty + 3];
+        uint8_t cacheLow = chunk->code[getProperty + 4];
+        CodeMark mark = markCode();
+        mark.offset = getProperty;
+        rewindCode(mark);
+
+        uint8_t argCount = argumentList();
+        emitShortOp(OP_INVOKE, name);
+        emitByte(argCount, parser.previous.line);
+        // it keeps the property's inline cache, which nothing else uses
+        emitByte(cacheHigh, parser.previous.line);
+        emitByte(cacheLow, parser.previous.line);
+        return;
+    }
+
     uint8_t argCount = argumentList();
     #ifdef DEBUG_LOGGING
     printf("Emitting OP_CALL with %d args. Locals: %d\n", argCount, current->localCount);
     #endif
+    current->lastCall = currentChunk()->count;
     emitBytes(OP_CALL, argCount);
 }
 
@@ -562,17 +735,21 @@ void parseCall(bool canAssign) {
 */
 void dot(bool canAssign) {
     consumeToken(TOKEN_IDENTIFIER, "Expect property name after '.'.");
-    uint8_t name = identifierConstant(&parser.previous);
+    uint16_t name = identifierConstant(&parser.previous);
 
     if (canAssign && matchToken(TOKEN_EQUAL)) {
         parseExpression();
-        emitBytes(OP_SET_PROPERTY, name);
+        emitShortOp(OP_SET_PROPERTY, name);
+        emitInlineCache();
     } else if (matchToken(TOKEN_LEFT_PAREN)) {
         uint8_t argCount = argumentList();
-        emitBytes(OP_INVOKE, name);
+        emitShortOp(OP_INVOKE, name);
         emitByte(argCount, parser.previous.line);
+        emitInlineCache();
     } else {
-        emitBytes(OP_GET_PROPERTY, name);
+        current->lastGetProperty = currentChunk()->count;
+        emitShortOp(OP_GET_PROPERTY, name);
+        emitInlineCache();
     }
 }
 
@@ -584,17 +761,15 @@ void dot(bool canAssign) {
  * @param canAssign Indicates if assignment is allowed (unused).
  */
 void literal(bool canAssign) {
-
-    int tLine = parser.previous.line;
     switch (parser.previous.type) {
         case TOKEN_FALSE:
-            emitByte(OP_FALSE, tLine);
+            emitLiteral(BOOL_VAL(false));
             break;
         case TOKEN_NIL:
-            emitByte(OP_NIL, tLine);
+            emitLiteral(NIL_VAL);
             break;
         case TOKEN_TRUE:
-            emitByte(OP_TRUE, tLine);
+            emitLiteral(BOOL_VAL(true));
             break;
         default:
             return;
@@ -617,17 +792,17 @@ void super_(bool canAssign) {
 
     consumeToken(TOKEN_DOT, "Expected '.' after 'super'.");
     consumeToken(TOKEN_IDENTIFIER, "Expect superclass method name.");
-    uint8_t name = identifierConstant(&parser.previous);
+    uint16_t name = identifierConstant(&parser.previous);
 
     namedVariable(syntheticToken("self"), false);
     if (matchToken(TOKEN_LEFT_PAREN)) {
         uint8_t argCount = argumentList();
         namedVariable(syntheticToken("super"), false);
-        emitBytes(OP_SUPER_INVOKE, name);
+        emitShortOp(OP_SUPER_INVOKE, name);
         emitByte(argCount, parser.previous.line);
     } else {
         namedVariable(syntheticToken("super"), false);
-        emitBytes(OP_GET_SUPER, name);
+        emitShortOp(OP_GET_SUPER, name);
     }
 }
 
@@ -662,8 +837,24 @@ void unary(bool canAssign) {
     // could be wrong
     int tLine = parser.previous.line;
 
+    CodeMark operandStart = markCode();
     parsePrecedence(PREC_UNARY);
 
+    Value operand;
+    if (constantExpression(operandStart, &operand)) {
+        if (operatorType == TOKEN_MINUS && IS_NUMBER(operand)) {
+            rewindCode(operandStart);
+            int32_t negated;
+            emitLiteral(IS_INT(operand) && negateInt(AS_INT(operand), &negated)
+                ? INT_VAL(negated) : NUMBER_VAL(-AS_NUMBER(operand)));
+            return;
+        } else if (operatorType == TOKEN_BANG) {
+            rewindCode(operandStart);
+            emitLiteral(BOOL_VAL(isFalsey(operand)));
+            return;
+        }
+    }
+
     switch (operatorType) {
         case TOKEN_MINUS:
             emitByte(OP_NEGATE, tLine);
@@ -676,4 +867,4 @@ void unary(bool canAssign) {
     }
 }
 
-Parser parser;
+THREAD_LOCAL Parser parser;
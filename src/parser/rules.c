@@ -86,6 +86,10 @@ ParseRule rules[] = {
     [TOKEN_CONTINUE]        = { NULL,                NULL,           PREC_NONE       },
     [TOKEN_FINAL]           = { NULL,                NULL,           PREC_NONE       },
     [TOKEN_ASSERT]          = { NULL,                NULL,           PREC_NONE       },
+    [TOKEN_TRY]             = { NULL,                NULL,           PREC_NONE       },
+    [TOKEN_EXCEPT]          = { NULL,                NULL,           PREC_NONE       },
+    [TOKEN_FINALLY]         = { NULL,                NULL,           PREC_NONE       },
+    [TOKEN_RAISE]           = { NULL,                NULL,           PREC_NONE       },
     [TOKEN_IMPORT]          = { NULL,                NULL,           PREC_NONE       },
     [TOKEN_ERROR]           = { NULL,                NULL,           PREC_NONE       },
     [TOKEN_EOF]             = { NULL,                NULL,           PREC_NONE       },
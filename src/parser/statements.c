@@ -3,6 +3,7 @@
  * This file contains the declarations for the statements in the CSLO language.
  */
 
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -31,6 +32,10 @@ void parseStatement() {
         continueStatement();
     } else if (matchToken(TOKEN_ASSERT)) {
         assertStatement();
+    } else if (matchToken(TOKEN_TRY)) {
+        tryStatement();
+    } else if (matchToken(TOKEN_RAISE)) {
+        raiseStatement();
     } else if (matchToken(TOKEN_LEFT_BRACE)) {
         beginScope();
         parseBlock();
@@ -49,6 +54,131 @@ void parseExpressionStatement() {
     emitByte(OP_POP, parser.previous.line);
 }
 
+/**
+ * Method for compiling the finally clause of a try statement again, where a
+ * break, continue or return jumps out of it.
+ *
+ * The locals declared inside the try statement are still on the stack but
+ * hidden, so names resolve as they do in the clause itself. A break or
+ * continue in it jumps in the loop around the try statement, so the jumps
+ * it leaves for that loop are kept back from any loop inside the try
+ * statement, which would otherwise patch them as its own.
+ */
+static void finallyClause(TryStatement* statement) {
+    int lengths[UINT8_COUNT];
+    int localCount = current->localCount;
+    for (int i = statement->depth; i < localCount; i++) {
+        lengths[i - statement->depth] = current->locals[i].name.length;
+        current->locals[i].name.length = 0;
+    }
+    TryStatement* innermostTry = current->innermostTry;
+    current->innermostTry = statement->enclosing;
+    int loopStart = current->innermostLoopStart;
+    int loopScopeDepth = current->innermostLoopScopeDepth;
+    int breakCount = current->breakCount;
+    int continueCount = current->continueCount;
+    current->innermostLoopStart = statement->loopStart;
+    current->innermostLoopScopeDepth = statement->loopScopeDepth;
+
+    Parser savedParser = parser;
+    Scanner savedScanner = scanner;
+    scanner.start = statement->finally.start;
+    scanner.current = statement->finally.start;
+    scanner.line = statement->finally.line;
+    parser.hadError = false;
+    for (int i = 0; i < MAX_LOOKAHEAD; i++) {
+        parser.lookahead[i] = scanToken();
+    }
+    parserAdvance();
+    consumeToken(TOKEN_LEFT_BRACE, "Expect '{' after 'finally'.");
+    beginScope();
+    parseBlock();
+    endScope();
+    // its errors have been reported once, so they aren't again for the other copies or the clause itself
+    if (parser.hadError) {
+        statement->hasFinally = false;
+        statement->failed = true;
+    }
+    bool hadError = parser.hadError;
+    parser = savedParser;
+    parser.hadError |= hadError;
+    scanner = savedScanner;
+
+    for (int i = breakCount; i < current->breakCount; i++) {
+        if (statement->breakCount < MAX_FINALLY_EXITS) {
+            statement->breakJumps[statement->breakCount++] = current->breakJumps[i];
+        } else {
+            error("Too many jumps out of a try statement with a finally clause.");
+        }
+    }
+    for (int i = continueCount; i < current->continueCount; i++) {
+        if (statement->continueCount < MAX_FINALLY_EXITS) {
+            statement->continueJumps[statement->continueCount++] = current->continueJumps[i];
+        } else {
+            error("Too many jumps out of a try statement with a finally clause.");
+        }
+    }
+    current->breakCount = breakCount;
+    current->continueCount = continueCount;
+    current->innermostLoopStart = loopStart;
+    current->innermostLoopScopeDepth = loopScopeDepth;
+    current->innermostTry = innermostTry;
+    for (int i = statement->depth; i < localCount; i++) {
+        current->locals[i].name.length = lengths[i - statement->depth];
+    }
+}
+
+/**
+ * Method for running the finally clauses of the try statements a break, continue
+ * or return jumps out of, those started at the given scope depth or deeper.
+ *
+ * They run innermost first. A return's value is on the stack above the
+ * locals while they do, so it's given a slot they can't see.
+ */
+static void finallyClauses(int scopeDepth, bool returning) {
+    TryStatement* innermost = current->innermostTry;
+    int localCount = current->localCount;
+    bool slot = false;
+    for (TryStatement* statement = innermost; statement != NULL && statement->scopeDepth >= scopeDepth; statement = statement->enclosing) {
+        if (!statement->hasFinally) {
+            continue;
+        }
+        if (returning && !slot) {
+            addLocal(syntheticToken(""), false);
+            markInitialized();
+            slot = true;
+        }
+
+        int start = currentChunk()->count;
+        finallyClause(statement);
+        int end = currentChunk()->count;
+        for (TryStatement* inner = innermost;; inner = inner->enclosing) {
+            if (inner->exitCount < MAX_FINALLY_EXITS) {
+                inner->exits[inner->exitCount][0] = start;
+                inner->exits[inner->exitCount][1] = end;
+                inner->exitCount++;
+            } else {
+                error("Too many jumps out of a try statement with a finally clause.");
+            }
+            if (inner == statement) {
+                break;
+            }
+        }
+    }
+    current->localCount = localCount;
+}
+
+/**
+ * Method for popping a local a break or continue jumps out of the scope of.
+ */
+static void popLocal(int local) {
+    if (current->locals[local].literal != -1) {
+        // only known to be safe to free once the rest of its scope's been compiled
+        addLocalPop(currentChunk()->count, local);
+    }
+    emitByte(OP_POP, parser.previous.line);
+}
+
 /**
  * Method for parsing a break statement.
  */
@@ -58,6 +188,7 @@ void breakStatement() {
     }
 
     consumeToken(TOKEN_SEMICOLON, "Expect ';' after 'break'.");
+    finallyClauses(current->innermostLoopScopeDepth, false);
 
     // Discard any locals created inside the loop.
     for (
@@ -65,9 +196,9 @@ void breakStatement() {
         i >= 0 && current->locals[i].depth > current->innermostLoopScopeDepth;
         i--
     ) {
-        emitByte(OP_POP, parser.previous.line);
+        popLocal(i);
     }
-    current->breakJumps[current->breakCount++] = emitJump(OP_JUMP);
+    addBreakJump(emitJump(OP_JUMP));
 }
 
 /**
@@ -79,6 +210,7 @@ void continueStatement() {
     }
 
     consumeToken(TOKEN_SEMICOLON, "Expect ';' after 'continue'.");
+    finallyClauses(current->innermostLoopScopeDepth, false);
 
     // Discard any locals created inside the loop.
     for (
@@ -86,13 +218,13 @@ void continueStatement() {
         i >= 0 && current->locals[i].depth > current->innermostLoopScopeDepth;
         i--
     ) {
-        emitByte(OP_POP, parser.previous.line);
+        popLocal(i);
     }
 
     // Jump to top of current innermost loop.
     // In continueStatement:
     if (current->innermostLoopStart == -6) {
-        current->continueJumps[current->continueCount++] = emitJump(OP_JUMP);
+        addContinueJump(emitJump(OP_JUMP));
     } else {
         emitLoop(current->innermostLoopStart);    // for/while
     }
@@ -144,7 +276,7 @@ void forStatement() {
         addLocal(syntheticToken("__idx"), false);
         markInitialized();
         uint8_t indexSlot = (uint8_t)current->localCount - 1;
-        emitConstant(NUMBER_VAL(0));
+        emitConstant(INT_VAL(0));
         emitBytes(OP_SET_LOCAL, indexSlot);
         // this is the initial value of the index variable
         // do not pop it!
@@ -154,72 +286,47 @@ void forStatement() {
         uint8_t varSlot = (uint8_t)current->localCount - 1;
         // set the loop variable to a random initial value on the stack for now
         // this value will be overwritten on each loop
-        emitConstant(NUMBER_VAL(-1));
+        emitConstant(INT_VAL(-1));
         emitBytes(OP_SET_LOCAL, varSlot);
         // this is the initial value of the loop variable
         // do not pop it!
 
         int surroundingLoopStart = current->innermostLoopStart;
         int surroundingLoopScopeDepth = current->innermostLoopScopeDepth;
-        int surroundingContinueJumps[256];
-        memcpy(surroundingContinueJumps, current->continueJumps, sizeof(current->continueJumps));
+        // the jumps from before are the surrounding loop's, this one's go after them
         int surroundingContinueCount = current->continueCount;
-        int surroundingBreaksJumps[256];
-        memcpy(surroundingBreaksJumps, current->breakJumps, sizeof(current->breakJumps));
         int surroundingBreakCount = current->breakCount;
 
         current->innermostLoopStart = currentChunk()->count;
         current->innermostLoopScopeDepth = current->scopeDepth;
-        current->continueCount = 0;
-
-        // check we're still in range
-        emitBytes(OP_GET_LOCAL, indexSlot);  // push index
-        emitBytes(OP_GET_LOCAL, iterableSlot);     // push iterable
-        emitByte(OP_LEN, parser.previous.line); // pop iterable, push length
-        emitByte(OP_GREATER_EQUAL, parser.previous.line); // compare index >= length
-
-        int exitJump = emitJump(OP_JUMP_IF_TRUE);
-        emitByte(OP_POP, parser.previous.line); // pop the condition only
 
-        // get the current index and iterable
-        // the iterable first, and then the index second
-        // OP_GET_INDEX will then pop both and push the value at that index
-        // OP_SET_LOCAL will then update varSlot with the correct value - note that this won't pop the value
-        // we can then pop the value safely as the original stack slot has been updated
-        emitBytes(OP_GET_LOCAL, iterableSlot);
-        emitBytes(OP_GET_LOCAL, indexSlot);
-
-        emitBytes(OP_INVOKE, makeConstant(OBJ_VAL(copyString("__index__", 9))));
-        emitByte(1, parser.previous.line);
-
-        emitBytes(OP_SET_LOCAL, varSlot);
-        emitByte(OP_POP, parser.previous.line);
+        // advance the cursor and load the next item into the loop variable
+        // jumping out of the loop once the iterable is exhausted
+        // the cursor and loop variable are the two slots after the iterable
+        emitByte(OP_ITER_NEXT, parser.previous.line);
+        emitByte(iterableSlot, parser.previous.line);
+        emitByte(0xff, parser.previous.line);
+        emitByte(0xff, parser.previous.line);
+        int exitJump = currentChunk()->count - 2;
 
         int prevStart = current->innermostLoopStart;
         current->innermostLoopStart = -6;
         parseStatement();
         current->innermostLoopStart = prevStart;
 
-        // increment index
+        // continues jump here to loop back round
         int incrementStart = currentChunk()->count;
 
         // patch all the jumps
-        for (int i = 0; i < current->continueCount; i++) {
+        for (int i = surroundingContinueCount; i < current->continueCount; i++) {
             patchJumpTo(current->continueJumps[i], incrementStart);
         }
 
-        emitBytes(OP_GET_LOCAL, indexSlot);
-        emitConstant(NUMBER_VAL(1));
-        emitByte(OP_ADD, parser.previous.line);
-        emitBytes(OP_SET_LOCAL, indexSlot);
-        emitByte(OP_POP, parser.previous.line); // Pop the value after assignment
-
         emitLoop(current->innermostLoopStart);
         current->innermostLoopStart = incrementStart;
         patchJump(exitJump);
-        emitByte(OP_POP, parser.previous.line); // pop the condition only
         // patch all the breaks
-        for (int i = 0; i < current->breakCount; i++) {
+        for (int i = surroundingBreakCount; i < current->breakCount; i++) {
             patchJump(current->breakJumps[i]);
         }
         // No OP_POP here! endScope() will clean up all locals and stack values for the for-in loop.
@@ -233,9 +340,7 @@ void forStatement() {
         current->innermostLoopStart = surroundingLoopStart;
         current->innermostLoopScopeDepth = surroundingLoopScopeDepth;
         current->continueCount = surroundingContinueCount;
-        memcpy(current->continueJumps, surroundingContinueJumps, sizeof(current->continueJumps));
         current->breakCount = surroundingBreakCount;
-        memcpy(current->breakJumps, surroundingBreaksJumps, sizeof(current->breakJumps));
 
         endScope();
 
@@ -262,11 +367,8 @@ void forStatement() {
 
     int surroundingLoopStart = current->innermostLoopStart;
     int surroundingLoopScopeDepth = current->innermostLoopScopeDepth;
-    int surroundingContinueJumps[256];
-    memcpy(surroundingContinueJumps, current->continueJumps, sizeof(current->continueJumps));
+    // the jumps from before are the surrounding loop's, this one's go after them
     int surroundingContinueCount = current->continueCount;
-    int surroundingBreaksJumps[256];
-    memcpy(surroundingBreaksJumps, current->breakJumps, sizeof(current->breakJumps));
     int surroundingBreakCount = current->breakCount;
 
     current->innermostLoopStart = currentChunk()->count;
@@ -308,17 +410,15 @@ void forStatement() {
     if (exitJump != -1) {
         patchJump(exitJump);
         emitByte(OP_POP, parser.previous.line); // pop the condition only
-        for (int i = 0; i < current->breakCount; i++) {
-            patchJump(current->breakJumps[i]);
-        }
+    }
+    for (int i = surroundingBreakCount; i < current->breakCount; i++) {
+        patchJump(current->breakJumps[i]);
     }
 
     current->innermostLoopStart = surroundingLoopStart;
     current->innermostLoopScopeDepth = surroundingLoopScopeDepth;
     current->continueCount = surroundingContinueCount;
-    memcpy(current->continueJumps, surroundingContinueJumps, sizeof(current->continueJumps));
     current->breakCount = surroundingBreakCount;
-    memcpy(current->breakJumps, surroundingBreaksJumps, sizeof(current->breakJumps));
 
     endScope();
     #ifdef DEBUG_LOGGING
@@ -329,16 +429,34 @@ void forStatement() {
     #endif
 }
 
+/**
+ * Method for compiling a branch of an if statement that can never run.
+ *
+ * The branch still has to be parsed, but everything it emitted is thrown
+ * away, along with any break/continue jumps it registered.
+ */
+static void deadBranch(CodeMark start) {
+    int breakCount = current->breakCount;
+    int continueCount = current->continueCount;
+    parseStatement();
+    rewindCode(start);
+    current->breakCount = breakCount;
+    current->continueCount = continueCount;
+}
+
 /**
  * Method for compiling if statements.
  *
  * This includes compiling the accompanying elif and else statements.
  * We use jumping and patching here for flow so our VM knows where to jump to and from.
+ * Branches whose condition is a literal are resolved at compile time:
+ * a falsey literal drops the branch and a truthy one drops every branch after it.
  */
 void ifStatement() {
     // compile the bit within the '()'
     // should evaluate to true/false
     consumeToken(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+    CodeMark conditionStart = markCode();
     parseExpression();
     consumeToken(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
@@ -353,42 +471,52 @@ void ifStatement() {
         elseJumps[x] = -1;
     }
 
-    // emit the OP_JUMP_IF_FALSE which we'll patch later
-    // this signals where to jump to if our expression evaluates to false
-    int thenJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP, parser.previous.line);
-
-    // compile the actual code within the if block
-    parseStatement();
-
-    // create our jump point to patch later
-    elseJumps[0] = emitJump(OP_JUMP);
-
-    // patch the "if false" jump so we know where to skip to
-    patchJump(thenJump);
-    emitByte(OP_POP, parser.previous.line);
+    // whether a branch with a truthy literal condition has been compiled,
+    // in which case nothing after it can run
+    bool taken = false;
+    int jumps = 0;
+    bool first = true;
 
-    int jumps = 1;
     // continuously loop if we keep finding ELIF tokens
     // each one is compiled similarly to an if
     // if false; we patch jump to the next elif, else, or end of branching
     // at the end of our block, we emit a jump to jump to the end of branching
-    while(matchToken(TOKEN_ELIF)) {
-        if (jumps == MAX_IF_BRANCHES) {
-            error("Too many elif branches!");
+    while (first || matchToken(TOKEN_ELIF)) {
+        if (!first) {
+            if (jumps == MAX_IF_BRANCHES) {
+                error("Too many elif branches!");
+            }
+            // compile the bit within the '()'
+            // should evaluate to true/false
+            consumeToken(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+            conditionStart = markCode();
+            parseExpression();
+            consumeToken(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+        }
+        first = false;
+
+        Value condition;
+        if (taken) {
+            deadBranch(conditionStart);
+            continue;
+        }
+        if (constantExpression(conditionStart, &condition)) {
+            rewindCode(conditionStart);
+            if (isFalsey(condition)) {
+                deadBranch(conditionStart);
+            } else {
+                parseStatement();
+                taken = true;
+            }
+            continue;
         }
-        // compile the bit within the '()'
-        // should evaluate to true/false
-        consumeToken(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
-        parseExpression();
-        consumeToken(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
-        // create patch jump position for next branch
+        // emit the OP_JUMP_IF_FALSE which we'll patch later
         // this signals where to jump to if our expression evaluates to false
         int thenJump = emitJump(OP_JUMP_IF_FALSE);
         emitByte(OP_POP, parser.previous.line);
 
-        // the code in the elif block
+        // compile the actual code within the if block
         parseStatement();
 
         // create our jump point to patch later
@@ -404,7 +532,11 @@ void ifStatement() {
     // else is optional
     // no need for any more patching in here, we just fall out of the 'else' block naturally
     if (matchToken(TOKEN_ELSE)) {
-        parseStatement();
+        if (taken) {
+            deadBranch(markCode());
+        } else {
+            parseStatement();
+        }
     }
 
     for (int j = 0; j < MAX_IF_BRANCHES; j++) {
@@ -425,11 +557,8 @@ void whileStatement() {
 
     int surroundingLoopStart = current->innermostLoopStart;
     int surroundingLoopScopeDepth = current->innermostLoopScopeDepth;
-    int surroundingContinueJumps[256];
-    memcpy(surroundingContinueJumps, current->continueJumps, sizeof(current->continueJumps));
+    // the jumps from before are the surrounding loop's, this one's go after them
     int surroundingContinueCount = current->continueCount;
-    int surroundingBreaksJumps[256];
-    memcpy(surroundingBreaksJumps, current->breakJumps, sizeof(current->breakJumps));
     int surroundingBreakCount = current->breakCount;
 
     current->innermostLoopStart = currentChunk()->count;
@@ -446,16 +575,14 @@ void whileStatement() {
     patchJump(exitJump);
     emitByte(OP_POP, parser.previous.line);
 
-    for (int i = 0; i < current->breakCount; i++) {
+    for (int i = surroundingBreakCount; i < current->breakCount; i++) {
         patchJump(current->breakJumps[i]);
     }
 
     current->innermostLoopStart = surroundingLoopStart;
     current->innermostLoopScopeDepth = surroundingLoopScopeDepth;
     current->continueCount = surroundingContinueCount;
-    memcpy(current->continueJumps, surroundingContinueJumps, sizeof(current->continueJumps));
     current->breakCount = surroundingBreakCount;
-    memcpy(current->breakJumps, surroundingBreaksJumps, sizeof(current->breakJumps));
 
     endScope();
 }
@@ -469,15 +596,33 @@ void returnStatement() {
     }
 
     if (matchToken(TOKEN_SEMICOLON)) {
-        emitReturn();
+        if (current->innermostTry == NULL) {
+            emitReturn();
+            return;
+        }
+        if (current->type == TYPE_INITIALISER) {
+            emitBytes(OP_GET_LOCAL, 0);
+        } else {
+            emitByte(OP_NIL, parser.previous.line);
+        }
     } else {
         if (current->type == TYPE_INITIALISER) {
             error("Can't return a value from an initialiser.");
         }
         parseExpression();
         consumeToken(TOKEN_SEMICOLON, "Expected ';' after return value.");
-        emitByte(OP_RETURN, parser.previous.line);
+        // a call that's the last thing before returning can reuse this frame,
+        // unless a try block in this one has to be around to catch what it raises
+        if (current->lastCall != -1 && current->lastCall == currentChunk()->count - 2 && current->innermostTry == NULL) {
+            currentChunk()->code[current->lastCall] = OP_TAIL_CALL;
+            // the callee takes the frame over without returning, so nothing in scope is freed by it
+            for (int i = 0; i < current->localCount; i++) {
+                current->locals[i].literal = -1;
+            }
+        }
     }
+    finallyClauses(0, true);
+    emitByte(OP_RETURN, parser.previous.line);
 }
 
 
@@ -486,18 +631,15 @@ void returnStatement() {
  */
 void parseImportStatement() {
     consumeToken(TOKEN_IDENTIFIER, "Expected module name after 'import'.");
-    ObjString* moduleName = copyString(parser.previous.start, parser.previous.length);
-
+    Token name = parser.previous;
+    emitShortOp(OP_IMPORT, identifierConstant(&name));
 
+    // the module is bound to a global, under its own name unless it's imported 'as' another
     if (matchToken(TOKEN_AS)) {
         consumeToken(TOKEN_IDENTIFIER, "Expected name after 'as'.");
-        ObjString* moduleNickName = copyString(parser.previous.start, parser.previous.length);
-        emitByte(OP_IMPORT_AS, parser.previous.line);
-        emitByte(makeConstant(OBJ_VAL(moduleName)), parser.previous.line);
-        emitByte(makeConstant(OBJ_VAL(moduleNickName)), parser.previous.line);
-    } else {
-        emitBytes(OP_IMPORT, makeConstant(OBJ_VAL(moduleName)));
+        name = parser.previous;
     }
+    emitShortOp(OP_DEFINE_GLOBAL, resolveGlobal(&name));
     consumeToken(TOKEN_SEMICOLON, "Expected ';' after import statement.");
 }
 
@@ -511,3 +653,220 @@ void assertStatement() {
     emitByte(OP_ASSERT, parser.previous.line);
 }
 //
+
+/**
+ * Method for pushing the exception a try statement raised, from the slot after its locals.
+ */
+static void getRaised(int depth) {
+    if (depth > UINT8_MAX) {
+        error("Too many local variables in function.");
+        return;
+    }
+    emitBytes(OP_GET_LOCAL, (uint8_t)depth);
+}
+
+/**
+ * Method for compiling the except clauses of a try statement.
+ *
+ * They start with the exception in the slot after the try's locals.
+ * Each clause with types checks them first, falling through to the
+ * next clause if they don't match, and anything no clause catches
+ * is raised again.
+ */
+static void exceptClauses(int depth) {
+    int endJumps[MAX_IF_BRANCHES];
+    int clauses = 0;
+    bool catchAll = false;
+
+    beginScope();
+    addLocal(syntheticToken("__raised"), false);
+    markInitialized();
+
+    while (matchToken(TOKEN_EXCEPT)) {
+        if (catchAll) {
+            error("An 'except' without exception types must be the last one.");
+        }
+
+        // the types are known now, so they're checked as a mask of bits
+        uint16_t types = 0;
+        if (checkToken(TOKEN_IDENTIFIER)) {
+            do {
+                consumeToken(TOKEN_IDENTIFIER, "Expect exception type after ','.");
+                Token name = parser.previous;
+                int type = errorTypeFromName(name.start, name.length);
+                if (name.length == 9 && memcmp(name.start, "Exception", 9) == 0) {
+                    types = UINT16_MAX;
+                } else if (type == -1) {
+                    error("Unknown exception type.");
+                } else {
+                    types |= (uint16_t)(1 << type);
+                }
+            } while (matchToken(TOKEN_COMMA));
+        }
+
+        int nextClause = -1;
+        if (types != 0 && types != UINT16_MAX) {
+            emitByte(OP_EXCEPT_JUMP, parser.previous.line);
+            emitByte((types >> 8) & 0xff, parser.previous.line);
+            emitByte(types & 0xff, parser.previous.line);
+            emitByte(0xff, parser.previous.line);
+            emitByte(0xff, parser.previous.line);
+            nextClause = currentChunk()->count - 2;
+        } else {
+            catchAll = true;
+        }
+
+        beginScope();
+        if (matchToken(TOKEN_AS)) {
+            consumeToken(TOKEN_IDENTIFIER, "Expect name after 'as'.");
+            addLocal(parser.previous, false);
+            markInitialized();
+            getRaised(depth);
+        }
+        consumeToken(TOKEN_LEFT_BRACE, "Expect '{' after except clause.");
+        parseBlock();
+        endScope();
+
+        int endJump = emitJump(OP_JUMP);
+        if (clauses < MAX_IF_BRANCHES) {
+            endJumps[clauses++] = endJump;
+        } else {
+            error("Too many except clauses!");
+        }
+        if (nextClause != -1) {
+            patchJump(nextClause);
+        }
+    }
+
+    if (!catchAll) {
+        getRaised(depth);
+        emitBytes(OP_THROW, ERROR_RUNTIME);
+    }
+    for (int i = 0; i < clauses; i++) {
+        patchJump(endJumps[i]);
+    }
+    endScope();
+}
+
+/**
+ * Method for adding a handler for the code of a try statement in [start, end),
+ * less the finally clauses jumping out of it runs, which its handlers don't cover.
+ */
+static void addHandler(TryStatement* statement, int start, int end) {
+    for (int i = 0; i < statement->exitCount; i++) {
+        int exitStart = statement->exits[i][0];
+        int exitEnd = statement->exits[i][1];
+        if (exitEnd <= start || exitStart >= end) {
+            continue;
+        }
+        if (exitStart > start) {
+            addExceptionHandler(currentChunk(), start, exitStart, currentChunk()->count, statement->depth);
+        }
+        start = exitEnd;
+    }
+    if (start < end) {
+        addExceptionHandler(currentChunk(), start, end, currentChunk()->count, statement->depth);
+    }
+}
+
+/**
+ * Method for compiling a try statement.
+ *
+ * Entering a try block costs nothing: its code runs as it is and the chunk's
+ * handler table is only looked at when something raises. A finally clause
+ * runs after the try block and its except clauses either way. It's given
+ * nil where the exception would be when nothing was raised, and raises it
+ * again at the end otherwise. A break, continue or return out of the try
+ * block or except clauses runs a copy of it before jumping.
+ */
+void tryStatement() {
+    TryStatement statement;
+    statement.enclosing = current->innermostTry;
+    statement.depth = current->localCount;
+    statement.scopeDepth = current->scopeDepth;
+    statement.hasFinally = finallyAhead(&statement.finally);
+    statement.failed = false;
+    statement.exitCount = 0;
+    statement.loopStart = current->innermostLoopStart;
+    statement.loopScopeDepth = current->innermostLoopScopeDepth;
+    statement.breakCount = 0;
+    statement.continueCount = 0;
+    current->innermostTry = &statement;
+    int depth = statement.depth;
+
+    consumeToken(TOKEN_LEFT_BRACE, "Expect '{' after 'try'.");
+    int start = currentChunk()->count;
+    beginScope();
+    parseBlock();
+    endScope();
+    int end = currentChunk()->count;
+
+    if (!checkToken(TOKEN_EXCEPT) && !checkToken(TOKEN_FINALLY)) {
+        errorAtCurrent("Expect 'except' or 'finally' after try block.");
+    }
+    if (checkToken(TOKEN_EXCEPT)) {
+        int skipHandler = emitJump(OP_JUMP);
+        addHandler(&statement, start, end);
+        exceptClauses(depth);
+        patchJump(skipHandler);
+    }
+    current->innermostTry = statement.enclosing;
+
+    if (matchToken(TOKEN_FINALLY)) {
+        // the try block and except clauses raising carry on at the finally
+        // clause with the exception where this nil is
+        end = currentChunk()->count;
+        emitByte(OP_NIL, parser.previous.line);
+        addHandler(&statement, start, end);
+
+        beginScope();
+        addLocal(syntheticToken("__raised"), false);
+        markInitialized();
+        consumeToken(TOKEN_LEFT_BRACE, "Expect '{' after 'finally'.");
+        bool quiet = parser.quiet;
+        parser.quiet = quiet || statement.failed;
+        beginScope();
+        parseBlock();
+        endScope();
+        parser.quiet = quiet;
+
+        getRaised(depth);
+        int notRaised = emitJump(OP_JUMP_IF_FALSE);
+        emitBytes(OP_THROW, ERROR_RUNTIME);
+        patchJump(notRaised);
+        emitByte(OP_POP, parser.previous.line);
+        endScope();
+    }
+
+    for (int i = 0; i < statement.breakCount; i++) {
+        addBreakJump(statement.breakJumps[i]);
+    }
+    for (int i = 0; i < statement.continueCount; i++) {
+        addContinueJump(statement.continueJumps[i]);
+    }
+}
+
+/**
+ * Method for compiling a raise statement.
+ *
+ * Raising an exception that was caught raises it again. Anything else is
+ * the message of a new RuntimeException, or of the type it's wrapped in,
+ * like "raise TypeException("Expected a number.");".
+ */
+void raiseStatement() {
+    uint8_t type = ERROR_RUNTIME;
+    int named = checkToken(TOKEN_IDENTIFIER) && peekToken(1).type == TOKEN_LEFT_PAREN
+        ? errorTypeFromName(parser.current.start, parser.current.length)
+        : -1;
+    if (named != -1) {
+        type = (uint8_t)named;
+        parserAdvance();
+        consumeToken(TOKEN_LEFT_PAREN, "Expect '(' after exception type.");
+        parseExpression();
+        consumeToken(TOKEN_RIGHT_PAREN, "Expect ')' after exception message.");
+    } else {
+        parseExpression();
+    }
+    consumeToken(TOKEN_SEMICOLON, "Expect ';' after raise statement.");
+    emitBytes(OP_THROW, type);
+}
@@ -0,0 +1,488 @@
+/**
+ * @file async.c
+ * @brief Implementation of the async module.
+ *
+ * Tasks are fibers run by a single event loop-> A task that sleeps or waits
+ * on a file is suspended and parked on a timer or the file, and the loop
+ * resumes it once the time has passed or the file is ready, using poll() to
+ * wait on every parked file at once. Tasks only switch when one sleeps,
+ * waits or yields, so they never run at the same time.
+ *
+ * Natives such as the socket methods do their I/O through performIo. When
+ * it would block, the task is parked with the request and the loop carries
+ * it on each time the file is ready, resuming the task once it's finished.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "builtins/util.h"
+#include "core/gc.h"
+#include "core/memory.h"
+#include "core/object.h"
+#include "core/value.h"
+#include "core/vm.h"
+#include "std/async.h"
+
+static Value spawnNative(int argCount, Value* args, ParamInfo* params);
+static Value runNative(int argCount, Value* args, ParamInfo* params);
+static Value sleepNative(int argCount, Value* args, ParamInfo* params);
+static Value waitNative(int argCount, Value* args, ParamInfo* params);
+
+/**
+ * The async module's functions, each one created the first time it's looked up.
+ */
+static NativeDef asyncNatives[] = {
+    {"spawn", spawnNative, 1, 2, {{"function", true}, {"value", false}}},
+    {"run", runNative, 0, 0, {}},
+    {"sleep", sleepNative, 1, 1, {{"seconds", true}}},
+    {"wait", waitNative, 1, 2, {{"file", true}, {"mode", false}}},
+    {NULL}
+};
+
+/**
+ * @brief Gets the async module with all its functions.
+ * @return A pointer to the ObjModule containing the async functions.
+ */
+ObjModule* getAsyncModule() {
+    ObjModule* module = newModule();
+    module->natives = asyncNatives;
+    return module;
+}
+
+/**
+ * @struct Task
+ *
+ * A task that's ready to run, and the value to resume it with. If the
+ * request it was parked on failed the value is the error's message instead.
+ */
+typedef struct Task {
+    ObjFiber* fiber;
+    Value value;
+    bool failed;
+} Task;
+
+/**
+ * @struct Timer
+ *
+ * A task that's sleeping until the deadline, in seconds on the monotonic clock.
+ */
+typedef struct Timer {
+    double deadline;
+    ObjFiber* fiber;
+} Timer;
+
+/**
+ * @struct Waiter
+ *
+ * A task that's waiting on an I/O request's file descriptor to be ready.
+ */
+typedef struct Waiter {
+    IoRequest request;
+    ObjFiber* fiber;
+} Waiter;
+
+/**
+ * @struct EventLoop
+ *
+ * The ready tasks are a queue from readyHead, the timers a min-heap on their deadline.
+ * Each VM has its own, so the tasks of one never run in another.
+ */
+typedef struct EventLoop {
+    Task* ready;
+    int readyHead;
+    int readyCount;
+    int readyCapacity;
+    Timer* timers;
+    int timerCount;
+    int timerCapacity;
+    Waiter* waiters;
+    int waiterCount;
+    int waiterCapacity;
+    struct pollfd* polls;
+    int pollCapacity;
+    // requests being run outside of a task, so blocking until they finish
+    IoRequest* blocking;
+    // the task being run, and whether it parked itself before suspending
+    ObjFiber* current;
+    bool parked;
+    bool running;
+} EventLoop;
+
+/**
+ * Method for getting the running VM's event loop, making it the first time.
+ */
+static EventLoop* getLoop() {
+    if (vm->eventLoop == NULL) {
+        vm->eventLoop = calloc(1, sizeof(EventLoop));
+        if (vm->eventLoop == NULL) {
+            exit(1);
+        }
+    }
+    return vm->eventLoop;
+}
+
+void freeEventLoop() {
+    EventLoop* loop = vm->eventLoop;
+    if (loop == NULL) {
+        return;
+    }
+    free(loop->ready);
+    free(loop->timers);
+    free(loop->waiters);
+    free(loop->polls);
+    free(loop);
+    vm->eventLoop = NULL;
+}
+
+void markEventLoop() {
+    EventLoop* loop = vm->eventLoop;
+    if (loop == NULL) {
+        return;
+    }
+    for (int i = loop->readyHead; i < loop->readyCount; i++) {
+        markObject((Obj*)loop->ready[i].fiber);
+        markValue(loop->ready[i].value);
+    }
+    for (int i = 0; i < loop->timerCount; i++) {
+        markObject((Obj*)loop->timers[i].fiber);
+    }
+    for (int i = 0; i < loop->waiterCount; i++) {
+        markObject((Obj*)loop->waiters[i].fiber);
+        markValue(loop->waiters[i].request.state);
+        markValue(loop->waiters[i].request.buffer);
+    }
+    for (IoRequest* request = loop->blocking; request != NULL; request = request->next) {
+        markValue(request->state);
+        markValue(request->buffer);
+    }
+    markObject((Obj*)loop->current);
+}
+
+/**
+ * Method for growing one of the loop's arrays to hold at least count items.
+ *
+ * These hold nothing but tasks, which are marked through markEventLoop.
+ */
+static void* growBuffer(void* buffer, int* capacity, int count, size_t size) {
+    if (*capacity >= count) {
+        return buffer;
+    }
+    *capacity = GROW_CAPACITY(*capacity);
+    if (*capacity < count) {
+        *capacity = count;
+    }
+    buffer = realloc(buffer, size * *capacity);
+    if (buffer == NULL) {
+        exit(1);
+    }
+    return buffer;
+}
+
+/**
+ * Method for getting the time in seconds on the monotonic clock.
+ */
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/**
+ * Method for sleeping for a number of seconds, carrying on if interrupted.
+ */
+static void sleepFor(double seconds) {
+    struct timespec time;
+    time.tv_sec = (time_t)seconds;
+    time.tv_nsec = (long)((seconds - (double)time.tv_sec) * 1e9);
+    while (nanosleep(&time, &time) != 0 && errno == EINTR) {
+    }
+}
+
+/**
+ * Method for adding a task to the end of the ready queue.
+ */
+static void enqueue(ObjFiber* fiber, Value value) {
+    EventLoop* loop = getLoop();
+    bool failed = IS_ERROR(value);
+    if (failed) {
+        // the error itself isn't kept alive by the collector, its message is
+        const char* message = errorMessage(value);
+        value = OBJ_VAL(copyString(message, (int)strlen(message)));
+    }
+    if (loop->readyHead > 0 && loop->readyCount == loop->readyCapacity) {
+        // reuse the space of the tasks already taken off the front
+        memmove(loop->ready, loop->ready + loop->readyHead, sizeof(Task) * (loop->readyCount - loop->readyHead));
+        loop->readyCount -= loop->readyHead;
+        loop->readyHead = 0;
+    }
+    loop->ready = growBuffer(loop->ready, &loop->readyCapacity, loop->readyCount + 1, sizeof(Task));
+    loop->ready[loop->readyCount].fiber = fiber;
+    loop->ready[loop->readyCount].value = value;
+    loop->ready[loop->readyCount].failed = failed;
+    loop->readyCount++;
+}
+
+/**
+ * Method for adding a timer to the heap.
+ */
+static void addTimer(double deadline, ObjFiber* fiber) {
+    EventLoop* loop = getLoop();
+    loop->timers = growBuffer(loop->timers, &loop->timerCapacity, loop->timerCount + 1, sizeof(Timer));
+    int i = loop->timerCount++;
+    while (i > 0 && loop->timers[(i - 1) / 2].deadline > deadline) {
+        loop->timers[i] = loop->timers[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    loop->timers[i].deadline = deadline;
+    loop->timers[i].fiber = fiber;
+}
+
+/**
+ * Method for taking the timer with the earliest deadline off the heap.
+ */
+static ObjFiber* popTimer() {
+    EventLoop* loop = getLoop();
+    ObjFiber* fiber = loop->timers[0].fiber;
+    Timer last = loop->timers[--loop->timerCount];
+    int i = 0;
+    for (;;) {
+        int child = i * 2 + 1;
+        if (child >= loop->timerCount) {
+            break;
+        }
+        if (child + 1 < loop->timerCount && loop->timers[child + 1].deadline < loop->timers[child].deadline) {
+            child++;
+        }
+        if (last.deadline <= loop->timers[child].deadline) {
+            break;
+        }
+        loop->timers[i] = loop->timers[child];
+        i = child;
+    }
+    if (loop->timerCount > 0) {
+        loop->timers[i] = last;
+    }
+    return fiber;
+}
+
+/**
+ * Method for waiting up to timeout seconds (or forever if it's negative) for
+ * any of the parked files to be ready, and carrying on their requests. The
+ * tasks whose requests have finished are queued with the results.
+ */
+static void pollWaiters(double timeout) {
+    EventLoop* loop = getLoop();
+    loop->polls = growBuffer(loop->polls, &loop->pollCapacity, loop->waiterCount, sizeof(struct pollfd));
+    for (int i = 0; i < loop->waiterCount; i++) {
+        loop->polls[i].fd = loop->waiters[i].request.fd;
+        loop->polls[i].events = loop->waiters[i].request.events;
+        loop->polls[i].revents = 0;
+    }
+    int milliseconds = timeout < 0 ? -1 : (int)(timeout * 1000 + 0.999);
+    if (poll(loop->polls, loop->waiterCount, milliseconds) <= 0) {
+        return;
+    }
+
+    // backwards, so removing a waiter doesn't move one that's still to be checked
+    for (int i = loop->waiterCount - 1; i >= 0; i--) {
+        if (loop->polls[i].revents == 0) {
+            continue;
+        }
+        IoRequest* request = &loop->waiters[i].request;
+        Value result = NIL_VAL;
+        if (request->step == NULL || request->step(request, &result)) {
+            enqueue(loop->waiters[i].fiber, result);
+            loop->waiters[i] = loop->waiters[--loop->waiterCount];
+        }
+    }
+}
+
+/**
+ * Method for dropping every task, after one has raised an error.
+ */
+static void resetLoop() {
+    EventLoop* loop = getLoop();
+    loop->readyHead = 0;
+    loop->readyCount = 0;
+    loop->timerCount = 0;
+    loop->waiterCount = 0;
+    loop->current = NULL;
+    loop->running = false;
+}
+
+/**
+ * Method for running a task until it next suspends.
+ */
+static bool runTask(Task task) {
+    EventLoop* loop = getLoop();
+    if (task.fiber->state == FIBER_DONE || task.fiber->state == FIBER_RUNNING) {
+        // resumed and finished by something else, or resuming the loop that's running it
+        return true;
+    }
+    if (task.failed) {
+        return failFiber(task.fiber, AS_CSTRING(task.value));
+    }
+    loop->current = task.fiber;
+    loop->parked = false;
+    Value result;
+    bool ok = resumeFiber(task.fiber, task.value, &result);
+    loop->current = NULL;
+    if (ok && task.fiber->state == FIBER_SUSPENDED && !loop->parked) {
+        // it yielded, so it goes to the back of the queue
+        enqueue(task.fiber, NIL_VAL);
+    }
+    return ok;
+}
+
+/**
+ * Method for checking whether the running fiber is a task of the loop, so can be parked.
+ */
+static bool canPark() {
+    EventLoop* loop = getLoop();
+    return loop->current != NULL && vm->fiber == loop->current && yieldFiber(NIL_VAL);
+}
+
+Value performIo(IoRequest* request) {
+    EventLoop* loop = getLoop();
+    Value result = NIL_VAL;
+    // kept alive while it runs here as well as once it's parked
+    request->next = loop->blocking;
+    loop->blocking = request;
+
+    bool finished = request->step != NULL && request->step(request, &result);
+    if (!finished && canPark()) {
+        loop->waiters = growBuffer(loop->waiters, &loop->waiterCapacity, loop->waiterCount + 1, sizeof(Waiter));
+        loop->waiters[loop->waiterCount].request = *request;
+        loop->waiters[loop->waiterCount].request.next = NULL;
+        loop->waiters[loop->waiterCount].fiber = loop->current;
+        loop->waiterCount++;
+        loop->parked = true;
+        finished = true;
+    }
+    while (!finished) {
+        struct pollfd single = {request->fd, request->events, 0};
+        while (poll(&single, 1, -1) < 0 && errno == EINTR) {
+        }
+        finished = request->step == NULL || request->step(request, &result);
+    }
+
+    loop->blocking = request->next;
+    return result;
+}
+
+/**
+ * spawn native function.
+ * Creates a task that runs the function, with the optional value as its argument.
+ */
+static Value spawnNative(int argCount, Value* args, ParamInfo* params) {
+    if (!IS_CLOSURE(args[0])) {
+        return nativeError("spawn() expects a function.");
+    }
+    if (AS_CLOSURE(args[0])->function->arity > 1) {
+        return nativeError("spawn() function must take no more than one argument.");
+    }
+    ObjFiber* fiber = newFiber(AS_CLOSURE(args[0]));
+    enqueue(fiber, argCount > 1 ? args[1] : NIL_VAL);
+    return OBJ_VAL(fiber);
+}
+
+/**
+ * run native function.
+ * Runs tasks until every one of them has finished.
+ */
+static Value runNative(int argCount, Value* args, ParamInfo* params) {
+    EventLoop* loop = getLoop();
+    if (loop->running) {
+        return nativeError("run() can't be called while the loop is already running.");
+    }
+    loop->running = true;
+
+    while (loop->readyHead < loop->readyCount || loop->timerCount > 0 || loop->waiterCount > 0) {
+        // tasks that become ready while these run wait for the next time round
+        int end = loop->readyCount;
+        while (loop->readyHead < end) {
+            Task task = loop->ready[loop->readyHead++];
+            if (!runTask(task)) {
+                resetLoop();
+                return nativeError("run() task raised an error.");
+            }
+            end -= loop->readyHead == 0 ? end - loop->readyCount : 0;
+        }
+        if (loop->readyHead == loop->readyCount) {
+            loop->readyHead = 0;
+            loop->readyCount = 0;
+        }
+
+        double timeout = -1;
+        if (loop->readyHead < loop->readyCount) {
+            timeout = 0;
+        } else if (loop->timerCount > 0) {
+            timeout = loop->timers[0].deadline - now();
+            timeout = timeout < 0 ? 0 : timeout;
+        }
+        if (loop->waiterCount > 0) {
+            pollWaiters(timeout);
+        } else if (timeout > 0) {
+            sleepFor(timeout);
+        }
+
+        double time = now();
+        while (loop->timerCount > 0 && loop->timers[0].deadline <= time) {
+            enqueue(popTimer(), NIL_VAL);
+        }
+    }
+
+    loop->running = false;
+    return NIL_VAL;
+}
+
+/**
+ * sleep native function.
+ * Suspends a task for the number of seconds. Anywhere else it blocks.
+ */
+static Value sleepNative(int argCount, Value* args, ParamInfo* params) {
+    EventLoop* loop = getLoop();
+    if (!IS_NUMBER(args[0]) || AS_NUMBER(args[0]) < 0) {
+        return nativeError("sleep() expects a non-negative number of seconds.");
+    }
+    double seconds = AS_NUMBER(args[0]);
+    if (canPark()) {
+        addTimer(now() + seconds, loop->current);
+        loop->parked = true;
+    } else {
+        sleepFor(seconds);
+    }
+    return NIL_VAL;
+}
+
+/**
+ * wait native function.
+ * Suspends a task until the file or socket can be read from ("r", the default)
+ * or written to ("w") without blocking. Anywhere else it blocks until then.
+ */
+static Value waitNative(int argCount, Value* args, ParamInfo* params) {
+    int fd;
+    if (IS_FILE(args[0]) && !AS_FILE(args[0])->closed) {
+        fd = fileno(AS_FILE(args[0])->file);
+    } else if (IS_SOCKET(args[0]) && !AS_SOCKET(args[0])->closed) {
+        fd = AS_SOCKET(args[0])->fd;
+    } else {
+        return nativeError("wait() expects an open file or socket.");
+    }
+    short events = POLLIN;
+    if (argCount > 1) {
+        if (!IS_STRING(args[1]) || (strcmp(AS_CSTRING(args[1]), "r") != 0 && strcmp(AS_CSTRING(args[1]), "w") != 0)) {
+            return nativeError("wait() mode must be \"r\" or \"w\".");
+        }
+        events = AS_CSTRING(args[1])[0] == 'w' ? POLLOUT : POLLIN;
+    }
+
+    IoRequest request = {fd, events, NULL, NIL_VAL, NIL_VAL, 0, 0, NULL};
+    return performIo(&request);
+}
@@ -0,0 +1,136 @@
+/**
+ * @file cache.c
+ * @brief Implementation of the cache module.
+ *
+ * memoize(fn) and lru(fn, maxsize) wrap a function so its results are
+ * remembered by the args it's called with, in a table of the wrapper's
+ * own. The VM looks the args up as the wrapper's called, so a hit never
+ * makes a frame for the function, and stores what the function's frame
+ * returns on a miss. Args are compared the way dict keys are.
+ */
+
+#include <string.h>
+
+#include "builtins/util.h"
+#include "core/memo.h"
+#include "core/object.h"
+#include "core/table.h"
+#include "core/value.h"
+#include "core/vm.h"
+#include "std/cache.h"
+
+// forward declarations of native functions
+static Value memoizeNative(int argCount, Value* args, ParamInfo* params);
+static Value lruNative(int argCount, Value* args, ParamInfo* params);
+static Value statsNative(int argCount, Value* args, ParamInfo* params);
+static Value clearNative(int argCount, Value* args, ParamInfo* params);
+
+/**
+ * The cache module's functions, each one created the first time it's looked up.
+ */
+static NativeDef cacheNatives[] = {
+    {"memoize", memoizeNative, 1, 1, {{"function", true}}},
+    {"lru", lruNative, 2, 2, {{"function", true}, {"maxsize", true}}},
+    {NULL}
+};
+
+/**
+ * The methods of memoised functions.
+ */
+static NativeDef memoNatives[] = {
+    {"stats", statsNative, 1, 1, {{"self", true}}},
+    {"clear", clearNative, 1, 1, {{"self", true}}},
+    {NULL}
+};
+
+/**
+ * @brief Gets the cache module with all its functions.
+ * @return A pointer to the ObjModule containing the cache functions.
+ */
+ObjModule* getCacheModule() {
+    ObjModule* module = newModule();
+    module->natives = cacheNatives;
+    return module;
+}
+
+/**
+ * @brief Registers the methods of memoised functions for the given ObjClass.
+ * @param cls The ObjClass representing the memo type.
+ */
+void registerMemoMethods(ObjClass* cls) {
+    cls->natives = memoNatives;
+}
+
+/**
+ * Method for checking a value can be memoised.
+ */
+static bool isMemoisable(Value value) {
+    return IS_CLOSURE(value) || IS_BOUND_METHOD(value) || IS_NATIVE(value);
+}
+
+/**
+ * Wraps a function so every result it returns is remembered.
+ * Usage: memoize(fn)
+ */
+static Value memoizeNative(int argCount, Value* args, ParamInfo* params) {
+    if (!isMemoisable(args[0])) {
+        return nativeError("memoize() expects a function.");
+    }
+    return OBJ_VAL(newMemo(args[0], 0));
+}
+
+/**
+ * Wraps a function so its most recently used results are remembered, up to maxsize of them.
+ * Usage: lru(fn, maxsize)
+ */
+static Value lruNative(int argCount, Value* args, ParamInfo* params) {
+    if (!isMemoisable(args[0])) {
+        return nativeError("lru() expects a function.");
+    }
+    if (!IS_NUMBER(args[1]) || AS_NUMBER(args[1]) < 1 || AS_NUMBER(args[1]) > INT32_MAX
+            || AS_NUMBER(args[1]) != (int)AS_NUMBER(args[1])) {
+        return nativeError("lru() expects a maxsize that's a whole number of at least 1.");
+    }
+    return OBJ_VAL(newMemo(args[0], (int)AS_NUMBER(args[1])));
+}
+
+/**
+ * Method for setting a dict entry named by a C string.
+ */
+static void setEntry(ObjDict* dict, const char* name, Value value) {
+    push(OBJ_VAL(copyString(name, (int)strlen(name))));
+    tableSet(&dict->data, peek(0), value);
+    pop();
+}
+
+/**
+ * Gets how often a memoised function's results were found, as a dict of
+ * hits, misses, size and maxsize, which is nil if there's no limit.
+ * Usage: fn.stats()
+ */
+static Value statsNative(int argCount, Value* args, ParamInfo* params) {
+    if (!IS_MEMO(args[0])) {
+        return nativeError("stats() must be called on a memoised function.");
+    }
+    ObjMemo* memo = AS_MEMO(args[0]);
+    ObjDict* dict = newDict();
+    push(OBJ_VAL(dict));
+    setEntry(dict, "hits", NUMBER_VAL((double)memo->hits));
+    setEntry(dict, "misses", NUMBER_VAL((double)memo->misses));
+    setEntry(dict, "size", NUMBER_VAL(memo->count));
+    setEntry(dict, "maxsize", memo->maxSize > 0 ? NUMBER_VAL(memo->maxSize) : NIL_VAL);
+    pop();
+    return OBJ_VAL(dict);
+}
+
+/**
+ * Forgets every result a memoised function has remembered.
+ * Usage: fn.clear()
+ */
+static Value clearNative(int argCount, Value* args, ParamInfo* params) {
+    if (!IS_MEMO(args[0])) {
+        return nativeError("clear() must be called on a memoised function.");
+    }
+    clearMemo(AS_MEMO(args[0]));
+    return NIL_VAL;
+}
@@ -0,0 +1,186 @@
+/**
+ * @file gc.c
+ * @brief Implementation of the gc module.
+ *
+ * Lets a program collect when it chooses to, turn collections off around
+ * sections that can't have pauses, change how far the heap grows between
+ * collections, run a function in a region that's freed when it returns,
+ * and read the same statistics --gc-stats reports at exit.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "builtins/util.h"
+#include "core/gc.h"
+#include "core/object.h"
+#include "core/table.h"
+#include "core/value.h"
+#include "core/vm.h"
+#include "std/gc.h"
+
+// forward declarations of native functions
+static Value collectNative(int argCount, Value* args, ParamInfo* params);
+static Value enableNative(int argCount, Value* args, ParamInfo* params);
+static Value disableNative(int argCount, Value* args, ParamInfo* params);
+static Value isEnabledNative(int argCount, Value* args, ParamInfo* params);
+static Value growFactorNative(int argCount, Value* args, ParamInfo* params);
+static Value statsNative(int argCount, Value* args, ParamInfo* params);
+static Value objectsNative(int argCount, Value* args, ParamInfo* params);
+static Value regionNative(int argCount, Value* args, ParamInfo* params);
+
+/**
+ * The gc module's functions, each one created the first time it's looked up.
+ */
+static NativeDef gcNatives[] = {
+    {"collect", collectNative, 0, 0, {}},
+    {"enable", enableNative, 0, 0, {}},
+    {"disable", disableNative, 0, 0, {}},
+    {"isenabled", isEnabledNative, 0, 0, {}},
+    {"growfactor", growFactorNative, 0, 1, {{"factor", false}}},
+    {"stats", statsNative, 0, 0, {}},
+    {"objects", objectsNative, 0, 0, {}},
+    {"region", regionNative, 1, 1, {{"function", false}}},
+    {NULL}
+};
+
+/**
+ * @brief Gets the gc module with all its functions.
+ * @return A pointer to the ObjModule containing the gc functions.
+ */
+ObjModule* getGCModule() {
+    ObjModule* module = newModule();
+    module->natives = gcNatives;
+    return module;
+}
+
+/**
+ * Method for setting a dict entry named by a C string.
+ */
+static void setEntry(ObjDict* dict, const char* name, Value value) {
+    push(OBJ_VAL(copyString(name, (int)strlen(name))));
+    tableSet(&dict->data, peek(0), value);
+    pop();
+}
+
+/**
+ * Runs a full collection now, even while collections are turned off.
+ * Returns the number of bytes it freed.
+ * Usage: collect()
+ */
+static Value collectNative(int argCount, Value* args, ParamInfo* params) {
+    return NUMBER_VAL((double)collectNow());
+}
+
+/**
+ * Turns collections back on.
+ * Usage: enable()
+ */
+static Value enableNative(int argCount, Value* args, ParamInfo* params) {
+    setGCEnabled(true);
+    return NIL_VAL;
+}
+
+/**
+ * Turns collections off, letting the heap grow until they're turned back on.
+ * Usage: disable()
+ */
+static Value disableNative(int argCount, Value* args, ParamInfo* params) {
+    setGCEnabled(false);
+    return NIL_VAL;
+}
+
+/**
+ * Checks whether collections are on.
+ * Usage: isenabled()
+ */
+static Value isEnabledNative(int argCount, Value* args, ParamInfo* params) {
+    return BOOL_VAL(!vm->gcDisabled);
+}
+
+/**
+ * Gets how many times the heap surviving a collection grows to before the next,
+ * setting it first if it's given. Takes effect from the next collection.
+ * Usage: growfactor() or growfactor(1.5)
+ */
+static Value growFactorNative(int argCount, Value* args, ParamInfo* params) {
+    if (argCount == 1) {
+        if (!IS_NUMBER(args[0]) || AS_NUMBER(args[0]) <= 1) {
+            return nativeError("growfactor() expects a number greater than 1.");
+        }
+        setHeapGrowFactor(AS_NUMBER(args[0]));
+    }
+    return NUMBER_VAL(vm->heapGrowFactor);
+}
+
+/**
+ * Gets the collector's statistics as a dict. Pauses are in seconds.
+ * Usage: stats()
+ */
+static Value statsNative(int argCount, Value* args, ParamInfo* params) {
+    finishSweep();
+    const GCStats* stats = &vm->gcStats;
+    ObjDict* dict = newDict();
+    push(OBJ_VAL(dict));
+
+    setEntry(dict, "collections", NUMBER_VAL(stats->minorCollections + stats->majorCollections));
+    setEntry(dict, "minor_collections", NUMBER_VAL(stats->minorCollections));
+    setEntry(dict, "major_collections", NUMBER_VAL(stats->majorCollections));
+    setEntry(dict, "total_pause", NUMBER_VAL(stats->minorPauseTotal + stats->majorPauseTotal));
+    setEntry(dict, "max_pause", NUMBER_VAL(stats->maxPause));
+    setEntry(dict, "bytes_freed", NUMBER_VAL((double)stats->bytesFreed));
+    setEntry(dict, "objects_freed", NUMBER_VAL((double)stats->objectsFreed));
+    setEntry(dict, "last_bytes_freed", NUMBER_VAL((double)stats->lastBytesFreed));
+    setEntry(dict, "last_objects_freed", NUMBER_VAL((double)stats->lastObjectsFreed));
+    setEntry(dict, "bytes_allocated", NUMBER_VAL((double)vm->bytesAllocated));
+    setEntry(dict, "next_gc", vm->nextGC == SIZE_MAX ? NIL_VAL : NUMBER_VAL((double)vm->nextGC));
+    setEntry(dict, "allocation_rate", NUMBER_VAL(allocationRate()));
+    setEntry(dict, "interned_strings", NUMBER_VAL(vm->strings.count));
+    setEntry(dict, "enabled", BOOL_VAL(!vm->gcDisabled));
+
+    pop();
+    return OBJ_VAL(dict);
+}
+
+/**
+ * Gets how many objects of each type there are, as a dict of type name to count.
+ * Usage: objects()
+ */
+static Value objectsNative(int argCount, Value* args, ParamInfo* params) {
+    size_t counts[OBJ_TYPE_COUNT];
+    countObjects(counts, OBJ_TYPE_COUNT);
+
+    ObjDict* dict = newDict();
+    push(OBJ_VAL(dict));
+    for (int i = 0; i < OBJ_TYPE_COUNT; i++) {
+        if (counts[i] > 0) {
+            setEntry(dict, objTypeName((ObjType)i), NUMBER_VAL((double)counts[i]));
+        }
+    }
+    pop();
+    return OBJ_VAL(dict);
+}
+
+/**
+ * Calls a function in a region and returns what it returns. Everything it
+ * allocates that isn't returned or stored somewhere older, such as a global,
+ * is freed as soon as it returns, without waiting for a collection.
+ * Usage: region(handle)
+ */
+static Value regionNative(int argCount, Value* args, ParamInfo* params) {
+    if (!IS_CLOSURE(args[0])) {
+        return nativeError("region() expects a function.");
+    }
+
+    Value result;
+    beginRegion();
+    bool ok = callFunction(args[0], 0, NULL, &result);
+    // what it returns is the one thing a C local holds on to
+    push(ok ? result : NIL_VAL);
+    endRegion();
+    result = pop();
+    if (!ok) {
+        return nativeError("region() function raised an error.");
+    }
+    return result;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file io.c
+ * @brief Implementation of the io module.
+ *
+ * Wraps stdout and stderr as write mode files, so output can be written
+ * with write / writelines without print's formatting, and flushed when a
+ * program needs what it's written so far to be seen.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "builtins/util.h"
+#include "core/gc.h"
+#include "core/object.h"
+#include "core/table.h"
+#include "core/value.h"
+#include "core/vm.h"
+#include "std/io.h"
+
+// forward declarations of native functions
+static Value flushNative(int argCount, Value* args, ParamInfo* params);
+
+/**
+ * The io module's functions, each one created the first time it's looked up.
+ */
+static NativeDef ioNatives[] = {
+    {"flush", flushNative, 0, 0, {}},
+    {NULL}
+};
+
+/**
+ * Method for adding one of the standard streams to the module as a file.
+ */
+static void addStream(ObjModule* module, const char* name, FILE* stream) {
+    ObjString* sName = copyString(name, (int)strlen(name));
+    push(OBJ_VAL(sName));
+    ObjFile* file = newFile(stream, FILE_WRITE, sName, 0);
+    push(OBJ_VAL(file));
+    tableSet(&module->methods, OBJ_VAL(sName), OBJ_VAL(file));
+    writeBarrier((Obj*)module, OBJ_VAL(file));
+    pop();
+    pop();
+}
+
+/**
+ * @brief Gets the io module with all its functions and streams.
+ * @return A pointer to the ObjModule containing the io functions.
+ */
+ObjModule* getIOModule() {
+    ObjModule* module = newModule();
+    module->natives = ioNatives;
+    push(OBJ_VAL(module));
+    addStream(module, "stdout", stdout);
+    addStream(module, "stderr", stderr);
+    pop();
+    return module;
+}
+
+/**
+ * Writes out everything buffered for stdout.
+ * Usage: flush()
+ */
+static Value flushNative(int argCount, Value* args, ParamInfo* params) {
+    if (fflush(stdout) == EOF) {
+        return nativeError("flush() failed to write to stdout.");
+    }
+    return NIL_VAL;
+}
@@ -1,23 +1,51 @@
 /**
  * @file json.c
  * @brief Implementation of JSON handling utilities.
+ *
+ * Parsing and serializing are both done in a single pass, straight between the
+ * text and slo values, without building an intermediate tree.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 
 #include "builtins/util.h"
+#include "core/gc.h"
+#include "core/memory.h"
 #include "core/object.h"
+#include "core/vm.h"
 #include "core/value.h"
+#include "core/writer.h"
 #include "std/json.h"
 
-#include "cJSON.h"
-
 // forward declarations of native functions
 static Value loadJsonNative(int argCount, Value* args, ParamInfo* params);
 static Value loadsJsonNative(int argCount, Value* args, ParamInfo* params);
 static Value dumpsJsonNative(int argCount, Value* args, ParamInfo* params);
 static Value dumpJsonNative(int argCount, Value* args, ParamInfo* params);
+static Value loadEachJsonNative(int argCount, Value* args, ParamInfo* params);
+static Value loadLinesJsonNative(int argCount, Value* args, ParamInfo* params);
+
+/**
+ * The json module's functions, each one created the first time it's looked up.
+ */
+static NativeDef jsonNatives[] = {
+    {"load", loadJsonNative, 1, 1, {{"file", true}}},
+    {"loads", loadsJsonNative, 1, 1, {{"json_string", true}}},
+    {"dumps", dumpsJsonNative, 1, 2, {{"obj", true}, {"indent", false}}},
+    {"dump", dumpJsonNative, 2, 3, {{"file", true}, {"obj", true}, {"indent", false}}},
+    {"loadeach", loadEachJsonNative, 2, 2, {{"source", true}, {"callback", true}}},
+    {"loadlines", loadLinesJsonNative, 2, 2, {{"file", true}, {"callback", true}}},
+    {NULL}
+};
 
 /**
  * @brief Gets the json module with all its functions.
@@ -25,98 +53,775 @@ static Value dumpJsonNative(int argCount, Value* args, ParamInfo* params);
  */
 ObjModule* getJsonModule() {
     ObjModule* module = newModule();
-    defineBuiltIn(&module->methods, "load", loadJsonNative, 1, 1, PARAMS({copyString("file", 4), true}));
-    defineBuiltIn(&module->methods, "loads", loadsJsonNative, 1, 1, PARAMS({copyString("json_string", 11), true}));
-    defineBuiltIn(&module->methods, "dumps", dumpsJsonNative, 1, 2, PARAMS({copyString("obj", 3), true}, {copyString("indent", 6), false}));
-    defineBuiltIn(&module->methods, "dump", dumpJsonNative, 1, 2, PARAMS({copyString("obj", 3), true}, {copyString("file", 4), false}));
+    module->natives = jsonNatives;
     return module;
 }
 
 /**
- * @brief Converts a cJSON object to a Value.
- * @param json The cJSON object to convert.
- * @return A Value representing the JSON object, or an error value if conversion fails.
+ * JSON documents nested deeper than this are rejected rather than recursing further.
+ */
+#define JSON_NESTING_LIMIT 1000
+
+/**
+ * How many levels of nesting the parser remembers object sizes for, see parseObject.
+ */
+#define JSON_SIZE_HINTS 16
+
+/**
+ * @struct JsonParser
+ *
+ * State for parsing a JSON document straight from a buffer into slo values.
+ *
+ * The buffer doesn't need to be NUL-terminated, so strings, string views and
+ * mapped files are all parsed in place without copying them first.
+ */
+typedef struct JsonParser {
+    const char* start;
+    const char* current;
+    const char* end;
+    int depth;
+    const char* error;
+    // how many members the last object at each depth had
+    int objectSizes[JSON_SIZE_HINTS];
+} JsonParser;
+
+static bool parseValue(JsonParser* parser);
+
+static void initParser(JsonParser* parser, const char* chars, size_t length) {
+    parser->start = chars;
+    parser->current = chars;
+    parser->end = chars + length;
+    parser->depth = 0;
+    parser->error = NULL;
+    memset(parser->objectSizes, 0, sizeof(parser->objectSizes));
+}
+
+static bool parseError(JsonParser* parser, const char* message) {
+    if (parser->error == NULL) {
+        parser->error = message;
+    }
+    return false;
+}
+
+static void skipWhitespace(JsonParser* parser) {
+    while (parser->current < parser->end) {
+        char c = *parser->current;
+        if (c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+            return;
+        }
+        parser->current++;
+    }
+}
+
+static bool matchLiteral(JsonParser* parser, const char* literal, int length) {
+    if (parser->end - parser->current < length || memcmp(parser->current, literal, length) != 0) {
+        return parseError(parser, "unexpected character");
+    }
+    parser->current += length;
+    return true;
+}
+
+/**
+ * Method for reading four hex digits of a \u escape.
+ */
+static bool parseHex4(JsonParser* parser, uint32_t* codepoint) {
+    if (parser->end - parser->current < 4) {
+        return parseError(parser, "incomplete unicode escape");
+    }
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = *parser->current++;
+        value <<= 4;
+        if (c >= '0' && c <= '9') {
+            value |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            value |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            value |= c - 'A' + 10;
+        } else {
+            return parseError(parser, "invalid unicode escape");
+        }
+    }
+    *codepoint = value;
+    return true;
+}
+
+static int encodeUtf8(uint32_t codepoint, char* out) {
+    if (codepoint < 0x80) {
+        out[0] = (char)codepoint;
+        return 1;
+    } else if (codepoint < 0x800) {
+        out[0] = (char)(0xC0 | (codepoint >> 6));
+        out[1] = (char)(0x80 | (codepoint & 0x3F));
+        return 2;
+    } else if (codepoint < 0x10000) {
+        out[0] = (char)(0xE0 | (codepoint >> 12));
+        out[1] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (codepoint & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (codepoint >> 18));
+    out[1] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (codepoint & 0x3F));
+    return 4;
+}
+
+/**
+ * Method for parsing a string and pushing it.
+ *
+ * Strings without escapes are copied straight out of the buffer. Object keys
+ * are interned, so the keys repeated across every record share one string.
  */
-static Value cjsonToValue(cJSON* json) {
-    if (cJSON_IsObject(json)) {
-        Value result = OBJ_VAL(newDict());
-        cJSON* child = json->child;
-        while (child) {
-            Value key = OBJ_VAL(copyString(child->string, strlen(child->string)));
-            Value value = cjsonToValue(child);
-            if (IS_ERROR(value)) return value;
-            tableSet(&AS_DICT(result)->data, key, value);
-            child = child->next;
-        }
-        return result;
-    } else if (cJSON_IsArray(json)) {
-        Value result = OBJ_VAL(newList());
-        cJSON* child = json->child;
-        while (child) {
-            Value value = cjsonToValue(child);
-            if (IS_ERROR(value)) return value;
-            ObjList* list = AS_LIST(result);
-            if (list->values.capacity <= list->values.capacity + 1) {
-                growValueArray(&list->values);
+static bool parseString(JsonParser* parser, bool isKey) {
+    // skip the opening quote
+    const char* first = ++parser->current;
+    const char* scan = first;
+    bool escaped = false;
+    while (scan < parser->end && *scan != '"') {
+        if (*scan == '\\') {
+            escaped = true;
+            scan++;
+        } else if ((unsigned char)*scan < 0x20) {
+            parser->current = scan;
+            return parseError(parser, "control character in string");
+        }
+        scan++;
+    }
+    if (scan >= parser->end) {
+        parser->current = parser->end;
+        return parseError(parser, "unterminated string");
+    }
+
+    int rawLength = (int)(scan - first);
+    if (!escaped) {
+        parser->current = scan + 1;
+        ObjString* string = isKey ? copyString(first, rawLength) : copyRuntimeString(first, rawLength);
+        push(OBJ_VAL(string));
+        return true;
+    }
+
+    // escapes only ever shrink the string, so the raw length is enough room
+    char* chars = ALLOCATE(char, rawLength + 1);
+    int length = 0;
+    parser->current = first;
+    while (parser->current < scan) {
+        char c = *parser->current++;
+        if (c != '\\') {
+            chars[length++] = c;
+            continue;
+        }
+        char escape = *parser->current++;
+        switch (escape) {
+            case '"': chars[length++] = '"'; break;
+            case '\\': chars[length++] = '\\'; break;
+            case '/': chars[length++] = '/'; break;
+            case 'b': chars[length++] = '\b'; break;
+            case 'f': chars[length++] = '\f'; break;
+            case 'n': chars[length++] = '\n'; break;
+            case 'r': chars[length++] = '\r'; break;
+            case 't': chars[length++] = '\t'; break;
+            case 'u': {
+                uint32_t codepoint;
+                if (!parseHex4(parser, &codepoint)) {
+                    FREE_ARRAY(char, chars, rawLength + 1);
+                    return false;
+                }
+                if (codepoint >= 0xD800 && codepoint <= 0xDBFF) {
+                    // a high surrogate must be followed by a low one
+                    uint32_t low;
+                    if (scan - parser->current < 6 || parser->current[0] != '\\' || parser->current[1] != 'u') {
+                        FREE_ARRAY(char, chars, rawLength + 1);
+                        return parseError(parser, "invalid unicode surrogate pair");
+                    }
+                    parser->current += 2;
+                    if (!parseHex4(parser, &low) || low < 0xDC00 || low > 0xDFFF) {
+                        FREE_ARRAY(char, chars, rawLength + 1);
+                        return parseError(parser, "invalid unicode surrogate pair");
+                    }
+                    codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                } else if (codepoint >= 0xDC00 && codepoint <= 0xDFFF) {
+                    FREE_ARRAY(char, chars, rawLength + 1);
+                    return parseError(parser, "invalid unicode surrogate pair");
+                }
+                length += encodeUtf8(codepoint, chars + length);
+                break;
             }
-            // add the value to the list
-            list->values.values[list->count++] = value;
-            list->values.count = list->count;
-
-            child = child->next;
-        }
-        return result;
-    } else if (cJSON_IsString(json)) {
-        return OBJ_VAL(copyString(json->valuestring, strlen(json->valuestring)));
-    } else if (cJSON_IsNumber(json)) {
-        return NUMBER_VAL(json->valuedouble);
-    } else if (cJSON_IsBool(json)) {
-        return BOOL_VAL(cJSON_IsTrue(json));
-    } else if (cJSON_IsNull(json)) {
-        return NIL_VAL;
+            default:
+                FREE_ARRAY(char, chars, rawLength + 1);
+                parser->current--;
+                return parseError(parser, "invalid escape in string");
+        }
     }
-    return NIL_VAL;
+    parser->current = scan + 1;
+    chars[length] = '\0';
+
+    ObjString* string;
+    if (isKey) {
+        string = copyString(chars, length);
+        FREE_ARRAY(char, chars, rawLength + 1);
+    } else {
+        // shrink to fit so the GC's accounting matches what the string frees
+        chars = GROW_ARRAY(char, chars, rawLength + 1, length + 1);
+        string = takeRuntimeString(chars, length);
+    }
+    push(OBJ_VAL(string));
+    return true;
+}
+
+static inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
 }
 
 /**
- * @brief Converts a Value to a cJSON object.
- * @param value The Value to convert.
- * @return A cJSON object representing the Value, or NULL if conversion fails.
+ * Method for parsing a number and pushing it.
+ *
+ * Integers of up to 15 digits, which doubles hold exactly, are worked out as
+ * they are scanned. Anything else is handed to strtod from a local copy, as
+ * the buffer may not be NUL-terminated.
  */
-static cJSON* valueToCJson(Value value) {
-    if (IS_DICT(value)) {
-        cJSON* json = cJSON_CreateObject();
-        ObjDict* dict = AS_DICT(value);
-        for (int i = 0; i < dict->data.capacity; i++) {
-            Value key = dict->data.entries[i].key;
-            Value val = dict->data.entries[i].value;
-            if (IS_NIL(key)) {
-                // skip tombstones / empties
-                continue;
+static bool parseNumber(JsonParser* parser) {
+    const char* first = parser->current;
+    const char* scan = first;
+    bool negative = false;
+    if (*scan == '-') {
+        negative = true;
+        scan++;
+    }
+    if (scan >= parser->end || !isDigit(*scan)) {
+        return parseError(parser, "invalid number");
+    }
+
+    double integer = 0;
+    int digits = 0;
+    if (*scan == '0') {
+        scan++;
+    } else {
+        while (scan < parser->end && isDigit(*scan)) {
+            integer = integer * 10 + (*scan - '0');
+            digits++;
+            scan++;
+        }
+    }
+
+    bool simple = digits <= 15;
+    if (scan < parser->end && *scan == '.') {
+        simple = false;
+        scan++;
+        if (scan >= parser->end || !isDigit(*scan)) {
+            parser->current = scan;
+            return parseError(parser, "invalid number");
+        }
+        while (scan < parser->end && isDigit(*scan)) {
+            scan++;
+        }
+    }
+    if (scan < parser->end && (*scan == 'e' || *scan == 'E')) {
+        simple = false;
+        scan++;
+        if (scan < parser->end && (*scan == '+' || *scan == '-')) {
+            scan++;
+        }
+        if (scan >= parser->end || !isDigit(*scan)) {
+            parser->current = scan;
+            return parseError(parser, "invalid number");
+        }
+        while (scan < parser->end && isDigit(*scan)) {
+            scan++;
+        }
+    }
+    parser->current = scan;
+
+    if (simple) {
+        push(NUMBER_VAL(negative ? -integer : integer));
+        return true;
+    }
+
+    int length = (int)(scan - first);
+    char local[64];
+    char* copy = length < (int)sizeof(local) ? local : malloc(length + 1);
+    if (copy == NULL) {
+        return parseError(parser, "out of memory");
+    }
+    memcpy(copy, first, length);
+    copy[length] = '\0';
+    double number = strtod(copy, NULL);
+    if (copy != local) {
+        free(copy);
+    }
+    push(NUMBER_VAL(number));
+    return true;
+}
+
+/**
+ * Method for parsing an array and pushing it as a list.
+ */
+static bool parseArray(JsonParser* parser) {
+    // skip the opening bracket
+    parser->current++;
+    ObjList* list = newList();
+    push(OBJ_VAL(list));
+
+    skipWhitespace(parser);
+    if (parser->current < parser->end && *parser->current == ']') {
+        parser->current++;
+        return true;
+    }
+    for (;;) {
+        if (!parseValue(parser)) {
+            return false;
+        }
+        // the list may have been promoted while the value was made
+        Value value = vm->stackTop[-1];
+        writeValueArray(&list->values, value);
+        list->count = list->values.count;
+        writeBarrier((Obj*)list, value);
+        pop();
+
+        skipWhitespace(parser);
+        if (parser->current >= parser->end) {
+            return parseError(parser, "unterminated array");
+        }
+        char c = *parser->current++;
+        if (c == ']') {
+            return true;
+        } else if (c != ',') {
+            parser->current--;
+            return parseError(parser, "expected ',' or ']' in array");
+        }
+    }
+}
+
+/**
+ * Method for parsing an object and pushing it as a dict.
+ *
+ * Objects side by side are usually records with the same keys, so each
+ * one's sized for as many members as the last one at the same depth.
+ */
+static bool parseObject(JsonParser* parser) {
+    // skip the opening brace
+    parser->current++;
+    int* size = parser->depth <= JSON_SIZE_HINTS ? &parser->objectSizes[parser->depth - 1] : NULL;
+    ObjDict* dict = newDictWithCapacity(size != NULL ? *size : 0);
+    push(OBJ_VAL(dict));
+
+    skipWhitespace(parser);
+    if (parser->current < parser->end && *parser->current == '}') {
+        parser->current++;
+        if (size != NULL) {
+            *size = 0;
+        }
+        return true;
+    }
+    for (;;) {
+        skipWhitespace(parser);
+        if (parser->current >= parser->end || *parser->current != '"') {
+            return parseError(parser, "expected a string key in object");
+        }
+        if (!parseString(parser, true)) {
+            return false;
+        }
+        skipWhitespace(parser);
+        if (parser->current >= parser->end || *parser->current != ':') {
+            return parseError(parser, "expected ':' after object key");
+        }
+        parser->current++;
+        if (!parseValue(parser)) {
+            return false;
+        }
+
+        // the key and value stay on the stack until the table has them
+        Value key = vm->stackTop[-2];
+        Value value = vm->stackTop[-1];
+        tableSet(&dict->data, key, value);
+        writeBarrier((Obj*)dict, key);
+        writeBarrier((Obj*)dict, value);
+        vm->stackTop -= 2;
+
+        skipWhitespace(parser);
+        if (parser->current >= parser->end) {
+            return parseError(parser, "unterminated object");
+        }
+        char c = *parser->current++;
+        if (c == '}') {
+            if (size != NULL) {
+                *size = dict->data.count;
+            }
+            return true;
+        } else if (c != ',') {
+            parser->current--;
+            return parseError(parser, "expected ',' or '}' in object");
+        }
+    }
+}
+
+/**
+ * Method for parsing any JSON value and pushing it onto the VM's stack.
+ *
+ * Everything made so far stays on the stack, so it is rooted while the rest
+ * of the document allocates. On an error the caller resets the stack.
+ */
+static bool parseValue(JsonParser* parser) {
+    skipWhitespace(parser);
+    if (parser->current >= parser->end) {
+        return parseError(parser, "unexpected end of input");
+    }
+
+    switch (*parser->current) {
+        case '{':
+        case '[': {
+            if (++parser->depth > JSON_NESTING_LIMIT) {
+                return parseError(parser, "nested too deeply");
+            }
+            bool ok = *parser->current == '{' ? parseObject(parser) : parseArray(parser);
+            parser->depth--;
+            return ok;
+        }
+        case '"':
+            return parseString(parser, false);
+        case 't':
+            if (!matchLiteral(parser, "true", 4)) {
+                return false;
+            }
+            push(BOOL_VAL(true));
+            return true;
+        case 'f':
+            if (!matchLiteral(parser, "false", 5)) {
+                return false;
+            }
+            push(BOOL_VAL(false));
+            return true;
+        case 'n':
+            if (!matchLiteral(parser, "null", 4)) {
+                return false;
+            }
+            push(NIL_VAL);
+            return true;
+        default:
+            if (*parser->current != '-' && !isDigit(*parser->current)) {
+                return parseError(parser, "unexpected character");
+            }
+            return parseNumber(parser);
+    }
+}
+
+/**
+ * Method for making the error value for a failed parse, giving where it failed.
+ *
+ * firstLine is the line the buffer starts on, for documents that are one line of a file.
+ */
+static Value jsonError(JsonParser* parser, int firstLine) {
+    int line = firstLine;
+    const char* lineStart = parser->start;
+    for (const char* c = parser->start; c < parser->current; c++) {
+        if (*c == '\n') {
+            line++;
+            lineStart = c + 1;
+        }
+    }
+    char message[128];
+    snprintf(message, sizeof(message), "Invalid JSON: %s at line %d, column %d.",
+        parser->error != NULL ? parser->error : "unexpected character", line, (int)(parser->current - lineStart) + 1);
+    return ERROR_VAL_PTR(message);
+}
+
+/**
+ * Method for parsing a whole document, which must be one value and nothing else.
+ */
+static Value parseDocument(const char* chars, size_t length, int firstLine) {
+    JsonParser parser;
+    initParser(&parser, chars, length);
+    Value* stackTop = vm->stackTop;
+
+    bool ok = parseValue(&parser);
+    if (ok) {
+        skipWhitespace(&parser);
+        if (parser.current < parser.end) {
+            ok = parseError(&parser, "unexpected data after the JSON value");
+        }
+    }
+    if (!ok) {
+        vm->stackTop = stackTop;
+        return jsonError(&parser, firstLine);
+    }
+    Value result = pop();
+    vm->stackTop = stackTop;
+    return result;
+}
+
+/**
+ * @struct JsonSource
+ *
+ * A file's contents for parsing: mapped when it's a regular file, read otherwise.
+ */
+typedef struct JsonSource {
+    char* chars;
+    size_t length;
+    bool mapped;
+} JsonSource;
+
+/**
+ * Method for getting a file's whole contents to parse.
+ *
+ * Regular files are mapped, so the document is parsed from the page cache
+ * without a second copy of it on the heap.
+ */
+static bool openJsonSource(ObjFile* file, JsonSource* source) {
+    source->chars = NULL;
+    source->length = 0;
+    source->mapped = false;
+
+    struct stat info;
+    int fd = fileno(file->file);
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void* chars = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (chars != MAP_FAILED) {
+            source->chars = chars;
+            source->length = (size_t)info.st_size;
+            source->mapped = true;
+            return true;
+        }
+    }
+
+    // pipes and the like are read in until they end
+    fseek(file->file, 0, SEEK_SET);
+    size_t capacity = 0;
+    for (;;) {
+        if (source->length == capacity) {
+            capacity = capacity < 4096 ? 4096 : capacity * 2;
+            char* grown = realloc(source->chars, capacity);
+            if (grown == NULL) {
+                free(source->chars);
+                return false;
             }
-            if (!IS_STRING(key)) {
-                continue;
+            source->chars = grown;
+        }
+        size_t bytesRead = fread(source->chars + source->length, 1, capacity - source->length, file->file);
+        source->length += bytesRead;
+        if (bytesRead == 0) {
+            return !ferror(file->file);
+        }
+    }
+}
+
+static void closeJsonSource(JsonSource* source) {
+    if (source->mapped) {
+        munmap(source->chars, source->length);
+    } else {
+        free(source->chars);
+    }
+}
+
+/**
+ * Size of the buffer json.dump fills before writing it to the file.
+ */
+#define JSON_WRITE_BUFFER_SIZE (1 << 16)
+
+/**
+ * @struct JsonWriter
+ *
+ * State for writing values out as JSON.
+ *
+ * When writing to a file the writer's buffer is a fixed size and is flushed
+ * as it fills, so the JSON is never all in memory at once. Otherwise it grows
+ * and becomes the resulting string.
+ */
+typedef struct JsonWriter {
+    Writer out;
+    int indent;
+} JsonWriter;
+
+/**
+ * Method for starting a new, indented line when pretty printing.
+ */
+static bool writeNewline(JsonWriter* writer, int depth) {
+    if (writer->indent == 0) {
+        return true;
+    }
+    if (!writeChar(&writer->out, '\n')) {
+        return false;
+    }
+    for (int i = 0; i < depth * writer->indent; i++) {
+        if (!writeChar(&writer->out, ' ')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool writeJsonNumber(Writer* writer, double number) {
+    if (isnan(number) || isinf(number)) {
+        // JSON has no NaN or infinity
+        return writeChars(writer, "null", 4);
+    }
+    char buffer[32];
+    int length;
+    if (number == (double)(int64_t)number && fabs(number) < 9007199254740992.0) {
+        length = snprintf(buffer, sizeof(buffer), "%" PRId64, (int64_t)number);
+    } else {
+        // the shortest of these that reads back as the same double
+        length = snprintf(buffer, sizeof(buffer), "%.15g", number);
+        if (strtod(buffer, NULL) != number) {
+            length = snprintf(buffer, sizeof(buffer), "%.17g", number);
+        }
+    }
+    return writeChars(writer, buffer, length);
+}
+
+static bool writeJsonString(Writer* writer, const char* chars, int length) {
+    static const char hex[] = "0123456789abcdef";
+    if (!writeChar(writer, '"')) {
+        return false;
+    }
+    int run = 0;
+    for (int i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)chars[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        // write out the plain characters before this one in one go
+        if (!writeChars(writer, chars + run, i - run)) {
+            return false;
+        }
+        run = i + 1;
+        char escape[6] = {'\\', 0};
+        int escapeLength = 2;
+        switch (c) {
+            case '"': escape[1] = '"'; break;
+            case '\\': escape[1] = '\\'; break;
+            case '\b': escape[1] = 'b'; break;
+            case '\f': escape[1] = 'f'; break;
+            case '\n': escape[1] = 'n'; break;
+            case '\r': escape[1] = 'r'; break;
+            case '\t': escape[1] = 't'; break;
+            default:
+                escape[1] = 'u';
+                escape[2] = '0';
+                escape[3] = '0';
+                escape[4] = hex[c >> 4];
+                escape[5] = hex[c & 0xF];
+                escapeLength = 6;
+                break;
+        }
+        if (!writeChars(writer, escape, escapeLength)) {
+            return false;
+        }
+    }
+    return writeChars(writer, chars + run, length - run) && writeChar(writer, '"');
+}
+
+static bool writeJsonValue(JsonWriter* writer, Value value, int depth);
+
+/**
+ * Method for writing each item of a list, typed array or set as a JSON array.
+ */
+static bool writeJsonArray(JsonWriter* writer, Value value, int depth) {
+    int count;
+    if (IS_LIST(value)) {
+        count = AS_LIST(value)->values.count;
+    } else if (IS_ARRAY(value)) {
+        count = AS_ARRAY(value)->count;
+    } else {
+        count = AS_SET(value)->data.count;
+    }
+    if (count == 0) {
+        return writeChars(&writer->out, "[]", 2);
+    }
+
+    if (!writeChar(&writer->out, '[')) {
+        return false;
+    }
+    bool first = true;
+    int setIndex = 0;
+    for (int i = 0; i < count; i++) {
+        if (!first && !writeChar(&writer->out, ',')) {
+            return false;
+        }
+        first = false;
+        if (!writeNewline(writer, depth + 1)) {
+            return false;
+        }
+        bool ok;
+        if (IS_LIST(value)) {
+            ok = writeJsonValue(writer, AS_LIST(value)->values.values[i], depth + 1);
+        } else if (IS_ARRAY(value)) {
+            ok = writeJsonNumber(&writer->out, arrayGet(AS_ARRAY(value), i));
+        } else {
+            Table* table = &AS_SET(value)->data;
+            while (IS_EMPTY(table->entries[setIndex].key)) {
+                setIndex++;
             }
-            cJSON_AddItemToObject(json, AS_CSTRING(key), valueToCJson(val));
+            ok = writeJsonValue(writer, table->entries[setIndex++].key, depth + 1);
         }
-        return json;
-    } else if (IS_LIST(value)) {
-        cJSON* json = cJSON_CreateArray();
-        ObjList* list = AS_LIST(value);
-        for (int i = 0; i < list->values.count; i++) {
-            cJSON_AddItemToArray(json, valueToCJson(list->values.values[i]));
+        if (!ok) {
+            return false;
         }
-        return json;
+    }
+    return writeNewline(writer, depth) && writeChar(&writer->out, ']');
+}
+
+/**
+ * Method for writing a dict as a JSON object. Entries without a string key are skipped.
+ */
+static bool writeJsonObject(JsonWriter* writer, ObjDict* dict, int depth) {
+    if (!writeChar(&writer->out, '{')) {
+        return false;
+    }
+    bool first = true;
+    for (int i = 0; i < dict->data.entryCount; i++) {
+        Entry* entry = &dict->data.entries[i];
+        if (IS_EMPTY(entry->key) || !IS_STRING(entry->key)) {
+            continue;
+        }
+        if (!first && !writeChar(&writer->out, ',')) {
+            return false;
+        }
+        first = false;
+        ObjString* key = AS_STRING(entry->key);
+        if (!writeNewline(writer, depth + 1) || !writeJsonString(&writer->out, key->chars, key->length)
+                || !writeChar(&writer->out, ':') || (writer->indent > 0 && !writeChar(&writer->out, ' '))
+                || !writeJsonValue(writer, entry->value, depth + 1)) {
+            return false;
+        }
+    }
+    if (!first && !writeNewline(writer, depth)) {
+        return false;
+    }
+    return writeChar(&writer->out, '}');
+}
+
+/**
+ * Method for writing any value as JSON. Values JSON can't represent are written as null.
+ */
+static bool writeJsonValue(JsonWriter* writer, Value value, int depth) {
+    if (depth > JSON_NESTING_LIMIT) {
+        return writerError(&writer->out, "Value is nested too deeply (or contains itself) to serialize.");
+    }
+    if (IS_DICT(value)) {
+        return writeJsonObject(writer, AS_DICT(value), depth);
+    } else if (IS_LIST(value) || IS_ARRAY(value) || IS_SET(value)) {
+        return writeJsonArray(writer, value, depth);
     } else if (IS_STRING(value)) {
-        return cJSON_CreateString(AS_CSTRING(value));
+        ObjString* string = AS_STRING(value);
+        return writeJsonString(&writer->out, string->chars, string->length);
     } else if (IS_NUMBER(value)) {
-        return cJSON_CreateNumber(AS_NUMBER(value));
+        return writeJsonNumber(&writer->out, AS_NUMBER(value));
     } else if (IS_BOOL(value)) {
-        return cJSON_CreateBool(AS_BOOL(value));
-    } else if (IS_NIL(value)) {
-        return cJSON_CreateNull();
+        return AS_BOOL(value) ? writeChars(&writer->out, "true", 4) : writeChars(&writer->out, "false", 5);
     }
-    return cJSON_CreateNull();
+    return writeChars(&writer->out, "null", 4);
+}
+
+/**
+ * Method for reading the optional indent argument: the spaces per level, 0 for compact output.
+ */
+static int indentArgument(int argCount, Value* args, int index) {
+    int indent = 2;
+    if (argCount > index && IS_NUMBER(args[index])) {
+        indent = (int)AS_NUMBER(args[index]);
+        if (indent < 0) indent = 0;
+    }
+    return indent;
 }
 
 /**
@@ -126,132 +831,224 @@ static cJSON* valueToCJson(Value value) {
  */
 static Value loadsJsonNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("loads() expects a single string argument.");
-    }
-
-    cJSON* json = cJSON_Parse(AS_CSTRING(args[0]));
-    if (!json) {
-        return ERROR_VAL_PTR("Invalid JSON string.");
+        return nativeError("loads() expects a single string argument.");
     }
-
-    Value result = cjsonToValue(json);
-    cJSON_Delete(json);
-
-    return result;
+    ObjString* string = AS_STRING(args[0]);
+    return parseDocument(string->chars, string->length, 1);
 }
 
 /**
- * @brief
+ * @brief Loads a JSON file into a Value.
+ * @param file The open file to parse.
+ * @return A Value representing the parsed JSON, or an error value.
  */
 static Value loadJsonNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_FILE(args[0])) {
-        return ERROR_VAL_PTR("load() expects a single file argument.");
+        return nativeError("load() expects a single file argument.");
     }
 
     ObjFile* file = AS_FILE(args[0]);
     if (file->closed) {
-        return ERROR_VAL_PTR("File is not open.");
+        return nativeError("File is not open.");
     }
 
-    // Read the file content into a string
-    fseek(file->file, 0, SEEK_END);
-    long fileSize = ftell(file->file);
-    fseek(file->file, 0, SEEK_SET);
-    char* buffer = malloc(fileSize + 1);
-    if (!buffer) {
-        return ERROR_VAL_PTR("Memory allocation failed.");
+    JsonSource source;
+    if (!openJsonSource(file, &source)) {
+        return nativeError("Failed to read file.");
     }
-    size_t read = fread(buffer, 1, fileSize, file->file);
-    if (read != (size_t)fileSize) {
-        free(buffer);
-        return ERROR_VAL_PTR("Failed to read file.");
+    Value result = parseDocument(source.chars, source.length, 1);
+    closeJsonSource(&source);
+    return result;
+}
+
+/**
+ * @brief Calls a function with each element of a top level JSON array.
+ * @param source A JSON string or an open file holding an array.
+ * @param callback Called with each element in turn.
+ * @return The number of elements, or an error value.
+ *
+ * Only one element is alive at a time, so arrays far larger than memory
+ * as slo values can be worked through.
+ */
+static Value loadEachJsonNative(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 2 || !(IS_STRING(args[0]) || IS_FILE(args[0]))) {
+        return nativeError("loadeach() expects a string or file and a function.");
     }
-    buffer[fileSize] = '\0'; // Null-terminate the string
 
-    cJSON* json = cJSON_Parse(buffer);
-    free(buffer);
-    if (!json) {
-        return ERROR_VAL_PTR("Invalid JSON string.");
+    JsonSource source;
+    if (IS_STRING(args[0])) {
+        source.chars = AS_STRING(args[0])->chars;
+        source.length = AS_STRING(args[0])->length;
+        source.mapped = false;
+    } else {
+        ObjFile* file = AS_FILE(args[0]);
+        if (file->closed) {
+            return nativeError("File is not open.");
+        }
+        if (!openJsonSource(file, &source)) {
+            return nativeError("Failed to read file.");
+        }
     }
 
-    Value result = cjsonToValue(json);
-    cJSON_Delete(json);
+    JsonParser parser;
+    initParser(&parser, source.chars, source.length);
+    Value* stackTop = vm->stackTop;
+    Value result = NIL_VAL;
+    int count = 0;
+
+    skipWhitespace(&parser);
+    bool ok = parser.current < parser.end && *parser.current == '[';
+    if (!ok) {
+        parseError(&parser, "expected an array");
+    } else {
+        parser.current++;
+        skipWhitespace(&parser);
+        bool done = parser.current < parser.end && *parser.current == ']';
+        if (done) {
+            parser.current++;
+        }
+        while (ok && !done) {
+            ok = parseValue(&parser);
+            if (!ok) {
+                break;
+            }
+            Value called;
+            if (!callFunction(args[1], 1, vm->stackTop - 1, &called)) {
+                result = nativeError("loadeach() callback raised an error.");
+                break;
+            }
+            pop();
+            count++;
 
+            skipWhitespace(&parser);
+            char c = parser.current < parser.end ? *parser.current++ : '\0';
+            if (c == ']') {
+                done = true;
+            } else if (c != ',') {
+                if (c != '\0') {
+                    parser.current--;
+                }
+                ok = parseError(&parser, "expected ',' or ']' in array");
+            }
+        }
+        if (ok && IS_NIL(result)) {
+            skipWhitespace(&parser);
+            if (parser.current < parser.end) {
+                ok = parseError(&parser, "unexpected data after the JSON value");
+            }
+        }
+    }
+
+    if (!ok) {
+        result = jsonError(&parser, 1);
+    } else if (IS_NIL(result)) {
+        result = NUMBER_VAL(count);
+    }
+    vm->stackTop = stackTop;
+    if (IS_FILE(args[0])) {
+        closeJsonSource(&source);
+    }
     return result;
 }
 
+/**
+ * @brief Calls a function with the value on each line of newline delimited JSON.
+ * @param file An open file with one JSON value per line.
+ * @param callback Called with each value in turn.
+ * @return The number of values, or an error value.
+ *
+ * Lines are read into the file's own line buffer, so nothing but the values
+ * themselves is allocated. Blank lines are skipped.
+ */
+static Value loadLinesJsonNative(int argCount, Value* args, ParamInfo* params) {
+    if (argCount != 2 || !IS_FILE(args[0])) {
+        return nativeError("loadlines() expects a file and a function.");
+    }
+    ObjFile* file = AS_FILE(args[0]);
+    if (file->closed) {
+        return nativeError("File is not open.");
+    }
+
+    int count = 0;
+    int line = 0;
+    ssize_t length;
+    while (!file->closed && (length = getline(&file->line, &file->lineCapacity, file->file)) != -1) {
+        line++;
+        JsonParser parser;
+        initParser(&parser, file->line, (size_t)length);
+        skipWhitespace(&parser);
+        if (parser.current == parser.end) {
+            continue;
+        }
+
+        Value value = parseDocument(file->line, (size_t)length, line);
+        if (IS_ERROR(value)) {
+            return value;
+        }
+        push(value);
+        Value called;
+        bool ok = callFunction(args[1], 1, vm->stackTop - 1, &called);
+        pop();
+        if (!ok) {
+            return nativeError("loadlines() callback raised an error.");
+        }
+        count++;
+    }
+    return NUMBER_VAL(count);
+}
+
 /**
  * @brief Dumps a Value to a JSON string.
  * @param value The Value to serialize to JSON.
+ * @param indent Optionally the spaces to indent each level by, or 0 for compact output.
  * @return A Value containing the JSON string, or an error value if serialization fails.
  */
 static Value dumpsJsonNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount < 1) {
-        return ERROR_VAL_PTR("dumps() expects at least one argument.");
+        return nativeError("dumps() expects at least one argument.");
     }
 
-    int indent = 2;
-    if (argCount >= 2 && IS_NUMBER(args[1])) {
-        indent = (int)AS_NUMBER(args[1]);
-        if (indent < 0) indent = 0;
+    JsonWriter writer = {{0}, indentArgument(argCount, args, 1)};
+    initWriter(&writer.out);
+    if (!writeJsonValue(&writer, args[0], 0)) {
+        const char* error = writer.out.error;
+        freeWriter(&writer.out);
+        return ERROR_VAL_PTR(error);
     }
-
-    cJSON* json = valueToCJson(args[0]);
-    if (!json) {
-        return ERROR_VAL_PTR("Invalid value for JSON serialization.");
-    }
-
-    char* jsonString = NULL;
-    if (indent == 0) {
-        jsonString = cJSON_PrintUnformatted(json);
-    } else {
-        int bufsize = 256;
-        jsonString = cJSON_PrintBuffered(json, bufsize, 1);
-    }
-    cJSON_Delete(json);
-    if (!jsonString) {
-        return ERROR_VAL_PTR("Failed to serialize JSON.");
-    }
-    Value result = OBJ_VAL(copyString(jsonString, strlen(jsonString)));
-    free(jsonString);
-    return result;
+    return OBJ_VAL(writerToString(&writer.out));
 }
 
+/**
+ * @brief Dumps a Value to a file as JSON.
+ * @param file The open file to write to.
+ * @param value The Value to serialize to JSON.
+ * @param indent Optionally the spaces to indent each level by, or 0 for compact output.
+ *
+ * The JSON is written out as it's made, through a fixed size buffer.
+ */
 static Value dumpJsonNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount < 2 || !IS_FILE(args[0])) {
-        return ERROR_VAL_PTR("dump() expects a file and a value.");
-    }
-
-    int indent = 2;
-    if (argCount >= 3 && IS_NUMBER(args[2])) {
-        indent = (int)AS_NUMBER(args[2]);
-        if (indent < 0) indent = 0;
+        return nativeError("dump() expects a file and a value.");
     }
 
     ObjFile* file = AS_FILE(args[0]);
     if (file->closed) {
-        return ERROR_VAL_PTR("File is not open.");
+        return nativeError("File is not open.");
     }
 
-    cJSON* json = valueToCJson(args[1]);
-    if (!json) {
-        return ERROR_VAL_PTR("Invalid value for JSON serialization.");
+    // a file written in the background has to have caught up before its FILE* is written to
+    if (!syncFile(file)) {
+        return nativeError("Failed to write to file.");
     }
 
-    char* jsonString = NULL;
-    if (indent == 0) {
-        jsonString = cJSON_PrintUnformatted(json);
-    } else {
-        int bufsize = 256;
-        jsonString = cJSON_PrintBuffered(json, bufsize, 1);
+    char buffer[JSON_WRITE_BUFFER_SIZE];
+    JsonWriter writer = {{0}, indentArgument(argCount, args, 2)};
+    initFileWriter(&writer.out, file->file, buffer, sizeof(buffer));
+    if (!writeJsonValue(&writer, args[1], 0) || !flushWriter(&writer.out)) {
+        return ERROR_VAL_PTR(writer.out.error);
     }
-    cJSON_Delete(json);
-    if (!jsonString) {
-        return ERROR_VAL_PTR("Failed to serialize JSON.");
+    if (file->flusher != NULL && fflush(file->file) != 0) {
+        return nativeError("Failed to write to file.");
     }
-
-    fprintf(file->file, "%s", jsonString);
-    free(jsonString);
-
     return NIL_VAL;
 }
@@ -1,12 +1,20 @@
 /**
  * @file math.c
  * @brief Implementation of math-related functions and constants.
+ *
+ * The functions take a number, or a list of numbers or a typed array to
+ * work on every element in one call. The bulk loops run over the raw
+ * buffers so the compiler can vectorise them, and totals are summed
+ * pairwise to keep the rounding error down over long runs.
  */
 
 #include <math.h>
+#include <stdint.h>
 
 #include "builtins/util.h"
+#include "core/object.h"
 #include "core/value.h"
+#include "core/vm.h"
 #include "std/math.h"
 
 
@@ -17,94 +25,315 @@ static Value sqrtNative(int argCount, Value* args, ParamInfo* params);
 static Value sinNative(int argCount, Value* args, ParamInfo* params);
 static Value cosNative(int argCount, Value* args, ParamInfo* params);
 static Value tanNative(int argCount, Value* args, ParamInfo* params);
+static Value sumNative(int argCount, Value* args, ParamInfo* params);
+static Value meanNative(int argCount, Value* args, ParamInfo* params);
+static Value dotNative(int argCount, Value* args, ParamInfo* params);
 
 
+/**
+ * The math module's functions, each one created the first time it's looked up.
+ */
+static NativeDef mathNatives[] = {
+    {"ceil", ceilNative, 1, 1, {{"value", true}}},
+    {"floor", floorNative, 1, 1, {{"value", true}}},
+    {"sqrt", sqrtNative, 1, 1, {{"value", true}}},
+    {"sin", sinNative, 1, 1, {{"value", true}}},
+    {"cos", cosNative, 1, 1, {{"value", true}}},
+    {"tan", tanNative, 1, 1, {{"value", true}}},
+    {"sum", sumNative, 1, 1, {{"values", true}}},
+    {"mean", meanNative, 1, 1, {{"values", true}}},
+    {"dot", dotNative, 2, 2, {{"a", true}, {"b", true}}},
+    {NULL}
+};
+
 /**
  * @brief Gets the math module with all its functions.
  * @return A pointer to the ObjDict containing math functions.
  */
 ObjModule* getMathModule() {
     ObjModule* module = newModule();
-    defineBuiltIn(&module->methods, "ceil", ceilNative, 1, 1, PARAMS({copyString("value", 5), true}));
-    defineBuiltIn(&module->methods, "floor", floorNative, 1, 1, PARAMS({copyString("value", 5), true}));
-    defineBuiltIn(&module->methods, "sqrt", sqrtNative, 1, 1, PARAMS({copyString("value", 5), true}));
-    defineBuiltIn(&module->methods, "sin", sinNative, 1, 1, PARAMS({copyString("value", 5), true}));
-    defineBuiltIn(&module->methods, "cos", cosNative, 1, 1, PARAMS({copyString("value", 5), true}));
-    defineBuiltIn(&module->methods, "tan", tanNative, 1, 1, PARAMS({copyString("value", 5), true}));
+    module->natives = mathNatives;
     return module;
 }
 
+// runs of at most this many are summed straight, longer ones are split in half
+#define PAIRWISE_BLOCK 128
+
 /**
- * Calculates the ceil of a number.
- * If the argument is not a number, returns NIL_VAL or throws an error.
+ * Defines a pairwise sum of term(i) over a run, with four accumulators in
+ * each block so the loop can be vectorised.
  */
-static Value ceilNative(int argCount, Value* args, ParamInfo* params) {
-    if (argCount != 1 || !IS_NUMBER(args[0])) {
-        return ERROR_VAL_PTR("ceil() expects a single numeric argument.");
+#define DEFINE_PAIRWISE(signature, recurse, term)                           \
+    signature {                                                             \
+        if (count <= PAIRWISE_BLOCK) {                                      \
+            double sums[4] = {0, 0, 0, 0};                                  \
+            int i = 0;                                                      \
+            for (; i + 4 <= count; i += 4) {                                \
+                sums[0] += term(i);                                         \
+                sums[1] += term(i + 1);                                     \
+                sums[2] += term(i + 2);                                     \
+                sums[3] += term(i + 3);                                     \
+            }                                                               \
+            for (; i < count; i++) {                                        \
+                sums[0] += term(i);                                         \
+            }                                                               \
+            return (sums[0] + sums[1]) + (sums[2] + sums[3]);               \
+        }                                                                   \
+        int half = count / 2;                                               \
+        return recurse(0, half) + recurse(half, count - half);              \
+    }
+
+#define DOUBLE_TERM(i) (values[i])
+#define DOUBLE_RECURSE(start, n) sumDoubles(values + (start), (n))
+DEFINE_PAIRWISE(double sumDoubles(const double* values, int count), DOUBLE_RECURSE, DOUBLE_TERM)
+
+#define DOT_TERM(i) (a[i] * b[i])
+#define DOT_RECURSE(start, n) dotDoubles(a + (start), b + (start), (n))
+DEFINE_PAIRWISE(double dotDoubles(const double* a, const double* b, int count), DOT_RECURSE, DOT_TERM)
+
+#define VALUE_TERM(i) AS_NUMBER(values[i])
+#define VALUE_RECURSE(start, n) sumValues(values + (start), (n))
+DEFINE_PAIRWISE(static double sumValues(const Value* values, int count), VALUE_RECURSE, VALUE_TERM)
+
+#define VALUE_DOT_TERM(i) (AS_NUMBER(a[i]) * AS_NUMBER(b[i]))
+#define VALUE_DOT_RECURSE(start, n) dotValues(a + (start), b + (start), (n))
+DEFINE_PAIRWISE(static double dotValues(const Value* a, const Value* b, int count), VALUE_DOT_RECURSE, VALUE_DOT_TERM)
+
+/**
+ * Method for checking every value in a list is a number.
+ */
+static bool allNumbers(ObjList* list) {
+    Value* values = list->values.values;
+    for (int i = 0; i < list->count; i++) {
+        if (!IS_NUMBER(values[i])) {
+            return false;
+        }
     }
-    double value = AS_NUMBER(args[0]);
-    return NUMBER_VAL(ceil(value));
+    return true;
 }
 
 /**
- * Calculates the floor of a number.
- * If the argument is not a number, returns NIL_VAL or throws an error.
+ * The functions of one number that also work elementwise.
  */
-static Value floorNative(int argCount, Value* args, ParamInfo* params) {
-    if (argCount != 1 || !IS_NUMBER(args[0])) {
-        return ERROR_VAL_PTR("floor() expects a single numeric argument.");
+typedef enum UnaryOp {
+    UNARY_CEIL,
+    UNARY_FLOOR,
+    UNARY_SQRT,
+    UNARY_SIN,
+    UNARY_COS,
+    UNARY_TAN
+} UnaryOp;
+
+// loop for applying a function to each element, converting them to and from doubles
+#define UNARY_LOOP(out, in, count, fn, load, store)                         \
+    for (int i = 0; i < (count); i++) {                                     \
+        (out)[i] = store(fn(load((in)[i])));                                \
+    }
+
+#define UNARY(out, in, count, op, load, store)                              \
+    switch (op) {                                                           \
+        case UNARY_CEIL: UNARY_LOOP(out, in, count, ceil, load, store); break;   \
+        case UNARY_FLOOR: UNARY_LOOP(out, in, count, floor, load, store); break; \
+        case UNARY_SQRT: UNARY_LOOP(out, in, count, sqrt, load, store); break;   \
+        case UNARY_SIN: UNARY_LOOP(out, in, count, sin, load, store); break;     \
+        case UNARY_COS: UNARY_LOOP(out, in, count, cos, load, store); break;     \
+        case UNARY_TAN: UNARY_LOOP(out, in, count, tan, load, store); break;     \
+    }
+
+#define AS_SAME(value) (value)
+#define AS_I64_DOUBLE(value) ((double)(value))
+
+/**
+ * Method for applying one of the functions to a number, or to every number
+ * in a list or typed array. Lists give a new list, and arrays a new f64 array.
+ */
+static Value unary(int argCount, Value* args, UnaryOp op, const char* error) {
+    if (argCount != 1) {
+        return ERROR_VAL_PTR(error);
+    }
+    if (IS_NUMBER(args[0])) {
+        double value = AS_NUMBER(args[0]);
+        if (op == UNARY_SQRT && value < 0) {
+            return nativeError("sqrt() domain error: negative input.");
+        }
+        double result;
+        UNARY(&result, &value, 1, op, AS_SAME, AS_SAME);
+        return NUMBER_VAL(result);
+    }
+
+    if (IS_ARRAY(args[0])) {
+        ObjArray* array = AS_ARRAY(args[0]);
+        int count = array->count;
+        if (op == UNARY_SQRT) {
+            for (int i = 0; i < count; i++) {
+                if (arrayGet(array, i) < 0) {
+                    return nativeError("sqrt() domain error: negative input.");
+                }
+            }
+        }
+        ObjArray* result = newArray(ARRAY_F64, count);
+        double* out = result->as.f64;
+        if (array->type == ARRAY_F64) {
+            const double* in = array->as.f64;
+            UNARY(out, in, count, op, AS_SAME, AS_SAME);
+        } else {
+            const int64_t* in = array->as.i64;
+            UNARY(out, in, count, op, AS_I64_DOUBLE, AS_SAME);
+        }
+        return OBJ_VAL(result);
+    }
+
+    if (!IS_LIST(args[0]) || !allNumbers(AS_LIST(args[0]))) {
+        return ERROR_VAL_PTR(error);
+    }
+    ObjList* list = AS_LIST(args[0]);
+    int count = list->count;
+    if (op == UNARY_SQRT) {
+        for (int i = 0; i < count; i++) {
+            if (AS_NUMBER(list->values.values[i]) < 0) {
+                return nativeError("sqrt() domain error: negative input.");
+            }
+        }
     }
-    double value = AS_NUMBER(args[0]);
-    return NUMBER_VAL(floor(value));
+    ObjList* result = newListWithCapacity(count);
+    Value* out = result->values.values;
+    const Value* in = list->values.values;
+    UNARY(out, in, count, op, AS_NUMBER, NUMBER_VAL);
+    result->count = count;
+    result->values.count = count;
+    return OBJ_VAL(result);
+}
+
+/**
+ * Calculates the ceil of a number, or of each element of a list or array.
+ */
+static Value ceilNative(int argCount, Value* args, ParamInfo* params) {
+    return unary(argCount, args, UNARY_CEIL, "ceil() expects a number, a list of numbers or an array.");
+}
+
+/**
+ * Calculates the floor of a number, or of each element of a list or array.
+ */
+static Value floorNative(int argCount, Value* args, ParamInfo* params) {
+    return unary(argCount, args, UNARY_FLOOR, "floor() expects a number, a list of numbers or an array.");
 }
 
 /**
- * Calculates the square root of a number.
- * If the argument is not a number, returns NIL_VAL or throws an error.
+ * Calculates the square root of a number, or of each element of a list or array.
+ * Negative numbers are a domain error.
  */
 static Value sqrtNative(int argCount, Value* args, ParamInfo* params) {
-    if (argCount != 1 || !IS_NUMBER(args[0])) {
-        return ERROR_VAL_PTR("sqrt() expects a single numeric argument.");
+    return unary(argCount, args, UNARY_SQRT, "sqrt() expects a number, a list of numbers or an array.");
+}
+
+/**
+ * Calculates the sine of a number, or of each element of a list or array.
+ */
+static Value sinNative(int argCount, Value* args, ParamInfo* params) {
+    return unary(argCount, args, UNARY_SIN, "sin() expects a number, a list of numbers or an array.");
+}
+
+/**
+ * Calculates the cosine of a number, or of each element of a list or array.
+ */
+static Value cosNative(int argCount, Value* args, ParamInfo* params) {
+    return unary(argCount, args, UNARY_COS, "cos() expects a number, a list of numbers or an array.");
+}
+
+/**
+ * Calculates the tangent of a number, or of each element of a list or array.
+ */
+static Value tanNative(int argCount, Value* args, ParamInfo* params) {
+    return unary(argCount, args, UNARY_TAN, "tan() expects a number, a list of numbers or an array.");
+}
+
+/**
+ * Method for adding up a list of numbers or a typed array, giving false if
+ * it's neither. i64 arrays are summed exactly.
+ */
+static bool total(Value value, double* sum, int* count) {
+    if (IS_ARRAY(value)) {
+        ObjArray* array = AS_ARRAY(value);
+        *count = array->count;
+        if (array->type == ARRAY_F64) {
+            *sum = sumDoubles(array->as.f64, array->count);
+            return true;
+        }
+        int64_t exact = 0;
+        for (int i = 0; i < array->count; i++) {
+            exact += array->as.i64[i];
+        }
+        *sum = (double)exact;
+        return true;
     }
-    double value = AS_NUMBER(args[0]);
-    if (value < 0) {
-        return ERROR_VAL_PTR("sqrt() domain error: negative input.");
+    if (!IS_LIST(value) || !allNumbers(AS_LIST(value))) {
+        return false;
     }
-    return NUMBER_VAL(sqrt(value));
+    ObjList* list = AS_LIST(value);
+    *count = list->count;
+    *sum = sumValues(list->values.values, list->count);
+    return true;
 }
 
 /**
- * Calculates the sine of a number.
- * If the argument is not a number, returns NIL_VAL or throws an error.
+ * Adds up a list of numbers or a typed array.
+ * Usage: sum(values)
  */
-static Value sinNative(int argCount, Value* args, ParamInfo* params) {
-    if (argCount != 1 || !IS_NUMBER(args[0])) {
-        return ERROR_VAL_PTR("sin() expects a single numeric argument.");
+static Value sumNative(int argCount, Value* args, ParamInfo* params) {
+    double sum;
+    int count;
+    if (argCount != 1 || !total(args[0], &sum, &count)) {
+        return nativeError("sum() expects a list of numbers or an array.");
     }
-    double value = AS_NUMBER(args[0]);
-    return NUMBER_VAL(sin(value));
+    return NUMBER_VAL(sum);
 }
 
 /**
- * Calculates the cosine of a number.
- * If the argument is not a number, returns NIL_VAL or throws an error.
+ * Works out the mean of a non-empty list of numbers or typed array.
+ * Usage: mean(values)
  */
-static Value cosNative(int argCount, Value* args, ParamInfo* params) {
-    if (argCount != 1 || !IS_NUMBER(args[0])) {
-        return ERROR_VAL_PTR("cos() expects a single numeric argument.");
+static Value meanNative(int argCount, Value* args, ParamInfo* params) {
+    double sum;
+    int count;
+    if (argCount != 1 || !total(args[0], &sum, &count)) {
+        return nativeError("mean() expects a list of numbers or an array.");
+    }
+    if (count == 0) {
+        return nativeError("mean() of an empty list or array.");
     }
-    double value = AS_NUMBER(args[0]);
-    return NUMBER_VAL(cos(value));
+    return NUMBER_VAL(sum / count);
 }
 
 /**
- * Calculates the tangent of a number.
- * If the argument is not a number, returns NIL_VAL or throws an error.
+ * Works out the dot product of two lists of numbers, or two typed arrays
+ * of the same type, of the same length.
+ * Usage: dot(a, b)
  */
-static Value tanNative(int argCount, Value* args, ParamInfo* params) {
-    if (argCount != 1 || !IS_NUMBER(args[0])) {
-        return ERROR_VAL_PTR("tan() expects a single numeric argument.");
+static Value dotNative(int argCount, Value* args, ParamInfo* params) {
+    if (argCount == 2 && IS_ARRAY(args[0]) && IS_ARRAY(args[1])) {
+        ObjArray* a = AS_ARRAY(args[0]);
+        ObjArray* b = AS_ARRAY(args[1]);
+        if (a->type != b->type || a->count != b->count) {
+            return nativeError("dot() expects arrays of the same type and length.");
+        }
+        if (a->type == ARRAY_F64) {
+            return NUMBER_VAL(dotDoubles(a->as.f64, b->as.f64, a->count));
+        }
+        int64_t exact = 0;
+        for (int i = 0; i < a->count; i++) {
+            exact += a->as.i64[i] * b->as.i64[i];
+        }
+        return NUMBER_VAL((double)exact);
+    }
+
+    if (argCount != 2 || !IS_LIST(args[0]) || !IS_LIST(args[1])
+            || !allNumbers(AS_LIST(args[0])) || !allNumbers(AS_LIST(args[1]))) {
+        return nativeError("dot() expects two lists of numbers or two arrays.");
+    }
+    ObjList* a = AS_LIST(args[0]);
+    ObjList* b = AS_LIST(args[1]);
+    if (a->count != b->count) {
+        return nativeError("dot() expects lists of the same length.");
     }
-    double value = AS_NUMBER(args[0]);
-    return NUMBER_VAL(tan(value));
+    return NUMBER_VAL(dotValues(a->values.values, b->values.values, a->count));
 }
@@ -0,0 +1,854 @@
+/**
+ * @file net.c
+ * @brief Implementation of the net module.
+ *
+ * TCP sockets, and a minimal HTTP/1.1 client and server on top of them. All
+ * of it goes through performIo, so inside an async task waiting on the
+ * network parks the task and lets the others run, and anywhere else it blocks.
+ *
+ * HTTP is kept to one request per connection: requests are sent with
+ * "Connection: close" and responses are read until the server closes, and
+ * responses are sent the same way. There's no TLS, so only http:// URLs.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "builtins/util.h"
+#include "core/memory.h"
+#include "core/object.h"
+#include "core/table.h"
+#include "core/value.h"
+#include "core/vm.h"
+#include "objects/bytes_methods.h"
+#include "objects/socket_methods.h"
+#include "std/async.h"
+#include "std/net.h"
+
+// how much more room is made in a buffer before each read
+#define NET_READ_SIZE (1 << 14)
+
+static Value connectNative(int argCount, Value* args, ParamInfo* params);
+static Value listenNative(int argCount, Value* args, ParamInfo* params);
+static Value requestNative(int argCount, Value* args, ParamInfo* params);
+static Value getNative(int argCount, Value* args, ParamInfo* params);
+static Value readRequestNative(int argCount, Value* args, ParamInfo* params);
+static Value respondNative(int argCount, Value* args, ParamInfo* params);
+
+/**
+ * The net module's functions, each one created the first time it's looked up.
+ */
+static NativeDef netNatives[] = {
+    {"connect", connectNative, 2, 2, {{"host", true}, {"port", true}}},
+    {"listen", listenNative, 2, 3, {{"host", true}, {"port", true}, {"backlog", false}}},
+    {"request", requestNative, 2, 4, {{"method", true}, {"url", true}, {"body", false}, {"headers", false}}},
+    {"get", getNative, 1, 2, {{"url", true}, {"headers", false}}},
+    {"readrequest", readRequestNative, 1, 1, {{"socket", true}}},
+    {"respond", respondNative, 3, 4, {{"socket", true}, {"status", true}, {"body", true}, {"headers", false}}},
+    {NULL}
+};
+
+/**
+ * @brief Gets the net module with all its functions.
+ * @return A pointer to the ObjModule containing the net functions.
+ */
+ObjModule* getNetModule() {
+    ObjModule* module = newModule();
+    module->natives = netNatives;
+    return module;
+}
+
+/**
+ * The phases of an HTTP client request.
+ */
+enum {
+    HTTP_CONNECTING,
+    HTTP_SENDING,
+    HTTP_RECEIVING
+};
+
+/**
+ * @struct TextBuffer
+ *
+ * A growable buffer for putting together the head of a request or response.
+ */
+typedef struct TextBuffer {
+    char* data;
+    size_t length;
+    size_t capacity;
+} TextBuffer;
+
+/**
+ * Method for appending length bytes to a text buffer.
+ */
+static void appendText(TextBuffer* buffer, const char* text, size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+        buffer->capacity = buffer->capacity < 256 ? 256 : buffer->capacity * 2;
+        while (buffer->capacity < buffer->length + length) {
+            buffer->capacity *= 2;
+        }
+        buffer->data = realloc(buffer->data, buffer->capacity);
+        if (buffer->data == NULL) {
+            exit(1);
+        }
+    }
+    memcpy(buffer->data + buffer->length, text, length);
+    buffer->length += length;
+}
+
+/**
+ * Method for appending a NUL terminated string to a text buffer.
+ */
+static void appendCString(TextBuffer* buffer, const char* text) {
+    appendText(buffer, text, strlen(text));
+}
+
+/**
+ * Method for appending a string or bytes value to a text buffer.
+ */
+static void appendValue(TextBuffer* buffer, Value value) {
+    if (IS_BYTES(value)) {
+        appendText(buffer, (const char*)AS_BYTES(value)->data, AS_BYTES(value)->count);
+    } else {
+        appendText(buffer, AS_CSTRING(value), AS_STRING(value)->length);
+    }
+}
+
+/**
+ * Method for appending "Name: value" lines for every entry of a headers dict.
+ * Returns false if a name or value isn't a string.
+ */
+static bool appendHeaders(TextBuffer* buffer, ObjDict* headers) {
+    for (int i = 0; i < headers->data.entryCount; i++) {
+        Entry* entry = &headers->data.entries[i];
+        if (IS_EMPTY(entry->key)) {
+            continue;
+        }
+        if (!IS_STRING(entry->key) || !IS_STRING(entry->value)) {
+            return false;
+        }
+        appendValue(buffer, entry->key);
+        appendText(buffer, ": ", 2);
+        appendValue(buffer, entry->value);
+        appendText(buffer, "\r\n", 2);
+    }
+    return true;
+}
+
+/**
+ * Method for moving a text buffer into a new bytes object, ready to send.
+ */
+static Value takeText(TextBuffer* buffer) {
+    ObjBytes* bytes = newBytes((int)buffer->length);
+    if (buffer->length > 0) {
+        memcpy(bytes->data, buffer->data, buffer->length);
+    }
+    free(buffer->data);
+    buffer->data = NULL;
+    return OBJ_VAL(bytes);
+}
+
+/**
+ * Method for checking whether a file descriptor is ready, without waiting.
+ */
+static bool isReady(int fd, short events) {
+    struct pollfd single = {fd, events, 0};
+    return poll(&single, 1, 0) > 0;
+}
+
+/**
+ * Method for opening a non-blocking connection to host:port.
+ *
+ * The connection might still be in progress, so it's ready to use once
+ * the socket can be written to. Returns nil, or an error.
+ */
+static Value openConnection(const char* host, int port, int* fd, bool* inProgress) {
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    // resolving the name still blocks, there's no portable non-blocking lookup
+    struct addrinfo* addresses;
+    int status = getaddrinfo(host, service, &hints, &addresses);
+    if (status != 0) {
+        char message[256];
+        snprintf(message, sizeof(message), "Could not resolve '%s': %s", host, gai_strerror(status));
+        return ERROR_VAL_PTR(message);
+    }
+
+    Value error = NIL_VAL;
+    *fd = -1;
+    for (struct addrinfo* address = addresses; address != NULL; address = address->ai_next) {
+        int attempt = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (attempt < 0) {
+            continue;
+        }
+        if (!setNonBlocking(attempt)) {
+            close(attempt);
+            continue;
+        }
+        if (connect(attempt, address->ai_addr, address->ai_addrlen) == 0) {
+            *fd = attempt;
+            *inProgress = false;
+            break;
+        }
+        if (errno == EINPROGRESS) {
+            *fd = attempt;
+            *inProgress = true;
+            break;
+        }
+        close(attempt);
+    }
+    if (*fd < 0) {
+        error = socketError("connect()");
+    }
+    freeaddrinfo(addresses);
+    return error;
+}
+
+/**
+ * Method for checking whether a connection in progress has finished.
+ * Returns false until it has, then true with any error in result.
+ */
+static bool finishConnecting(int fd, Value* result) {
+    if (!isReady(fd, POLLOUT)) {
+        return false;
+    }
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0) {
+        *result = socketError("connect()");
+    } else if (error != 0) {
+        errno = error;
+        *result = socketError("connect()");
+    }
+    return true;
+}
+
+/**
+ * I/O step that waits for a connection to finish, finishing with its socket.
+ */
+static bool connectStep(IoRequest* request, Value* result) {
+    if (!finishConnecting(request->fd, result)) {
+        return false;
+    }
+    if (IS_ERROR(*result)) {
+        closeSocket(AS_SOCKET(request->state));
+        return true;
+    }
+    *result = request->state;
+    return true;
+}
+
+/**
+ * Method for reading whatever's available onto the end of the request's bytes buffer.
+ *
+ * Returns how many bytes were read, 0 at the end of the stream, or -1 if
+ * there's nothing yet or it failed, with the error in result.
+ */
+static ssize_t readMore(IoRequest* request, Value* result) {
+    ObjBytes* bytes = AS_BYTES(request->buffer);
+    if (bytes->capacity - bytes->count < NET_READ_SIZE) {
+        int oldCapacity = bytes->capacity;
+        bytes->capacity = oldCapacity * 2 < oldCapacity + NET_READ_SIZE ? oldCapacity + NET_READ_SIZE : oldCapacity * 2;
+        bytes->data = GROW_ARRAY(uint8_t, bytes->data, oldCapacity, bytes->capacity);
+    }
+    for (;;) {
+        ssize_t count = recv(request->fd, bytes->data + bytes->count, bytes->capacity - bytes->count, 0);
+        if (count >= 0) {
+            bytes->count += (int)count;
+            return count;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            *result = socketError("recv()");
+        }
+        return -1;
+    }
+}
+
+/**
+ * Method for finding the blank line that ends a message's head.
+ * Returns the offset just past it, or -1 if it hasn't all arrived yet.
+ */
+static int findHeadEnd(const uint8_t* data, int length) {
+    for (int i = 0; i + 3 < length; i++) {
+        if (data[i] == '\r' && data[i + 1] == '\n' && data[i + 2] == '\r' && data[i + 3] == '\n') {
+            return i + 4;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Method for parsing the header lines after a message's first line into a
+ * dict, with the names in lower case. Returns the end of the first line.
+ */
+static int parseHeaders(const char* data, int headEnd, ObjDict* headers) {
+    const char* lineEnd = strstr(data, "\r\n");
+    if (lineEnd == NULL || lineEnd >= data + headEnd) {
+        lineEnd = data + headEnd - 4;
+    }
+    int firstLineEnd = (int)(lineEnd - data);
+    const char* line = lineEnd + 2;
+    const char* end = data + headEnd - 2;
+
+    while (line < end) {
+        lineEnd = strstr(line, "\r\n");
+        if (lineEnd == NULL) {
+            break;
+        }
+        const char* colon = memchr(line, ':', lineEnd - line);
+        if (colon != NULL) {
+            int nameLength = (int)(colon - line);
+            char* name = malloc(nameLength + 1);
+            for (int i = 0; i < nameLength; i++) {
+                name[i] = (char)tolower((unsigned char)line[i]);
+            }
+            const char* value = colon + 1;
+            const char* valueEnd = lineEnd;
+            while (value < valueEnd && (*value == ' ' || *value == '\t')) {
+                value++;
+            }
+            while (valueEnd > value && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t')) {
+                valueEnd--;
+            }
+
+            // keep both rooted while the other is made and the dict grows
+            push(OBJ_VAL(copyRuntimeString(name, nameLength)));
+            push(OBJ_VAL(copyRuntimeString(value, (int)(valueEnd - value))));
+            tableSet(&headers->data, peek(1), peek(0));
+            pop();
+            pop();
+            free(name);
+        }
+        line = lineEnd + 2;
+    }
+    return firstLineEnd;
+}
+
+/**
+ * Method for getting a header's value from a parsed headers dict, or NULL.
+ */
+static const char* findHeader(ObjDict* headers, const char* name) {
+    Value value;
+    ObjString* key = copyRuntimeString(name, (int)strlen(name));
+    if (!tableGet(&headers->data, OBJ_VAL(key), &value)) {
+        return NULL;
+    }
+    return AS_CSTRING(value);
+}
+
+/**
+ * Method for getting the Content-Length from parsed headers, or -1 if there isn't one.
+ */
+static long contentLength(ObjDict* headers) {
+    const char* length = findHeader(headers, "content-length");
+    if (length == NULL) {
+        return -1;
+    }
+    char* end;
+    long value = strtol(length, &end, 10);
+    return end == length || value < 0 ? -1 : value;
+}
+
+/**
+ * Method for decoding a chunked body in place. Returns its decoded length, or -1 if it's malformed.
+ */
+static long decodeChunked(char* body, long length) {
+    long read = 0;
+    long written = 0;
+    for (;;) {
+        char* end;
+        long size = strtol(body + read, &end, 16);
+        char* lineEnd = strstr(end, "\r\n");
+        if (end == body + read || size < 0 || lineEnd == NULL) {
+            return -1;
+        }
+        read = (lineEnd - body) + 2;
+        if (size == 0) {
+            return written;
+        }
+        if (read + size > length) {
+            return -1;
+        }
+        memmove(body + written, body + read, size);
+        written += size;
+        read += size + 2;
+    }
+}
+
+/**
+ * Method for parsing a whole HTTP response into a dict of its status, headers and body.
+ */
+static Value parseResponse(ObjBytes* bytes) {
+    // NUL terminated so it can be searched as a string
+    bytesAppend(bytes, '\0');
+    char* data = (char*)bytes->data;
+    int length = bytes->count - 1;
+
+    int headEnd = findHeadEnd(bytes->data, length);
+    if (headEnd < 0 || strncmp(data, "HTTP/", 5) != 0) {
+        return ERROR_VAL_PTR("request() got a malformed response.");
+    }
+
+    ObjDict* response = newDict();
+    push(OBJ_VAL(response));
+    ObjDict* headers = newDict();
+    push(OBJ_VAL(headers));
+    parseHeaders(data, headEnd, headers);
+
+    const char* space = strchr(data, ' ');
+    double status = space != NULL ? strtol(space + 1, NULL, 10) : 0;
+
+    char* body = data + headEnd;
+    long bodyLength = length - headEnd;
+    const char* encoding = findHeader(headers, "transfer-encoding");
+    if (encoding != NULL && strstr(encoding, "chunked") != NULL) {
+        bodyLength = decodeChunked(body, bodyLength);
+        if (bodyLength < 0) {
+            pop();
+            pop();
+            return ERROR_VAL_PTR("request() got a malformed chunked response.");
+        }
+    } else {
+        long declared = contentLength(headers);
+        if (declared >= 0 && declared < bodyLength) {
+            bodyLength = declared;
+        }
+    }
+
+    tableSet(&response->data, OBJ_VAL(copyString("status", 6)), NUMBER_VAL(status));
+    tableSet(&response->data, OBJ_VAL(copyString("headers", 7)), OBJ_VAL(headers));
+    push(OBJ_VAL(copyRuntimeString(body, (int)bodyLength)));
+    tableSet(&response->data, OBJ_VAL(copyString("body", 4)), peek(0));
+    pop();
+    pop();
+    pop();
+    return OBJ_VAL(response);
+}
+
+/**
+ * I/O step that connects, sends an HTTP request and reads the whole response.
+ *
+ * The state is the socket, and the buffer is the request until it's sent
+ * and then the response as it arrives.
+ */
+static bool httpClientStep(IoRequest* request, Value* result) {
+    ObjSocket* socket = AS_SOCKET(request->state);
+    switch (request->phase) {
+        case HTTP_CONNECTING:
+            if (!finishConnecting(request->fd, result)) {
+                return false;
+            }
+            if (IS_ERROR(*result)) {
+                break;
+            }
+            request->phase = HTTP_SENDING;
+            // fall through
+        case HTTP_SENDING:
+            if (!sendStep(request, result)) {
+                return false;
+            }
+            if (IS_ERROR(*result)) {
+                break;
+            }
+            request->phase = HTTP_RECEIVING;
+            request->events = POLLIN;
+            request->buffer = OBJ_VAL(newBytes(0));
+            // fall through
+        case HTTP_RECEIVING: {
+            ssize_t count;
+            while ((count = readMore(request, result)) > 0) {
+            }
+            if (count < 0 && !IS_ERROR(*result)) {
+                return false;
+            }
+            if (count == 0) {
+                *result = parseResponse(AS_BYTES(request->buffer));
+            }
+            break;
+        }
+    }
+    closeSocket(socket);
+    return true;
+}
+
+/**
+ * Method for splitting an http:// URL into its host, port and path.
+ * The host and path are written into the given buffers. Returns false if it's not one.
+ */
+static bool parseUrl(const char* url, char* host, size_t hostSize, int* port, const char** path) {
+    if (strncmp(url, "http://", 7) != 0) {
+        return false;
+    }
+    const char* start = url + 7;
+    const char* end = start + strcspn(start, ":/?#");
+    if (end == start || (size_t)(end - start) >= hostSize) {
+        return false;
+    }
+    memcpy(host, start, end - start);
+    host[end - start] = '\0';
+
+    *port = 80;
+    if (*end == ':') {
+        char* portEnd;
+        long value = strtol(end + 1, &portEnd, 10);
+        if (portEnd == end + 1 || value <= 0 || value > 65535) {
+            return false;
+        }
+        *port = (int)value;
+        end = portEnd;
+    }
+    *path = *end == '\0' ? "/" : end;
+    return **path == '/';
+}
+
+/**
+ * Method for sending an HTTP request and reading its response, shared by request() and get().
+ */
+static Value httpRequest(const char* method, const char* url, Value body, Value headers) {
+    char host[256];
+    int port;
+    const char* path;
+    if (!parseUrl(url, host, sizeof(host), &port, &path)) {
+        return ERROR_VAL_PTR("request() expects an http:// URL.");
+    }
+
+    TextBuffer text = {NULL, 0, 0};
+    appendCString(&text, method);
+    appendText(&text, " ", 1);
+    appendCString(&text, path);
+    appendCString(&text, " HTTP/1.1\r\nHost: ");
+    appendCString(&text, host);
+    if (port != 80) {
+        char portText[16];
+        snprintf(portText, sizeof(portText), ":%d", port);
+        appendCString(&text, portText);
+    }
+    appendCString(&text, "\r\nConnection: close\r\n");
+    if (!IS_NIL(body)) {
+        char lengthText[48];
+        int length = IS_BYTES(body) ? AS_BYTES(body)->count : AS_STRING(body)->length;
+        snprintf(lengthText, sizeof(lengthText), "Content-Length: %d\r\n", length);
+        appendCString(&text, lengthText);
+    }
+    if (!IS_NIL(headers) && !appendHeaders(&text, AS_DICT(headers))) {
+        free(text.data);
+        return ERROR_VAL_PTR("request() headers must all be strings.");
+    }
+    appendText(&text, "\r\n", 2);
+    if (!IS_NIL(body)) {
+        appendValue(&text, body);
+    }
+
+    int fd;
+    bool inProgress;
+    Value error = openConnection(host, port, &fd, &inProgress);
+    if (IS_ERROR(error)) {
+        free(text.data);
+        return error;
+    }
+    IoRequest request = {fd, POLLOUT, httpClientStep, NIL_VAL, NIL_VAL, HTTP_CONNECTING, 0, NULL};
+    request.state = OBJ_VAL(newSocket(fd, false));
+    push(request.state);
+    request.buffer = takeText(&text);
+    pop();
+    if (!inProgress) {
+        request.phase = HTTP_SENDING;
+    }
+    return performIo(&request);
+}
+
+/**
+ * Method for checking a value is a string or bytes.
+ */
+static bool isData(Value value) {
+    return IS_STRING(value) || IS_BYTES(value);
+}
+
+/**
+ * connect native function.
+ * Opens a TCP connection to host:port and returns its socket.
+ */
+static Value connectNative(int argCount, Value* args, ParamInfo* params) {
+    if (!IS_STRING(args[0]) || !IS_NUMBER(args[1])) {
+        return ERROR_VAL_PTR("connect() expects a host and a port number.");
+    }
+    int fd;
+    bool inProgress;
+    Value error = openConnection(AS_CSTRING(args[0]), (int)AS_NUMBER(args[1]), &fd, &inProgress);
+    if (IS_ERROR(error)) {
+        return error;
+    }
+    ObjSocket* socket = newSocket(fd, false);
+    if (!inProgress) {
+        return OBJ_VAL(socket);
+    }
+    IoRequest request = {fd, POLLOUT, connectStep, OBJ_VAL(socket), NIL_VAL, 0, 0, NULL};
+    return performIo(&request);
+}
+
+/**
+ * listen native function.
+ * Opens a socket listening for TCP connections on host:port. A nil host
+ * listens on every interface, and port 0 picks a free port.
+ */
+static Value listenNative(int argCount, Value* args, ParamInfo* params) {
+    if ((!IS_NIL(args[0]) && !IS_STRING(args[0])) || !IS_NUMBER(args[1])) {
+        return ERROR_VAL_PTR("listen() expects a host and a port number.");
+    }
+    int backlog = 128;
+    if (argCount == 3 && !IS_NIL(args[2])) {
+        if (!IS_NUMBER(args[2]) || AS_NUMBER(args[2]) < 1) {
+            return ERROR_VAL_PTR("listen() backlog must be a positive number.");
+        }
+        backlog = (int)AS_NUMBER(args[2]);
+    }
+
+    char service[16];
+    snprintf(service, sizeof(service), "%d", (int)AS_NUMBER(args[1]));
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo* addresses;
+    int status = getaddrinfo(IS_NIL(args[0]) ? NULL : AS_CSTRING(args[0]), service, &hints, &addresses);
+    if (status != 0) {
+        char message[256];
+        snprintf(message, sizeof(message), "listen() could not resolve the host: %s", gai_strerror(status));
+        return ERROR_VAL_PTR(message);
+    }
+
+    int fd = -1;
+    for (struct addrinfo* address = addresses; address != NULL && fd < 0; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(fd, address->ai_addr, address->ai_addrlen) != 0 || listen(fd, backlog) != 0
+                || !setNonBlocking(fd)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        return socketError("listen()");
+    }
+    return OBJ_VAL(newSocket(fd, true));
+}
+
+/**
+ * request native function.
+ * Sends an HTTP request with an optional body and dict of headers, and returns
+ * the response as a dict of its status, headers (with lower case names) and body.
+ */
+static Value requestNative(int argCount, Value* args, ParamInfo* params) {
+    if (!IS_STRING(args[0]) || !IS_STRING(args[1])) {
+        return ERROR_VAL_PTR("request() expects a method and a URL.");
+    }
+    Value body = argCount > 2 ? args[2] : NIL_VAL;
+    Value headers = argCount > 3 ? args[3] : NIL_VAL;
+    if (!IS_NIL(body) && !isData(body)) {
+        return ERROR_VAL_PTR("request() body must be a string or bytes.");
+    }
+    if (!IS_NIL(headers) && !IS_DICT(headers)) {
+        return ERROR_VAL_PTR("request() headers must be a dict.");
+    }
+    return httpRequest(AS_CSTRING(args[0]), AS_CSTRING(args[1]), body, headers);
+}
+
+/**
+ * get native function.
+ * Sends an HTTP GET request, returning the response like request() does.
+ */
+static Value getNative(int argCount, Value* args, ParamInfo* params) {
+    if (!IS_STRING(args[0])) {
+        return ERROR_VAL_PTR("get() expects a URL.");
+    }
+    Value headers = argCount > 1 ? args[1] : NIL_VAL;
+    if (!IS_NIL(headers) && !IS_DICT(headers)) {
+        return ERROR_VAL_PTR("get() headers must be a dict.");
+    }
+    return httpRequest("GET", AS_CSTRING(args[0]), NIL_VAL, headers);
+}
+
+/**
+ * Method for parsing a whole HTTP request into a dict of its method, path, headers and body.
+ */
+static Value parseRequest(ObjBytes* bytes, int headEnd, long bodyLength) {
+    bytesAppend(bytes, '\0');
+    char* data = (char*)bytes->data;
+
+    ObjDict* request = newDict();
+    push(OBJ_VAL(request));
+    ObjDict* headers = newDict();
+    push(OBJ_VAL(headers));
+    int firstLineEnd = parseHeaders(data, headEnd, headers);
+
+    // "METHOD /path HTTP/1.1"
+    const char* method = data;
+    const char* methodEnd = memchr(method, ' ', firstLineEnd);
+    if (methodEnd == NULL) {
+        pop();
+        pop();
+        return ERROR_VAL_PTR("readrequest() got a malformed request.");
+    }
+    const char* path = methodEnd + 1;
+    const char* pathEnd = memchr(path, ' ', data + firstLineEnd - path);
+    if (pathEnd == NULL) {
+        pathEnd = data + firstLineEnd;
+    }
+
+    tableSet(&request->data, OBJ_VAL(copyString("headers", 7)), OBJ_VAL(headers));
+    push(OBJ_VAL(copyRuntimeString(method, (int)(methodEnd - method))));
+    tableSet(&request->data, OBJ_VAL(copyString("method", 6)), peek(0));
+    pop();
+    push(OBJ_VAL(copyRuntimeString(path, (int)(pathEnd - path))));
+    tableSet(&request->data, OBJ_VAL(copyString("path", 4)), peek(0));
+    pop();
+    push(OBJ_VAL(copyRuntimeString(data + headEnd, (int)bodyLength)));
+    tableSet(&request->data, OBJ_VAL(copyString("body", 4)), peek(0));
+    pop();
+    pop();
+    pop();
+    return OBJ_VAL(request);
+}
+
+/**
+ * I/O step that reads an HTTP request's head and then as much body as its
+ * Content-Length says. The buffer holds what's arrived so far, and offset is
+ * where the head ends once it's all arrived.
+ */
+static bool readRequestStep(IoRequest* request, Value* result) {
+    for (;;) {
+        ObjBytes* bytes = AS_BYTES(request->buffer);
+        if (request->offset == 0) {
+            int headEnd = findHeadEnd(bytes->data, bytes->count);
+            if (headEnd >= 0) {
+                request->offset = headEnd;
+            }
+        }
+        if (request->offset > 0) {
+            // the head has arrived so just parse the length out of it to see if the body has too
+            int headEnd = (int)request->offset;
+            ObjDict* headers = newDict();
+            push(OBJ_VAL(headers));
+            bytesAppend(bytes, '\0');
+            bytes->count--;
+            parseHeaders((char*)bytes->data, headEnd, headers);
+            long length = contentLength(headers);
+            pop();
+            length = length < 0 ? 0 : length;
+            if (bytes->count - headEnd >= length) {
+                *result = parseRequest(bytes, headEnd, length);
+                return true;
+            }
+        }
+
+        ssize_t count = readMore(request, result);
+        if (count < 0) {
+            return IS_ERROR(*result);
+        }
+        if (count == 0) {
+            // closed before a whole request arrived, which is nil if nothing did
+            *result = bytes->count == 0 ? NIL_VAL : ERROR_VAL_PTR("readrequest() connection closed mid-request.");
+            return true;
+        }
+    }
+}
+
+/**
+ * readrequest native function.
+ * Reads an HTTP request from a connection, returning a dict of its method,
+ * path, headers (with lower case names) and body, or nil if the connection
+ * closed without sending one.
+ */
+static Value readRequestNative(int argCount, Value* args, ParamInfo* params) {
+    if (!IS_SOCKET(args[0]) || AS_SOCKET(args[0])->closed || AS_SOCKET(args[0])->listening) {
+        return ERROR_VAL_PTR("readrequest() expects an open, connected socket.");
+    }
+    IoRequest request = {AS_SOCKET(args[0])->fd, POLLIN, readRequestStep, NIL_VAL, NIL_VAL, 0, 0, NULL};
+    request.buffer = OBJ_VAL(newBytes(0));
+    return performIo(&request);
+}
+
+/**
+ * Method for getting the reason phrase for a status code.
+ */
+static const char* reasonPhrase(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        default: return "Unknown";
+    }
+}
+
+/**
+ * respond native function.
+ * Sends an HTTP response with the status, body and an optional dict of
+ * headers. Content-Length and "Connection: close" are added, so the
+ * connection should be closed afterwards. Returns how many bytes were sent.
+ */
+static Value respondNative(int argCount, Value* args, ParamInfo* params) {
+    if (!IS_SOCKET(args[0]) || AS_SOCKET(args[0])->closed || AS_SOCKET(args[0])->listening) {
+        return ERROR_VAL_PTR("respond() expects an open, connected socket.");
+    }
+    if (!IS_NUMBER(args[1]) || AS_NUMBER(args[1]) < 100 || AS_NUMBER(args[1]) > 999) {
+        return ERROR_VAL_PTR("respond() status must be a number from 100 to 999.");
+    }
+    if (!isData(args[2])) {
+        return ERROR_VAL_PTR("respond() body must be a string or bytes.");
+    }
+    if (argCount > 3 && !IS_NIL(args[3]) && !IS_DICT(args[3])) {
+        return ERROR_VAL_PTR("respond() headers must be a dict.");
+    }
+
+    int status = (int)AS_NUMBER(args[1]);
+    int length = IS_BYTES(args[2]) ? AS_BYTES(args[2])->count : AS_STRING(args[2])->length;
+    char line[128];
+    snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\nContent-Length: %d\r\nConnection: close\r\n",
+        status, reasonPhrase(status), length);
+    TextBuffer text = {NULL, 0, 0};
+    appendCString(&text, line);
+    if (argCount > 3 && !IS_NIL(args[3]) && !appendHeaders(&text, AS_DICT(args[3]))) {
+        free(text.data);
+        return ERROR_VAL_PTR("respond() headers must all be strings.");
+    }
+    appendText(&text, "\r\n", 2);
+    appendValue(&text, args[2]);
+
+    IoRequest request = {AS_SOCKET(args[0])->fd, POLLOUT, sendStep, NIL_VAL, NIL_VAL, 0, 0, NULL};
+    request.buffer = takeText(&text);
+    return performIo(&request);
+}
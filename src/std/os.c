@@ -5,10 +5,14 @@
 
 #define _POSIX_C_SOURCE 200112L
 #define _XOPEN_SOURCE 700
+// for d_type and the DT_* constants
+#define _DEFAULT_SOURCE
 
 #include <dirent.h>
+#include <fnmatch.h>
 #include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,7 +20,9 @@
 #include <unistd.h>
 
 #include "builtins/util.h"
+#include "core/gc.h"
 #include "core/object.h"
+#include "core/vm.h"
 #include "core/value.h"
 #include "std/os.h"
 
@@ -45,6 +51,37 @@ static Value absPath(int argCount, Value* args, ParamInfo* params);
 static Value joinPath(int argCount, Value* args, ParamInfo* params);
 static Value baseName(int argCount, Value* args, ParamInfo* params);
 static Value dirName(int argCount, Value* args, ParamInfo* params);
+static Value walkNative(int argCount, Value* args, ParamInfo* params);
+static Value globNative(int argCount, Value* args, ParamInfo* params);
+static Value statNative(int argCount, Value* args, ParamInfo* params);
+
+/**
+ * The os module's functions, each one created the first time it's looked up.
+ */
+static NativeDef osNatives[] = {
+    {"getenv", getEnvNative, 1, 1, {{"name", true}}},
+    {"setenv", setEnvNative, 2, 2, {{"name", true}, {"value", true}}},
+    {"unsetenv", unsetEnvNative, 1, 1, {{"name", true}}},
+    {"getcwd", getCWD, 0, 0, {}},
+    {"getpid", getPID, 0, 0, {}},
+    {"getuid", getUID, 0, 0, {}},
+    {"chdir", changeDir, 1, 1, {{"path", true}}},
+    {"mkdir", makeDir, 1, 1, {{"path", true}}},
+    {"rmdir", rmDir, 1, 1, {{"path", true}}},
+    {"remove", removeFile, 1, 1, {{"path", true}}},
+    {"listdir", listDir, 1, 1, {{"path", true}}},
+    {"exists", existsNtv, 1, 1, {{"path", true}}},
+    {"isfile", isFile, 1, 1, {{"path", true}}},
+    {"isdir", isDir, 1, 1, {{"path", true}}},
+    {"abspath", absPath, 1, 1, {{"path", true}}},
+    {"join", joinPath, 1, -1, {{"path", true}, {"...args", true}}},
+    {"basename", baseName, 1, 1, {{"path", true}}},
+    {"dirname", dirName, 1, 1, {{"path", true}}},
+    {"walk", walkNative, 1, 2, {{"root", true}, {"threads", false}}},
+    {"glob", globNative, 1, 1, {{"pattern", true}}},
+    {"stat", statNative, 1, 1, {{"path", true}}},
+    {NULL}
+};
 
 /**
  * @brief Gets the random module with all its functions.
@@ -52,25 +89,7 @@ static Value dirName(int argCount, Value* args, ParamInfo* params);
  */
 ObjModule* getOSModule() {
     ObjModule* module = newModule();
-    defineBuiltIn(&module->methods, "getenv", getEnvNative, 1, 1, PARAMS({copyString("name", 4), true}));
-    defineBuiltIn(&module->methods, "setenv", setEnvNative, 2, 2, PARAMS({copyString("name", 4), true}, {copyString("value", 5), true}));
-    defineBuiltIn(&module->methods, "unsetenv", unsetEnvNative, 1, 1, PARAMS({copyString("name", 4), true}));
-
-    defineBuiltIn(&module->methods, "getcwd", getCWD, 0, 0, NULL);
-    defineBuiltIn(&module->methods, "getpid", getPID, 0, 0, NULL);
-    defineBuiltIn(&module->methods, "getuid", getUID, 0, 0, NULL);
-    defineBuiltIn(&module->methods, "chdir", changeDir, 1, 1, PARAMS({copyString("path", 4), true}));
-    defineBuiltIn(&module->methods, "mkdir", makeDir, 1, 1, PARAMS({copyString("path", 4), true}));
-    defineBuiltIn(&module->methods, "rmdir", rmDir, 1, 1, PARAMS({copyString("path", 4), true}));
-    defineBuiltIn(&module->methods, "remove", removeFile, 1, 1, PARAMS({copyString("path", 4), true}));
-    defineBuiltIn(&module->methods, "listdir", listDir, 1, 1, PARAMS({copyString("path", 4), true}));
-    defineBuiltIn(&module->methods, "exists", existsNtv, 1, 1, PARAMS({copyString("path", 4), true}));
-    defineBuiltIn(&module->methods, "isfile", isFile, 1, 1, PARAMS({copyString("path", 4), true}));
-    defineBuiltIn(&module->methods, "isdir", isDir, 1, 1, PARAMS({copyString("path", 4), true}));
-    defineBuiltIn(&module->methods, "abspath", absPath, 1, 1, PARAMS({copyString("path", 4), true}));
-    defineBuiltIn(&module->methods, "join", joinPath, 1, -1, PARAMS({copyString("path", 4), true}, {copyString("...args", 7), true}));
-    defineBuiltIn(&module->methods, "basename", baseName, 1, 1, PARAMS({copyString("path", 4), true}));
-    defineBuiltIn(&module->methods, "dirname", dirName, 1, 1, PARAMS({copyString("path", 4), true}));
+    module->natives = osNatives;
     return module;
 }
 
@@ -80,7 +99,7 @@ ObjModule* getOSModule() {
  */
 static Value getEnvNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("getenv() expects a single string argument.");
+        return nativeError("getenv() expects a single string argument.");
     }
     const char* name = AS_CSTRING(args[0]);
     char* value = getenv(name);
@@ -96,7 +115,7 @@ static Value getEnvNative(int argCount, Value* args, ParamInfo* params) {
  */
 static Value setEnvNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 2 || !IS_STRING(args[0]) || !IS_STRING(args[1])) {
-        return ERROR_VAL_PTR("setenv() expects two string arguments.");
+        return nativeError("setenv() expects two string arguments.");
     }
     const char* name = AS_CSTRING(args[0]);
     const char* value = AS_CSTRING(args[1]);
@@ -108,7 +127,7 @@ static Value setEnvNative(int argCount, Value* args, ParamInfo* params) {
     int result = setenv(name, value, 1);
 #endif
     if (result != 0) {
-        return ERROR_VAL_PTR("setenv() failed to set environment variable.");
+        return nativeError("setenv() failed to set environment variable.");
     }
     return NIL_VAL;
 }
@@ -119,7 +138,7 @@ static Value setEnvNative(int argCount, Value* args, ParamInfo* params) {
  */
 static Value unsetEnvNative(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("unsetenv() expects a single string argument.");
+        return nativeError("unsetenv() expects a single string argument.");
     }
     const char* name = AS_CSTRING(args[0]);
 #if defined(_WIN32)
@@ -130,7 +149,7 @@ static Value unsetEnvNative(int argCount, Value* args, ParamInfo* params) {
     int result = unsetenv(name);
 #endif
     if (result != 0) {
-        return ERROR_VAL_PTR("unsetenv() failed to unset environment variable.");
+        return nativeError("unsetenv() failed to unset environment variable.");
     }
     return NIL_VAL;
 }
@@ -143,11 +162,11 @@ static Value unsetEnvNative(int argCount, Value* args, ParamInfo* params) {
  */
 static Value getCWD(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 0) {
-        return ERROR_VAL_PTR("getcwd() expects no arguments.");
+        return nativeError("getcwd() expects no arguments.");
     }
     char cwd[1024];
     if (getcwd(cwd, sizeof(cwd)) == NULL) {
-        return ERROR_VAL_PTR("getcwd() failed to get current working directory.");
+        return nativeError("getcwd() failed to get current working directory.");
     }
     return OBJ_VAL(copyString(cwd, (int)strlen(cwd)));
 }
@@ -160,7 +179,7 @@ static Value getCWD(int argCount, Value* args, ParamInfo* params) {
  */
 static Value getPID(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 0) {
-        return ERROR_VAL_PTR("getpid() expects no arguments.");
+        return nativeError("getpid() expects no arguments.");
     }
     pid_t pid = getpid();
     return NUMBER_VAL((double)pid);
@@ -174,7 +193,7 @@ static Value getPID(int argCount, Value* args, ParamInfo* params) {
  */
 static Value getUID(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 0) {
-        return ERROR_VAL_PTR("getuid() expects no arguments.");
+        return nativeError("getuid() expects no arguments.");
     }
     uid_t uid = getuid();
     return NUMBER_VAL((double)uid);
@@ -188,11 +207,11 @@ static Value getUID(int argCount, Value* args, ParamInfo* params) {
  */
 static Value changeDir(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("chdir() expects a single string argument.");
+        return nativeError("chdir() expects a single string argument.");
     }
     const char* path = AS_CSTRING(args[0]);
     if (chdir(path) != 0) {
-        return ERROR_VAL_PTR("chdir() failed to change directory.");
+        return nativeError("chdir() failed to change directory.");
     }
     return NIL_VAL;
 }
@@ -205,11 +224,11 @@ static Value changeDir(int argCount, Value* args, ParamInfo* params) {
  */
 static Value makeDir(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("mkdir() expects a single string argument.");
+        return nativeError("mkdir() expects a single string argument.");
     }
     const char* path = AS_CSTRING(args[0]);
     if (mkdir(path, 0755) != 0) {
-        return ERROR_VAL_PTR("mkdir() failed to create directory.");
+        return nativeError("mkdir() failed to create directory.");
     }
     return NIL_VAL;
 }
@@ -222,11 +241,11 @@ static Value makeDir(int argCount, Value* args, ParamInfo* params) {
  */
 static Value rmDir(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("rmdir() expects a single string argument.");
+        return nativeError("rmdir() expects a single string argument.");
     }
     const char* path = AS_CSTRING(args[0]);
     if (rmdir(path) != 0) {
-        return ERROR_VAL_PTR("rmdir() failed to remove directory.");
+        return nativeError("rmdir() failed to remove directory.");
     }
     return NIL_VAL;
 }
@@ -239,11 +258,11 @@ static Value rmDir(int argCount, Value* args, ParamInfo* params) {
  */
 static Value removeFile(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("remove() expects a single string argument.");
+        return nativeError("remove() expects a single string argument.");
     }
     const char* path = AS_CSTRING(args[0]);
     if (unlink(path) != 0) {
-        return ERROR_VAL_PTR("remove() failed to remove file.");
+        return nativeError("remove() failed to remove file.");
     }
     return NIL_VAL;
 }
@@ -254,12 +273,12 @@ static Value removeFile(int argCount, Value* args, ParamInfo* params) {
  */
 static Value listDir(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("listdir() expects a single string argument.");
+        return nativeError("listdir() expects a single string argument.");
     }
     const char* path = AS_CSTRING(args[0]);
     DIR* dir = opendir(path);
     if (dir == NULL) {
-        return ERROR_VAL_PTR("listdir() failed to open directory.");
+        return nativeError("listdir() failed to open directory.");
     }
 
     ObjList* list = newList();
@@ -291,7 +310,7 @@ static Value listDir(int argCount, Value* args, ParamInfo* params) {
  */
 static Value existsNtv(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("exists() expects a single string argument.");
+        return nativeError("exists() expects a single string argument.");
     }
     const char* path = AS_CSTRING(args[0]);
     struct stat buffer;
@@ -307,12 +326,12 @@ static Value existsNtv(int argCount, Value* args, ParamInfo* params) {
  */
 static Value isFile(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("isfile() expects a single string argument.");
+        return nativeError("isfile() expects a single string argument.");
     }
     const char* path = AS_CSTRING(args[0]);
     struct stat buffer;
     if (stat(path, &buffer) != 0) {
-        return ERROR_VAL_PTR("isfile() failed to stat path.");
+        return nativeError("isfile() failed to stat path.");
     }
     return BOOL_VAL(S_ISREG(buffer.st_mode));
 }
@@ -325,12 +344,12 @@ static Value isFile(int argCount, Value* args, ParamInfo* params) {
  */
 static Value isDir(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("isdir() expects a single string argument.");
+        return nativeError("isdir() expects a single string argument.");
     }
     const char* path = AS_CSTRING(args[0]);
     struct stat buffer;
     if (stat(path, &buffer) != 0) {
-        return ERROR_VAL_PTR("isdir() failed to stat path.");
+        return nativeError("isdir() failed to stat path.");
     }
     return BOOL_VAL(S_ISDIR(buffer.st_mode));
 }
@@ -343,12 +362,12 @@ static Value isDir(int argCount, Value* args, ParamInfo* params) {
  */
 static Value absPath(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("abspath() expects a single string argument.");
+        return nativeError("abspath() expects a single string argument.");
     }
     const char* path = AS_CSTRING(args[0]);
     char* resolved = realpath(path, NULL);
     if (resolved == NULL) {
-        return ERROR_VAL_PTR("abspath() failed to resolve path.");
+        return nativeError("abspath() failed to resolve path.");
     }
     Value result = OBJ_VAL(copyString(resolved, (int)strlen(resolved)));
     free(resolved);
@@ -363,13 +382,13 @@ static Value absPath(int argCount, Value* args, ParamInfo* params) {
  */
 static Value joinPath(int argCount, Value* args, ParamInfo* params) {
     if (argCount < 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("join() expects at least one string argument.");
+        return nativeError("join() expects at least one string argument.");
     }
     char path[1024] = {0};
     const char* sep = "/";
     for (int i = 0; i < argCount; i++) {
         if (!IS_STRING(args[i])) {
-            return ERROR_VAL_PTR("join() expects all arguments to be strings.");
+            return nativeError("join() expects all arguments to be strings.");
         }
         const char* part = AS_CSTRING(args[i]);
         if (i > 0) {
@@ -388,7 +407,7 @@ static Value joinPath(int argCount, Value* args, ParamInfo* params) {
  */
 static Value baseName(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("basename() expects a single string argument.");
+        return nativeError("basename() expects a single string argument.");
     }
     const char* path = AS_CSTRING(args[0]);
     const char* base = strrchr(path, '/');
@@ -406,7 +425,7 @@ static Value baseName(int argCount, Value* args, ParamInfo* params) {
  */
 static Value dirName(int argCount, Value* args, ParamInfo* params) {
     if (argCount != 1 || !IS_STRING(args[0])) {
-        return ERROR_VAL_PTR("dirname() expects a single string argument.");
+        return nativeError("dirname() expects a single string argument.");
     }
     const char* path = AS_CSTRING(args[0]);
     char dir[1024];
@@ -418,3 +437,445 @@ static Value dirName(int argCount, Value* args, ParamInfo* params) {
     *lastSlash = '\0'; // Remove the last part
     return OBJ_VAL(copyString(dir, (int)strlen(dir)));
 }
+
+/**
+ * A growable array of C strings, for collecting paths off the VM heap.
+ */
+typedef struct {
+    char** items;
+    int count;
+    int capacity;
+} PathList;
+
+/**
+ * Method for adding a path to a PathList, which takes ownership of it.
+ */
+static void addPath(PathList* paths, char* path) {
+    if (paths->count >= paths->capacity) {
+        paths->capacity = paths->capacity < 8 ? 8 : paths->capacity * 2;
+        paths->items = (char**)realloc(paths->items, sizeof(char*) * paths->capacity);
+        if (paths->items == NULL) exit(1);
+    }
+    paths->items[paths->count++] = path;
+}
+
+/**
+ * Method for freeing a PathList and the paths in it.
+ */
+static void freePaths(PathList* paths) {
+    for (int i = 0; i < paths->count; i++) {
+        free(paths->items[i]);
+    }
+    free(paths->items);
+}
+
+/**
+ * Method for comparing two paths for qsort.
+ */
+static int comparePaths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+ * Method for joining a directory and a name into a new heap string.
+ * An empty directory means the current one and gives just the name.
+ */
+static char* joinName(const char* dir, const char* name) {
+    size_t dirLength = strlen(dir);
+    size_t nameLength = strlen(name);
+    bool slash = dirLength > 0 && dir[dirLength - 1] != '/';
+    char* path = (char*)malloc(dirLength + slash + nameLength + 1);
+    if (path == NULL) exit(1);
+    memcpy(path, dir, dirLength);
+    if (slash) {
+        path[dirLength] = '/';
+    }
+    memcpy(path + dirLength + slash, name, nameLength + 1);
+    return path;
+}
+
+/**
+ * Method for checking whether a directory entry is a directory.
+ * d_type answers it without a stat on most filesystems, the ones that
+ * don't fill it in get a stat, and symlinks are only followed if asked.
+ */
+static bool entryIsDir(const char* dir, struct dirent* entry, bool followLinks) {
+    if (entry->d_type == DT_DIR) {
+        return true;
+    }
+    if (entry->d_type != DT_UNKNOWN && (entry->d_type != DT_LNK || !followLinks)) {
+        return false;
+    }
+    char* path = joinName(dir, entry->d_name);
+    struct stat buffer;
+    int result = followLinks ? stat(path, &buffer) : lstat(path, &buffer);
+    free(path);
+    return result == 0 && S_ISDIR(buffer.st_mode);
+}
+
+/**
+ * Method for appending a value to a list, keeping it rooted while the list grows.
+ */
+static void appendValue(ObjList* list, Value value) {
+    push(value);
+    if (list->count >= list->values.capacity) {
+        growValueArray(&list->values);
+    }
+    list->values.values[list->count++] = value;
+    writeBarrier((Obj*)list, value);
+    list->values.count = list->count;
+    pop();
+}
+
+/**
+ * Method for turning a PathList into a list of strings.
+ */
+static ObjList* pathsToList(PathList* paths) {
+    ObjList* list = newList();
+    push(OBJ_VAL(list));
+    for (int i = 0; i < paths->count; i++) {
+        appendValue(list, OBJ_VAL(copyString(paths->items[i], (int)strlen(paths->items[i]))));
+    }
+    pop();
+    return list;
+}
+
+/**
+ * One directory read by walk(), with its subdirectories and other entries.
+ */
+typedef struct {
+    char* path;
+    PathList dirs;
+    PathList files;
+} WalkDir;
+
+/**
+ * The state shared by everything walking a tree.
+ *
+ * Directories still to be read sit on a stack, and pending counts both those
+ * and the ones being read, so a worker only stops once it's zero: until then
+ * a directory being read by someone else may still add more to the stack.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    PathList stack;
+    int pending;
+    WalkDir* results;
+    int resultCount;
+    int resultCapacity;
+} Walk;
+
+/**
+ * Method for reading a single directory of a walk.
+ * Directories that can't be opened are skipped rather than failing the walk.
+ */
+static void readWalkDir(Walk* walk, char* path) {
+    WalkDir result = {path, {NULL, 0, 0}, {NULL, 0, 0}};
+    DIR* dir = opendir(path);
+    if (dir != NULL) {
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            char* name = strdup(entry->d_name);
+            if (name == NULL) exit(1);
+            addPath(entryIsDir(path, entry, false) ? &result.dirs : &result.files, name);
+        }
+        closedir(dir);
+    }
+    // an empty directory leaves the lists without arrays, which qsort mustn't be given
+    if (result.dirs.count > 1) {
+        qsort(result.dirs.items, result.dirs.count, sizeof(char*), comparePaths);
+    }
+    if (result.files.count > 1) {
+        qsort(result.files.items, result.files.count, sizeof(char*), comparePaths);
+    }
+
+    pthread_mutex_lock(&walk->lock);
+    for (int i = 0; i < result.dirs.count; i++) {
+        addPath(&walk->stack, joinName(path, result.dirs.items[i]));
+    }
+    walk->pending += result.dirs.count - 1;
+    if (walk->resultCount >= walk->resultCapacity) {
+        walk->resultCapacity = walk->resultCapacity < 8 ? 8 : walk->resultCapacity * 2;
+        walk->results = (WalkDir*)realloc(walk->results, sizeof(WalkDir) * walk->resultCapacity);
+        if (walk->results == NULL) exit(1);
+    }
+    walk->results[walk->resultCount++] = result;
+    pthread_cond_broadcast(&walk->ready);
+    pthread_mutex_unlock(&walk->lock);
+}
+
+/**
+ * Method for reading directories off a walk's stack until there are none left.
+ * The calling thread runs it too, so a walk with one thread starts none.
+ */
+static void* runWalker(void* arg) {
+    Walk* walk = (Walk*)arg;
+    pthread_mutex_lock(&walk->lock);
+    while (true) {
+        while (walk->stack.count == 0 && walk->pending > 0) {
+            pthread_cond_wait(&walk->ready, &walk->lock);
+        }
+        if (walk->stack.count == 0) {
+            break;
+        }
+        char* path = walk->stack.items[--walk->stack.count];
+        pthread_mutex_unlock(&walk->lock);
+        readWalkDir(walk, path);
+        pthread_mutex_lock(&walk->lock);
+    }
+    pthread_mutex_unlock(&walk->lock);
+    return NULL;
+}
+
+/**
+ * Method for comparing two walked directories by path for qsort.
+ */
+static int compareWalkDirs(const void* a, const void* b) {
+    return strcmp(((const WalkDir*)a)->path, ((const WalkDir*)b)->path);
+}
+
+/**
+ * Walks a directory tree, giving a list of [path, dirs, files] for every
+ * directory in it. Parents come before their children and everything is
+ * sorted by name, so the result is the same however many threads read it.
+ * Entry types come from readdir where the filesystem gives them, so most
+ * entries never need a stat, and symlinks are listed with the files and
+ * not followed. Passing a number of threads, or true for one per CPU,
+ * reads the directories in parallel.
+ * Usage: walk("src") or walk("src", 8)
+ */
+static Value walkNative(int argCount, Value* args, ParamInfo* params) {
+    if (!IS_STRING(args[0])) {
+        return nativeError("walk() expects a string path.");
+    }
+    int threads = 1;
+    if (argCount == 2) {
+        if (IS_BOOL(args[1])) {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            threads = AS_BOOL(args[1]) && cpus > 1 ? (int)cpus : 1;
+        } else if (IS_NUMBER(args[1]) && AS_NUMBER(args[1]) >= 1) {
+            threads = AS_NUMBER(args[1]) > 256 ? 256 : (int)AS_NUMBER(args[1]);
+        } else {
+            return nativeError("walk() expects a number of threads or a bool.");
+        }
+    }
+    const char* root = AS_CSTRING(args[0]);
+    struct stat buffer;
+    if (stat(root, &buffer) != 0 || !S_ISDIR(buffer.st_mode)) {
+        return nativeError("walk() failed to open directory.");
+    }
+
+    Walk walk;
+    memset(&walk, 0, sizeof(walk));
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.ready, NULL);
+    char* start = strdup(root);
+    if (start == NULL) exit(1);
+    addPath(&walk.stack, start);
+    walk.pending = 1;
+
+    pthread_t* workers = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+    if (workers == NULL) exit(1);
+    int started = 0;
+    for (; started < threads - 1; started++) {
+        if (pthread_create(&workers[started], NULL, runWalker, &walk) != 0) {
+            break;
+        }
+    }
+    runWalker(&walk);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    free(walk.stack.items);
+    pthread_cond_destroy(&walk.ready);
+    pthread_mutex_destroy(&walk.lock);
+
+    if (walk.resultCount > 1) {
+        qsort(walk.results, walk.resultCount, sizeof(WalkDir), compareWalkDirs);
+    }
+    ObjList* list = newList();
+    push(OBJ_VAL(list));
+    for (int i = 0; i < walk.resultCount; i++) {
+        WalkDir* dir = &walk.results[i];
+        ObjList* entry = newList();
+        appendValue(list, OBJ_VAL(entry));
+        appendValue(entry, OBJ_VAL(copyString(dir->path, (int)strlen(dir->path))));
+        appendValue(entry, OBJ_VAL(pathsToList(&dir->dirs)));
+        appendValue(entry, OBJ_VAL(pathsToList(&dir->files)));
+        free(dir->path);
+        freePaths(&dir->dirs);
+        freePaths(&dir->files);
+    }
+    free(walk.results);
+    pop();
+    return OBJ_VAL(list);
+}
+
+/**
+ * Method for checking whether a glob pattern component has any wildcards.
+ */
+static bool hasWildcard(const char* component) {
+    return strpbrk(component, "*?[") != NULL;
+}
+
+/**
+ * Method for matching the pattern components from index onwards under dir,
+ * adding every path that matches to the results.
+ *
+ * Components without wildcards are joined on without reading the directory,
+ * and "**" matches any number of directories, including none.
+ */
+static void globFrom(const char* dir, char** components, int count, int index, PathList* results) {
+    const char* component = components[index];
+    bool last = index == count - 1;
+    if (!hasWildcard(component)) {
+        char* path = joinName(dir, component);
+        struct stat buffer;
+        if (!last) {
+            globFrom(path, components, count, index + 1, results);
+            free(path);
+        } else if (lstat(path, &buffer) == 0) {
+            addPath(results, path);
+        } else {
+            free(path);
+        }
+        return;
+    }
+
+    bool recursive = strcmp(component, "**") == 0;
+    if (recursive && !last) {
+        globFrom(dir, components, count, index + 1, results);
+    }
+    DIR* handle = opendir(dir[0] == '\0' ? "." : dir);
+    if (handle == NULL) {
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(handle)) != NULL) {
+        const char* name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+        if (recursive) {
+            // like a shell, ** skips hidden entries and doesn't follow symlinks
+            if (name[0] == '.') {
+                continue;
+            }
+            char* path = joinName(dir, name);
+            if (entryIsDir(dir, entry, false)) {
+                globFrom(path, components, count, index, results);
+            }
+            if (last) {
+                addPath(results, path);
+            } else {
+                free(path);
+            }
+        } else if (fnmatch(component, name, FNM_PERIOD) == 0) {
+            if (last) {
+                addPath(results, joinName(dir, name));
+            } else if (entryIsDir(dir, entry, true)) {
+                char* path = joinName(dir, name);
+                globFrom(path, components, count, index + 1, results);
+                free(path);
+            }
+        }
+    }
+    closedir(handle);
+}
+
+/**
+ * Finds the paths matching a shell-style pattern, sorted. Each part of the
+ * pattern between slashes can use *, ? and [...], and a part that's just **
+ * matches any number of directories. Hidden entries only match a part that
+ * starts with a dot.
+ * Usage: glob("*.c")
+ */
+static Value globNative(int argCount, Value* args, ParamInfo* params) {
+    if (!IS_STRING(args[0])) {
+        return nativeError("glob() expects a string pattern.");
+    }
+    ObjString* pattern = AS_STRING(args[0]);
+    char* copy = (char*)malloc(pattern->length + 1);
+    if (copy == NULL) exit(1);
+    memcpy(copy, AS_CSTRING(args[0]), pattern->length + 1);
+
+    // split on slashes in place, dropping empty parts
+    char** components = (char**)malloc(sizeof(char*) * (pattern->length / 2 + 1));
+    if (components == NULL) exit(1);
+    int count = 0;
+    char* save = NULL;
+    for (char* part = strtok_r(copy, "/", &save); part != NULL; part = strtok_r(NULL, "/", &save)) {
+        components[count++] = part;
+    }
+
+    PathList results = {NULL, 0, 0};
+    if (count > 0) {
+        globFrom(pattern->length > 0 && AS_CSTRING(args[0])[0] == '/' ? "/" : "", components, count, 0, &results);
+    }
+    free(components);
+    free(copy);
+
+    // ** can reach the same path more than one way
+    if (results.count > 1) {
+        qsort(results.items, results.count, sizeof(char*), comparePaths);
+    }
+    int unique = 0;
+    for (int i = 0; i < results.count; i++) {
+        if (unique > 0 && strcmp(results.items[unique - 1], results.items[i]) == 0) {
+            free(results.items[i]);
+        } else {
+            results.items[unique++] = results.items[i];
+        }
+    }
+    results.count = unique;
+
+    Value list = OBJ_VAL(pathsToList(&results));
+    freePaths(&results);
+    return list;
+}
+
+/**
+ * Method for setting a dict entry named by a C string.
+ */
+static void setEntry(ObjDict* dict, const char* name, Value value) {
+    push(OBJ_VAL(copyString(name, (int)strlen(name))));
+    tableSet(&dict->data, peek(0), value);
+    writeBarrier((Obj*)dict, peek(0));
+    pop();
+}
+
+/**
+ * Gets everything stat knows about a path as a dict, from a single stat call.
+ * Times are in seconds since the epoch.
+ * Usage: stat("file.txt")["size"]
+ */
+static Value statNative(int argCount, Value* args, ParamInfo* params) {
+    if (!IS_STRING(args[0])) {
+        return nativeError("stat() expects a string path.");
+    }
+    struct stat buffer;
+    if (stat(AS_CSTRING(args[0]), &buffer) != 0) {
+        return nativeError("stat() failed to stat path.");
+    }
+    ObjDict* dict = newDict();
+    push(OBJ_VAL(dict));
+    setEntry(dict, "size", NUMBER_VAL((double)buffer.st_size));
+    setEntry(dict, "mode", NUMBER_VAL((double)buffer.st_mode));
+    setEntry(dict, "isfile", BOOL_VAL(S_ISREG(buffer.st_mode)));
+    setEntry(dict, "isdir", BOOL_VAL(S_ISDIR(buffer.st_mode)));
+    setEntry(dict, "uid", NUMBER_VAL((double)buffer.st_uid));
+    setEntry(dict, "gid", NUMBER_VAL((double)buffer.st_gid));
+    setEntry(dict, "inode", NUMBER_VAL((double)buffer.st_ino));
+    setEntry(dict, "device", NUMBER_VAL((double)buffer.st_dev));
+    setEntry(dict, "links", NUMBER_VAL((double)buffer.st_nlink));
+    setEntry(dict, "atime", NUMBER_VAL((double)buffer.st_atime));
+    setEntry(dict, "mtime", NUMBER_VAL((double)buffer.st_mtime));
+    setEntry(dict, "ctime", NUMBER_VAL((double)buffer.st_ctime));
+    pop();
+    return OBJ_VAL(dict);
+}
@@ -1,14 +1,23 @@
 /**
  * @file random.c
  * @brief Implementation of random number generation functions.
+ *
+ * Numbers come from xoshiro256**, which is fast, has a period of 2^256 - 1
+ * and passes the statistical test suites rand() doesn't. The module's
+ * functions use a generator each VM has to itself, so threads don't share
+ * one, and random.Random gives independent streams that can be seeded
+ * separately. Both have the same functions, written once here.
  */
 
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "builtins/util.h"
 #include "core/object.h"
+#include "core/vm.h"
 #include "core/value.h"
 #include "std/random.h"
 
@@ -16,17 +25,83 @@
 #define M_PI 3.14159265358979323846
 #endif
 
+/**
+ * Defines the random module's function and random.Random's method for an
+ * implementation, the one using the VM's generator and the other its receiver's.
+ */
+#define RANDOM_NATIVE(name) \
+    static Value name##Native(int argCount, Value* args, ParamInfo* params) { \
+        return name##With(&vm->random, argCount, args); \
+    } \
+    static Value name##Method(int argCount, Value* args, ParamInfo* params) { \
+        if (argCount < 1 || !IS_RANDOM(args[0])) { \
+            return nativeError(#name "() must be called on a random generator."); \
+        } \
+        return name##With(&AS_RANDOM(args[0])->state, argCount - 1, args + 1); \
+    }
+
 // forward declarations
-static Value randomSeedNative(int argCount, Value* args, ParamInfo* params);
-static Value randomNative(int argCount, Value* args, ParamInfo* params);
-static Value randomIntNative(int argCount, Value* args, ParamInfo* params);
-static Value randomRangeNative(int argCount, Value* args, ParamInfo* params);
-static Value randomChoiceNative(int argCount, Value* args, ParamInfo* params);
-static Value randomShuffleNative(int argCount, Value* args, ParamInfo* params);
-static Value randomBoolNative(int argCount, Value* args, ParamInfo* params);
-static Value randomBytesNative(int argCount, Value* args, ParamInfo* params);
-static Value randomGaussNative(int argCount, Value* args, ParamInfo* params);
-static Value randomSampleNative(int argCount, Value* args, ParamInfo* params);
+static Value seedWith(RandomState* state, int argCount, Value* args);
+static Value randomWith(RandomState* state, int argCount, Value* args);
+static Value randintWith(RandomState* state, int argCount, Value* args);
+static Value randrangeWith(RandomState* state, int argCount, Value* args);
+static Value choiceWith(RandomState* state, int argCount, Value* args);
+static Value shuffleWith(RandomState* state, int argCount, Value* args);
+static Value randboolWith(RandomState* state, int argCount, Value* args);
+static Value randbytesWith(RandomState* state, int argCount, Value* args);
+static Value gaussWith(RandomState* state, int argCount, Value* args);
+static Value sampleWith(RandomState* state, int argCount, Value* args);
+static Value fillWith(RandomState* state, int argCount, Value* args);
+static Value newRandomNative(int argCount, Value* args, ParamInfo* params);
+
+RANDOM_NATIVE(seed)
+RANDOM_NATIVE(random)
+RANDOM_NATIVE(randint)
+RANDOM_NATIVE(randrange)
+RANDOM_NATIVE(choice)
+RANDOM_NATIVE(shuffle)
+RANDOM_NATIVE(randbool)
+RANDOM_NATIVE(randbytes)
+RANDOM_NATIVE(gauss)
+RANDOM_NATIVE(sample)
+RANDOM_NATIVE(fill)
+
+/**
+ * The random module's functions, each one created the first time it's looked up.
+ */
+static NativeDef randomNatives[] = {
+    {"seed", seedNative, 1, 1, {{"seed", true}}},
+    {"random", randomNative, 0, 0, {}},
+    {"randint", randintNative, 2, 2, {{"min", true}, {"max", true}}},
+    {"randrange", randrangeNative, 2, 2, {{"min", true}, {"max", true}}},
+    {"choice", choiceNative, 1, 1, {{"list", true}}},
+    {"shuffle", shuffleNative, 1, 1, {{"list", true}}},
+    {"randbool", randboolNative, 0, 0, {}},
+    {"randbytes", randbytesNative, 1, 1, {{"length", true}}},
+    {"gauss", gaussNative, 2, 2, {{"mean", true}, {"stddev", true}}},
+    {"sample", sampleNative, 2, 2, {{"population", true}, {"k", true}}},
+    {"fill", fillNative, 1, 3, {{"array", true}, {"min", false}, {"max", false}}},
+    {"Random", newRandomNative, 0, 1, {{"seed", false}}},
+    {NULL}
+};
+
+/**
+ * The methods of random.Random generators, the same as the module's functions.
+ */
+static NativeDef generatorNatives[] = {
+    {"seed", seedMethod, 2, 2, {{"seed", true}}},
+    {"random", randomMethod, 1, 1, {}},
+    {"randint", randintMethod, 3, 3, {{"min", true}, {"max", true}}},
+    {"randrange", randrangeMethod, 3, 3, {{"min", true}, {"max", true}}},
+    {"choice", choiceMethod, 2, 2, {{"list", true}}},
+    {"shuffle", shuffleMethod, 2, 2, {{"list", true}}},
+    {"randbool", randboolMethod, 1, 1, {}},
+    {"randbytes", randbytesMethod, 2, 2, {{"length", true}}},
+    {"gauss", gaussMethod, 3, 3, {{"mean", true}, {"stddev", true}}},
+    {"sample", sampleMethod, 3, 3, {{"population", true}, {"k", true}}},
+    {"fill", fillMethod, 2, 4, {{"array", true}, {"min", false}, {"max", false}}},
+    {NULL}
+};
 
 /**
  * @brief Gets the random module with all its functions.
@@ -34,73 +109,168 @@ static Value randomSampleNative(int argCount, Value* args, ParamInfo* params);
  */
 ObjModule* getRandomModule() {
     ObjModule* module = newModule();
-    defineBuiltIn(&module->methods, "seed", randomSeedNative, 1, 1, PARAMS({copyString("seed", 4), true}));
-    defineBuiltIn(&module->methods, "random", randomNative, 0, 0, NULL);
-    defineBuiltIn(&module->methods, "randint", randomIntNative, 2, 2, PARAMS({copyString("min", 3), true}, {copyString("max", 3), true}));
-    defineBuiltIn(&module->methods, "randrange", randomRangeNative, 2, 2, PARAMS({copyString("min", 3), true}, {copyString("max", 3), true}));
-    defineBuiltIn(&module->methods, "choice", randomChoiceNative, 1, 1, PARAMS({copyString("list", 4), true}));
-    defineBuiltIn(&module->methods, "shuffle", randomShuffleNative, 1, 1, PARAMS({copyString("list", 4), true}));
-    defineBuiltIn(&module->methods, "randbool", randomBoolNative, 0, 0, NULL);
-    defineBuiltIn(&module->methods, "randbytes", randomBytesNative, 1, 1, PARAMS({copyString("length", 6), true}));
-    defineBuiltIn(&module->methods, "gauss", randomGaussNative, 2, 2, PARAMS({copyString("mean", 5), true}, {copyString("stddev", 6), true}));
-    defineBuiltIn(&module->methods, "sample", randomSampleNative, 2, 2, PARAMS({copyString("population", 9), true}, {copyString("k", 1), true}));
+    module->natives = randomNatives;
     return module;
 }
 
+/**
+ * @brief Registers the methods of random.Random generators for the given ObjClass.
+ * @param cls The ObjClass representing the random type.
+ */
+void registerRandomMethods(ObjClass* cls) {
+    cls->natives = generatorNatives;
+}
+
+/**
+ * Method for getting the next value of a splitmix64 sequence, used to turn
+ * a seed into a full xoshiro state.
+ */
+static uint64_t splitMix(uint64_t* x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * Seeds a generator, spreading the seed over its whole state.
+ */
+void seedRandom(RandomState* state, uint64_t seed) {
+    for (int i = 0; i < 4; i++) {
+        state->s[i] = splitMix(&seed);
+    }
+}
+
+static inline uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+/**
+ * Gets the generator's next 64 random bits.
+ */
+uint64_t nextRandom(RandomState* state) {
+    uint64_t* s = state->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+/**
+ * Method for getting a random double in [0, 1), from the top 53 bits.
+ */
+static inline double nextDouble(RandomState* state) {
+    return (double)(nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * Method for getting a random integer in [0, bound) without modulo bias.
+ * A bound of 0 stands for 2^64.
+ */
+static uint64_t nextBelow(RandomState* state, uint64_t bound) {
+    if (bound == 0) {
+        return nextRandom(state);
+    }
+    // values below 2^64 % bound would make the low results more likely
+    uint64_t threshold = -bound % bound;
+    for (;;) {
+        uint64_t value = nextRandom(state);
+        if (value >= threshold) {
+            return value % bound;
+        }
+    }
+}
+
+/**
+ * Method for getting a normally distributed number with the Box-Muller transform.
+ */
+static double nextGauss(RandomState* state, double mu, double sigma) {
+    // 1 - u keeps it away from log(0)
+    double u1 = 1.0 - nextDouble(state);
+    double u2 = nextDouble(state);
+    return mu + sqrt(-2.0 * log(u1)) * cos(2 * M_PI * u2) * sigma;
+}
+
+/**
+ * Creates a new generator, from the seed if there is one or else from the
+ * VM's generator.
+ * Usage: Random() or Random(seed)
+ */
+static Value newRandomNative(int argCount, Value* args, ParamInfo* params) {
+    if (argCount == 1 && !IS_NUMBER(args[0])) {
+        return nativeError("Random() expects a numeric seed.");
+    }
+    uint64_t seed = nextRandom(&vm->random);
+    if (argCount == 1) {
+        double number = AS_NUMBER(args[0]);
+        memcpy(&seed, &number, sizeof(seed));
+    }
+    ObjRandom* random = newRandom();
+    seedRandom(&random->state, seed);
+    return OBJ_VAL(random);
+}
+
 /**
  * Sets the seed for the random number generator.
  */
-static Value randomSeedNative(int argCount, Value* args, ParamInfo* params) {
+static Value seedWith(RandomState* state, int argCount, Value* args) {
     if (argCount != 1 || !IS_NUMBER(args[0])) {
-        return ERROR_VAL_PTR("seed() expects a single numeric argument.");
+        return nativeError("seed() expects a single numeric argument.");
     }
-    unsigned int seed = (unsigned int)AS_NUMBER(args[0]);
-    srand(seed);
+    // every number is its own seed, not just the integer part
+    double number = AS_NUMBER(args[0]);
+    uint64_t seed;
+    memcpy(&seed, &number, sizeof(seed));
+    seedRandom(state, seed);
     return NIL_VAL;
 }
 
 /**
  * Generates a random number between 0 and 1.
  */
-static Value randomNative(int argCount, Value* args, ParamInfo* params) {
+static Value randomWith(RandomState* state, int argCount, Value* args) {
     if (argCount != 0) {
-        return ERROR_VAL_PTR("random() expects no arguments.");
+        return nativeError("random() expects no arguments.");
     }
-    return NUMBER_VAL((double)rand() / RAND_MAX);
+    return NUMBER_VAL(nextDouble(state));
 }
 
 /**
  * Generates a random integer between the given range.
  * If the arguments are not numbers, returns ERROR_VAL or throws an error.
  */
-static Value randomIntNative(int argCount, Value* args, ParamInfo* params) {
+static Value randintWith(RandomState* state, int argCount, Value* args) {
     if (argCount != 2 || !IS_NUMBER(args[0]) || !IS_NUMBER(args[1])) {
-        return ERROR_VAL_PTR("randint() expects two numeric arguments.");
+        return nativeError("randint() expects two numeric arguments.");
     }
     double min = AS_NUMBER(args[0]);
     double max = AS_NUMBER(args[1]);
     if (min > max) {
-        return ERROR_VAL_PTR("randint() min must be less than or equal to max.");
+        return nativeError("randint() min must be less than or equal to max.");
     }
-    int range = (int)(max - min + 1);
-    return NUMBER_VAL(min + (rand() % range));
+    uint64_t range = (uint64_t)(max - min) + 1;
+    return NUMBER_VAL(min + (double)nextBelow(state, range));
 }
 
 /**
  * Generates a random number between the given range.
  * If the arguments are not numbers, returns ERROR_VAL or throws an error.
  */
-static Value randomRangeNative(int argCount, Value* args, ParamInfo* params) {
+static Value randrangeWith(RandomState* state, int argCount, Value* args) {
     if (argCount != 2 || !IS_NUMBER(args[0]) || !IS_NUMBER(args[1])) {
-        return ERROR_VAL_PTR("randrange() expects two numeric arguments.");
+        return nativeError("randrange() expects two numeric arguments.");
     }
     double min = AS_NUMBER(args[0]);
     double max = AS_NUMBER(args[1]);
     if (min > max) {
-        return ERROR_VAL_PTR("randrange() min must be less than or equal to max.");
+        return nativeError("randrange() min must be less than or equal to max.");
     }
-    double range = max - min;
-    return NUMBER_VAL(min + ((double)rand() / RAND_MAX) * range);
+    return NUMBER_VAL(min + nextDouble(state) * (max - min));
 }
 
 /**
@@ -109,16 +279,15 @@ static Value randomRangeNative(int argCount, Value* args, ParamInfo* params) {
  * @param args The arguments passed to the function.
  * @return A random choice from the list or an error if the arguments are invalid.
  */
-static Value randomChoiceNative(int argCount, Value* args, ParamInfo* params) {
+static Value choiceWith(RandomState* state, int argCount, Value* args) {
     if (argCount != 1 || !IS_LIST(args[0])) {
-        return ERROR_VAL_PTR("choice() expects a single list argument.");
+        return nativeError("choice() expects a single list argument.");
     }
     ObjList* list = AS_LIST(args[0]);
     if (list->count == 0) {
         return NIL_VAL;
     }
-    int index = rand() % list->count;
-    return list->values.values[index];
+    return list->values.values[nextBelow(state, (uint64_t)list->count)];
 }
 
 /**
@@ -127,21 +296,22 @@ static Value randomChoiceNative(int argCount, Value* args, ParamInfo* params) {
  * @param args The arguments passed to the function.
  * @return The shuffled list or an error if the arguments are invalid.
  */
-static Value randomShuffleNative(int argCount, Value* args, ParamInfo* params) {
+static Value shuffleWith(RandomState* state, int argCount, Value* args) {
     if (argCount != 1 || !IS_LIST(args[0])) {
-        return ERROR_VAL_PTR("shuffle() expects a single list argument.");
+        return nativeError("shuffle() expects a single list argument.");
     }
     ObjList* list = AS_LIST(args[0]);
     if (list->count <= 1) {
         return OBJ_VAL(list); // No need to shuffle
     }
+    unshareList(list);
     // Fisher-Yates shuffle
+    Value* values = list->values.values;
     for (int i = list->count - 1; i > 0; i--) {
-        int j = rand() % (i + 1);
-        // Swap elements at indices i and j
-        Value temp = list->values.values[i];
-        list->values.values[i] = list->values.values[j];
-        list->values.values[j] = temp;
+        int j = (int)nextBelow(state, (uint64_t)i + 1);
+        Value temp = values[i];
+        values[i] = values[j];
+        values[j] = temp;
     }
     return OBJ_VAL(list);
 }
@@ -152,34 +322,36 @@ static Value randomShuffleNative(int argCount, Value* args, ParamInfo* params) {
  * @param args The arguments passed to the function.
  * @return A random boolean value or an error if the arguments are invalid.
  */
-static Value randomBoolNative(int argCount, Value* args, ParamInfo* params) {
+static Value randboolWith(RandomState* state, int argCount, Value* args) {
     if (argCount != 0) {
-        return ERROR_VAL_PTR("randbool() expects no arguments.");
+        return nativeError("randbool() expects no arguments.");
     }
-    int val = rand() & 1;
-    return BOOL_VAL(val != 0);
+    return BOOL_VAL((nextRandom(state) >> 63) != 0);
 }
 
 /**
- * @brief Generates a random byte array of specified length.
+ * @brief Generates a list of random bytes of the given length.
  * @param argCount The number of arguments passed to the function.
  * @param args The arguments passed to the function.
- * @return A byte array containing random bytes or an error if the arguments are invalid.
+ * @return A list of random bytes or an error if the arguments are invalid.
  */
-static Value randomBytesNative(int argCount, Value* args, ParamInfo* params) {
+static Value randbytesWith(RandomState* state, int argCount, Value* args) {
     if (argCount != 1 || !IS_NUMBER(args[0])) {
-        return ERROR_VAL_PTR("randbytes() expects a single numeric argument.");
+        return nativeError("randbytes() expects a single numeric argument.");
     }
     int length = (int)AS_NUMBER(args[0]);
     if (length < 0) {
-        return ERROR_VAL_PTR("randbytes() length must be non-negative.");
-    }
-    ObjList* byteArray = newList();
-    while (byteArray->values.capacity < length) {
-        growValueArray(&byteArray->values);
+        return nativeError("randbytes() length must be non-negative.");
     }
+    ObjList* byteArray = newListWithCapacity(length);
+    // eight bytes from each value rather than a value per byte
+    uint64_t bits = 0;
     for (int i = 0; i < length; i++) {
-        byteArray->values.values[i] = NUMBER_VAL(rand() % 256);
+        if ((i & 7) == 0) {
+            bits = nextRandom(state);
+        }
+        byteArray->values.values[i] = NUMBER_VAL((double)(bits & 0xff));
+        bits >>= 8;
     }
     byteArray->count = length;
     byteArray->values.count = length;
@@ -192,49 +364,85 @@ static Value randomBytesNative(int argCount, Value* args, ParamInfo* params) {
  * @param args The arguments passed to the function.
  * @return A random Gaussian distributed number or an error if the arguments are invalid.
  */
-static Value randomGaussNative(int argCount, Value* args, ParamInfo* params) {
+static Value gaussWith(RandomState* state, int argCount, Value* args) {
     if (argCount != 2 || !IS_NUMBER(args[0]) || !IS_NUMBER(args[1])) {
-        return ERROR_VAL_PTR("gauss() expects two numeric arguments.");
+        return nativeError("gauss() expects two numeric arguments.");
     }
     double mu = AS_NUMBER(args[0]);
     double sigma = AS_NUMBER(args[1]);
     if (sigma <= 0) {
-        return ERROR_VAL_PTR("gauss() sigma must be positive.");
+        return nativeError("gauss() sigma must be positive.");
     }
-
-    double u1 = (double)rand() / RAND_MAX;
-    double u2 = (double)rand() / RAND_MAX;
-    double z0 = sqrt(-2.0 * log(u1)) * cos(2 * M_PI * u2);
-    return NUMBER_VAL(mu + z0 * sigma);
+    return NUMBER_VAL(nextGauss(state, mu, sigma));
 }
 
 /**
- * @brief Samples a list in place using the Fisher-Yates algorithm.
+ * @brief Picks k of a list's values at random, without picking any one twice.
  * @param argCount The number of arguments passed to the function.
  * @param args The arguments passed to the function.
- * @return The sampled list or an error if the arguments are invalid.
+ * @return A new list of the sampled values or an error if the arguments are invalid.
  */
-static Value randomSampleNative(int argCount, Value* args, ParamInfo* params) {
+static Value sampleWith(RandomState* state, int argCount, Value* args) {
     if (argCount != 2 || !IS_LIST(args[0]) || !IS_NUMBER(args[1])) {
-        return ERROR_VAL_PTR("sample() expects a list and a numeric argument.");
+        return nativeError("sample() expects a list and a numeric argument.");
     }
     ObjList* list = AS_LIST(args[0]);
     int sampleSize = (int)AS_NUMBER(args[1]);
     if (sampleSize < 0 || sampleSize > list->count) {
-        return ERROR_VAL_PTR("sample() size must be in range 0..list length.");
-    }
-    ObjList* sample = newList();
-    while (sample->values.capacity < sampleSize) {
-        growValueArray(&sample->values);
+        return nativeError("sample() size must be in range 0..list length.");
     }
+    // copy the population once and shuffle just the first k into place
+    ObjList* sample = newListWithCapacity(list->count);
+    Value* values = sample->values.values;
+    copyValues(values, list->values.values, list->count);
     for (int i = 0; i < sampleSize; i++) {
-        int index = rand() % list->count;
-        sample->values.values[i] = list->values.values[index];
-        // Remove the sampled element from the original list
-        list->values.values[index] = list->values.values[list->count - 1];
-        list->count--;
+        int j = i + (int)nextBelow(state, (uint64_t)(list->count - i));
+        Value temp = values[i];
+        values[i] = values[j];
+        values[j] = temp;
     }
     sample->count = sampleSize;
     sample->values.count = sampleSize;
     return OBJ_VAL(sample);
 }
+
+/**
+ * @brief Fills a typed array with random numbers in place.
+ *
+ * f64 arrays get numbers in [0, 1), or [min, max) if they're given. i64
+ * arrays need min and max, and get integers between them inclusive.
+ * @param argCount The number of arguments passed to the function.
+ * @param args The arguments passed to the function.
+ * @return The array or an error if the arguments are invalid.
+ */
+static Value fillWith(RandomState* state, int argCount, Value* args) {
+    if ((argCount != 1 && argCount != 3) || !IS_ARRAY(args[0])
+            || (argCount == 3 && (!IS_NUMBER(args[1]) || !IS_NUMBER(args[2])))) {
+        return nativeError("fill() expects an array, optionally with a numeric min and max.");
+    }
+    ObjArray* array = AS_ARRAY(args[0]);
+    double min = argCount == 3 ? AS_NUMBER(args[1]) : 0;
+    double max = argCount == 3 ? AS_NUMBER(args[2]) : 1;
+    if (min > max) {
+        return nativeError("fill() min must be less than or equal to max.");
+    }
+
+    if (array->type == ARRAY_F64) {
+        double* values = array->as.f64;
+        double range = max - min;
+        for (int i = 0; i < array->count; i++) {
+            values[i] = min + nextDouble(state) * range;
+        }
+    } else {
+        if (argCount != 3) {
+            return nativeError("fill() needs a min and max for an i64 array.");
+        }
+        int64_t* values = array->as.i64;
+        int64_t low = (int64_t)min;
+        uint64_t range = (uint64_t)((int64_t)max - low) + 1;
+        for (int i = 0; i < array->count; i++) {
+            values[i] = low + (int64_t)nextBelow(state, range);
+        }
+    }
+    return OBJ_VAL(array);
+}
@@ -0,0 +1,1744 @@
+/**
+ * @file thread.c
+ * @brief Implementation of the thread module.
+ *
+ * Every thread runs its own VM, so no objects are ever shared between them.
+ * Values are passed between VMs as messages: they're packed into a plain
+ * malloc'd buffer by the sender and unpacked into new objects by whoever
+ * receives them. Channels are the only thing that's actually shared, and
+ * are reference counted across the VMs holding them.
+ *
+ * A thread starts with a copy of the globals of the VM that started it, as
+ * they were when it was started, so the functions and classes it calls are
+ * there. Globals that can't be copied, such as open files, are left undefined.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "builtins/util.h"
+#include "core/bytecode.h"
+#include "core/gc.h"
+#include "core/loader.h"
+#include "core/memory.h"
+#include "core/object.h"
+#include "core/table.h"
+#include "core/value.h"
+#include "core/vm.h"
+#include "std/thread.h"
+
+// how deeply containers can be nested in a message, so packing never overflows the C stack
+#define PACK_MAX_DEPTH 256
+
+/**
+ * @enum PackTag
+ *
+ * The type of each packed value.
+ */
+typedef enum PackTag {
+    PACK_NIL,
+    PACK_FALSE,
+    PACK_TRUE,
+    PACK_NUMBER,
+    PACK_STRING,
+    PACK_LIST,
+    PACK_DICT,
+    PACK_SET,
+    PACK_ARRAY,
+    PACK_ARRAY_MOVED,
+    PACK_BYTES,
+    PACK_BYTES_MOVED,
+    PACK_CLOSURE,
+    PACK_CLASS,
+    PACK_ENUM,
+    PACK_MODULE,
+    PACK_CHANNEL,
+    PACK_INSTANCE,
+    PACK_NATIVE,
+    // an object already in the message, by its index
+    PACK_REF,
+} PackTag;
+
+/**
+ * @struct Packer
+ *
+ * The state of packing a message.
+ *
+ * Every mutable object packed is given the next index, and packing it
+ * again just refers back to that index, which keeps shared references
+ * shared and stops cycles recursing forever.
+ * The arrays and bytes being transferred only give up their buffers once
+ * everything has been packed, so a failure leaves them as they were.
+ */
+typedef struct Packer {
+    Message* message;
+    Obj** keys;
+    int* indexes;
+    int capacity;
+    int count;
+    int refCount;
+    bool transfer;
+    Obj** moved;
+    int movedCount;
+    int movedCapacity;
+    int depth;
+    char error[128];
+} Packer;
+
+/**
+ * @struct Unpacker
+ *
+ * The state of unpacking a message. refs is a list of every indexed object
+ * made so far, which also keeps them alive until the message is unpacked.
+ */
+typedef struct Unpacker {
+    Message* message;
+    size_t offset;
+    bool error;
+    ObjList* refs;
+} Unpacker;
+
+/**
+ * @struct WorkQueue
+ *
+ * The indexes of the items a parallelMap worker has left, [head, tail).
+ * The worker takes from the head and any others steal from the tail.
+ */
+typedef struct WorkQueue {
+    pthread_mutex_t lock;
+    int head;
+    int tail;
+} WorkQueue;
+
+/**
+ * @struct ParallelMap
+ *
+ * The work shared by all of a parallelMap's workers.
+ */
+typedef struct ParallelMap {
+    // the globals and the function
+    Message* setup;
+    Message** items;
+    Message** results;
+    int count;
+    WorkQueue* queues;
+    int workerCount;
+    pthread_mutex_t lock;
+    bool failed;
+    char error[256];
+} ParallelMap;
+
+/**
+ * @struct MapWorker
+ */
+typedef struct MapWorker {
+    pthread_t id;
+    ParallelMap* map;
+    int index;
+} MapWorker;
+
+static Value startNative(int argCount, Value* args, ParamInfo* params);
+static Value channelNative(int argCount, Value* args, ParamInfo* params);
+static Value parallelMapNative(int argCount, Value* args, ParamInfo* params);
+static Value cpusNative(int argCount, Value* args, ParamInfo* params);
+
+/**
+ * The thread module's functions, each one created the first time it's looked up.
+ */
+static NativeDef threadNatives[] = {
+    {"start", startNative, 1, -1, {{"function", true}}},
+    {"channel", channelNative, 0, 1, {{"capacity", false}}},
+    {"parallelMap", parallelMapNative, 2, 3, {{"list", true}, {"function", true}, {"workers", false}}},
+    {"cpus", cpusNative, 0, 0, {}},
+    {NULL}
+};
+
+/**
+ * Implementation of method to get the thread module.
+ */
+ObjModule* getThreadModule() {
+    ObjModule* module = newModule();
+    module->natives = threadNatives;
+    return module;
+}
+
+/**
+ * Method for writing raw bytes to a message.
+ *
+ * Messages are malloc'd rather than allocated by the VM as they outlive it.
+ */
+static void writeBytes(Message* message, const void* bytes, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    if (message->capacity < message->count + length) {
+        size_t capacity = message->capacity < 64 ? 64 : message->capacity;
+        while (capacity < message->count + length) {
+            capacity *= 2;
+        }
+        message->bytes = (uint8_t*)realloc(message->bytes, capacity);
+        if (message->bytes == NULL) exit(1);
+        message->capacity = capacity;
+    }
+    memcpy(message->bytes + message->count, bytes, length);
+    message->count += length;
+}
+
+/**
+ * Method for writing a tag to a message.
+ */
+static void writeTag(Message* message, uint8_t tag) {
+    writeBytes(message, &tag, 1);
+}
+
+/**
+ * Method for writing a 32-bit integer to a message.
+ */
+static void writeInt(Message* message, int32_t value) {
+    writeBytes(message, &value, sizeof(value));
+}
+
+/**
+ * Method for writing a length prefixed string to a message.
+ */
+static void writeString(Message* message, ObjString* string) {
+    writeInt(message, string->length);
+    writeBytes(message, string->chars, string->length);
+}
+
+/**
+ * Method for marking an array or bytes to have its buffer handed over, returning its index.
+ */
+static int addMoved(Packer* packer, Obj* object) {
+    if (packer->movedCapacity < packer->movedCount + 1) {
+        packer->movedCapacity = packer->movedCapacity < 4 ? 4 : packer->movedCapacity * 2;
+        packer->moved = (Obj**)realloc(packer->moved, sizeof(Obj*) * packer->movedCapacity);
+        if (packer->moved == NULL) exit(1);
+    }
+    packer->moved[packer->movedCount] = object;
+    return packer->movedCount++;
+}
+
+/**
+ * Method for handing the marked buffers over to the message.
+ */
+static void moveBuffers(Packer* packer) {
+    Message* message = packer->message;
+    if (packer->movedCount == 0) {
+        return;
+    }
+    message->owned = (void**)calloc(packer->movedCount + 1, sizeof(void*));
+    if (message->owned == NULL) exit(1);
+    message->ownedCount = packer->movedCount;
+    message->ownedCapacity = packer->movedCount + 1;
+
+    // the buffers aren't this VM's any more
+    for (int i = 0; i < packer->movedCount; i++) {
+        if (packer->moved[i]->type == OBJ_ARRAY) {
+            ObjArray* array = (ObjArray*)packer->moved[i];
+            message->owned[i] = array->as.f64;
+            vm->bytesAllocated -= sizeof(double) * array->count;
+            array->as.f64 = NULL;
+            array->count = 0;
+        } else {
+            ObjBytes* bytes = (ObjBytes*)packer->moved[i];
+            message->owned[i] = bytes->data;
+            vm->bytesAllocated -= bytes->capacity;
+            bytes->data = NULL;
+            bytes->count = 0;
+            bytes->capacity = 0;
+        }
+    }
+}
+
+/**
+ * Method for giving a message its own reference to a channel, returning its index.
+ */
+static int addChannel(Message* message, Channel* channel) {
+    if (message->channelCapacity < message->channelCount + 1) {
+        message->channelCapacity = message->channelCapacity < 4 ? 4 : message->channelCapacity * 2;
+        message->channels = (Channel**)realloc(message->channels, sizeof(Channel*) * message->channelCapacity);
+        if (message->channels == NULL) exit(1);
+    }
+    retainChannel(channel);
+    message->channels[message->channelCount] = channel;
+    return message->channelCount++;
+}
+
+/**
+ * Method for making a new, empty message.
+ */
+static Message* newMessage() {
+    Message* message = (Message*)calloc(1, sizeof(Message));
+    if (message == NULL) exit(1);
+    return message;
+}
+
+/**
+ * Implementation of method to free a message.
+ */
+void freeMessage(Message* message) {
+    if (message == NULL) {
+        return;
+    }
+    for (int i = 0; i < message->ownedCount; i++) {
+        free(message->owned[i]);
+    }
+    for (int i = 0; i < message->channelCount; i++) {
+        releaseChannel(message->channels[i]);
+    }
+    free(message->owned);
+    free(message->channels);
+    free(message->bytes);
+    free(message);
+}
+
+/**
+ * Method for finding where an object is, or would go, in the packer's index.
+ */
+static int findPacked(Packer* packer, Obj* object) {
+    uintptr_t hash = (uintptr_t)object >> 4;
+    int slot = (int)(hash & (uintptr_t)(packer->capacity - 1));
+    while (packer->keys[slot] != NULL && packer->keys[slot] != object) {
+        slot = (slot + 1) & (packer->capacity - 1);
+    }
+    return slot;
+}
+
+/**
+ * Method for checking whether an object has already been packed.
+ *
+ * If it has, a reference to it is written instead and this returns true.
+ * Otherwise it's given the next index.
+ */
+static bool packedBefore(Packer* packer, Obj* object) {
+    if (packer->capacity > 0) {
+        int slot = findPacked(packer, object);
+        if (packer->keys[slot] == object && packer->indexes[slot] >= 0) {
+            writeTag(packer->message, PACK_REF);
+            writeInt(packer->message, packer->indexes[slot]);
+            return true;
+        }
+    }
+
+    if (packer->count + 1 > packer->capacity * 3 / 4) {
+        Obj** oldKeys = packer->keys;
+        int* oldIndexes = packer->indexes;
+        int oldCapacity = packer->capacity;
+        packer->capacity = oldCapacity < 16 ? 16 : oldCapacity * 2;
+        packer->keys = (Obj**)calloc(packer->capacity, sizeof(Obj*));
+        packer->indexes = (int*)malloc(sizeof(int) * packer->capacity);
+        if (packer->keys == NULL || packer->indexes == NULL) exit(1);
+        for (int i = 0; i < oldCapacity; i++) {
+            if (oldKeys[i] != NULL) {
+                int slot = findPacked(packer, oldKeys[i]);
+                packer->keys[slot] = oldKeys[i];
+                packer->indexes[slot] = oldIndexes[i];
+            }
+        }
+        free(oldKeys);
+        free(oldIndexes);
+    }
+
+    int slot = findPacked(packer, object);
+    if (packer->keys[slot] == NULL) {
+        packer->count++;
+    }
+    packer->keys[slot] = object;
+    packer->indexes[slot] = packer->refCount++;
+    return false;
+}
+
+/**
+ * Method for forgetting the objects packed since refCount, after they've been rolled back.
+ */
+static void forgetPacked(Packer* packer, int refCount) {
+    for (int i = 0; i < packer->capacity; i++) {
+        if (packer->keys[i] != NULL && packer->indexes[i] >= refCount) {
+            packer->indexes[i] = -1;
+        }
+    }
+    packer->refCount = refCount;
+}
+
+/**
+ * Method for recording why a value couldn't be packed.
+ */
+static bool packFailed(Packer* packer, const char* message, Value value) {
+    snprintf(packer->error, sizeof(packer->error), message, valueTypeToString(value));
+    return false;
+}
+
+static bool packValue(Packer* packer, Value value);
+
+/**
+ * Method for packing the key/value pairs of a table.
+ */
+static bool packTable(Packer* packer, Table* table, bool withValues) {
+    int count = 0;
+    for (int i = 0; i < table->entryCount; i++) {
+        if (!IS_EMPTY(table->entries[i].key)) {
+            count++;
+        }
+    }
+    writeInt(packer->message, count);
+    for (int i = 0; i < table->entryCount; i++) {
+        Entry* entry = &table->entries[i];
+        if (IS_EMPTY(entry->key)) {
+            continue;
+        }
+        if (!packValue(packer, entry->key) || (withValues && !packValue(packer, entry->value))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Method for packing a closure, its function as bytecode and its captured values.
+ */
+static bool packClosure(Packer* packer, ObjClosure* closure) {
+    size_t size;
+    uint8_t* function = packFunction(closure->function, &size);
+    if (function == NULL) {
+        return packFailed(packer, "Can't send a function with constants that can't be serialised.", NIL_VAL);
+    }
+    writeInt(packer->message, (int32_t)size);
+    writeBytes(packer->message, function, size);
+    free(function);
+
+    writeInt(packer->message, closure->upvalueCount);
+    for (int i = 0; i < closure->upvalueCount; i++) {
+        // finals are captured flat and have no upvalue
+        bool isFlat = closure->upvalues[i] == NULL;
+        writeTag(packer->message, isFlat ? CAPTURE_FLAT : 0);
+        if (!packValue(packer, isFlat ? closure->captured[i] : *closure->upvalues[i]->location)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Method for packing an instance of a slo class, its fields by name in the order they were added.
+ */
+static bool packInstance(Packer* packer, ObjInstance* instance) {
+    if (!packValue(packer, OBJ_VAL(instance->sClass))) {
+        return false;
+    }
+
+    // each shape adds the next field to its parent's, so walking up finds them newest first
+    int fieldCount = instance->shape->fieldCount;
+    ObjString** names = (ObjString**)malloc(sizeof(ObjString*) * (fieldCount + 1));
+    if (names == NULL) exit(1);
+    int count = fieldCount;
+    for (Shape* shape = instance->shape; shape->parent != NULL && count > 0; shape = shape->parent) {
+        names[--count] = shape->name;
+    }
+
+    writeInt(packer->message, fieldCount);
+    bool packed = true;
+    for (int i = 0; i < fieldCount && packed; i++) {
+        writeString(packer->message, names[i]);
+        packed = packValue(packer, instance->fields[i]);
+    }
+    free(names);
+    return packed;
+}
+
+/**
+ * Method for finding a native's name, and the native module it's from, so it can be looked up again.
+ *
+ * Returns false if it isn't a builtin or a native module's function.
+ */
+static bool nativeName(Value native, ObjString** module, ObjString** name) {
+    for (int i = 0; i < vm->builtins.entryCount; i++) {
+        Entry* entry = &vm->builtins.entries[i];
+        if (IS_STRING(entry->key) && valuesEqual(entry->value, native)) {
+            *module = NULL;
+            *name = AS_STRING(entry->key);
+            return true;
+        }
+    }
+    for (int i = 0; i < vm->modules.entryCount; i++) {
+        Entry* entry = &vm->modules.entries[i];
+        if (!IS_MODULE(entry->value) || AS_MODULE(entry->value)->fromFile) {
+            continue;
+        }
+        Table* methods = &AS_MODULE(entry->value)->methods;
+        for (int j = 0; j < methods->entryCount; j++) {
+            if (IS_STRING(methods->entries[j].key) && valuesEqual(methods->entries[j].value, native)) {
+                *module = AS_MODULE(entry->value)->name;
+                *name = AS_STRING(methods->entries[j].key);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Method for packing a typed array, either copying or moving its buffer.
+ */
+static void packArray(Packer* packer, ObjArray* array) {
+    size_t size = sizeof(double) * array->count;
+    writeTag(packer->message, packer->transfer ? PACK_ARRAY_MOVED : PACK_ARRAY);
+    writeTag(packer->message, (uint8_t)array->type);
+    writeInt(packer->message, array->count);
+    if (!packer->transfer) {
+        writeBytes(packer->message, array->as.f64, size);
+        return;
+    }
+
+    writeInt(packer->message, addMoved(packer, (Obj*)array));
+}
+
+/**
+ * Method for packing bytes, either copying or moving its buffer.
+ */
+static void packBytes(Packer* packer, ObjBytes* bytes) {
+    writeTag(packer->message, packer->transfer ? PACK_BYTES_MOVED : PACK_BYTES);
+    writeInt(packer->message, bytes->count);
+    if (!packer->transfer) {
+        writeBytes(packer->message, bytes->data, bytes->count);
+        return;
+    }
+
+    writeInt(packer->message, bytes->capacity);
+    writeInt(packer->message, addMoved(packer, (Obj*)bytes));
+}
+
+/**
+ * Method for packing an object.
+ */
+static bool packObject(Packer* packer, Value value) {
+    Message* message = packer->message;
+    Obj* object = AS_OBJ(value);
+
+    // strings are immutable so they're just copied each time
+    if (object->type == OBJ_STRING) {
+        writeTag(message, PACK_STRING);
+        writeTag(message, AS_STRING(value)->interned);
+        writeString(message, AS_STRING(value));
+        return true;
+    }
+    if (object->type == OBJ_CHANNEL) {
+        writeTag(message, PACK_CHANNEL);
+        writeInt(message, addChannel(message, AS_CHANNEL(value)->channel));
+        return true;
+    }
+    if (object->type == OBJ_MODULE) {
+        ObjModule* module = AS_MODULE(value);
+        writeTag(message, PACK_MODULE);
+        writeString(message, module->name);
+        writeTag(message, module->fromFile);
+        return true;
+    }
+    if (object->type == OBJ_NATIVE) {
+        // the receiving VM has its own, so it's looked up again by name
+        ObjString* module;
+        ObjString* name;
+        if (!nativeName(value, &module, &name)) {
+            return packFailed(packer, "Can't send a native function that isn't a builtin or from a native module.", value);
+        }
+        writeTag(message, PACK_NATIVE);
+        writeTag(message, module != NULL);
+        if (module != NULL) {
+            writeString(message, module);
+        }
+        writeString(message, name);
+        return true;
+    }
+
+    switch (object->type) {
+        case OBJ_LIST:
+        case OBJ_DICT:
+        case OBJ_SET:
+        case OBJ_ARRAY:
+        case OBJ_BYTES:
+        case OBJ_CLOSURE:
+        case OBJ_ENUM:
+            break;
+        case OBJ_INSTANCE:
+            if (AS_INSTANCE(value)->sClass->natives == NULL) {
+                break;
+            }
+            // fall through
+        case OBJ_CLASS:
+            // the builtin types' classes belong to their VM
+            if (AS_CLASS(value)->natives == NULL) {
+                break;
+            }
+            // fall through
+        default:
+            return packFailed(packer, "Can't send %s values between threads.", value);
+    }
+
+    if (packedBefore(packer, object)) {
+        return true;
+    }
+
+    switch (object->type) {
+        case OBJ_LIST: {
+            ObjList* list = AS_LIST(value);
+            writeTag(message, PACK_LIST);
+            writeInt(message, list->values.count);
+            for (int i = 0; i < list->values.count; i++) {
+                if (!packValue(packer, list->values.values[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case OBJ_DICT:
+            writeTag(message, PACK_DICT);
+            return packTable(packer, &AS_DICT(value)->data, true);
+        case OBJ_SET:
+            writeTag(message, PACK_SET);
+            return packTable(packer, &AS_SET(value)->data, false);
+        case OBJ_ARRAY:
+            packArray(packer, AS_ARRAY(value));
+            return true;
+        case OBJ_BYTES:
+            packBytes(packer, AS_BYTES(value));
+            return true;
+        case OBJ_CLOSURE:
+            writeTag(message, PACK_CLOSURE);
+            return packClosure(packer, AS_CLOSURE(value));
+        case OBJ_ENUM: {
+            ObjEnum* sEnum = AS_ENUM(value);
+            writeTag(message, PACK_ENUM);
+            writeString(message, sEnum->name);
+            return packTable(packer, &sEnum->values, true);
+        }
+        case OBJ_CLASS: {
+            ObjClass* sClass = AS_CLASS(value);
+            writeTag(message, PACK_CLASS);
+            writeString(message, sClass->name);
+            Value superclass = sClass->superclass == NULL ? NIL_VAL : OBJ_VAL(sClass->superclass);
+            return packValue(packer, superclass) && packTable(packer, &sClass->methods, true);
+        }
+        case OBJ_INSTANCE:
+            writeTag(message, PACK_INSTANCE);
+            return packInstance(packer, AS_INSTANCE(value));
+        default:
+            return false;
+    }
+}
+
+/**
+ * Method for packing a value.
+ */
+static bool packValue(Packer* packer, Value value) {
+    if (IS_NIL(value)) {
+        writeTag(packer->message, PACK_NIL);
+        return true;
+    }
+    if (IS_BOOL(value)) {
+        writeTag(packer->message, AS_BOOL(value) ? PACK_TRUE : PACK_FALSE);
+        return true;
+    }
+    if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        writeTag(packer->message, PACK_NUMBER);
+        writeBytes(packer->message, &number, sizeof(number));
+        return true;
+    }
+    if (!IS_OBJ(value)) {
+        return packFailed(packer, "Can't send %s values between threads.", value);
+    }
+
+    if (packer->depth >= PACK_MAX_DEPTH) {
+        return packFailed(packer, "Value is nested too deeply to send between threads.", value);
+    }
+    packer->depth++;
+    bool packed = packObject(packer, value);
+    packer->depth--;
+    return packed;
+}
+
+/**
+ * Method for starting to pack a message.
+ */
+static void initPacker(Packer* packer, bool transfer) {
+    packer->message = newMessage();
+    packer->keys = NULL;
+    packer->indexes = NULL;
+    packer->capacity = 0;
+    packer->count = 0;
+    packer->refCount = 0;
+    packer->transfer = transfer;
+    packer->moved = NULL;
+    packer->movedCount = 0;
+    packer->movedCapacity = 0;
+    packer->depth = 0;
+    packer->error[0] = '\0';
+}
+
+/**
+ * Method for finishing packing a message, returning it or NULL if it failed.
+ */
+static Message* finishPacker(Packer* packer, bool packed, Value* error) {
+    free(packer->keys);
+    free(packer->indexes);
+    if (packed) {
+        moveBuffers(packer);
+    }
+    free(packer->moved);
+    if (!packed) {
+        *error = ERROR_VAL_PTR(packer->error);
+        freeMessage(packer->message);
+        return NULL;
+    }
+    return packer->message;
+}
+
+/**
+ * Implementation of method to pack a value into a new message.
+ */
+Message* packMessage(Value value, bool transfer, Value* error) {
+    Packer packer;
+    initPacker(&packer, transfer);
+    bool packed = packValue(&packer, value);
+    return finishPacker(&packer, packed, error);
+}
+
+/**
+ * Method for checking whether a global still holds the builtin it was given.
+ */
+static bool isBuiltin(Value name, Value value) {
+    Value builtin;
+    return IS_NATIVE(value) && tableGet(&vm->builtins, name, &builtin) && valuesEqual(builtin, value);
+}
+
+/**
+ * Implementation of method to pack the globals, followed by a value.
+ *
+ * Every global's name is written first so the new VM can give them all
+ * slots before any functions refer to them. Then each value that can be
+ * packed is written with its slot, any that can't are rolled back and
+ * skipped. Builtins are skipped as the new VM has its own.
+ */
+Message* packWithGlobals(Value entry, bool warn, Value* error) {
+    Packer packer;
+    initPacker(&packer, false);
+    Message* message = packer.message;
+
+    int globalCount = vm->globalNames.count;
+    writeInt(message, globalCount);
+    for (int slot = 0; slot < globalCount; slot++) {
+        writeString(message, AS_STRING(vm->globalNames.values[slot]));
+        writeTag(message, AS_BOOL(vm->globalFinals.values[slot]));
+    }
+
+    for (int slot = 0; slot < globalCount; slot++) {
+        Value value = vm->globalValues.values[slot];
+        if (IS_EMPTY(value) || isBuiltin(vm->globalNames.values[slot], value)) {
+            continue;
+        }
+        size_t offset = message->count;
+        int refCount = packer.refCount;
+        writeInt(message, slot);
+        if (!packValue(&packer, value)) {
+            message->count = offset;
+            forgetPacked(&packer, refCount);
+            packer.depth = 0;
+            // channels referenced by what was rolled back stay with the message until it's freed
+            if (warn) {
+                fprintf(stderr, "Global '%s' can't be copied, so it's left out.\n", AS_CSTRING(vm->globalNames.values[slot]));
+            }
+        }
+    }
+    writeInt(message, -1);
+
+    bool packed = packValue(&packer, entry);
+    return finishPacker(&packer, packed, error);
+}
+
+/**
+ * Method for reading raw bytes from a message.
+ */
+static const uint8_t* readBytes(Unpacker* unpacker, size_t length) {
+    if (unpacker->error || unpacker->offset + length > unpacker->message->count) {
+        unpacker->error = true;
+        return NULL;
+    }
+    const uint8_t* bytes = unpacker->message->bytes + unpacker->offset;
+    unpacker->offset += length;
+    return bytes;
+}
+
+/**
+ * Method for reading a tag from a message.
+ */
+static uint8_t readTag(Unpacker* unpacker) {
+    const uint8_t* tag = readBytes(unpacker, 1);
+    return tag == NULL ? 0 : *tag;
+}
+
+/**
+ * Method for reading a 32-bit integer from a message.
+ */
+static int32_t readInt(Unpacker* unpacker) {
+    int32_t value = 0;
+    const uint8_t* bytes = readBytes(unpacker, sizeof(value));
+    if (bytes != NULL) {
+        memcpy(&value, bytes, sizeof(value));
+    }
+    return value;
+}
+
+/**
+ * Method for reading a count, which can't be negative.
+ */
+static int readCount(Unpacker* unpacker) {
+    int32_t count = readInt(unpacker);
+    if (count < 0) {
+        unpacker->error = true;
+        return 0;
+    }
+    return count;
+}
+
+/**
+ * Method for reading a string from a message.
+ */
+static ObjString* readString(Unpacker* unpacker) {
+    int length = readCount(unpacker);
+    const uint8_t* chars = readBytes(unpacker, length);
+    if (chars == NULL) {
+        return NULL;
+    }
+    return copyString((const char*)chars, length);
+}
+
+/**
+ * Method for taking a buffer a message owns.
+ */
+static void* takeOwned(Unpacker* unpacker) {
+    int index = readInt(unpacker);
+    Message* message = unpacker->message;
+    if (unpacker->error || index < 0 || index >= message->ownedCount) {
+        unpacker->error = true;
+        return NULL;
+    }
+    void* pointer = message->owned[index];
+    message->owned[index] = NULL;
+    return pointer;
+}
+
+/**
+ * Method for saving a place for the next indexed object, returning its index.
+ */
+static int reserveRef(Unpacker* unpacker) {
+    ObjList* refs = unpacker->refs;
+    writeValueArray(&refs->values, NIL_VAL);
+    refs->count = refs->values.count;
+    return refs->values.count - 1;
+}
+
+/**
+ * Method for filling in an indexed object.
+ */
+static void setRef(Unpacker* unpacker, int index, Value value) {
+    unpacker->refs->values.values[index] = value;
+    writeBarrier((Obj*)unpacker->refs, value);
+}
+
+static bool unpackValue(Unpacker* unpacker);
+
+/**
+ * Method for unpacking a list, which is left on the stack.
+ */
+static bool unpackList(Unpacker* unpacker) {
+    int index = reserveRef(unpacker);
+    int count = readCount(unpacker);
+    ObjList* list = newList();
+    push(OBJ_VAL(list));
+    setRef(unpacker, index, OBJ_VAL(list));
+    for (int i = 0; i < count && !unpacker->error; i++) {
+        if (!unpackValue(unpacker)) {
+            return false;
+        }
+        Value value = vm->stackTop[-1];
+        writeValueArray(&list->values, value);
+        list->count = list->values.count;
+        writeBarrier((Obj*)list, value);
+        pop();
+    }
+    return !unpacker->error;
+}
+
+/**
+ * Method for unpacking key/value pairs into a table belonging to the object on top of the stack.
+ */
+static bool unpackTable(Unpacker* unpacker, Table* table, bool withValues) {
+    Obj* owner = AS_OBJ(vm->stackTop[-1]);
+    int count = readCount(unpacker);
+    for (int i = 0; i < count && !unpacker->error; i++) {
+        if (!unpackValue(unpacker)) {
+            return false;
+        }
+        Value key = vm->stackTop[-1];
+        Value value = BOOL_VAL(true);
+        if (withValues) {
+            if (!unpackValue(unpacker)) {
+                return false;
+            }
+            value = vm->stackTop[-1];
+        }
+        tableSet(table, key, value);
+        writeBarrier(owner, key);
+        writeBarrier(owner, value);
+        vm->stackTop -= withValues ? 2 : 1;
+    }
+    return !unpacker->error;
+}
+
+/**
+ * Method for unpacking a closure, which is left on the stack.
+ */
+static bool unpackClosure(Unpacker* unpacker) {
+    int index = reserveRef(unpacker);
+    int size = readCount(unpacker);
+    const uint8_t* bytes = readBytes(unpacker, size);
+    ObjFunction* function = bytes == NULL ? NULL : unpackFunction(bytes, size);
+    if (function == NULL) {
+        unpacker->error = true;
+        return false;
+    }
+
+    push(OBJ_VAL(function));
+    ObjClosure* closure = newClosure(function);
+    pop();
+    push(OBJ_VAL(closure));
+    setRef(unpacker, index, OBJ_VAL(closure));
+
+    int upvalueCount = readCount(unpacker);
+    if (upvalueCount != closure->upvalueCount) {
+        unpacker->error = true;
+        return false;
+    }
+    for (int i = 0; i < upvalueCount; i++) {
+        uint8_t flags = readTag(unpacker);
+        if (!unpackValue(unpacker)) {
+            return false;
+        }
+        if (flags & CAPTURE_FLAT) {
+            if (closure->captured == NULL) {
+                closure->captured = ALLOCATE(Value, upvalueCount);
+                for (int j = 0; j < upvalueCount; j++) {
+                    closure->captured[j] = NIL_VAL;
+                }
+            }
+            closure->captured[i] = pop();
+            writeBarrier((Obj*)closure, closure->captured[i]);
+            continue;
+        }
+        // captured variables are copied, so each thread has its own
+        ObjUpvalue* upvalue = newUpvalue(NULL);
+        upvalue->closed = pop();
+        upvalue->location = &upvalue->closed;
+        closure->upvalues[i] = upvalue;
+        writeBarrier((Obj*)upvalue, upvalue->closed);
+        writeBarrier((Obj*)closure, OBJ_VAL(upvalue));
+    }
+    return true;
+}
+
+/**
+ * Method for unpacking a class, which is left on the stack.
+ */
+static bool unpackClass(Unpacker* unpacker) {
+    int index = reserveRef(unpacker);
+    ObjString* name = readString(unpacker);
+    if (name == NULL) {
+        return false;
+    }
+    push(OBJ_VAL(name));
+    if (!unpackValue(unpacker)) {
+        return false;
+    }
+    Value superclass = vm->stackTop[-1];
+    if (!IS_NIL(superclass) && !IS_CLASS(superclass)) {
+        unpacker->error = true;
+        return false;
+    }
+
+    ObjClass* sClass = newClass(name, IS_NIL(superclass) ? NULL : AS_CLASS(superclass));
+    vm->stackTop -= 2;
+    push(OBJ_VAL(sClass));
+    setRef(unpacker, index, OBJ_VAL(sClass));
+    return unpackTable(unpacker, &sClass->methods, true);
+}
+
+/**
+ * Method for unpacking a typed array, which is left on the stack.
+ */
+static bool unpackArray(Unpacker* unpacker, bool moved) {
+    int index = reserveRef(unpacker);
+    uint8_t type = readTag(unpacker);
+    int count = readCount(unpacker);
+    if (unpacker->error || (type != ARRAY_F64 && type != ARRAY_I64)) {
+        unpacker->error = true;
+        return false;
+    }
+
+    size_t size = sizeof(double) * count;
+    ObjArray* array;
+    if (moved) {
+        void* buffer = takeOwned(unpacker);
+        if (unpacker->error) {
+            return false;
+        }
+        array = newArray((ArrayType)type, 0);
+        array->as.f64 = (double*)buffer;
+        array->count = count;
+        vm->bytesAllocated += size;
+    } else {
+        const uint8_t* bytes = readBytes(unpacker, size);
+        if (bytes == NULL) {
+            return false;
+        }
+        array = newArray((ArrayType)type, count);
+        if (size > 0) {
+            memcpy(array->as.f64, bytes, size);
+        }
+    }
+    push(OBJ_VAL(array));
+    setRef(unpacker, index, OBJ_VAL(array));
+    return true;
+}
+
+/**
+ * Method for unpacking bytes, which is left on the stack.
+ */
+static bool unpackBytes(Unpacker* unpacker, bool moved) {
+    int index = reserveRef(unpacker);
+    int count = readCount(unpacker);
+    ObjBytes* bytes;
+    if (moved) {
+        int capacity = readCount(unpacker);
+        void* buffer = takeOwned(unpacker);
+        if (unpacker->error || capacity < count) {
+            unpacker->error = true;
+            return false;
+        }
+        bytes = newBytes(0);
+        bytes->data = (uint8_t*)buffer;
+        bytes->count = count;
+        bytes->capacity = capacity;
+        vm->bytesAllocated += capacity;
+    } else {
+        const uint8_t* data = readBytes(unpacker, count);
+        if (data == NULL) {
+            return false;
+        }
+        bytes = newBytes(count);
+        if (count > 0) {
+            memcpy(bytes->data, data, count);
+        }
+    }
+    push(OBJ_VAL(bytes));
+    setRef(unpacker, index, OBJ_VAL(bytes));
+    return true;
+}
+
+/**
+ * Method for unpacking a module, importing it if this VM hasn't yet.
+ */
+static bool unpackModule(Unpacker* unpacker) {
+    ObjString* name = readString(unpacker);
+    bool fromFile = readTag(unpacker);
+    if (name == NULL) {
+        return false;
+    }
+    push(OBJ_VAL(name));
+    ObjModule* module = fromFile ? adoptFileModule(name) : loadModule(name, NULL);
+    pop();
+    if (module == NULL) {
+        unpacker->error = true;
+        return false;
+    }
+    push(OBJ_VAL(module));
+    return true;
+}
+
+/**
+ * Method for unpacking an instance, which is left on the stack.
+ *
+ * Its fields are added in the order they were packed in, so it ends up with the same shape.
+ */
+static bool unpackInstance(Unpacker* unpacker) {
+    int index = reserveRef(unpacker);
+    if (!unpackValue(unpacker)) {
+        return false;
+    }
+    Value sClass = vm->stackTop[-1];
+    if (!IS_CLASS(sClass)) {
+        unpacker->error = true;
+        return false;
+    }
+    ObjInstance* instance = newInstance(AS_CLASS(sClass));
+    pop();
+    push(OBJ_VAL(instance));
+    setRef(unpacker, index, OBJ_VAL(instance));
+
+    int fieldCount = readCount(unpacker);
+    for (int i = 0; i < fieldCount && !unpacker->error; i++) {
+        ObjString* name = readString(unpacker);
+        if (name == NULL) {
+            return false;
+        }
+        push(OBJ_VAL(name));
+        if (!unpackValue(unpacker)) {
+            return false;
+        }
+        instanceSetField(instance, name, vm->stackTop[-1]);
+        vm->stackTop -= 2;
+    }
+    return !unpacker->error;
+}
+
+/**
+ * Method for unpacking a native, looking it up by name in this VM.
+ */
+static bool unpackNative(Unpacker* unpacker) {
+    bool fromModule = readTag(unpacker);
+    ObjString* moduleName = fromModule ? readString(unpacker) : NULL;
+    if (fromModule && moduleName == NULL) {
+        return false;
+    }
+    if (moduleName != NULL) {
+        push(OBJ_VAL(moduleName));
+    }
+    ObjString* name = readString(unpacker);
+    if (name == NULL) {
+        return false;
+    }
+    push(OBJ_VAL(name));
+
+    Value native;
+    bool found;
+    if (moduleName == NULL) {
+        found = tableGet(&vm->builtins, OBJ_VAL(name), &native);
+    } else {
+        ObjModule* module = loadModule(moduleName, NULL);
+        found = module != NULL && !module->fromFile
+            && lookupNative((Obj*)module, &module->methods, module->natives, name, &native);
+    }
+    vm->stackTop -= moduleName != NULL ? 2 : 1;
+    if (!found) {
+        unpacker->error = true;
+        return false;
+    }
+    push(native);
+    return true;
+}
+
+/**
+ * Method for unpacking a value, which is left on the stack.
+ */
+static bool unpackValue(Unpacker* unpacker) {
+    uint8_t tag = readTag(unpacker);
+    if (unpacker->error) {
+        return false;
+    }
+
+    switch (tag) {
+        case PACK_NIL:
+            push(NIL_VAL);
+            return true;
+        case PACK_FALSE:
+            push(BOOL_VAL(false));
+            return true;
+        case PACK_TRUE:
+            push(BOOL_VAL(true));
+            return true;
+        case PACK_NUMBER: {
+            double number;
+            const uint8_t* bytes = readBytes(unpacker, sizeof(number));
+            if (bytes == NULL) {
+                return false;
+            }
+            memcpy(&number, bytes, sizeof(number));
+            push(NUMBER_VAL(number));
+            return true;
+        }
+        case PACK_STRING: {
+            bool interned = readTag(unpacker);
+            int length = readCount(unpacker);
+            const uint8_t* chars = readBytes(unpacker, length);
+            if (chars == NULL) {
+                return false;
+            }
+            ObjString* string = interned ? copyString((const char*)chars, length)
+                : copyRuntimeString((const char*)chars, length);
+            push(OBJ_VAL(string));
+            return true;
+        }
+        case PACK_LIST:
+            return unpackList(unpacker);
+        case PACK_DICT: {
+            int index = reserveRef(unpacker);
+            ObjDict* dict = newDict();
+            push(OBJ_VAL(dict));
+            setRef(unpacker, index, OBJ_VAL(dict));
+            return unpackTable(unpacker, &dict->data, true);
+        }
+        case PACK_SET: {
+            int index = reserveRef(unpacker);
+            ObjSet* set = newSet();
+            push(OBJ_VAL(set));
+            setRef(unpacker, index, OBJ_VAL(set));
+            return unpackTable(unpacker, &set->data, false);
+        }
+        case PACK_ARRAY:
+        case PACK_ARRAY_MOVED:
+            return unpackArray(unpacker, tag == PACK_ARRAY_MOVED);
+        case PACK_BYTES:
+        case PACK_BYTES_MOVED:
+            return unpackBytes(unpacker, tag == PACK_BYTES_MOVED);
+        case PACK_CLOSURE:
+            return unpackClosure(unpacker);
+        case PACK_CLASS:
+            return unpackClass(unpacker);
+        case PACK_ENUM: {
+            int index = reserveRef(unpacker);
+            ObjString* name = readString(unpacker);
+            if (name == NULL) {
+                return false;
+            }
+            push(OBJ_VAL(name));
+            ObjEnum* sEnum = newEnum(name);
+            pop();
+            push(OBJ_VAL(sEnum));
+            setRef(unpacker, index, OBJ_VAL(sEnum));
+            return unpackTable(unpacker, &sEnum->values, true);
+        }
+        case PACK_MODULE:
+            return unpackModule(unpacker);
+        case PACK_INSTANCE:
+            return unpackInstance(unpacker);
+        case PACK_NATIVE:
+            return unpackNative(unpacker);
+        case PACK_CHANNEL: {
+            int index = readInt(unpacker);
+            if (unpacker->error || index < 0 || index >= unpacker->message->channelCount) {
+                unpacker->error = true;
+                return false;
+            }
+            push(OBJ_VAL(newChannel(unpacker->message->channels[index])));
+            return true;
+        }
+        case PACK_REF: {
+            int index = readInt(unpacker);
+            if (unpacker->error || index < 0 || index >= unpacker->refs->values.count) {
+                unpacker->error = true;
+                return false;
+            }
+            push(unpacker->refs->values.values[index]);
+            return true;
+        }
+        default:
+            unpacker->error = true;
+            return false;
+    }
+}
+
+/**
+ * Method for unpacking a message's globals into this VM's.
+ */
+static bool unpackGlobals(Unpacker* unpacker) {
+    int globalCount = readCount(unpacker);
+    if (unpacker->error) {
+        return false;
+    }
+
+    int* slots = (int*)malloc(sizeof(int) * (globalCount + 1));
+    if (slots == NULL) exit(1);
+    for (int i = 0; i < globalCount && !unpacker->error; i++) {
+        ObjString* name = readString(unpacker);
+        bool final = readTag(unpacker);
+        if (name != NULL) {
+            slots[i] = globalSlot(name);
+            vm->globalFinals.values[slots[i]] = BOOL_VAL(final);
+        }
+    }
+
+    while (!unpacker->error) {
+        int index = readInt(unpacker);
+        if (index == -1) {
+            break;
+        }
+        if (index < 0 || index >= globalCount || !unpackValue(unpacker)) {
+            unpacker->error = true;
+            break;
+        }
+        vm->globalValues.values[slots[index]] = pop();
+    }
+
+    free(slots);
+    return !unpacker->error;
+}
+
+/**
+ * Method for unpacking a message, optionally starting with globals.
+ */
+static Value unpackInto(Message* message, bool withGlobals) {
+    Unpacker unpacker = {message, 0, false, NULL};
+    unpacker.refs = newList();
+    push(OBJ_VAL(unpacker.refs));
+
+    Value* stackTop = vm->stackTop;
+    bool unpacked = (!withGlobals || unpackGlobals(&unpacker)) && unpackValue(&unpacker);
+    Value value = unpacked ? vm->stackTop[-1] : NIL_VAL;
+    vm->stackTop = stackTop;
+    pop();
+
+    if (!unpacked || unpacker.offset != message->count) {
+        return nativeError("Couldn't unpack a value sent from another thread.");
+    }
+    return value;
+}
+
+/**
+ * Implementation of method to unpack a message into the current VM.
+ */
+Value unpackMessage(Message* message) {
+    return unpackInto(message, false);
+}
+
+/**
+ * Implementation of method to unpack a message made by packWithGlobals into the current VM.
+ */
+Value unpackWithGlobals(Message* message) {
+    return unpackInto(message, true);
+}
+
+/**
+ * Implementation of method to take a reference to a channel.
+ */
+void retainChannel(Channel* channel) {
+    pthread_mutex_lock(&channel->lock);
+    channel->refs++;
+    pthread_mutex_unlock(&channel->lock);
+}
+
+/**
+ * Implementation of method to drop a reference to a channel.
+ */
+void releaseChannel(Channel* channel) {
+    pthread_mutex_lock(&channel->lock);
+    bool last = --channel->refs == 0;
+    pthread_mutex_unlock(&channel->lock);
+    if (!last) {
+        return;
+    }
+
+    while (channel->head != NULL) {
+        Message* message = channel->head;
+        channel->head = message->next;
+        freeMessage(message);
+    }
+    pthread_mutex_destroy(&channel->lock);
+    pthread_cond_destroy(&channel->changed);
+    free(channel);
+}
+
+/**
+ * Method for dropping a reference to a thread handle, freeing it after the last one.
+ */
+static void dropHandle(ThreadHandle* handle) {
+    pthread_mutex_lock(&handle->lock);
+    bool last = --handle->refs == 0;
+    pthread_mutex_unlock(&handle->lock);
+    if (!last) {
+        return;
+    }
+
+    freeMessage(handle->start);
+    freeMessage(handle->result);
+    pthread_mutex_destroy(&handle->lock);
+    pthread_cond_destroy(&handle->finished);
+    free(handle);
+}
+
+/**
+ * Implementation of method to drop the ObjThread's reference to a thread.
+ */
+void releaseThread(ThreadHandle* handle) {
+    if (!handle->joined) {
+        pthread_detach(handle->id);
+    }
+    dropHandle(handle);
+}
+
+/**
+ * Method for copying an error value's message into a buffer.
+ */
+static void copyError(char* buffer, size_t size, Value error) {
+    snprintf(buffer, size, "%s", errorMessage(error));
+}
+
+/**
+ * Method for running a started thread in its own VM.
+ */
+static void* runThread(void* argument) {
+    ThreadHandle* handle = (ThreadHandle*)argument;
+    VM* instance = (VM*)malloc(sizeof(VM));
+    if (instance == NULL) exit(1);
+    initVM(instance);
+
+    Message* result = NULL;
+    bool failed = true;
+    char error[256] = "";
+
+    Value entry = unpackWithGlobals(handle->start);
+    freeMessage(handle->start);
+    handle->start = NULL;
+
+    if (IS_ERROR(entry)) {
+        copyError(error, sizeof(error), entry);
+    } else {
+        ObjList* call = AS_LIST(entry);
+        push(entry);
+        Value value;
+        if (!callFunction(call->values.values[0], call->values.count - 1, call->values.values + 1, &value)) {
+            snprintf(error, sizeof(error), "The thread stopped with an error.");
+        } else {
+            Value packError;
+            push(value);
+            result = packMessage(value, false, &packError);
+            pop();
+            if (result == NULL) {
+                copyError(error, sizeof(error), packError);
+            } else {
+                failed = false;
+            }
+        }
+        pop();
+    }
+
+    freeVM();
+    free(instance);
+
+    pthread_mutex_lock(&handle->lock);
+    handle->result = result;
+    handle->failed = failed;
+    memcpy(handle->error, error, sizeof(error));
+    handle->done = true;
+    pthread_cond_broadcast(&handle->finished);
+    pthread_mutex_unlock(&handle->lock);
+    dropHandle(handle);
+    return NULL;
+}
+
+/**
+ * start native function.
+ *
+ * Starts a function running on a new thread with the given arguments,
+ * which are copied into the thread's VM along with the globals.
+ */
+static Value startNative(int argCount, Value* args, ParamInfo* params) {
+    if (!IS_CLOSURE(args[0])) {
+        return nativeError("start() expects a function.");
+    }
+    if (argCount - 1 != AS_CLOSURE(args[0])->function->arity) {
+        return nativeError("start() must be given as many arguments as the function takes.");
+    }
+
+    ObjList* call = newList();
+    push(OBJ_VAL(call));
+    for (int i = 0; i < argCount; i++) {
+        writeValueArray(&call->values, args[i]);
+    }
+    call->count = call->values.count;
+
+    Value error;
+    Message* start = packWithGlobals(OBJ_VAL(call), false, &error);
+    pop();
+    if (start == NULL) {
+        return error;
+    }
+
+    ThreadHandle* handle = (ThreadHandle*)calloc(1, sizeof(ThreadHandle));
+    if (handle == NULL) exit(1);
+    pthread_mutex_init(&handle->lock, NULL);
+    pthread_cond_init(&handle->finished, NULL);
+    handle->start = start;
+    // one for the ObjThread and one for the thread itself
+    handle->refs = 2;
+
+    ObjThread* thread = newThread(handle);
+    if (pthread_create(&handle->id, NULL, runThread, handle) != 0) {
+        // nothing will run it, so it's as good as joined
+        handle->joined = true;
+        handle->refs = 1;
+        return nativeError("Couldn't start a thread.");
+    }
+    return OBJ_VAL(thread);
+}
+
+/**
+ * channel native function.
+ *
+ * Makes a new channel. With a capacity, sending waits while that many
+ * values are waiting to be received.
+ */
+static Value channelNative(int argCount, Value* args, ParamInfo* params) {
+    int capacity = 0;
+    if (argCount == 1) {
+        if (!IS_NUMBER(args[0]) || AS_NUMBER(args[0]) < 0) {
+            return nativeError("channel() expects a capacity that's a positive number.");
+        }
+        capacity = (int)AS_NUMBER(args[0]);
+    }
+
+    Channel* channel = (Channel*)calloc(1, sizeof(Channel));
+    if (channel == NULL) exit(1);
+    pthread_mutex_init(&channel->lock, NULL);
+    pthread_cond_init(&channel->changed, NULL);
+    channel->capacity = capacity;
+    return OBJ_VAL(newChannel(channel));
+}
+
+/**
+ * Method for getting the index of the next item a parallelMap worker should do.
+ *
+ * Takes from the front of the worker's own queue, and once that's empty
+ * steals from the back of the others'. Returns -1 when there's nothing left.
+ */
+static int nextItem(ParallelMap* map, int worker) {
+    for (int i = 0; i < map->workerCount; i++) {
+        WorkQueue* queue = &map->queues[(worker + i) % map->workerCount];
+        int item = -1;
+        pthread_mutex_lock(&queue->lock);
+        if (queue->head < queue->tail) {
+            item = i == 0 ? queue->head++ : --queue->tail;
+        }
+        pthread_mutex_unlock(&queue->lock);
+        if (item != -1) {
+            return item;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Method for stopping a parallelMap after a worker fails, keeping the first error.
+ */
+static void failMap(ParallelMap* map, const char* error) {
+    pthread_mutex_lock(&map->lock);
+    if (!map->failed) {
+        map->failed = true;
+        snprintf(map->error, sizeof(map->error), "%s", error);
+    }
+    pthread_mutex_unlock(&map->lock);
+}
+
+/**
+ * Method for checking whether a parallelMap has failed.
+ */
+static bool mapFailed(ParallelMap* map) {
+    pthread_mutex_lock(&map->lock);
+    bool failed = map->failed;
+    pthread_mutex_unlock(&map->lock);
+    return failed;
+}
+
+/**
+ * Method for running a parallelMap worker in its own VM.
+ */
+static void* runMapWorker(void* argument) {
+    MapWorker* worker = (MapWorker*)argument;
+    ParallelMap* map = worker->map;
+    VM* instance = (VM*)malloc(sizeof(VM));
+    if (instance == NULL) exit(1);
+    initVM(instance);
+
+    char error[256];
+    Value function = unpackWithGlobals(map->setup);
+    if (IS_ERROR(function)) {
+        copyError(error, sizeof(error), function);
+        failMap(map, error);
+    } else {
+        push(function);
+        for (int item = nextItem(map, worker->index); item != -1 && !mapFailed(map);
+                item = nextItem(map, worker->index)) {
+            Value value = unpackMessage(map->items[item]);
+            Value result;
+            if (IS_ERROR(value)) {
+                copyError(error, sizeof(error), value);
+                failMap(map, error);
+                break;
+            }
+            if (!callFunction(function, 1, &value, &result)) {
+                failMap(map, "parallelMap() stopped as the function raised an error.");
+                break;
+            }
+
+            Value packError;
+            push(result);
+            map->results[item] = packMessage(result, false, &packError);
+            pop();
+            if (map->results[item] == NULL) {
+                copyError(error, sizeof(error), packError);
+                failMap(map, error);
+                break;
+            }
+        }
+        pop();
+    }
+
+    freeVM();
+    free(instance);
+    return NULL;
+}
+
+/**
+ * Method for freeing a parallelMap's shared state.
+ */
+static void freeMap(ParallelMap* map) {
+    freeMessage(map->setup);
+    for (int i = 0; i < map->count; i++) {
+        if (map->items != NULL) {
+            freeMessage(map->items[i]);
+        }
+        if (map->results != NULL) {
+            freeMessage(map->results[i]);
+        }
+    }
+    for (int i = 0; map->queues != NULL && i < map->workerCount; i++) {
+        pthread_mutex_destroy(&map->queues[i].lock);
+    }
+    pthread_mutex_destroy(&map->lock);
+    free(map->items);
+    free(map->results);
+    free(map->queues);
+}
+
+/**
+ * Method for getting how many CPUs are online.
+ */
+static int cpuCount() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus < 1 ? 1 : (int)cpus;
+}
+
+/**
+ * parallelMap native function.
+ *
+ * Calls a function on every item of a list across a number of worker
+ * threads, one for each CPU by default, and returns the results in order.
+ * Each worker starts with a contiguous share of the items and steals from
+ * the others once it's through its own, so uneven items still balance out.
+ */
+static Value parallelMapNative(int argCount, Value* args, ParamInfo* params) {
+    if (!IS_LIST(args[0])) {
+        return nativeError("parallelMap() expects a list.");
+    }
+    if (!IS_CLOSURE(args[1]) || AS_CLOSURE(args[1])->function->arity != 1) {
+        return nativeError("parallelMap() expects a function that takes one argument.");
+    }
+    int workerCount = cpuCount();
+    if (argCount == 3) {
+        if (!IS_NUMBER(args[2]) || AS_NUMBER(args[2]) < 1) {
+            return nativeError("parallelMap() expects at least one worker.");
+        }
+        workerCount = (int)AS_NUMBER(args[2]);
+    }
+
+    ObjList* list = AS_LIST(args[0]);
+    int count = list->values.count;
+    if (workerCount > count) {
+        workerCount = count < 1 ? 1 : count;
+    }
+
+    ParallelMap map;
+    memset(&map, 0, sizeof(map));
+    pthread_mutex_init(&map.lock, NULL);
+    map.count = count;
+    map.workerCount = workerCount;
+
+    Value error = NIL_VAL;
+    map.setup = packWithGlobals(args[1], false, &error);
+    map.items = (Message**)calloc(count + 1, sizeof(Message*));
+    map.results = (Message**)calloc(count + 1, sizeof(Message*));
+    map.queues = (WorkQueue*)calloc(workerCount, sizeof(WorkQueue));
+    MapWorker* workers = (MapWorker*)calloc(workerCount, sizeof(MapWorker));
+    if (map.items == NULL || map.results == NULL || map.queues == NULL || workers == NULL) exit(1);
+    for (int i = 0; i < count && map.setup != NULL; i++) {
+        map.items[i] = packMessage(list->values.values[i], false, &error);
+        if (map.items[i] == NULL) {
+            break;
+        }
+    }
+    if (!IS_NIL(error)) {
+        free(workers);
+        freeMap(&map);
+        return error;
+    }
+
+    for (int i = 0; i < workerCount; i++) {
+        pthread_mutex_init(&map.queues[i].lock, NULL);
+        map.queues[i].head = (int)((long)count * i / workerCount);
+        map.queues[i].tail = (int)((long)count * (i + 1) / workerCount);
+    }
+
+    int started = 0;
+    for (; started < workerCount; started++) {
+        workers[started].map = &map;
+        workers[started].index = started;
+        if (pthread_create(&workers[started].id, NULL, runMapWorker, &workers[started]) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        failMap(&map, "Couldn't start a thread.");
+    } else {
+        // the workers that did start steal whatever the others would have done
+        for (int i = 0; i < started; i++) {
+            pthread_join(workers[i].id, NULL);
+        }
+    }
+    free(workers);
+
+    if (map.failed) {
+        Value failure = ERROR_VAL_PTR(map.error);
+        freeMap(&map);
+        return failure;
+    }
+
+    ObjList* results = newList();
+    push(OBJ_VAL(results));
+    for (int i = 0; i < count; i++) {
+        Value value = unpackMessage(map.results[i]);
+        if (IS_ERROR(value)) {
+            pop();
+            freeMap(&map);
+            return value;
+        }
+        push(value);
+        writeValueArray(&results->values, value);
+        results->count = results->values.count;
+        pop();
+    }
+    pop();
+    freeMap(&map);
+    return OBJ_VAL(results);
+}
+
+/**
+ * cpus native function.
+ *
+ * Returns how many CPUs are online, the default number of parallelMap workers.
+ */
+static Value cpusNative(int argCount, Value* args, ParamInfo* params) {
+    return NUMBER_VAL(cpuCount());
+}
@@ -0,0 +1,125 @@
+#!/usr/bin/python
+
+"""Runs the slo benchmarks against one or more cslo binaries.
+
+Usage:
+    python util/run_benchmarks.py [--runs N] [--baseline PATH] [--save-baseline] BINARY [BINARY ...]
+
+Each benchmark in the benchmarks directory is executed N times with every
+binary given and the best, median and standard deviation of the wall-clock
+times are reported with the peak RSS, so two builds of the interpreter
+(e.g. switch vs computed-goto dispatch) can be compared side by side.
+
+With --baseline the first binary's medians are compared against the ones
+stored in that JSON file, and the runner exits with 1 if any benchmark is
+slower by more than --threshold percent. --save-baseline writes them there instead.
+"""
+
+import argparse
+import json
+import os
+import statistics
+import subprocess  # noqa: S404
+import sys
+import time
+from pathlib import Path
+
+BENCHMARK_DIR = Path(__file__).resolve().parent.parent / "benchmarks"
+
+
+def time_run(binary: Path, script: Path) -> tuple[float, int]:
+    """Runs a single benchmark script and returns the wall-clock time and peak RSS.
+
+    Args:
+        binary (Path): the cslo binary to use
+        script (Path): the benchmark script to run
+
+    Raises:
+        subprocess.CalledProcessError: if the benchmark fails.
+
+    Returns:
+        tuple[float, int]: the elapsed time in seconds and the peak RSS in KB
+    """
+    start = time.perf_counter()
+    process = subprocess.Popen([str(binary), str(script)], stdout=subprocess.DEVNULL)  # noqa: S603
+    # wait4 gives the resource usage of just this child
+    _, status, usage = os.wait4(process.pid, 0)
+    elapsed = time.perf_counter() - start
+    process.returncode = os.waitstatus_to_exitcode(status)
+    if process.returncode != 0:
+        raise subprocess.CalledProcessError(process.returncode, process.args)
+    return elapsed, usage.ru_maxrss
+
+
+def compare(name: str, median: float, baseline: dict, threshold: float) -> tuple[str, bool]:
+    """Compares a median time against the baseline's.
+
+    Args:
+        name (str): the benchmark's name
+        median (float): the median time in seconds
+        baseline (dict): the stored baseline, benchmark name to results
+        threshold (float): how many percent slower counts as a regression
+
+    Returns:
+        tuple[str, bool]: the change to print and whether it's a regression
+    """
+    if name not in baseline:
+        return "new", False
+    change = (median / baseline[name]["median"] - 1) * 100
+    regressed = change > threshold
+    return f"{change:+.1f}%{' REGRESSION' if regressed else ''}", regressed
+
+
+def main() -> int:
+    """Entry point for the benchmark runner.
+
+    Returns:
+        int: the exit code
+    """
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("binaries", nargs="+", type=Path, help="cslo binaries to compare")
+    parser.add_argument("--runs", type=int, default=5, help="number of runs per benchmark")
+    parser.add_argument("--baseline", type=Path, help="JSON file of median times to compare the first binary against")
+    parser.add_argument("--save-baseline", action="store_true", help="write the first binary's results to --baseline")
+    parser.add_argument("--threshold", type=float, default=10, help="percent slower than the baseline to fail on")
+    args = parser.parse_args()
+
+    baseline = {}
+    if args.baseline is not None and not args.save_baseline and args.baseline.is_file():
+        baseline = json.loads(args.baseline.read_text(encoding="utf-8"))
+
+    scripts = sorted(BENCHMARK_DIR.glob("*.slo"))
+    results = {}
+    regressions = []
+    print(f"{'benchmark':<20} {'binary':<24} {'best':>9} {'median':>9} {'stddev':>9} {'peak rss':>10}  baseline")
+    for script in scripts:
+        for index, binary in enumerate(args.binaries):
+            runs = [time_run(binary, script) for _ in range(args.runs)]
+            times = [elapsed for elapsed, _ in runs]
+            median = statistics.median(times)
+            stddev = statistics.stdev(times) if len(times) > 1 else 0.0
+            rss = max(peak for _, peak in runs)
+
+            change = ""
+            if index == 0:
+                results[script.stem] = {"median": round(median, 4), "stddev": round(stddev, 4), "rss": rss}
+                if baseline:
+                    change, regressed = compare(script.stem, median, baseline, args.threshold)
+                    if regressed:
+                        regressions.append(script.stem)
+            print(
+                f"{script.stem:<20} {binary.name:<24} {min(times):>8.3f}s {median:>8.3f}s "
+                f"{stddev:>8.3f}s {rss / 1024:>7.1f} MB  {change}"
+            )
+
+    if args.save_baseline and args.baseline is not None:
+        args.baseline.write_text(json.dumps(results, indent=4, sort_keys=True) + "\n", encoding="utf-8")
+        print(f"Saved baseline to {args.baseline}")
+    if regressions:
+        print(f"Slower than the baseline by more than {args.threshold}%: {', '.join(regressions)}")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())